@@ -25,6 +25,12 @@ BOOLEAN DiopBreakOnKdAttached = TRUE;
 
 DIO_CONFIGURATION_BLOCK DiopConfigurationBlock;
 
+// Time stamp counter ticks per second, for the skew of the group port I/O. Zero if unknown.
+ULONGLONG DiopCycleFrequency = 0;
+
+// Only FastIoDeviceControl is provided.
+FAST_IO_DISPATCH DiopFastIoDispatch;
+
 
 //
 // Utility functions.
@@ -506,6 +512,98 @@ DiopIsPortRangesOverlapping(
 	return FALSE;
 }
 
+BOOLEAN
+DiopMeasurePortDescriptors(
+	IN DIO_PORT_DESCRIPTOR *Descriptors, 
+	IN ULONG DescriptorCount, 
+	OUT ULONG *DataLength)
+/**
+ *	@brief	Validates the port descriptors and calculates the data length.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Addresses and lengths are calculated in 64 bits, so no field value can wrap them around.
+ *	
+ *	@param	[in] Descriptors			Port descriptors.
+ *	@param	[in] DescriptorCount		Count of Descriptors.
+ *	@param	[out] DataLength			Receives the data length in bytes.
+ *	@return								Non-zero if every descriptor is valid and the data length
+ *										does not exceed DIO_PORT_IO_V2_MAXIMUM_DATA_LENGTH.
+ *	
+ */
+{
+	ULONGLONG Length = 0;
+	ULONG i;
+
+	for (i = 0; i < DescriptorCount; i++)
+	{
+		DIO_PORT_DESCRIPTOR *Descriptor = Descriptors + i;
+		ULONGLONG LastAddress;
+
+		if (!Descriptor->Count || !Descriptor->Width || !Descriptor->Repeat)
+		{
+			DFTRACE_DBG("[%d] Empty descriptor\n", i);
+			return FALSE;
+		}
+
+		LastAddress = (ULONGLONG)Descriptor->StartAddress + 
+			(ULONGLONG)(Descriptor->Count - 1) * Descriptor->Stride + Descriptor->Width - 1;
+
+		if (LastAddress > 0xffff)
+		{
+			DFTRACE_DBG("[%d] Port range exceeded (last port 0x%I64x)\n", i, LastAddress);
+			return FALSE;
+		}
+
+		Length += (ULONGLONG)Descriptor->Count * Descriptor->Width * Descriptor->Repeat;
+
+		if (Length > DIO_PORT_IO_V2_MAXIMUM_DATA_LENGTH)
+		{
+			DFTRACE_DBG("[%d] Data length exceeded\n", i);
+			return FALSE;
+		}
+	}
+
+	*DataLength = (ULONG)Length;
+
+	return TRUE;
+}
+
+BOOLEAN
+DiopTestPortDescriptor(
+	IN DIO_PORT_DESCRIPTOR *Descriptor, 
+	IN DIO_PORT_RANGE *AddressRangesAvailable, 
+	IN ULONG AddressRangeCount)
+/**
+ *	@brief	Tests every element of the descriptor is accessible or not.
+ *	
+ *	This function is reserved for internal use.
+ *	
+ *	@param	[in] Descriptor				Port descriptor which is validated by DiopMeasurePortDescriptors().
+ *	@param	[in] AddressRangesAvailable	Contains multiple port address ranges that claimed by PnP manager.
+ *	@param	[in] AddressRangeCount		Count of port address ranges.
+ *	@return								Returns FALSE if non-accessible, TRUE otherwise.
+ *	
+ */
+{
+	ULONG Address = Descriptor->StartAddress;
+	ULONG LastAddress = Address + (Descriptor->Count - 1) * Descriptor->Stride + Descriptor->Width - 1;
+	ULONG Count = Descriptor->Stride ? Descriptor->Count : 1;
+	ULONG i;
+
+	// Elements are inside one claimed range if the whole span is.
+	if (DioTestPortRange((USHORT)Address, (USHORT)LastAddress, AddressRangesAvailable, AddressRangeCount))
+		return TRUE;
+
+	for (i = 0; i < Count; i++, Address += Descriptor->Stride)
+	{
+		if (!DioTestPortRange((USHORT)Address, (USHORT)(Address + Descriptor->Width - 1), 
+			AddressRangesAvailable, AddressRangeCount))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
 BOOLEAN
 DiopValidatePacketBuffer(
 	IN DIO_PACKET *Packet, 
@@ -585,7 +683,13 @@ DiopValidatePacketBuffer(
 				return FALSE;
 			}
 
-			RangeCount = Packet->PortIo.RangeCount;
+			if (Packet->PortIo.RangeCount & ~(DIO_PORT_IO_RANGE_COUNT_MASK | DIO_PORT_IO_VALID_FLAGS))
+			{
+				DFTRACE_DBG("Unknown flags 0x%x\n", Packet->PortIo.RangeCount);
+				return FALSE;
+			}
+
+			RangeCount = PACKET_PORT_IO_GET_RANGE_COUNT(&Packet->PortIo);
 			if (RangeCount > DIO_MAXIMUM_PORT_RANGES)
 			{
 				DFTRACE_DBG("RangeCount %d\n", RangeCount);
@@ -603,7 +707,7 @@ DiopValidatePacketBuffer(
 			// Calculate the data length to transfer.
 			//
 
-			for (i = 0; i < Packet->PortIo.RangeCount; i++)
+			for (i = 0; i < RangeCount; i++)
 			{
 				DIO_PORT_RANGE *AddressRange = Packet->PortIo.AddressRange + i;
 
@@ -620,9 +724,9 @@ DiopValidatePacketBuffer(
 
 
 			// Port read  : InputBuffer  [RangeCount] [Ranges]
-			//              OutputBuffer [RangeCount] [Ranges] [Data]
+			//              OutputBuffer [RangeCount] [Ranges] [Data] [Timestamp]
 			// Port write : InputBuffer  [RangeCount] [Ranges] [Data]
-			//              OutputBuffer [RangeCount] [Ranges]
+			//              OutputBuffer [RangeCount] [Ranges] [Timestamp]
 
 			RequiredOutputLength = RequiredInputLength;
 
@@ -631,6 +735,20 @@ DiopValidatePacketBuffer(
 			else
 				RequiredInputLength += DataLength;
 
+			if (Packet->PortIo.RangeCount & DIO_PORT_IO_FLAG_TIMESTAMP)
+				RequiredOutputLength += sizeof(DIO_PORT_IO_TIMESTAMP);
+
+			if (Packet->PortIo.RangeCount & DIO_PORT_IO_FLAG_GROUP)
+			{
+				if (DataLength > DIO_PORT_IO_GROUP_MAXIMUM_LENGTH)
+				{
+					DFTRACE_DBG("DataLength (%d) is too long for a group\n", DataLength);
+					return FALSE;
+				}
+
+				RequiredOutputLength += sizeof(DIO_PORT_IO_SKEW);
+			}
+
 			if (InputBufferLength < RequiredInputLength || 
 				OutputBufferLength < RequiredOutputLength)
 			{
@@ -640,473 +758,1865 @@ DiopValidatePacketBuffer(
 		}
 		break;
 
-	default:
-		DFTRACE_DBG("Unknown IOCTL\n");
-		return FALSE;
-	}
+	case DIO_IOCTL_READ_PORT_V2:
+	case DIO_IOCTL_WRITE_PORT_V2:
+		//
+		// Input: Packet->PortIoV2, or Packet->MemoryIoV2 if DIO_PORT_IO_V2_FLAG_MEMORY_SPACE
+		// Output: [Data] [Timestamp] in the locked buffer
+		//
+		{
+			ULONG DescriptorCount;
+			ULONG DataLength = 0;
+			BOOLEAN MemorySpace;
 
-	return TRUE;
-}
+			if (InputBufferLength < sizeof(Packet->PortIoV2))
+				return FALSE;
 
-BOOLEAN
-DiopInternalPortIo(
-	IN USHORT BaseAddress, 
-	IN OUT PUCHAR Buffer, 
-	IN ULONG Length, 
-	IN BOOLEAN Write)
-/**
- *	@brief	Do the direct port I/O for given address.
- *	
- *	This function is reserved for internal use.
- *	
- *	@param	[in] BaseAddress			Base address to read/write.
- *	@param	[in, out] Buffer			Address of buffer.
- *	@param	[in] Length					Length in bytes to read/write.
- *	@param	[in] Write					Port input if FALSE, port output otherwise.
- *	@return								Non-zero if successful.
- *	
- */
-{
-	ULONG i;
-	ULONG Address;
+			if (Packet->PortIoV2.Version != DIO_PORT_IO_VERSION2 || 
+				(Packet->PortIoV2.Flags & ~DIO_PORT_IO_V2_VALID_FLAGS))
+			{
+				DFTRACE_DBG("Version %d, Flags 0x%x\n", Packet->PortIoV2.Version, Packet->PortIoV2.Flags);
+				return FALSE;
+			}
 
-	Address = BaseAddress;
+			DescriptorCount = Packet->PortIoV2.DescriptorCount;
+			if (!DescriptorCount || DescriptorCount > DIO_PORT_IO_V2_MAXIMUM_DESCRIPTORS)
+			{
+				DFTRACE_DBG("DescriptorCount %d\n", DescriptorCount);
+				return FALSE;
+			}
 
-	if (Address >= 0x10000 || Length >= 0x10000 || Address + Length > 0x10000)
-		return FALSE;
+			MemorySpace = (BOOLEAN)((Packet->PortIoV2.Flags & DIO_PORT_IO_V2_FLAG_MEMORY_SPACE) != 0);
 
-	if (Write)
-	{
-		for (i = 0; i < Length; i++)
-			__outbyte((USHORT)(Address + i), Buffer[i]);
-	}
-	else
-	{
-		for (i = 0; i < Length; i++)
-			Buffer[i] = __inbyte((USHORT)(Address + i));
-	}
+			// Count is bounded, so the length cannot overflow.
+			if (MemorySpace)
+			{
+				if (InputBufferLength < PACKET_MEMORY_IO_V2_GET_LENGTH(DescriptorCount))
+					return FALSE;
 
-	return TRUE;
-}
+				if (!DiopMeasureMemoryDescriptors(Packet->MemoryIoV2.Descriptors, DescriptorCount, &DataLength))
+					return FALSE;
+			}
+			else
+			{
+				if (InputBufferLength < PACKET_PORT_IO_V2_GET_LENGTH(DescriptorCount))
+					return FALSE;
 
-BOOLEAN
-DioPortIo(
-	IN DIO_PORT_RANGE *Ranges, 
-	IN ULONG Count, 
-	IN DIO_PORT_RANGE *AvailableRanges, 
-	IN ULONG AvailableRangeCount, 
-	OPTIONAL IN OUT PUCHAR Buffer, 
-	IN ULONG BufferLength, 
-	OUT ULONG *TransferredLength, 
-	IN BOOLEAN Write)
-/**
- *	@brief	Do the direct port I/O for given address range.
- *	
- *	@param	[in] Ranges					Contains one or multiple port range(s).
- *	@param	[in] Count					Number of port range.
- *	@param	[in] AvailableRanges		Contains multiple port address ranges that claimed by PnP manager.
- *	@param	[in] AvailableRangeCount	Count of port address ranges.
- *	@param	[in, out, opt] Buffer		Address of I/O buffer. This parameter can be NULL.\n
- *										case 1) Buffer == NULL\n
- *										- Returns the test result whether the access is allowed or not.\n
- *										case 2) Buffer != NULL && Write == FALSE\n
- *										- Results will be copied to the Buffer.\n
- *										case 3) Buffer != NULL && Write != FALSE\n
- *										- Contents of Buffer will be sent to given address range.\n
- *	@param	[in] BufferLength			Caller-supplied buffer length in bytes.
- *	@param	[out] TransferredLength		Address of variable that receives the transferred length in bytes.
- *	@param	[in] Write					Port input if FALSE, port output otherwise.
- *	@return								Non-zero if successful.
- *	
- */
-{
-	ULONG i;
-	KIRQL Irql;
-	ULONG RequiredLength = 0;
-	ULONG IoLength = 0;
-	BOOLEAN Result = TRUE;
+				if (!DiopMeasurePortDescriptors(Packet->PortIoV2.Descriptors, DescriptorCount, &DataLength))
+					return FALSE;
+			}
 
-	DFTRACE_DBG("Range count = %d\n", Count);
-	
-	if (Count > DIO_MAXIMUM_PORT_RANGES)
-	{
-		DFTRACE_DBG("Maximum entry count exceeded\n");
-		return FALSE;
-	}
+			if (Packet->PortIoV2.Flags & DIO_PORT_IO_V2_FLAG_TIMESTAMP)
+				DataLength += sizeof(DIO_PORT_IO_TIMESTAMP);
 
-	if (!DIO_IS_OPTION_ENABLED(DIO_CFGB_ALLOW_PORT_RANGE_OVERLAP))
-	{
-		if (DiopIsPortRangesOverlapping(Ranges, Count))
-		{
-			DFTRACE_DBG("Range overlapping detected\n");
-			return FALSE;
+			if (OutputBufferLength < DataLength)
+			{
+				DFTRACE_DBG("RequiredOutputLength %d\n", DataLength);
+				return FALSE;
+			}
 		}
-	}
-
-	for (i = 0; i < Count; i++)
-	{
-		DFTRACE_DBG("[%d] 0x%x - 0x%x\n", i, Ranges[i].StartAddress, Ranges[i].EndAddress);
+		break;
 
-		if (!DioTestPortRange(Ranges[i].StartAddress, Ranges[i].EndAddress, AvailableRanges, AvailableRangeCount))
+	case DIO_IOCTL_READ_BURST:
+		//
+		// Input: Packet->ReadBurst
+		// Output: [Data] [Timestamps] in the locked buffer
+		//
 		{
-			DFTRACE_DBG("[%d] Inaccessible address range\n", i);
-			return FALSE;
-		}
-
-		RequiredLength += Ranges[i].EndAddress - Ranges[i].StartAddress + 1;
-	}
+			ULONG RangeCount;
+			ULONG FrameLength = 0;
+			ULONGLONG RequiredOutputLength;
 
-	if (!Buffer)
-	{
-		DFTRACE_DBG("Null buffer, transfer ignored\n");
-		return TRUE;
-	}
+			if (InputBufferLength < sizeof(Packet->ReadBurst))
+				return FALSE;
 
-	if (BufferLength < RequiredLength)
-	{
-		DFTRACE_DBG("Insufficient buffer length (BufferLength %d, RequiredLength %d)\n", 
-			BufferLength, RequiredLength);
-		return FALSE;
-	}
+			if (Packet->ReadBurst.Flags & ~DIO_BURST_VALID_FLAGS)
+				return FALSE;
 
-	if (Write)
-		DFTRACE_DBG("Writing to the port...\n");
-	else
-		DFTRACE_DBG("Reading from the port...\n");
+			if (!Packet->ReadBurst.FrameCount || Packet->ReadBurst.FrameCount > DIO_BURST_MAXIMUM_FRAMES)
+				return FALSE;
 
+			RangeCount = Packet->ReadBurst.RangeCount;
+			if (!RangeCount || RangeCount > DIO_MAXIMUM_PORT_RANGES || 
+				InputBufferLength < PACKET_READ_BURST_GET_LENGTH(RangeCount))
+				return FALSE;
 
-	// Only one instance at most can access the port simultaneously.
-	KeAcquireSpinLock(&DiopPortReadWriteLock, &Irql);
+			for (i = 0; i < RangeCount; i++)
+			{
+				DIO_PORT_RANGE *AddressRange = Packet->ReadBurst.AddressRange + i;
 
-	DIO_IN_DEBUG_BREAKPOINT();
+				if (AddressRange->StartAddress > AddressRange->EndAddress)
+					return FALSE;
 
-	for (i = 0; i < Count; i++)
-	{
-		ULONG Length = Ranges[i].EndAddress - Ranges[i].StartAddress + 1;
+				FrameLength += AddressRange->EndAddress - AddressRange->StartAddress + 1;
+			}
 
-#ifdef __DIO_IOCTL_TEST_MODE
-		if (Write)
-			DioDbgDumpBytes("Writing bytes", Length, 16, Buffer + IoLength);
-		else
-		{
-			ULONG j;
+			RequiredOutputLength = (ULONGLONG)FrameLength * Packet->ReadBurst.FrameCount;
+			if (RequiredOutputLength > DIO_BURST_MAXIMUM_DATA_LENGTH)
+			{
+				DFTRACE_DBG("Data length exceeded (FrameLength %d, FrameCount %d)\n", 
+					FrameLength, Packet->ReadBurst.FrameCount);
+				return FALSE;
+			}
 
-			for (j = 0; j < Length; j++)
-				Buffer[IoLength + j] = ((j & 0x0f) << 4) | (j & 0x0f);
+			if (Packet->ReadBurst.Flags & DIO_BURST_FLAG_TIMESTAMPS)
+				RequiredOutputLength += (ULONGLONG)Packet->ReadBurst.FrameCount * sizeof(LONGLONG);
 
-			DioDbgDumpBytes("Reading bytes", Length, 16, Buffer + IoLength);
-		}
-#else
-		if (!DiopInternalPortIo(Ranges[i].StartAddress, Buffer + IoLength, Length, Write))
-		{
-			DFTRACE_DBG(" *** WARNING: Unexpected I/O failure\n");
-			Result = FALSE;
-			break;
+			if (OutputBufferLength < RequiredOutputLength)
+				return FALSE;
 		}
-#endif
+		break;
 
-		IoLength += Length;
-	}
+	case DIO_IOCTL_QUERY_RESOURCES:
+		//
+		// Input: None
+		// Output: Packet->QueryResources
+		//
 
-	KeReleaseSpinLock(&DiopPortReadWriteLock, Irql);
+		if (OutputBufferLength < sizeof(Packet->QueryResources))
+			return FALSE;
+		break;
 
-	DFTRACE_DBG("Total %d bytes transferred\n", IoLength);
+	case DIO_IOCTL_QUERY_MEMORY_RESOURCES:
+		//
+		// Input: None
+		// Output: Packet->QueryMemoryResources
+		//
 
-	if (TransferredLength)
-		*TransferredLength = IoLength;
+		if (OutputBufferLength < sizeof(Packet->QueryMemoryResources))
+			return FALSE;
+		break;
 
-	return Result;
-}
+	case DIO_IOCTL_MAP_MEMORY:
+		//
+		// Input: Packet->MapMemory
+		// Output: Packet->MemoryWindow
+		//
+
+		if (InputBufferLength < sizeof(Packet->MapMemory) || 
+			OutputBufferLength < sizeof(Packet->MemoryWindow))
+			return FALSE;
+		break;
+
+	case DIO_IOCTL_UNMAP_MEMORY:
+		//
+		// Input: Packet->UnmapMemory
+		// Output: None
+		//
+
+		if (InputBufferLength < sizeof(Packet->UnmapMemory))
+			return FALSE;
+		break;
+
+	case DIO_IOCTL_WAIT_PATTERN:
+		//
+		// Input: Packet->WaitPattern (parameters)
+		// Output: Packet->WaitPattern [Data]
+		//
+
+		if (InputBufferLength < sizeof(Packet->WaitPattern))
+			return FALSE;
+
+		if ((Packet->WaitPattern.Flags & DIO_WAIT_PATTERN_FLAG_READ) && 
+			Packet->WaitPattern.ReadRange.StartAddress > Packet->WaitPattern.ReadRange.EndAddress)
+			return FALSE;
+
+		if (OutputBufferLength < PACKET_WAIT_PATTERN_GET_LENGTH(&Packet->WaitPattern))
+			return FALSE;
+		break;
+
+	case DIO_IOCTL_QUERY_CLOCK:
+		//
+		// Input: None
+		// Output: Packet->QueryClock
+		//
+
+		if (OutputBufferLength < sizeof(Packet->QueryClock))
+			return FALSE;
+		break;
+
+	case DIO_IOCTL_START_EDGE_ENGINE:
+		//
+		// Input: Packet->StartEdgeEngine
+		// Output: None
+		//
+
+		if (InputBufferLength < sizeof(Packet->StartEdgeEngine))
+			return FALSE;
+
+		if (Packet->StartEdgeEngine.ChannelCount > DIO_EDGE_MAXIMUM_CHANNELS || 
+			Packet->StartEdgeEngine.DecoderCount > DIO_EDGE_MAXIMUM_DECODERS)
+			return FALSE;
+		break;
+
+	case DIO_IOCTL_STOP_EDGE_ENGINE:
+		//
+		// Input: None
+		// Output: None
+		//
+
+		break;
+
+	case DIO_IOCTL_QUERY_EDGE_COUNTERS:
+		//
+		// Input: None
+		// Output: Packet->QueryEdgeCounters
+		//
+
+		if (OutputBufferLength < sizeof(Packet->QueryEdgeCounters))
+			return FALSE;
+		break;
+
+	case DIO_IOCTL_START_STREAM:
+		//
+		// Input: Packet->StartStream [Ranges]
+		// Output: None
+		//
+
+		if (InputBufferLength < sizeof(Packet->StartStream))
+			return FALSE;
+
+		if (!Packet->StartStream.RangeCount || Packet->StartStream.RangeCount > DIO_STREAM_MAXIMUM_RANGES)
+			return FALSE;
+
+		if (InputBufferLength < PACKET_START_STREAM_GET_LENGTH(Packet->StartStream.RangeCount))
+			return FALSE;
+		break;
+
+	case DIO_IOCTL_WRITE_STREAM:
+		//
+		// Input: Packet->WriteStream [Frames]
+		// Output: Packet->QueryStream
+		//
+
+		if (InputBufferLength < sizeof(Packet->WriteStream) || 
+			OutputBufferLength < sizeof(Packet->QueryStream))
+			return FALSE;
+		break;
+
+	case DIO_IOCTL_STOP_STREAM:
+		//
+		// Input: None
+		// Output: None
+		//
+
+		break;
+
+	case DIO_IOCTL_QUERY_STREAM:
+		//
+		// Input: None
+		// Output: Packet->QueryStream
+		//
+
+		if (OutputBufferLength < sizeof(Packet->QueryStream))
+			return FALSE;
+		break;
+
+	case DIO_IOCTL_START_SCHEDULER:
+		//
+		// Input: Packet->StartScheduler
+		// Output: None
+		//
+
+		if (InputBufferLength < sizeof(Packet->StartScheduler))
+			return FALSE;
+		break;
+
+	case DIO_IOCTL_STOP_SCHEDULER:
+		//
+		// Input: None
+		// Output: None
+		//
+
+		break;
+
+	case DIO_IOCTL_SCHEDULE_OUTPUT:
+		//
+		// Input: Packet->ScheduleOutput [Entries]
+		// Output: Packet->ScheduleOutput
+		//
+
+		if (InputBufferLength < sizeof(Packet->ScheduleOutput) || 
+			OutputBufferLength < sizeof(Packet->ScheduleOutput))
+			return FALSE;
+
+		if (Packet->ScheduleOutput.EntryCount > 
+			(InputBufferLength - sizeof(Packet->ScheduleOutput)) / sizeof(DIO_SCHEDULE_ENTRY))
+			return FALSE;
+		break;
+
+	case DIO_IOCTL_QUERY_SCHEDULER:
+		//
+		// Input: None
+		// Output: Packet->QueryScheduler [Records]
+		//
+
+		if (OutputBufferLength < sizeof(Packet->QueryScheduler))
+			return FALSE;
+		break;
+
+	case DIO_IOCTL_LOAD_REACTION:
+		//
+		// Input: Packet->LoadReaction [Instructions]
+		// Output: Packet->ReactionId
+		//
+
+		if (InputBufferLength < sizeof(Packet->LoadReaction) || 
+			OutputBufferLength < sizeof(Packet->ReactionId))
+			return FALSE;
+
+		if (Packet->LoadReaction.InstructionCount > DIO_REACTION_MAXIMUM_INSTRUCTIONS || 
+			InputBufferLength < PACKET_LOAD_REACTION_GET_LENGTH(Packet->LoadReaction.InstructionCount))
+			return FALSE;
+		break;
+
+	case DIO_IOCTL_UNLOAD_REACTION:
+		//
+		// Input: Packet->ReactionId
+		// Output: None
+		//
+
+		if (InputBufferLength < sizeof(Packet->ReactionId))
+			return FALSE;
+		break;
+
+	case DIO_IOCTL_START_REACTOR:
+		//
+		// Input: Packet->StartReactor
+		// Output: None
+		//
+
+		if (InputBufferLength < sizeof(Packet->StartReactor))
+			return FALSE;
+		break;
+
+	case DIO_IOCTL_STOP_REACTOR:
+		//
+		// Input: None
+		// Output: None
+		//
+
+		break;
+
+	case DIO_IOCTL_QUERY_REACTOR:
+		//
+		// Input: None
+		// Output: Packet->QueryReactor
+		//
+
+		if (OutputBufferLength < sizeof(Packet->QueryReactor))
+			return FALSE;
+		break;
+
+	case DIO_IOCTL_CREATE_RING:
+		//
+		// Input: Packet->CreateRing
+		// Output: Packet->RingAddress
+		//
+
+		if (InputBufferLength < sizeof(Packet->CreateRing) || 
+			OutputBufferLength < sizeof(Packet->RingAddress))
+			return FALSE;
+		break;
+
+	case DIO_IOCTL_ENTER_RING:
+		//
+		// Input: None
+		// Output: Packet->EnterRing
+		//
+
+		if (OutputBufferLength < sizeof(Packet->EnterRing))
+			return FALSE;
+		break;
+
+	case DIO_IOCTL_DESTROY_RING:
+		//
+		// Input: None
+		// Output: None
+		//
+
+		break;
+
+	case DIO_IOCTL_SET_FILE_MODE:
+		//
+		// Input: Packet->SetFileMode
+		// Output: None
+		//
+
+		if (InputBufferLength < sizeof(Packet->SetFileMode))
+			return FALSE;
+
+		if (Packet->SetFileMode.Mode > DIO_FILE_MODE_MAXIMUM)
+			return FALSE;
+
+		if (Packet->SetFileMode.Mode == DIO_FILE_MODE_REPEAT && 
+			(!Packet->SetFileMode.Width || Packet->SetFileMode.Width > DIO_FILE_MAXIMUM_WIDTH))
+			return FALSE;
+		break;
+
+	case DIO_IOCTL_MAP_SNAPSHOT:
+		//
+		// Input: None
+		// Output: Packet->SnapshotAddress
+		//
+
+		if (OutputBufferLength < sizeof(Packet->SnapshotAddress))
+			return FALSE;
+		break;
+
+	case DIO_IOCTL_START_SNAPSHOT:
+		//
+		// Input: Packet->StartSnapshot [Ranges]
+		// Output: None
+		//
+
+		if (InputBufferLength < sizeof(Packet->StartSnapshot))
+			return FALSE;
+
+		if (!Packet->StartSnapshot.RangeCount || Packet->StartSnapshot.RangeCount > DIO_SNAPSHOT_MAXIMUM_RANGES)
+			return FALSE;
+
+		if (InputBufferLength < PACKET_START_SNAPSHOT_GET_LENGTH(Packet->StartSnapshot.RangeCount))
+			return FALSE;
+		break;
+
+	case DIO_IOCTL_STOP_SNAPSHOT:
+		//
+		// Input: None
+		// Output: None
+		//
+
+		break;
+
+	case DIO_IOCTL_START_WORKER:
+		//
+		// Input: Packet->StartWorker
+		// Output: None
+		//
+
+		if (InputBufferLength < sizeof(Packet->StartWorker))
+			return FALSE;
+		break;
+
+	case DIO_IOCTL_STOP_WORKER:
+		//
+		// Input: None
+		// Output: None
+		//
+
+		break;
+
+	case DIO_IOCTL_QUERY_WORKER:
+		//
+		// Input: None
+		// Output: Packet->QueryWorker
+		//
+
+		if (OutputBufferLength < sizeof(Packet->QueryWorker))
+			return FALSE;
+		break;
+
+	default:
+		DFTRACE_DBG("Unknown IOCTL\n");
+		return FALSE;
+	}
+
+	return TRUE;
+}
 
 BOOLEAN
-DioIsRegistered(
-	VOID)
+DiopInternalPortIo(
+	IN USHORT BaseAddress, 
+	IN OUT PUCHAR Buffer, 
+	IN ULONG Length, 
+	IN BOOLEAN Write)
 /**
- *	@brief	Returns the result whether the caller process is registered or not.
+ *	@brief	Do the direct port I/O for given address.
  *	
- *	@return								Non-zero if caller is already registered.
+ *	This function is reserved for internal use.
+ *	
+ *	@param	[in] BaseAddress			Base address to read/write.
+ *	@param	[in, out] Buffer			Address of buffer.
+ *	@param	[in] Length					Length in bytes to read/write.
+ *	@param	[in] Write					Port input if FALSE, port output otherwise.
+ *	@return								Non-zero if successful.
  *	
  */
 {
-	return (BOOLEAN)(DiopRegisteredProcess == PsGetCurrentProcess());
+	ULONG i;
+	ULONG Address;
+
+	Address = BaseAddress;
+
+	if (Address >= 0x10000 || Length >= 0x10000 || Address + Length > 0x10000)
+		return FALSE;
+
+	if (Write)
+	{
+		for (i = 0; i < Length; i++)
+			__outbyte((USHORT)(Address + i), Buffer[i]);
+	}
+	else
+	{
+		for (i = 0; i < Length; i++)
+			Buffer[i] = __inbyte((USHORT)(Address + i));
+	}
+
+	return TRUE;
 }
 
 BOOLEAN
-DioRegisterSelf(
-	VOID)
+DioTransferPortRanges(
+	IN DIO_PORT_RANGE *Ranges, 
+	IN ULONG Count, 
+	IN OUT PUCHAR Buffer, 
+	IN BOOLEAN Write, 
+	OPTIONAL OUT DIO_PORT_IO_TIMESTAMP *Timestamp, 
+	OUT ULONG *TransferredLength)
 /**
- *	@brief	Registers caller process to permit port I/O access.
+ *	@brief	Transfers the validated port ranges. Caller must hold the port lock.
  *	
+ *	Called by DioPortIo() and by the port I/O worker.
+ *	
+ *	@param	[in] Ranges					Port ranges which are checked by DioPortIo().
+ *	@param	[in] Count					Number of port range.
+ *	@param	[in, out] Buffer			Data of all ranges, in the order of Ranges.
+ *	@param	[in] Write					Port input if FALSE, port output otherwise.
+ *	@param	[out, opt] Timestamp		Receives the performance counter values around the port accesses.
+ *	@param	[out] TransferredLength		Receives the transferred length in bytes.
  *	@return								Non-zero if successful.
  *	
  */
 {
-	PEPROCESS CurrentProcess = PsGetCurrentProcess();
-	PEPROCESS RegisteredProcess = NULL;
-	BOOLEAN Result = FALSE;
-	HANDLE CurrentProcessId = PsGetProcessId(CurrentProcess);
-	KIRQL Irql;
-
-	KeAcquireSpinLock(&DiopProcessLock, &Irql);
+	ULONG i;
+	ULONG IoLength = 0;
+	BOOLEAN Result = TRUE;
+
+	DIO_IN_DEBUG_BREAKPOINT();
+
+	if (Timestamp)
+		Timestamp->StartTime = KeQueryPerformanceCounter(NULL).QuadPart;
+
+	for (i = 0; i < Count; i++)
+	{
+		ULONG Length = Ranges[i].EndAddress - Ranges[i].StartAddress + 1;
+
+#ifdef __DIO_IOCTL_TEST_MODE
+		if (Write)
+			DioDbgDumpBytes("Writing bytes", Length, 16, Buffer + IoLength);
+		else
+		{
+			ULONG j;
+
+			for (j = 0; j < Length; j++)
+				Buffer[IoLength + j] = ((j & 0x0f) << 4) | (j & 0x0f);
+
+			DioDbgDumpBytes("Reading bytes", Length, 16, Buffer + IoLength);
+		}
+#else
+		if (!DiopInternalPortIo(Ranges[i].StartAddress, Buffer + IoLength, Length, Write))
+		{
+			DFTRACE_DBG(" *** WARNING: Unexpected I/O failure\n");
+			Result = FALSE;
+			break;
+		}
+#endif
+
+		IoLength += Length;
+	}
+
+	if (Timestamp)
+	{
+		LARGE_INTEGER Frequency;
+
+		Timestamp->EndTime = KeQueryPerformanceCounter(&Frequency).QuadPart;
+		Timestamp->Frequency = Frequency.QuadPart;
+	}
+
+	*TransferredLength = IoLength;
+
+	return Result;
+}
+
+BOOLEAN
+DioPortIo(
+	IN DIO_PORT_RANGE *Ranges, 
+	IN ULONG Count, 
+	IN DIO_PORT_RANGE *AvailableRanges, 
+	IN ULONG AvailableRangeCount, 
+	OPTIONAL IN OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OUT ULONG *TransferredLength, 
+	IN BOOLEAN Write, 
+	OPTIONAL OUT DIO_PORT_IO_TIMESTAMP *Timestamp)
+/**
+ *	@brief	Do the direct port I/O for given address range.
+ *	
+ *	@param	[in] Ranges					Contains one or multiple port range(s).
+ *	@param	[in] Count					Number of port range.
+ *	@param	[in] AvailableRanges		Contains multiple port address ranges that claimed by PnP manager.
+ *	@param	[in] AvailableRangeCount	Count of port address ranges.
+ *	@param	[in, out, opt] Buffer		Address of I/O buffer. This parameter can be NULL.\n
+ *										case 1) Buffer == NULL\n
+ *										- Returns the test result whether the access is allowed or not.\n
+ *										case 2) Buffer != NULL && Write == FALSE\n
+ *										- Results will be copied to the Buffer.\n
+ *										case 3) Buffer != NULL && Write != FALSE\n
+ *										- Contents of Buffer will be sent to given address range.\n
+ *	@param	[in] BufferLength			Caller-supplied buffer length in bytes.
+ *	@param	[out] TransferredLength		Address of variable that receives the transferred length in bytes.
+ *	@param	[in] Write					Port input if FALSE, port output otherwise.
+ *	@param	[out, opt] Timestamp		Receives the performance counter values around the port accesses.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	ULONG i;
+	KIRQL Irql;
+	ULONG RequiredLength = 0;
+	ULONG IoLength = 0;
+	BOOLEAN Result = TRUE;
+
+	DFTRACE_DBG("Range count = %d\n", Count);
+	
+	if (Count > DIO_MAXIMUM_PORT_RANGES)
+	{
+		DFTRACE_DBG("Maximum entry count exceeded\n");
+		return FALSE;
+	}
+
+	if (!DIO_IS_OPTION_ENABLED(DIO_CFGB_ALLOW_PORT_RANGE_OVERLAP))
+	{
+		if (DiopIsPortRangesOverlapping(Ranges, Count))
+		{
+			DFTRACE_DBG("Range overlapping detected\n");
+			return FALSE;
+		}
+	}
+
+	for (i = 0; i < Count; i++)
+	{
+		DFTRACE_DBG("[%d] 0x%x - 0x%x\n", i, Ranges[i].StartAddress, Ranges[i].EndAddress);
+
+		if (!DioTestPortRange(Ranges[i].StartAddress, Ranges[i].EndAddress, AvailableRanges, AvailableRangeCount))
+		{
+			DFTRACE_DBG("[%d] Inaccessible address range\n", i);
+			return FALSE;
+		}
+
+		RequiredLength += Ranges[i].EndAddress - Ranges[i].StartAddress + 1;
+	}
+
+	if (!Buffer)
+	{
+		DFTRACE_DBG("Null buffer, transfer ignored\n");
+		return TRUE;
+	}
+
+	if (BufferLength < RequiredLength)
+	{
+		DFTRACE_DBG("Insufficient buffer length (BufferLength %d, RequiredLength %d)\n", 
+			BufferLength, RequiredLength);
+		return FALSE;
+	}
+
+	if (Write)
+		DFTRACE_DBG("Writing to the port...\n");
+	else
+		DFTRACE_DBG("Reading from the port...\n");
+
+
+	// Worker runs the transfer with its own hold of the port lock, if it is started.
+	if (!DioPostPortIo(Ranges, Count, Buffer, Write, Timestamp, &IoLength, &Result))
+	{
+		// Only one instance at most can access the port simultaneously.
+		KeAcquireSpinLock(&DiopPortReadWriteLock, &Irql);
+		Result = DioTransferPortRanges(Ranges, Count, Buffer, Write, Timestamp, &IoLength);
+		KeReleaseSpinLock(&DiopPortReadWriteLock, Irql);
+	}
+
+	DFTRACE_DBG("Total %d bytes transferred\n", IoLength);
+
+	if (TransferredLength)
+		*TransferredLength = IoLength;
+
+	return Result;
+}
+
+BOOLEAN
+DioGroupPortIo(
+	IN DIO_PORT_RANGE *Ranges, 
+	IN ULONG Count, 
+	IN OUT PUCHAR Buffer, 
+	IN BOOLEAN Write, 
+	OPTIONAL OUT DIO_PORT_IO_TIMESTAMP *Timestamp, 
+	OUT DIO_PORT_IO_SKEW *Skew)
+/**
+ *	@brief	Do the port I/O for given address ranges as one group.
+ *	
+ *	Ports and data are staged on the stack first, so the accesses run back to back with the
+ *	interrupts disabled, with no tracing or range walk in between. A multi-byte output word
+ *	which is spread over the ports changes with the least skew.\n
+ *	Caller has tested the ranges with DioPortIo().
+ *	
+ *	@param	[in] Ranges					Port ranges which are tested by DioPortIo().
+ *	@param	[in] Count					Number of port range.
+ *	@param	[in, out] Buffer			Data of all ranges, in the order of Ranges.
+ *	@param	[in] Write					Port input if FALSE, port output otherwise.
+ *	@param	[out, opt] Timestamp		Receives the performance counter values around the port accesses.
+ *	@param	[out] Skew					Receives the skew from the first to the last port access.
+ *	@return								Non-zero if successful. Fails if the data is longer than
+ *										DIO_PORT_IO_GROUP_MAXIMUM_LENGTH.
+ *	
+ */
+{
+	USHORT Ports[DIO_PORT_IO_GROUP_MAXIMUM_LENGTH];
+	UCHAR Data[DIO_PORT_IO_GROUP_MAXIMUM_LENGTH];
+	ULONG64 FirstCycle = 0;
+	ULONG64 LastCycle = 0;
+	ULONG_PTR Flags;
+	ULONG Length = 0;
+	ULONG Address;
+	ULONG i;
+	KIRQL Irql;
+
+	for (i = 0; i < Count; i++)
+	{
+		for (Address = Ranges[i].StartAddress; Address <= Ranges[i].EndAddress; Address++)
+		{
+			if (Length == DIO_PORT_IO_GROUP_MAXIMUM_LENGTH)
+				return FALSE;
+
+			Ports[Length++] = (USHORT)Address;
+		}
+	}
+
+	if (Write)
+		RtlCopyMemory(Data, Buffer, Length);
+
+	KeAcquireSpinLock(&DiopPortReadWriteLock, &Irql);
+
+	if (Timestamp)
+		Timestamp->StartTime = KeQueryPerformanceCounter(NULL).QuadPart;
+
+	Flags = __readeflags();
+	_disable();
+
+	if (Length)
+	{
+#ifdef __DIO_IOCTL_TEST_MODE
+		FirstCycle = __rdtsc();
+
+		for (i = 0; i < Length && !Write; i++)
+			Data[i] = (UCHAR)(((i & 0x0f) << 4) | (i & 0x0f));
+#else
+		if (Write)
+		{
+			__outbyte(Ports[0], Data[0]);
+			FirstCycle = __rdtsc();
+
+			for (i = 1; i < Length; i++)
+				__outbyte(Ports[i], Data[i]);
+		}
+		else
+		{
+			Data[0] = __inbyte(Ports[0]);
+			FirstCycle = __rdtsc();
+
+			for (i = 1; i < Length; i++)
+				Data[i] = __inbyte(Ports[i]);
+		}
+#endif
+
+		LastCycle = __rdtsc();
+	}
+
+	__writeeflags(Flags);
+
+	if (Timestamp)
+	{
+		LARGE_INTEGER Frequency;
+
+		Timestamp->EndTime = KeQueryPerformanceCounter(&Frequency).QuadPart;
+		Timestamp->Frequency = Frequency.QuadPart;
+	}
+
+	KeReleaseSpinLock(&DiopPortReadWriteLock, Irql);
+
+	if (!Write)
+		RtlCopyMemory(Buffer, Data, Length);
+
+	Skew->Cycles = LastCycle - FirstCycle;
+	Skew->Nanoseconds = DiopCycleFrequency ? (ULONG)(Skew->Cycles * 1000000000 / DiopCycleFrequency) : 0;
+	Skew->PortCount = Length;
+
+	return TRUE;
+}
+
+VOID
+DioCalibrateCycleCounter(
+	VOID)
+/**
+ *	@brief	Measures the time stamp counter frequency against the performance counter.
+ *	
+ *	Called once on initialization. Stalls the processor for a millisecond.
+ *	
+ */
+{
+	LARGE_INTEGER Frequency, StartTime, EndTime;
+	ULONG64 StartCycle, EndCycle;
+
+	StartTime = KeQueryPerformanceCounter(&Frequency);
+	StartCycle = __rdtsc();
+
+	KeStallExecutionProcessor(1000);
+
+	EndTime = KeQueryPerformanceCounter(NULL);
+	EndCycle = __rdtsc();
+
+	if (EndTime.QuadPart > StartTime.QuadPart)
+	{
+		DiopCycleFrequency = (EndCycle - StartCycle) * (ULONGLONG)Frequency.QuadPart / 
+			(ULONGLONG)(EndTime.QuadPart - StartTime.QuadPart);
+	}
+
+	DFTRACE_DBG("Cycle frequency %I64u\n", DiopCycleFrequency);
+}
+
+BOOLEAN
+DioWaitPattern(
+	IN OUT DIO_PACKET_WAIT_PATTERN *WaitPattern, 
+	IN DIO_PORT_RANGE *AvailableRanges, 
+	IN ULONG AvailableRangeCount)
+/**
+ *	@brief	Polls the port until the pattern is observed or the spin time is elapsed.
+ *	
+ *	Port lock is held for each probe only, and the spin runs at PASSIVE_LEVEL, 
+ *	so the thread can be preempted between the probes.\n
+ *	Spin time is capped at DIO_WAIT_PATTERN_MAXIMUM_SPIN_TIME.
+ *	
+ *	@param	[in, out] WaitPattern		Wait parameters. Receives the results and the data.
+ *	@param	[in] AvailableRanges		Contains multiple port address ranges that claimed by PnP manager.
+ *	@param	[in] AvailableRangeCount	Count of port address ranges.
+ *	@return								Non-zero if the wait is performed (whether matched or not).
+ *	
+ */
+{
+	LARGE_INTEGER Frequency;
+	LARGE_INTEGER StartTime;
+	LARGE_INTEGER CurrentTime;
+	LONGLONG SpinTicks;
+	ULONG SpinTime;
+	ULONG PollInterval;
+	ULONG Iterations = 0;
+	ULONG ReadLength = 0;
+	BOOLEAN Read;
+	BOOLEAN Matched = FALSE;
+	UCHAR Input = 0;
+	KIRQL Irql;
+
+	if (KeGetCurrentIrql() != PASSIVE_LEVEL)
+		return FALSE;
+
+	Read = (BOOLEAN)!!(WaitPattern->Flags & DIO_WAIT_PATTERN_FLAG_READ);
+
+	if (!DioTestPortRange(WaitPattern->Port, WaitPattern->Port, AvailableRanges, AvailableRangeCount))
+	{
+		DFTRACE_DBG("Inaccessible port 0x%x\n", WaitPattern->Port);
+		return FALSE;
+	}
+
+	if (Read)
+	{
+		if (!DioTestPortRange(WaitPattern->ReadRange.StartAddress, WaitPattern->ReadRange.EndAddress, 
+			AvailableRanges, AvailableRangeCount))
+		{
+			DFTRACE_DBG("Inaccessible read range 0x%x - 0x%x\n", 
+				WaitPattern->ReadRange.StartAddress, WaitPattern->ReadRange.EndAddress);
+			return FALSE;
+		}
+
+		ReadLength = WaitPattern->ReadRange.EndAddress - WaitPattern->ReadRange.StartAddress + 1;
+	}
+
+	SpinTime = WaitPattern->MaximumSpinTime;
+	if (SpinTime > DIO_WAIT_PATTERN_MAXIMUM_SPIN_TIME)
+		SpinTime = DIO_WAIT_PATTERN_MAXIMUM_SPIN_TIME;
+
+	PollInterval = WaitPattern->PollInterval;
+	if (PollInterval > SpinTime)
+		PollInterval = SpinTime;
+
+	StartTime = KeQueryPerformanceCounter(&Frequency);
+	SpinTicks = (LONGLONG)SpinTime * Frequency.QuadPart / 1000000;
+
+	for (;;)
+	{
+		KeAcquireSpinLock(&DiopPortReadWriteLock, &Irql);
+
+#ifdef __DIO_IOCTL_TEST_MODE
+		Input = WaitPattern->Value;
+#else
+		DiopInternalPortIo(WaitPattern->Port, &Input, 1, FALSE);
+#endif
+
+		Iterations++;
+		Matched = (BOOLEAN)((Input & WaitPattern->Mask) == (WaitPattern->Value & WaitPattern->Mask));
+
+		// Read in the same lock hold so that nobody touches the ports between the match and the read.
+		if (Matched && Read)
+		{
+#ifdef __DIO_IOCTL_TEST_MODE
+			RtlZeroMemory(WaitPattern->Data, ReadLength);
+#else
+			DiopInternalPortIo(WaitPattern->ReadRange.StartAddress, WaitPattern->Data, ReadLength, FALSE);
+#endif
+		}
+
+		KeReleaseSpinLock(&DiopPortReadWriteLock, Irql);
+
+		CurrentTime = KeQueryPerformanceCounter(NULL);
+
+		if (Matched || CurrentTime.QuadPart - StartTime.QuadPart >= SpinTicks)
+			break;
+
+		if (PollInterval)
+			KeStallExecutionProcessor(PollInterval);
+		else
+			YieldProcessor();
+	}
+
+	WaitPattern->Matched = Matched;
+	WaitPattern->ObservedValue = Input;
+	WaitPattern->ElapsedTime = (ULONG)((CurrentTime.QuadPart - StartTime.QuadPart) * 1000000 / Frequency.QuadPart);
+	WaitPattern->Iterations = Iterations;
+
+	DFTRACE_DBG("Matched %d, value 0x%02x, %d us, %d iterations\n", 
+		Matched, Input, WaitPattern->ElapsedTime, Iterations);
+
+	return TRUE;
+}
+
+BOOLEAN
+DioIsRegistered(
+	VOID)
+/**
+ *	@brief	Returns the result whether the caller process is registered or not.
+ *	
+ *	@return								Non-zero if caller is already registered.
+ *	
+ */
+{
+	return (BOOLEAN)(DiopRegisteredProcess == PsGetCurrentProcess());
+}
+
+BOOLEAN
+DioRegisterSelf(
+	VOID)
+/**
+ *	@brief	Registers caller process to permit port I/O access.
+ *	
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	PEPROCESS CurrentProcess = PsGetCurrentProcess();
+	PEPROCESS RegisteredProcess = NULL;
+	BOOLEAN Result = FALSE;
+	HANDLE CurrentProcessId = PsGetProcessId(CurrentProcess);
+	KIRQL Irql;
+
+	KeAcquireSpinLock(&DiopProcessLock, &Irql);
+
+	RegisteredProcess = (PEPROCESS)InterlockedCompareExchangePointer((PVOID *)&DiopRegisteredProcess, (PVOID)CurrentProcess, 0);
+	if (!RegisteredProcess)
+	{
+		ObfReferenceObject(CurrentProcess);
+		Result = TRUE;
+	}
+
+	KeReleaseSpinLock(&DiopProcessLock, Irql);
+	
+	if (Result)
+		DFTRACE("Registered %d\n", CurrentProcessId);
+	else
+		DFTRACE("Failed to register %d because it is already registered\n", CurrentProcessId);
+
+
+	return Result;
+}
+
+BOOLEAN
+DioUnregister(
+	VOID)
+/**
+ *	@brief	Unregisters caller process.
+ *	
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	PEPROCESS RegisteredProcess = NULL;
+	PEPROCESS CurrentProcess = PsGetCurrentProcess();
+	BOOLEAN Result = FALSE;
+	HANDLE RegisteredProcessId;
+	KIRQL Irql;
+
+	KeAcquireSpinLock(&DiopProcessLock, &Irql);
+
+	RegisteredProcess = (PEPROCESS)InterlockedCompareExchangePointer((PVOID *)&DiopRegisteredProcess, 0, (PVOID)CurrentProcess);
+	if (RegisteredProcess == CurrentProcess)
+	{
+		RegisteredProcessId = PsGetProcessId(RegisteredProcess);
+		ObfDereferenceObject(RegisteredProcess);
+		Result = TRUE;
+	}
+
+	KeReleaseSpinLock(&DiopProcessLock, Irql);
+
+	if (Result)
+		DFTRACE("Unregistered %d\n", RegisteredProcessId);
+	else
+		DFTRACE("Failed to unregister because current process is not in registered state\n");
+
+	return Result;
+}
+
+BOOLEAN
+DioForceUnregister(
+	IN HANDLE UnregisterProcessId)
+/**
+ *	@brief	Forcibly unregisters specified process.
+ *	
+ *	@param	[in] UnregisterProcessId	Process id to unregister.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	BOOLEAN Unregistered = FALSE;
+	PEPROCESS RegisteredProcess;
+	KIRQL Irql;
+
+//	DFTRACE("Trying to unregister %d\n", UnregisterProcessId);
+
+	// Acquire the lock so following code is not executed simultaneously.
+	KeAcquireSpinLock(&DiopProcessLock, &Irql);
+
+	RegisteredProcess = (PEPROCESS)InterlockedCompareExchangePointer((PVOID *)&DiopRegisteredProcess, 0, 0);
+
+	if (RegisteredProcess)
+	{
+		if (UnregisterProcessId == PsGetProcessId(RegisteredProcess))
+		{
+			// Use xchg instead
+			InterlockedExchangePointer((PVOID *)&DiopRegisteredProcess, 0);
+
+			// OK, dereference it
+			ObfDereferenceObject(RegisteredProcess);
+
+			Unregistered = TRUE;
+		}
+	}
+
+	KeReleaseSpinLock(&DiopProcessLock, Irql);
+
+	if (Unregistered)
+		DFTRACE("Unregistered %d\n", UnregisterProcessId);
+
+	return Unregistered;
+}
+
+
+//
+// Our callback function.
+//
+
+VOID
+DiopCreateProcessNotifyRoutine(
+	IN HANDLE ParentId, 
+	IN HANDLE ProcessId, 
+	IN BOOLEAN Create)
+/**
+ *	@brief	Our process notify routine.
+ *	
+ *	This function is reserved for internal use.
+ *
+ *	@param	[in] ParentId				ID of parent process.
+ *	@param	[in] ProcessId				ID of target process.
+ *	@param	[in] Create					Zero for process deletion. Other values for process creation.
+ *	@return								None.
+ *	
+ */
+{
+	UNREFERENCED_PARAMETER(ParentId);
+
+	if (!Create)
+	{
+		DioForceUnregister(ProcessId);
+	}
+}
+
+
+//
+// Our dispatch function.
+//
+
+NTSTATUS
+DioDispatchNotSupported(
+	IN PDEVICE_OBJECT DeviceObject, 
+	IN PIRP Irp)
+/**
+ *	@brief	Default dispatch routine for not supported functions.
+ *	
+ *	@param	[in] DeviceObject			Device object.
+ *	@param	[in] Irp					Irp object.
+ *	@return								STATUS_NOT_SUPPORTED always.
+ *	
+ */
+{
+	NTSTATUS Status = STATUS_NOT_SUPPORTED;
+	PIO_STACK_LOCATION IoStackLocation = IoGetCurrentIrpStackLocation(Irp);
+
+	UNREFERENCED_PARAMETER(DeviceObject);
+
+	DFTRACE("Major %d, Minor %d\n", IoStackLocation->MajorFunction, IoStackLocation->MinorFunction);
+
+	Irp->IoStatus.Status = Status;
+	Irp->IoStatus.Information = 0;
+
+	IofCompleteRequest(Irp, IO_NO_INCREMENT);
+
+	return Status;
+}
+
+NTSTATUS
+DioDispatchSystemControl(
+	IN PDEVICE_OBJECT DeviceObject, 
+	IN PIRP Irp)
+/**
+ *	@brief	Dispatch routine for IRP_MJ_SYSTEM_CONTROL.
+ *
+ *  This routine does nothing without passing down IRP to the lower level device.
+ *	
+ *	@param	[in] DeviceObject			Device object.
+ *	@param	[in] Irp					Irp object.
+ *	@return								STATUS_SUCCESS always.
+ *	
+ */
+{
+	// I hate WMI...
+	DIO_DEVICE_EXTENSION *DeviceExtension = (DIO_DEVICE_EXTENSION *)DeviceObject->DeviceExtension;
+
+	IoSkipCurrentIrpStackLocation(Irp);
+	return IoCallDriver(DeviceExtension->LowerLevelDeviceObject, Irp);
+}
+
+NTSTATUS
+DioDispatchCreate(
+	IN PDEVICE_OBJECT DeviceObject, 
+	IN PIRP Irp)
+/**
+ *	@brief	Dispatch routine for IRP_MJ_CREATE.
+ *	
+ *	@param	[in] DeviceObject			Device object.
+ *	@param	[in] Irp					Irp object.
+ *	@return								STATUS_SUCCESS always.
+ *	
+ */
+{
+	NTSTATUS Status = STATUS_SUCCESS;
+
+	UNREFERENCED_PARAMETER(DeviceObject);
+
+	if (!DioRegisterSelf())
+	{
+		DFTRACE("Process 0x%p is already registered\n", DiopRegisteredProcess);
+		Status = STATUS_ACCESS_DENIED;
+	}
+
+	Irp->IoStatus.Status = Status;
+	Irp->IoStatus.Information = 0;
+
+	IofCompleteRequest(Irp, IO_NO_INCREMENT);
+
+	return Status;
+}
+
+NTSTATUS
+DioDispatchClose(
+	IN PDEVICE_OBJECT DeviceObject, 
+	IN PIRP Irp)
+/**
+ *	@brief	Dispatch routine for IRP_MJ_CLOSE.
+ *	
+ *	@param	[in] DeviceObject			Device object.
+ *	@param	[in] Irp					Irp object.
+ *	@return								STATUS_SUCCESS always.
+ *	
+ */
+{
+	UNREFERENCED_PARAMETER(DeviceObject);
+
+	Irp->IoStatus.Status = STATUS_SUCCESS;
+	Irp->IoStatus.Information = 0;
+
+	IofCompleteRequest(Irp, IO_NO_INCREMENT);
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+DioDispatchCleanup(
+	IN PDEVICE_OBJECT DeviceObject, 
+	IN PIRP Irp)
+/**
+ *	@brief	Dispatch routine for IRP_MJ_CLEANUP.
+ *	
+ *	@param	[in] DeviceObject			Device object.
+ *	@param	[in] Irp					Irp object.
+ *	@return								STATUS_SUCCESS always.
+ *	
+ */
+{
+	PIO_STACK_LOCATION IoStackLocation = IoGetCurrentIrpStackLocation(Irp);
+
+	UNREFERENCED_PARAMETER(DeviceObject);
+
+	// Ring, snapshot page and memory windows belong to the handle which mapped them, so they are
+	// released with it even if the process is already unregistered, and kept for other handles.
+	DioDestroyRing(IoStackLocation->FileObject);
+	DioUnmapSnapshot(IoStackLocation->FileObject);
+	DioUnmapMemoryWindows(IoStackLocation->FileObject);
+
+	// Engines belong to the registered process.
+	if (DioIsRegistered())
+	{
+		DioStopEdgeEngine();
+		DioStopStream();
+		DioStopScheduler();
+		DioStopReactor();
+		DioUnloadReaction(DIO_REACTION_ALL_PROGRAMS);
+		DioStopPortWorker();
+	}
+
+	DioUnregister();
+
+	Irp->IoStatus.Status = STATUS_SUCCESS;
+	Irp->IoStatus.Information = 0;
+
+	IofCompleteRequest(Irp, IO_NO_INCREMENT);
+
+	return STATUS_SUCCESS;
+}
+
+VOID
+DiopFileIoSegment(
+	IN USHORT Port, 
+	IN OUT PUCHAR Buffer, 
+	IN ULONG Length, 
+	IN BOOLEAN Fifo, 
+	IN BOOLEAN Write)
+/**
+ *	@brief	Transfers the bytes to the consecutive ports, or to one port if Fifo.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Caller holds the port lock and has tested the ports.
+ *	
+ *	@param	[in] Port					First port, or the only port if Fifo.
+ *	@param	[in, out] Buffer			Address of buffer.
+ *	@param	[in] Length					Length in bytes to read/write.
+ *	@param	[in] Fifo					Every byte goes to the same port.
+ *	@param	[in] Write					Port input if FALSE, port output otherwise.
+ *	
+ */
+{
+#ifdef __DIO_IOCTL_TEST_MODE
+	ULONG i;
+
+	UNREFERENCED_PARAMETER(Port);
+	UNREFERENCED_PARAMETER(Fifo);
+
+	if (Write)
+		DioDbgDumpBytes("Writing bytes", Length, 16, Buffer);
+	else
+	{
+		for (i = 0; i < Length; i++)
+			Buffer[i] = ((i & 0x0f) << 4) | (i & 0x0f);
+
+		DioDbgDumpBytes("Reading bytes", Length, 16, Buffer);
+	}
+#else
+	if (!Fifo)
+		DiopInternalPortIo(Port, Buffer, Length, Write);
+	else if (Write)
+		__outbytestring(Port, Buffer, Length);
+	else
+		__inbytestring(Port, Buffer, Length);
+#endif
+}
+
+NTSTATUS
+DiopFileIo(
+	IN DIO_DEVICE_EXTENSION *DeviceExtension, 
+	IN PVOID FileContext, 
+	IN ULONG Port, 
+	IN OUT PUCHAR Buffer, 
+	IN ULONG Length, 
+	IN BOOLEAN Write)
+/**
+ *	@brief	Runs the read/write of the handle in its file mode.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Port lock is held for DIO_FILE_IO_CHUNK_LENGTH bytes at most, so other port accesses
+ *	can run in between the chunks of a long transfer.
+ *	
+ *	@param	[in] DeviceExtension		Device extension.
+ *	@param	[in] FileContext			File mode of the handle. See DIO_FILE_CONTEXT().
+ *	@param	[in] Port					Port address, which is the file offset.
+ *	@param	[in, out] Buffer			System address of the caller's buffer.
+ *	@param	[in] Length					Length in bytes to read/write. Must be non-zero.
+ *	@param	[in] Write					Port input if FALSE, port output otherwise.
+ *	@return								STATUS_SUCCESS if successful.
+ *	
+ */
+{
+	ULONG Mode = DIO_FILE_CONTEXT_MODE(FileContext);
+	ULONG Width;
+	ULONG Phase = 0;
+	ULONG Done = 0;
+	KIRQL Irql;
+
+	switch (Mode)
+	{
+	case DIO_FILE_MODE_FIFO:
+		Width = 1;
+		break;
+
+	case DIO_FILE_MODE_REPEAT:
+		Width = DIO_FILE_CONTEXT_WIDTH(FileContext);
+		break;
+
+	default:
+		Width = Length;
+	}
+
+	if (Port >= 0x10000 || Width > 0x10000 - Port)
+	{
+		DFTRACE_DBG("Port range exceeded (Port 0x%x, Width %d)\n", Port, Width);
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	if (!DioTestPortRange((USHORT)Port, (USHORT)(Port + Width - 1), 
+		DeviceExtension->PortResources, DeviceExtension->PortRangeCount))
+	{
+		DFTRACE_DBG("Inaccessible address range 0x%x - 0x%x\n", Port, Port + Width - 1);
+		return STATUS_ACCESS_DENIED;
+	}
+
+	DFTRACE_DBG("%s %d bytes at 0x%x, mode %d\n", Write ? "Writing" : "Reading", Length, Port, Mode);
+
+	while (Done < Length)
+	{
+		ULONG ChunkEnd = Done + min(Length - Done, DIO_FILE_IO_CHUNK_LENGTH);
+
+		KeAcquireSpinLock(&DiopPortReadWriteLock, &Irql);
+
+		while (Done < ChunkEnd)
+		{
+			// One segment ends at the chunk end or at the end of the cycle.
+			ULONG SegmentLength = (Mode == DIO_FILE_MODE_FIFO) ? 
+				ChunkEnd - Done : min(ChunkEnd - Done, Width - Phase);
+
+			DiopFileIoSegment((USHORT)(Port + Phase), Buffer + Done, SegmentLength, 
+				(BOOLEAN)(Mode == DIO_FILE_MODE_FIFO), Write);
+
+			Done += SegmentLength;
+
+			if (Mode == DIO_FILE_MODE_REPEAT)
+			{
+				Phase += SegmentLength;
+				if (Phase == Width)
+					Phase = 0;
+			}
+			else if (Mode != DIO_FILE_MODE_FIFO)
+				Phase = Done;
+		}
+
+		KeReleaseSpinLock(&DiopPortReadWriteLock, Irql);
+	}
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+DioDispatchReadWrite(
+	IN PDEVICE_OBJECT DeviceObject, 
+	IN PIRP Irp)
+/**
+ *	@brief	Dispatch routine for IRP_MJ_READ and IRP_MJ_WRITE.
+ *	
+ *	File offset is the port address and the length is the byte count. Buffer is passed by
+ *	direct I/O, so the bulk transfer needs no packet header and no copy of the data.\n
+ *	How the bytes map to the ports is set per handle by DIO_IOCTL_SET_FILE_MODE.
+ *	
+ *	@param	[in] DeviceObject			Device object.
+ *	@param	[in] Irp					Irp object.
+ *	@return								STATUS_SUCCESS if successful.
+ *	
+ */
+{
+	DIO_DEVICE_EXTENSION *DeviceExtension = (DIO_DEVICE_EXTENSION *)DeviceObject->DeviceExtension;
+	PIO_STACK_LOCATION IoStackLocation = IoGetCurrentIrpStackLocation(Irp);
+	BOOLEAN Write = (BOOLEAN)(IoStackLocation->MajorFunction == IRP_MJ_WRITE);
+	LARGE_INTEGER Offset;
+	ULONG Length;
+	PUCHAR Buffer;
+	NTSTATUS Status = STATUS_SUCCESS;
 
-	RegisteredProcess = (PEPROCESS)InterlockedCompareExchangePointer((PVOID *)&DiopRegisteredProcess, (PVOID)CurrentProcess, 0);
-	if (!RegisteredProcess)
+	if (Write)
 	{
-		ObfReferenceObject(CurrentProcess);
-		Result = TRUE;
+		Offset = IoStackLocation->Parameters.Write.ByteOffset;
+		Length = IoStackLocation->Parameters.Write.Length;
 	}
-
-	KeReleaseSpinLock(&DiopProcessLock, Irql);
-	
-	if (Result)
-		DFTRACE("Registered %d\n", CurrentProcessId);
 	else
-		DFTRACE("Failed to register %d because it is already registered\n", CurrentProcessId);
+	{
+		Offset = IoStackLocation->Parameters.Read.ByteOffset;
+		Length = IoStackLocation->Parameters.Read.Length;
+	}
 
+	do
+	{
+		if (!DioIsRegistered())
+		{
+			DFTRACE("Process %d is not allowed\n", PsGetProcessId(PsGetCurrentProcess()));
+			Status = STATUS_ACCESS_DENIED;
+			break;
+		}
 
-	return Result;
+		if (Offset.QuadPart < 0 || Offset.QuadPart >= 0x10000)
+		{
+			Status = STATUS_INVALID_PARAMETER;
+			break;
+		}
+
+		if (!Length)
+			break;
+
+		Buffer = (PUCHAR)MmGetSystemAddressForMdlSafe(Irp->MdlAddress, NormalPagePriority);
+		if (!Buffer)
+		{
+			Status = STATUS_INSUFFICIENT_RESOURCES;
+			break;
+		}
+
+		Status = DiopFileIo(DeviceExtension, IoStackLocation->FileObject->FsContext2, 
+			Offset.LowPart, Buffer, Length, Write);
+	} while (FALSE);
+
+	Irp->IoStatus.Status = Status;
+	Irp->IoStatus.Information = NT_SUCCESS(Status) ? Length : 0;
+
+	IofCompleteRequest(Irp, IO_NO_INCREMENT);
+
+	return Status;
 }
 
-BOOLEAN
-DioUnregister(
-	VOID)
+NTSTATUS
+DiopDispatchPortIo(
+	IN DIO_DEVICE_EXTENSION *DeviceExtension, 
+	IN OUT DIO_PACKET *Packet, 
+	IN ULONG IoControlCode, 
+	IN ULONG InputBufferLength, 
+	IN ULONG OutputBufferLength, 
+	OUT ULONG *OutputActualLength)
 /**
- *	@brief	Unregisters caller process.
+ *	@brief	Runs the validated port read/write packet.
  *	
- *	@return								Non-zero if successful.
+ *	This function is reserved for internal use.\n
+ *	Shared by the IRP path and the fast I/O path, so both complete the packet in the same way.
+ *	
+ *	@param	[in] DeviceExtension		Device extension.
+ *	@param	[in, out] Packet			Packet which is validated by DiopValidatePacketBuffer().
+ *	@param	[in] IoControlCode			DIO_IOCTL_READ_PORT or DIO_IOCTL_WRITE_PORT.
+ *	@param	[in] InputBufferLength		Input length of Packet.
+ *	@param	[in] OutputBufferLength		Output length of Packet.
+ *	@param	[out] OutputActualLength	Receives the output length.
+ *	@return								STATUS_SUCCESS if successful.
  *	
  */
 {
-	PEPROCESS RegisteredProcess = NULL;
-	PEPROCESS CurrentProcess = PsGetCurrentProcess();
-	BOOLEAN Result = FALSE;
-	HANDLE RegisteredProcessId;
-	KIRQL Irql;
+	DIO_PORT_IO_TIMESTAMP Timestamp;
+	DIO_PORT_IO_SKEW Skew;
+	BOOLEAN Write = (BOOLEAN)(IoControlCode == DIO_IOCTL_WRITE_PORT);
+	BOOLEAN Group = (BOOLEAN)((Packet->PortIo.RangeCount & DIO_PORT_IO_FLAG_GROUP) != 0);
+	ULONG RangeCount;
+	ULONG DataOffset;
+	ULONG Length = 0;
+
+	DFTRACE_DBG("Port %s request from process %d\n", Write ? "write" : "read", 
+		PsGetProcessId(PsGetCurrentProcess()));
+
+	*OutputActualLength = 0;
+
+	RangeCount = PACKET_PORT_IO_GET_RANGE_COUNT(&Packet->PortIo);
+	DataOffset = PACKET_PORT_IO_GET_LENGTH(RangeCount);
+
+	// Group is only tested here, then run by DioGroupPortIo().
+	if (!DioPortIo(Packet->PortIo.AddressRange, 
+					RangeCount, 
+					DeviceExtension->PortResources, 
+					DeviceExtension->PortRangeCount, 
+					Group ? NULL : PACKET_PORT_IO_GET_DATA_ADDRESS(&Packet->PortIo), 
+					(Write ? InputBufferLength : OutputBufferLength) - DataOffset, 
+					Write ? NULL : &Length, 
+					Write, 
+					(Packet->PortIo.RangeCount & DIO_PORT_IO_FLAG_TIMESTAMP) ? &Timestamp : NULL))
+	{
+		DFTRACE_DBG("I/O failed\n");
+		return STATUS_UNSUCCESSFUL;
+	}
 
-	KeAcquireSpinLock(&DiopProcessLock, &Irql);
+	if (Group)
+	{
+		if (!DioGroupPortIo(Packet->PortIo.AddressRange, 
+							RangeCount, 
+							PACKET_PORT_IO_GET_DATA_ADDRESS(&Packet->PortIo), 
+							Write, 
+							(Packet->PortIo.RangeCount & DIO_PORT_IO_FLAG_TIMESTAMP) ? &Timestamp : NULL, 
+							&Skew))
+		{
+			DFTRACE_DBG("Group I/O failed\n");
+			return STATUS_UNSUCCESSFUL;
+		}
 
-	RegisteredProcess = (PEPROCESS)InterlockedCompareExchangePointer((PVOID *)&DiopRegisteredProcess, 0, (PVOID)CurrentProcess);
-	if (RegisteredProcess == CurrentProcess)
+		Length = Write ? 0 : Skew.PortCount;
+	}
+
+	// Data is not returned for write, so the timestamp follows the ranges.
+	Length += DataOffset;
+
+	if (Packet->PortIo.RangeCount & DIO_PORT_IO_FLAG_TIMESTAMP)
 	{
-		RegisteredProcessId = PsGetProcessId(RegisteredProcess);
-		ObfDereferenceObject(RegisteredProcess);
-		Result = TRUE;
+		RtlCopyMemory((PUCHAR)Packet + Length, &Timestamp, sizeof(Timestamp));
+		Length += sizeof(Timestamp);
 	}
 
-	KeReleaseSpinLock(&DiopProcessLock, Irql);
+	if (Group)
+	{
+		RtlCopyMemory((PUCHAR)Packet + Length, &Skew, sizeof(Skew));
+		Length += sizeof(Skew);
+	}
 
-	if (Result)
-		DFTRACE("Unregistered %d\n", RegisteredProcessId);
-	else
-		DFTRACE("Failed to unregister because current process is not in registered state\n");
+	*OutputActualLength = Length;
 
-	return Result;
+	return STATUS_SUCCESS;
 }
 
-BOOLEAN
-DioForceUnregister(
-	IN HANDLE UnregisterProcessId)
+VOID
+DiopTransferPortRun(
+	IN USHORT Port, 
+	IN OUT PUCHAR Buffer, 
+	IN ULONG Length, 
+	IN BOOLEAN Fifo, 
+	IN BOOLEAN Write, 
+	IN OUT ULONG *HeldLength, 
+	IN OUT KIRQL *Irql)
 /**
- *	@brief	Forcibly unregisters specified process.
+ *	@brief	Transfers the consecutive ports, or one port if Fifo, for the descriptor transfer.
  *	
- *	@param	[in] UnregisterProcessId	Process id to unregister.
- *	@return								Non-zero if successful.
+ *	This function is reserved for internal use.\n
+ *	Caller holds the port lock and has tested the ports. The lock is released and taken again
+ *	whenever it has been held for DIO_FILE_IO_CHUNK_LENGTH bytes.
+ *	
+ *	@param	[in] Port					First port, or the only port if Fifo.
+ *	@param	[in, out] Buffer			Address of buffer.
+ *	@param	[in] Length					Length in bytes to read/write.
+ *	@param	[in] Fifo					Every byte goes to the same port.
+ *	@param	[in] Write					Port input if FALSE, port output otherwise.
+ *	@param	[in, out] HeldLength		Bytes transferred since the port lock was taken.
+ *	@param	[in, out] Irql				IRQL which is returned by KeAcquireSpinLock().
  *	
  */
 {
-	BOOLEAN Unregistered = FALSE;
-	PEPROCESS RegisteredProcess;
-	KIRQL Irql;
+	while (Length)
+	{
+		ULONG SegmentLength = min(Length, DIO_FILE_IO_CHUNK_LENGTH - *HeldLength);
 
-//	DFTRACE("Trying to unregister %d\n", UnregisterProcessId);
+		DiopFileIoSegment(Port, Buffer, SegmentLength, Fifo, Write);
 
-	// Acquire the lock so following code is not executed simultaneously.
-	KeAcquireSpinLock(&DiopProcessLock, &Irql);
+		Buffer += SegmentLength;
+		Length -= SegmentLength;
+		*HeldLength += SegmentLength;
 
-	RegisteredProcess = (PEPROCESS)InterlockedCompareExchangePointer((PVOID *)&DiopRegisteredProcess, 0, 0);
+		if (!Fifo)
+			Port = (USHORT)(Port + SegmentLength);
 
-	if (RegisteredProcess)
-	{
-		if (UnregisterProcessId == PsGetProcessId(RegisteredProcess))
+		if (*HeldLength == DIO_FILE_IO_CHUNK_LENGTH)
 		{
-			// Use xchg instead
-			InterlockedExchangePointer((PVOID *)&DiopRegisteredProcess, 0);
-
-			// OK, dereference it
-			ObfDereferenceObject(RegisteredProcess);
-
-			Unregistered = TRUE;
+			KeReleaseSpinLock(&DiopPortReadWriteLock, *Irql);
+			KeAcquireSpinLock(&DiopPortReadWriteLock, Irql);
+			*HeldLength = 0;
 		}
 	}
-
-	KeReleaseSpinLock(&DiopProcessLock, Irql);
-
-	if (Unregistered)
-		DFTRACE("Unregistered %d\n", UnregisterProcessId);
-
-	return Unregistered;
 }
 
-
-//
-// Our callback function.
-//
-
 VOID
-DiopCreateProcessNotifyRoutine(
-	IN HANDLE ParentId, 
-	IN HANDLE ProcessId, 
-	IN BOOLEAN Create)
+DiopTransferPortDescriptors(
+	IN DIO_PORT_DESCRIPTOR *Descriptors, 
+	IN ULONG DescriptorCount, 
+	IN OUT PUCHAR Buffer, 
+	IN BOOLEAN Write, 
+	OPTIONAL OUT DIO_PORT_IO_TIMESTAMP *Timestamp)
 /**
- *	@brief	Our process notify routine.
+ *	@brief	Transfers the validated port descriptors.
  *	
- *	This function is reserved for internal use.
- *
- *	@param	[in] ParentId				ID of parent process.
- *	@param	[in] ProcessId				ID of target process.
- *	@param	[in] Create					Zero for process deletion. Other values for process creation.
- *	@return								None.
+ *	This function is reserved for internal use.\n
+ *	Back-to-back elements and single-port FIFO elements are transferred as one run, the others
+ *	element by element. Timestamp brackets the whole transfer, including the breaks of the lock.
+ *	
+ *	@param	[in] Descriptors			Port descriptors which are tested by DiopTestPortDescriptor().
+ *	@param	[in] DescriptorCount		Count of Descriptors.
+ *	@param	[in, out] Buffer			Data of all descriptors, in the order of Descriptors.
+ *	@param	[in] Write					Port input if FALSE, port output otherwise.
+ *	@param	[out, opt] Timestamp		Receives the performance counter values around the port accesses.
  *	
  */
 {
-	UNREFERENCED_PARAMETER(ParentId);
+	ULONG HeldLength = 0;
+	ULONG i, j, k;
+	KIRQL Irql;
 
-	if (!Create)
+	KeAcquireSpinLock(&DiopPortReadWriteLock, &Irql);
+
+	if (Timestamp)
+		Timestamp->StartTime = KeQueryPerformanceCounter(NULL).QuadPart;
+
+	for (i = 0; i < DescriptorCount; i++)
 	{
-		DioForceUnregister(ProcessId);
+		DIO_PORT_DESCRIPTOR Descriptor = Descriptors[i];
+		ULONG ElementsLength = (ULONG)Descriptor.Count * Descriptor.Width;
+
+		for (j = 0; j < Descriptor.Repeat; j++)
+		{
+			if (!Descriptor.Stride && Descriptor.Width == 1)
+			{
+				DiopTransferPortRun(Descriptor.StartAddress, Buffer, ElementsLength, 
+					TRUE, Write, &HeldLength, &Irql);
+			}
+			else if (Descriptor.Stride == Descriptor.Width)
+			{
+				DiopTransferPortRun(Descriptor.StartAddress, Buffer, ElementsLength, 
+					FALSE, Write, &HeldLength, &Irql);
+			}
+			else
+			{
+				for (k = 0; k < Descriptor.Count; k++)
+				{
+					DiopTransferPortRun((USHORT)(Descriptor.StartAddress + k * Descriptor.Stride), 
+						Buffer + k * Descriptor.Width, Descriptor.Width, FALSE, Write, &HeldLength, &Irql);
+				}
+			}
+
+			Buffer += ElementsLength;
+		}
 	}
-}
 
+	if (Timestamp)
+	{
+		LARGE_INTEGER Frequency;
 
-//
-// Our dispatch function.
-//
+		Timestamp->EndTime = KeQueryPerformanceCounter(&Frequency).QuadPart;
+		Timestamp->Frequency = Frequency.QuadPart;
+	}
+
+	KeReleaseSpinLock(&DiopPortReadWriteLock, Irql);
+}
 
 NTSTATUS
-DioDispatchNotSupported(
-	IN PDEVICE_OBJECT DeviceObject, 
-	IN PIRP Irp)
+DiopDispatchPortIoV2(
+	IN DIO_DEVICE_EXTENSION *DeviceExtension, 
+	IN DIO_PACKET_PORT_IO_V2 *PortIo, 
+	IN ULONG IoControlCode, 
+	IN OUT PUCHAR Buffer, 
+	OUT ULONG *OutputActualLength)
 /**
- *	@brief	Default dispatch routine for not supported functions.
+ *	@brief	Runs the validated version 2 port read/write packet.
  *	
- *	@param	[in] DeviceObject			Device object.
- *	@param	[in] Irp					Irp object.
- *	@return								STATUS_NOT_SUPPORTED always.
+ *	This function is reserved for internal use.\n
+ *	Requests are not queued to the port I/O worker, like ReadFile/WriteFile, since the lock is
+ *	held for a chunk at a time anyway.
+ *	
+ *	@param	[in] DeviceExtension		Device extension.
+ *	@param	[in] PortIo					Packet which is validated by DiopValidatePacketBuffer().
+ *	@param	[in] IoControlCode			DIO_IOCTL_READ_PORT_V2 or DIO_IOCTL_WRITE_PORT_V2.
+ *	@param	[in, out] Buffer			System address of the output buffer. [Data] [Timestamp]
+ *	@param	[out] OutputActualLength	Receives the output length.
+ *	@return								STATUS_SUCCESS if successful.
  *	
  */
 {
-	NTSTATUS Status = STATUS_NOT_SUPPORTED;
-	PIO_STACK_LOCATION IoStackLocation = IoGetCurrentIrpStackLocation(Irp);
+	DIO_PORT_IO_TIMESTAMP Timestamp;
+	BOOLEAN Write = (BOOLEAN)(IoControlCode == DIO_IOCTL_WRITE_PORT_V2);
+	BOOLEAN Timed = (BOOLEAN)((PortIo->Flags & DIO_PORT_IO_V2_FLAG_TIMESTAMP) != 0);
+	ULONG DataLength = 0;
+	ULONG i;
 
-	UNREFERENCED_PARAMETER(DeviceObject);
+	DFTRACE_DBG("Port %s request with %d descriptors\n", Write ? "write" : "read", PortIo->DescriptorCount);
 
-	DFTRACE("Major %d, Minor %d\n", IoStackLocation->MajorFunction, IoStackLocation->MinorFunction);
+	*OutputActualLength = 0;
 
-	Irp->IoStatus.Status = Status;
-	Irp->IoStatus.Information = 0;
+	if (!DiopMeasurePortDescriptors(PortIo->Descriptors, PortIo->DescriptorCount, &DataLength))
+		return STATUS_INVALID_PARAMETER;
 
-	IofCompleteRequest(Irp, IO_NO_INCREMENT);
+	for (i = 0; i < PortIo->DescriptorCount; i++)
+	{
+		if (!DiopTestPortDescriptor(PortIo->Descriptors + i, 
+			DeviceExtension->PortResources, DeviceExtension->PortRangeCount))
+		{
+			DFTRACE_DBG("[%d] Inaccessible descriptor\n", i);
+			return STATUS_ACCESS_DENIED;
+		}
+	}
 
-	return Status;
-}
+	DiopTransferPortDescriptors(PortIo->Descriptors, PortIo->DescriptorCount, Buffer, Write, 
+		Timed ? &Timestamp : NULL);
 
-NTSTATUS
-DioDispatchSystemControl(
-	IN PDEVICE_OBJECT DeviceObject, 
-	IN PIRP Irp)
-/**
- *	@brief	Dispatch routine for IRP_MJ_SYSTEM_CONTROL.
- *
- *  This routine does nothing without passing down IRP to the lower level device.
- *	
- *	@param	[in] DeviceObject			Device object.
- *	@param	[in] Irp					Irp object.
- *	@return								STATUS_SUCCESS always.
- *	
- */
-{
-	// I hate WMI...
-	DIO_DEVICE_EXTENSION *DeviceExtension = (DIO_DEVICE_EXTENSION *)DeviceObject->DeviceExtension;
+	// Data of write stays in place, so the output length is the same for read and write.
+	if (Timed)
+		RtlCopyMemory(Buffer + DataLength, &Timestamp, sizeof(Timestamp));
 
-	IoSkipCurrentIrpStackLocation(Irp);
-	return IoCallDriver(DeviceExtension->LowerLevelDeviceObject, Irp);
+	*OutputActualLength = DataLength + (Timed ? sizeof(Timestamp) : 0);
+
+	return STATUS_SUCCESS;
 }
 
-NTSTATUS
-DioDispatchCreate(
-	IN PDEVICE_OBJECT DeviceObject, 
-	IN PIRP Irp)
+VOID
+DiopTransferBurst(
+	IN DIO_PORT_RANGE *Ranges, 
+	IN ULONG RangeCount, 
+	IN ULONG FrameCount, 
+	IN ULONG FrameLength, 
+	IN BOOLEAN Planar, 
+	OUT PUCHAR Buffer, 
+	OPTIONAL OUT PUCHAR Timestamps)
 /**
- *	@brief	Dispatch routine for IRP_MJ_CREATE.
+ *	@brief	Reads the validated ranges FrameCount times.
  *	
- *	@param	[in] DeviceObject			Device object.
- *	@param	[in] Irp					Irp object.
- *	@return								STATUS_SUCCESS always.
+ *	This function is reserved for internal use.\n
+ *	A frame is never split, so each frame is a consistent snapshot. Between the frames, the port
+ *	lock is released once it has been held for DIO_FILE_IO_CHUNK_LENGTH bytes.
+ *	
+ *	@param	[in] Ranges					Port ranges which are tested by the caller.
+ *	@param	[in] RangeCount				Count of Ranges.
+ *	@param	[in] FrameCount				Count of frames.
+ *	@param	[in] FrameLength			Data length of one frame.
+ *	@param	[in] Planar					Data of each range is contiguous over the frames.
+ *	@param	[out] Buffer				Receives the data. See DIO_PACKET_READ_BURST.
+ *	@param	[out, opt] Timestamps		Receives the counter after each frame, which may be unaligned.
  *	
  */
 {
-	NTSTATUS Status = STATUS_SUCCESS;
+	ULONG HeldLength = 0;
+	ULONG Frame;
+	ULONG Offset;
+	ULONG i;
+	KIRQL Irql;
 
-	UNREFERENCED_PARAMETER(DeviceObject);
+	KeAcquireSpinLock(&DiopPortReadWriteLock, &Irql);
 
-	if (!DioRegisterSelf())
+	for (Frame = 0; Frame < FrameCount; Frame++)
 	{
-		DFTRACE("Process 0x%p is already registered\n", DiopRegisteredProcess);
-		Status = STATUS_ACCESS_DENIED;
-	}
+		if (HeldLength && HeldLength + FrameLength > DIO_FILE_IO_CHUNK_LENGTH)
+		{
+			KeReleaseSpinLock(&DiopPortReadWriteLock, Irql);
+			KeAcquireSpinLock(&DiopPortReadWriteLock, &Irql);
+			HeldLength = 0;
+		}
 
-	Irp->IoStatus.Status = Status;
-	Irp->IoStatus.Information = 0;
+		for (i = 0, Offset = 0; i < RangeCount; i++)
+		{
+			ULONG Length = Ranges[i].EndAddress - Ranges[i].StartAddress + 1;
+			PUCHAR Destination = Planar ? 
+				Buffer + Offset * FrameCount + Frame * Length : 
+				Buffer + Frame * FrameLength + Offset;
 
-	IofCompleteRequest(Irp, IO_NO_INCREMENT);
+			DiopFileIoSegment(Ranges[i].StartAddress, Destination, Length, FALSE, FALSE);
+			Offset += Length;
+		}
+
+		if (Timestamps)
+		{
+			LONGLONG Now = KeQueryPerformanceCounter(NULL).QuadPart;
+
+			RtlCopyMemory(Timestamps + Frame * sizeof(LONGLONG), &Now, sizeof(Now));
+		}
+
+		HeldLength += FrameLength;
+	}
 
-	return Status;
+	KeReleaseSpinLock(&DiopPortReadWriteLock, Irql);
 }
 
 NTSTATUS
-DioDispatchClose(
-	IN PDEVICE_OBJECT DeviceObject, 
-	IN PIRP Irp)
+DiopDispatchReadBurst(
+	IN DIO_DEVICE_EXTENSION *DeviceExtension, 
+	IN DIO_PACKET_READ_BURST *ReadBurst, 
+	OUT PUCHAR Buffer, 
+	OUT ULONG *OutputActualLength)
 /**
- *	@brief	Dispatch routine for IRP_MJ_CLOSE.
+ *	@brief	Runs the validated burst read packet.
  *	
- *	@param	[in] DeviceObject			Device object.
- *	@param	[in] Irp					Irp object.
- *	@return								STATUS_SUCCESS always.
+ *	This function is reserved for internal use.
+ *	
+ *	@param	[in] DeviceExtension		Device extension.
+ *	@param	[in] ReadBurst				Packet which is validated by DiopValidatePacketBuffer().
+ *	@param	[out] Buffer				System address of the output buffer. [Data] [Timestamps]
+ *	@param	[out] OutputActualLength	Receives the output length.
+ *	@return								STATUS_SUCCESS if successful.
  *	
  */
 {
-	UNREFERENCED_PARAMETER(DeviceObject);
+	ULONG FrameLength = 0;
+	ULONG DataLength;
+	ULONG i;
 
-	Irp->IoStatus.Status = STATUS_SUCCESS;
-	Irp->IoStatus.Information = 0;
+	DFTRACE_DBG("Burst read of %d frames, flags 0x%x\n", ReadBurst->FrameCount, ReadBurst->Flags);
 
-	IofCompleteRequest(Irp, IO_NO_INCREMENT);
+	*OutputActualLength = 0;
 
-	return STATUS_SUCCESS;
-}
+	if (!DIO_IS_OPTION_ENABLED(DIO_CFGB_ALLOW_PORT_RANGE_OVERLAP))
+	{
+		if (DiopIsPortRangesOverlapping(ReadBurst->AddressRange, ReadBurst->RangeCount))
+		{
+			DFTRACE_DBG("Range overlapping detected\n");
+			return STATUS_INVALID_PARAMETER;
+		}
+	}
 
-NTSTATUS
-DioDispatchCleanup(
-	IN PDEVICE_OBJECT DeviceObject, 
-	IN PIRP Irp)
-/**
- *	@brief	Dispatch routine for IRP_MJ_CLEANUP.
- *	
- *	@param	[in] DeviceObject			Device object.
- *	@param	[in] Irp					Irp object.
- *	@return								STATUS_SUCCESS always.
- *	
- */
-{
-	UNREFERENCED_PARAMETER(DeviceObject);
+	for (i = 0; i < ReadBurst->RangeCount; i++)
+	{
+		DIO_PORT_RANGE *Range = ReadBurst->AddressRange + i;
 
-	DioUnregister();
+		if (!DioTestPortRange(Range->StartAddress, Range->EndAddress, 
+			DeviceExtension->PortResources, DeviceExtension->PortRangeCount))
+		{
+			DFTRACE_DBG("[%d] Inaccessible address range\n", i);
+			return STATUS_ACCESS_DENIED;
+		}
 
-	Irp->IoStatus.Status = STATUS_SUCCESS;
-	Irp->IoStatus.Information = 0;
+		FrameLength += Range->EndAddress - Range->StartAddress + 1;
+	}
 
-	IofCompleteRequest(Irp, IO_NO_INCREMENT);
+	DataLength = FrameLength * ReadBurst->FrameCount;
+
+	DiopTransferBurst(ReadBurst->AddressRange, ReadBurst->RangeCount, ReadBurst->FrameCount, FrameLength, 
+		(BOOLEAN)((ReadBurst->Flags & DIO_BURST_FLAG_PLANAR) != 0), Buffer, 
+		(ReadBurst->Flags & DIO_BURST_FLAG_TIMESTAMPS) ? Buffer + DataLength : NULL);
+
+	*OutputActualLength = DataLength;
+
+	if (ReadBurst->Flags & DIO_BURST_FLAG_TIMESTAMPS)
+		*OutputActualLength += ReadBurst->FrameCount * sizeof(LONGLONG);
 
 	return STATUS_SUCCESS;
 }
@@ -1129,7 +2639,6 @@ DioDispatchIoControl(
 	ULONG IoControlCode;
 	ULONG InputBufferLength;
 	ULONG OutputBufferLength;
-	ULONG DataOffset;
 	ULONG OutputActualLength;
 	DIO_PACKET *Packet;
 	NTSTATUS Status;
@@ -1154,7 +2663,7 @@ DioDispatchIoControl(
 	do
 	{
 		//
-		// 1. Make sure that caller is already registered and using buffered IOCTL.
+		// 1. Make sure that caller is already registered and using buffered (or direct output) IOCTL.
 		//
 
 		if (!DioIsRegistered())
@@ -1167,7 +2676,8 @@ DioDispatchIoControl(
 
 		DFTRACE_DBG("IOCTL from process %d\n", PsGetProcessId(CurrentProcess));
 
-		if (METHOD_FROM_CTL_CODE(IoControlCode) != METHOD_BUFFERED)
+		if (METHOD_FROM_CTL_CODE(IoControlCode) != METHOD_BUFFERED && 
+			METHOD_FROM_CTL_CODE(IoControlCode) != METHOD_OUT_DIRECT)
 		{
 			Status = STATUS_NOT_SUPPORTED;
 			Critical = TRUE;
@@ -1211,56 +2721,363 @@ DioDispatchIoControl(
 			if (Packet->ReadWriteConfiguration.Version == DIO_DRIVER_CONFIGURATION_VERSION1)
 			{
 				DiopConfigurationBlock = Packet->ReadWriteConfiguration.ConfigurationBlock;
+				DioPublishSnapshotConfiguration();
 				OutputActualLength = sizeof(Packet->ReadWriteConfiguration);
 			}
 			break;
 
 		case DIO_IOCTL_READ_PORT:
-			// Input from the port.
-			DFTRACE_DBG("Port read request from process 0x%p (%d)\n", 
-				CurrentProcess, PsGetProcessId(CurrentProcess));
+		case DIO_IOCTL_WRITE_PORT:
+			Status = DiopDispatchPortIo(DeviceExtension, Packet, IoControlCode, 
+				InputBufferLength, OutputBufferLength, &OutputActualLength);
+			break;
+
+		case DIO_IOCTL_READ_PORT_V2:
+		case DIO_IOCTL_WRITE_PORT_V2:
+			// Data is in the output buffer which is locked by the I/O manager.
+			{
+				PUCHAR Buffer = (PUCHAR)MmGetSystemAddressForMdlSafe(Irp->MdlAddress, NormalPagePriority);
+
+				if (!Buffer)
+				{
+					Status = STATUS_INSUFFICIENT_RESOURCES;
+					break;
+				}
+
+				if (Packet->PortIoV2.Flags & DIO_PORT_IO_V2_FLAG_MEMORY_SPACE)
+				{
+					Status = DiopDispatchMemoryIoV2(DeviceExtension, &Packet->MemoryIoV2, IoControlCode, 
+						Buffer, &OutputActualLength);
+				}
+				else
+				{
+					Status = DiopDispatchPortIoV2(DeviceExtension, &Packet->PortIoV2, IoControlCode, 
+						Buffer, &OutputActualLength);
+				}
+			}
+			break;
 
-			DataOffset = PACKET_PORT_IO_GET_LENGTH(Packet->PortIo.RangeCount);
+		case DIO_IOCTL_READ_BURST:
+			// Frames are read back to back into the locked output buffer.
+			{
+				PUCHAR Buffer = (PUCHAR)MmGetSystemAddressForMdlSafe(Irp->MdlAddress, NormalPagePriority);
 
-			if (!DioPortIo(Packet->PortIo.AddressRange, 
-							Packet->PortIo.RangeCount, 
-							DeviceExtension->PortResources, 
-							DeviceExtension->PortRangeCount, 
-							PACKET_PORT_IO_GET_DATA_ADDRESS(&Packet->PortIo), 
-							OutputBufferLength - DataOffset, 
-							&OutputActualLength, 
-							FALSE))
+				if (!Buffer)
+				{
+					Status = STATUS_INSUFFICIENT_RESOURCES;
+					break;
+				}
+
+				Status = DiopDispatchReadBurst(DeviceExtension, &Packet->ReadBurst, Buffer, &OutputActualLength);
+			}
+			break;
+
+		case DIO_IOCTL_QUERY_RESOURCES:
+			// Report the claimed port ranges so that caller can validate the requests in advance.
+			DFTRACE_DBG("Query resources\n");
+			{
+				ULONG RangeCount = DeviceExtension->PortRangeCount;
+				ULONG CopyCount = (OutputBufferLength - sizeof(Packet->QueryResources)) / sizeof(DIO_PORT_RANGE);
+
+				if (CopyCount > RangeCount)
+					CopyCount = RangeCount;
+
+				Packet->QueryResources.RangeCount = RangeCount;
+				RtlCopyMemory(Packet->QueryResources.AddressRange, DeviceExtension->PortResources, 
+					CopyCount * sizeof(DIO_PORT_RANGE));
+
+				OutputActualLength = sizeof(Packet->QueryResources) + CopyCount * sizeof(DIO_PORT_RANGE);
+			}
+			break;
+
+		case DIO_IOCTL_QUERY_MEMORY_RESOURCES:
+			// Report the mapped memory resources, which the memory space descriptors index.
+			DFTRACE_DBG("Query memory resources\n");
+			DioQueryMemoryResources(DeviceExtension, &Packet->QueryMemoryResources, OutputBufferLength, 
+				&OutputActualLength);
+			break;
+
+		case DIO_IOCTL_MAP_MEMORY:
+			// Map the registers to the caller, so that it accesses them without an IOCTL.
+			DFTRACE_DBG("Map memory resource %d\n", Packet->MapMemory.Resource);
+
+			if (!DioMapMemoryWindow(DeviceExtension, &Packet->MapMemory, IoStackLocation->FileObject, 
+									&Packet->MemoryWindow))
 			{
-				DFTRACE_DBG("I/O failed\n");
 				Status = STATUS_UNSUCCESSFUL;
 				break;
 			}
 
-			OutputActualLength += PACKET_PORT_IO_GET_LENGTH(Packet->PortIo.RangeCount);
+			OutputActualLength = sizeof(Packet->MemoryWindow);
 			break;
 
-		case DIO_IOCTL_WRITE_PORT:
-			// Output to the port.
-			DFTRACE_DBG("Port write request from process 0x%p (%d)\n", 
-				CurrentProcess, PsGetProcessId(CurrentProcess));
+		case DIO_IOCTL_UNMAP_MEMORY:
+			DFTRACE_DBG("Unmap memory resource %d\n", Packet->UnmapMemory.Resource);
+
+			if (!DioUnmapMemoryWindow(Packet->UnmapMemory.Resource, IoStackLocation->FileObject))
+				Status = STATUS_UNSUCCESSFUL;
+			break;
 
-			DataOffset = PACKET_PORT_IO_GET_LENGTH(Packet->PortIo.RangeCount);
+		case DIO_IOCTL_WAIT_PATTERN:
+			// Spin-wait for the port pattern, bounded by the maximum spin time.
+			DFTRACE_DBG("Wait pattern on port 0x%x\n", Packet->WaitPattern.Port);
 
-			if (!DioPortIo(Packet->PortIo.AddressRange, 
-							Packet->PortIo.RangeCount, 
-							DeviceExtension->PortResources, 
-							DeviceExtension->PortRangeCount, 
-							PACKET_PORT_IO_GET_DATA_ADDRESS(&Packet->PortIo), 
-							InputBufferLength - DataOffset, 
-							NULL, 
-							TRUE))
+			if (!DioWaitPattern(&Packet->WaitPattern, 
+								DeviceExtension->PortResources, 
+								DeviceExtension->PortRangeCount))
+			{
+				DFTRACE_DBG("Wait failed\n");
+				Status = STATUS_UNSUCCESSFUL;
+				break;
+			}
+
+			OutputActualLength = PACKET_WAIT_PATTERN_GET_LENGTH(&Packet->WaitPattern);
+			break;
+
+		case DIO_IOCTL_QUERY_CLOCK:
+			// Sample the kernel clock so that caller can correlate it with its own clock.
+			{
+				LARGE_INTEGER Frequency;
+
+				Packet->QueryClock.Counter = KeQueryPerformanceCounter(&Frequency).QuadPart;
+				Packet->QueryClock.Frequency = Frequency.QuadPart;
+				OutputActualLength = sizeof(Packet->QueryClock);
+			}
+			break;
+
+		case DIO_IOCTL_START_EDGE_ENGINE:
+			// Start sampling the channels in the driver so that no edge is missed between the IOCTLs.
+			DFTRACE_DBG("Start edge engine\n");
+
+			if (!DioStartEdgeEngine(&Packet->StartEdgeEngine, 
+									DeviceExtension->PortResources, 
+									DeviceExtension->PortRangeCount))
+			{
+				DFTRACE_DBG("Start failed\n");
+				Status = STATUS_UNSUCCESSFUL;
+				break;
+			}
+			break;
+
+		case DIO_IOCTL_STOP_EDGE_ENGINE:
+			DFTRACE_DBG("Stop edge engine\n");
+			DioStopEdgeEngine();
+			break;
+
+		case DIO_IOCTL_QUERY_EDGE_COUNTERS:
+			DioQueryEdgeCounters(&Packet->QueryEdgeCounters);
+			OutputActualLength = sizeof(Packet->QueryEdgeCounters);
+			break;
+
+		case DIO_IOCTL_START_STREAM:
+			// Play the frames from the driver so that the output timing does not depend on the caller.
+			DFTRACE_DBG("Start stream\n");
+
+			if (!DioStartStream(&Packet->StartStream, 
+								DeviceExtension->PortResources, 
+								DeviceExtension->PortRangeCount))
+			{
+				DFTRACE_DBG("Start failed\n");
+				Status = STATUS_UNSUCCESSFUL;
+				break;
+			}
+			break;
+
+		case DIO_IOCTL_WRITE_STREAM:
+			if (!DioWriteStream(&Packet->WriteStream, InputBufferLength, &Packet->QueryStream))
+			{
+				DFTRACE_DBG("Write failed\n");
+				Status = STATUS_UNSUCCESSFUL;
+				break;
+			}
+
+			OutputActualLength = sizeof(Packet->QueryStream);
+			break;
+
+		case DIO_IOCTL_STOP_STREAM:
+			DFTRACE_DBG("Stop stream\n");
+			DioStopStream();
+			break;
+
+		case DIO_IOCTL_QUERY_STREAM:
+			DioQueryStream(&Packet->QueryStream);
+			OutputActualLength = sizeof(Packet->QueryStream);
+			break;
+
+		case DIO_IOCTL_START_SCHEDULER:
+			// Run the time-tagged writes from the driver instead of busy-waiting in the caller.
+			DFTRACE_DBG("Start scheduler\n");
+
+			if (!DioStartScheduler(&Packet->StartScheduler))
+			{
+				DFTRACE_DBG("Start failed\n");
+				Status = STATUS_UNSUCCESSFUL;
+				break;
+			}
+			break;
+
+		case DIO_IOCTL_STOP_SCHEDULER:
+			DFTRACE_DBG("Stop scheduler\n");
+			DioStopScheduler();
+			break;
+
+		case DIO_IOCTL_SCHEDULE_OUTPUT:
+			if (!DioScheduleOutput(&Packet->ScheduleOutput, 
+								   DeviceExtension->PortResources, 
+								   DeviceExtension->PortRangeCount))
+			{
+				DFTRACE_DBG("Schedule failed\n");
+				Status = STATUS_UNSUCCESSFUL;
+				break;
+			}
+
+			OutputActualLength = sizeof(Packet->ScheduleOutput);
+			break;
+
+		case DIO_IOCTL_QUERY_SCHEDULER:
+			OutputActualLength = DioQueryScheduler(&Packet->QueryScheduler, OutputBufferLength);
+			break;
+
+		case DIO_IOCTL_LOAD_REACTION:
+			// React to the inputs from the driver, within a tick, instead of a round trip to the caller.
+			DFTRACE_DBG("Load reaction\n");
+
+			if (!DioLoadReaction(&Packet->LoadReaction, 
+								 DeviceExtension->PortResources, 
+								 DeviceExtension->PortRangeCount, 
+								 &Packet->ReactionId.Id))
+			{
+				DFTRACE_DBG("Load failed\n");
+				Status = STATUS_UNSUCCESSFUL;
+				break;
+			}
+
+			OutputActualLength = sizeof(Packet->ReactionId);
+			break;
+
+		case DIO_IOCTL_UNLOAD_REACTION:
+			DFTRACE_DBG("Unload reaction %d\n", Packet->ReactionId.Id);
+
+			if (!DioUnloadReaction(Packet->ReactionId.Id))
+			{
+				DFTRACE_DBG("Unload failed\n");
+				Status = STATUS_UNSUCCESSFUL;
+				break;
+			}
+			break;
+
+		case DIO_IOCTL_START_REACTOR:
+			DFTRACE_DBG("Start reactor\n");
+
+			if (!DioStartReactor(&Packet->StartReactor))
+			{
+				DFTRACE_DBG("Start failed\n");
+				Status = STATUS_UNSUCCESSFUL;
+				break;
+			}
+			break;
+
+		case DIO_IOCTL_STOP_REACTOR:
+			DFTRACE_DBG("Stop reactor\n");
+			DioStopReactor();
+			break;
+
+		case DIO_IOCTL_QUERY_REACTOR:
+			DioQueryReactor(&Packet->QueryReactor);
+			OutputActualLength = sizeof(Packet->QueryReactor);
+			break;
+
+		case DIO_IOCTL_CREATE_RING:
+			// Port operations are queued through the shared memory instead of one IOCTL each.
+			DFTRACE_DBG("Create ring\n");
+
+			if (!DioCreateRing(&Packet->CreateRing, 
+							   DeviceExtension->PortResources, 
+							   DeviceExtension->PortRangeCount, 
+							   IoStackLocation->FileObject, 
+							   &Packet->RingAddress))
+			{
+				DFTRACE_DBG("Create failed\n");
+				Status = STATUS_UNSUCCESSFUL;
+				break;
+			}
+
+			OutputActualLength = sizeof(Packet->RingAddress);
+			break;
+
+		case DIO_IOCTL_ENTER_RING:
+			if (!DioEnterRing(&Packet->EnterRing))
+			{
+				Status = STATUS_UNSUCCESSFUL;
+				break;
+			}
+
+			OutputActualLength = sizeof(Packet->EnterRing);
+			break;
+
+		case DIO_IOCTL_DESTROY_RING:
+			DFTRACE_DBG("Destroy ring\n");
+			DioDestroyRing(IoStackLocation->FileObject);
+			break;
+
+		case DIO_IOCTL_MAP_SNAPSHOT:
+			// Map the page which readers take the latest inputs from, without an IOCTL.
+			DFTRACE_DBG("Map snapshot\n");
+
+			if (!DioMapSnapshot(IoStackLocation->FileObject, &Packet->SnapshotAddress))
+			{
+				DFTRACE_DBG("Map failed\n");
+				Status = STATUS_UNSUCCESSFUL;
+				break;
+			}
+
+			OutputActualLength = sizeof(Packet->SnapshotAddress);
+			break;
+
+		case DIO_IOCTL_START_SNAPSHOT:
+			DFTRACE_DBG("Start snapshot\n");
+
+			if (!DioStartSnapshot(&Packet->StartSnapshot, 
+									DeviceExtension->PortResources, 
+									DeviceExtension->PortRangeCount))
+			{
+				DFTRACE_DBG("Start failed\n");
+				Status = STATUS_UNSUCCESSFUL;
+				break;
+			}
+			break;
+
+		case DIO_IOCTL_STOP_SNAPSHOT:
+			DFTRACE_DBG("Stop snapshot\n");
+			DioStopSnapshot();
+			break;
+
+		case DIO_IOCTL_START_WORKER:
+			// Port reads and writes are run by one thread instead of contending for the port lock.
+			DFTRACE_DBG("Start worker\n");
+
+			if (!DioStartPortWorker(&Packet->StartWorker))
 			{
-				DFTRACE_DBG("I/O failed\n");
+				DFTRACE_DBG("Start failed\n");
 				Status = STATUS_UNSUCCESSFUL;
 				break;
 			}
+			break;
 
-			OutputActualLength += PACKET_PORT_IO_GET_LENGTH(Packet->PortIo.RangeCount);
+		case DIO_IOCTL_STOP_WORKER:
+			DFTRACE_DBG("Stop worker\n");
+			DioStopPortWorker();
+			break;
+
+		case DIO_IOCTL_QUERY_WORKER:
+			DioQueryPortWorker(&Packet->QueryWorker);
+			OutputActualLength = sizeof(Packet->QueryWorker);
+			break;
+
+		case DIO_IOCTL_SET_FILE_MODE:
+			DFTRACE_DBG("Set file mode %d, width %d\n", Packet->SetFileMode.Mode, Packet->SetFileMode.Width);
+			IoStackLocation->FileObject->FsContext2 = DIO_FILE_CONTEXT(Packet->SetFileMode.Mode, 
+				(Packet->SetFileMode.Mode == DIO_FILE_MODE_REPEAT) ? Packet->SetFileMode.Width : 0);
 			break;
 
 		default:
@@ -1281,6 +3098,105 @@ DioDispatchIoControl(
 	return Status;
 }
 
+BOOLEAN
+DioFastIoDeviceControl(
+	IN PFILE_OBJECT FileObject, 
+	IN BOOLEAN Wait, 
+	OPTIONAL IN PVOID InputBuffer, 
+	IN ULONG InputBufferLength, 
+	OPTIONAL OUT PVOID OutputBuffer, 
+	IN ULONG OutputBufferLength, 
+	IN ULONG IoControlCode, 
+	OUT PIO_STATUS_BLOCK IoStatus, 
+	IN PDEVICE_OBJECT DeviceObject)
+/**
+ *	@brief	Fast I/O routine for IRP_MJ_DEVICE_CONTROL.
+ *	
+ *	Runs the small port read/write without the IRP, which costs more than the port accesses.
+ *	Returns FALSE for anything else, for the request which fails the validation, or if the caller
+ *	cannot wait, so the I/O manager falls back to DioDispatchIoControl() which handles and reports it.\n
+ *	Buffers are the caller's, so the packet is copied to the stack before it is validated.
+ *	Once the ports are accessed, the request is completed here, so it is never run twice.
+ *	
+ *	@param	[in] FileObject				File object.
+ *	@param	[in] Wait					Whether the caller can wait. The request goes to the IRP path
+ *										if not, as the port lock may be held by the port I/O worker.
+ *	@param	[in, opt] InputBuffer		Caller's input buffer.
+ *	@param	[in] InputBufferLength		Length of InputBuffer.
+ *	@param	[out, opt] OutputBuffer		Caller's output buffer.
+ *	@param	[in] OutputBufferLength		Length of OutputBuffer.
+ *	@param	[in] IoControlCode			IOCTL code.
+ *	@param	[out] IoStatus				Receives the status if the request is completed.
+ *	@param	[in] DeviceObject			Device object.
+ *	@return								Non-zero if the request is completed.
+ *	
+ */
+{
+	DIO_DEVICE_EXTENSION *DeviceExtension;
+	ULONGLONG Buffer[DIO_FAST_IO_MAXIMUM_LENGTH / sizeof(ULONGLONG)];
+	DIO_PACKET *Packet = (DIO_PACKET *)Buffer;
+	ULONG OutputActualLength = 0;
+	NTSTATUS Status;
+
+	UNREFERENCED_PARAMETER(FileObject);
+
+	if (!Wait || DIO_IS_OPTION_ENABLED(DIO_CFGB_DISABLE_FAST_IO))
+		return FALSE;
+
+	if (IoControlCode != DIO_IOCTL_READ_PORT && IoControlCode != DIO_IOCTL_WRITE_PORT)
+		return FALSE;
+
+	if (!InputBuffer || InputBufferLength > sizeof(Buffer) || OutputBufferLength > sizeof(Buffer) || 
+		(OutputBufferLength && !OutputBuffer))
+		return FALSE;
+
+	if (!DioIsRegistered())
+		return FALSE;
+
+	__try
+	{
+		if (ExGetPreviousMode() != KernelMode)
+		{
+			ProbeForRead(InputBuffer, InputBufferLength, sizeof(UCHAR));
+			if (OutputBufferLength)
+				ProbeForWrite(OutputBuffer, OutputBufferLength, sizeof(UCHAR));
+		}
+
+		RtlCopyMemory(Buffer, InputBuffer, InputBufferLength);
+	}
+	__except (EXCEPTION_EXECUTE_HANDLER)
+	{
+		return FALSE;
+	}
+
+	DeviceExtension = (DIO_DEVICE_EXTENSION *)DeviceObject->DeviceExtension;
+
+	if (!DiopValidatePacketBuffer(Packet, InputBufferLength, OutputBufferLength, IoControlCode, 
+			DeviceExtension->PortResources, DeviceExtension->PortRangeCount))
+		return FALSE;
+
+	Status = DiopDispatchPortIo(DeviceExtension, Packet, IoControlCode, 
+		InputBufferLength, OutputBufferLength, &OutputActualLength);
+
+	if (NT_SUCCESS(Status) && OutputActualLength)
+	{
+		__try
+		{
+			RtlCopyMemory(OutputBuffer, Buffer, OutputActualLength);
+		}
+		__except (EXCEPTION_EXECUTE_HANDLER)
+		{
+			Status = GetExceptionCode();
+			OutputActualLength = 0;
+		}
+	}
+
+	IoStatus->Status = Status;
+	IoStatus->Information = OutputActualLength;
+
+	return TRUE;
+}
+
 VOID
 DioDriverUnload(
 	IN PDRIVER_OBJECT DriverObject)
@@ -1297,6 +3213,16 @@ DioDriverUnload(
 
 	PsSetCreateProcessNotifyRoutine(DiopCreateProcessNotifyRoutine, TRUE);
 
+	DioStopEdgeEngine();
+	DioStopStream();
+	DioStopScheduler();
+	DioStopReactor();
+	DioUnloadReaction(DIO_REACTION_ALL_PROGRAMS);
+	DioDestroyRing(NULL);
+	DioUnmapSnapshot(NULL);
+	DioUnmapMemoryWindows(NULL);
+	DioStopPortWorker();
+
 	DioUnregister();
 
 	ZwClose(DiopRegKeyHandle);
@@ -1419,6 +3345,8 @@ DioAddDevice(
 		// Clear the initialization flag.
 		//
 
+		// ReadFile/WriteFile transfer the caller's buffer with direct I/O.
+		DeviceObject->Flags |= DO_DIRECT_IO;
 		DeviceObject->Flags &= ~DO_DEVICE_INITIALIZING;
 
 #if 0
@@ -1555,11 +3483,19 @@ DriverEntry(
 
 	DriverObject->MajorFunction[IRP_MJ_CREATE] = DioDispatchCreate;
 	DriverObject->MajorFunction[IRP_MJ_CLOSE] = DioDispatchClose;
+	DriverObject->MajorFunction[IRP_MJ_READ] = DioDispatchReadWrite;
+	DriverObject->MajorFunction[IRP_MJ_WRITE] = DioDispatchReadWrite;
 	DriverObject->MajorFunction[IRP_MJ_DEVICE_CONTROL] = DioDispatchIoControl;
 	DriverObject->MajorFunction[IRP_MJ_CLEANUP] = DioDispatchCleanup;
 	DriverObject->MajorFunction[IRP_MJ_PNP] = DioDispatchPnP;
 	DriverObject->MajorFunction[IRP_MJ_SYSTEM_CONTROL] = DioDispatchSystemControl; // WMI
 	DriverObject->DriverExtension->AddDevice = DioAddDevice;
+
+	RtlZeroMemory(&DiopFastIoDispatch, sizeof(DiopFastIoDispatch));
+	DiopFastIoDispatch.SizeOfFastIoDispatch = sizeof(DiopFastIoDispatch);
+	DiopFastIoDispatch.FastIoDeviceControl = DioFastIoDeviceControl;
+	DriverObject->FastIoDispatch = &DiopFastIoDispatch;
+
 #ifdef __DIO_SUPPORT_UNLOAD
 	DriverObject->DriverUnload = DioDriverUnload;
 #else
@@ -1585,6 +3521,16 @@ DriverEntry(
 	KeInitializeSpinLock(&DiopPortReadWriteLock);
 	KeInitializeSpinLock(&DiopProcessLock);
 
+	DioInitializeEdgeEngine();
+	DioInitializeStream();
+	DioInitializeScheduler();
+	DioInitializeReactor();
+	DioInitializeRing();
+	DioInitializeSnapshot();
+	DioInitializePortWorker();
+	DioInitializeMemoryWindows();
+	DioCalibrateCycleCounter();
+
 	DiopDriverObject = DriverObject;
 	DiopRegKeyHandle = KeyHandle;
 
@@ -20,6 +20,23 @@
 #define DIO_ALLOC(_size)						ExAllocatePoolWithTag(NonPagedPool, (_size), DIO_POOL_TAG)
 #define DIO_FREE(_addr)							ExFreePoolWithTag((_addr), DIO_POOL_TAG)
 
+// Port read/write packets up to this length (input and output each) are run by the fast I/O path.
+#define DIO_FAST_IO_MAXIMUM_LENGTH				128
+
+// ReadFile/WriteFile, the version 2 port I/O, the burst read and the snapshot refresh hold the port lock
+// for this many bytes at most, except that a burst frame is never split.
+#define DIO_FILE_IO_CHUNK_LENGTH				256
+
+// File mode of the handle, kept in FileObject->FsContext2. NULL is DIO_FILE_MODE_LINEAR.
+#define DIO_FILE_CONTEXT(_mode, _width)			\
+	( (PVOID)(ULONG_PTR)(((ULONG)(_width) << 8) | (ULONG)(_mode)) )
+
+#define DIO_FILE_CONTEXT_MODE(_ctx)				\
+	( (ULONG)((ULONG_PTR)(_ctx) & 0xff) )
+
+#define DIO_FILE_CONTEXT_WIDTH(_ctx)			\
+	( (ULONG)((ULONG_PTR)(_ctx) >> 8) )
+
 #define DIO_IS_OPTION_ENABLED(_opt)	(			\
 	(DiopConfigurationBlock.ConfigurationBits	\
 		& ((ULONG)(_opt))) == ((ULONG)(_opt))	\
@@ -47,6 +64,15 @@
 }
 #endif
 
+/**
+ *	@brief	Memory resource of the device, mapped to the system space on the start.
+ */
+typedef struct _DIO_MEMORY_RESOURCE {
+	PHYSICAL_ADDRESS PhysicalAddress;
+	ULONG Length;
+	PUCHAR SystemAddress;			// Uncached mapping. Cleared under the port lock before it is unmapped.
+} DIO_MEMORY_RESOURCE;
+
 typedef struct _DIO_DEVICE_EXTENSION {
 	PDEVICE_OBJECT LowerLevelDeviceObject;
 	PDEVICE_OBJECT PhysicalDeviceObject;
@@ -61,6 +87,9 @@ typedef struct _DIO_DEVICE_EXTENSION {
 	ULONG PortRangeCount;
 	DIO_PORT_RANGE PortResources[DIO_MAXIMUM_PORT_RANGES];
 
+	ULONG MemoryRangeCount;
+	DIO_MEMORY_RESOURCE MemoryResources[DIO_MAXIMUM_MEMORY_RANGES];
+
 } DIO_DEVICE_EXTENSION;
 
 
@@ -79,6 +108,7 @@ extern volatile PEPROCESS DiopRegisteredProcess;
 extern BOOLEAN DiopBreakOnKdAttached;
 
 extern DIO_CONFIGURATION_BLOCK DiopConfigurationBlock;
+extern ULONGLONG DiopCycleFrequency;
 
 
 //
@@ -170,6 +200,18 @@ DiopIsPortRangesOverlapping(
 	IN DIO_PORT_RANGE *AddressRanges, 
 	IN ULONG AddressRangeCount);
 
+BOOLEAN
+DiopMeasurePortDescriptors(
+	IN DIO_PORT_DESCRIPTOR *Descriptors, 
+	IN ULONG DescriptorCount, 
+	OUT ULONG *DataLength);
+
+BOOLEAN
+DiopTestPortDescriptor(
+	IN DIO_PORT_DESCRIPTOR *Descriptor, 
+	IN DIO_PORT_RANGE *AddressRangesAvailable, 
+	IN ULONG AddressRangeCount);
+
 BOOLEAN
 DiopValidatePacketBuffer(
 	IN DIO_PACKET *Packet, 
@@ -186,6 +228,15 @@ DiopInternalPortIo(
 	IN ULONG Length, 
 	IN BOOLEAN Write);
 
+BOOLEAN
+DioTransferPortRanges(
+	IN DIO_PORT_RANGE *Ranges, 
+	IN ULONG Count, 
+	IN OUT PUCHAR Buffer, 
+	IN BOOLEAN Write, 
+	OPTIONAL OUT DIO_PORT_IO_TIMESTAMP *Timestamp, 
+	OUT ULONG *TransferredLength);
+
 BOOLEAN
 DioPortIo(
 	IN DIO_PORT_RANGE *Ranges, 
@@ -195,7 +246,288 @@ DioPortIo(
 	OPTIONAL IN OUT PUCHAR Buffer, 
 	IN ULONG BufferLength, 
 	OUT ULONG *TransferredLength, 
-	IN BOOLEAN Write);
+	IN BOOLEAN Write, 
+	OPTIONAL OUT DIO_PORT_IO_TIMESTAMP *Timestamp);
+
+BOOLEAN
+DioGroupPortIo(
+	IN DIO_PORT_RANGE *Ranges, 
+	IN ULONG Count, 
+	IN OUT PUCHAR Buffer, 
+	IN BOOLEAN Write, 
+	OPTIONAL OUT DIO_PORT_IO_TIMESTAMP *Timestamp, 
+	OUT DIO_PORT_IO_SKEW *Skew);
+
+VOID
+DioCalibrateCycleCounter(
+	VOID);
+
+BOOLEAN
+DioWaitPattern(
+	IN OUT DIO_PACKET_WAIT_PATTERN *WaitPattern, 
+	IN DIO_PORT_RANGE *AvailableRanges, 
+	IN ULONG AvailableRangeCount);
+
+
+
+//
+// Edge counting engine.
+//
+
+VOID
+DioInitializeEdgeEngine(
+	VOID);
+
+BOOLEAN
+DioStartEdgeEngine(
+	IN DIO_PACKET_START_EDGE_ENGINE *Parameters, 
+	IN DIO_PORT_RANGE *AvailableRanges, 
+	IN ULONG AvailableRangeCount);
+
+VOID
+DioStopEdgeEngine(
+	VOID);
+
+VOID
+DioQueryEdgeCounters(
+	OUT DIO_PACKET_QUERY_EDGE_COUNTERS *Counters);
+
+
+
+//
+// Output streaming.
+//
+
+VOID
+DioInitializeStream(
+	VOID);
+
+BOOLEAN
+DioStartStream(
+	IN DIO_PACKET_START_STREAM *Parameters, 
+	IN DIO_PORT_RANGE *AvailableRanges, 
+	IN ULONG AvailableRangeCount);
+
+BOOLEAN
+DioWriteStream(
+	IN DIO_PACKET_WRITE_STREAM *Packet, 
+	IN ULONG InputBufferLength, 
+	OUT DIO_PACKET_QUERY_STREAM *Status);
+
+VOID
+DioStopStream(
+	VOID);
+
+VOID
+DioQueryStream(
+	OUT DIO_PACKET_QUERY_STREAM *Status);
+
+
+
+//
+// Time-tagged output scheduler.
+//
+
+VOID
+DioInitializeScheduler(
+	VOID);
+
+BOOLEAN
+DioStartScheduler(
+	IN DIO_PACKET_START_SCHEDULER *Parameters);
+
+BOOLEAN
+DioScheduleOutput(
+	IN OUT DIO_PACKET_SCHEDULE_OUTPUT *Packet, 
+	IN DIO_PORT_RANGE *AvailableRanges, 
+	IN ULONG AvailableRangeCount);
+
+VOID
+DioStopScheduler(
+	VOID);
+
+ULONG
+DioQueryScheduler(
+	OUT DIO_PACKET_QUERY_SCHEDULER *Status, 
+	IN ULONG OutputBufferLength);
+
+
+
+//
+// Reaction programs.
+//
+
+VOID
+DioInitializeReactor(
+	VOID);
+
+BOOLEAN
+DioLoadReaction(
+	IN DIO_PACKET_LOAD_REACTION *Packet, 
+	IN DIO_PORT_RANGE *AvailableRanges, 
+	IN ULONG AvailableRangeCount, 
+	OUT ULONG *Id);
+
+BOOLEAN
+DioUnloadReaction(
+	IN ULONG Id);
+
+BOOLEAN
+DioStartReactor(
+	IN DIO_PACKET_START_REACTOR *Parameters);
+
+VOID
+DioStopReactor(
+	VOID);
+
+VOID
+DioQueryReactor(
+	OUT DIO_PACKET_QUERY_REACTOR *Status);
+
+
+
+//
+// Submission and completion rings.
+//
+
+VOID
+DioInitializeRing(
+	VOID);
+
+BOOLEAN
+DioCreateRing(
+	IN DIO_PACKET_CREATE_RING *Parameters, 
+	IN DIO_PORT_RANGE *AvailableRanges, 
+	IN ULONG AvailableRangeCount, 
+	IN PFILE_OBJECT FileObject, 
+	OUT DIO_PACKET_RING_ADDRESS *Address);
+
+BOOLEAN
+DioEnterRing(
+	OUT DIO_PACKET_ENTER_RING *Packet);
+
+VOID
+DioDestroyRing(
+	OPTIONAL IN PFILE_OBJECT FileObject);
+
+
+//
+// Live snapshot page.
+//
+
+VOID
+DioInitializeSnapshot(
+	VOID);
+
+BOOLEAN
+DioMapSnapshot(
+	IN PFILE_OBJECT FileObject, 
+	OUT DIO_PACKET_SNAPSHOT_ADDRESS *Address);
+
+BOOLEAN
+DioStartSnapshot(
+	IN DIO_PACKET_START_SNAPSHOT *Parameters, 
+	IN DIO_PORT_RANGE *AvailableRanges, 
+	IN ULONG AvailableRangeCount);
+
+VOID
+DioStopSnapshot(
+	VOID);
+
+VOID
+DioUnmapSnapshot(
+	OPTIONAL IN PFILE_OBJECT FileObject);
+
+VOID
+DioPublishSnapshotConfiguration(
+	VOID);
+
+
+//
+// Memory-mapped I/O.
+//
+
+VOID
+DioInitializeMemoryWindows(
+	VOID);
+
+BOOLEAN
+DioMapMemoryResource(
+	IN OUT DIO_DEVICE_EXTENSION *DeviceExtension, 
+	IN PHYSICAL_ADDRESS PhysicalAddress, 
+	IN ULONG Length);
+
+VOID
+DioUnmapMemoryResources(
+	IN OUT DIO_DEVICE_EXTENSION *DeviceExtension);
+
+VOID
+DioQueryMemoryResources(
+	IN DIO_DEVICE_EXTENSION *DeviceExtension, 
+	OUT DIO_PACKET_QUERY_MEMORY_RESOURCES *Packet, 
+	IN ULONG PacketLength, 
+	OUT ULONG *OutputActualLength);
+
+BOOLEAN
+DiopMeasureMemoryDescriptors(
+	IN DIO_MEMORY_DESCRIPTOR *Descriptors, 
+	IN ULONG DescriptorCount, 
+	OUT ULONG *DataLength);
+
+NTSTATUS
+DiopDispatchMemoryIoV2(
+	IN DIO_DEVICE_EXTENSION *DeviceExtension, 
+	IN DIO_PACKET_MEMORY_IO_V2 *MemoryIo, 
+	IN ULONG IoControlCode, 
+	IN OUT PUCHAR Buffer, 
+	OUT ULONG *OutputActualLength);
+
+BOOLEAN
+DioMapMemoryWindow(
+	IN DIO_DEVICE_EXTENSION *DeviceExtension, 
+	IN DIO_PACKET_MAP_MEMORY *Parameters, 
+	IN PFILE_OBJECT FileObject, 
+	OUT DIO_PACKET_MEMORY_WINDOW *Window);
+
+BOOLEAN
+DioUnmapMemoryWindow(
+	IN ULONG Resource, 
+	IN PFILE_OBJECT FileObject);
+
+VOID
+DioUnmapMemoryWindows(
+	OPTIONAL IN PFILE_OBJECT FileObject);
+
+
+//
+// Port I/O worker.
+//
+
+VOID
+DioInitializePortWorker(
+	VOID);
+
+BOOLEAN
+DioStartPortWorker(
+	IN DIO_PACKET_START_WORKER *Parameters);
+
+VOID
+DioStopPortWorker(
+	VOID);
+
+VOID
+DioQueryPortWorker(
+	OUT DIO_PACKET_QUERY_WORKER *Status);
+
+BOOLEAN
+DioPostPortIo(
+	IN DIO_PORT_RANGE *Ranges, 
+	IN ULONG Count, 
+	IN OUT PUCHAR Buffer, 
+	IN BOOLEAN Write, 
+	OPTIONAL OUT DIO_PORT_IO_TIMESTAMP *Timestamp, 
+	OUT ULONG *TransferredLength, 
+	OUT BOOLEAN *Result);
 
 BOOLEAN
 DioIsRegistered(
@@ -249,11 +581,28 @@ DioDispatchCleanup(
 	IN PDEVICE_OBJECT DeviceObject, 
 	IN PIRP Irp);
 
+NTSTATUS
+DioDispatchReadWrite(
+	IN PDEVICE_OBJECT DeviceObject, 
+	IN PIRP Irp);
+
 NTSTATUS
 DioDispatchIoControl(
 	IN PDEVICE_OBJECT DeviceObject, 
 	IN PIRP Irp);
 
+BOOLEAN
+DioFastIoDeviceControl(
+	IN PFILE_OBJECT FileObject, 
+	IN BOOLEAN Wait, 
+	OPTIONAL IN PVOID InputBuffer, 
+	IN ULONG InputBufferLength, 
+	OPTIONAL OUT PVOID OutputBuffer, 
+	IN ULONG OutputBufferLength, 
+	IN ULONG IoControlCode, 
+	OUT PIO_STATUS_BLOCK IoStatus, 
+	IN PDEVICE_OBJECT DeviceObject);
+
 NTSTATUS
 DioDispatchPnP(
 	IN PDEVICE_OBJECT DeviceObject, 
@@ -0,0 +1,329 @@
+#include <ntddk.h>
+#include "../Include/dioctl.h"
+#include "edge.h"
+
+
+//
+// Position step indexed by (previous phase << 2) | current phase, where the phase is A | (B << 1).
+// A leading B (00 -> 01 -> 11 -> 10) counts up. 2 means both phases changed in one sample.
+//
+
+static const CHAR DiopQuadratureSteps[16] = {
+	 0,  1, -1,  2, 
+	-1,  0,  2,  1, 
+	 1,  2,  0, -1, 
+	 2, -1,  1,  0, 
+};
+
+static
+LONGLONG
+DiopEdgeScale(
+	IN LONGLONG Value, 
+	IN LONGLONG Multiplier, 
+	IN LONGLONG Divisor)
+/**
+ *	@brief	Calculates Value * Multiplier / Divisor without overflowing the intermediate product.
+ */
+{
+	return (Value / Divisor) * Multiplier + (Value % Divisor) * Multiplier / Divisor;
+}
+
+BOOLEAN
+DioEdgeInitialize(
+	OUT DIO_EDGE_STATE *State, 
+	IN DIO_PACKET_START_EDGE_ENGINE *Parameters, 
+	IN LONGLONG Frequency)
+/**
+ *	@brief	Validates the parameters and resets the state.
+ *	
+ *	Ports of the channels are not validated here.
+ *	
+ *	@param	[out] State					State to initialize.
+ *	@param	[in] Parameters				Channels, decoders and sample interval.
+ *	@param	[in] Frequency				Frequency of the counter which timestamps the samples.
+ *	@return								Non-zero if the parameters are valid.
+ *	
+ */
+{
+	ULONG i, j;
+
+	if (!Parameters->ChannelCount || Parameters->ChannelCount > DIO_EDGE_MAXIMUM_CHANNELS || 
+		Parameters->DecoderCount > DIO_EDGE_MAXIMUM_DECODERS || !Parameters->SampleInterval || Frequency <= 0)
+		return FALSE;
+
+	RtlZeroMemory(State, sizeof(*State));
+
+	State->ChannelCount = Parameters->ChannelCount;
+	State->DecoderCount = Parameters->DecoderCount;
+	State->Interval = DiopEdgeScale(Parameters->SampleInterval, Frequency, 1000000000);
+
+	// Sampler thread waits at least one tick of the counter between the samples.
+	if (!State->Interval)
+		State->Interval = 1;
+
+	for (i = 0; i < State->ChannelCount; i++)
+	{
+		DIO_EDGE_CHANNEL *Channel = &Parameters->Channels[i];
+
+		if (Channel->Bit > 7 || (Channel->Flags & ~DIO_EDGE_CHANNEL_VALID_FLAGS))
+			return FALSE;
+
+		// Channels in the same port share one port read.
+		for (j = 0; j < State->PortCount; j++)
+		{
+			if (State->Ports[j] == Channel->Port)
+				break;
+		}
+
+		if (j == State->PortCount)
+			State->Ports[State->PortCount++] = Channel->Port;
+
+		State->Channels[i].PortIndex = (UCHAR)j;
+		State->Channels[i].Bit = Channel->Bit;
+
+		if (Channel->Flags & DIO_EDGE_CHANNEL_INVERTED)
+			State->InvertMask |= 1UL << i;
+	}
+
+	for (i = 0; i < State->DecoderCount; i++)
+	{
+		DIO_QUADRATURE_DECODER *Decoder = &Parameters->Decoders[i];
+		DIO_QUADRATURE_STATE *Quadrature = &State->Decoders[i];
+
+		if (Decoder->ChannelA >= State->ChannelCount || Decoder->ChannelB >= State->ChannelCount || 
+			Decoder->ChannelA == Decoder->ChannelB || 
+			(Decoder->ChannelIndex != DIO_QUADRATURE_NO_INDEX && Decoder->ChannelIndex >= State->ChannelCount) || 
+			(Decoder->Flags & ~DIO_QUADRATURE_VALID_FLAGS))
+			return FALSE;
+
+		Quadrature->ChannelA = Decoder->ChannelA;
+		Quadrature->ChannelB = Decoder->ChannelB;
+		Quadrature->ChannelIndex = Decoder->ChannelIndex;
+		Quadrature->Flags = Decoder->Flags;
+		Quadrature->Mask = (1UL << Decoder->ChannelA) | (1UL << Decoder->ChannelB);
+
+		if (Decoder->ChannelIndex != DIO_QUADRATURE_NO_INDEX)
+			Quadrature->Mask |= 1UL << Decoder->ChannelIndex;
+	}
+
+	return TRUE;
+}
+
+ULONG
+DioEdgeBuildSample(
+	IN DIO_EDGE_STATE *State, 
+	IN PUCHAR PortValues)
+/**
+ *	@brief	Collects the channel levels from the port values.
+ *	
+ *	@param	[in] State					Engine state.
+ *	@param	[in] PortValues				Values read from State->Ports, in the same order.
+ *	@return								Sample whose bit N is the level of channel N, inversion applied.
+ *	
+ */
+{
+	ULONG Sample = 0;
+	ULONG i;
+
+	for (i = 0; i < State->ChannelCount; i++)
+	{
+		DIO_EDGE_CHANNEL_STATE *Channel = &State->Channels[i];
+
+		Sample |= (ULONG)((PortValues[Channel->PortIndex] >> Channel->Bit) & 1) << i;
+	}
+
+	return Sample ^ State->InvertMask;
+}
+
+VOID
+DioEdgeProcessSample(
+	IN OUT DIO_EDGE_STATE *State, 
+	IN ULONG Sample, 
+	IN LONGLONG Time)
+/**
+ *	@brief	Updates the counters with a new sample.
+ *	
+ *	The first sample only sets the initial levels. An edge is timed at the sample which observed it, 
+ *	so the period has the resolution of the sample interval.
+ *	
+ *	@param	[in, out] State				Engine state.
+ *	@param	[in] Sample					Sample from DioEdgeBuildSample().
+ *	@param	[in] Time					Counter value when the sample is taken.
+ *	@return								None.
+ *	
+ */
+{
+	ULONG Changed;
+	ULONG Rising;
+	ULONG Bits;
+	ULONG i;
+
+	if (!State->SampleCount)
+	{
+		for (i = 0; i < State->DecoderCount; i++)
+		{
+			DIO_QUADRATURE_STATE *Quadrature = &State->Decoders[i];
+
+			Quadrature->Phase = ((Sample >> Quadrature->ChannelA) & 1) | (((Sample >> Quadrature->ChannelB) & 1) << 1);
+		}
+
+		State->Sample = Sample;
+		State->SampleCount = 1;
+		State->FirstTime = Time;
+		State->LastTime = Time;
+		return;
+	}
+
+	// Ticks which passed without a sample are counted, rounded to the nearest tick.
+	if (State->Interval)
+	{
+		LONGLONG Ticks = (Time - State->LastTime + State->Interval / 2) / State->Interval;
+
+		if (Ticks > 1)
+			State->MissedSamples += (ULONG)(Ticks - 1);
+	}
+
+	Changed = Sample ^ State->Sample;
+
+	if (Changed)
+	{
+		Rising = Changed & Sample;
+
+		for (i = 0, Bits = Changed; Bits; i++, Bits >>= 1)
+		{
+			DIO_EDGE_CHANNEL_STATE *Channel = &State->Channels[i];
+
+			if (!(Bits & 1))
+				continue;
+
+			if (Rising & (1UL << i))
+			{
+				if (Channel->Risen)
+					Channel->Period = Time - Channel->LastRisingTime;
+
+				Channel->RisingEdges++;
+				Channel->LastRisingTime = Time;
+				Channel->Risen = TRUE;
+			}
+			else
+			{
+				Channel->FallingEdges++;
+			}
+		}
+
+		for (i = 0; i < State->DecoderCount; i++)
+		{
+			DIO_QUADRATURE_STATE *Quadrature = &State->Decoders[i];
+			ULONG Phase;
+			LONG Step;
+
+			if (!(Changed & Quadrature->Mask))
+				continue;
+
+			Phase = ((Sample >> Quadrature->ChannelA) & 1) | (((Sample >> Quadrature->ChannelB) & 1) << 1);
+			Step = DiopQuadratureSteps[(Quadrature->Phase << 2) | Phase];
+
+			// Direction is unknown if both phases changed, so the position is kept.
+			if (Step == 2)
+				Quadrature->ErrorCount++;
+			else if (Quadrature->Flags & DIO_QUADRATURE_FLAG_REVERSE)
+				Quadrature->Position -= Step;
+			else
+				Quadrature->Position += Step;
+
+			Quadrature->Phase = Phase;
+
+			if (Quadrature->ChannelIndex != DIO_QUADRATURE_NO_INDEX && 
+				(Rising & (1UL << Quadrature->ChannelIndex)))
+			{
+				Quadrature->IndexCount++;
+				Quadrature->IndexPosition = Quadrature->Position;
+
+				if (Quadrature->Flags & DIO_QUADRATURE_FLAG_RESET_ON_INDEX)
+					Quadrature->Position = 0;
+			}
+		}
+	}
+
+	State->Sample = Sample;
+	State->SampleCount++;
+	State->LastTime = Time;
+}
+
+VOID
+DioEdgeQueryCounters(
+	IN DIO_EDGE_STATE *State, 
+	IN LONGLONG Now, 
+	IN LONGLONG Frequency, 
+	OUT DIO_PACKET_QUERY_EDGE_COUNTERS *Counters)
+/**
+ *	@brief	Converts the state to the counters.
+ *	
+ *	Frequency is estimated from the last period. Once the time since the last rising edge
+ *	exceeds the period, that time is used instead, so a stopped signal decays to zero.\n
+ *	Caller must zero the counters, and set Running.
+ *	
+ *	@param	[in] State					Engine state.
+ *	@param	[in] Now					Current counter value.
+ *	@param	[in] Frequency				Counter frequency.
+ *	@param	[out] Counters				Receives the counters.
+ *	@return								None.
+ *	
+ */
+{
+	ULONG i;
+
+	Counters->ChannelCount = State->ChannelCount;
+	Counters->DecoderCount = State->DecoderCount;
+
+	if (!State->SampleCount || Frequency <= 0)
+		return;
+
+	Counters->MissedSamples = State->MissedSamples;
+	Counters->SampleCount = State->SampleCount;
+	Counters->SampleTime = (ULONGLONG)DiopEdgeScale(State->LastTime - State->FirstTime, 1000000000, Frequency);
+
+	for (i = 0; i < State->ChannelCount; i++)
+	{
+		DIO_EDGE_CHANNEL_STATE *Channel = &State->Channels[i];
+		DIO_EDGE_COUNTER *Counter = &Counters->Channels[i];
+
+		Counter->RisingEdges = Channel->RisingEdges;
+		Counter->FallingEdges = Channel->FallingEdges;
+		Counter->Level = (State->Sample >> i) & 1;
+		Counter->Period = (ULONGLONG)DiopEdgeScale(Channel->Period, 1000000000, Frequency);
+		Counter->Age = DIO_EDGE_NO_EDGE;
+
+		if (Channel->Risen)
+		{
+			LONGLONG Age = Now - Channel->LastRisingTime;
+			LONGLONG Period = Channel->Period;
+
+			if (Age < 0)
+				Age = 0;
+
+			Counter->Age = (ULONGLONG)DiopEdgeScale(Age, 1000000000, Frequency);
+
+			if (Period && Age > Period)
+				Period = Age;
+
+			if (Period)
+			{
+				LONGLONG Millihertz = Frequency * 1000 / Period;
+
+				Counter->Frequency = Millihertz > MAXULONG ? MAXULONG : (ULONG)Millihertz;
+			}
+		}
+	}
+
+	for (i = 0; i < State->DecoderCount; i++)
+	{
+		DIO_QUADRATURE_STATE *Quadrature = &State->Decoders[i];
+		DIO_QUADRATURE_COUNTER *Counter = &Counters->Decoders[i];
+
+		Counter->Position = Quadrature->Position;
+		Counter->IndexPosition = Quadrature->IndexPosition;
+		Counter->IndexCount = Quadrature->IndexCount;
+		Counter->ErrorCount = Quadrature->ErrorCount;
+	}
+}
@@ -0,0 +1,78 @@
+
+#ifndef __DIO_EDGE_H__
+#define __DIO_EDGE_H__
+
+//
+// Edge counting and quadrature decoding core.
+//
+// The core does not call any kernel routine, so it can be built and tested in user mode
+// with a header that provides the base types in place of ntddk.h. See test/ntddk.h and
+// test/edge_test.c, which are run by make test in DIOPort/test.
+//
+
+typedef struct _DIO_EDGE_CHANNEL_STATE {
+	ULONG RisingEdges;
+	ULONG FallingEdges;
+	LONGLONG LastRisingTime;		// Counter value of the sample which saw the last rising edge.
+	LONGLONG Period;				// Ticks between the last two rising edges. Zero if unknown.
+	UCHAR PortIndex;				// Index in DIO_EDGE_STATE.Ports.
+	UCHAR Bit;
+	BOOLEAN Risen;					// LastRisingTime is valid.
+} DIO_EDGE_CHANNEL_STATE;
+
+typedef struct _DIO_QUADRATURE_STATE {
+	ULONG Mask;						// Sample bits of A, B and index.
+	UCHAR ChannelA;
+	UCHAR ChannelB;
+	UCHAR ChannelIndex;
+	UCHAR Flags;
+	ULONG Phase;					// A in bit 0, B in bit 1.
+	LONG Position;
+	LONG IndexPosition;
+	ULONG IndexCount;
+	ULONG ErrorCount;
+} DIO_QUADRATURE_STATE;
+
+typedef struct _DIO_EDGE_STATE {
+	ULONG ChannelCount;
+	ULONG DecoderCount;
+	ULONG PortCount;
+	USHORT Ports[DIO_EDGE_MAXIMUM_CHANNELS];	// Distinct ports to read for a sample.
+	ULONG InvertMask;
+	ULONG Sample;					// Levels of the last sample. Bit N is channel N.
+	ULONG MissedSamples;
+	ULONGLONG SampleCount;
+	LONGLONG Interval;				// Ticks between the samples. Zero if free running.
+	LONGLONG FirstTime;
+	LONGLONG LastTime;
+	DIO_EDGE_CHANNEL_STATE Channels[DIO_EDGE_MAXIMUM_CHANNELS];
+	DIO_QUADRATURE_STATE Decoders[DIO_EDGE_MAXIMUM_DECODERS];
+} DIO_EDGE_STATE;
+
+
+BOOLEAN
+DioEdgeInitialize(
+	OUT DIO_EDGE_STATE *State, 
+	IN DIO_PACKET_START_EDGE_ENGINE *Parameters, 
+	IN LONGLONG Frequency);
+
+ULONG
+DioEdgeBuildSample(
+	IN DIO_EDGE_STATE *State, 
+	IN PUCHAR PortValues);
+
+VOID
+DioEdgeProcessSample(
+	IN OUT DIO_EDGE_STATE *State, 
+	IN ULONG Sample, 
+	IN LONGLONG Time);
+
+VOID
+DioEdgeQueryCounters(
+	IN DIO_EDGE_STATE *State, 
+	IN LONGLONG Now, 
+	IN LONGLONG Frequency, 
+	OUT DIO_PACKET_QUERY_EDGE_COUNTERS *Counters);
+
+
+#endif
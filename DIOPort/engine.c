@@ -0,0 +1,3082 @@
+#include <ntddk.h>
+#include "../Include/dioctl.h"
+#include "../Include/dioring.h"
+#include "../Include/diosnap.h"
+#include "dioport.h"
+#include "edge.h"
+#include "stream.h"
+#include "schedule.h"
+#include "reaction.h"
+
+// Tick threads sleep instead of spinning if the next tick is further than this, in microseconds.
+#define DIO_TICK_SLEEP_THRESHOLD				2000
+
+// Longest wait of the scheduler thread in microseconds. Bounds the conversion to the timeout.
+#define DIO_SCHEDULER_MAXIMUM_WAIT				1000000
+
+// Submissions which are run with one hold of the port lock.
+#define DIO_RING_BATCH							64
+
+// Requests of the port I/O worker which are run with one hold of the port lock.
+#define DIO_WORKER_BATCH						64
+
+C_ASSERT(sizeof(DIO_SNAPSHOT_PAGE) == DIO_SNAPSHOT_PAGE_LENGTH);
+
+typedef struct _DIO_EDGE_ENGINE {
+	KMUTEX Mutex;					// Serializes start and stop.
+	KSPIN_LOCK Lock;				// Protects State against the query.
+	DIO_EDGE_STATE State;
+	PKTHREAD Thread;
+	volatile LONG StopRequested;
+	BOOLEAN Running;
+	ULONG Processor;
+	LONGLONG Frequency;
+} DIO_EDGE_ENGINE;
+
+typedef struct _DIO_STREAM_ENGINE {
+	KMUTEX Mutex;					// Serializes start, write and stop.
+	KSPIN_LOCK Lock;				// Protects State and the statistics against the tick thread.
+	DIO_STREAM_STATE State;
+	PKTHREAD Thread;
+	volatile LONG StopRequested;
+	BOOLEAN Running;
+	ULONG Processor;
+	LONGLONG Frequency;
+	LONGLONG Interval;				// Ticks of the performance counter between the frames.
+	ULONG RangeCount;
+	DIO_PORT_RANGE Ranges[DIO_STREAM_MAXIMUM_RANGES];
+	ULONG LateTicks;
+	LONGLONG MaximumLateness;
+} DIO_STREAM_ENGINE;
+
+typedef struct _DIO_SCHEDULER {
+	KMUTEX Mutex;					// Serializes start and stop.
+	KSPIN_LOCK Lock;				// Protects State against the scheduler thread.
+	KEVENT Wakeup;					// Signaled when the earliest deadline changes or the stop is requested.
+	DIO_SCHEDULE_STATE State;
+	PVOID Memory;					// Heap and entries of State.
+	PKTHREAD Thread;
+	volatile LONG StopRequested;
+	volatile LONG HeadChanged;		// Earlier entry is queued while the thread waits.
+	BOOLEAN Running;
+	ULONG Processor;
+	LONGLONG Frequency;
+} DIO_SCHEDULER;
+
+typedef struct _DIO_REACTOR {
+	KMUTEX Mutex;					// Serializes start, stop, load and unload.
+	KSPIN_LOCK Lock;				// Protects Programs and the statistics against the tick thread.
+	DIO_REACTION_PROGRAM *Programs[DIO_REACTION_MAXIMUM_PROGRAMS];
+	PKTHREAD Thread;
+	volatile LONG StopRequested;
+	BOOLEAN Running;
+	ULONG Processor;
+	LONGLONG Frequency;
+	LONGLONG Interval;				// Ticks of the performance counter between the reactor ticks.
+	ULONGLONG Ticks;
+	ULONG MissedTicks;
+} DIO_REACTOR;
+
+typedef struct _DIO_RING {
+	KMUTEX Mutex;					// Serializes create, doorbell and destroy.
+	KEVENT Wakeup;					// Signaled by the doorbell or the stop while the polling thread sleeps.
+	DIO_RING_CONSUMER Consumer;		// Used by the polling thread only, or by the doorbell with Mutex held.
+	PVOID Memory;					// System address of the pages of Mdl.
+	ULONG Length;					// Length of Memory, rounded up to pages.
+	PMDL Mdl;						// Pages of the rings, which are allocated by MmAllocatePagesForMdl().
+	PVOID UserAddress;				// Memory mapped to Process.
+	PEPROCESS Process;				// Referenced while the ring exists.
+	PFILE_OBJECT FileObject;		// Handle which created the ring. Its cleanup destroys the ring.
+	DIO_PORT_RANGE *AvailableRanges;
+	ULONG AvailableRangeCount;
+	PKTHREAD Thread;				// Polling thread. NULL if the doorbell runs the submissions.
+	volatile LONG StopRequested;
+	BOOLEAN Created;
+	ULONG Processor;
+	LONGLONG IdleTime;				// Ticks of the performance counter to poll before sleeping.
+} DIO_RING;
+
+typedef struct _DIO_SNAPSHOT {
+	KMUTEX Mutex;					// Serializes map, start, stop and unmap.
+	KSPIN_LOCK Lock;				// Serializes the writers of Page.
+	HANDLE Section;					// Kernel handle of the pagefile-backed section.
+	PVOID SystemView;				// Writable view of Section in the system space.
+	PMDL Mdl;						// Locks SystemView, so that Page can be written at DISPATCH_LEVEL.
+	DIO_SNAPSHOT_PAGE *Page;		// Locked mapping of SystemView. NULL if not mapped.
+	PVOID UserAddress;				// Read-only view of Section in Process.
+	PEPROCESS Process;				// Referenced while the page is mapped.
+	PFILE_OBJECT FileObject;		// Handle which mapped the page. Its cleanup unmaps the page.
+	ULONG Sequence;					// Sequence of the page. The page is never read back.
+	PKTHREAD Thread;
+	volatile LONG StopRequested;
+	BOOLEAN Running;
+	ULONG Processor;
+	LONGLONG Frequency;
+	LONGLONG Interval;				// Ticks of the performance counter between the refreshes.
+	ULONGLONG SampleCount;
+	ULONG RangeCount;
+	DIO_PORT_RANGE Ranges[DIO_SNAPSHOT_MAXIMUM_RANGES];
+} DIO_SNAPSHOT;
+
+/**
+ *	@brief	Port read/write which is posted to the worker. Lives on the stack of the poster.
+ */
+typedef struct _DIO_PORT_WORK {
+	SLIST_ENTRY Entry;
+	KEVENT Done;					// Signaled when the worker has run the request.
+	DIO_PORT_RANGE *Ranges;
+	ULONG Count;
+	PUCHAR Buffer;
+	DIO_PORT_IO_TIMESTAMP *Timestamp;
+	ULONG TransferredLength;
+	BOOLEAN Write;
+	BOOLEAN Result;
+} DIO_PORT_WORK;
+
+typedef struct _DIO_PORT_WORKER {
+	SLIST_HEADER Queue;				// Posted requests, newest first.
+	KMUTEX Mutex;					// Serializes start and stop.
+	KSPIN_LOCK Lock;				// Protects the statistics against the query.
+	KEVENT Wakeup;					// Signaled by the first post to the empty queue while the worker sleeps, or by the stop.
+	EX_RUNDOWN_REF Rundown;			// Held by the posters, so the stop waits for their requests.
+	PKTHREAD Thread;
+	volatile LONG StopRequested;
+	volatile LONG Sleeping;			// Worker checks the queue for the last time before it sleeps.
+	BOOLEAN Running;
+	ULONG Processor;
+	LONGLONG SpinTime;				// Ticks of the performance counter to poll before sleeping.
+	ULONGLONG Requests;
+	ULONGLONG Batches;
+	ULONGLONG Wakeups;
+	ULONG MaximumBatch;
+} DIO_PORT_WORKER;
+
+static DIO_EDGE_ENGINE DiopEdgeEngine;
+static DIO_STREAM_ENGINE DiopStreamEngine;
+static DIO_SCHEDULER DiopScheduler;
+static DIO_REACTOR DiopReactor;
+static DIO_RING DiopRing;
+static DIO_SNAPSHOT DiopSnapshot;
+static DIO_PORT_WORKER DiopPortWorker;
+
+
+VOID
+DiopWaitForTick(
+	IN LONGLONG Next, 
+	IN LONGLONG Frequency, 
+	IN volatile LONG *StopRequested)
+/**
+ *	@brief	Waits until the performance counter reaches Next.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Spins for the last DIO_TICK_SLEEP_THRESHOLD, since the timer resolution is far too coarse
+ *	for the tick rates of the engines. Returns early if the stop is requested.
+ *	
+ *	@param	[in] Next					Performance counter value to wait for.
+ *	@param	[in] Frequency				Performance counter frequency.
+ *	@param	[in] StopRequested			Stop flag of the engine.
+ *	@return								None.
+ *	
+ */
+{
+	LONGLONG SleepThreshold = DIO_TICK_SLEEP_THRESHOLD * Frequency / 1000000;
+	LONGLONG Now = KeQueryPerformanceCounter(NULL).QuadPart;
+
+	if (Next - Now > SleepThreshold)
+	{
+		LARGE_INTEGER Delay;
+
+		Delay.QuadPart = -(Next - Now - SleepThreshold) * 10000000 / Frequency;
+		KeDelayExecutionThread(KernelMode, FALSE, &Delay);
+	}
+
+	while (KeQueryPerformanceCounter(NULL).QuadPart < Next && !*StopRequested)
+		YieldProcessor();
+}
+
+VOID
+DiopSetTickThreadProcessor(
+	IN ULONG Processor)
+/**
+ *	@brief	Raises the current thread to the real-time priority and pins it to the processor.
+ *	
+ *	This function is reserved for internal use.
+ *	
+ *	@param	[in] Processor				Processor number, or DIO_EDGE_ANY_PROCESSOR.
+ *	@return								None.
+ *	
+ */
+{
+	KeSetPriorityThread(KeGetCurrentThread(), LOW_REALTIME_PRIORITY);
+
+	if (Processor != DIO_EDGE_ANY_PROCESSOR)
+		KeSetSystemAffinityThread((KAFFINITY)1 << Processor);
+}
+
+BOOLEAN
+DiopIsValidTickProcessor(
+	IN ULONG Processor)
+/**
+ *	@brief	Checks whether the tick thread can be pinned to the processor.
+ *	
+ *	This function is reserved for internal use.
+ *	
+ *	@param	[in] Processor				Processor number, or DIO_EDGE_ANY_PROCESSOR.
+ *	@return								Non-zero if valid.
+ *	
+ */
+{
+	if (Processor == DIO_EDGE_ANY_PROCESSOR)
+		return TRUE;
+
+	return (BOOLEAN)(Processor < KeQueryActiveProcessorCount(NULL) && Processor < sizeof(KAFFINITY) * 8);
+}
+
+NTSTATUS
+DiopCreateTickThread(
+	IN PKSTART_ROUTINE StartRoutine, 
+	IN PVOID StartContext, 
+	OUT PKTHREAD *Thread)
+/**
+ *	@brief	Creates the system thread of the engine and references it.
+ *	
+ *	This function is reserved for internal use.
+ *	
+ *	@param	[in] StartRoutine			Thread routine.
+ *	@param	[in] StartContext			Engine.
+ *	@param	[out] Thread				Receives the referenced thread object.
+ *	@return								STATUS_SUCCESS if successful.
+ *	
+ */
+{
+	OBJECT_ATTRIBUTES ObjectAttributes;
+	HANDLE ThreadHandle;
+	NTSTATUS Status;
+
+	InitializeObjectAttributes(&ObjectAttributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+
+	Status = PsCreateSystemThread(&ThreadHandle, THREAD_ALL_ACCESS, &ObjectAttributes, NULL, NULL, 
+		StartRoutine, StartContext);
+	if (!NT_SUCCESS(Status))
+		return Status;
+
+	Status = ObReferenceObjectByHandle(ThreadHandle, SYNCHRONIZE, NULL, KernelMode, (PVOID *)Thread, NULL);
+	ZwClose(ThreadHandle);
+
+	return Status;
+}
+
+
+VOID
+DiopEdgeSamplerThread(
+	IN PVOID StartContext)
+/**
+ *	@brief	Sampler thread of the edge counting engine.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Port lock is held for the port reads of one sample only.
+ *	
+ *	@param	[in] StartContext			Engine.
+ *	@return								None.
+ *	
+ */
+{
+	DIO_EDGE_ENGINE *Engine = (DIO_EDGE_ENGINE *)StartContext;
+	DIO_EDGE_STATE *State = &Engine->State;
+	UCHAR PortValues[DIO_EDGE_MAXIMUM_CHANNELS];
+	LONGLONG Interval = State->Interval;
+	LONGLONG Next;
+	LONGLONG Now;
+	ULONG Sample;
+	ULONG i;
+	KIRQL Irql;
+
+	DiopSetTickThreadProcessor(Engine->Processor);
+
+	Next = KeQueryPerformanceCounter(NULL).QuadPart;
+
+	while (!Engine->StopRequested)
+	{
+		KeAcquireSpinLock(&DiopPortReadWriteLock, &Irql);
+
+		for (i = 0; i < State->PortCount; i++)
+		{
+#ifdef __DIO_IOCTL_TEST_MODE
+			PortValues[i] = (UCHAR)State->SampleCount;
+#else
+			PortValues[i] = __inbyte(State->Ports[i]);
+#endif
+		}
+
+		Now = KeQueryPerformanceCounter(NULL).QuadPart;
+
+		KeReleaseSpinLock(&DiopPortReadWriteLock, Irql);
+
+		Sample = DioEdgeBuildSample(State, PortValues);
+
+		KeAcquireSpinLock(&Engine->Lock, &Irql);
+		DioEdgeProcessSample(State, Sample, Now);
+		KeReleaseSpinLock(&Engine->Lock, Irql);
+
+		// Schedule from the previous tick so that the rate does not drift, but skip the ticks
+		// which are already lost (they are counted as missed samples).
+		Next += Interval;
+		if (Now - Next > Interval)
+			Next = Now;
+
+		DiopWaitForTick(Next, Engine->Frequency, &Engine->StopRequested);
+	}
+
+	PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+VOID
+DioInitializeEdgeEngine(
+	VOID)
+/**
+ *	@brief	Initializes the edge counting engine. Called once on driver entry.
+ *	
+ *	@return								None.
+ *	
+ */
+{
+	RtlZeroMemory(&DiopEdgeEngine, sizeof(DiopEdgeEngine));
+
+	KeInitializeMutex(&DiopEdgeEngine.Mutex, 0);
+	KeInitializeSpinLock(&DiopEdgeEngine.Lock);
+}
+
+BOOLEAN
+DioStartEdgeEngine(
+	IN DIO_PACKET_START_EDGE_ENGINE *Parameters, 
+	IN DIO_PORT_RANGE *AvailableRanges, 
+	IN ULONG AvailableRangeCount)
+/**
+ *	@brief	Starts the sampler of the edge counting engine.
+ *	
+ *	Counters of the previous run are reset.
+ *	
+ *	@param	[in] Parameters				Channels, decoders and sample interval.
+ *	@param	[in] AvailableRanges		Contains multiple port address ranges that claimed by PnP manager.
+ *	@param	[in] AvailableRangeCount	Count of port address ranges.
+ *	@return								Non-zero if successful. Fails if the engine is already running.
+ *	
+ */
+{
+	DIO_EDGE_ENGINE *Engine = &DiopEdgeEngine;
+	LARGE_INTEGER Frequency;
+	NTSTATUS Status;
+	BOOLEAN Result = FALSE;
+	KIRQL Irql;
+	ULONG i;
+
+	if (KeGetCurrentIrql() != PASSIVE_LEVEL)
+		return FALSE;
+
+	if (Parameters->ChannelCount > DIO_EDGE_MAXIMUM_CHANNELS)
+		return FALSE;
+
+	for (i = 0; i < Parameters->ChannelCount; i++)
+	{
+		USHORT Port = Parameters->Channels[i].Port;
+
+		if (!DioTestPortRange(Port, Port, AvailableRanges, AvailableRangeCount))
+		{
+			DFTRACE_DBG("Inaccessible port 0x%x\n", Port);
+			return FALSE;
+		}
+	}
+
+	if (!DiopIsValidTickProcessor(Parameters->Processor))
+	{
+		DFTRACE_DBG("Invalid processor %d\n", Parameters->Processor);
+		return FALSE;
+	}
+
+	KeQueryPerformanceCounter(&Frequency);
+
+	KeWaitForSingleObject(&Engine->Mutex, Executive, KernelMode, FALSE, NULL);
+
+	do
+	{
+		if (Engine->Running)
+		{
+			DFTRACE_DBG("Already running\n");
+			break;
+		}
+
+		KeAcquireSpinLock(&Engine->Lock, &Irql);
+		Result = DioEdgeInitialize(&Engine->State, Parameters, Frequency.QuadPart);
+		Engine->Frequency = Frequency.QuadPart;
+		KeReleaseSpinLock(&Engine->Lock, Irql);
+
+		if (!Result)
+		{
+			DFTRACE_DBG("Invalid channels or decoders\n");
+			break;
+		}
+
+		Engine->Processor = Parameters->Processor;
+		Engine->StopRequested = 0;
+
+		Status = DiopCreateTickThread(DiopEdgeSamplerThread, Engine, &Engine->Thread);
+		if (!NT_SUCCESS(Status))
+		{
+			// Thread exits soon by itself if it is created but not referenced.
+			DFTRACE("Failed to start the sampler thread (0x%08lx)\n", Status);
+			InterlockedExchange(&Engine->StopRequested, 1);
+			Result = FALSE;
+			break;
+		}
+
+		Engine->Running = TRUE;
+
+		DFTRACE_DBG("Started, %d channels, %d decoders, %d ports, interval %d ns\n", 
+			Engine->State.ChannelCount, Engine->State.DecoderCount, Engine->State.PortCount, Parameters->SampleInterval);
+	} while (FALSE);
+
+	KeReleaseMutex(&Engine->Mutex, FALSE);
+
+	return Result;
+}
+
+VOID
+DioStopEdgeEngine(
+	VOID)
+/**
+ *	@brief	Stops the sampler and waits for it. Does nothing if the engine is not running.
+ *	
+ *	Counters remain readable until the next start.
+ *	
+ *	@return								None.
+ *	
+ */
+{
+	DIO_EDGE_ENGINE *Engine = &DiopEdgeEngine;
+
+	KeWaitForSingleObject(&Engine->Mutex, Executive, KernelMode, FALSE, NULL);
+
+	if (Engine->Running)
+	{
+		InterlockedExchange(&Engine->StopRequested, 1);
+
+		KeWaitForSingleObject(Engine->Thread, Executive, KernelMode, FALSE, NULL);
+		ObDereferenceObject(Engine->Thread);
+
+		Engine->Thread = NULL;
+		Engine->Running = FALSE;
+
+		DFTRACE_DBG("Stopped\n");
+	}
+
+	KeReleaseMutex(&Engine->Mutex, FALSE);
+}
+
+VOID
+DioQueryEdgeCounters(
+	OUT DIO_PACKET_QUERY_EDGE_COUNTERS *Counters)
+/**
+ *	@brief	Takes the snapshot of the edge counters.
+ *	
+ *	@param	[out] Counters				Receives the counters.
+ *	@return								None.
+ *	
+ */
+{
+	DIO_EDGE_ENGINE *Engine = &DiopEdgeEngine;
+	LONGLONG Now;
+	KIRQL Irql;
+
+	RtlZeroMemory(Counters, sizeof(*Counters));
+
+	KeAcquireSpinLock(&Engine->Lock, &Irql);
+
+	// Ages of the stopped engine are frozen at its last sample.
+	Now = Engine->Running ? KeQueryPerformanceCounter(NULL).QuadPart : Engine->State.LastTime;
+
+	DioEdgeQueryCounters(&Engine->State, Now, Engine->Frequency, Counters);
+	Counters->Running = Engine->Running;
+
+	KeReleaseSpinLock(&Engine->Lock, Irql);
+}
+
+
+VOID
+DiopStreamThread(
+	IN PVOID StartContext)
+/**
+ *	@brief	Tick thread of the output stream.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Frame is copied out under the stream lock, and written under the port lock, so the writer
+ *	never waits for the port writes.
+ *	
+ *	@param	[in] StartContext			Engine.
+ *	@return								None.
+ *	
+ */
+{
+	DIO_STREAM_ENGINE *Engine = (DIO_STREAM_ENGINE *)StartContext;
+	DIO_STREAM_STATE *State = &Engine->State;
+	UCHAR Frame[DIO_STREAM_MAXIMUM_FRAME_LENGTH];
+	LONGLONG Interval = Engine->Interval;
+	LONGLONG Lateness;
+	LONGLONG Next;
+	LONGLONG Now;
+	PUCHAR Source;
+	ULONG Offset;
+	ULONG i;
+	KIRQL Irql;
+
+	DiopSetTickThreadProcessor(Engine->Processor);
+
+	Next = KeQueryPerformanceCounter(NULL).QuadPart;
+
+	while (!Engine->StopRequested)
+	{
+		KeAcquireSpinLock(&Engine->Lock, &Irql);
+
+		Source = DioStreamNextFrame(State);
+		if (Source)
+			RtlCopyMemory(Frame, Source, State->FrameLength);
+
+		KeReleaseSpinLock(&Engine->Lock, Irql);
+
+		if (Source)
+		{
+			KeAcquireSpinLock(&DiopPortReadWriteLock, &Irql);
+
+			for (i = 0, Offset = 0; i < Engine->RangeCount; i++)
+			{
+				ULONG Length = Engine->Ranges[i].EndAddress - Engine->Ranges[i].StartAddress + 1;
+
+#ifndef __DIO_IOCTL_TEST_MODE
+				DiopInternalPortIo(Engine->Ranges[i].StartAddress, Frame + Offset, Length, TRUE);
+#endif
+				Offset += Length;
+			}
+
+			Now = KeQueryPerformanceCounter(NULL).QuadPart;
+
+			KeReleaseSpinLock(&DiopPortReadWriteLock, Irql);
+		}
+		else
+		{
+			Now = KeQueryPerformanceCounter(NULL).QuadPart;
+		}
+
+		Lateness = Now - Next;
+
+		KeAcquireSpinLock(&Engine->Lock, &Irql);
+
+		if (Lateness > Engine->MaximumLateness)
+			Engine->MaximumLateness = Lateness;
+
+		if (Lateness > Interval)
+			Engine->LateTicks++;
+
+		KeReleaseSpinLock(&Engine->Lock, Irql);
+
+		// Late tick is not made up with a burst of frames, the schedule restarts from now.
+		Next += Interval;
+		if (Now - Next > Interval)
+			Next = Now;
+
+		DiopWaitForTick(Next, Engine->Frequency, &Engine->StopRequested);
+	}
+
+	PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+VOID
+DioInitializeStream(
+	VOID)
+/**
+ *	@brief	Initializes the output stream. Called once on driver entry.
+ *	
+ *	@return								None.
+ *	
+ */
+{
+	RtlZeroMemory(&DiopStreamEngine, sizeof(DiopStreamEngine));
+
+	KeInitializeMutex(&DiopStreamEngine.Mutex, 0);
+	KeInitializeSpinLock(&DiopStreamEngine.Lock);
+}
+
+BOOLEAN
+DioStartStream(
+	IN DIO_PACKET_START_STREAM *Parameters, 
+	IN DIO_PORT_RANGE *AvailableRanges, 
+	IN ULONG AvailableRangeCount)
+/**
+ *	@brief	Allocates the frame buffer and starts the ticks of the output stream.
+ *	
+ *	Ticks start right away, and count no underrun until the first frame is written.
+ *	
+ *	@param	[in] Parameters				Tick interval, buffer size and address ranges.
+ *	@param	[in] AvailableRanges		Contains multiple port address ranges that claimed by PnP manager.
+ *	@param	[in] AvailableRangeCount	Count of port address ranges.
+ *	@return								Non-zero if successful. Fails if the stream is already running.
+ *	
+ */
+{
+	DIO_STREAM_ENGINE *Engine = &DiopStreamEngine;
+	LARGE_INTEGER Frequency;
+	PUCHAR Buffer = NULL;
+	ULONG FrameLength = 0;
+	NTSTATUS Status;
+	BOOLEAN Result = FALSE;
+	KIRQL Irql;
+	ULONG i;
+
+	if (KeGetCurrentIrql() != PASSIVE_LEVEL)
+		return FALSE;
+
+	if (!Parameters->RangeCount || Parameters->RangeCount > DIO_STREAM_MAXIMUM_RANGES || 
+		!Parameters->TickInterval || (Parameters->Flags & ~DIO_STREAM_VALID_FLAGS))
+		return FALSE;
+
+	if (!DIO_IS_OPTION_ENABLED(DIO_CFGB_ALLOW_PORT_RANGE_OVERLAP))
+	{
+		if (DiopIsPortRangesOverlapping(Parameters->AddressRange, Parameters->RangeCount))
+		{
+			DFTRACE_DBG("Range overlapping detected\n");
+			return FALSE;
+		}
+	}
+
+	for (i = 0; i < Parameters->RangeCount; i++)
+	{
+		DIO_PORT_RANGE *Range = &Parameters->AddressRange[i];
+
+		if (Range->StartAddress > Range->EndAddress || 
+			!DioTestPortRange(Range->StartAddress, Range->EndAddress, AvailableRanges, AvailableRangeCount))
+		{
+			DFTRACE_DBG("[%d] Inaccessible address range\n", i);
+			return FALSE;
+		}
+
+		FrameLength += Range->EndAddress - Range->StartAddress + 1;
+	}
+
+	if (FrameLength > DIO_STREAM_MAXIMUM_FRAME_LENGTH || !Parameters->FrameCapacity || 
+		Parameters->FrameCapacity > DIO_STREAM_MAXIMUM_BUFFER_LENGTH / FrameLength)
+	{
+		DFTRACE_DBG("Invalid buffer size (FrameLength %d, FrameCapacity %d)\n", FrameLength, Parameters->FrameCapacity);
+		return FALSE;
+	}
+
+	if (!DiopIsValidTickProcessor(Parameters->Processor))
+	{
+		DFTRACE_DBG("Invalid processor %d\n", Parameters->Processor);
+		return FALSE;
+	}
+
+	KeQueryPerformanceCounter(&Frequency);
+
+	KeWaitForSingleObject(&Engine->Mutex, Executive, KernelMode, FALSE, NULL);
+
+	do
+	{
+		if (Engine->Running)
+		{
+			DFTRACE_DBG("Already running\n");
+			break;
+		}
+
+		// Buffer is left here only if the thread of the previous start failed.
+		if (Engine->State.Buffer)
+		{
+			DIO_FREE(Engine->State.Buffer);
+			Engine->State.Buffer = NULL;
+		}
+
+		Buffer = (PUCHAR)DIO_ALLOC(FrameLength * Parameters->FrameCapacity);
+		if (!Buffer)
+		{
+			DFTRACE("Failed to allocate the frame buffer\n");
+			break;
+		}
+
+		KeAcquireSpinLock(&Engine->Lock, &Irql);
+
+		DioStreamInitialize(&Engine->State, Buffer, FrameLength, Parameters->FrameCapacity, Parameters->Flags);
+		RtlCopyMemory(Engine->Ranges, Parameters->AddressRange, Parameters->RangeCount * sizeof(DIO_PORT_RANGE));
+		Engine->RangeCount = Parameters->RangeCount;
+		Engine->Frequency = Frequency.QuadPart;
+		Engine->Interval = (LONGLONG)Parameters->TickInterval * Frequency.QuadPart / 1000000000;
+		Engine->LateTicks = 0;
+		Engine->MaximumLateness = 0;
+
+		if (!Engine->Interval)
+			Engine->Interval = 1;
+
+		KeReleaseSpinLock(&Engine->Lock, Irql);
+
+		Engine->Processor = Parameters->Processor;
+		Engine->StopRequested = 0;
+
+		Status = DiopCreateTickThread(DiopStreamThread, Engine, &Engine->Thread);
+		if (!NT_SUCCESS(Status))
+		{
+			// Thread exits soon by itself if it is created but not referenced.
+			// Buffer is left to the next start, since the thread may still be running.
+			DFTRACE("Failed to start the stream thread (0x%08lx)\n", Status);
+			InterlockedExchange(&Engine->StopRequested, 1);
+			break;
+		}
+
+		Engine->Running = TRUE;
+		Result = TRUE;
+
+		DFTRACE_DBG("Started, %d ranges, frame %d bytes x %d, interval %d ns\n", 
+			Engine->RangeCount, FrameLength, Parameters->FrameCapacity, Parameters->TickInterval);
+	} while (FALSE);
+
+	KeReleaseMutex(&Engine->Mutex, FALSE);
+
+	return Result;
+}
+
+VOID
+DiopQueryStream(
+	IN DIO_STREAM_ENGINE *Engine, 
+	OUT DIO_PACKET_QUERY_STREAM *Status)
+/**
+ *	@brief	Fills the stream status. Caller must hold the stream lock.
+ *	
+ *	This function is reserved for internal use.
+ *	
+ *	@param	[in] Engine					Stream engine.
+ *	@param	[out] Status				Receives the status.
+ *	@return								None.
+ *	
+ */
+{
+	RtlZeroMemory(Status, sizeof(*Status));
+
+	DioStreamQueryStatus(&Engine->State, Status);
+
+	Status->Running = Engine->Running;
+	Status->LateTicks = Engine->LateTicks;
+
+	if (Engine->Frequency)
+		Status->MaximumLateness = (ULONGLONG)(Engine->MaximumLateness * 1000000000 / Engine->Frequency);
+}
+
+BOOLEAN
+DioWriteStream(
+	IN DIO_PACKET_WRITE_STREAM *Packet, 
+	IN ULONG InputBufferLength, 
+	OUT DIO_PACKET_QUERY_STREAM *Status)
+/**
+ *	@brief	Appends the frames to the output stream.
+ *	
+ *	Packet and Status may be the same system buffer, so the frames are consumed before the status
+ *	is written.
+ *	
+ *	@param	[in] Packet					Frames to append.
+ *	@param	[in] InputBufferLength		Length of the packet in bytes.
+ *	@param	[out] Status				Receives the status, with the count of accepted frames.
+ *	@return								Non-zero if successful. Fails if the stream is not running.
+ *	
+ */
+{
+	DIO_STREAM_ENGINE *Engine = &DiopStreamEngine;
+	DIO_STREAM_STATE *State = &Engine->State;
+	ULONGLONG Position;
+	ULONG FrameCount = Packet->FrameCount;
+	ULONG Accepted = 0;
+	BOOLEAN Result = FALSE;
+	KIRQL Irql;
+	ULONG i;
+
+	if (KeGetCurrentIrql() != PASSIVE_LEVEL)
+		return FALSE;
+
+	KeWaitForSingleObject(&Engine->Mutex, Executive, KernelMode, FALSE, NULL);
+
+	do
+	{
+		if (!Engine->Running)
+		{
+			DFTRACE_DBG("Not running\n");
+			break;
+		}
+
+		if (FrameCount > (InputBufferLength - FIELD_OFFSET(DIO_PACKET_WRITE_STREAM, Frames)) / State->FrameLength)
+		{
+			DFTRACE_DBG("Insufficient buffer length (FrameCount %d)\n", FrameCount);
+			break;
+		}
+
+		KeAcquireSpinLock(&Engine->Lock, &Irql);
+		Accepted = DioStreamReserve(State, FrameCount, &Position);
+		KeReleaseSpinLock(&Engine->Lock, Irql);
+
+		// Reserved frames are not touched by the tick thread, and other writers wait for the mutex.
+		for (i = 0; i < Accepted; i++)
+		{
+			RtlCopyMemory(DioStreamGetFrame(State, Position + i), 
+				Packet->Frames + i * State->FrameLength, State->FrameLength);
+		}
+
+		KeAcquireSpinLock(&Engine->Lock, &Irql);
+		DioStreamCommit(State, Accepted);
+		DiopQueryStream(Engine, Status);
+		KeReleaseSpinLock(&Engine->Lock, Irql);
+
+		Status->AcceptedFrames = Accepted;
+		Result = TRUE;
+	} while (FALSE);
+
+	KeReleaseMutex(&Engine->Mutex, FALSE);
+
+	return Result;
+}
+
+VOID
+DioStopStream(
+	VOID)
+/**
+ *	@brief	Stops the ticks and frees the frame buffer. Does nothing if the stream is not running.
+ *	
+ *	Counters remain readable until the next start.
+ *	
+ *	@return								None.
+ *	
+ */
+{
+	DIO_STREAM_ENGINE *Engine = &DiopStreamEngine;
+	PUCHAR Buffer = NULL;
+	KIRQL Irql;
+
+	KeWaitForSingleObject(&Engine->Mutex, Executive, KernelMode, FALSE, NULL);
+
+	if (Engine->Running)
+	{
+		InterlockedExchange(&Engine->StopRequested, 1);
+
+		KeWaitForSingleObject(Engine->Thread, Executive, KernelMode, FALSE, NULL);
+		ObDereferenceObject(Engine->Thread);
+
+		KeAcquireSpinLock(&Engine->Lock, &Irql);
+
+		// Unplayed frames are dropped, but the counters are kept.
+		Buffer = Engine->State.Buffer;
+		Engine->State.Buffer = NULL;
+		Engine->State.WritePosition = Engine->State.PlayPosition;
+		Engine->State.SegmentCount = 0;
+
+		KeReleaseSpinLock(&Engine->Lock, Irql);
+
+		Engine->Thread = NULL;
+		Engine->Running = FALSE;
+
+		DFTRACE_DBG("Stopped\n");
+	}
+
+	KeReleaseMutex(&Engine->Mutex, FALSE);
+
+	if (Buffer)
+		DIO_FREE(Buffer);
+}
+
+VOID
+DioQueryStream(
+	OUT DIO_PACKET_QUERY_STREAM *Status)
+/**
+ *	@brief	Takes the snapshot of the stream status.
+ *	
+ *	@param	[out] Status				Receives the status.
+ *	@return								None.
+ *	
+ */
+{
+	DIO_STREAM_ENGINE *Engine = &DiopStreamEngine;
+	KIRQL Irql;
+
+	KeAcquireSpinLock(&Engine->Lock, &Irql);
+	DiopQueryStream(Engine, Status);
+	KeReleaseSpinLock(&Engine->Lock, Irql);
+}
+
+
+
+VOID
+DiopRunScheduleEntry(
+	IN DIO_SCHEDULE_ENTRY *Entry)
+/**
+ *	@brief	Accesses the ports of the entry. Caller must hold the port lock.
+ *	
+ *	This function is reserved for internal use.
+ *	
+ *	@param	[in] Entry					Entry to run.
+ *	@return								None.
+ *	
+ */
+{
+#ifdef __DIO_IOCTL_TEST_MODE
+	UNREFERENCED_PARAMETER(Entry);
+#else
+	UCHAR Value;
+	ULONG i;
+
+	for (i = 0; i < Entry->Length; i++)
+	{
+		USHORT Port = (USHORT)(Entry->Port + i);
+
+		switch (Entry->Operation)
+		{
+		case DIO_SCHEDULE_OP_WRITE:
+			Value = Entry->Data[i];
+			break;
+
+		case DIO_SCHEDULE_OP_MODIFY:
+			Value = (__inbyte(Port) & ~Entry->Mask[i]) | (Entry->Data[i] & Entry->Mask[i]);
+			break;
+
+		default:
+			Value = __inbyte(Port) ^ Entry->Mask[i];
+			break;
+		}
+
+		__outbyte(Port, Value);
+	}
+#endif
+}
+
+VOID
+DiopSchedulerThread(
+	IN PVOID StartContext)
+/**
+ *	@brief	Thread of the output scheduler.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Waits on the wakeup event until the earliest deadline is near, and spins for the rest.
+ *	The spin is cut short if an earlier entry is queued meanwhile.
+ *	
+ *	@param	[in] StartContext			Scheduler.
+ *	@return								None.
+ *	
+ */
+{
+	DIO_SCHEDULER *Scheduler = (DIO_SCHEDULER *)StartContext;
+	DIO_SCHEDULE_STATE *State = &Scheduler->State;
+	LONGLONG SleepThreshold = DIO_TICK_SLEEP_THRESHOLD * Scheduler->Frequency / 1000000;
+	LONGLONG MaximumWait = DIO_SCHEDULER_MAXIMUM_WAIT * Scheduler->Frequency / 1000000;
+	DIO_SCHEDULE_ENTRY Entry;
+	LARGE_INTEGER Timeout;
+	LONGLONG Deadline;
+	LONGLONG Wait;
+	LONGLONG Now;
+	BOOLEAN Pending;
+	KIRQL Irql;
+
+	DiopSetTickThreadProcessor(Scheduler->Processor);
+
+	while (!Scheduler->StopRequested)
+	{
+		KeAcquireSpinLock(&Scheduler->Lock, &Irql);
+		InterlockedExchange(&Scheduler->HeadChanged, 0);
+		Pending = DioSchedulePeek(State, &Deadline);
+		KeReleaseSpinLock(&Scheduler->Lock, Irql);
+
+		if (!Pending)
+		{
+			KeWaitForSingleObject(&Scheduler->Wakeup, Executive, KernelMode, FALSE, NULL);
+			continue;
+		}
+
+		Now = KeQueryPerformanceCounter(NULL).QuadPart;
+
+		// Deadlines are within DIO_SCHEDULE_MAXIMUM_HORIZON, so the difference does not overflow.
+		if (Deadline - Now > SleepThreshold)
+		{
+			Wait = min(Deadline - Now - SleepThreshold, MaximumWait);
+			Timeout.QuadPart = -Wait * 10000000 / Scheduler->Frequency;
+			KeWaitForSingleObject(&Scheduler->Wakeup, Executive, KernelMode, FALSE, &Timeout);
+			continue;
+		}
+
+		while (KeQueryPerformanceCounter(NULL).QuadPart < Deadline && 
+			!Scheduler->StopRequested && !Scheduler->HeadChanged)
+			YieldProcessor();
+
+		if (Scheduler->HeadChanged)
+			continue;
+
+		// Run every entry which is due, one lock round trip each, so the writer is not blocked long.
+		for (;;)
+		{
+			KeAcquireSpinLock(&Scheduler->Lock, &Irql);
+			Pending = DioSchedulePop(State, KeQueryPerformanceCounter(NULL).QuadPart, &Entry);
+			KeReleaseSpinLock(&Scheduler->Lock, Irql);
+
+			if (!Pending)
+				break;
+
+			KeAcquireSpinLock(&DiopPortReadWriteLock, &Irql);
+			Now = KeQueryPerformanceCounter(NULL).QuadPart;
+			DiopRunScheduleEntry(&Entry);
+			KeReleaseSpinLock(&DiopPortReadWriteLock, Irql);
+
+			KeAcquireSpinLock(&Scheduler->Lock, &Irql);
+			DioScheduleComplete(State, &Entry, Now);
+			KeReleaseSpinLock(&Scheduler->Lock, Irql);
+		}
+	}
+
+	PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+VOID
+DioInitializeScheduler(
+	VOID)
+/**
+ *	@brief	Initializes the output scheduler. Called once on driver entry.
+ *	
+ *	@return								None.
+ *	
+ */
+{
+	RtlZeroMemory(&DiopScheduler, sizeof(DiopScheduler));
+
+	KeInitializeMutex(&DiopScheduler.Mutex, 0);
+	KeInitializeSpinLock(&DiopScheduler.Lock);
+	KeInitializeEvent(&DiopScheduler.Wakeup, SynchronizationEvent, FALSE);
+}
+
+BOOLEAN
+DioStartScheduler(
+	IN DIO_PACKET_START_SCHEDULER *Parameters)
+/**
+ *	@brief	Allocates the queue and starts the scheduler thread.
+ *	
+ *	Statistics of the previous run are reset.
+ *	
+ *	@param	[in] Parameters				Capacity and processor.
+ *	@return								Non-zero if successful. Fails if the scheduler is already running.
+ *	
+ */
+{
+	DIO_SCHEDULER *Scheduler = &DiopScheduler;
+	LARGE_INTEGER Frequency;
+	PVOID Memory;
+	NTSTATUS Status;
+	BOOLEAN Result = FALSE;
+	KIRQL Irql;
+
+	if (KeGetCurrentIrql() != PASSIVE_LEVEL)
+		return FALSE;
+
+	if (!Parameters->Capacity || Parameters->Capacity > DIO_SCHEDULE_MAXIMUM_CAPACITY)
+		return FALSE;
+
+	if (!DiopIsValidTickProcessor(Parameters->Processor))
+	{
+		DFTRACE_DBG("Invalid processor %d\n", Parameters->Processor);
+		return FALSE;
+	}
+
+	KeQueryPerformanceCounter(&Frequency);
+
+	KeWaitForSingleObject(&Scheduler->Mutex, Executive, KernelMode, FALSE, NULL);
+
+	do
+	{
+		if (Scheduler->Running)
+		{
+			DFTRACE_DBG("Already running\n");
+			break;
+		}
+
+		// Memory is left here only if the thread of the previous start failed.
+		if (Scheduler->Memory)
+		{
+			DIO_FREE(Scheduler->Memory);
+			Scheduler->Memory = NULL;
+		}
+
+		Memory = DIO_ALLOC(DioScheduleGetMemoryLength(Parameters->Capacity));
+		if (!Memory)
+		{
+			DFTRACE("Failed to allocate the queue\n");
+			break;
+		}
+
+		KeAcquireSpinLock(&Scheduler->Lock, &Irql);
+		DioScheduleInitialize(&Scheduler->State, Memory, Parameters->Capacity, Frequency.QuadPart);
+		Scheduler->Memory = Memory;
+		Scheduler->Frequency = Frequency.QuadPart;
+		KeReleaseSpinLock(&Scheduler->Lock, Irql);
+
+		Scheduler->Processor = Parameters->Processor;
+		Scheduler->StopRequested = 0;
+		Scheduler->HeadChanged = 0;
+		KeClearEvent(&Scheduler->Wakeup);
+
+		Status = DiopCreateTickThread(DiopSchedulerThread, Scheduler, &Scheduler->Thread);
+		if (!NT_SUCCESS(Status))
+		{
+			// Thread exits soon by itself if it is created but not referenced.
+			DFTRACE("Failed to start the scheduler thread (0x%08lx)\n", Status);
+			InterlockedExchange(&Scheduler->StopRequested, 1);
+			KeSetEvent(&Scheduler->Wakeup, IO_NO_INCREMENT, FALSE);
+			break;
+		}
+
+		Scheduler->Running = TRUE;
+		Result = TRUE;
+
+		DFTRACE_DBG("Started, capacity %d\n", Parameters->Capacity);
+	} while (FALSE);
+
+	KeReleaseMutex(&Scheduler->Mutex, FALSE);
+
+	return Result;
+}
+
+BOOLEAN
+DioScheduleOutput(
+	IN OUT DIO_PACKET_SCHEDULE_OUTPUT *Packet, 
+	IN DIO_PORT_RANGE *AvailableRanges, 
+	IN ULONG AvailableRangeCount)
+/**
+ *	@brief	Queues the entries to the scheduler.
+ *	
+ *	All entries are validated before any is queued. Time must be within
+ *	DIO_SCHEDULE_MAXIMUM_HORIZON of the current time, so that the lateness and the wait of the
+ *	scheduler thread cannot overflow.
+ *	
+ *	@param	[in, out] Packet			Entries to queue. EntryCount receives the count of queued entries.
+ *	@param	[in] AvailableRanges		Contains multiple port address ranges that claimed by PnP manager.
+ *	@param	[in] AvailableRangeCount	Count of port address ranges.
+ *	@return								Non-zero if successful. Fails if the scheduler is not running.
+ *	
+ */
+{
+	DIO_SCHEDULER *Scheduler = &DiopScheduler;
+	BOOLEAN Wakeup = FALSE;
+	BOOLEAN Result = FALSE;
+	BOOLEAN First;
+	ULONG Accepted = 0;
+	LARGE_INTEGER Frequency;
+	LONGLONG Now = KeQueryPerformanceCounter(&Frequency).QuadPart;
+	LONGLONG Horizon = DIO_SCHEDULE_MAXIMUM_HORIZON * Frequency.QuadPart;
+	KIRQL Irql;
+	ULONG i;
+
+	for (i = 0; i < Packet->EntryCount; i++)
+	{
+		DIO_SCHEDULE_ENTRY *Entry = &Packet->Entries[i];
+
+		if (!Entry->Length || Entry->Length > DIO_SCHEDULE_MAXIMUM_LENGTH || 
+			Entry->Operation > DIO_SCHEDULE_OP_MAXIMUM || 
+			Entry->Time > Now + Horizon || Entry->Time < Now - Horizon || 
+			(ULONG)Entry->Port + Entry->Length > 0x10000 || 
+			!DioTestPortRange(Entry->Port, (USHORT)(Entry->Port + Entry->Length - 1), AvailableRanges, AvailableRangeCount))
+		{
+			DFTRACE_DBG("[%d] Invalid entry\n", i);
+			return FALSE;
+		}
+	}
+
+	KeAcquireSpinLock(&Scheduler->Lock, &Irql);
+
+	// Running is only changed under the mutex, but the queue memory is only valid while it is set.
+	if (Scheduler->Running && Scheduler->Memory)
+	{
+		for (Accepted = 0; Accepted < Packet->EntryCount; Accepted++)
+		{
+			if (!DioScheduleInsert(&Scheduler->State, &Packet->Entries[Accepted], &First))
+			{
+				// Rest of the entries are rejected too.
+				Scheduler->State.RejectedEntries += Packet->EntryCount - Accepted - 1;
+				break;
+			}
+
+			if (First)
+				Wakeup = TRUE;
+		}
+
+		Result = TRUE;
+	}
+
+	KeReleaseSpinLock(&Scheduler->Lock, Irql);
+
+	if (Wakeup)
+	{
+		InterlockedExchange(&Scheduler->HeadChanged, 1);
+		KeSetEvent(&Scheduler->Wakeup, IO_NO_INCREMENT, FALSE);
+	}
+
+	Packet->EntryCount = Accepted;
+
+	return Result;
+}
+
+VOID
+DioStopScheduler(
+	VOID)
+/**
+ *	@brief	Stops the scheduler and drops the pending entries. Does nothing if it is not running.
+ *	
+ *	Statistics remain readable until the next start.
+ *	
+ *	@return								None.
+ *	
+ */
+{
+	DIO_SCHEDULER *Scheduler = &DiopScheduler;
+	PVOID Memory = NULL;
+	KIRQL Irql;
+
+	KeWaitForSingleObject(&Scheduler->Mutex, Executive, KernelMode, FALSE, NULL);
+
+	if (Scheduler->Running)
+	{
+		InterlockedExchange(&Scheduler->StopRequested, 1);
+		KeSetEvent(&Scheduler->Wakeup, IO_NO_INCREMENT, FALSE);
+
+		KeWaitForSingleObject(Scheduler->Thread, Executive, KernelMode, FALSE, NULL);
+		ObDereferenceObject(Scheduler->Thread);
+
+		KeAcquireSpinLock(&Scheduler->Lock, &Irql);
+
+		Memory = Scheduler->Memory;
+		Scheduler->Memory = NULL;
+		Scheduler->State.Count = 0;
+		Scheduler->Running = FALSE;
+
+		KeReleaseSpinLock(&Scheduler->Lock, Irql);
+
+		Scheduler->Thread = NULL;
+
+		DFTRACE_DBG("Stopped\n");
+	}
+
+	KeReleaseMutex(&Scheduler->Mutex, FALSE);
+
+	if (Memory)
+		DIO_FREE(Memory);
+}
+
+ULONG
+DioQueryScheduler(
+	OUT DIO_PACKET_QUERY_SCHEDULER *Status, 
+	IN ULONG OutputBufferLength)
+/**
+ *	@brief	Takes the snapshot of the scheduler statistics, and moves the records out.
+ *	
+ *	@param	[out] Status				Receives the status and the records.
+ *	@param	[in] OutputBufferLength		Length of Status in bytes.
+ *	@return								Length of the output in bytes.
+ *	
+ */
+{
+	DIO_SCHEDULER *Scheduler = &DiopScheduler;
+	ULONG MaximumRecordCount;
+	KIRQL Irql;
+
+	MaximumRecordCount = (OutputBufferLength - sizeof(*Status)) / sizeof(DIO_SCHEDULE_RECORD);
+
+	RtlZeroMemory(Status, sizeof(*Status));
+
+	KeAcquireSpinLock(&Scheduler->Lock, &Irql);
+
+	DioScheduleQueryStatus(&Scheduler->State, Status, MaximumRecordCount);
+	Status->Running = Scheduler->Running;
+
+	KeReleaseSpinLock(&Scheduler->Lock, Irql);
+
+	return sizeof(*Status) + Status->RecordCount * sizeof(DIO_SCHEDULE_RECORD);
+}
+
+
+
+
+LONGLONG
+DiopRunReaction(
+	IN DIO_REACTION_PROGRAM *Program, 
+	IN LONGLONG Start)
+/**
+ *	@brief	Reads the inputs of the program, runs it if triggered, and writes the stored outputs.
+ *	Caller must hold the port lock.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Time of the run is measured from Start, so the input reads of the programs which are not
+ *	triggered are accounted to the next program which runs, and one counter read is saved.
+ *	
+ *	@param	[in] Program				Program.
+ *	@param	[in] Start					Counter value when the previous run ended.
+ *	@return								Counter value when this run ended, or Start if not triggered.
+ *	
+ */
+{
+	UCHAR Inputs[DIO_REACTION_MAXIMUM_PORTS];
+	UCHAR Outputs[DIO_REACTION_MAXIMUM_PORTS];
+	ULONG StoredOutputs;
+	LONGLONG End;
+	ULONG i;
+
+	for (i = 0; i < Program->InputCount; i++)
+	{
+#ifdef __DIO_IOCTL_TEST_MODE
+		Inputs[i] = (UCHAR)DiopReactor.Ticks;
+#else
+		Inputs[i] = __inbyte(Program->Inputs[i].Port);
+#endif
+	}
+
+	if (!DioReactionShouldRun(Program, Inputs))
+		return Start;
+
+	if (DioReactionRun(Program, Inputs, Outputs, &StoredOutputs))
+	{
+#ifndef __DIO_IOCTL_TEST_MODE
+		for (i = 0; i < Program->OutputCount; i++)
+		{
+			DIO_REACTION_PORT *Output = &Program->Outputs[i];
+
+			if (StoredOutputs & (1 << i))
+				__outbyte(Output->Port, (UCHAR)((__inbyte(Output->Port) & ~Output->Mask) | (Outputs[i] & Output->Mask)));
+		}
+#endif
+	}
+
+	End = KeQueryPerformanceCounter(NULL).QuadPart;
+	DioReactionAccountTime(Program, End - Start);
+
+	return End;
+}
+
+VOID
+DiopReactorThread(
+	IN PVOID StartContext)
+/**
+ *	@brief	Tick thread of the reactor.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Every program runs at DISPATCH_LEVEL with the port lock held, so that its read-modify-write
+ *	is not interleaved with other port accesses.
+ *	
+ *	@param	[in] StartContext			Reactor.
+ *	@return								None.
+ *	
+ */
+{
+	DIO_REACTOR *Reactor = (DIO_REACTOR *)StartContext;
+	LONGLONG Interval = Reactor->Interval;
+	LONGLONG Next;
+	LONGLONG Now;
+	ULONG i;
+	KIRQL Irql;
+
+	DiopSetTickThreadProcessor(Reactor->Processor);
+
+	Next = KeQueryPerformanceCounter(NULL).QuadPart;
+
+	while (!Reactor->StopRequested)
+	{
+		KeAcquireSpinLock(&Reactor->Lock, &Irql);
+		KeAcquireSpinLockAtDpcLevel(&DiopPortReadWriteLock);
+
+		Now = KeQueryPerformanceCounter(NULL).QuadPart;
+
+		for (i = 0; i < DIO_REACTION_MAXIMUM_PROGRAMS; i++)
+		{
+			if (Reactor->Programs[i])
+				Now = DiopRunReaction(Reactor->Programs[i], Now);
+		}
+
+		KeReleaseSpinLockFromDpcLevel(&DiopPortReadWriteLock);
+
+		Reactor->Ticks++;
+
+		KeReleaseSpinLock(&Reactor->Lock, Irql);
+
+		// Same as the edge sampler, the ticks which are already lost are skipped.
+		Next += Interval;
+		if (Now - Next > Interval)
+		{
+			Reactor->MissedTicks += (ULONG)((Now - Next) / Interval);
+			Next = Now;
+		}
+
+		DiopWaitForTick(Next, Reactor->Frequency, &Reactor->StopRequested);
+	}
+
+	PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+VOID
+DioInitializeReactor(
+	VOID)
+/**
+ *	@brief	Initializes the reactor. Called once on driver entry.
+ *	
+ *	@return								None.
+ *	
+ */
+{
+	LARGE_INTEGER Frequency;
+
+	RtlZeroMemory(&DiopReactor, sizeof(DiopReactor));
+
+	KeInitializeMutex(&DiopReactor.Mutex, 0);
+	KeInitializeSpinLock(&DiopReactor.Lock);
+
+	// Statistics of the programs are converted with it even if the reactor never runs.
+	KeQueryPerformanceCounter(&Frequency);
+	DiopReactor.Frequency = Frequency.QuadPart;
+}
+
+BOOLEAN
+DioLoadReaction(
+	IN DIO_PACKET_LOAD_REACTION *Packet, 
+	IN DIO_PORT_RANGE *AvailableRanges, 
+	IN ULONG AvailableRangeCount, 
+	OUT ULONG *Id)
+/**
+ *	@brief	Verifies the reaction program and loads it to a free slot.
+ *	
+ *	Program can be loaded while the reactor is running, and runs from the next tick.
+ *	
+ *	@param	[in] Packet					Program to load.
+ *	@param	[in] AvailableRanges		Contains multiple port address ranges that claimed by PnP manager.
+ *	@param	[in] AvailableRangeCount	Count of port address ranges.
+ *	@param	[out] Id					Receives the slot of the program.
+ *	@return								Non-zero if successful. Fails if the program is invalid or no slot is free.
+ *	
+ */
+{
+	DIO_REACTOR *Reactor = &DiopReactor;
+	DIO_REACTION_PROGRAM *Program;
+	ULONG ErrorIndex;
+	BOOLEAN Result = FALSE;
+	KIRQL Irql;
+	ULONG i;
+
+	if (KeGetCurrentIrql() != PASSIVE_LEVEL)
+		return FALSE;
+
+	if (Packet->InputCount > DIO_REACTION_MAXIMUM_PORTS || Packet->OutputCount > DIO_REACTION_MAXIMUM_PORTS)
+		return FALSE;
+
+	for (i = 0; i < (ULONG)Packet->InputCount + Packet->OutputCount; i++)
+	{
+		USHORT Port = (i < Packet->InputCount) ? 
+			Packet->Inputs[i].Port : Packet->Outputs[i - Packet->InputCount].Port;
+
+		if (!DioTestPortRange(Port, Port, AvailableRanges, AvailableRangeCount))
+		{
+			DFTRACE_DBG("Inaccessible port 0x%x\n", Port);
+			return FALSE;
+		}
+	}
+
+	Program = (DIO_REACTION_PROGRAM *)DIO_ALLOC(sizeof(*Program));
+	if (!Program)
+	{
+		DFTRACE("Failed to allocate the program\n");
+		return FALSE;
+	}
+
+	if (!DioReactionInitialize(Program, Packet, &ErrorIndex))
+	{
+		if (ErrorIndex != DIO_REACTION_NO_INSTRUCTION)
+			DFTRACE_DBG("Verification failed at instruction %d\n", ErrorIndex);
+		else
+			DFTRACE_DBG("Verification failed\n");
+
+		DIO_FREE(Program);
+		return FALSE;
+	}
+
+	KeWaitForSingleObject(&Reactor->Mutex, Executive, KernelMode, FALSE, NULL);
+
+	for (i = 0; i < DIO_REACTION_MAXIMUM_PROGRAMS; i++)
+	{
+		if (!Reactor->Programs[i])
+		{
+			KeAcquireSpinLock(&Reactor->Lock, &Irql);
+			Reactor->Programs[i] = Program;
+			KeReleaseSpinLock(&Reactor->Lock, Irql);
+
+			*Id = i;
+			Result = TRUE;
+
+			DFTRACE_DBG("Loaded to slot %d, %d instructions, step limit %d\n", 
+				i, Program->InstructionCount, Program->StepLimit);
+			break;
+		}
+	}
+
+	KeReleaseMutex(&Reactor->Mutex, FALSE);
+
+	if (!Result)
+	{
+		DFTRACE_DBG("No free slot\n");
+		DIO_FREE(Program);
+	}
+
+	return Result;
+}
+
+BOOLEAN
+DioUnloadReaction(
+	IN ULONG Id)
+/**
+ *	@brief	Unloads the reaction program. The program does not run after this returns.
+ *	
+ *	@param	[in] Id						Slot of the program, or DIO_REACTION_ALL_PROGRAMS.
+ *	@return								Non-zero if successful. Fails if the slot is empty,
+ *										except for DIO_REACTION_ALL_PROGRAMS.
+ *	
+ */
+{
+	DIO_REACTOR *Reactor = &DiopReactor;
+	DIO_REACTION_PROGRAM *Programs[DIO_REACTION_MAXIMUM_PROGRAMS];
+	BOOLEAN Result = FALSE;
+	KIRQL Irql;
+	ULONG i;
+
+	if (Id != DIO_REACTION_ALL_PROGRAMS && Id >= DIO_REACTION_MAXIMUM_PROGRAMS)
+		return FALSE;
+
+	RtlZeroMemory(Programs, sizeof(Programs));
+
+	KeWaitForSingleObject(&Reactor->Mutex, Executive, KernelMode, FALSE, NULL);
+	KeAcquireSpinLock(&Reactor->Lock, &Irql);
+
+	for (i = 0; i < DIO_REACTION_MAXIMUM_PROGRAMS; i++)
+	{
+		if (Id == DIO_REACTION_ALL_PROGRAMS || Id == i)
+		{
+			Programs[i] = Reactor->Programs[i];
+			Reactor->Programs[i] = NULL;
+		}
+	}
+
+	KeReleaseSpinLock(&Reactor->Lock, Irql);
+	KeReleaseMutex(&Reactor->Mutex, FALSE);
+
+	// Tick thread runs the programs under the lock, so they can be freed now.
+	for (i = 0; i < DIO_REACTION_MAXIMUM_PROGRAMS; i++)
+	{
+		if (Programs[i])
+		{
+			DIO_FREE(Programs[i]);
+			Result = TRUE;
+		}
+	}
+
+	return (BOOLEAN)(Result || Id == DIO_REACTION_ALL_PROGRAMS);
+}
+
+BOOLEAN
+DioStartReactor(
+	IN DIO_PACKET_START_REACTOR *Parameters)
+/**
+ *	@brief	Starts the ticks of the reactor.
+ *	
+ *	Tick counters of the previous run are reset. Statistics of the programs are kept.
+ *	
+ *	@param	[in] Parameters				Tick interval and processor.
+ *	@return								Non-zero if successful. Fails if the reactor is already running.
+ *	
+ */
+{
+	DIO_REACTOR *Reactor = &DiopReactor;
+	NTSTATUS Status;
+	BOOLEAN Result = FALSE;
+	KIRQL Irql;
+
+	if (KeGetCurrentIrql() != PASSIVE_LEVEL)
+		return FALSE;
+
+	// Back-to-back ticks would hold the port lock all the time.
+	if (!Parameters->TickInterval)
+		return FALSE;
+
+	if (!DiopIsValidTickProcessor(Parameters->Processor))
+	{
+		DFTRACE_DBG("Invalid processor %d\n", Parameters->Processor);
+		return FALSE;
+	}
+
+	KeWaitForSingleObject(&Reactor->Mutex, Executive, KernelMode, FALSE, NULL);
+
+	do
+	{
+		if (Reactor->Running)
+		{
+			DFTRACE_DBG("Already running\n");
+			break;
+		}
+
+		KeAcquireSpinLock(&Reactor->Lock, &Irql);
+		Reactor->Interval = (LONGLONG)Parameters->TickInterval * Reactor->Frequency / 1000000000;
+		Reactor->Ticks = 0;
+		Reactor->MissedTicks = 0;
+
+		if (!Reactor->Interval)
+			Reactor->Interval = 1;
+
+		KeReleaseSpinLock(&Reactor->Lock, Irql);
+
+		Reactor->Processor = Parameters->Processor;
+		Reactor->StopRequested = 0;
+
+		Status = DiopCreateTickThread(DiopReactorThread, Reactor, &Reactor->Thread);
+		if (!NT_SUCCESS(Status))
+		{
+			// Thread exits soon by itself if it is created but not referenced.
+			DFTRACE("Failed to start the reactor thread (0x%08lx)\n", Status);
+			InterlockedExchange(&Reactor->StopRequested, 1);
+			break;
+		}
+
+		Reactor->Running = TRUE;
+		Result = TRUE;
+
+		DFTRACE_DBG("Started, interval %d ns\n", Parameters->TickInterval);
+	} while (FALSE);
+
+	KeReleaseMutex(&Reactor->Mutex, FALSE);
+
+	return Result;
+}
+
+VOID
+DioStopReactor(
+	VOID)
+/**
+ *	@brief	Stops the ticks of the reactor and waits for them. Does nothing if it is not running.
+ *	
+ *	Programs remain loaded.
+ *	
+ *	@return								None.
+ *	
+ */
+{
+	DIO_REACTOR *Reactor = &DiopReactor;
+
+	KeWaitForSingleObject(&Reactor->Mutex, Executive, KernelMode, FALSE, NULL);
+
+	if (Reactor->Running)
+	{
+		InterlockedExchange(&Reactor->StopRequested, 1);
+
+		KeWaitForSingleObject(Reactor->Thread, Executive, KernelMode, FALSE, NULL);
+		ObDereferenceObject(Reactor->Thread);
+
+		Reactor->Thread = NULL;
+		Reactor->Running = FALSE;
+
+		DFTRACE_DBG("Stopped\n");
+	}
+
+	KeReleaseMutex(&Reactor->Mutex, FALSE);
+}
+
+VOID
+DioQueryReactor(
+	OUT DIO_PACKET_QUERY_REACTOR *Status)
+/**
+ *	@brief	Takes the snapshot of the reactor and the program statistics.
+ *	
+ *	@param	[out] Status				Receives the status.
+ *	@return								None.
+ *	
+ */
+{
+	DIO_REACTOR *Reactor = &DiopReactor;
+	KIRQL Irql;
+	ULONG i;
+
+	RtlZeroMemory(Status, sizeof(*Status));
+
+	KeAcquireSpinLock(&Reactor->Lock, &Irql);
+
+	Status->Running = Reactor->Running;
+	Status->MissedTicks = Reactor->MissedTicks;
+	Status->Ticks = Reactor->Ticks;
+
+	for (i = 0; i < DIO_REACTION_MAXIMUM_PROGRAMS; i++)
+	{
+		if (Reactor->Programs[i])
+			DioReactionQueryStatistics(Reactor->Programs[i], Reactor->Frequency, &Status->Programs[i]);
+	}
+
+	KeReleaseSpinLock(&Reactor->Lock, Irql);
+}
+
+
+
+
+UCHAR
+DiopRunRingSubmission(
+	IN PVOID Context, 
+	IN DIO_RING_SUBMISSION *Submission, 
+	OUT UCHAR *Data)
+/**
+ *	@brief	Runs one submission of the ring. Caller must hold the port lock.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Submission is the private copy, so the port is checked against the ranges here.
+ *	
+ *	@param	[in] Context				Ring.
+ *	@param	[in] Submission				Submission to run.
+ *	@param	[out] Data					Receives the value read.
+ *	@return								DIO_RING_STATUS_XXX.
+ *	
+ */
+{
+	DIO_RING *Ring = (DIO_RING *)Context;
+	USHORT Port = Submission->Port;
+
+	if (!DioTestPortRange(Port, Port, Ring->AvailableRanges, Ring->AvailableRangeCount))
+		return DIO_RING_STATUS_ACCESS_DENIED;
+
+#ifdef __DIO_IOCTL_TEST_MODE
+	UNREFERENCED_PARAMETER(Data);
+#else
+	switch (Submission->Operation)
+	{
+	case DIO_RING_OP_READ:
+		*Data = __inbyte(Port);
+		break;
+
+	case DIO_RING_OP_WRITE:
+		__outbyte(Port, Submission->Data);
+		break;
+
+	case DIO_RING_OP_MODIFY:
+		*Data = __inbyte(Port);
+		__outbyte(Port, (UCHAR)((*Data & ~Submission->Mask) | (Submission->Data & Submission->Mask)));
+		break;
+	}
+#endif
+
+	return DIO_RING_STATUS_SUCCESS;
+}
+
+ULONG
+DiopRunRing(
+	IN DIO_RING *Ring, 
+	IN ULONG Maximum)
+/**
+ *	@brief	Runs the pending submissions and posts their completions.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Port lock is held for DIO_RING_BATCH submissions at most, so other port accesses are not
+ *	blocked long by a full ring.
+ *	
+ *	@param	[in] Ring					Ring.
+ *	@param	[in] Maximum				Maximum count of submissions to run.
+ *	@return								Count of submissions which are run.
+ *	
+ */
+{
+	DIO_RING_CONSUMER *Consumer = &Ring->Consumer;
+	ULONG Total = 0;
+	ULONG Count;
+	KIRQL Irql;
+
+	do
+	{
+		Count = Maximum - Total;
+		if (Count > DIO_RING_BATCH)
+			Count = DIO_RING_BATCH;
+
+		KeAcquireSpinLock(&DiopPortReadWriteLock, &Irql);
+		Count = DioRingConsume(Consumer, Count, DiopRunRingSubmission, Ring);
+		KeReleaseSpinLock(&DiopPortReadWriteLock, Irql);
+
+		Total += Count;
+	} while (Count && Total < Maximum);
+
+	if (Consumer->Corrupted && !(Consumer->Shared->Flags & DIO_RING_FLAG_CORRUPTED))
+	{
+		DFTRACE("Invalid submission tail, ring is stopped\n");
+		InterlockedOr((volatile LONG *)&Consumer->Shared->Flags, DIO_RING_FLAG_CORRUPTED);
+	}
+
+	return Total;
+}
+
+VOID
+DiopRingThread(
+	IN PVOID StartContext)
+/**
+ *	@brief	Polling thread of the ring.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Polls the submission ring while the caller keeps submitting, and sleeps after IdleTime
+ *	without a submission that can run. Full completion ring counts as no submission, so the
+ *	thread sleeps until the caller reaps. DIO_RING_FLAG_NEED_WAKEUP is set before the last
+ *	check, so the caller which publishes or reaps meanwhile sees the flag and rings the doorbell.
+ *	
+ *	@param	[in] StartContext			Ring.
+ *	@return								None.
+ *	
+ */
+{
+	DIO_RING *Ring = (DIO_RING *)StartContext;
+	volatile LONG *Flags = (volatile LONG *)&Ring->Consumer.Shared->Flags;
+	LONGLONG LastWork;
+
+	DiopSetTickThreadProcessor(Ring->Processor);
+
+	LastWork = KeQueryPerformanceCounter(NULL).QuadPart;
+
+	while (!Ring->StopRequested)
+	{
+		if (DiopRunRing(Ring, Ring->Consumer.SubmissionEntries))
+		{
+			LastWork = KeQueryPerformanceCounter(NULL).QuadPart;
+			continue;
+		}
+
+		if (!Ring->Consumer.Corrupted && 
+			KeQueryPerformanceCounter(NULL).QuadPart - LastWork < Ring->IdleTime)
+		{
+			YieldProcessor();
+			continue;
+		}
+
+		InterlockedOr(Flags, DIO_RING_FLAG_NEED_WAKEUP);
+
+		if (Ring->Consumer.Corrupted || !DioRingConsumerHasWork(&Ring->Consumer))
+			KeWaitForSingleObject(&Ring->Wakeup, Executive, KernelMode, FALSE, NULL);
+
+		InterlockedAnd(Flags, ~DIO_RING_FLAG_NEED_WAKEUP);
+
+		LastWork = KeQueryPerformanceCounter(NULL).QuadPart;
+	}
+
+	PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+VOID
+DiopFreeRing(
+	IN DIO_RING *Ring)
+/**
+ *	@brief	Stops the polling thread, unmaps the shared memory from the caller and frees it.
+ *	Caller must hold the mutex of the ring.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Mapping can be removed only in the address space of its process, so the process is
+ *	attached if this is called from another one.
+ *	
+ *	@param	[in] Ring					Ring.
+ *	@return								None.
+ *	
+ */
+{
+	KAPC_STATE ApcState;
+
+	if (Ring->Thread)
+	{
+		InterlockedExchange(&Ring->StopRequested, 1);
+		KeSetEvent(&Ring->Wakeup, IO_NO_INCREMENT, FALSE);
+
+		KeWaitForSingleObject(Ring->Thread, Executive, KernelMode, FALSE, NULL);
+		ObDereferenceObject(Ring->Thread);
+
+		Ring->Thread = NULL;
+	}
+
+	if (Ring->UserAddress)
+	{
+		if (Ring->Process != PsGetCurrentProcess())
+		{
+			KeStackAttachProcess((PRKPROCESS)Ring->Process, &ApcState);
+			MmUnmapLockedPages(Ring->UserAddress, Ring->Mdl);
+			KeUnstackDetachProcess(&ApcState);
+		}
+		else
+		{
+			MmUnmapLockedPages(Ring->UserAddress, Ring->Mdl);
+		}
+
+		Ring->UserAddress = NULL;
+	}
+
+	if (Ring->Memory)
+	{
+		MmUnmapLockedPages(Ring->Memory, Ring->Mdl);
+		Ring->Memory = NULL;
+	}
+
+	if (Ring->Mdl)
+	{
+		MmFreePagesFromMdl(Ring->Mdl);
+		ExFreePool(Ring->Mdl);
+		Ring->Mdl = NULL;
+	}
+
+	if (Ring->Process)
+	{
+		ObDereferenceObject(Ring->Process);
+		Ring->Process = NULL;
+	}
+
+	Ring->FileObject = NULL;
+	Ring->Created = FALSE;
+}
+
+VOID
+DioInitializeRing(
+	VOID)
+/**
+ *	@brief	Initializes the ring. Called once on driver entry.
+ *	
+ *	@return								None.
+ *	
+ */
+{
+	RtlZeroMemory(&DiopRing, sizeof(DiopRing));
+
+	KeInitializeMutex(&DiopRing.Mutex, 0);
+	KeInitializeEvent(&DiopRing.Wakeup, SynchronizationEvent, FALSE);
+}
+
+BOOLEAN
+DioCreateRing(
+	IN DIO_PACKET_CREATE_RING *Parameters, 
+	IN DIO_PORT_RANGE *AvailableRanges, 
+	IN ULONG AvailableRangeCount, 
+	IN PFILE_OBJECT FileObject, 
+	OUT DIO_PACKET_RING_ADDRESS *Address)
+/**
+ *	@brief	Allocates the submission and completion rings and maps them to the caller.
+ *	
+ *	Ports of the submissions are checked when they are run, and the inaccessible ones are
+ *	completed with DIO_RING_STATUS_ACCESS_DENIED. Ring belongs to FileObject, so only that
+ *	handle destroys it.
+ *	
+ *	@param	[in] Parameters				Entry count, flags and the polling thread parameters.
+ *	@param	[in] AvailableRanges		Contains multiple port address ranges that claimed by PnP manager.
+ *	@param	[in] AvailableRangeCount	Count of port address ranges.
+ *	@param	[in] FileObject				File object of the caller's handle.
+ *	@param	[out] Address				Receives the shared memory. May overlap Parameters.
+ *	@return								Non-zero if successful. Fails if the ring already exists.
+ *	
+ */
+{
+	DIO_RING *Ring = &DiopRing;
+	DIO_PACKET_CREATE_RING Create = *Parameters;
+	PHYSICAL_ADDRESS LowAddress;
+	PHYSICAL_ADDRESS HighAddress;
+	PHYSICAL_ADDRESS SkipBytes;
+	LARGE_INTEGER Frequency;
+	ULONG Length;
+	NTSTATUS Status;
+	BOOLEAN Result = FALSE;
+
+	if (KeGetCurrentIrql() != PASSIVE_LEVEL)
+		return FALSE;
+
+	if (!DioRingIsValidEntries(Create.SubmissionEntries) || 
+		(Create.Flags & ~DIO_RING_CREATE_VALID_FLAGS) || 
+		Create.IdleTime > DIO_RING_MAXIMUM_IDLE_TIME)
+		return FALSE;
+
+	if ((Create.Flags & DIO_RING_CREATE_FLAG_POLL) && !DiopIsValidTickProcessor(Create.Processor))
+	{
+		DFTRACE_DBG("Invalid processor %d\n", Create.Processor);
+		return FALSE;
+	}
+
+	KeQueryPerformanceCounter(&Frequency);
+
+	// Whole pages are mapped to the caller, so the rings are allocated as pages of their own.
+	Length = (ULONG)ROUND_TO_PAGES(DioRingGetLength(Create.SubmissionEntries));
+
+	LowAddress.QuadPart = 0;
+	HighAddress.QuadPart = -1;
+	SkipBytes.QuadPart = 0;
+
+	KeWaitForSingleObject(&Ring->Mutex, Executive, KernelMode, FALSE, NULL);
+
+	do
+	{
+		if (Ring->Created)
+		{
+			DFTRACE_DBG("Already created\n");
+			break;
+		}
+
+		// Pages are zero-filled. Fewer pages than requested may be returned.
+		Ring->Mdl = MmAllocatePagesForMdl(LowAddress, HighAddress, SkipBytes, Length);
+		if (!Ring->Mdl || MmGetMdlByteCount(Ring->Mdl) != Length)
+		{
+			DFTRACE("Failed to allocate the ring\n");
+			DiopFreeRing(Ring);
+			break;
+		}
+
+		Ring->Length = Length;
+
+		Ring->Memory = MmGetSystemAddressForMdlSafe(Ring->Mdl, NormalPagePriority);
+		if (!Ring->Memory)
+		{
+			DFTRACE("Failed to map the ring to the system\n");
+			DiopFreeRing(Ring);
+			break;
+		}
+
+		Ring->Process = PsGetCurrentProcess();
+		ObReferenceObject(Ring->Process);
+		Ring->FileObject = FileObject;
+
+		__try
+		{
+			Ring->UserAddress = MmMapLockedPagesSpecifyCache(Ring->Mdl, UserMode, MmCached, NULL, FALSE, NormalPagePriority);
+		}
+		__except (EXCEPTION_EXECUTE_HANDLER)
+		{
+			Ring->UserAddress = NULL;
+		}
+
+		if (!Ring->UserAddress)
+		{
+			DFTRACE("Failed to map the ring\n");
+			DiopFreeRing(Ring);
+			break;
+		}
+
+		DioRingConsumerInitialize(&Ring->Consumer, Ring->Memory, Create.SubmissionEntries);
+
+		Ring->AvailableRanges = AvailableRanges;
+		Ring->AvailableRangeCount = AvailableRangeCount;
+		Ring->Processor = Create.Processor;
+		Ring->IdleTime = (LONGLONG)Create.IdleTime * Frequency.QuadPart / 1000000;
+		Ring->StopRequested = 0;
+		KeClearEvent(&Ring->Wakeup);
+
+		if (Create.Flags & DIO_RING_CREATE_FLAG_POLL)
+		{
+			Status = DiopCreateTickThread(DiopRingThread, Ring, &Ring->Thread);
+			if (!NT_SUCCESS(Status))
+			{
+				// Thread exits soon by itself if it is created but not referenced.
+				DFTRACE("Failed to start the polling thread (0x%08lx)\n", Status);
+				InterlockedExchange(&Ring->StopRequested, 1);
+				KeSetEvent(&Ring->Wakeup, IO_NO_INCREMENT, FALSE);
+				Ring->Thread = NULL;
+				DiopFreeRing(Ring);
+				break;
+			}
+		}
+
+		Ring->Created = TRUE;
+
+		Address->Address = (ULONGLONG)(ULONG_PTR)Ring->UserAddress;
+		Address->Length = Length;
+		Address->Reserved = 0;
+
+		Result = TRUE;
+
+		DFTRACE_DBG("Created, %d entries, %s\n", Create.SubmissionEntries, 
+			(Create.Flags & DIO_RING_CREATE_FLAG_POLL) ? "polled" : "doorbell");
+	} while (FALSE);
+
+	KeReleaseMutex(&Ring->Mutex, FALSE);
+
+	return Result;
+}
+
+BOOLEAN
+DioEnterRing(
+	OUT DIO_PACKET_ENTER_RING *Packet)
+/**
+ *	@brief	Doorbell of the ring.
+ *	
+ *	Runs the pending submissions in the caller's thread, up to one ring, or wakes the polling
+ *	thread if the ring is polled.
+ *	
+ *	@param	[out] Packet				Receives the count of submissions which are run.
+ *	@return								Non-zero if successful. Fails if no ring exists.
+ *	
+ */
+{
+	DIO_RING *Ring = &DiopRing;
+	BOOLEAN Result = FALSE;
+
+	Packet->Completed = 0;
+
+	KeWaitForSingleObject(&Ring->Mutex, Executive, KernelMode, FALSE, NULL);
+
+	if (Ring->Created)
+	{
+		if (Ring->Thread)
+			KeSetEvent(&Ring->Wakeup, IO_NO_INCREMENT, FALSE);
+		else
+			Packet->Completed = DiopRunRing(Ring, Ring->Consumer.SubmissionEntries);
+
+		Result = TRUE;
+	}
+
+	KeReleaseMutex(&Ring->Mutex, FALSE);
+
+	return Result;
+}
+
+VOID
+DioDestroyRing(
+	OPTIONAL IN PFILE_OBJECT FileObject)
+/**
+ *	@brief	Destroys the ring. Does nothing if no ring exists, or it belongs to another handle.
+ *	
+ *	Pending submissions are dropped, and the shared memory is unmapped from the process which
+ *	created the ring.
+ *	
+ *	@param	[in] FileObject				File object of the caller's handle. NULL destroys the ring of any handle.
+ *	@return								None.
+ *	
+ */
+{
+	DIO_RING *Ring = &DiopRing;
+
+	KeWaitForSingleObject(&Ring->Mutex, Executive, KernelMode, FALSE, NULL);
+
+	if (Ring->Created && (!FileObject || Ring->FileObject == FileObject))
+	{
+		DiopFreeRing(Ring);
+		DFTRACE_DBG("Destroyed\n");
+	}
+
+	KeReleaseMutex(&Ring->Mutex, FALSE);
+}
+
+
+VOID
+DiopSnapshotThread(
+	IN PVOID StartContext)
+/**
+ *	@brief	Refresh thread of the snapshot page.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Ports are read straight into the page with the port lock held, so the page is inconsistent
+ *	for the duration of the port reads only. The port lock is released and taken again every
+ *	DIO_FILE_IO_CHUNK_LENGTH ports, so a large snapshot does not hold off other port accesses.
+ *	
+ *	@param	[in] StartContext			Snapshot.
+ *	@return								None.
+ *	
+ */
+{
+	DIO_SNAPSHOT *Snapshot = (DIO_SNAPSHOT *)StartContext;
+	DIO_SNAPSHOT_PAGE *Page = Snapshot->Page;
+	LONGLONG Interval = Snapshot->Interval;
+	LONGLONG Next;
+	LONGLONG Now;
+	USHORT Port;
+	ULONG Offset;
+	ULONG Length;
+	ULONG Segment;
+	ULONG HeldLength;
+	ULONG i;
+	KIRQL Irql;
+
+	DiopSetTickThreadProcessor(Snapshot->Processor);
+
+	Next = KeQueryPerformanceCounter(NULL).QuadPart;
+
+	while (!Snapshot->StopRequested)
+	{
+		KeAcquireSpinLock(&Snapshot->Lock, &Irql);
+		KeAcquireSpinLockAtDpcLevel(&DiopPortReadWriteLock);
+
+		DioSnapshotBeginUpdate(Page, &Snapshot->Sequence);
+
+		for (i = 0, Offset = 0, HeldLength = 0; i < Snapshot->RangeCount; i++)
+		{
+			Port = Snapshot->Ranges[i].StartAddress;
+			Length = Snapshot->Ranges[i].EndAddress - Snapshot->Ranges[i].StartAddress + 1;
+
+			while (Length)
+			{
+				if (HeldLength == DIO_FILE_IO_CHUNK_LENGTH)
+				{
+					KeReleaseSpinLockFromDpcLevel(&DiopPortReadWriteLock);
+					KeAcquireSpinLockAtDpcLevel(&DiopPortReadWriteLock);
+					HeldLength = 0;
+				}
+
+				Segment = min(Length, DIO_FILE_IO_CHUNK_LENGTH - HeldLength);
+
+#ifdef __DIO_IOCTL_TEST_MODE
+				RtlFillMemory(Page->Data + Offset, Segment, (UCHAR)Snapshot->SampleCount);
+#else
+				DiopInternalPortIo(Port, Page->Data + Offset, Segment, FALSE);
+#endif
+
+				Port = (USHORT)(Port + Segment);
+				Offset += Segment;
+				Length -= Segment;
+				HeldLength += Segment;
+			}
+		}
+
+		Now = KeQueryPerformanceCounter(NULL).QuadPart;
+
+		Snapshot->SampleCount++;
+		Page->Timestamp = Now;
+		Page->SampleCount = Snapshot->SampleCount;
+
+		DioSnapshotEndUpdate(Page, &Snapshot->Sequence);
+
+		KeReleaseSpinLockFromDpcLevel(&DiopPortReadWriteLock);
+		KeReleaseSpinLock(&Snapshot->Lock, Irql);
+
+		// Readers want the latest value, so the lost refreshes are skipped rather than caught up.
+		Next += Interval;
+		if (Now - Next > Interval)
+			Next = Now;
+
+		DiopWaitForTick(Next, Snapshot->Frequency, &Snapshot->StopRequested);
+	}
+
+	PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+VOID
+DiopStopSnapshot(
+	IN DIO_SNAPSHOT *Snapshot)
+/**
+ *	@brief	Stops the refresh thread. Caller must hold the mutex of the snapshot.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Data of the last refresh is left in the page.
+ *	
+ *	@param	[in] Snapshot				Snapshot.
+ *	@return								None.
+ *	
+ */
+{
+	KIRQL Irql;
+
+	if (!Snapshot->Running)
+		return;
+
+	InterlockedExchange(&Snapshot->StopRequested, 1);
+
+	KeWaitForSingleObject(Snapshot->Thread, Executive, KernelMode, FALSE, NULL);
+	ObDereferenceObject(Snapshot->Thread);
+
+	Snapshot->Thread = NULL;
+	Snapshot->Running = FALSE;
+
+	KeAcquireSpinLock(&Snapshot->Lock, &Irql);
+
+	DioSnapshotBeginUpdate(Snapshot->Page, &Snapshot->Sequence);
+	Snapshot->Page->Running = 0;
+	DioSnapshotEndUpdate(Snapshot->Page, &Snapshot->Sequence);
+
+	KeReleaseSpinLock(&Snapshot->Lock, Irql);
+}
+
+VOID
+DiopUnmapSnapshot(
+	IN DIO_SNAPSHOT *Snapshot)
+/**
+ *	@brief	Stops the refreshes, unmaps the page from the caller and frees it.
+ *	Caller must hold the mutex of the snapshot.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Also cleans up the partial mapping which DioMapSnapshot() failed to complete.
+ *	
+ *	@param	[in] Snapshot				Snapshot.
+ *	@return								None.
+ *	
+ */
+{
+	KAPC_STATE ApcState;
+	KIRQL Irql;
+
+	if (Snapshot->Page)
+		DiopStopSnapshot(Snapshot);
+
+	KeAcquireSpinLock(&Snapshot->Lock, &Irql);
+	Snapshot->Page = NULL;
+	KeReleaseSpinLock(&Snapshot->Lock, Irql);
+
+	if (Snapshot->UserAddress)
+	{
+		if (Snapshot->Process != PsGetCurrentProcess())
+		{
+			KeStackAttachProcess((PRKPROCESS)Snapshot->Process, &ApcState);
+			ZwUnmapViewOfSection(ZwCurrentProcess(), Snapshot->UserAddress);
+			KeUnstackDetachProcess(&ApcState);
+		}
+		else
+		{
+			ZwUnmapViewOfSection(ZwCurrentProcess(), Snapshot->UserAddress);
+		}
+
+		Snapshot->UserAddress = NULL;
+	}
+
+	if (Snapshot->Mdl)
+	{
+		// Also removes the mapping of MmGetSystemAddressForMdlSafe().
+		MmUnlockPages(Snapshot->Mdl);
+		IoFreeMdl(Snapshot->Mdl);
+		Snapshot->Mdl = NULL;
+	}
+
+	if (Snapshot->SystemView)
+	{
+		MmUnmapViewInSystemSpace(Snapshot->SystemView);
+		Snapshot->SystemView = NULL;
+	}
+
+	if (Snapshot->Section)
+	{
+		ZwClose(Snapshot->Section);
+		Snapshot->Section = NULL;
+	}
+
+	if (Snapshot->Process)
+	{
+		ObDereferenceObject(Snapshot->Process);
+		Snapshot->Process = NULL;
+	}
+
+	Snapshot->FileObject = NULL;
+}
+
+VOID
+DioInitializeSnapshot(
+	VOID)
+/**
+ *	@brief	Initializes the snapshot. Called once on driver entry.
+ *	
+ *	@return								None.
+ *	
+ */
+{
+	RtlZeroMemory(&DiopSnapshot, sizeof(DiopSnapshot));
+
+	KeInitializeMutex(&DiopSnapshot.Mutex, 0);
+	KeInitializeSpinLock(&DiopSnapshot.Lock);
+}
+
+BOOLEAN
+DioMapSnapshot(
+	IN PFILE_OBJECT FileObject, 
+	OUT DIO_PACKET_SNAPSHOT_ADDRESS *Address)
+/**
+ *	@brief	Creates the snapshot page and maps it read-only to the caller.
+ *	
+ *	Page is a pagefile-backed section. The driver writes it through a locked view in the system
+ *	space, and the caller gets a PAGE_READONLY view. The driver configuration is published right
+ *	away, and the ports once DioStartSnapshot() is called.
+ *	
+ *	@param	[in] FileObject				File object of the caller's handle, which the page belongs to.
+ *	@param	[out] Address				Receives the address of the page in the caller.
+ *	@return								Non-zero if successful. Fails if the page is already mapped.
+ *	
+ */
+{
+	DIO_SNAPSHOT *Snapshot = &DiopSnapshot;
+	OBJECT_ATTRIBUTES ObjectAttributes;
+	LARGE_INTEGER MaximumSize;
+	PVOID SectionObject;
+	SIZE_T ViewSize;
+	NTSTATUS Status;
+	BOOLEAN Result = FALSE;
+	KIRQL Irql;
+
+	if (KeGetCurrentIrql() != PASSIVE_LEVEL)
+		return FALSE;
+
+	KeWaitForSingleObject(&Snapshot->Mutex, Executive, KernelMode, FALSE, NULL);
+
+	do
+	{
+		if (Snapshot->Page)
+		{
+			DFTRACE_DBG("Already mapped\n");
+			break;
+		}
+
+		InitializeObjectAttributes(&ObjectAttributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+		MaximumSize.QuadPart = DIO_SNAPSHOT_PAGE_LENGTH;
+
+		Status = ZwCreateSection(&Snapshot->Section, SECTION_ALL_ACCESS, &ObjectAttributes, &MaximumSize, 
+			PAGE_READWRITE, SEC_COMMIT, NULL);
+		if (!NT_SUCCESS(Status))
+		{
+			DFTRACE("Failed to create the section (0x%08lx)\n", Status);
+			Snapshot->Section = NULL;
+			break;
+		}
+
+		Status = ObReferenceObjectByHandle(Snapshot->Section, SECTION_MAP_READ | SECTION_MAP_WRITE, NULL, 
+			KernelMode, &SectionObject, NULL);
+		if (!NT_SUCCESS(Status))
+		{
+			DiopUnmapSnapshot(Snapshot);
+			break;
+		}
+
+		ViewSize = 0;
+		Status = MmMapViewInSystemSpace(SectionObject, &Snapshot->SystemView, &ViewSize);
+		ObDereferenceObject(SectionObject);
+
+		if (!NT_SUCCESS(Status))
+		{
+			DFTRACE("Failed to map the system view (0x%08lx)\n", Status);
+			Snapshot->SystemView = NULL;
+			DiopUnmapSnapshot(Snapshot);
+			break;
+		}
+
+		Snapshot->Mdl = IoAllocateMdl(Snapshot->SystemView, DIO_SNAPSHOT_PAGE_LENGTH, FALSE, FALSE, NULL);
+		if (!Snapshot->Mdl)
+		{
+			DFTRACE("Failed to allocate the MDL\n");
+			DiopUnmapSnapshot(Snapshot);
+			break;
+		}
+
+		__try
+		{
+			MmProbeAndLockPages(Snapshot->Mdl, KernelMode, IoWriteAccess);
+		}
+		__except (EXCEPTION_EXECUTE_HANDLER)
+		{
+			DFTRACE("Failed to lock the page\n");
+			IoFreeMdl(Snapshot->Mdl);
+			Snapshot->Mdl = NULL;
+		}
+
+		if (!Snapshot->Mdl)
+		{
+			DiopUnmapSnapshot(Snapshot);
+			break;
+		}
+
+		Snapshot->Process = PsGetCurrentProcess();
+		ObReferenceObject(Snapshot->Process);
+		Snapshot->FileObject = FileObject;
+
+		ViewSize = 0;
+		Status = ZwMapViewOfSection(Snapshot->Section, ZwCurrentProcess(), &Snapshot->UserAddress, 0, 
+			DIO_SNAPSHOT_PAGE_LENGTH, NULL, &ViewSize, ViewUnmap, 0, PAGE_READONLY);
+		if (!NT_SUCCESS(Status))
+		{
+			DFTRACE("Failed to map the page (0x%08lx)\n", Status);
+			Snapshot->UserAddress = NULL;
+			DiopUnmapSnapshot(Snapshot);
+			break;
+		}
+
+		KeAcquireSpinLock(&Snapshot->Lock, &Irql);
+
+		Snapshot->Page = (DIO_SNAPSHOT_PAGE *)MmGetSystemAddressForMdlSafe(Snapshot->Mdl, NormalPagePriority);
+		if (Snapshot->Page)
+		{
+			// Page of a new section is zero-filled.
+			Snapshot->Sequence = 0;
+			DioSnapshotBeginUpdate(Snapshot->Page, &Snapshot->Sequence);
+			Snapshot->Page->ConfigurationBits = DiopConfigurationBlock.ConfigurationBits;
+			DioSnapshotEndUpdate(Snapshot->Page, &Snapshot->Sequence);
+		}
+
+		KeReleaseSpinLock(&Snapshot->Lock, Irql);
+
+		if (!Snapshot->Page)
+		{
+			DFTRACE("Failed to map the locked page\n");
+			DiopUnmapSnapshot(Snapshot);
+			break;
+		}
+
+		Address->Address = (ULONGLONG)(ULONG_PTR)Snapshot->UserAddress;
+		Address->Length = (ULONG)ViewSize;
+		Address->Reserved = 0;
+
+		Result = TRUE;
+
+		DFTRACE_DBG("Mapped at 0x%p\n", Snapshot->UserAddress);
+	} while (FALSE);
+
+	KeReleaseMutex(&Snapshot->Mutex, FALSE);
+
+	return Result;
+}
+
+BOOLEAN
+DioStartSnapshot(
+	IN DIO_PACKET_START_SNAPSHOT *Parameters, 
+	IN DIO_PORT_RANGE *AvailableRanges, 
+	IN ULONG AvailableRangeCount)
+/**
+ *	@brief	Starts refreshing the ranges into the snapshot page.
+ *	
+ *	Refresh interval is raised to DIO_SNAPSHOT_MINIMUM_REFRESH_INTERVAL, so the refresh thread
+ *	leaves the port lock to others between the refreshes.
+ *	
+ *	@param	[in] Parameters				Refresh interval and address ranges.
+ *	@param	[in] AvailableRanges		Contains multiple port address ranges that claimed by PnP manager.
+ *	@param	[in] AvailableRangeCount	Count of port address ranges.
+ *	@return								Non-zero if successful. Fails if the page is not mapped or
+ *										the refreshes are already running.
+ *	
+ */
+{
+	DIO_SNAPSHOT *Snapshot = &DiopSnapshot;
+	DIO_SNAPSHOT_PAGE *Page;
+	LARGE_INTEGER Frequency;
+	ULONG RefreshInterval = max(Parameters->RefreshInterval, DIO_SNAPSHOT_MINIMUM_REFRESH_INTERVAL);
+	ULONG DataLength = 0;
+	NTSTATUS Status;
+	BOOLEAN Result = FALSE;
+	KIRQL Irql;
+	ULONG i;
+
+	if (KeGetCurrentIrql() != PASSIVE_LEVEL)
+		return FALSE;
+
+	if (!Parameters->RangeCount || Parameters->RangeCount > DIO_SNAPSHOT_MAXIMUM_RANGES)
+		return FALSE;
+
+	if (!DIO_IS_OPTION_ENABLED(DIO_CFGB_ALLOW_PORT_RANGE_OVERLAP))
+	{
+		if (DiopIsPortRangesOverlapping(Parameters->AddressRange, Parameters->RangeCount))
+		{
+			DFTRACE_DBG("Range overlapping detected\n");
+			return FALSE;
+		}
+	}
+
+	for (i = 0; i < Parameters->RangeCount; i++)
+	{
+		DIO_PORT_RANGE *Range = &Parameters->AddressRange[i];
+
+		if (Range->StartAddress > Range->EndAddress || 
+			!DioTestPortRange(Range->StartAddress, Range->EndAddress, AvailableRanges, AvailableRangeCount))
+		{
+			DFTRACE_DBG("[%d] Inaccessible address range\n", i);
+			return FALSE;
+		}
+
+		DataLength += Range->EndAddress - Range->StartAddress + 1;
+	}
+
+	if (DataLength > DIO_SNAPSHOT_MAXIMUM_DATA_LENGTH)
+	{
+		DFTRACE_DBG("Data does not fit in the page (%d bytes)\n", DataLength);
+		return FALSE;
+	}
+
+	if (!DiopIsValidTickProcessor(Parameters->Processor))
+	{
+		DFTRACE_DBG("Invalid processor %d\n", Parameters->Processor);
+		return FALSE;
+	}
+
+	KeQueryPerformanceCounter(&Frequency);
+
+	KeWaitForSingleObject(&Snapshot->Mutex, Executive, KernelMode, FALSE, NULL);
+
+	do
+	{
+		Page = Snapshot->Page;
+
+		if (!Page || Snapshot->Running)
+		{
+			DFTRACE_DBG("Not mapped or already running\n");
+			break;
+		}
+
+		RtlCopyMemory(Snapshot->Ranges, Parameters->AddressRange, Parameters->RangeCount * sizeof(DIO_PORT_RANGE));
+		Snapshot->RangeCount = Parameters->RangeCount;
+		Snapshot->Frequency = Frequency.QuadPart;
+		Snapshot->Interval = (LONGLONG)RefreshInterval * Frequency.QuadPart / 1000000000;
+
+		// Interval shorter than a tick of the counter.
+		if (!Snapshot->Interval)
+			Snapshot->Interval = 1;
+		Snapshot->SampleCount = 0;
+		Snapshot->Processor = Parameters->Processor;
+		Snapshot->StopRequested = 0;
+
+		KeAcquireSpinLock(&Snapshot->Lock, &Irql);
+
+		DioSnapshotBeginUpdate(Page, &Snapshot->Sequence);
+
+		Page->Running = 1;
+		Page->Interval = RefreshInterval;
+		Page->RangeCount = Parameters->RangeCount;
+		Page->DataLength = DataLength;
+		Page->Timestamp = 0;
+		Page->Frequency = Frequency.QuadPart;
+		Page->SampleCount = 0;
+		RtlCopyMemory(Page->Ranges, Snapshot->Ranges, Snapshot->RangeCount * sizeof(DIO_PORT_RANGE));
+		RtlZeroMemory(Page->Data, sizeof(Page->Data));
+
+		DioSnapshotEndUpdate(Page, &Snapshot->Sequence);
+
+		KeReleaseSpinLock(&Snapshot->Lock, Irql);
+
+		Status = DiopCreateTickThread(DiopSnapshotThread, Snapshot, &Snapshot->Thread);
+		if (!NT_SUCCESS(Status))
+		{
+			// Thread exits soon by itself if it is created but not referenced.
+			DFTRACE("Failed to start the refresh thread (0x%08lx)\n", Status);
+			InterlockedExchange(&Snapshot->StopRequested, 1);
+
+			KeAcquireSpinLock(&Snapshot->Lock, &Irql);
+			DioSnapshotBeginUpdate(Page, &Snapshot->Sequence);
+			Page->Running = 0;
+			DioSnapshotEndUpdate(Page, &Snapshot->Sequence);
+			KeReleaseSpinLock(&Snapshot->Lock, Irql);
+			break;
+		}
+
+		Snapshot->Running = TRUE;
+		Result = TRUE;
+
+		DFTRACE_DBG("Started, %d ranges, %d bytes, interval %d ns\n", 
+			Snapshot->RangeCount, DataLength, RefreshInterval);
+	} while (FALSE);
+
+	KeReleaseMutex(&Snapshot->Mutex, FALSE);
+
+	return Result;
+}
+
+VOID
+DioStopSnapshot(
+	VOID)
+/**
+ *	@brief	Stops the refreshes. The page stays mapped with the data of the last refresh.
+ *	
+ *	@return								None.
+ *	
+ */
+{
+	DIO_SNAPSHOT *Snapshot = &DiopSnapshot;
+
+	KeWaitForSingleObject(&Snapshot->Mutex, Executive, KernelMode, FALSE, NULL);
+
+	if (Snapshot->Running)
+	{
+		DiopStopSnapshot(Snapshot);
+		DFTRACE_DBG("Stopped\n");
+	}
+
+	KeReleaseMutex(&Snapshot->Mutex, FALSE);
+}
+
+VOID
+DioUnmapSnapshot(
+	OPTIONAL IN PFILE_OBJECT FileObject)
+/**
+ *	@brief	Stops the refreshes and unmaps the page. Does nothing if the page is not mapped, or it
+ *	belongs to another handle.
+ *	
+ *	@param	[in] FileObject				File object of the caller's handle. NULL unmaps the page of any handle.
+ *	@return								None.
+ *	
+ */
+{
+	DIO_SNAPSHOT *Snapshot = &DiopSnapshot;
+
+	KeWaitForSingleObject(&Snapshot->Mutex, Executive, KernelMode, FALSE, NULL);
+
+	if (Snapshot->Page && (!FileObject || Snapshot->FileObject == FileObject))
+	{
+		DiopUnmapSnapshot(Snapshot);
+		DFTRACE_DBG("Unmapped\n");
+	}
+
+	KeReleaseMutex(&Snapshot->Mutex, FALSE);
+}
+
+VOID
+DioPublishSnapshotConfiguration(
+	VOID)
+/**
+ *	@brief	Publishes the driver configuration to the snapshot page, if it is mapped.
+ *	
+ *	@return								None.
+ *	
+ */
+{
+	DIO_SNAPSHOT *Snapshot = &DiopSnapshot;
+	KIRQL Irql;
+
+	KeAcquireSpinLock(&Snapshot->Lock, &Irql);
+
+	if (Snapshot->Page)
+	{
+		DioSnapshotBeginUpdate(Snapshot->Page, &Snapshot->Sequence);
+		Snapshot->Page->ConfigurationBits = DiopConfigurationBlock.ConfigurationBits;
+		DioSnapshotEndUpdate(Snapshot->Page, &Snapshot->Sequence);
+	}
+
+	KeReleaseSpinLock(&Snapshot->Lock, Irql);
+}
+
+
+VOID
+DiopRunPortWork(
+	IN DIO_PORT_WORKER *Worker, 
+	IN PSLIST_ENTRY Entries)
+/**
+ *	@brief	Runs the requests which are taken from the queue, and signals their posters.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Queue is LIFO, so the requests are reversed to run in the order of the posts. Port lock is
+ *	held for DIO_WORKER_BATCH requests at most, so other port accesses are not blocked long by
+ *	a deep queue.
+ *	
+ *	@param	[in] Worker					Worker.
+ *	@param	[in] Entries				Requests flushed from the queue, newest first.
+ *	@return								None.
+ *	
+ */
+{
+	PSLIST_ENTRY Fifo = NULL;
+	PSLIST_ENTRY Entry;
+	PSLIST_ENTRY Next;
+	DIO_PORT_WORK *Work;
+	ULONG Count;
+	KIRQL Irql;
+
+	while (Entries)
+	{
+		Next = Entries->Next;
+		Entries->Next = Fifo;
+		Fifo = Entries;
+		Entries = Next;
+	}
+
+	while (Fifo)
+	{
+		Count = 0;
+
+		KeAcquireSpinLock(&DiopPortReadWriteLock, &Irql);
+
+		for (Entry = Fifo; Entry && Count < DIO_WORKER_BATCH; Entry = Entry->Next, Count++)
+		{
+			Work = CONTAINING_RECORD(Entry, DIO_PORT_WORK, Entry);
+			Work->Result = DioTransferPortRanges(Work->Ranges, Work->Count, Work->Buffer, Work->Write, 
+				Work->Timestamp, &Work->TransferredLength);
+		}
+
+		KeAcquireSpinLockAtDpcLevel(&Worker->Lock);
+		Worker->Requests += Count;
+		Worker->Batches++;
+		if (Worker->MaximumBatch < Count)
+			Worker->MaximumBatch = Count;
+		KeReleaseSpinLockFromDpcLevel(&Worker->Lock);
+
+		KeReleaseSpinLock(&DiopPortReadWriteLock, Irql);
+
+		// Request is gone as soon as its poster is signaled, so take the link first.
+		while (Fifo != Entry)
+		{
+			Next = Fifo->Next;
+			Work = CONTAINING_RECORD(Fifo, DIO_PORT_WORK, Entry);
+			KeSetEvent(&Work->Done, IO_NO_INCREMENT, FALSE);
+			Fifo = Next;
+		}
+	}
+}
+
+VOID
+DiopPortWorkerThread(
+	IN PVOID StartContext)
+/**
+ *	@brief	Port I/O worker thread.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Polls the queue while the requests keep coming, and sleeps after SpinTime without one.
+ *	Sleeping is set before the last check of the queue, so the poster which finds the queue
+ *	empty meanwhile sees the flag and wakes the worker.
+ *	
+ *	@param	[in] StartContext			Worker.
+ *	@return								None.
+ *	
+ */
+{
+	DIO_PORT_WORKER *Worker = (DIO_PORT_WORKER *)StartContext;
+	PSLIST_ENTRY Entries;
+	LONGLONG LastWork;
+	KIRQL Irql;
+
+	DiopSetTickThreadProcessor(Worker->Processor);
+
+	LastWork = KeQueryPerformanceCounter(NULL).QuadPart;
+
+	// Stop is requested after all posters have returned, so the queue is empty then.
+	while (!Worker->StopRequested)
+	{
+		Entries = InterlockedFlushSList(&Worker->Queue);
+		if (Entries)
+		{
+			DiopRunPortWork(Worker, Entries);
+			LastWork = KeQueryPerformanceCounter(NULL).QuadPart;
+			continue;
+		}
+
+		if (KeQueryPerformanceCounter(NULL).QuadPart - LastWork < Worker->SpinTime)
+		{
+			YieldProcessor();
+			continue;
+		}
+
+		InterlockedExchange(&Worker->Sleeping, 1);
+
+		if (!ExQueryDepthSList(&Worker->Queue) && !Worker->StopRequested)
+		{
+			KeWaitForSingleObject(&Worker->Wakeup, Executive, KernelMode, FALSE, NULL);
+
+			KeAcquireSpinLock(&Worker->Lock, &Irql);
+			Worker->Wakeups++;
+			KeReleaseSpinLock(&Worker->Lock, Irql);
+		}
+
+		InterlockedExchange(&Worker->Sleeping, 0);
+
+		LastWork = KeQueryPerformanceCounter(NULL).QuadPart;
+	}
+
+	PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+VOID
+DioInitializePortWorker(
+	VOID)
+/**
+ *	@brief	Initializes the port I/O worker. Called once on driver entry.
+ *	
+ *	@return								None.
+ *	
+ */
+{
+	RtlZeroMemory(&DiopPortWorker, sizeof(DiopPortWorker));
+
+	InitializeSListHead(&DiopPortWorker.Queue);
+	KeInitializeMutex(&DiopPortWorker.Mutex, 0);
+	KeInitializeSpinLock(&DiopPortWorker.Lock);
+	KeInitializeEvent(&DiopPortWorker.Wakeup, SynchronizationEvent, FALSE);
+
+	// Rundown is completed while the worker is stopped, so the posts fail and take the port lock.
+	ExInitializeRundownProtection(&DiopPortWorker.Rundown);
+	ExWaitForRundownProtectionRelease(&DiopPortWorker.Rundown);
+}
+
+BOOLEAN
+DioStartPortWorker(
+	IN DIO_PACKET_START_WORKER *Parameters)
+/**
+ *	@brief	Starts the worker which runs the port reads and writes of all callers.
+ *	
+ *	Callers post their requests to a lock-free queue and wait, instead of contending for the
+ *	port lock. The worker runs them in the order of the posts.\n
+ *	The worker spins on one processor while it polls, so pick the processor with care.
+ *	
+ *	@param	[in] Parameters				Processor and spin time of the worker.
+ *	@return								Non-zero if successful. Fails if the worker is running.
+ *	
+ */
+{
+	DIO_PORT_WORKER *Worker = &DiopPortWorker;
+	DIO_PACKET_START_WORKER Start = *Parameters;
+	LARGE_INTEGER Frequency;
+	NTSTATUS Status;
+	BOOLEAN Result = FALSE;
+
+	if (KeGetCurrentIrql() != PASSIVE_LEVEL)
+		return FALSE;
+
+	if (Start.SpinTime > DIO_WORKER_MAXIMUM_SPIN_TIME)
+		return FALSE;
+
+	if (!DiopIsValidTickProcessor(Start.Processor))
+	{
+		DFTRACE_DBG("Invalid processor %d\n", Start.Processor);
+		return FALSE;
+	}
+
+	KeQueryPerformanceCounter(&Frequency);
+
+	KeWaitForSingleObject(&Worker->Mutex, Executive, KernelMode, FALSE, NULL);
+
+	do
+	{
+		if (Worker->Running)
+		{
+			DFTRACE_DBG("Already running\n");
+			break;
+		}
+
+		Worker->Processor = Start.Processor;
+		Worker->SpinTime = (LONGLONG)Start.SpinTime * Frequency.QuadPart / 1000000;
+		Worker->StopRequested = 0;
+		Worker->Sleeping = 0;
+		Worker->Requests = 0;
+		Worker->Batches = 0;
+		Worker->Wakeups = 0;
+		Worker->MaximumBatch = 0;
+		KeClearEvent(&Worker->Wakeup);
+
+		Status = DiopCreateTickThread(DiopPortWorkerThread, Worker, &Worker->Thread);
+		if (!NT_SUCCESS(Status))
+		{
+			// Thread exits soon by itself if it is created but not referenced.
+			DFTRACE("Failed to start the worker (0x%08lx)\n", Status);
+			InterlockedExchange(&Worker->StopRequested, 1);
+			KeSetEvent(&Worker->Wakeup, IO_NO_INCREMENT, FALSE);
+			Worker->Thread = NULL;
+			break;
+		}
+
+		// Posts are accepted from now on.
+		ExReInitializeRundownProtection(&Worker->Rundown);
+		Worker->Running = TRUE;
+
+		Result = TRUE;
+
+		DFTRACE_DBG("Started on processor %d\n", Start.Processor);
+	} while (FALSE);
+
+	KeReleaseMutex(&Worker->Mutex, FALSE);
+
+	return Result;
+}
+
+VOID
+DioStopPortWorker(
+	VOID)
+/**
+ *	@brief	Stops the worker. Does nothing if the worker is not running.
+ *	
+ *	Requests which are already posted are run first. Later ones take the port lock in the
+ *	caller's thread again.
+ *	
+ *	@return								None.
+ *	
+ */
+{
+	DIO_PORT_WORKER *Worker = &DiopPortWorker;
+
+	KeWaitForSingleObject(&Worker->Mutex, Executive, KernelMode, FALSE, NULL);
+
+	if (Worker->Running)
+	{
+		ExWaitForRundownProtectionRelease(&Worker->Rundown);
+
+		InterlockedExchange(&Worker->StopRequested, 1);
+		KeSetEvent(&Worker->Wakeup, IO_NO_INCREMENT, FALSE);
+
+		KeWaitForSingleObject(Worker->Thread, Executive, KernelMode, FALSE, NULL);
+		ObDereferenceObject(Worker->Thread);
+
+		Worker->Thread = NULL;
+		Worker->Running = FALSE;
+
+		DFTRACE_DBG("Stopped, %I64u requests in %I64u batches\n", Worker->Requests, Worker->Batches);
+	}
+
+	KeReleaseMutex(&Worker->Mutex, FALSE);
+}
+
+VOID
+DioQueryPortWorker(
+	OUT DIO_PACKET_QUERY_WORKER *Status)
+/**
+ *	@brief	Queries the statistics of the worker.
+ *	
+ *	@param	[out] Status				Receives the statistics. Kept after the stop.
+ *	@return								None.
+ *	
+ */
+{
+	DIO_PORT_WORKER *Worker = &DiopPortWorker;
+	KIRQL Irql;
+
+	RtlZeroMemory(Status, sizeof(*Status));
+
+	KeAcquireSpinLock(&Worker->Lock, &Irql);
+
+	Status->Running = Worker->Running;
+	Status->MaximumBatch = Worker->MaximumBatch;
+	Status->Requests = Worker->Requests;
+	Status->Batches = Worker->Batches;
+	Status->Wakeups = Worker->Wakeups;
+
+	KeReleaseSpinLock(&Worker->Lock, Irql);
+}
+
+BOOLEAN
+DioPostPortIo(
+	IN DIO_PORT_RANGE *Ranges, 
+	IN ULONG Count, 
+	IN OUT PUCHAR Buffer, 
+	IN BOOLEAN Write, 
+	OPTIONAL OUT DIO_PORT_IO_TIMESTAMP *Timestamp, 
+	OUT ULONG *TransferredLength, 
+	OUT BOOLEAN *Result)
+/**
+ *	@brief	Runs the validated port transfer on the worker and waits for it.
+ *	
+ *	Ranges and Buffer must stay resident until this returns. The wait is in kernel mode, so the
+ *	stack of the caller is not paged out meanwhile.
+ *	
+ *	@param	[in] Ranges					Port ranges which are checked by DioPortIo().
+ *	@param	[in] Count					Number of port range.
+ *	@param	[in, out] Buffer			Data of all ranges, in the order of Ranges.
+ *	@param	[in] Write					Port input if FALSE, port output otherwise.
+ *	@param	[out, opt] Timestamp		Receives the performance counter values around the port accesses.
+ *	@param	[out] TransferredLength		Receives the transferred length in bytes.
+ *	@param	[out] Result				Receives the result of DioTransferPortRanges().
+ *	@return								Non-zero if the worker has run the transfer. FALSE if the
+ *										worker is not running, so the caller must run it.
+ *	
+ */
+{
+	DIO_PORT_WORKER *Worker = &DiopPortWorker;
+	DIO_PORT_WORK Work;
+
+	// Unsynchronized check keeps the rundown line untouched while the worker is stopped.
+	if (!Worker->Running || KeGetCurrentIrql() > APC_LEVEL)
+		return FALSE;
+
+	if (!ExAcquireRundownProtection(&Worker->Rundown))
+		return FALSE;
+
+	Work.Ranges = Ranges;
+	Work.Count = Count;
+	Work.Buffer = Buffer;
+	Work.Write = Write;
+	Work.Timestamp = Timestamp;
+	Work.TransferredLength = 0;
+	Work.Result = FALSE;
+	KeInitializeEvent(&Work.Done, NotificationEvent, FALSE);
+
+	// Only the post to the empty queue can find the worker asleep.
+	if (!InterlockedPushEntrySList(&Worker->Queue, &Work.Entry) && Worker->Sleeping)
+		KeSetEvent(&Worker->Wakeup, IO_NO_INCREMENT, FALSE);
+
+	KeWaitForSingleObject(&Work.Done, Executive, KernelMode, FALSE, NULL);
+
+	ExReleaseRundownProtection(&Worker->Rundown);
+
+	*TransferredLength = Work.TransferredLength;
+	*Result = Work.Result;
+
+	return TRUE;
+}
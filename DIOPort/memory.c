@@ -0,0 +1,720 @@
+#include <ntddk.h>
+#include "../Include/dioctl.h"
+#include "dioport.h"
+
+// Widest register access. READ_REGISTER_ULONG64 and its friends exist on 64-bit targets only.
+#ifdef _WIN64
+#define DIO_MEMORY_MAXIMUM_WIDTH				8
+#else
+#define DIO_MEMORY_MAXIMUM_WIDTH				4
+#endif
+
+#define DIO_IS_VALID_MEMORY_WIDTH(_width)	(				\
+	(_width) && (_width) <= DIO_MEMORY_MAXIMUM_WIDTH &&		\
+	!((_width) & ((_width) - 1))							\
+)
+
+C_ASSERT(DIO_MEMORY_WINDOW_ALIGNMENT == PAGE_SIZE);
+
+typedef struct _DIO_MEMORY_WINDOW {
+	PMDL Mdl;						// Describes the registers of the window. NULL if not mapped.
+	PVOID UserAddress;				// Registers mapped to Process.
+	PEPROCESS Process;				// Referenced while the window is mapped.
+	PFILE_OBJECT FileObject;		// Handle which mapped the window. Its cleanup unmaps the window.
+} DIO_MEMORY_WINDOW;
+
+typedef struct _DIO_MEMORY_WINDOWS {
+	KMUTEX Mutex;					// Serializes map and unmap of the windows and of the resources.
+	DIO_MEMORY_WINDOW Windows[DIO_MAXIMUM_MEMORY_RANGES];	// Indexed by the memory resource.
+} DIO_MEMORY_WINDOWS;
+
+static DIO_MEMORY_WINDOWS DiopMemoryWindows;
+
+
+static
+BOOLEAN
+DiopIsMappableResource(
+	IN DIO_MEMORY_RESOURCE *Resource)
+/**
+ *	@brief	Tests the resource can be mapped to the caller.
+ *	
+ *	A resource smaller than a page may share its page with the registers of another device,
+ *	so only whole pages of the resource are mapped.
+ */
+{
+	return (BOOLEAN)(Resource->SystemAddress && 
+		!BYTE_OFFSET(Resource->PhysicalAddress.LowPart) && 
+		Resource->Length >= PAGE_SIZE);
+}
+
+static
+VOID
+DiopMemoryAccess(
+	IN PUCHAR Register, 
+	IN OUT PUCHAR Buffer, 
+	IN ULONG Width, 
+	IN BOOLEAN Write)
+/**
+ *	@brief	Reads or writes one register with one volatile access of Width bytes.
+ *	
+ *	Buffer may be unaligned, so the value is copied through a local.
+ */
+{
+#ifdef __DIO_IOCTL_TEST_MODE
+	ULONG i;
+
+	UNREFERENCED_PARAMETER(Register);
+
+	if (Write)
+		DioDbgDumpBytes("Writing register", Width, 16, Buffer);
+	else
+	{
+		for (i = 0; i < Width; i++)
+			Buffer[i] = ((i & 0x0f) << 4) | (i & 0x0f);
+	}
+#else
+	union {
+		UCHAR Byte;
+		USHORT Word;
+		ULONG Dword;
+		ULONG64 Qword;
+	} Value;
+
+	if (Write)
+		RtlCopyMemory(&Value, Buffer, Width);
+
+	switch (Width)
+	{
+	case 1:
+		if (Write)
+			WRITE_REGISTER_UCHAR(Register, Value.Byte);
+		else
+			Value.Byte = READ_REGISTER_UCHAR(Register);
+		break;
+
+	case 2:
+		if (Write)
+			WRITE_REGISTER_USHORT((PUSHORT)Register, Value.Word);
+		else
+			Value.Word = READ_REGISTER_USHORT((PUSHORT)Register);
+		break;
+
+	case 4:
+		if (Write)
+			WRITE_REGISTER_ULONG((PULONG)Register, Value.Dword);
+		else
+			Value.Dword = READ_REGISTER_ULONG((PULONG)Register);
+		break;
+
+#ifdef _WIN64
+	case 8:
+		// Older WDKs have no READ_REGISTER_ULONG64. On x64 it is this volatile access.
+		if (Write)
+		{
+			*(volatile ULONG64 *)Register = Value.Qword;
+			KeMemoryBarrier();
+		}
+		else
+		{
+			Value.Qword = *(volatile ULONG64 *)Register;
+		}
+		break;
+#endif
+	}
+
+	if (!Write)
+		RtlCopyMemory(Buffer, &Value, Width);
+#endif
+}
+
+VOID
+DiopUnmapMemoryWindow(
+	IN DIO_MEMORY_WINDOW *Window)
+/**
+ *	@brief	Unmaps the window from the caller. Caller must hold the mutex of the windows.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Also cleans up the partial mapping which DioMapMemoryWindow() failed to complete.
+ *	
+ *	@param	[in] Window					Window.
+ *	@return								None.
+ *	
+ */
+{
+	KAPC_STATE ApcState;
+
+	if (Window->UserAddress)
+	{
+		if (Window->Process != PsGetCurrentProcess())
+		{
+			KeStackAttachProcess((PRKPROCESS)Window->Process, &ApcState);
+			MmUnmapLockedPages(Window->UserAddress, Window->Mdl);
+			KeUnstackDetachProcess(&ApcState);
+		}
+		else
+		{
+			MmUnmapLockedPages(Window->UserAddress, Window->Mdl);
+		}
+
+		Window->UserAddress = NULL;
+	}
+
+	if (Window->Mdl)
+	{
+		IoFreeMdl(Window->Mdl);
+		Window->Mdl = NULL;
+	}
+
+	if (Window->Process)
+	{
+		ObDereferenceObject(Window->Process);
+		Window->Process = NULL;
+	}
+
+	Window->FileObject = NULL;
+}
+
+VOID
+DioInitializeMemoryWindows(
+	VOID)
+/**
+ *	@brief	Initializes the memory windows. Called once on driver entry.
+ *	
+ *	@return								None.
+ *	
+ */
+{
+	RtlZeroMemory(&DiopMemoryWindows, sizeof(DiopMemoryWindows));
+
+	KeInitializeMutex(&DiopMemoryWindows.Mutex, 0);
+}
+
+BOOLEAN
+DioMapMemoryResource(
+	IN OUT DIO_DEVICE_EXTENSION *DeviceExtension, 
+	IN PHYSICAL_ADDRESS PhysicalAddress, 
+	IN ULONG Length)
+/**
+ *	@brief	Maps the translated memory resource to the system space and adds it to the device.
+ *	
+ *	Registers must not be cached, so the mapping is uncached.
+ *	
+ *	@param	[in, out] DeviceExtension	Device extension.
+ *	@param	[in] PhysicalAddress		Translated physical address of the resource.
+ *	@param	[in] Length					Length of the resource in bytes.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIO_MEMORY_RESOURCE *Resource;
+	PVOID SystemAddress;
+	KIRQL Irql;
+
+	if (!Length)
+		return FALSE;
+
+	if (DeviceExtension->MemoryRangeCount >= DIO_MAXIMUM_MEMORY_RANGES)
+	{
+		DFTRACE("Too many memory resources, 0x%I64x ignored\n", PhysicalAddress.QuadPart);
+		return FALSE;
+	}
+
+	SystemAddress = MmMapIoSpace(PhysicalAddress, Length, MmNonCached);
+	if (!SystemAddress)
+	{
+		DFTRACE("Failed to map 0x%I64x, Length 0x%lx\n", PhysicalAddress.QuadPart, Length);
+		return FALSE;
+	}
+
+	KeAcquireSpinLock(&DiopPortReadWriteLock, &Irql);
+
+	Resource = DeviceExtension->MemoryResources + DeviceExtension->MemoryRangeCount;
+	Resource->PhysicalAddress = PhysicalAddress;
+	Resource->Length = Length;
+	Resource->SystemAddress = (PUCHAR)SystemAddress;
+	DeviceExtension->MemoryRangeCount++;
+
+	KeReleaseSpinLock(&DiopPortReadWriteLock, Irql);
+
+	return TRUE;
+}
+
+VOID
+DioUnmapMemoryResources(
+	IN OUT DIO_DEVICE_EXTENSION *DeviceExtension)
+/**
+ *	@brief	Unmaps the windows and the memory resources of the device. Called on the stop.
+ *	
+ *	Addresses are cleared under the port lock, which every register access holds, so no access
+ *	is in flight when the resources are unmapped.
+ *	
+ *	@param	[in, out] DeviceExtension	Device extension.
+ *	@return								None.
+ *	
+ */
+{
+	DIO_MEMORY_RESOURCE *Resources = DeviceExtension->MemoryResources;
+	PUCHAR SystemAddresses[DIO_MAXIMUM_MEMORY_RANGES];
+	ULONG Count;
+	ULONG i;
+	KIRQL Irql;
+
+	KeWaitForSingleObject(&DiopMemoryWindows.Mutex, Executive, KernelMode, FALSE, NULL);
+
+	for (i = 0; i < DIO_MAXIMUM_MEMORY_RANGES; i++)
+		DiopUnmapMemoryWindow(DiopMemoryWindows.Windows + i);
+
+	KeAcquireSpinLock(&DiopPortReadWriteLock, &Irql);
+
+	Count = DeviceExtension->MemoryRangeCount;
+
+	for (i = 0; i < Count; i++)
+	{
+		SystemAddresses[i] = Resources[i].SystemAddress;
+		Resources[i].SystemAddress = NULL;
+	}
+
+	DeviceExtension->MemoryRangeCount = 0;
+
+	KeReleaseSpinLock(&DiopPortReadWriteLock, Irql);
+
+	KeReleaseMutex(&DiopMemoryWindows.Mutex, FALSE);
+
+	for (i = 0; i < Count; i++)
+	{
+		if (SystemAddresses[i])
+			MmUnmapIoSpace(SystemAddresses[i], Resources[i].Length);
+	}
+}
+
+VOID
+DioQueryMemoryResources(
+	IN DIO_DEVICE_EXTENSION *DeviceExtension, 
+	OUT DIO_PACKET_QUERY_MEMORY_RESOURCES *Packet, 
+	IN ULONG PacketLength, 
+	OUT ULONG *OutputActualLength)
+/**
+ *	@brief	Reports the memory resources of the device, as many as the packet can hold.
+ *	
+ *	@param	[in] DeviceExtension		Device extension.
+ *	@param	[out] Packet				Receives the ranges.
+ *	@param	[in] PacketLength			Length of Packet. Holds the header at least.
+ *	@param	[out] OutputActualLength	Receives the output length.
+ *	@return								None.
+ *	
+ */
+{
+	ULONG RangeCount = DeviceExtension->MemoryRangeCount;
+	ULONG CopyCount = (PacketLength - sizeof(*Packet)) / sizeof(DIO_MEMORY_RANGE);
+	ULONG i;
+
+	if (CopyCount > RangeCount)
+		CopyCount = RangeCount;
+
+	for (i = 0; i < CopyCount; i++)
+	{
+		DIO_MEMORY_RESOURCE *Resource = DeviceExtension->MemoryResources + i;
+
+		Packet->AddressRange[i].PhysicalAddress = (ULONGLONG)Resource->PhysicalAddress.QuadPart;
+		Packet->AddressRange[i].Length = Resource->Length;
+		Packet->AddressRange[i].Flags = DiopIsMappableResource(Resource) ? DIO_MEMORY_RANGE_FLAG_MAPPABLE : 0;
+	}
+
+	Packet->RangeCount = RangeCount;
+
+	*OutputActualLength = PACKET_QUERY_MEMORY_RESOURCES_GET_LENGTH(CopyCount);
+}
+
+BOOLEAN
+DiopMeasureMemoryDescriptors(
+	IN DIO_MEMORY_DESCRIPTOR *Descriptors, 
+	IN ULONG DescriptorCount, 
+	OUT ULONG *DataLength)
+/**
+ *	@brief	Validates the memory descriptors and calculates the data length.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Only the layout is checked here. DiopTestMemoryDescriptor() checks it against the resources.
+ *	
+ *	@param	[in] Descriptors			Memory descriptors.
+ *	@param	[in] DescriptorCount		Count of Descriptors.
+ *	@param	[out] DataLength			Receives the data length in bytes.
+ *	@return								Non-zero if every descriptor is valid and the data length
+ *										does not exceed DIO_PORT_IO_V2_MAXIMUM_DATA_LENGTH.
+ *	
+ */
+{
+	ULONGLONG Length = 0;
+	ULONG i;
+
+	for (i = 0; i < DescriptorCount; i++)
+	{
+		DIO_MEMORY_DESCRIPTOR *Descriptor = Descriptors + i;
+
+		if (!Descriptor->Count || !Descriptor->Repeat)
+		{
+			DFTRACE_DBG("[%d] Empty descriptor\n", i);
+			return FALSE;
+		}
+
+		if (!DIO_IS_VALID_MEMORY_WIDTH(Descriptor->Width) || 
+			((Descriptor->Offset | Descriptor->Stride) & (Descriptor->Width - 1)))
+		{
+			DFTRACE_DBG("[%d] Invalid width %d or misaligned (Offset 0x%lx, Stride 0x%lx)\n", 
+				i, Descriptor->Width, Descriptor->Offset, Descriptor->Stride);
+			return FALSE;
+		}
+
+		if (Descriptor->Resource >= DIO_MAXIMUM_MEMORY_RANGES)
+		{
+			DFTRACE_DBG("[%d] Invalid resource %d\n", i, Descriptor->Resource);
+			return FALSE;
+		}
+
+		Length += (ULONGLONG)Descriptor->Count * Descriptor->Width * Descriptor->Repeat;
+
+		if (Length > DIO_PORT_IO_V2_MAXIMUM_DATA_LENGTH)
+		{
+			DFTRACE_DBG("[%d] Data length exceeded\n", i);
+			return FALSE;
+		}
+	}
+
+	*DataLength = (ULONG)Length;
+
+	return TRUE;
+}
+
+BOOLEAN
+DiopTestMemoryDescriptor(
+	IN DIO_MEMORY_DESCRIPTOR *Descriptor, 
+	IN DIO_MEMORY_RESOURCE *Resources, 
+	IN ULONG ResourceCount)
+/**
+ *	@brief	Tests every element of the descriptor is inside its memory resource.
+ *	
+ *	This function is reserved for internal use.
+ *	
+ *	@param	[in] Descriptor				Memory descriptor which is validated by DiopMeasureMemoryDescriptors().
+ *	@param	[in] Resources				Memory resources of the device.
+ *	@param	[in] ResourceCount			Count of Resources.
+ *	@return								Returns FALSE if non-accessible, TRUE otherwise.
+ *	
+ */
+{
+	ULONGLONG LastOffset;
+
+	if (Descriptor->Resource >= ResourceCount || !Resources[Descriptor->Resource].SystemAddress)
+		return FALSE;
+
+	LastOffset = (ULONGLONG)Descriptor->Offset +
+		(ULONGLONG)(Descriptor->Count - 1) * Descriptor->Stride + Descriptor->Width - 1;
+
+	return (BOOLEAN)(LastOffset < Resources[Descriptor->Resource].Length);
+}
+
+BOOLEAN
+DiopTransferMemoryDescriptors(
+	IN DIO_MEMORY_RESOURCE *Resources, 
+	IN DIO_MEMORY_DESCRIPTOR *Descriptors, 
+	IN ULONG DescriptorCount, 
+	IN OUT PUCHAR Buffer, 
+	IN BOOLEAN Write, 
+	OPTIONAL OUT DIO_PORT_IO_TIMESTAMP *Timestamp)
+/**
+ *	@brief	Transfers the tested memory descriptors, one register access per element.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Port lock orders the register accesses with the port I/O, and is released and taken again
+ *	whenever it has been held for DIO_FILE_IO_CHUNK_LENGTH bytes, as the port descriptors do.
+ *	
+ *	@param	[in] Resources				Memory resources of the device.
+ *	@param	[in] Descriptors			Memory descriptors which are tested by DiopTestMemoryDescriptor().
+ *	@param	[in] DescriptorCount		Count of Descriptors.
+ *	@param	[in, out] Buffer			Data of all descriptors, in the order of Descriptors.
+ *	@param	[in] Write					Register read if FALSE, register write otherwise.
+ *	@param	[out, opt] Timestamp		Receives the performance counter values around the accesses.
+ *	@return								Non-zero if successful. Fails if the device is stopped meanwhile.
+ *	
+ */
+{
+	ULONG HeldLength = 0;
+	BOOLEAN Result = TRUE;
+	ULONG i, j, k;
+	KIRQL Irql;
+
+	KeAcquireSpinLock(&DiopPortReadWriteLock, &Irql);
+
+	if (Timestamp)
+		Timestamp->StartTime = KeQueryPerformanceCounter(NULL).QuadPart;
+
+	for (i = 0; i < DescriptorCount && Result; i++)
+	{
+		DIO_MEMORY_DESCRIPTOR Descriptor = Descriptors[i];
+
+		for (j = 0; j < Descriptor.Repeat && Result; j++)
+		{
+			for (k = 0; k < Descriptor.Count; k++)
+			{
+				// Resource may be unmapped by the stop of the device while the lock is released.
+				PUCHAR Base = Resources[Descriptor.Resource].SystemAddress;
+
+				if (!Base)
+				{
+					Result = FALSE;
+					break;
+				}
+
+				DiopMemoryAccess(Base + Descriptor.Offset + k * Descriptor.Stride, Buffer, Descriptor.Width, Write);
+
+				Buffer += Descriptor.Width;
+				HeldLength += Descriptor.Width;
+
+				if (HeldLength >= DIO_FILE_IO_CHUNK_LENGTH)
+				{
+					KeReleaseSpinLock(&DiopPortReadWriteLock, Irql);
+					KeAcquireSpinLock(&DiopPortReadWriteLock, &Irql);
+					HeldLength = 0;
+				}
+			}
+		}
+	}
+
+	if (Timestamp)
+	{
+		LARGE_INTEGER Frequency;
+
+		Timestamp->EndTime = KeQueryPerformanceCounter(&Frequency).QuadPart;
+		Timestamp->Frequency = Frequency.QuadPart;
+	}
+
+	KeReleaseSpinLock(&DiopPortReadWriteLock, Irql);
+
+	return Result;
+}
+
+NTSTATUS
+DiopDispatchMemoryIoV2(
+	IN DIO_DEVICE_EXTENSION *DeviceExtension, 
+	IN DIO_PACKET_MEMORY_IO_V2 *MemoryIo, 
+	IN ULONG IoControlCode, 
+	IN OUT PUCHAR Buffer, 
+	OUT ULONG *OutputActualLength)
+/**
+ *	@brief	Runs the validated version 2 packet of the memory space.
+ *	
+ *	This function is reserved for internal use.
+ *	
+ *	@param	[in] DeviceExtension		Device extension.
+ *	@param	[in] MemoryIo				Packet which is validated by DiopValidatePacketBuffer().
+ *	@param	[in] IoControlCode			DIO_IOCTL_READ_PORT_V2 or DIO_IOCTL_WRITE_PORT_V2.
+ *	@param	[in, out] Buffer			System address of the output buffer. [Data] [Timestamp]
+ *	@param	[out] OutputActualLength	Receives the output length.
+ *	@return								STATUS_SUCCESS if successful.
+ *	
+ */
+{
+	DIO_PORT_IO_TIMESTAMP Timestamp;
+	BOOLEAN Write = (BOOLEAN)(IoControlCode == DIO_IOCTL_WRITE_PORT_V2);
+	BOOLEAN Timed = (BOOLEAN)((MemoryIo->Flags & DIO_PORT_IO_V2_FLAG_TIMESTAMP) != 0);
+	ULONG DataLength = 0;
+	ULONG i;
+
+	DFTRACE_DBG("Memory %s request with %d descriptors\n", Write ? "write" : "read", MemoryIo->DescriptorCount);
+
+	*OutputActualLength = 0;
+
+	if (!DiopMeasureMemoryDescriptors(MemoryIo->Descriptors, MemoryIo->DescriptorCount, &DataLength))
+		return STATUS_INVALID_PARAMETER;
+
+	for (i = 0; i < MemoryIo->DescriptorCount; i++)
+	{
+		if (!DiopTestMemoryDescriptor(MemoryIo->Descriptors + i, 
+			DeviceExtension->MemoryResources, DeviceExtension->MemoryRangeCount))
+		{
+			DFTRACE_DBG("[%d] Inaccessible descriptor\n", i);
+			return STATUS_ACCESS_DENIED;
+		}
+	}
+
+	if (!DiopTransferMemoryDescriptors(DeviceExtension->MemoryResources, MemoryIo->Descriptors, 
+		MemoryIo->DescriptorCount, Buffer, Write, Timed ? &Timestamp : NULL))
+	{
+		DFTRACE_DBG("Device is stopped\n");
+		return STATUS_DEVICE_NOT_READY;
+	}
+
+	if (Timed)
+		RtlCopyMemory(Buffer + DataLength, &Timestamp, sizeof(Timestamp));
+
+	*OutputActualLength = DataLength + (Timed ? sizeof(Timestamp) : 0);
+
+	return STATUS_SUCCESS;
+}
+
+BOOLEAN
+DioMapMemoryWindow(
+	IN DIO_DEVICE_EXTENSION *DeviceExtension, 
+	IN DIO_PACKET_MAP_MEMORY *Parameters, 
+	IN PFILE_OBJECT FileObject, 
+	OUT DIO_PACKET_MEMORY_WINDOW *Window)
+/**
+ *	@brief	Maps a window of the memory resource to the caller, uncached.
+ *	
+ *	Caller accesses the registers of the window without an IOCTL, so the window bypasses the port
+ *	lock and the checks of the driver. It never reaches outside the resource, which is claimed by
+ *	the device.
+ *	
+ *	@param	[in] DeviceExtension		Device extension.
+ *	@param	[in] Parameters				Resource and the window in it.
+ *	@param	[in] FileObject				File object of the caller's handle, which the window belongs to.
+ *	@param	[out] Window				Receives the mapping. May overlap Parameters.
+ *	@return								Non-zero if successful. Fails if the resource has a window.
+ *	
+ */
+{
+	DIO_PACKET_MAP_MEMORY Map = *Parameters;
+	DIO_MEMORY_WINDOW *MemoryWindow;
+	DIO_MEMORY_RESOURCE *Resource;
+	ULONG Length;
+	BOOLEAN Result = FALSE;
+
+	if (KeGetCurrentIrql() != PASSIVE_LEVEL)
+		return FALSE;
+
+	if (Map.Resource >= DIO_MAXIMUM_MEMORY_RANGES || !Map.Length || 
+		(Map.Offset & (DIO_MEMORY_WINDOW_ALIGNMENT - 1)))
+		return FALSE;
+
+	Resource = DeviceExtension->MemoryResources + Map.Resource;
+	MemoryWindow = DiopMemoryWindows.Windows + Map.Resource;
+
+	KeWaitForSingleObject(&DiopMemoryWindows.Mutex, Executive, KernelMode, FALSE, NULL);
+
+	do
+	{
+		if (Map.Resource >= DeviceExtension->MemoryRangeCount || !DiopIsMappableResource(Resource))
+		{
+			DFTRACE_DBG("Resource %d is not mappable\n", Map.Resource);
+			break;
+		}
+
+		if (Map.Length > Resource->Length)
+			break;
+
+		Length = (ULONG)ROUND_TO_PAGES(Map.Length);
+
+		if ((ULONGLONG)Map.Offset + Length > Resource->Length)
+		{
+			DFTRACE_DBG("Window exceeds the resource (Offset 0x%lx, Length 0x%lx)\n", Map.Offset, Length);
+			break;
+		}
+
+		if (MemoryWindow->Mdl)
+		{
+			DFTRACE_DBG("Already mapped\n");
+			break;
+		}
+
+		MemoryWindow->Mdl = IoAllocateMdl(Resource->SystemAddress + Map.Offset, Length, FALSE, FALSE, NULL);
+		if (!MemoryWindow->Mdl)
+		{
+			DFTRACE("Failed to allocate the MDL\n");
+			break;
+		}
+
+		MmBuildMdlForNonPagedPool(MemoryWindow->Mdl);
+
+		MemoryWindow->Process = PsGetCurrentProcess();
+		ObReferenceObject(MemoryWindow->Process);
+		MemoryWindow->FileObject = FileObject;
+
+		__try
+		{
+			MemoryWindow->UserAddress = MmMapLockedPagesSpecifyCache(MemoryWindow->Mdl, UserMode, MmNonCached, 
+				NULL, FALSE, NormalPagePriority);
+		}
+		__except (EXCEPTION_EXECUTE_HANDLER)
+		{
+			MemoryWindow->UserAddress = NULL;
+		}
+
+		if (!MemoryWindow->UserAddress)
+		{
+			DFTRACE("Failed to map the window\n");
+			DiopUnmapMemoryWindow(MemoryWindow);
+			break;
+		}
+
+		Window->Address = (ULONGLONG)(ULONG_PTR)MemoryWindow->UserAddress;
+		Window->Length = Length;
+		Window->Reserved = 0;
+
+		Result = TRUE;
+
+		DFTRACE_DBG("Mapped resource %d, Offset 0x%lx, Length 0x%lx\n", Map.Resource, Map.Offset, Length);
+	} while (FALSE);
+
+	KeReleaseMutex(&DiopMemoryWindows.Mutex, FALSE);
+
+	return Result;
+}
+
+BOOLEAN
+DioUnmapMemoryWindow(
+	IN ULONG Resource, 
+	IN PFILE_OBJECT FileObject)
+/**
+ *	@brief	Unmaps the window of the memory resource from the caller.
+ *	
+ *	@param	[in] Resource				Index of the memory resource.
+ *	@param	[in] FileObject				File object of the caller's handle.
+ *	@return								Non-zero if successful. Fails if the resource has no window of FileObject.
+ *	
+ */
+{
+	DIO_MEMORY_WINDOW *Window;
+	BOOLEAN Result;
+
+	if (Resource >= DIO_MAXIMUM_MEMORY_RANGES)
+		return FALSE;
+
+	Window = DiopMemoryWindows.Windows + Resource;
+
+	KeWaitForSingleObject(&DiopMemoryWindows.Mutex, Executive, KernelMode, FALSE, NULL);
+
+	Result = (BOOLEAN)(Window->Mdl != NULL && Window->FileObject == FileObject);
+	if (Result)
+		DiopUnmapMemoryWindow(Window);
+
+	KeReleaseMutex(&DiopMemoryWindows.Mutex, FALSE);
+
+	return Result;
+}
+
+VOID
+DioUnmapMemoryWindows(
+	OPTIONAL IN PFILE_OBJECT FileObject)
+/**
+ *	@brief	Unmaps every window of the handle. Does nothing if no window is mapped.
+ *	
+ *	@param	[in] FileObject				File object of the caller's handle. NULL unmaps the windows of any handle.
+ *	@return								None.
+ *	
+ */
+{
+	DIO_MEMORY_WINDOW *Window;
+	ULONG i;
+
+	KeWaitForSingleObject(&DiopMemoryWindows.Mutex, Executive, KernelMode, FALSE, NULL);
+
+	for (i = 0; i < DIO_MAXIMUM_MEMORY_RANGES; i++)
+	{
+		Window = DiopMemoryWindows.Windows + i;
+
+		if (!FileObject || Window->FileObject == FileObject)
+			DiopUnmapMemoryWindow(Window);
+	}
+
+	KeReleaseMutex(&DiopMemoryWindows.Mutex, FALSE);
+}
@@ -94,7 +94,7 @@ DioPnpStartDevice(
 			{
 				PartialDescriptor = FullDescriptor->PartialResourceList.PartialDescriptors + j;
 			
-				// Currently we only need ports
+				// Ports and the memory-mapped registers. Interrupts are not used.
 				if (PartialDescriptor->Type == CmResourceTypePort)
 				{
 					USHORT Base = (USHORT)(PartialDescriptor->u.Port.Start.QuadPart & 0xffff);
@@ -110,6 +110,14 @@ DioPnpStartDevice(
 						DeviceExtension->PortRangeCount++;
 					}
 				}
+				else if (PartialDescriptor->Type == CmResourceTypeMemory)
+				{
+					DFTRACE(">> Memory range Start 0x%I64x, Length 0x%lx\n", 
+						PartialDescriptor->u.Memory.Start.QuadPart, PartialDescriptor->u.Memory.Length);
+
+					DioMapMemoryResource(DeviceExtension, 
+						PartialDescriptor->u.Memory.Start, PartialDescriptor->u.Memory.Length);
+				}
 			}
 
 			FullDescriptor = (CM_FULL_RESOURCE_DESCRIPTOR *)(
@@ -132,6 +140,13 @@ DioPnpStopDevice(
 	IN PDEVICE_OBJECT DeviceObject, 
 	IN PIRP Irp)
 {
+	DIO_DEVICE_EXTENSION *DeviceExtension;
+	DeviceExtension = (DIO_DEVICE_EXTENSION *)DeviceObject->DeviceExtension;
+
+	UNREFERENCED_PARAMETER(Irp);
+
+	// Resources may be moved by the PnP manager, so the registers are mapped again on the start.
+	DioUnmapMemoryResources(DeviceExtension);
 }
 
 VOID
@@ -0,0 +1,378 @@
+#include <ntddk.h>
+#include "../Include/dioctl.h"
+#include "reaction.h"
+
+
+static
+LONGLONG
+DiopReactionTicksToNanoseconds(
+	IN LONGLONG Ticks, 
+	IN LONGLONG Frequency)
+/**
+ *	@brief	Calculates Ticks * 10^9 / Frequency without overflowing the intermediate product.
+ */
+{
+	return (Ticks / Frequency) * 1000000000 + (Ticks % Frequency) * 1000000000 / Frequency;
+}
+
+static
+BOOLEAN
+DiopReactionVerifyInstruction(
+	IN DIO_PACKET_LOAD_REACTION *Packet, 
+	IN ULONG Index, 
+	OUT BOOLEAN *BackwardJump)
+/**
+ *	@brief	Checks the opcode and every index which the instruction refers to.
+ */
+{
+	DIO_REACTION_INSTRUCTION *Instruction = &Packet->Instructions[Index];
+	UCHAR Opcode = (UCHAR)(Instruction->Opcode & ~DIO_REACTION_OP_IMMEDIATE);
+	BOOLEAN Immediate = (BOOLEAN)((Instruction->Opcode & DIO_REACTION_OP_IMMEDIATE) != 0);
+	LONGLONG Target;
+
+	*BackwardJump = FALSE;
+
+	if (Opcode > DIO_REACTION_OP_MAXIMUM || Instruction->Reserved)
+		return FALSE;
+
+	if (Immediate && (Opcode < DIO_REACTION_OP_MOVE || Opcode > DIO_REACTION_OP_LESS))
+		return FALSE;
+
+	switch (Opcode)
+	{
+	case DIO_REACTION_OP_EXIT:
+		return TRUE;
+
+	case DIO_REACTION_OP_LOAD_INPUT:
+		return (BOOLEAN)(Instruction->Destination < DIO_REACTION_REGISTERS && 
+			Instruction->Source < Packet->InputCount);
+
+	case DIO_REACTION_OP_LOAD_STATE:
+		return (BOOLEAN)(Instruction->Destination < DIO_REACTION_REGISTERS && 
+			Instruction->Source < DIO_REACTION_STATES);
+
+	case DIO_REACTION_OP_STORE_STATE:
+		return (BOOLEAN)(Instruction->Destination < DIO_REACTION_STATES && 
+			Instruction->Source < DIO_REACTION_REGISTERS);
+
+	case DIO_REACTION_OP_STORE_OUTPUT:
+		return (BOOLEAN)(Instruction->Destination < Packet->OutputCount && 
+			Instruction->Source < DIO_REACTION_REGISTERS);
+
+	case DIO_REACTION_OP_JUMP:
+	case DIO_REACTION_OP_JUMP_ZERO:
+	case DIO_REACTION_OP_JUMP_NOT_ZERO:
+		if (Opcode != DIO_REACTION_OP_JUMP && Instruction->Destination >= DIO_REACTION_REGISTERS)
+			return FALSE;
+
+		Target = (LONGLONG)Index + 1 + Instruction->Immediate;
+
+		if (Target < 0 || Target >= Packet->InstructionCount)
+			return FALSE;
+
+		*BackwardJump = (BOOLEAN)(Target <= Index);
+		return TRUE;
+
+	default:
+		// MOVE ~ LESS.
+		return (BOOLEAN)(Instruction->Destination < DIO_REACTION_REGISTERS && 
+			(Immediate || Instruction->Source < DIO_REACTION_REGISTERS));
+	}
+}
+
+BOOLEAN
+DioReactionInitialize(
+	OUT DIO_REACTION_PROGRAM *Program, 
+	IN DIO_PACKET_LOAD_REACTION *Packet, 
+	OUT ULONG *ErrorIndex)
+/**
+ *	@brief	Verifies the program and resets the states and the statistics.
+ *	
+ *	Every jump must land in the program and the last instruction must be EXIT or JUMP, so the run
+ *	cannot leave the program. A program without a backward jump ends within its instruction count.
+ *	A program with one must give the step limit. Ports are not validated here.
+ *	
+ *	@param	[out] Program				Program to initialize.
+ *	@param	[in] Packet					Program to verify. Caller must validate the length.
+ *	@param	[out] ErrorIndex			Receives the instruction which failed the verification, or
+ *										DIO_REACTION_NO_INSTRUCTION.
+ *	@return								Non-zero if the program is valid.
+ *	
+ */
+{
+	DIO_REACTION_INSTRUCTION *Last;
+	BOOLEAN HasLoop = FALSE;
+	BOOLEAN BackwardJump;
+	ULONG i;
+
+	*ErrorIndex = DIO_REACTION_NO_INSTRUCTION;
+
+	if (Packet->Trigger > DIO_REACTION_TRIGGER_MAXIMUM || 
+		Packet->InputCount > DIO_REACTION_MAXIMUM_PORTS || 
+		Packet->OutputCount > DIO_REACTION_MAXIMUM_PORTS || 
+		!Packet->InstructionCount || Packet->InstructionCount > DIO_REACTION_MAXIMUM_INSTRUCTIONS || 
+		Packet->StepLimit > DIO_REACTION_MAXIMUM_STEPS)
+		return FALSE;
+
+	for (i = 0; i < Packet->InstructionCount; i++)
+	{
+		if (!DiopReactionVerifyInstruction(Packet, i, &BackwardJump))
+		{
+			*ErrorIndex = i;
+			return FALSE;
+		}
+
+		if (BackwardJump)
+			HasLoop = TRUE;
+	}
+
+	Last = &Packet->Instructions[Packet->InstructionCount - 1];
+
+	if (Last->Opcode != DIO_REACTION_OP_EXIT && Last->Opcode != DIO_REACTION_OP_JUMP)
+	{
+		*ErrorIndex = Packet->InstructionCount - 1;
+		return FALSE;
+	}
+
+	if (HasLoop && !Packet->StepLimit)
+		return FALSE;
+
+	RtlZeroMemory(Program, sizeof(*Program));
+
+	Program->Trigger = Packet->Trigger;
+	Program->StepLimit = HasLoop ? Packet->StepLimit : Packet->InstructionCount;
+	Program->InstructionCount = Packet->InstructionCount;
+	Program->InputCount = Packet->InputCount;
+	Program->OutputCount = Packet->OutputCount;
+
+	RtlCopyMemory(Program->Inputs, Packet->Inputs, sizeof(Program->Inputs));
+	RtlCopyMemory(Program->Outputs, Packet->Outputs, sizeof(Program->Outputs));
+	RtlCopyMemory(Program->Instructions, Packet->Instructions, 
+		Packet->InstructionCount * sizeof(DIO_REACTION_INSTRUCTION));
+
+	return TRUE;
+}
+
+BOOLEAN
+DioReactionShouldRun(
+	IN OUT DIO_REACTION_PROGRAM *Program, 
+	IN PUCHAR Inputs)
+/**
+ *	@brief	Checks the trigger of the program against the inputs of this tick.
+ *	
+ *	@param	[in, out] Program			Program.
+ *	@param	[in] Inputs					Value of each input port as read.
+ *	@return								Non-zero if the program should run.
+ *	
+ */
+{
+	BOOLEAN Changed = (BOOLEAN)!Program->Triggered;
+	ULONG i;
+
+	if (Program->Trigger == DIO_REACTION_TRIGGER_TICK)
+		return TRUE;
+
+	for (i = 0; i < Program->InputCount; i++)
+	{
+		UCHAR Value = (UCHAR)(Inputs[i] & Program->Inputs[i].Mask);
+
+		if (Value != Program->LastInputs[i])
+		{
+			Program->LastInputs[i] = Value;
+			Changed = TRUE;
+		}
+	}
+
+	Program->Triggered = TRUE;
+
+	return Changed;
+}
+
+BOOLEAN
+DioReactionRun(
+	IN OUT DIO_REACTION_PROGRAM *Program, 
+	IN PUCHAR Inputs, 
+	OUT PUCHAR Outputs, 
+	OUT ULONG *StoredOutputs)
+/**
+ *	@brief	Runs the program once.
+ *	
+ *	Values of the outputs have the XOR mask applied, and are to be written to the Mask bits of
+ *	the output ports. The run which reaches the step limit is counted as a fault, and its outputs
+ *	and states are discarded.
+ *	
+ *	@param	[in, out] Program			Verified program.
+ *	@param	[in] Inputs					Value of each input port as read.
+ *	@param	[out] Outputs				Receives the value of each output port.
+ *	@param	[out] StoredOutputs			Receives the outputs which are stored. Bit N is output N.
+ *	@return								Non-zero if the program reached EXIT.
+ *	
+ */
+{
+	DIO_REACTION_INSTRUCTION *Instructions = Program->Instructions;
+	ULONG Registers[DIO_REACTION_REGISTERS];
+	ULONG States[DIO_REACTION_STATES];
+	ULONG Stored = 0;
+	ULONG Steps = 0;
+	ULONG Pc = 0;
+	BOOLEAN Exited = FALSE;
+
+	RtlZeroMemory(Registers, sizeof(Registers));
+	RtlCopyMemory(States, Program->States, sizeof(States));
+
+	while (!Exited && Steps < Program->StepLimit)
+	{
+		DIO_REACTION_INSTRUCTION *Instruction = &Instructions[Pc++];
+		ULONG *Destination = &Registers[Instruction->Destination & (DIO_REACTION_REGISTERS - 1)];
+		ULONG Operand;
+
+		Steps++;
+
+		// Source is only a register index for the register operand, which the verifier checked.
+		if (Instruction->Opcode & DIO_REACTION_OP_IMMEDIATE)
+			Operand = (ULONG)Instruction->Immediate;
+		else
+			Operand = Registers[Instruction->Source & (DIO_REACTION_REGISTERS - 1)];
+
+		switch (Instruction->Opcode & ~DIO_REACTION_OP_IMMEDIATE)
+		{
+		case DIO_REACTION_OP_EXIT:
+			Exited = TRUE;
+			break;
+
+		case DIO_REACTION_OP_LOAD_INPUT:
+			*Destination = Inputs[Instruction->Source] ^ Program->Inputs[Instruction->Source].XorMask;
+			break;
+
+		case DIO_REACTION_OP_LOAD_STATE:
+			*Destination = States[Instruction->Source];
+			break;
+
+		case DIO_REACTION_OP_STORE_STATE:
+			States[Instruction->Destination] = Operand;
+			break;
+
+		case DIO_REACTION_OP_STORE_OUTPUT:
+			Outputs[Instruction->Destination] = (UCHAR)Operand ^ Program->Outputs[Instruction->Destination].XorMask;
+			Stored |= 1 << Instruction->Destination;
+			break;
+
+		case DIO_REACTION_OP_MOVE:
+			*Destination = Operand;
+			break;
+
+		case DIO_REACTION_OP_AND:
+			*Destination &= Operand;
+			break;
+
+		case DIO_REACTION_OP_OR:
+			*Destination |= Operand;
+			break;
+
+		case DIO_REACTION_OP_XOR:
+			*Destination ^= Operand;
+			break;
+
+		case DIO_REACTION_OP_ADD:
+			*Destination += Operand;
+			break;
+
+		case DIO_REACTION_OP_SUB:
+			*Destination -= Operand;
+			break;
+
+		case DIO_REACTION_OP_SHL:
+			*Destination <<= Operand & 31;
+			break;
+
+		case DIO_REACTION_OP_SHR:
+			*Destination >>= Operand & 31;
+			break;
+
+		case DIO_REACTION_OP_LESS:
+			*Destination = (*Destination < Operand) ? 1 : 0;
+			break;
+
+		case DIO_REACTION_OP_JUMP:
+			Pc += Instruction->Immediate;
+			break;
+
+		case DIO_REACTION_OP_JUMP_ZERO:
+			if (!*Destination)
+				Pc += Instruction->Immediate;
+			break;
+
+		case DIO_REACTION_OP_JUMP_NOT_ZERO:
+			if (*Destination)
+				Pc += Instruction->Immediate;
+			break;
+		}
+	}
+
+	Program->Runs++;
+
+	if (Steps > Program->MaximumSteps)
+		Program->MaximumSteps = Steps;
+
+	if (!Exited)
+	{
+		Program->Faults++;
+		*StoredOutputs = 0;
+		return FALSE;
+	}
+
+	RtlCopyMemory(Program->States, States, sizeof(States));
+	*StoredOutputs = Stored;
+
+	return TRUE;
+}
+
+VOID
+DioReactionAccountTime(
+	IN OUT DIO_REACTION_PROGRAM *Program, 
+	IN LONGLONG Time)
+/**
+ *	@brief	Accounts the time of the last run.
+ *	
+ *	@param	[in, out] Program			Program.
+ *	@param	[in] Time					Counter ticks of the run.
+ *	@return								None.
+ *	
+ */
+{
+	Program->TotalTime += Time;
+
+	if (Time > Program->MaximumTime)
+		Program->MaximumTime = Time;
+}
+
+VOID
+DioReactionQueryStatistics(
+	IN DIO_REACTION_PROGRAM *Program, 
+	IN LONGLONG Frequency, 
+	OUT DIO_REACTION_STATISTICS *Statistics)
+/**
+ *	@brief	Fills the statistics of the program.
+ *	
+ *	@param	[in] Program				Program.
+ *	@param	[in] Frequency				Frequency of the counter of the run time.
+ *	@param	[out] Statistics			Receives the statistics.
+ *	@return								None.
+ *	
+ */
+{
+	RtlZeroMemory(Statistics, sizeof(*Statistics));
+
+	Statistics->Loaded = TRUE;
+	Statistics->InstructionCount = Program->InstructionCount;
+	Statistics->StepLimit = Program->StepLimit;
+	Statistics->MaximumSteps = Program->MaximumSteps;
+	Statistics->Faults = Program->Faults;
+	Statistics->Runs = Program->Runs;
+
+	if (Frequency <= 0)
+		return;
+
+	Statistics->TotalTime = (ULONGLONG)DiopReactionTicksToNanoseconds(Program->TotalTime, Frequency);
+	Statistics->MaximumTime = (ULONGLONG)DiopReactionTicksToNanoseconds(Program->MaximumTime, Frequency);
+}
@@ -0,0 +1,62 @@
+
+#ifndef __DIO_REACTION_H__
+#define __DIO_REACTION_H__
+
+//
+// Reaction program verifier and interpreter.
+//
+// Programs are verified once on load, so the interpreter only bounds the steps of the run.
+// Like the edge core, this does not call any kernel routine.
+//
+
+typedef struct _DIO_REACTION_PROGRAM {
+	ULONG Trigger;
+	ULONG StepLimit;				// Steps of a run. Instruction count if the program has no loop.
+	ULONG InstructionCount;
+	ULONG InputCount;
+	ULONG OutputCount;
+	BOOLEAN Triggered;				// LastInputs is valid.
+	UCHAR LastInputs[DIO_REACTION_MAXIMUM_PORTS];	// Mask bits of the inputs of the last run.
+	ULONG States[DIO_REACTION_STATES];
+	DIO_REACTION_PORT Inputs[DIO_REACTION_MAXIMUM_PORTS];
+	DIO_REACTION_PORT Outputs[DIO_REACTION_MAXIMUM_PORTS];
+	ULONG MaximumSteps;
+	ULONG Faults;
+	ULONGLONG Runs;
+	LONGLONG TotalTime;				// Ticks.
+	LONGLONG MaximumTime;			// Ticks.
+	DIO_REACTION_INSTRUCTION Instructions[DIO_REACTION_MAXIMUM_INSTRUCTIONS];
+} DIO_REACTION_PROGRAM;
+
+
+BOOLEAN
+DioReactionInitialize(
+	OUT DIO_REACTION_PROGRAM *Program, 
+	IN DIO_PACKET_LOAD_REACTION *Packet, 
+	OUT ULONG *ErrorIndex);
+
+BOOLEAN
+DioReactionShouldRun(
+	IN OUT DIO_REACTION_PROGRAM *Program, 
+	IN PUCHAR Inputs);
+
+BOOLEAN
+DioReactionRun(
+	IN OUT DIO_REACTION_PROGRAM *Program, 
+	IN PUCHAR Inputs, 
+	OUT PUCHAR Outputs, 
+	OUT ULONG *StoredOutputs);
+
+VOID
+DioReactionAccountTime(
+	IN OUT DIO_REACTION_PROGRAM *Program, 
+	IN LONGLONG Time);
+
+VOID
+DioReactionQueryStatistics(
+	IN DIO_REACTION_PROGRAM *Program, 
+	IN LONGLONG Frequency, 
+	OUT DIO_REACTION_STATISTICS *Statistics);
+
+
+#endif
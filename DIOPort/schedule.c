@@ -0,0 +1,315 @@
+#include <ntddk.h>
+#include "../Include/dioctl.h"
+#include "schedule.h"
+
+
+// Upper bounds of the lateness histogram buckets in nanoseconds. Last bucket has no bound.
+static const LONGLONG DiopScheduleHistogramLimits[DIO_SCHEDULE_HISTOGRAM_BUCKETS - 1] = {
+	1000, 10000, 100000, 1000000, 
+};
+
+static
+BOOLEAN
+DiopScheduleKeyLess(
+	IN DIO_SCHEDULE_KEY *Key1, 
+	IN DIO_SCHEDULE_KEY *Key2)
+/**
+ *	@brief	Returns TRUE if Key1 runs before Key2.
+ *	
+ *	Sequence is compared by the signed difference, so it may wrap around.
+ */
+{
+	if (Key1->Time != Key2->Time)
+		return (BOOLEAN)(Key1->Time < Key2->Time);
+
+	return (BOOLEAN)((LONG)(Key1->Sequence - Key2->Sequence) < 0);
+}
+
+static
+LONGLONG
+DiopScheduleTicksToNanoseconds(
+	IN LONGLONG Ticks, 
+	IN LONGLONG Frequency)
+/**
+ *	@brief	Calculates Ticks * 10^9 / Frequency without overflowing the intermediate product.
+ */
+{
+	return (Ticks / Frequency) * 1000000000 + (Ticks % Frequency) * 1000000000 / Frequency;
+}
+
+ULONG
+DioScheduleGetMemoryLength(
+	IN ULONG Capacity)
+/**
+ *	@brief	Returns the length of the memory which holds the entries of the capacity.
+ *	
+ *	@param	[in] Capacity				Maximum count of pending entries.
+ *	@return								Length in bytes.
+ *	
+ */
+{
+	return Capacity * (sizeof(DIO_SCHEDULE_KEY) + sizeof(DIO_SCHEDULE_ENTRY) + sizeof(ULONG));
+}
+
+VOID
+DioScheduleInitialize(
+	OUT DIO_SCHEDULE_STATE *State, 
+	IN PVOID Memory, 
+	IN ULONG Capacity, 
+	IN LONGLONG Frequency)
+/**
+ *	@brief	Resets the queue and the statistics.
+ *	
+ *	@param	[out] State					State to initialize.
+ *	@param	[in] Memory					Memory of DioScheduleGetMemoryLength(Capacity) bytes, 8-byte aligned.
+ *	@param	[in] Capacity				Maximum count of pending entries.
+ *	@param	[in] Frequency				Frequency of the counter of the deadlines.
+ *	@return								None.
+ *	
+ */
+{
+	ULONG i;
+
+	RtlZeroMemory(State, sizeof(*State));
+
+	State->Heap = (DIO_SCHEDULE_KEY *)Memory;
+	State->Entries = (DIO_SCHEDULE_ENTRY *)(State->Heap + Capacity);
+	State->FreeSlots = (ULONG *)(State->Entries + Capacity);
+	State->Capacity = Capacity;
+	State->Frequency = Frequency;
+
+	// Lower slots are used first, which keeps the small queue in fewer cache lines.
+	for (i = 0; i < Capacity; i++)
+		State->FreeSlots[i] = Capacity - 1 - i;
+
+	for (i = 0; i < DIO_SCHEDULE_HISTOGRAM_BUCKETS - 1; i++)
+		State->HistogramLimits[i] = DiopScheduleHistogramLimits[i] * Frequency / 1000000000;
+}
+
+BOOLEAN
+DioScheduleInsert(
+	IN OUT DIO_SCHEDULE_STATE *State, 
+	IN DIO_SCHEDULE_ENTRY *Entry, 
+	OPTIONAL OUT BOOLEAN *First)
+/**
+ *	@brief	Queues the entry.
+ *	
+ *	@param	[in, out] State				Queue state.
+ *	@param	[in] Entry					Entry to queue. Caller must validate it.
+ *	@param	[out, opt] First			Receives TRUE if the entry is the earliest one now.
+ *	@return								Non-zero if queued. Fails if the queue is full.
+ *	
+ */
+{
+	DIO_SCHEDULE_KEY Key;
+	ULONG Index;
+
+	if (State->Count == State->Capacity)
+	{
+		State->RejectedEntries++;
+		return FALSE;
+	}
+
+	Key.Time = Entry->Time;
+	Key.Sequence = State->Sequence++;
+	Key.Slot = State->FreeSlots[State->Capacity - 1 - State->Count];
+
+	State->Entries[Key.Slot] = *Entry;
+
+	// Sift up.
+	for (Index = State->Count++; Index; )
+	{
+		ULONG Parent = (Index - 1) / 2;
+
+		if (!DiopScheduleKeyLess(&Key, &State->Heap[Parent]))
+			break;
+
+		State->Heap[Index] = State->Heap[Parent];
+		Index = Parent;
+	}
+
+	State->Heap[Index] = Key;
+
+	if (First)
+		*First = (BOOLEAN)(Index == 0);
+
+	return TRUE;
+}
+
+BOOLEAN
+DioSchedulePeek(
+	IN DIO_SCHEDULE_STATE *State, 
+	OUT LONGLONG *Time)
+/**
+ *	@brief	Returns the deadline of the earliest entry.
+ *	
+ *	@param	[in] State					Queue state.
+ *	@param	[out] Time					Receives the deadline.
+ *	@return								Non-zero if the queue is not empty.
+ *	
+ */
+{
+	if (!State->Count)
+		return FALSE;
+
+	*Time = State->Heap[0].Time;
+
+	return TRUE;
+}
+
+BOOLEAN
+DioSchedulePop(
+	IN OUT DIO_SCHEDULE_STATE *State, 
+	IN LONGLONG Now, 
+	OUT DIO_SCHEDULE_ENTRY *Entry)
+/**
+ *	@brief	Takes the earliest entry if its deadline has come.
+ *	
+ *	@param	[in, out] State				Queue state.
+ *	@param	[in] Now					Current counter value.
+ *	@param	[out] Entry					Receives the entry.
+ *	@return								Non-zero if an entry is taken.
+ *	
+ */
+{
+	DIO_SCHEDULE_KEY *Heap = State->Heap;
+	DIO_SCHEDULE_KEY Last;
+	ULONG Count;
+	ULONG Index;
+
+	if (!State->Count || Heap[0].Time > Now)
+		return FALSE;
+
+	*Entry = State->Entries[Heap[0].Slot];
+
+	Count = --State->Count;
+	State->FreeSlots[State->Capacity - 1 - Count] = Heap[0].Slot;
+
+	if (!Count)
+		return TRUE;
+
+	// Sift the last key down from the root.
+	Last = Heap[Count];
+
+	for (Index = 0; ; )
+	{
+		ULONG Child = Index * 2 + 1;
+
+		if (Child >= Count)
+			break;
+
+		if (Child + 1 < Count && DiopScheduleKeyLess(&Heap[Child + 1], &Heap[Child]))
+			Child++;
+
+		if (!DiopScheduleKeyLess(&Heap[Child], &Last))
+			break;
+
+		Heap[Index] = Heap[Child];
+		Index = Child;
+	}
+
+	Heap[Index] = Last;
+
+	return TRUE;
+}
+
+VOID
+DioScheduleComplete(
+	IN OUT DIO_SCHEDULE_STATE *State, 
+	IN DIO_SCHEDULE_ENTRY *Entry, 
+	IN LONGLONG Time)
+/**
+ *	@brief	Accounts the lateness of the fired entry.
+ *	
+ *	Oldest record is overwritten if the records are not read in time. Entry time is within
+ *	DIO_SCHEDULE_MAXIMUM_HORIZON of Time, so the lateness does not overflow.
+ *	
+ *	@param	[in, out] State				Queue state.
+ *	@param	[in] Entry					Entry which is taken by DioSchedulePop().
+ *	@param	[in] Time					Counter value when the ports were accessed.
+ *	@return								None.
+ *	
+ */
+{
+	LONGLONG Lateness = Time - Entry->Time;
+	DIO_SCHEDULE_RECORD *Record;
+	ULONG i;
+
+	if (Lateness < 0)
+		Lateness = 0;
+
+	State->FiredEntries++;
+	State->TotalLateness += Lateness;
+
+	if (Lateness > State->MaximumLateness)
+		State->MaximumLateness = Lateness;
+
+	for (i = 0; i < DIO_SCHEDULE_HISTOGRAM_BUCKETS - 1; i++)
+	{
+		if (Lateness < State->HistogramLimits[i])
+			break;
+	}
+
+	State->LatenessHistogram[i]++;
+
+	if (State->RecordCount == DIO_SCHEDULE_RECORD_COUNT)
+	{
+		State->RecordHead = (State->RecordHead + 1) % DIO_SCHEDULE_RECORD_COUNT;
+		State->RecordCount--;
+		State->LostRecords++;
+	}
+
+	Record = &State->Records[(State->RecordHead + State->RecordCount) % DIO_SCHEDULE_RECORD_COUNT];
+	Record->Tag = Entry->Tag;
+	Record->Reserved = 0;
+	Record->Time = Entry->Time;
+	Record->Lateness = (ULONGLONG)Lateness;
+
+	State->RecordCount++;
+}
+
+VOID
+DioScheduleQueryStatus(
+	IN OUT DIO_SCHEDULE_STATE *State, 
+	OUT DIO_PACKET_QUERY_SCHEDULER *Status, 
+	IN ULONG MaximumRecordCount)
+/**
+ *	@brief	Fills the status, and moves the records to it.
+ *	
+ *	@param	[in, out] State				Queue state.
+ *	@param	[out] Status				Receives the status and the records. Running is left as is.
+ *	@param	[in] MaximumRecordCount		Count of records which Status can hold.
+ *	@return								None.
+ *	
+ */
+{
+	LONGLONG Frequency = State->Frequency;
+	ULONG i;
+
+	Status->Capacity = State->Capacity;
+	Status->PendingEntries = State->Count;
+	Status->RejectedEntries = State->RejectedEntries;
+	Status->LostRecords = State->LostRecords;
+	Status->FiredEntries = State->FiredEntries;
+	Status->RecordCount = 0;
+
+	for (i = 0; i < DIO_SCHEDULE_HISTOGRAM_BUCKETS; i++)
+		Status->LatenessHistogram[i] = State->LatenessHistogram[i];
+
+	if (Frequency <= 0)
+		return;
+
+	Status->TotalLateness = (ULONGLONG)DiopScheduleTicksToNanoseconds(State->TotalLateness, Frequency);
+	Status->MaximumLateness = (ULONGLONG)DiopScheduleTicksToNanoseconds(State->MaximumLateness, Frequency);
+
+	while (State->RecordCount && Status->RecordCount < MaximumRecordCount)
+	{
+		DIO_SCHEDULE_RECORD *Record = &Status->Records[Status->RecordCount++];
+
+		*Record = State->Records[State->RecordHead];
+		Record->Lateness = (ULONGLONG)DiopScheduleTicksToNanoseconds((LONGLONG)Record->Lateness, Frequency);
+
+		State->RecordHead = (State->RecordHead + 1) % DIO_SCHEDULE_RECORD_COUNT;
+		State->RecordCount--;
+	}
+}
@@ -0,0 +1,81 @@
+
+#ifndef __DIO_SCHEDULE_H__
+#define __DIO_SCHEDULE_H__
+
+//
+// Time-tagged output queue.
+//
+// Pending entries are kept in a slot pool, and ordered by a binary min-heap of small keys
+// so that the sift moves 16 bytes instead of the whole entry. Insert and pop are O(log n).
+// Like the edge core, this does not call any kernel routine.
+//
+
+typedef struct _DIO_SCHEDULE_KEY {
+	LONGLONG Time;
+	ULONG Sequence;					// Orders the entries of the same Time by insertion.
+	ULONG Slot;						// Index in DIO_SCHEDULE_STATE.Entries.
+} DIO_SCHEDULE_KEY;
+
+typedef struct _DIO_SCHEDULE_STATE {
+	DIO_SCHEDULE_KEY *Heap;
+	DIO_SCHEDULE_ENTRY *Entries;
+	ULONG *FreeSlots;				// Stack of unused slots.
+	ULONG Capacity;
+	ULONG Count;
+	ULONG Sequence;
+	ULONG RejectedEntries;
+	LONGLONG Frequency;
+	LONGLONG HistogramLimits[DIO_SCHEDULE_HISTOGRAM_BUCKETS - 1];	// Bucket bounds in ticks.
+	ULONG LatenessHistogram[DIO_SCHEDULE_HISTOGRAM_BUCKETS];
+	ULONGLONG FiredEntries;
+	LONGLONG TotalLateness;			// Ticks.
+	LONGLONG MaximumLateness;		// Ticks.
+	ULONG LostRecords;
+	ULONG RecordHead;				// Oldest record.
+	ULONG RecordCount;
+	DIO_SCHEDULE_RECORD Records[DIO_SCHEDULE_RECORD_COUNT];	// Lateness is in ticks until read.
+} DIO_SCHEDULE_STATE;
+
+
+ULONG
+DioScheduleGetMemoryLength(
+	IN ULONG Capacity);
+
+VOID
+DioScheduleInitialize(
+	OUT DIO_SCHEDULE_STATE *State, 
+	IN PVOID Memory, 
+	IN ULONG Capacity, 
+	IN LONGLONG Frequency);
+
+BOOLEAN
+DioScheduleInsert(
+	IN OUT DIO_SCHEDULE_STATE *State, 
+	IN DIO_SCHEDULE_ENTRY *Entry, 
+	OPTIONAL OUT BOOLEAN *First);
+
+BOOLEAN
+DioSchedulePeek(
+	IN DIO_SCHEDULE_STATE *State, 
+	OUT LONGLONG *Time);
+
+BOOLEAN
+DioSchedulePop(
+	IN OUT DIO_SCHEDULE_STATE *State, 
+	IN LONGLONG Now, 
+	OUT DIO_SCHEDULE_ENTRY *Entry);
+
+VOID
+DioScheduleComplete(
+	IN OUT DIO_SCHEDULE_STATE *State, 
+	IN DIO_SCHEDULE_ENTRY *Entry, 
+	IN LONGLONG Time);
+
+VOID
+DioScheduleQueryStatus(
+	IN OUT DIO_SCHEDULE_STATE *State, 
+	OUT DIO_PACKET_QUERY_SCHEDULER *Status, 
+	IN ULONG MaximumRecordCount);
+
+
+#endif
@@ -0,0 +1,199 @@
+#include <ntddk.h>
+#include "../Include/dioctl.h"
+#include "stream.h"
+
+
+static
+ULONGLONG
+DiopStreamOldestPosition(
+	IN DIO_STREAM_STATE *State)
+/**
+ *	@brief	Returns the oldest frame which must not be overwritten.
+ *	
+ *	Segment being looped may be played again, so it is kept until the next segment starts.
+ */
+{
+	return (State->Flags & DIO_STREAM_FLAG_LOOP) ? State->SegmentStart : State->PlayPosition;
+}
+
+VOID
+DioStreamInitialize(
+	OUT DIO_STREAM_STATE *State, 
+	IN PUCHAR Buffer, 
+	IN ULONG FrameLength, 
+	IN ULONG FrameCapacity, 
+	IN ULONG Flags)
+/**
+ *	@brief	Resets the stream state.
+ *	
+ *	@param	[out] State					State to initialize.
+ *	@param	[in] Buffer					Frame buffer of FrameLength * FrameCapacity bytes.
+ *	@param	[in] FrameLength			Length of one frame in bytes.
+ *	@param	[in] FrameCapacity			Count of frames in the buffer.
+ *	@param	[in] Flags					Combination of DIO_STREAM_FLAG_XXX.
+ *	@return								None.
+ *	
+ */
+{
+	RtlZeroMemory(State, sizeof(*State));
+
+	State->Buffer = Buffer;
+	State->FrameLength = FrameLength;
+	State->FrameCapacity = FrameCapacity;
+	State->Flags = Flags;
+}
+
+PUCHAR
+DioStreamGetFrame(
+	IN DIO_STREAM_STATE *State, 
+	IN ULONGLONG Position)
+/**
+ *	@brief	Returns the address of the frame at the position.
+ *	
+ *	@param	[in] State					Stream state.
+ *	@param	[in] Position				Position of the frame.
+ *	@return								Address of the frame in the buffer.
+ *	
+ */
+{
+	return State->Buffer + (ULONG)(Position % State->FrameCapacity) * State->FrameLength;
+}
+
+ULONG
+DioStreamReserve(
+	IN DIO_STREAM_STATE *State, 
+	IN ULONG FrameCount, 
+	OUT ULONGLONG *Position)
+/**
+ *	@brief	Reserves the space to write the frames.
+ *	
+ *	The reserved frames are not played until DioStreamCommit(), so caller may fill them
+ *	without holding the lock, as long as only one caller writes at a time.
+ *	
+ *	@param	[in] State					Stream state.
+ *	@param	[in] FrameCount				Count of frames to write.
+ *	@param	[out] Position				Receives the position of the first frame.
+ *	@return								Count of frames which can be written. In loop mode, 
+ *										either FrameCount or zero.
+ *	
+ */
+{
+	ULONG FreeFrames = State->FrameCapacity - (ULONG)(State->WritePosition - DiopStreamOldestPosition(State));
+
+	*Position = State->WritePosition;
+
+	if (State->Flags & DIO_STREAM_FLAG_LOOP)
+	{
+		if (FrameCount > FreeFrames || State->SegmentCount == DIO_STREAM_MAXIMUM_SEGMENTS)
+			return 0;
+
+		return FrameCount;
+	}
+
+	return FrameCount < FreeFrames ? FrameCount : FreeFrames;
+}
+
+VOID
+DioStreamCommit(
+	IN OUT DIO_STREAM_STATE *State, 
+	IN ULONG FrameCount)
+/**
+ *	@brief	Makes the reserved frames playable, as one segment.
+ *	
+ *	@param	[in, out] State				Stream state.
+ *	@param	[in] FrameCount				Count of frames which are filled. Must not exceed the reserved count.
+ *	@return								None.
+ *	
+ */
+{
+	if (!FrameCount)
+		return;
+
+	State->WritePosition += FrameCount;
+
+	if (State->Flags & DIO_STREAM_FLAG_LOOP)
+	{
+		State->SegmentEnds[(State->SegmentHead + State->SegmentCount) % DIO_STREAM_MAXIMUM_SEGMENTS] = State->WritePosition;
+		State->SegmentCount++;
+	}
+}
+
+PUCHAR
+DioStreamNextFrame(
+	IN OUT DIO_STREAM_STATE *State)
+/**
+ *	@brief	Takes the frame to play for this tick.
+ *	
+ *	In loop mode, the next segment starts at the end of the current segment if it is written.
+ *	Otherwise the current segment is played again.\n
+ *	Caller must copy the frame before the lock is released, since the space may be reused.
+ *	
+ *	@param	[in, out] State				Stream state.
+ *	@return								Address of the frame. NULL if no frame is available (underrun).
+ *	
+ */
+{
+	PUCHAR Frame;
+
+	if (State->Flags & DIO_STREAM_FLAG_LOOP)
+	{
+		if (State->PlayPosition == State->SegmentEnd)
+		{
+			if (State->SegmentCount)
+			{
+				State->SegmentStart = State->SegmentEnd;
+				State->SegmentEnd = State->SegmentEnds[State->SegmentHead];
+				State->SegmentHead = (State->SegmentHead + 1) % DIO_STREAM_MAXIMUM_SEGMENTS;
+				State->SegmentCount--;
+			}
+			else if (State->SegmentEnd != State->SegmentStart)
+			{
+				State->PlayPosition = State->SegmentStart;
+				State->Loops++;
+			}
+		}
+	}
+
+	if (State->PlayPosition == State->WritePosition || 
+		((State->Flags & DIO_STREAM_FLAG_LOOP) && State->PlayPosition == State->SegmentEnd))
+	{
+		if (State->Started)
+			State->Underruns++;
+
+		return NULL;
+	}
+
+	Frame = DioStreamGetFrame(State, State->PlayPosition);
+
+	State->PlayPosition++;
+	State->PlayedFrames++;
+	State->Started = TRUE;
+
+	return Frame;
+}
+
+VOID
+DioStreamQueryStatus(
+	IN DIO_STREAM_STATE *State, 
+	OUT DIO_PACKET_QUERY_STREAM *Status)
+/**
+ *	@brief	Fills the buffer part of the status.
+ *	
+ *	@param	[in] State					Stream state.
+ *	@param	[out] Status				Receives the status. Other fields are left as is.
+ *	@return								None.
+ *	
+ */
+{
+	Status->Flags = State->Flags;
+	Status->FrameLength = State->FrameLength;
+	Status->FrameCapacity = State->FrameCapacity;
+	Status->QueuedFrames = (ULONG)(State->WritePosition - State->PlayPosition);
+	Status->FreeFrames = State->FrameCapacity - (ULONG)(State->WritePosition - DiopStreamOldestPosition(State));
+	Status->Underruns = State->Underruns;
+	Status->Loops = State->Loops;
+	Status->PlayedFrames = State->PlayedFrames;
+
+	if ((State->Flags & DIO_STREAM_FLAG_LOOP) && State->SegmentCount == DIO_STREAM_MAXIMUM_SEGMENTS)
+		Status->FreeFrames = 0;
+}
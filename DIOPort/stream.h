@@ -0,0 +1,65 @@
+
+#ifndef __DIO_STREAM_H__
+#define __DIO_STREAM_H__
+
+//
+// Output stream frame buffer.
+//
+// Positions count the frames from the start, and the frame of position P is stored at
+// P % FrameCapacity. Like the edge core, this does not call any kernel routine.
+//
+
+typedef struct _DIO_STREAM_STATE {
+	PUCHAR Buffer;
+	ULONG FrameLength;
+	ULONG FrameCapacity;
+	ULONG Flags;
+	BOOLEAN Started;				// First frame is played. Underruns are counted after this.
+	ULONGLONG PlayPosition;			// Next frame to play.
+	ULONGLONG WritePosition;		// End of the written frames.
+	ULONGLONG SegmentStart;			// Segment being played (loop mode only).
+	ULONGLONG SegmentEnd;
+	ULONGLONG SegmentEnds[DIO_STREAM_MAXIMUM_SEGMENTS];	// Ends of the segments waiting to be played.
+	ULONG SegmentHead;
+	ULONG SegmentCount;
+	ULONGLONG PlayedFrames;
+	ULONG Underruns;
+	ULONG Loops;
+} DIO_STREAM_STATE;
+
+
+VOID
+DioStreamInitialize(
+	OUT DIO_STREAM_STATE *State, 
+	IN PUCHAR Buffer, 
+	IN ULONG FrameLength, 
+	IN ULONG FrameCapacity, 
+	IN ULONG Flags);
+
+PUCHAR
+DioStreamGetFrame(
+	IN DIO_STREAM_STATE *State, 
+	IN ULONGLONG Position);
+
+ULONG
+DioStreamReserve(
+	IN DIO_STREAM_STATE *State, 
+	IN ULONG FrameCount, 
+	OUT ULONGLONG *Position);
+
+VOID
+DioStreamCommit(
+	IN OUT DIO_STREAM_STATE *State, 
+	IN ULONG FrameCount);
+
+PUCHAR
+DioStreamNextFrame(
+	IN OUT DIO_STREAM_STATE *State);
+
+VOID
+DioStreamQueryStatus(
+	IN DIO_STREAM_STATE *State, 
+	OUT DIO_PACKET_QUERY_STREAM *Status);
+
+
+#endif
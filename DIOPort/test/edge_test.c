@@ -0,0 +1,388 @@
+
+#include <ntddk.h>
+#include <stdio.h>
+#include "../../Include/dioctl.h"
+#include "../edge.h"
+
+//
+// Tests of the edge counting and quadrature decoding core against generated waveforms.
+//
+// Counter runs at 10 MHz like the performance counter, and the samples are taken at 100 kHz.
+//
+
+#define TEST_FREQUENCY			10000000
+#define TEST_INTERVAL			100			// Ticks between the samples (10 us)
+#define TEST_JITTER				10			// Sample time jitter in ticks (+-1 us)
+#define TEST_PORT				0x300
+
+#define CHECK(_e)				\
+	do { if (!(_e)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #_e); Failures++; } } while (0)
+
+static ULONG Failures;
+static ULONGLONG RandomState = 0x9e3779b97f4a7c15ULL;
+
+
+static
+ULONG
+Random(
+	VOID)
+{
+	// xorshift64*, so the runs are reproducible.
+	RandomState ^= RandomState >> 12;
+	RandomState ^= RandomState << 25;
+	RandomState ^= RandomState >> 27;
+
+	return (ULONG)((RandomState * 0x2545f4914f6cdd1dULL) >> 32);
+}
+
+static
+VOID
+AddChannel(
+	IN OUT DIO_PACKET_START_EDGE_ENGINE *Parameters, 
+	IN UCHAR Bit, 
+	IN UCHAR Flags)
+{
+	DIO_EDGE_CHANNEL *Channel = &Parameters->Channels[Parameters->ChannelCount++];
+
+	Channel->Port = (USHORT)(TEST_PORT + Bit / 8);
+	Channel->Bit = Bit % 8;
+	Channel->Flags = Flags;
+}
+
+static
+VOID
+ProcessLevels(
+	IN OUT DIO_EDGE_STATE *State, 
+	IN ULONG Levels, 
+	IN LONGLONG Time)
+/**
+ *	@brief	Feeds the port values whose bit N (port N / 8) is Levels bit N, as the sampler does.
+ */
+{
+	UCHAR PortValues[DIO_EDGE_MAXIMUM_CHANNELS];
+	ULONG i;
+
+	for (i = 0; i < State->PortCount; i++)
+		PortValues[i] = (UCHAR)(Levels >> ((State->Ports[i] - TEST_PORT) * 8));
+
+	DioEdgeProcessSample(State, DioEdgeBuildSample(State, PortValues), Time);
+}
+
+static
+LONGLONG
+CountRisingEdges(
+	IN LONGLONG HalfPeriod, 
+	IN LONGLONG From, 
+	IN LONGLONG To)
+/**
+ *	@brief	Rising edges of the square wave (Time / HalfPeriod) & 1 in (From, To].
+ *	
+ *	Rising edges are at the odd multiples of HalfPeriod.
+ */
+{
+	return (To / HalfPeriod + 1) / 2 - (From / HalfPeriod + 1) / 2;
+}
+
+static
+VOID
+TestSquareWaves(
+	VOID)
+/**
+ *	@brief	Square waves from 0.5 Hz to 7.8 kHz on one port, sampled with jitter for 10 seconds.
+ *	
+ *	Edge counts must be exact. Period must be within a sample interval and the jitter.
+ *	Last channel is the inverted copy of the first one.
+ */
+{
+	static const LONGLONG HalfPeriods[] = { 10000000, 1000000, 50000, 5000, 641 };
+	static DIO_PACKET_START_EDGE_ENGINE Parameters;
+	static DIO_PACKET_QUERY_EDGE_COUNTERS Counters;
+	static DIO_EDGE_STATE State;
+	ULONG Count = ARRAYSIZE(HalfPeriods);
+	LONGLONG FirstTime = 0;
+	LONGLONG Time = 0;
+	ULONG Sample;
+	ULONG i;
+
+	RtlZeroMemory(&Parameters, sizeof(Parameters));
+	Parameters.SampleInterval = TEST_INTERVAL * 100;
+
+	for (i = 0; i < Count; i++)
+		AddChannel(&Parameters, (UCHAR)i, 0);
+
+	AddChannel(&Parameters, (UCHAR)Count, DIO_EDGE_CHANNEL_INVERTED);
+
+	CHECK(DioEdgeInitialize(&State, &Parameters, TEST_FREQUENCY));
+	CHECK(State.PortCount == 1);
+
+	for (Sample = 0; Sample < 1000000; Sample++)
+	{
+		ULONG Levels = 0;
+
+		Time = 1000 + (LONGLONG)Sample * TEST_INTERVAL + (LONGLONG)(Random() % (2 * TEST_JITTER + 1)) - TEST_JITTER;
+
+		if (!Sample)
+			FirstTime = Time;
+
+		for (i = 0; i < Count; i++)
+			Levels |= (ULONG)((Time / HalfPeriods[i]) & 1) << i;
+
+		// Inverted channel sees the inverted level, so it reports the first wave again.
+		Levels |= (~Levels & 1) << Count;
+
+		ProcessLevels(&State, Levels, Time);
+	}
+
+	RtlZeroMemory(&Counters, sizeof(Counters));
+	DioEdgeQueryCounters(&State, Time, TEST_FREQUENCY, &Counters);
+
+	CHECK(Counters.SampleCount == 1000000);
+	CHECK(Counters.MissedSamples == 0);
+
+	for (i = 0; i <= Count; i++)
+	{
+		LONGLONG HalfPeriod = HalfPeriods[i == Count ? 0 : i];
+		LONGLONG Rising = CountRisingEdges(HalfPeriod, FirstTime, Time);
+		LONGLONG Falling = CountRisingEdges(HalfPeriod, FirstTime - HalfPeriod, Time - HalfPeriod);
+		LONGLONG Period = 2 * HalfPeriod * 100;
+		LONGLONG Error = (LONGLONG)Counters.Channels[i].Period - Period;
+
+		CHECK(Counters.Channels[i].RisingEdges == Rising);
+		CHECK(Counters.Channels[i].FallingEdges == Falling);
+		CHECK(Counters.Channels[i].Level == ((Time / HalfPeriod) & 1));
+
+		if (Rising >= 2)
+			CHECK(Error >= -(TEST_INTERVAL + 2 * TEST_JITTER) * 100 && Error <= (TEST_INTERVAL + 2 * TEST_JITTER) * 100);
+	}
+
+	// Frequency of the fastest wave (7.8 kHz) within 2%.
+	CHECK(Counters.Channels[Count - 1].Frequency > 7800000 * 98 / 100 && 
+		Counters.Channels[Count - 1].Frequency < 7800000 * 102 / 100);
+
+	// Estimate decays once the wave stops: 1 second later, the age is used as the period.
+	RtlZeroMemory(&Counters, sizeof(Counters));
+	DioEdgeQueryCounters(&State, Time + TEST_FREQUENCY, TEST_FREQUENCY, &Counters);
+
+	CHECK(Counters.Channels[Count - 1].Frequency <= 1000);
+	CHECK(Counters.Channels[Count - 1].Age >= 1000000000ULL);
+}
+
+static
+VOID
+TestQuadrature(
+	IN UCHAR Flags)
+/**
+ *	@brief	Random walk of an encoder with the index at every 400 counts, over 2M samples.
+ *	
+ *	Decoder sees only the A, B and index levels, and the expected position is counted from the walk.
+ */
+{
+	static const ULONG Phases[4] = { 0, 1, 3, 2 };	// A | (B << 1), A leading B counts up
+	static DIO_PACKET_START_EDGE_ENGINE Parameters;
+	static DIO_PACKET_QUERY_EDGE_COUNTERS Counters;
+	static DIO_EDGE_STATE State;
+	LONG Walk = 1000000;
+	LONG Position = 0;
+	LONG IndexPosition = 0;
+	ULONG IndexCount = 0;
+	BOOLEAN Index = FALSE;
+	ULONG Sample;
+
+	RtlZeroMemory(&Parameters, sizeof(Parameters));
+	Parameters.SampleInterval = TEST_INTERVAL * 100;
+	AddChannel(&Parameters, 0, 0);	// A
+	AddChannel(&Parameters, 9, 0);	// B, in the next port
+	AddChannel(&Parameters, 3, 0);	// Index
+
+	Parameters.DecoderCount = 1;
+	Parameters.Decoders[0].ChannelA = 0;
+	Parameters.Decoders[0].ChannelB = 1;
+	Parameters.Decoders[0].ChannelIndex = 2;
+	Parameters.Decoders[0].Flags = Flags;
+
+	CHECK(DioEdgeInitialize(&State, &Parameters, TEST_FREQUENCY));
+	CHECK(State.PortCount == 2);
+
+	for (Sample = 0; Sample < 2000000; Sample++)
+	{
+		ULONG Phase;
+		ULONG Levels;
+		BOOLEAN NewIndex;
+
+		if (Sample)
+		{
+			LONG Step = (LONG)(Random() % 3) - 1;
+
+			Walk += Step;
+			Position += (Flags & DIO_QUADRATURE_FLAG_REVERSE) ? -Step : Step;
+		}
+
+		Phase = Phases[Walk & 3];
+		NewIndex = (BOOLEAN)(Walk % 400 == 0);
+		Levels = (Phase & 1) | ((Phase >> 1) << 9) | ((ULONG)NewIndex << 3);
+
+		if (Sample && NewIndex && !Index)
+		{
+			IndexCount++;
+			IndexPosition = Position;
+
+			if (Flags & DIO_QUADRATURE_FLAG_RESET_ON_INDEX)
+				Position = 0;
+		}
+
+		Index = NewIndex;
+
+		ProcessLevels(&State, Levels, (LONGLONG)Sample * TEST_INTERVAL);
+	}
+
+	RtlZeroMemory(&Counters, sizeof(Counters));
+	DioEdgeQueryCounters(&State, (LONGLONG)Sample * TEST_INTERVAL, TEST_FREQUENCY, &Counters);
+
+	CHECK(IndexCount > 0);
+	CHECK(Counters.Decoders[0].Position == Position);
+	CHECK(Counters.Decoders[0].IndexPosition == IndexPosition);
+	CHECK(Counters.Decoders[0].IndexCount == IndexCount);
+	CHECK(Counters.Decoders[0].ErrorCount == 0);
+}
+
+static
+VOID
+TestDoubleStep(
+	VOID)
+/**
+ *	@brief	A and B changing in the same sample is an error, and the position is kept.
+ */
+{
+	static DIO_PACKET_START_EDGE_ENGINE Parameters;
+	static DIO_PACKET_QUERY_EDGE_COUNTERS Counters;
+	static DIO_EDGE_STATE State;
+
+	RtlZeroMemory(&Parameters, sizeof(Parameters));
+	Parameters.SampleInterval = TEST_INTERVAL * 100;
+	AddChannel(&Parameters, 0, 0);
+	AddChannel(&Parameters, 1, 0);
+
+	Parameters.DecoderCount = 1;
+	Parameters.Decoders[0].ChannelA = 0;
+	Parameters.Decoders[0].ChannelB = 1;
+	Parameters.Decoders[0].ChannelIndex = DIO_QUADRATURE_NO_INDEX;
+
+	CHECK(DioEdgeInitialize(&State, &Parameters, TEST_FREQUENCY));
+
+	ProcessLevels(&State, 0, 0);
+	ProcessLevels(&State, 1, TEST_INTERVAL);		// 00 -> 01: +1
+	ProcessLevels(&State, 2, 2 * TEST_INTERVAL);	// 01 -> 10: both changed
+	ProcessLevels(&State, 3, 3 * TEST_INTERVAL);	// 10 -> 11: -1
+
+	RtlZeroMemory(&Counters, sizeof(Counters));
+	DioEdgeQueryCounters(&State, 3 * TEST_INTERVAL, TEST_FREQUENCY, &Counters);
+
+	CHECK(Counters.Decoders[0].ErrorCount == 1);
+	CHECK(Counters.Decoders[0].Position == 0);
+}
+
+static
+VOID
+TestGaps(
+	VOID)
+/**
+ *	@brief	Ticks without a sample are counted as missed, rounded to the nearest tick.
+ */
+{
+	static DIO_PACKET_START_EDGE_ENGINE Parameters;
+	static DIO_PACKET_QUERY_EDGE_COUNTERS Counters;
+	static DIO_EDGE_STATE State;
+	LONGLONG Time = 0;
+	ULONG Missed = 0;
+	ULONG Sample;
+
+	RtlZeroMemory(&Parameters, sizeof(Parameters));
+	Parameters.SampleInterval = TEST_INTERVAL * 100;
+	AddChannel(&Parameters, 0, 0);
+
+	CHECK(DioEdgeInitialize(&State, &Parameters, TEST_FREQUENCY));
+	CHECK(State.Interval == TEST_INTERVAL);
+
+	for (Sample = 0; Sample < 100000; Sample++)
+	{
+		ULONG Gap = (Random() % 16) ? 0 : Random() % 5;
+
+		if (Sample)
+		{
+			Time += (LONGLONG)(Gap + 1) * TEST_INTERVAL + (LONGLONG)(Random() % (2 * TEST_JITTER + 1)) - TEST_JITTER;
+			Missed += Gap;
+		}
+
+		ProcessLevels(&State, Sample & 1, Time);
+	}
+
+	RtlZeroMemory(&Counters, sizeof(Counters));
+	DioEdgeQueryCounters(&State, Time, TEST_FREQUENCY, &Counters);
+
+	CHECK(Counters.MissedSamples == Missed);
+	CHECK(Counters.Channels[0].RisingEdges == 50000);
+	CHECK(Counters.Channels[0].FallingEdges == 49999);
+}
+
+static
+VOID
+TestParameters(
+	VOID)
+/**
+ *	@brief	Invalid channels, decoders and sample interval are rejected.
+ */
+{
+	static DIO_PACKET_START_EDGE_ENGINE Parameters;
+	static DIO_EDGE_STATE State;
+
+	RtlZeroMemory(&Parameters, sizeof(Parameters));
+	Parameters.SampleInterval = TEST_INTERVAL * 100;
+	CHECK(!DioEdgeInitialize(&State, &Parameters, TEST_FREQUENCY));
+
+	AddChannel(&Parameters, 0, 0);
+	AddChannel(&Parameters, 1, 0);
+	CHECK(DioEdgeInitialize(&State, &Parameters, TEST_FREQUENCY));
+	CHECK(!DioEdgeInitialize(&State, &Parameters, 0));
+
+	// Back-to-back sampling would hold the port lock all the time.
+	Parameters.SampleInterval = 0;
+	CHECK(!DioEdgeInitialize(&State, &Parameters, TEST_FREQUENCY));
+
+	// Interval shorter than a tick is one tick.
+	Parameters.SampleInterval = 1;
+	CHECK(DioEdgeInitialize(&State, &Parameters, TEST_FREQUENCY));
+	CHECK(State.Interval == 1);
+	Parameters.SampleInterval = TEST_INTERVAL * 100;
+
+	Parameters.Channels[1].Bit = 8;
+	CHECK(!DioEdgeInitialize(&State, &Parameters, TEST_FREQUENCY));
+	Parameters.Channels[1].Bit = 1;
+
+	Parameters.DecoderCount = 1;
+	Parameters.Decoders[0].ChannelA = 0;
+	Parameters.Decoders[0].ChannelB = 0;
+	Parameters.Decoders[0].ChannelIndex = DIO_QUADRATURE_NO_INDEX;
+	CHECK(!DioEdgeInitialize(&State, &Parameters, TEST_FREQUENCY));
+
+	Parameters.Decoders[0].ChannelB = 1;
+	Parameters.Decoders[0].ChannelIndex = 2;
+	CHECK(!DioEdgeInitialize(&State, &Parameters, TEST_FREQUENCY));
+}
+
+int
+main(
+	VOID)
+{
+	TestParameters();
+	TestSquareWaves();
+	TestQuadrature(0);
+	TestQuadrature(DIO_QUADRATURE_FLAG_REVERSE);
+	TestQuadrature(DIO_QUADRATURE_FLAG_RESET_ON_INDEX);
+	TestQuadrature(DIO_QUADRATURE_FLAG_RESET_ON_INDEX | DIO_QUADRATURE_FLAG_REVERSE);
+	TestDoubleStep();
+	TestGaps();
+
+	printf("edge_test: %s\n", Failures ? "FAILED" : "passed");
+
+	return Failures ? 1 : 0;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+//
+// Base types of ntddk.h for the user-mode tests of the portable driver cores.
+//
+// edge.c and schedule.c include <ntddk.h>, and this file is found first through the include path
+// of the test Makefile. Only the types and the routines which the cores use are provided, so a core
+// which starts to call the kernel fails to build here.
+//
+
+#include <stdint.h>
+#include <string.h>
+
+#define IN
+#define OUT
+#define OPTIONAL
+
+#define VOID						void
+typedef char						CHAR;
+typedef int32_t						LONG;
+typedef int64_t						LONGLONG;
+typedef unsigned char				UCHAR;
+typedef unsigned short				USHORT;
+typedef uint32_t					ULONG;
+typedef uint64_t					ULONGLONG;
+typedef void						*PVOID;
+typedef UCHAR						BOOLEAN;
+typedef UCHAR						*PUCHAR;
+
+#define TRUE						1
+#define FALSE						0
+
+#define MAXULONG					0xffffffffUL
+#define MAXLONGLONG					0x7fffffffffffffffLL
+
+#define ARRAYSIZE(_a)				( sizeof(_a) / sizeof((_a)[0]) )
+
+#define RtlZeroMemory(_d, _l)		memset((_d), 0, (_l))
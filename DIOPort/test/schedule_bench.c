@@ -0,0 +1,134 @@
+
+#include <ntddk.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../../Include/dioctl.h"
+#include "../schedule.h"
+
+//
+// Benchmark of the time-tagged output queue with 100K pending entries of random deadlines.
+//
+// Insert and fire (pop and complete) are timed in batches, so the queue moves between 100K and
+// 100K + BENCH_BATCH entries. Deadlines are random after the last fired one, as the scheduler
+// thread sees them.
+//
+
+#define BENCH_FREQUENCY			10000000
+#define BENCH_PENDING			100000
+#define BENCH_BATCH				16384
+#define BENCH_ROUNDS			64
+
+static ULONGLONG RandomState = 0x9e3779b97f4a7c15ULL;
+
+
+static
+ULONG
+Random(
+	VOID)
+{
+	RandomState ^= RandomState >> 12;
+	RandomState ^= RandomState << 25;
+	RandomState ^= RandomState >> 27;
+
+	return (ULONG)((RandomState * 0x2545f4914f6cdd1dULL) >> 32);
+}
+
+static
+LONGLONG
+Nanoseconds(
+	VOID)
+{
+	struct timespec Time;
+
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+
+	return (LONGLONG)Time.tv_sec * 1000000000 + Time.tv_nsec;
+}
+
+static
+VOID
+Insert(
+	IN OUT DIO_SCHEDULE_STATE *State, 
+	IN LONGLONG Time)
+{
+	DIO_SCHEDULE_ENTRY Entry;
+
+	RtlZeroMemory(&Entry, sizeof(Entry));
+	Entry.Time = Time;
+	Entry.Port = 0x300;
+	Entry.Length = 1;
+
+	if (!DioScheduleInsert(State, &Entry, NULL))
+	{
+		printf("schedule_bench: queue is full\n");
+		exit(1);
+	}
+}
+
+int
+main(
+	VOID)
+{
+	DIO_SCHEDULE_STATE State;
+	DIO_SCHEDULE_ENTRY Entry;
+	ULONG Capacity = BENCH_PENDING + BENCH_BATCH;
+	PVOID Memory = malloc(DioScheduleGetMemoryLength(Capacity));
+	LONGLONG InsertTime = 0;
+	LONGLONG FireTime = 0;
+	LONGLONG PairTime;
+	LONGLONG Now = 0;
+	LONGLONG Start;
+	ULONG Round;
+	ULONG i;
+
+	if (!Memory)
+		return 1;
+
+	DioScheduleInitialize(&State, Memory, Capacity, BENCH_FREQUENCY);
+
+	for (i = 0; i < BENCH_PENDING; i++)
+		Insert(&State, Random());
+
+	for (Round = 0; Round < BENCH_ROUNDS; Round++)
+	{
+		Start = Nanoseconds();
+
+		for (i = 0; i < BENCH_BATCH; i++)
+			Insert(&State, Now + Random());
+
+		InsertTime += Nanoseconds() - Start;
+		Start = Nanoseconds();
+
+		for (i = 0; i < BENCH_BATCH; i++)
+		{
+			DioSchedulePop(&State, MAXLONGLONG, &Entry);
+			DioScheduleComplete(&State, &Entry, Entry.Time + 10);
+			Now = Entry.Time;
+		}
+
+		FireTime += Nanoseconds() - Start;
+	}
+
+	// Insert and fire one by one, so the queue stays at 100K.
+	Start = Nanoseconds();
+
+	for (i = 0; i < BENCH_BATCH * BENCH_ROUNDS; i++)
+	{
+		Insert(&State, Now + Random());
+		DioSchedulePop(&State, MAXLONGLONG, &Entry);
+		DioScheduleComplete(&State, &Entry, Entry.Time + 10);
+		Now = Entry.Time;
+	}
+
+	PairTime = Nanoseconds() - Start;
+
+	printf("schedule_bench: %u pending, %u operations each\n", BENCH_PENDING, BENCH_BATCH * BENCH_ROUNDS);
+	printf("  insert           %6.1f ns\n", (double)InsertTime / (BENCH_BATCH * BENCH_ROUNDS));
+	printf("  fire             %6.1f ns\n", (double)FireTime / (BENCH_BATCH * BENCH_ROUNDS));
+	printf("  insert and fire  %6.1f ns\n", (double)PairTime / (BENCH_BATCH * BENCH_ROUNDS));
+
+	free(Memory);
+
+	return 0;
+}
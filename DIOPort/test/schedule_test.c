@@ -0,0 +1,305 @@
+
+#include <ntddk.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../../Include/dioctl.h"
+#include "../schedule.h"
+
+//
+// Tests of the time-tagged output queue.
+//
+// Counter runs at 10 MHz like the performance counter. Tags are the insertion order, so the fired
+// order can be checked against (Time, Tag).
+//
+
+#define TEST_FREQUENCY			10000000
+
+#define CHECK(_e)				\
+	do { if (!(_e)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #_e); Failures++; } } while (0)
+
+static ULONG Failures;
+static ULONGLONG RandomState = 0x2545f4914f6cdd1dULL;
+
+
+static
+ULONG
+Random(
+	VOID)
+{
+	// xorshift64*, so the runs are reproducible.
+	RandomState ^= RandomState >> 12;
+	RandomState ^= RandomState << 25;
+	RandomState ^= RandomState >> 27;
+
+	return (ULONG)((RandomState * 0x2545f4914f6cdd1dULL) >> 32);
+}
+
+static
+PVOID
+CreateQueue(
+	OUT DIO_SCHEDULE_STATE *State, 
+	IN ULONG Capacity)
+{
+	PVOID Memory = malloc(DioScheduleGetMemoryLength(Capacity));
+
+	if (Memory)
+		DioScheduleInitialize(State, Memory, Capacity, TEST_FREQUENCY);
+
+	return Memory;
+}
+
+static
+BOOLEAN
+Insert(
+	IN OUT DIO_SCHEDULE_STATE *State, 
+	IN LONGLONG Time, 
+	IN ULONG Tag, 
+	OPTIONAL OUT BOOLEAN *First)
+{
+	DIO_SCHEDULE_ENTRY Entry;
+
+	RtlZeroMemory(&Entry, sizeof(Entry));
+	Entry.Time = Time;
+	Entry.Tag = Tag;
+	Entry.Port = 0x300;
+	Entry.Length = 1;
+	Entry.Data[0] = (UCHAR)Tag;
+
+	return DioScheduleInsert(State, &Entry, First);
+}
+
+static
+VOID
+TestOrder(
+	VOID)
+/**
+ *	@brief	Entries fire by deadline, and by insertion order for the same deadline.
+ */
+{
+	static const LONGLONG Times[] = { 50, 10, 30, 10, 40, 30, 10, 20 };
+	static const ULONG Order[] = { 1, 3, 6, 7, 2, 5, 4, 0 };
+	DIO_SCHEDULE_STATE State;
+	DIO_SCHEDULE_ENTRY Entry;
+	PVOID Memory = CreateQueue(&State, 16);
+	BOOLEAN First;
+	LONGLONG Time;
+	ULONG i;
+
+	for (i = 0; i < ARRAYSIZE(Times); i++)
+	{
+		CHECK(Insert(&State, Times[i], i, &First));
+		CHECK(First == (i == 0 || i == 1));
+	}
+
+	CHECK(DioSchedulePeek(&State, &Time) && Time == 10);
+
+	// Nothing is due before the earliest deadline.
+	CHECK(!DioSchedulePop(&State, 9, &Entry));
+
+	for (i = 0; i < ARRAYSIZE(Order); i++)
+	{
+		CHECK(DioSchedulePop(&State, 100, &Entry));
+		CHECK(Entry.Tag == Order[i] && Entry.Data[0] == (UCHAR)Order[i]);
+	}
+
+	CHECK(!DioSchedulePop(&State, 100, &Entry));
+	CHECK(!DioSchedulePeek(&State, &Time));
+
+	free(Memory);
+}
+
+static
+VOID
+TestSequenceWrap(
+	VOID)
+/**
+ *	@brief	Insertion order of the same deadline holds across the wraparound of the sequence.
+ */
+{
+	DIO_SCHEDULE_STATE State;
+	DIO_SCHEDULE_ENTRY Entry;
+	PVOID Memory = CreateQueue(&State, 64);
+	ULONG i;
+
+	State.Sequence = 0xffffffe0;
+
+	for (i = 0; i < 64; i++)
+		CHECK(Insert(&State, 1000, i, NULL));
+
+	for (i = 0; i < 64; i++)
+		CHECK(DioSchedulePop(&State, 1000, &Entry) && Entry.Tag == i);
+
+	free(Memory);
+}
+
+static
+VOID
+TestFullQueue(
+	VOID)
+/**
+ *	@brief	Full queue rejects the entry and counts it. Freed slots are reused.
+ */
+{
+	DIO_SCHEDULE_STATE State;
+	DIO_SCHEDULE_ENTRY Entry;
+	DIO_PACKET_QUERY_SCHEDULER Status;
+	PVOID Memory = CreateQueue(&State, 4);
+	ULONG i;
+
+	for (i = 0; i < 4; i++)
+		CHECK(Insert(&State, i, i, NULL));
+
+	CHECK(!Insert(&State, 0, 4, NULL));
+	CHECK(!Insert(&State, 0, 5, NULL));
+
+	CHECK(DioSchedulePop(&State, 0, &Entry) && Entry.Tag == 0);
+	CHECK(Insert(&State, 0, 6, NULL));
+	CHECK(DioSchedulePop(&State, 0, &Entry) && Entry.Tag == 6);
+
+	RtlZeroMemory(&Status, sizeof(Status));
+	DioScheduleQueryStatus(&State, &Status, 0);
+
+	CHECK(Status.Capacity == 4);
+	CHECK(Status.PendingEntries == 3);
+	CHECK(Status.RejectedEntries == 2);
+
+	free(Memory);
+}
+
+static
+VOID
+TestRecords(
+	VOID)
+/**
+ *	@brief	Lateness statistics, histogram and the record ring which drops the oldest records.
+ */
+{
+	static UCHAR Buffer[sizeof(DIO_PACKET_QUERY_SCHEDULER) + DIO_SCHEDULE_RECORD_COUNT * sizeof(DIO_SCHEDULE_RECORD)];
+	DIO_PACKET_QUERY_SCHEDULER *Status = (DIO_PACKET_QUERY_SCHEDULER *)Buffer;
+	DIO_SCHEDULE_STATE State;
+	DIO_SCHEDULE_ENTRY Entry;
+	PVOID Memory = CreateQueue(&State, 16);
+	ULONG Count = DIO_SCHEDULE_RECORD_COUNT + 100;
+	ULONG i;
+
+	// Lateness of entry i is (i % 5) buckets: 0 ns, 1 us, 10 us, 100 us and 1 ms. Entry 1 is early.
+	for (i = 0; i < Count; i++)
+	{
+		static const LONGLONG Lateness[] = { 0, 10, 100, 1000, 10000 };
+
+		CHECK(Insert(&State, (LONGLONG)i * 100000, i, NULL));
+		CHECK(DioSchedulePop(&State, (LONGLONG)i * 100000, &Entry));
+		DioScheduleComplete(&State, &Entry, Entry.Time + (i == 1 ? -5 : Lateness[i % 5]));
+	}
+
+	RtlZeroMemory(Buffer, sizeof(Buffer));
+	DioScheduleQueryStatus(&State, Status, 10);
+
+	CHECK(Status->FiredEntries == Count);
+	CHECK(Status->LostRecords == 100);
+	CHECK(Status->MaximumLateness == 1000000);
+	CHECK(Status->LatenessHistogram[0] == (Count + 4) / 5 + 1);
+	CHECK(Status->LatenessHistogram[1] == (Count + 3) / 5 - 1);
+	CHECK(Status->LatenessHistogram[4] == Count / 5);
+	CHECK(Status->RecordCount == 10);
+	CHECK(Status->Records[0].Tag == 100 && Status->Records[0].Time == 100 * 100000);
+	CHECK(Status->Records[1].Lateness == 1000);
+
+	// Rest of the records are returned by the next query, oldest first.
+	RtlZeroMemory(Buffer, sizeof(Buffer));
+	DioScheduleQueryStatus(&State, Status, DIO_SCHEDULE_RECORD_COUNT);
+
+	CHECK(Status->RecordCount == DIO_SCHEDULE_RECORD_COUNT - 10);
+	CHECK(Status->Records[0].Tag == 110);
+	CHECK(Status->Records[Status->RecordCount - 1].Tag == Count - 1);
+
+	free(Memory);
+}
+
+static
+VOID
+TestRandomOperations(
+	VOID)
+/**
+ *	@brief	2M random inserts and pops against the monotonic drain invariant.
+ *	
+ *	Deadlines are never before the current time, so the fired entries must be in strictly
+ *	increasing (Time, Tag) order, no due entry may be left behind, and every entry fires once.
+ */
+{
+	DIO_SCHEDULE_STATE State;
+	DIO_SCHEDULE_ENTRY Entry;
+	PVOID Memory = CreateQueue(&State, 4096);
+	UCHAR *Fired = (UCHAR *)calloc(2000000, 1);
+	LONGLONG LastTime = -1;
+	LONGLONG Now = 0;
+	LONGLONG Time;
+	ULONG LastTag = 0;
+	ULONG Inserted = 0;
+	ULONG Pending = 0;
+	ULONG i;
+
+	for (i = 0; i < 2000000; i++)
+	{
+		// Inserts are more frequent while the queue is small, so it fills up and drains.
+		if (Random() % 4096 >= Pending / 2 && Pending < State.Capacity)
+		{
+			CHECK(Insert(&State, Now + Random() % 10000, Inserted++, NULL));
+			Pending++;
+			continue;
+		}
+
+		Now += Random() % 200;
+
+		while (DioSchedulePop(&State, Now, &Entry))
+		{
+			CHECK(Entry.Time <= Now);
+			CHECK(Entry.Time > LastTime || (Entry.Time == LastTime && Entry.Tag > LastTag));
+			CHECK(!Fired[Entry.Tag]);
+
+			Fired[Entry.Tag] = 1;
+			LastTime = Entry.Time;
+			LastTag = Entry.Tag;
+			Pending--;
+		}
+
+		CHECK(State.Count == Pending);
+		CHECK(!DioSchedulePeek(&State, &Time) || Time > Now);
+	}
+
+	while (DioSchedulePop(&State, MAXLONGLONG, &Entry))
+	{
+		CHECK(!Fired[Entry.Tag]);
+		Fired[Entry.Tag] = 1;
+		Pending--;
+	}
+
+	CHECK(Pending == 0);
+
+	for (i = 0; i < Inserted; i++)
+	{
+		if (!Fired[i])
+		{
+			CHECK(Fired[i]);
+			break;
+		}
+	}
+
+	free(Fired);
+	free(Memory);
+}
+
+int
+main(
+	VOID)
+{
+	TestOrder();
+	TestSequenceWrap();
+	TestFullQueue();
+	TestRecords();
+	TestRandomOperations();
+
+	printf("schedule_test: %s\n", Failures ? "FAILED" : "passed");
+
+	return Failures ? 1 : 0;
+}
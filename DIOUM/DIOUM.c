@@ -7,7 +7,13 @@
 #include "../Include/dioum.h"
 #include "dioum_internal.h"
 
-#define DFTRACE(_fmt, ...)			DTRACE(__FUNCTION__ ": " _fmt, __VA_ARGS__)
+// Header reserved by DioReadPortDirect() caller must match the packet header.
+C_ASSERT(DIOUM_DIRECT_HEADER_LENGTH(1) == PACKET_PORT_IO_GET_LENGTH(1));
+C_ASSERT(sizeof(DIOUM_PORT_RANGE) == sizeof(DIO_PORT_RANGE));
+C_ASSERT(sizeof(DIOUM_PORT_DESCRIPTOR) == sizeof(DIO_PORT_DESCRIPTOR));
+C_ASSERT(sizeof(DIOUM_PORT_SKEW) == sizeof(DIO_PORT_IO_SKEW));
+C_ASSERT(sizeof(DIOUM_EDGE_COUNTERS) == sizeof(DIO_PACKET_QUERY_EDGE_COUNTERS));
+C_ASSERT(sizeof(DIOUM_WORKER_STATUS) == sizeof(DIO_PACKET_QUERY_WORKER));
 
 
 VOID
@@ -135,341 +141,2487 @@ DiopUnsafeXorCopy(
 	return CopyLength;
 }
 
+DIOUM_REQUEST *
+APIENTRY
+DiopAcquireRequest(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG BufferLength)
+/**
+ *	@brief	Takes a request from the pool.
+ *	
+ *	New request is allocated if the pool is empty, so each concurrent caller gets its own.\n
+ *	Buffer which is larger than DIOUM_INLINE_PACKET_LENGTH is allocated for this call only.
+ *
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] BufferLength			Required packet buffer length in bytes.
+ *	@return								Non-NULL if succeeded.
+ *	
+ */
+{
+	DIOUM_REQUEST *Request = (DIOUM_REQUEST *)InterlockedPopEntrySList(&Context->RequestPool);
+
+	if (!Request)
+	{
+		Request = (DIOUM_REQUEST *)DiopAllocate(sizeof(*Request));
+		if (!Request)
+			return NULL;
+
+		if (!Context->Transport->InitializeRequest(Request))
+		{
+			DiopFree(Request);
+			return NULL;
+		}
+	}
+
+	Request->Buffer = Request->InlineBuffer;
+	Request->BufferLength = sizeof(Request->InlineBuffer);
+
+	if (BufferLength > sizeof(Request->InlineBuffer))
+	{
+		Request->Buffer = (PUCHAR)DiopAllocate(BufferLength);
+		Request->BufferLength = BufferLength;
+
+		if (!Request->Buffer)
+		{
+			Request->Buffer = Request->InlineBuffer;
+			Request->BufferLength = sizeof(Request->InlineBuffer);
+			InterlockedPushEntrySList(&Context->RequestPool, &Request->PoolEntry);
+			return NULL;
+		}
+	}
+
+	return Request;
+}
+
+VOID
+APIENTRY
+DiopReleaseRequest(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_REQUEST *Request)
+/**
+ *	@brief	Returns the request to the pool.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] Request				Request which is returned by DiopAcquireRequest().
+ *	@return								None.
+ *	
+ */
+{
+	if (Request->Buffer != Request->InlineBuffer)
+		DiopFree(Request->Buffer);
+
+	Request->Buffer = Request->InlineBuffer;
+	Request->BufferLength = sizeof(Request->InlineBuffer);
+
+	InterlockedPushEntrySList(&Context->RequestPool, &Request->PoolEntry);
+}
+
+BOOL
+APIENTRY
+DiopIssueIoControl(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_REQUEST *Request, 
+	IN ULONG IoControlCode, 
+	IN PVOID InputBuffer, 
+	IN ULONG InputBufferLength, 
+	OUT PVOID OutputBuffer, 
+	IN ULONG OutputBufferLength, 
+	OUT ULONG *ReturnedLength)
+/**
+ *	@brief	Sends the IOCTL through the transport and waits for the completion. The call is not recorded.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] Request				Request which owns the overlapped structure.
+ *	@param	[in] IoControlCode			IOCTL code.
+ *	@param	[in] InputBuffer			Input buffer.
+ *	@param	[in] InputBufferLength		Input buffer length in bytes.
+ *	@param	[out] OutputBuffer			Output buffer.
+ *	@param	[in] OutputBufferLength		Output buffer length in bytes.
+ *	@param	[out] ReturnedLength		Receives the returned length in bytes.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	*ReturnedLength = 0;
+
+	return Context->Transport->IoControl(Context, Request, IoControlCode, 
+		InputBuffer, InputBufferLength, OutputBuffer, OutputBufferLength, ReturnedLength);
+}
+
+BOOL
+APIENTRY
+DiopDeviceIoControl(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_REQUEST *Request, 
+	IN ULONG IoControlCode, 
+	IN PVOID InputBuffer, 
+	IN ULONG InputBufferLength, 
+	OUT PVOID OutputBuffer, 
+	IN ULONG OutputBufferLength, 
+	OUT ULONG *ReturnedLength)
+/**
+ *	@brief	Sends the IOCTL and waits for the completion, recording it if the recording is active.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] Request				Request which owns the overlapped structure.
+ *	@param	[in] IoControlCode			IOCTL code.
+ *	@param	[in] InputBuffer			Input buffer.
+ *	@param	[in] InputBufferLength		Input buffer length in bytes.
+ *	@param	[out] OutputBuffer			Output buffer.
+ *	@param	[in] OutputBufferLength		Output buffer length in bytes.
+ *	@param	[out] ReturnedLength		Receives the returned length in bytes.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	if (Context->Log)
+	{
+		return DiopRecordIoControl(Context, Request, IoControlCode, 
+			InputBuffer, InputBufferLength, OutputBuffer, OutputBufferLength, ReturnedLength);
+	}
+
+	return DiopIssueIoControl(Context, Request, IoControlCode, 
+		InputBuffer, InputBufferLength, OutputBuffer, OutputBufferLength, ReturnedLength);
+}
+
+BOOLEAN
+APIENTRY
+DiopIsValidRangeSetName(
+	IN PCSTR Name)
+/**
+ *	@brief	Checks that the name is not empty and fits DIOUM_RANGE_SET_MAXIMUM_NAME_LENGTH.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Names are never truncated, so that two long names cannot match by their common prefix.
+ *	
+ *	@param	[in] Name					Name of the range set.
+ *	@return								TRUE if the name can be stored and looked up.
+ *	
+ */
+{
+	SIZE_T Length = strnlen(Name, DIOUM_RANGE_SET_NAME_LENGTH);
+
+	return (BOOLEAN)(Length && Length <= DIOUM_RANGE_SET_MAXIMUM_NAME_LENGTH);
+}
+
+DIOUM_RANGE_SET *
+APIENTRY
+DiopCreateRangeSet(
+	OPTIONAL IN PCSTR Name, 
+	IN ULONG AddressRangeCount, 
+	IN DIOUM_PORT_RANGE *AddressRanges, 
+	OPTIONAL IN UCHAR *ReadXorMasks, 
+	OPTIONAL IN UCHAR *WriteXorMasks)
+/**
+ *	@brief	Creates the immutable range set with prebuilt packet header.
+ *	
+ *	@param	[in, opt] Name				Name of the range set, validated by DiopIsValidRangeSetName().
+ *	@param	[in] AddressRangeCount		Count of port address ranges.
+ *	@param	[in] AddressRanges			Port address ranges.
+ *	@param	[in, opt] ReadXorMasks		Read XOR mask of each range. Context mask is used if both are NULL.
+ *	@param	[in, opt] WriteXorMasks		Write XOR mask of each range. Context mask is used if both are NULL.
+ *	@return								Non-NULL if succeeded.
+ *	
+ */
+{
+	DIOUM_RANGE_SET *RangeSet;
+	ULONG DataLength;
+	ULONG HeaderLength;
+	ULONG Offset;
+	ULONG i;
+
+	if (AddressRangeCount > DIO_MAXIMUM_PORT_RANGES)
+		return NULL;
+
+	if (!DiopGetDataLength(AddressRangeCount, (DIO_PORT_RANGE *)AddressRanges, &DataLength))
+		return NULL;
+
+	HeaderLength = PACKET_PORT_IO_GET_LENGTH(AddressRangeCount);
+
+	// [DIOUM_RANGE_SET] [Ranges] [Offsets] [ReadXorMasks] [WriteXorMasks]
+	RangeSet = (DIOUM_RANGE_SET *)DiopAllocate(
+		FIELD_OFFSET(DIOUM_RANGE_SET, Header) + HeaderLength + 
+		AddressRangeCount * (sizeof(ULONG) + sizeof(UCHAR) * 2));
+
+	if (!RangeSet)
+		return NULL;
+
+	if (Name)
+		strcpy(RangeSet->Name, Name);
+
+	RangeSet->DataLength = DataLength;
+	RangeSet->HeaderLength = HeaderLength;
+	RangeSet->Offsets = (ULONG *)((PUCHAR)&RangeSet->Header + HeaderLength);
+	RangeSet->ReadXorMasks = (UCHAR *)(RangeSet->Offsets + AddressRangeCount);
+	RangeSet->WriteXorMasks = RangeSet->ReadXorMasks + AddressRangeCount;
+	RangeSet->Header.RangeCount = AddressRangeCount;
+	memcpy(RangeSet->Header.AddressRange, AddressRanges, AddressRangeCount * sizeof(DIO_PORT_RANGE));
+
+	if (ReadXorMasks || WriteXorMasks)
+		RangeSet->Flags |= DIOUM_RANGE_SET_FLAG_OWN_MASKS;
+
+	for (i = 0, Offset = 0; i < AddressRangeCount; i++)
+	{
+		RangeSet->Offsets[i] = Offset;
+		RangeSet->ReadXorMasks[i] = ReadXorMasks ? ReadXorMasks[i] : 0x00;
+		RangeSet->WriteXorMasks[i] = WriteXorMasks ? WriteXorMasks[i] : 0x00;
+
+		Offset += AddressRanges[i].EndAddress - AddressRanges[i].StartAddress + 1;
+	}
+
+	return RangeSet;
+}
+
+VOID
+APIENTRY
+DiopFreeRangeSet(
+	IN DIOUM_RANGE_SET *RangeSet)
+/**
+ *	@brief	Frees the range set and its caches.
+ *	
+ *	@param	[in] RangeSet				Range set which is created by DiopCreateRangeSet().
+ *	@return								None.
+ *	
+ */
+{
+	DiopFreeShadow(RangeSet);
+	DiopFreeReadCache(RangeSet);
+	DiopFree(RangeSet);
+}
+
+VOID
+APIENTRY
+DiopCopyRangeSetData(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	OUT PUCHAR DestinationBuffer, 
+	IN PUCHAR SourceBuffer, 
+	IN BOOLEAN Write)
+/**
+ *	@brief	Copies the range set data with XOR masks applied.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] RangeSet				Range set which describes the data layout.
+ *	@param	[out] DestinationBuffer		Destination buffer.
+ *	@param	[in] SourceBuffer			Source buffer.
+ *	@param	[in] Write					Applies the write masks if TRUE, read masks otherwise.
+ *	@return								None.
+ *	
+ */
+{
+	ULONG i;
+
+	if (!(RangeSet->Flags & DIOUM_RANGE_SET_FLAG_OWN_MASKS))
+	{
+		DiopUnsafeXorCopy(DestinationBuffer, SourceBuffer, RangeSet->DataLength, 
+			Write ? Context->WriteXorMask : Context->ReadXorMask);
+		return;
+	}
+
+	for (i = 0; i < RangeSet->Header.RangeCount; i++)
+	{
+		ULONG Offset = RangeSet->Offsets[i];
+		ULONG Length = RangeSet->Header.AddressRange[i].EndAddress - RangeSet->Header.AddressRange[i].StartAddress + 1;
+
+		DiopUnsafeXorCopy(DestinationBuffer + Offset, SourceBuffer + Offset, Length, 
+			Write ? RangeSet->WriteXorMasks[i] : RangeSet->ReadXorMasks[i]);
+	}
+}
+
+BOOL
+APIENTRY
+DiopQueryResources(
+	IN DIOUM_DRIVER_CONTEXT *Context)
+/**
+ *	@brief	Queries the port ranges claimed by the device.
+ *	
+ *	The result is cached in the context. ResourceRangeCount is zero if the driver 
+ *	does not support DIO_IOCTL_QUERY_RESOURCES, and then the ranges are validated by the driver only.
+ *
+ *	@param	[in] Context				Driver context.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	UCHAR Buffer[PACKET_PORT_IO_GET_LENGTH(DIO_MAXIMUM_PORT_RANGES)];
+	DIO_PACKET_QUERY_RESOURCES *Packet = (DIO_PACKET_QUERY_RESOURCES *)Buffer;
+	DIOUM_REQUEST *Request;
+	ULONG ReturnedLength = 0;
+
+	if (Context->ResourcesQueried)
+		return TRUE;
+
+	Request = DiopAcquireRequest(Context, 0);
+	if (!Request)
+		return FALSE;
+
+	if (DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_QUERY_RESOURCES, 
+		NULL, 
+		0, 
+		(PVOID)Buffer, 
+		sizeof(Buffer), 
+		&ReturnedLength) && 
+		ReturnedLength >= sizeof(*Packet) && 
+		Packet->RangeCount <= DIO_MAXIMUM_PORT_RANGES && 
+		ReturnedLength == PACKET_PORT_IO_GET_LENGTH(Packet->RangeCount))
+	{
+		memcpy(Context->Resources, Packet->AddressRange, Packet->RangeCount * sizeof(DIO_PORT_RANGE));
+		Context->ResourceRangeCount = Packet->RangeCount;
+	}
+	else
+	{
+		DFTRACE("Driver does not report the resources\n");
+		Context->ResourceRangeCount = 0;
+	}
+
+	DiopReleaseRequest(Context, Request);
+
+	InterlockedExchange(&Context->ResourcesQueried, TRUE);
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DiopValidateRanges(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG AddressRangeCount, 
+	IN DIOUM_PORT_RANGE *AddressRanges)
+/**
+ *	@brief	Validates the port ranges as the driver does.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] AddressRangeCount		Count of port address ranges.
+ *	@param	[in] AddressRanges			Port address ranges.
+ *	@return								FALSE if the driver would reject the ranges.
+ *	
+ */
+{
+	ULONG ConfigurationBits = 0;
+	ULONG DataLength = 0;
+	ULONG i, j;
+
+	if (AddressRangeCount > DIO_MAXIMUM_PORT_RANGES)
+		return FALSE;
+
+	if (!DiopGetDataLength(AddressRangeCount, (DIO_PORT_RANGE *)AddressRanges, &DataLength) || 
+		DataLength > 0x10000)
+		return FALSE;
+
+	if (!DiopQueryResources(Context))
+		return FALSE;
+
+	for (i = 0; i < AddressRangeCount && Context->ResourceRangeCount; i++)
+	{
+		for (j = 0; j < Context->ResourceRangeCount; j++)
+		{
+			if (Context->Resources[j].StartAddress <= AddressRanges[i].StartAddress && 
+				AddressRanges[i].EndAddress <= Context->Resources[j].EndAddress)
+				break;
+		}
+
+		if (j == Context->ResourceRangeCount)
+		{
+			DFTRACE("[%d] Inaccessible address range 0x%04hx - 0x%04hx\n", 
+				i, AddressRanges[i].StartAddress, AddressRanges[i].EndAddress);
+			return FALSE;
+		}
+	}
+
+	if (DioGetDriverConfiguration(Context, &ConfigurationBits) && 
+		!(ConfigurationBits & DIO_CFGB_ALLOW_PORT_RANGE_OVERLAP))
+	{
+		for (i = 0; i < AddressRangeCount; i++)
+		{
+			for (j = i + 1; j < AddressRangeCount; j++)
+			{
+				if (DIO_IS_CONFLICTING_ADDRESSES(
+					AddressRanges[i].StartAddress, AddressRanges[i].EndAddress, 
+					AddressRanges[j].StartAddress, AddressRanges[j].EndAddress))
+				{
+					DFTRACE("[%d] Range overlapping detected\n", j);
+					return FALSE;
+				}
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DiopReadRangeSetUncached(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *ReturnedDataLength)
+/**
+ *	@brief	Reads the ranges of range set from the ports, bypassing the read cache.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] RangeSet				Range set to read.
+ *	@param	[out] Buffer				Receives the data.
+ *	@param	[in] BufferLength			Length of Buffer in bytes.
+ *	@param	[out, opt] ReturnedDataLength	Receives the data length in bytes.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	ULONG HeaderLength = RangeSet->HeaderLength;
+	ULONG DataLength = RangeSet->DataLength;
+	ULONG ReturnedLength = 0;
+	DIOUM_REQUEST *Request;
+	BOOL Result = FALSE;
+
+	if (DataLength > BufferLength)
+		return FALSE;
+
+	if (Context->CombineMaximumWindow)
+		return DiopCombineRangeSetIo(Context, RangeSet, Buffer, BufferLength, ReturnedDataLength, FALSE);
+
+	Request = DiopAcquireRequest(Context, HeaderLength + DataLength);
+	if (!Request)
+		return FALSE;
+
+	memcpy(Request->Buffer, &RangeSet->Header, HeaderLength);
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_READ_PORT, 
+		(PVOID)Request->Buffer, 
+		HeaderLength, 
+		(PVOID)Request->Buffer, 
+		HeaderLength + DataLength, 
+		&ReturnedLength);
+
+	if (Result)
+	{
+		DFTRACE("IOCTL succeeded with %d bytes returned\n", ReturnedLength);
+
+		if (ReturnedLength == HeaderLength + DataLength)
+		{
+			DiopCopyRangeSetData(Context, RangeSet, Buffer, Request->Buffer + HeaderLength, FALSE);
+
+			if (ReturnedDataLength)
+				*ReturnedDataLength = DataLength;
+		}
+		else
+		{
+			DFTRACE("Length mismatched, assuming failed\n");
+			Result = FALSE;
+		}
+	}
+
+	DiopReleaseRequest(Context, Request);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DiopReadRangeSet(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *ReturnedDataLength)
+/**
+ *	@brief	Reads the ranges of range set, from the read cache if it is fresh.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] RangeSet				Range set to read.
+ *	@param	[out] Buffer				Receives the data.
+ *	@param	[in] BufferLength			Length of Buffer in bytes.
+ *	@param	[out, opt] ReturnedDataLength	Receives the data length in bytes.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIOUM_READ_CACHE *ReadCache = RangeSet->ReadCache;
+
+	if (ReadCache && ReadCache->Freshness)
+		return DiopReadCachedRangeSet(Context, RangeSet, Buffer, BufferLength, ReturnedDataLength);
+
+	return DiopReadRangeSetUncached(Context, RangeSet, Buffer, BufferLength, ReturnedDataLength);
+}
+
+BOOL
+APIENTRY
+DiopWriteRangeSet(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	IN PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *TransferredDataLength)
+/**
+ *	@brief	Writes the ranges of range set.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] RangeSet				Range set to write.
+ *	@param	[in] Buffer					Data to write.
+ *	@param	[in] BufferLength			Length of Buffer in bytes.
+ *	@param	[out, opt] TransferredDataLength	Receives the data length in bytes.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	ULONG HeaderLength = RangeSet->HeaderLength;
+	ULONG DataLength = RangeSet->DataLength;
+	ULONG ReturnedLength = 0;
+	DIOUM_REQUEST *Request;
+	BOOL Result = FALSE;
+
+	if (DataLength > BufferLength)
+		return FALSE;
+
+	if (Context->CombineMaximumWindow)
+	{
+		Result = DiopCombineRangeSetIo(Context, RangeSet, Buffer, BufferLength, TransferredDataLength, TRUE);
+
+		if (RangeSet->ReadCache)
+			DiopInvalidateReadCache(RangeSet);
+
+		return Result;
+	}
+
+	Request = DiopAcquireRequest(Context, HeaderLength + DataLength);
+	if (!Request)
+		return FALSE;
+
+	memcpy(Request->Buffer, &RangeSet->Header, HeaderLength);
+	DiopCopyRangeSetData(Context, RangeSet, Request->Buffer + HeaderLength, Buffer, TRUE);
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_WRITE_PORT, 
+		(PVOID)Request->Buffer, 
+		HeaderLength + DataLength, 
+		(PVOID)Request->Buffer, 
+		HeaderLength, 
+		&ReturnedLength);
+
+	if (Result)
+	{
+		DFTRACE("IOCTL succeeded with %d bytes returned\n", ReturnedLength);
+
+		if (ReturnedLength == HeaderLength)
+		{
+			if (TransferredDataLength)
+				*TransferredDataLength = DataLength;
+		}
+		else
+		{
+			DFTRACE("Length mismatched, assuming failed\n");
+			Result = FALSE;
+		}
+	}
+
+	DiopReleaseRequest(Context, Request);
+
+	// Ports may read back what is written, so the cached data is no longer valid.
+	if (RangeSet->ReadCache)
+		DiopInvalidateReadCache(RangeSet);
+
+	return Result;
+}
+
+DIOUM_RANGE_SET *
+APIENTRY
+DiopReferenceRegisteredRangeSet(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OUT ULONG *Epoch)
+/**
+ *	@brief	References the registered range set.
+ *	
+ *	Caller must call DiopDereferenceRegisteredRangeSet() with Epoch after use, even if NULL is
+ *	returned.
+ *
+ *	@param	[in] Context				Driver context.
+ *	@param	[out] Epoch					Receives the reader counter which the caller is counted in.
+ *	@return								Registered range set. NULL if not registered.
+ *	
+ */
+{
+	*Epoch = Context->ReaderEpoch & 1;
+
+	// Interlocked increment is a full barrier, so the pointer is read after we are counted.
+	InterlockedIncrement(&Context->ActiveReaders[*Epoch]);
+
+	return Context->RegisteredRangeSet;
+}
+
+VOID
+APIENTRY
+DiopDereferenceRegisteredRangeSet(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG Epoch)
+{
+	InterlockedDecrement(&Context->ActiveReaders[Epoch]);
+}
+
+VOID
+APIENTRY
+DiopReclaimRangeSets(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN BOOLEAN Force)
+/**
+ *	@brief	Frees the retired range sets which no reader can reference.
+ *	
+ *	A reader which references a retired set was counted before the set was retired, and keeps
+ *	its counter above zero until it is done. So a set is freed once each of the two reader
+ *	counters has been seen zero after the set was retired.\n
+ *	New readers are counted in ActiveReaders[ReaderEpoch]. The epoch is flipped whenever the
+ *	other counter is zero, so each counter drains in turn even under constant load.
+ *
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] Force					Frees without checking the reader counters (shutdown only).
+ *	@return								None.
+ *	
+ */
+{
+	DIOUM_RANGE_SET *RangeSet;
+	PSLIST_ENTRY *Link;
+	PSLIST_ENTRY Entry;
+	PSLIST_ENTRY Next;
+	ULONG IdleReaders = 0;
+	LONG Epoch;
+	ULONG i;
+
+	AcquireSRWLockExclusive(&Context->ReclaimLock);
+
+	// Flush is a full barrier, so the counters below are read after the sets are retired.
+	Entry = InterlockedFlushSList(&Context->RetiredRangeSets);
+
+	while (Entry)
+	{
+		Next = Entry->Next;
+		Entry->Next = Context->ReclaimingRangeSets;
+		Context->ReclaimingRangeSets = Entry;
+		Entry = Next;
+	}
+
+	for (i = 0; i < ARRAYSIZE(Context->ActiveReaders); i++)
+	{
+		if (Force || !Context->ActiveReaders[i])
+			IdleReaders |= 1 << i;
+	}
+
+	for (Link = &Context->ReclaimingRangeSets; *Link; )
+	{
+		Entry = *Link;
+		RangeSet = CONTAINING_RECORD(Entry, DIOUM_RANGE_SET, RetiredEntry);
+		RangeSet->IdleReaders |= IdleReaders;
+
+		if (RangeSet->IdleReaders == 3)
+		{
+			*Link = Entry->Next;
+			DiopFreeRangeSet(RangeSet);
+		}
+		else
+		{
+			Link = &Entry->Next;
+		}
+	}
+
+	Epoch = Context->ReaderEpoch & 1;
+
+	if (!Context->ActiveReaders[Epoch ^ 1])
+		InterlockedExchange(&Context->ReaderEpoch, Epoch ^ 1);
+
+	ReleaseSRWLockExclusive(&Context->ReclaimLock);
+}
+
+
+DIOUM_DRIVER_CONTEXT *
+APIENTRY
+DioInitialize(
+	VOID)
+{
+	DIOUM_DRIVER_CONTEXT *Context = (DIOUM_DRIVER_CONTEXT *)DiopAllocate(sizeof(*Context));
+	
+	do
+	{
+		if (!Context)
+			break;
+
+		InitializeSListHead(&Context->RequestPool);
+		InitializeSListHead(&Context->RetiredRangeSets);
+		InitializeSRWLock(&Context->ReclaimLock);
+		InitializeSRWLock(&Context->RangeSetLock);
+		InitializeSRWLock(&Context->CombineLock);
+		InitializeConditionVariable(&Context->CombineDone);
+		InitializeSRWLock(&Context->ClockLock);
+		InitializeSRWLock(&Context->LogLock);
+		InitializeSRWLock(&Context->StreamLock);
+		InitializeSRWLock(&Context->RingLock);
+		InitializeSRWLock(&Context->SnapshotLock);
+		QueryPerformanceFrequency(&Context->PerformanceFrequency);
+
+		Context->Transport = &DiopTransport;
+
+		if (!Context->Transport->Open(Context))
+			break;
+
+		Context->ReadXorMask = 0x00;
+		Context->WriteXorMask = 0xff;
+		Context->RegisteredRangeSet = NULL;
+		Context->ActiveReaders[0] = 0;
+		Context->ActiveReaders[1] = 0;
+		Context->ReaderEpoch = 0;
+		Context->ReclaimingRangeSets = NULL;
+
+		Context->Magic = DIOUM_CONTEXT_MAGIC;
+
+		// Optional. Without the page, the snapshot functions fail and the configuration is read by IOCTL.
+		if (!DiopMapSnapshot(Context))
+			DFTRACE("Snapshot page is not available\n");
+
+		return Context;
+
+	} while(FALSE);
+
+	if (!Context)
+		return NULL;
+
+	DiopFree(Context);
+
+	return NULL;
+}
+
+BOOL
+APIENTRY
+DioGetXorMask(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OUT UCHAR *ReadXorMask, 
+	OUT UCHAR *WriteXorMask)
+{
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	if (ReadXorMask)
+		*ReadXorMask = Context->ReadXorMask;
+
+	if (WriteXorMask)
+		*WriteXorMask = Context->WriteXorMask;
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DioSetXorMask(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN UCHAR ReadXorMask, 
+	IN UCHAR WriteXorMask, 
+	IN BOOL SetRead, 
+	IN BOOL SetWrite)
+{
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	if (SetRead)
+		Context->ReadXorMask = ReadXorMask;
+
+	if (SetWrite)
+		Context->WriteXorMask = WriteXorMask;
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DioGetDriverConfiguration(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OUT ULONG *ConfigurationBits)
+{
+	BOOL Result = FALSE;
+	ULONG ReturnedLength = 0;
+	DIO_PACKET_READ_WRITE_CONFIGURATION Packet;
+	DIOUM_REQUEST *Request;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	// Driver publishes the configuration in the snapshot page, so no IOCTL is needed.
+	if (DiopReadSnapshotConfiguration(Context, ConfigurationBits))
+		return TRUE;
+
+	Request = DiopAcquireRequest(Context, 0);
+	if (!Request)
+		return FALSE;
+
+	ZeroMemory(&Packet, sizeof(Packet));
+	Packet.Version = DIO_DRIVER_CONFIGURATION_VERSION1;
+
+	if (DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_READ_CONFIGURATION, 
+		(PVOID)&Packet, 
+		sizeof(Packet.Version), 
+		(PVOID)&Packet, 
+		sizeof(Packet), 
+		&ReturnedLength))
+	{
+		DFTRACE("IOCTL succeeded with %d bytes returned\n", ReturnedLength);
+
+		if (ReturnedLength == sizeof(Packet))
+		{
+			*ConfigurationBits = Packet.ConfigurationBlock.ConfigurationBits;
+			Result = TRUE;
+		}
+	}
+
+	DiopReleaseRequest(Context, Request);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioSetDriverConfiguration(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG ConfigurationBits)
+{
+	BOOL Result = FALSE;
+	ULONG ReturnedLength = 0;
+	DIO_PACKET_READ_WRITE_CONFIGURATION Packet;
+	DIOUM_REQUEST *Request;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	Request = DiopAcquireRequest(Context, 0);
+	if (!Request)
+		return FALSE;
+
+	ZeroMemory(&Packet, sizeof(Packet));
+	Packet.Version = DIO_DRIVER_CONFIGURATION_VERSION1;
+	Packet.ConfigurationBlock.ConfigurationBits = ConfigurationBits;
+
+	if (DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_WRITE_CONFIGURATION, 
+		(PVOID)&Packet, 
+		sizeof(Packet), 
+		(PVOID)&Packet, 
+		sizeof(Packet), 
+		&ReturnedLength))
+	{
+		DFTRACE("IOCTL succeeded with %d bytes returned\n", ReturnedLength);
+
+		if (ReturnedLength == sizeof(Packet))
+			Result = TRUE;
+	}
+
+	DiopReleaseRequest(Context, Request);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioShutdown(
+	IN DIOUM_DRIVER_CONTEXT *Context)
+{
+	PSLIST_ENTRY Entry;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	//
+	// Caller must make sure that no other thread is using the context.
+	//
+
+	if (Context->Log)
+		DiopStopRecording(Context);
+
+	if (Context->RegisteredRangeSet)
+		DiopFreeRangeSet(Context->RegisteredRangeSet);
+
+	if (Context->StreamWriteMasks)
+		DiopFree(Context->StreamWriteMasks);
+
+	// Shared memory of the ring is unmapped by the driver when the handle is closed.
+	if (Context->Ring)
+		DiopFree(Context->Ring);
+
+	// Snapshot page is unmapped by the driver when the handle is closed.
+	if (Context->SnapshotLayout)
+		DiopFreeRangeSet(Context->SnapshotLayout);
+
+	while (Context->RetiredSnapshotLayouts)
+	{
+		DIOUM_RANGE_SET *RangeSet = Context->RetiredSnapshotLayouts;
+
+		Context->RetiredSnapshotLayouts = RangeSet->Next;
+		DiopFreeRangeSet(RangeSet);
+	}
+
+	DiopReclaimRangeSets(Context, TRUE);
+
+	while (Context->RangeSetList)
+	{
+		DIOUM_RANGE_SET *RangeSet = Context->RangeSetList;
+
+		Context->RangeSetList = RangeSet->Next;
+		DiopFreeRangeSet(RangeSet);
+	}
+
+	while ((Entry = InterlockedPopEntrySList(&Context->RequestPool)) != NULL)
+	{
+		DIOUM_REQUEST *Request = CONTAINING_RECORD(Entry, DIOUM_REQUEST, PoolEntry);
+
+		Context->Transport->DeleteRequest(Request);
+		DiopFree(Request);
+	}
+
+	Context->Transport->Close(Context);
+
+	memset(Context, 0, sizeof(*Context));
+
+	DiopFree(Context);
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DioRegisterPortAddressRange(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG AddressRangeCount, 
+	IN DIOUM_PORT_RANGE *AddressRanges)
+{
+	DIOUM_RANGE_SET *RangeSet;
+	DIOUM_RANGE_SET *OldRangeSet;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	if (AddressRangeCount > DIO_MAXIMUM_PORT_RANGES)
+		return FALSE;
+
+	RangeSet = DiopCreateRangeSet(NULL, AddressRangeCount, AddressRanges, NULL, NULL);
+	if (!RangeSet)
+		return FALSE;
+
+	if (Context->RegisteredFreshness && 
+		!DiopSetReadCacheFreshness(Context, RangeSet, Context->RegisteredFreshness))
+	{
+		DiopFreeRangeSet(RangeSet);
+		return FALSE;
+	}
+
+	// Publish the new set. Threads which already referenced the old one keep using it.
+	OldRangeSet = (DIOUM_RANGE_SET *)InterlockedExchangePointer(
+		(PVOID *)&Context->RegisteredRangeSet, RangeSet);
+
+	if (OldRangeSet)
+		InterlockedPushEntrySList(&Context->RetiredRangeSets, &OldRangeSet->RetiredEntry);
+
+	DiopReclaimRangeSets(Context, FALSE);
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DioReadPortMultiple(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *ReturnedDataLength)
+{
+	DIOUM_RANGE_SET *RangeSet;
+	BOOL Result = FALSE;
+	ULONG Epoch = 0;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	RangeSet = DiopReferenceRegisteredRangeSet(Context, &Epoch);
+
+	if (RangeSet)
+		Result = DiopReadRangeSet(Context, RangeSet, Buffer, BufferLength, ReturnedDataLength);
+
+	DiopDereferenceRegisteredRangeSet(Context, Epoch);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioWritePortMultiple(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *TransferredDataLength)
+{
+	DIOUM_RANGE_SET *RangeSet;
+	BOOL Result = FALSE;
+	ULONG Epoch = 0;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	RangeSet = DiopReferenceRegisteredRangeSet(Context, &Epoch);
+
+	if (RangeSet)
+		Result = DiopWriteRangeSet(Context, RangeSet, Buffer, BufferLength, TransferredDataLength);
+
+	DiopDereferenceRegisteredRangeSet(Context, Epoch);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioCreateRangeSet(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OPTIONAL IN PCSTR Name, 
+	IN ULONG AddressRangeCount, 
+	IN DIOUM_PORT_RANGE *AddressRanges, 
+	OPTIONAL IN UCHAR *ReadXorMasks, 
+	OPTIONAL IN UCHAR *WriteXorMasks, 
+	OUT DIOUM_RANGE_SET **RangeSet)
+/**
+ *	@brief	Creates the range set which can be read/written without registration.
+ *	
+ *	The ranges are validated once against the resources claimed by the device, 
+ *	so the invalid requests never reach the driver.\n
+ *	Each range set stores its packet header, data length, data offsets and XOR masks.
+ *
+ *	@param	[in] Context				Driver context.
+ *	@param	[in, opt] Name				Name of the range set which can be used with DioLookupRangeSet().\n
+ *										1 ~ DIOUM_RANGE_SET_MAXIMUM_NAME_LENGTH characters if given.\n
+ *										Fails with ERROR_ALREADY_EXISTS if the name is in use.
+ *	@param	[in] AddressRangeCount		Count of port address ranges.
+ *	@param	[in] AddressRanges			Port address ranges.
+ *	@param	[in, opt] ReadXorMasks		Read XOR mask of each range.
+ *	@param	[in, opt] WriteXorMasks		Write XOR mask of each range.\n
+ *										Context masks are used if both masks are NULL.
+ *	@param	[out] RangeSet				Receives the range set.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIOUM_RANGE_SET *NewRangeSet;
+	DIOUM_RANGE_SET *Entry;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	if (!AddressRangeCount || !AddressRanges || !RangeSet)
+		return FALSE;
+
+	if (Name && !DiopIsValidRangeSetName(Name))
+		return FALSE;
+
+	if (!DiopValidateRanges(Context, AddressRangeCount, AddressRanges))
+		return FALSE;
+
+	NewRangeSet = DiopCreateRangeSet(Name, AddressRangeCount, AddressRanges, ReadXorMasks, WriteXorMasks);
+	if (!NewRangeSet)
+		return FALSE;
+
+	AcquireSRWLockExclusive(&Context->RangeSetLock);
+
+	if (Name)
+	{
+		for (Entry = Context->RangeSetList; Entry; Entry = Entry->Next)
+		{
+			if (Entry->Name[0] && !strcmp(Entry->Name, Name))
+				break;
+		}
+
+		if (Entry)
+		{
+			ReleaseSRWLockExclusive(&Context->RangeSetLock);
+			DiopFreeRangeSet(NewRangeSet);
+			SetLastError(ERROR_ALREADY_EXISTS);
+			return FALSE;
+		}
+	}
+
+	NewRangeSet->Next = Context->RangeSetList;
+	Context->RangeSetList = NewRangeSet;
+	ReleaseSRWLockExclusive(&Context->RangeSetLock);
+
+	*RangeSet = NewRangeSet;
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DioDestroyRangeSet(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet)
+/**
+ *	@brief	Destroys the range set.
+ *	
+ *	Caller must make sure that no other thread is using the range set.
+ *
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] RangeSet				Range set which is created by DioCreateRangeSet().
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIOUM_RANGE_SET **Link;
+	BOOL Found = FALSE;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	AcquireSRWLockExclusive(&Context->RangeSetLock);
+
+	for (Link = &Context->RangeSetList; *Link; Link = &(*Link)->Next)
+	{
+		if (*Link == RangeSet)
+		{
+			*Link = RangeSet->Next;
+			Found = TRUE;
+			break;
+		}
+	}
+
+	ReleaseSRWLockExclusive(&Context->RangeSetLock);
+
+	if (Found)
+		DiopFreeRangeSet(RangeSet);
+
+	return Found;
+}
+
+DIOUM_RANGE_SET *
+APIENTRY
+DioLookupRangeSet(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN PCSTR Name)
+/**
+ *	@brief	Looks up the range set by name.
+ *	
+ *	Unnamed range sets are never found.\n
+ *	No reference is taken on the returned range set, so the caller must serialize the lookup 
+ *	and every use of the result against DioDestroyRangeSet() of the same range set.
+ *
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] Name					Name which is given to DioCreateRangeSet().
+ *	@return								Range set. NULL if not found or the name is not valid.
+ *	
+ */
+{
+	DIOUM_RANGE_SET *RangeSet;
+
+	if (!DiopValidateContext(Context) || !Name || !DiopIsValidRangeSetName(Name))
+		return NULL;
+
+	AcquireSRWLockShared(&Context->RangeSetLock);
+
+	for (RangeSet = Context->RangeSetList; RangeSet; RangeSet = RangeSet->Next)
+	{
+		if (RangeSet->Name[0] && !strcmp(RangeSet->Name, Name))
+			break;
+	}
+
+	ReleaseSRWLockShared(&Context->RangeSetLock);
+
+	return RangeSet;
+}
+
+BOOL
+APIENTRY
+DioGetRangeSetLayout(
+	IN DIOUM_RANGE_SET *RangeSet, 
+	IN ULONG RangeIndex, 
+	OPTIONAL OUT ULONG *Offset, 
+	OPTIONAL OUT ULONG *Length, 
+	OPTIONAL OUT ULONG *DataLength)
+/**
+ *	@brief	Returns the data layout of range set.
+ *	
+ *	@param	[in] RangeSet				Range set.
+ *	@param	[in] RangeIndex				Index of the range.
+ *	@param	[out, opt] Offset			Receives the data offset of the range.
+ *	@param	[out, opt] Length			Receives the data length of the range.
+ *	@param	[out, opt] DataLength		Receives the total data length of range set.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	if (!RangeSet || RangeIndex >= RangeSet->Header.RangeCount)
+		return FALSE;
+
+	if (Offset)
+		*Offset = RangeSet->Offsets[RangeIndex];
+
+	if (Length)
+		*Length = RangeSet->Header.AddressRange[RangeIndex].EndAddress - 
+			RangeSet->Header.AddressRange[RangeIndex].StartAddress + 1;
+
+	if (DataLength)
+		*DataLength = RangeSet->DataLength;
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DioReadRangeSet(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *ReturnedDataLength)
+{
+	if (!DiopValidateContext(Context) || !RangeSet)
+		return FALSE;
+
+	return DiopReadRangeSet(Context, RangeSet, Buffer, BufferLength, ReturnedDataLength);
+}
+
+BOOL
+APIENTRY
+DioWriteRangeSet(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	IN PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *TransferredDataLength)
+{
+	if (!DiopValidateContext(Context) || !RangeSet)
+		return FALSE;
+
+	return DiopWriteRangeSet(Context, RangeSet, Buffer, BufferLength, TransferredDataLength);
+}
+
+BOOL
+APIENTRY
+DiopReadBurst(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	IN ULONG FrameCount, 
+	IN ULONG Flags, 
+	OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT LONGLONG *Timestamps)
+/**
+ *	@brief	Reads the range set FrameCount times with one IOCTL.
+ *	
+ *	This function is reserved for internal use.\n
+ *	With Timestamps, fails without reading if the clock cannot be calibrated.
+ *	
+ */
+{
+	DIO_PACKET_READ_BURST *Packet;
+	DIOUM_REQUEST *Request;
+	ULONG RangeCount = RangeSet->Header.RangeCount;
+	ULONG HeaderLength = PACKET_READ_BURST_GET_LENGTH(RangeCount);
+	ULONG DataLength;
+	ULONG OutputLength;
+	ULONG ReturnedLength = 0;
+	PUCHAR Output;
+	ULONG i;
+	BOOL Result;
+
+	if (!RangeCount || !FrameCount || FrameCount > DIOUM_BURST_MAXIMUM_FRAMES || (Flags & ~DIOUM_BURST_FLAG_PLANAR))
+		return FALSE;
+
+	if ((ULONGLONG)RangeSet->DataLength * FrameCount > DIOUM_BURST_MAXIMUM_DATA_LENGTH)
+		return FALSE;
 
-DIOUM_DRIVER_CONTEXT *
+	DataLength = RangeSet->DataLength * FrameCount;
+	OutputLength = DataLength + (Timestamps ? FrameCount * sizeof(LONGLONG) : 0);
+
+	if (BufferLength < DataLength)
+		return FALSE;
+
+	// Calibrate before the read, so that a failed calibration does not throw the frames away.
+	if (Timestamps)
+	{
+		if (!DiopAcquireCalibratedClock(Context))
+			return FALSE;
+
+		ReleaseSRWLockShared(&Context->ClockLock);
+	}
+
+	// Data is read straight into Buffer, unless the timestamps follow it.
+	Request = DiopAcquireRequest(Context, HeaderLength + (Timestamps ? OutputLength : 0));
+	if (!Request)
+		return FALSE;
+
+	Packet = (DIO_PACKET_READ_BURST *)Request->Buffer;
+	Packet->FrameCount = FrameCount;
+	Packet->Flags = (Flags & DIOUM_BURST_FLAG_PLANAR) ? DIO_BURST_FLAG_PLANAR : 0;
+	Packet->RangeCount = RangeCount;
+	memcpy(Packet->AddressRange, RangeSet->Header.AddressRange, RangeCount * sizeof(DIO_PORT_RANGE));
+
+	if (Timestamps)
+		Packet->Flags |= DIO_BURST_FLAG_TIMESTAMPS;
+
+	Output = Timestamps ? Request->Buffer + HeaderLength : Buffer;
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_READ_BURST, 
+		(PVOID)Packet, 
+		HeaderLength, 
+		(PVOID)Output, 
+		OutputLength, 
+		&ReturnedLength);
+
+	if (Result && ReturnedLength != OutputLength)
+	{
+		DFTRACE("Length mismatched, assuming failed\n");
+		Result = FALSE;
+	}
+
+	if (Result && Timestamps)
+	{
+		memcpy(Buffer, Output, DataLength);
+		memcpy(Timestamps, Output + DataLength, FrameCount * sizeof(LONGLONG));
+	}
+
+	DiopReleaseRequest(Context, Request);
+
+	if (!Result)
+		return FALSE;
+
+	// Apply the read masks in place. A planar range is one run over all frames.
+	if (Flags & DIOUM_BURST_FLAG_PLANAR)
+	{
+		for (i = 0; i < RangeCount; i++)
+		{
+			ULONG Length = RangeSet->Header.AddressRange[i].EndAddress - RangeSet->Header.AddressRange[i].StartAddress + 1;
+			PUCHAR Plane = Buffer + RangeSet->Offsets[i] * FrameCount;
+
+			DiopUnsafeXorCopy(Plane, Plane, Length * FrameCount, 
+				(RangeSet->Flags & DIOUM_RANGE_SET_FLAG_OWN_MASKS) ? RangeSet->ReadXorMasks[i] : Context->ReadXorMask);
+		}
+	}
+	else
+	{
+		for (i = 0; i < FrameCount; i++)
+			DiopCopyRangeSetData(Context, RangeSet, Buffer + i * RangeSet->DataLength, Buffer + i * RangeSet->DataLength, FALSE);
+	}
+
+	// Calibration is never cleared, so the clock is still calibrated.
+	if (Timestamps)
+	{
+		AcquireSRWLockShared(&Context->ClockLock);
+
+		for (i = 0; i < FrameCount; i++)
+			Timestamps[i] = DiopConvertKernelTime(Context, Timestamps[i]);
+
+		ReleaseSRWLockShared(&Context->ClockLock);
+	}
+
+	return TRUE;
+}
+
+BOOL
 APIENTRY
-DioInitialize(
-	VOID)
+DioReadRangeSetBurst(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OPTIONAL IN DIOUM_RANGE_SET *RangeSet, 
+	IN ULONG FrameCount, 
+	IN ULONG Flags, 
+	OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT LONGLONG *Timestamps)
+/**
+ *	@brief	Reads the range set FrameCount times back to back, with one IOCTL.
+ *	
+ *	Each frame is read with one hold of the port lock, so it is a consistent snapshot. Between
+ *	the frames the driver lets other port accesses run once it has held the lock long enough.\n
+ *	Frames are interleaved by default: frame f is at f * DataLength of the range set. With
+ *	DIOUM_BURST_FLAG_PLANAR, the data of each range is contiguous over the frames instead.
+ *	Read XOR masks are applied. The cache of the range set is neither used nor updated.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in, opt] RangeSet			Range set. Registered ranges if NULL.
+ *	@param	[in] FrameCount				Count of frames, 1 ~ DIOUM_BURST_MAXIMUM_FRAMES.
+ *	@param	[in] Flags					Combination of DIOUM_BURST_FLAG_XXX.
+ *	@param	[out] Buffer				Receives the data of all frames.
+ *	@param	[in] BufferLength			Length of Buffer. Must hold FrameCount frames, and
+ *										DIOUM_BURST_MAXIMUM_DATA_LENGTH at most is read.
+ *	@param	[out, opt] Timestamps		Receives FrameCount times in the application clock, each right
+ *										after the frame is read.
+ *	@return								Non-zero if successful.
+ *	
+ */
 {
-	DIOUM_DRIVER_CONTEXT *Context = (DIOUM_DRIVER_CONTEXT *)DiopAllocate(sizeof(*Context));
-	BOOLEAN InitializedCritSection = FALSE;
-	
-	do
+	BOOLEAN Registered = !RangeSet;
+	BOOL Result = FALSE;
+	ULONG Epoch = 0;
+
+	if (!DiopValidateContext(Context) || !Buffer)
+		return FALSE;
+
+	if (Registered)
+		RangeSet = DiopReferenceRegisteredRangeSet(Context, &Epoch);
+
+	if (RangeSet)
+		Result = DiopReadBurst(Context, RangeSet, FrameCount, Flags, Buffer, BufferLength, Timestamps);
+
+	if (Registered)
+		DiopDereferenceRegisteredRangeSet(Context, Epoch);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioReadPortScatter(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG EntryCount, 
+	IN DIOUM_SCATTER_ENTRY *Entries, 
+	OPTIONAL OUT ULONG *ReturnedDataLength)
+/**
+ *	@brief	Reads the multiple port ranges and scatters the data to the caller buffers.
+ *	
+ *	Read XOR mask is applied while the data is copied to each destination buffer, 
+ *	so no intermediate flat buffer is needed.
+ *
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] EntryCount				Count of scatter entries.
+ *	@param	[in] Entries				Contains the port range and destination buffer pairs.
+ *	@param	[out, opt] ReturnedDataLength	Receives the total data length in bytes.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	ULONG i;
+	ULONG DataLength = 0;
+	ULONG HeaderLength;
+	ULONG ReturnedLength = 0;
+	DIO_PACKET_PORT_IO *PortIo;
+	DIOUM_REQUEST *Request;
+	BOOL Result = FALSE;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	if (!EntryCount || EntryCount > DIO_MAXIMUM_PORT_RANGES || !Entries)
+		return FALSE;
+
+	for (i = 0; i < EntryCount; i++)
 	{
-		if (!Context)
-			break;
+		if (Entries[i].Range.StartAddress > Entries[i].Range.EndAddress || !Entries[i].Buffer)
+			return FALSE;
 
-		if (!InitializeCriticalSectionAndSpinCount(&Context->CriticalSection, 0x1000))
-			break;
+		DataLength += Entries[i].Range.EndAddress - Entries[i].Range.StartAddress + 1;
+	}
 
-		InitializedCritSection = TRUE;
+	HeaderLength = PACKET_PORT_IO_GET_LENGTH(EntryCount);
 
-		Context->Handle = CreateFileW(L"\\\\.\\dioport", GENERIC_READ | GENERIC_WRITE, 
-			0, NULL, OPEN_EXISTING, 0, NULL);
+	Request = DiopAcquireRequest(Context, HeaderLength + DataLength);
+	if (!Request)
+		return FALSE;
 
-		if (Context->Handle == INVALID_HANDLE_VALUE)
-			break;
+	PortIo = (DIO_PACKET_PORT_IO *)Request->Buffer;
+	PortIo->RangeCount = EntryCount;
 
-		Context->ReadXorMask = 0x00;
-		Context->WriteXorMask = 0xff;
-		Context->InputBuffer.Packet.PortIo.RangeCount = 0;
-		Context->OutputBuffer.Packet.PortIo.RangeCount = 0;
+	for (i = 0; i < EntryCount; i++)
+	{
+		PortIo->AddressRange[i].StartAddress = Entries[i].Range.StartAddress;
+		PortIo->AddressRange[i].EndAddress = Entries[i].Range.EndAddress;
+	}
 
-		Context->Magic = DIOUM_CONTEXT_MAGIC;
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_READ_PORT, 
+		(PVOID)Request->Buffer, 
+		HeaderLength, 
+		(PVOID)Request->Buffer, 
+		HeaderLength + DataLength, 
+		&ReturnedLength);
+
+	if (Result)
+	{
+		DFTRACE("IOCTL succeeded with %d bytes returned\n", ReturnedLength);
 
-		return Context;
+		if (ReturnedLength == HeaderLength + DataLength)
+		{
+			PUCHAR Source = Request->Buffer + HeaderLength;
 
-	} while(FALSE);
+			for (i = 0; i < EntryCount; i++)
+			{
+				ULONG Length = Entries[i].Range.EndAddress - Entries[i].Range.StartAddress + 1;
+
+				Source += DiopUnsafeXorCopy(Entries[i].Buffer, Source, Length, Context->ReadXorMask);
+			}
+
+			if (ReturnedDataLength)
+				*ReturnedDataLength = DataLength;
+		}
+		else
+		{
+			DFTRACE("Length mismatched, assuming failed\n");
+			Result = FALSE;
+		}
+	}
+
+	DiopReleaseRequest(Context, Request);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioReadPortDirect(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG AddressRangeCount, 
+	IN DIOUM_PORT_RANGE *AddressRanges, 
+	IN OUT PUCHAR PacketBuffer, 
+	IN ULONG PacketBufferLength, 
+	OPTIONAL OUT PUCHAR *Data, 
+	OPTIONAL OUT ULONG *ReturnedDataLength)
+/**
+ *	@brief	Reads the multiple port ranges into the caller-supplied packet buffer.
+ *	
+ *	Caller must reserve DIOUM_DIRECT_HEADER_LENGTH(AddressRangeCount) bytes in front of the data.\n
+ *	The packet header is built in place and the same buffer is used as the IOCTL input/output, 
+ *	so the data is never staged in the request buffers.
+ *
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] AddressRangeCount		Count of port address ranges.
+ *	@param	[in] AddressRanges			Port address ranges to read.
+ *	@param	[in, out] PacketBuffer		Buffer which receives [header space] [data].
+ *	@param	[in] PacketBufferLength		Length of PacketBuffer in bytes.
+ *	@param	[out, opt] Data				Receives the address of the data in PacketBuffer.
+ *	@param	[out, opt] ReturnedDataLength	Receives the data length in bytes.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIO_PACKET_PORT_IO *PortIo = (DIO_PACKET_PORT_IO *)PacketBuffer;
+	ULONG HeaderLength = PACKET_PORT_IO_GET_LENGTH(AddressRangeCount);
+	ULONG DataLength = 0;
+	ULONG ReturnedLength = 0;
+	ULONG i;
+	DIOUM_REQUEST *Request;
+	BOOL Result = FALSE;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	if (!AddressRangeCount || AddressRangeCount > DIO_MAXIMUM_PORT_RANGES || !AddressRanges || !PacketBuffer)
+		return FALSE;
+
+	if (!DiopGetDataLength(AddressRangeCount, (DIO_PORT_RANGE *)AddressRanges, &DataLength) || 
+		PacketBufferLength < HeaderLength + DataLength)
+		return FALSE;
+
+	// Only the overlapped structure of the request is used.
+	Request = DiopAcquireRequest(Context, 0);
+	if (!Request)
+		return FALSE;
+
+	PortIo->RangeCount = AddressRangeCount;
+	memcpy(PortIo->AddressRange, AddressRanges, AddressRangeCount * sizeof(DIO_PORT_RANGE));
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_READ_PORT, 
+		(PVOID)PacketBuffer, 
+		HeaderLength, 
+		(PVOID)PacketBuffer, 
+		HeaderLength + DataLength, 
+		&ReturnedLength);
+
+	DiopReleaseRequest(Context, Request);
+
+	if (Result)
+	{
+		DFTRACE("IOCTL succeeded with %d bytes returned\n", ReturnedLength);
+
+		if (ReturnedLength == HeaderLength + DataLength)
+		{
+			if (Context->ReadXorMask)
+			{
+				for (i = 0; i < DataLength; i++)
+					PacketBuffer[HeaderLength + i] ^= Context->ReadXorMask;
+			}
+
+			if (Data)
+				*Data = PacketBuffer + HeaderLength;
+
+			if (ReturnedDataLength)
+				*ReturnedDataLength = DataLength;
+		}
+		else
+		{
+			DFTRACE("Length mismatched, assuming failed\n");
+			Result = FALSE;
+		}
+	}
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DiopGroupPortIo(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG AddressRangeCount, 
+	IN DIOUM_PORT_RANGE *AddressRanges, 
+	IN OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT DIOUM_PORT_SKEW *Skew, 
+	IN BOOLEAN Write)
+/**
+ *	@brief	Reads or writes the port ranges as one group.
+ *	
+ *	This function is reserved for internal use.
+ *	
+ */
+{
+	DIO_PACKET_PORT_IO *PortIo;
+	DIOUM_REQUEST *Request;
+	ULONG HeaderLength = PACKET_PORT_IO_GET_LENGTH(AddressRangeCount);
+	ULONG DataLength = 0;
+	ULONG OutputLength;
+	ULONG ReturnedLength = 0;
+	BOOL Result;
+
+	if (!DiopValidateContext(Context) || !Buffer)
+		return FALSE;
+
+	if (!AddressRangeCount || AddressRangeCount > DIO_MAXIMUM_PORT_RANGES || !AddressRanges)
+		return FALSE;
+
+	if (!DiopGetDataLength(AddressRangeCount, (DIO_PORT_RANGE *)AddressRanges, &DataLength) || 
+		DataLength > DIOUM_GROUP_MAXIMUM_LENGTH || BufferLength < DataLength)
+		return FALSE;
+
+	// Read  : [RangeCount] [Ranges] [Data] [Skew]
+	// Write : [RangeCount] [Ranges] [Skew]
+	OutputLength = HeaderLength + (Write ? 0 : DataLength) + sizeof(DIO_PORT_IO_SKEW);
+
+	Request = DiopAcquireRequest(Context, HeaderLength + DataLength + sizeof(DIO_PORT_IO_SKEW));
+	if (!Request)
+		return FALSE;
+
+	PortIo = (DIO_PACKET_PORT_IO *)Request->Buffer;
+	PortIo->RangeCount = AddressRangeCount | DIO_PORT_IO_FLAG_GROUP;
+	memcpy(PortIo->AddressRange, AddressRanges, AddressRangeCount * sizeof(DIO_PORT_RANGE));
+
+	if (Write)
+		DiopUnsafeXorCopy(Request->Buffer + HeaderLength, Buffer, DataLength, Context->WriteXorMask);
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		Write ? DIO_IOCTL_WRITE_PORT : DIO_IOCTL_READ_PORT, 
+		(PVOID)Request->Buffer, 
+		Write ? HeaderLength + DataLength : HeaderLength, 
+		(PVOID)Request->Buffer, 
+		OutputLength, 
+		&ReturnedLength);
+
+	if (Result && ReturnedLength != OutputLength)
+	{
+		DFTRACE("Length mismatched, assuming failed\n");
+		Result = FALSE;
+	}
+
+	if (Result)
+	{
+		if (!Write)
+			DiopUnsafeXorCopy(Buffer, Request->Buffer + HeaderLength, DataLength, Context->ReadXorMask);
+
+		if (Skew)
+			memcpy(Skew, Request->Buffer + OutputLength - sizeof(DIO_PORT_IO_SKEW), sizeof(*Skew));
+	}
+
+	DiopReleaseRequest(Context, Request);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioReadPortGroup(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG AddressRangeCount, 
+	IN DIOUM_PORT_RANGE *AddressRanges, 
+	OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT DIOUM_PORT_SKEW *Skew)
+/**
+ *	@brief	Reads the port ranges back to back with the interrupts disabled.
+ *	
+ *	The driver stages the ports before the reads, so the reads of a multi-byte input word which is
+ *	spread over the ports are as close in time as the bus allows. The ranges are not reordered.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] AddressRangeCount		Count of port address ranges.
+ *	@param	[in] AddressRanges			Port address ranges to read. DIOUM_GROUP_MAXIMUM_LENGTH ports at most.
+ *	@param	[out] Buffer				Receives the data with the read XOR mask applied.
+ *	@param	[in] BufferLength			Length of Buffer in bytes.
+ *	@param	[out, opt] Skew				Receives the time from the first to the last port read.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	return DiopGroupPortIo(Context, AddressRangeCount, AddressRanges, Buffer, BufferLength, Skew, FALSE);
+}
+
+BOOL
+APIENTRY
+DioWritePortGroup(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG AddressRangeCount, 
+	IN DIOUM_PORT_RANGE *AddressRanges, 
+	IN PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT DIOUM_PORT_SKEW *Skew)
+/**
+ *	@brief	Writes the port ranges back to back with the interrupts disabled.
+ *	
+ *	The driver stages the data before the writes, so the ports of a multi-byte output word change
+ *	as close in time as the bus allows, and the loads downstream see the fewest intermediate values.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] AddressRangeCount		Count of port address ranges.
+ *	@param	[in] AddressRanges			Port address ranges to write. DIOUM_GROUP_MAXIMUM_LENGTH ports at most.
+ *	@param	[in] Buffer					Data to write. Write XOR mask is applied.
+ *	@param	[in] BufferLength			Length of Buffer in bytes.
+ *	@param	[out, opt] Skew				Receives the time from the first to the last port write.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	return DiopGroupPortIo(Context, AddressRangeCount, AddressRanges, Buffer, BufferLength, Skew, TRUE);
+}
+
+BOOL
+APIENTRY
+DiopGetDescriptorDataLength(
+	IN ULONG DescriptorCount, 
+	IN DIOUM_PORT_DESCRIPTOR *Descriptors, 
+	OUT ULONG *DataLength)
+/**
+ *	@brief	Validates the port descriptors as the driver does, and calculates the data length.
+ *	
+ *	This function is reserved for internal use.
+ *	
+ *	@param	[in] DescriptorCount		Count of Descriptors.
+ *	@param	[in] Descriptors			Port descriptors.
+ *	@param	[out] DataLength			Receives the data length in bytes.
+ *	@return								Non-zero if the descriptors are valid.
+ *	
+ */
+{
+	ULONGLONG Length = 0;
+	ULONG i;
+
+	if (!DescriptorCount || DescriptorCount > DIOUM_PORT_IO_MAXIMUM_DESCRIPTORS || !Descriptors)
+		return FALSE;
+
+	for (i = 0; i < DescriptorCount; i++)
+	{
+		DIOUM_PORT_DESCRIPTOR *Descriptor = Descriptors + i;
+
+		if (!Descriptor->Count || !Descriptor->Width || !Descriptor->Repeat)
+			return FALSE;
+
+		if ((ULONGLONG)Descriptor->StartAddress + 
+			(ULONGLONG)(Descriptor->Count - 1) * Descriptor->Stride + Descriptor->Width - 1 > 0xffff)
+			return FALSE;
+
+		Length += (ULONGLONG)Descriptor->Count * Descriptor->Width * Descriptor->Repeat;
+		if (Length > DIOUM_PORT_IO_MAXIMUM_DATA_LENGTH)
+			return FALSE;
+	}
+
+	*DataLength = (ULONG)Length;
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DioReadPortDescriptors(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG DescriptorCount, 
+	IN DIOUM_PORT_DESCRIPTOR *Descriptors, 
+	OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *ReturnedDataLength)
+/**
+ *	@brief	Reads the ports which are described by the strided descriptors.
+ *	
+ *	Only the descriptors are sent to the driver, which writes the data straight to Buffer,
+ *	so a sparse or interleaved layout costs a few bytes of header instead of a range per run.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] DescriptorCount		Count of Descriptors, up to DIOUM_PORT_IO_MAXIMUM_DESCRIPTORS.
+ *	@param	[in] Descriptors			Port descriptors.
+ *	@param	[out] Buffer				Receives the data in the order of Descriptors.
+ *	@param	[in] BufferLength			Length of Buffer in bytes.
+ *	@param	[out, opt] ReturnedDataLength	Receives the data length in bytes.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIO_PACKET_PORT_IO_V2 *PortIo;
+	DIOUM_REQUEST *Request;
+	ULONG HeaderLength = PACKET_PORT_IO_V2_GET_LENGTH(DescriptorCount);
+	ULONG DataLength = 0;
+	ULONG ReturnedLength = 0;
+	ULONG i;
+	BOOL Result;
 
-	if (InitializedCritSection)
-		DeleteCriticalSection(&Context->CriticalSection);
+	if (!DiopValidateContext(Context) || !Buffer)
+		return FALSE;
 
-	if (Context->Handle != NULL && Context->Handle != INVALID_HANDLE_VALUE)
-		CloseHandle(Context->Handle);
+	if (!DiopGetDescriptorDataLength(DescriptorCount, Descriptors, &DataLength) || BufferLength < DataLength)
+		return FALSE;
 
-	DiopFree(Context);
+	Request = DiopAcquireRequest(Context, HeaderLength);
+	if (!Request)
+		return FALSE;
 
-	return NULL;
-}
+	PortIo = (DIO_PACKET_PORT_IO_V2 *)Request->Buffer;
+	PortIo->Version = DIO_PORT_IO_VERSION2;
+	PortIo->Flags = 0;
+	PortIo->DescriptorCount = DescriptorCount;
+	memcpy(PortIo->Descriptors, Descriptors, DescriptorCount * sizeof(DIO_PORT_DESCRIPTOR));
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_READ_PORT_V2, 
+		(PVOID)PortIo, 
+		HeaderLength, 
+		(PVOID)Buffer, 
+		DataLength, 
+		&ReturnedLength);
+
+	DiopReleaseRequest(Context, Request);
+
+	if (Result && ReturnedLength != DataLength)
+	{
+		DFTRACE("Length mismatched, assuming failed\n");
+		Result = FALSE;
+	}
 
-BOOL
-APIENTRY
-DioGetXorMask(
-	IN DIOUM_DRIVER_CONTEXT *Context, 
-	OUT UCHAR *ReadXorMask, 
-	OUT UCHAR *WriteXorMask)
-{
-	if (!DiopValidateContext(Context))
+	if (!Result)
 		return FALSE;
 
-	if (ReadXorMask)
-		*ReadXorMask = Context->ReadXorMask;
+	if (Context->ReadXorMask)
+	{
+		for (i = 0; i < DataLength; i++)
+			Buffer[i] ^= Context->ReadXorMask;
+	}
 
-	if (WriteXorMask)
-		*WriteXorMask = Context->WriteXorMask;
+	if (ReturnedDataLength)
+		*ReturnedDataLength = DataLength;
 
 	return TRUE;
 }
 
 BOOL
 APIENTRY
-DioSetXorMask(
+DioWritePortDescriptors(
 	IN DIOUM_DRIVER_CONTEXT *Context, 
-	IN UCHAR ReadXorMask, 
-	IN UCHAR WriteXorMask, 
-	IN BOOL SetRead, 
-	IN BOOL SetWrite)
+	IN ULONG DescriptorCount, 
+	IN DIOUM_PORT_DESCRIPTOR *Descriptors, 
+	IN PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *TransferredDataLength)
+/**
+ *	@brief	Writes the ports which are described by the strided descriptors.
+ *	
+ *	Data is copied once with the write XOR mask applied, and nothing is returned but the status.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] DescriptorCount		Count of Descriptors, up to DIOUM_PORT_IO_MAXIMUM_DESCRIPTORS.
+ *	@param	[in] Descriptors			Port descriptors.
+ *	@param	[in] Buffer					Data to write, in the order of Descriptors.
+ *	@param	[in] BufferLength			Length of Buffer in bytes.
+ *	@param	[out, opt] TransferredDataLength	Receives the data length in bytes.
+ *	@return								Non-zero if successful.
+ *	
+ */
 {
-	if (!DiopValidateContext(Context))
+	DIO_PACKET_PORT_IO_V2 *PortIo;
+	DIOUM_REQUEST *Request;
+	ULONG HeaderLength = PACKET_PORT_IO_V2_GET_LENGTH(DescriptorCount);
+	ULONG DataLength = 0;
+	ULONG ReturnedLength = 0;
+	BOOL Result;
+
+	if (!DiopValidateContext(Context) || !Buffer)
 		return FALSE;
 
-	if (SetRead)
-		Context->ReadXorMask = ReadXorMask;
+	if (!DiopGetDescriptorDataLength(DescriptorCount, Descriptors, &DataLength) || BufferLength < DataLength)
+		return FALSE;
 
-	if (SetWrite)
-		Context->WriteXorMask = WriteXorMask;
+	// [Header] [Descriptors] [Data]
+	Request = DiopAcquireRequest(Context, HeaderLength + DataLength);
+	if (!Request)
+		return FALSE;
 
-	return TRUE;
+	PortIo = (DIO_PACKET_PORT_IO_V2 *)Request->Buffer;
+	PortIo->Version = DIO_PORT_IO_VERSION2;
+	PortIo->Flags = 0;
+	PortIo->DescriptorCount = DescriptorCount;
+	memcpy(PortIo->Descriptors, Descriptors, DescriptorCount * sizeof(DIO_PORT_DESCRIPTOR));
+
+	DiopUnsafeXorCopy(Request->Buffer + HeaderLength, Buffer, DataLength, Context->WriteXorMask);
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_WRITE_PORT_V2, 
+		(PVOID)PortIo, 
+		HeaderLength, 
+		(PVOID)(Request->Buffer + HeaderLength), 
+		DataLength, 
+		&ReturnedLength);
+
+	DiopReleaseRequest(Context, Request);
+
+	if (Result && ReturnedLength != DataLength)
+	{
+		DFTRACE("Length mismatched, assuming failed\n");
+		Result = FALSE;
+	}
+
+	if (Result && TransferredDataLength)
+		*TransferredDataLength = DataLength;
+
+	return Result;
 }
 
 BOOL
 APIENTRY
-DioGetDriverConfiguration(
+DioWaitPortPattern(
 	IN DIOUM_DRIVER_CONTEXT *Context, 
-	OUT ULONG *ConfigurationBits)
+	IN USHORT Port, 
+	IN UCHAR Mask, 
+	IN UCHAR Value, 
+	IN ULONG MaximumSpinTime, 
+	IN ULONG PollInterval, 
+	OPTIONAL IN DIOUM_PORT_RANGE *ReadRange, 
+	OPTIONAL OUT PUCHAR ReadBuffer, 
+	IN ULONG ReadBufferLength, 
+	OPTIONAL OUT DIOUM_WAIT_PATTERN_RESULT *WaitResult)
+/**
+ *	@brief	Waits in the driver until (port value & Mask) == Value, then optionally reads a range.
+ *	
+ *	The driver spins for MaximumSpinTime at most (capped at DIO_WAIT_PATTERN_MAXIMUM_SPIN_TIME), 
+ *	so one IOCTL replaces the user-mode polling loop.\n
+ *	Mask and Value are compared after the read XOR mask is applied, as the other reads do.
+ *
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] Port					Port address to poll.
+ *	@param	[in] Mask					Bits to compare.
+ *	@param	[in] Value					Expected value of the masked bits.
+ *	@param	[in] MaximumSpinTime		Maximum spin time in microseconds.
+ *	@param	[in] PollInterval			Microseconds between the probes. Zero for back-to-back probes.
+ *	@param	[in, opt] ReadRange			Range to read right after the match.
+ *	@param	[out, opt] ReadBuffer		Receives the data of ReadRange. Required if ReadRange is given.
+ *	@param	[in] ReadBufferLength		Length of ReadBuffer in bytes.
+ *	@param	[out, opt] WaitResult		Receives the observed value, elapsed time and iterations.
+ *	@return								Non-zero if the pattern is observed.
+ *	
+ */
 {
-	BOOL Result = FALSE;
+	DIO_PACKET_WAIT_PATTERN *Packet;
+	DIOUM_REQUEST *Request;
+	ULONG PacketLength;
+	ULONG ReadLength = 0;
 	ULONG ReturnedLength = 0;
-	DIO_PACKET_READ_WRITE_CONFIGURATION Packet;
+	BOOL Result = FALSE;
 
 	if (!DiopValidateContext(Context))
 		return FALSE;
 
-	ZeroMemory(&Packet, sizeof(Packet));
-	Packet.Version = DIO_DRIVER_CONFIGURATION_VERSION1;
+	if (ReadRange)
+	{
+		if (ReadRange->StartAddress > ReadRange->EndAddress || !ReadBuffer)
+			return FALSE;
 
-	EnterCriticalSection(&Context->CriticalSection);
+		ReadLength = ReadRange->EndAddress - ReadRange->StartAddress + 1;
+		if (ReadLength > ReadBufferLength)
+			return FALSE;
+	}
 
-	Result = DeviceIoControl(
-		Context->Handle, 
-		DIO_IOCTL_READ_CONFIGURATION, 
-		(PVOID)&Packet, 
-		sizeof(Packet.Version), 
-		(PVOID)&Packet, 
-		sizeof(Packet), 
-		&ReturnedLength, 
-		NULL);
+	PacketLength = sizeof(*Packet) + ReadLength;
+
+	Request = DiopAcquireRequest(Context, PacketLength);
+	if (!Request)
+		return FALSE;
+
+	Packet = (DIO_PACKET_WAIT_PATTERN *)Request->Buffer;
+
+	ZeroMemory(Packet, sizeof(*Packet));
+	Packet->Port = Port;
+	Packet->Mask = Mask;
+	Packet->Value = (Value ^ Context->ReadXorMask) & Mask;
+	Packet->MaximumSpinTime = MaximumSpinTime;
+	Packet->PollInterval = PollInterval;
 
-	if (Result && GetLastError() == ERROR_SUCCESS)
+	if (ReadRange)
 	{
-		DFTRACE("IOCTL succeeded with %d bytes returned\n", ReturnedLength);
+		Packet->Flags |= DIO_WAIT_PATTERN_FLAG_READ;
+		Packet->ReadRange.StartAddress = ReadRange->StartAddress;
+		Packet->ReadRange.EndAddress = ReadRange->EndAddress;
+	}
 
-		if (ReturnedLength == sizeof(Packet))
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_WAIT_PATTERN, 
+		(PVOID)Packet, 
+		sizeof(*Packet), 
+		(PVOID)Packet, 
+		PacketLength, 
+		&ReturnedLength);
+
+	if (Result && ReturnedLength != PacketLength)
+	{
+		DFTRACE("Length mismatched, assuming failed\n");
+		Result = FALSE;
+	}
+
+	if (Result)
+	{
+		if (WaitResult)
 		{
-			*ConfigurationBits = Packet.ConfigurationBlock.ConfigurationBits;
-			Result = TRUE;
+			WaitResult->ObservedValue = (UCHAR)Packet->ObservedValue ^ Context->ReadXorMask;
+			WaitResult->ElapsedTime = Packet->ElapsedTime;
+			WaitResult->Iterations = Packet->Iterations;
 		}
+
+		Result = !!Packet->Matched;
+
+		if (Result && ReadRange)
+			DiopUnsafeXorCopy(ReadBuffer, Packet->Data, ReadLength, Context->ReadXorMask);
 	}
 
-	LeaveCriticalSection(&Context->CriticalSection);
+	DiopReleaseRequest(Context, Request);
 
 	return Result;
 }
 
 BOOL
 APIENTRY
-DioSetDriverConfiguration(
+DioStartEdgeEngine(
 	IN DIOUM_DRIVER_CONTEXT *Context, 
-	IN ULONG ConfigurationBits)
+	IN ULONG SampleInterval, 
+	IN ULONG Processor, 
+	IN ULONG ChannelCount, 
+	IN DIOUM_CHANNEL *Channels, 
+	IN ULONG DecoderCount, 
+	OPTIONAL IN DIOUM_QUADRATURE_DECODER *Decoders)
+/**
+ *	@brief	Starts the edge counting engine in the driver.
+ *	
+ *	The driver samples the ports of the channels every SampleInterval and keeps the edge counters, 
+ *	period and frequency of each channel and the position of each quadrature decoder.\n
+ *	The sampler spins on one processor between the samples, so pick the processor with care.\n
+ *	Levels are in the caller's domain: the read XOR mask is applied as the other reads do.
+ *
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] SampleInterval			Nanoseconds between the samples. Must not be zero.
+ *	@param	[in] Processor				Processor to run the sampler, or DIOUM_EDGE_ANY_PROCESSOR.
+ *	@param	[in] ChannelCount			Count of Channels (1 ~ DIOUM_EDGE_MAXIMUM_CHANNELS).
+ *	@param	[in] Channels				Input bits to sample.
+ *	@param	[in] DecoderCount			Count of Decoders (0 ~ DIOUM_EDGE_MAXIMUM_DECODERS).
+ *	@param	[in, opt] Decoders			Quadrature decoders which refer to the channels by index.
+ *	@return								Non-zero if successful. Fails if the engine is already running.
+ *	
+ */
 {
-	BOOL Result = FALSE;
+	DIO_PACKET_START_EDGE_ENGINE *Packet;
+	DIOUM_REQUEST *Request;
 	ULONG ReturnedLength = 0;
-	DIO_PACKET_READ_WRITE_CONFIGURATION Packet;
+	ULONG i;
+	BOOL Result;
 
 	if (!DiopValidateContext(Context))
 		return FALSE;
 
-	ZeroMemory(&Packet, sizeof(Packet));
-	Packet.Version = DIO_DRIVER_CONFIGURATION_VERSION1;
-	Packet.ConfigurationBlock.ConfigurationBits = ConfigurationBits;
+	if (!ChannelCount || ChannelCount > DIOUM_EDGE_MAXIMUM_CHANNELS || !Channels || 
+		DecoderCount > DIOUM_EDGE_MAXIMUM_DECODERS || (DecoderCount && !Decoders))
+		return FALSE;
 
-	EnterCriticalSection(&Context->CriticalSection);
+	for (i = 0; i < ChannelCount; i++)
+	{
+		if (Channels[i].Bit > 7 || (Channels[i].Flags & ~DIOUM_CHANNEL_VALID_FLAGS))
+			return FALSE;
+	}
 
-	Result = DeviceIoControl(
-		Context->Handle, 
-		DIO_IOCTL_WRITE_CONFIGURATION, 
-		(PVOID)&Packet, 
-		sizeof(Packet), 
-		(PVOID)&Packet, 
-		sizeof(Packet), 
-		&ReturnedLength, 
-		NULL);
+	Request = DiopAcquireRequest(Context, sizeof(*Packet));
+	if (!Request)
+		return FALSE;
+
+	Packet = (DIO_PACKET_START_EDGE_ENGINE *)Request->Buffer;
+
+	ZeroMemory(Packet, sizeof(*Packet));
+	Packet->SampleInterval = SampleInterval;
+	Packet->Processor = Processor;
+	Packet->ChannelCount = ChannelCount;
+	Packet->DecoderCount = DecoderCount;
 
-	if (Result && GetLastError() == ERROR_SUCCESS)
+	for (i = 0; i < ChannelCount; i++)
 	{
-		DFTRACE("IOCTL succeeded with %d bytes returned\n", ReturnedLength);
+		UCHAR Inverted = (UCHAR)((Context->ReadXorMask >> Channels[i].Bit) & 1);
 
-		if (ReturnedLength == sizeof(Packet))
-			Result = TRUE;
+		if (Channels[i].Flags & DIOUM_CHANNEL_INVERTED)
+			Inverted ^= 1;
+
+		Packet->Channels[i].Port = Channels[i].Port;
+		Packet->Channels[i].Bit = Channels[i].Bit;
+		Packet->Channels[i].Flags = Inverted ? DIO_EDGE_CHANNEL_INVERTED : 0;
 	}
 
-	LeaveCriticalSection(&Context->CriticalSection);
+	for (i = 0; i < DecoderCount; i++)
+	{
+		Packet->Decoders[i].ChannelA = Decoders[i].ChannelA;
+		Packet->Decoders[i].ChannelB = Decoders[i].ChannelB;
+		Packet->Decoders[i].ChannelIndex = Decoders[i].ChannelIndex;
+		Packet->Decoders[i].Flags = Decoders[i].Flags;
+	}
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_START_EDGE_ENGINE, 
+		(PVOID)Packet, 
+		sizeof(*Packet), 
+		NULL, 
+		0, 
+		&ReturnedLength);
+
+	DiopReleaseRequest(Context, Request);
 
 	return Result;
 }
 
 BOOL
 APIENTRY
-DioShutdown(
+DioStopEdgeEngine(
 	IN DIOUM_DRIVER_CONTEXT *Context)
+/**
+ *	@brief	Stops the edge counting engine.
+ *	
+ *	Counters remain readable until the next start. Closing the driver also stops the engine.
+ *
+ *	@param	[in] Context				Driver context.
+ *	@return								Non-zero if successful, even if the engine was not running.
+ *	
+ */
 {
+	DIOUM_REQUEST *Request;
+	ULONG ReturnedLength = 0;
+	BOOL Result;
+
 	if (!DiopValidateContext(Context))
 		return FALSE;
 
-	DeleteCriticalSection(&Context->CriticalSection);
-
-	if (Context->Handle != NULL && Context->Handle != INVALID_HANDLE_VALUE)
-		CloseHandle(Context->Handle);
+	Request = DiopAcquireRequest(Context, 0);
+	if (!Request)
+		return FALSE;
 
-	memset(Context, 0, sizeof(*Context));
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_STOP_EDGE_ENGINE, 
+		NULL, 
+		0, 
+		NULL, 
+		0, 
+		&ReturnedLength);
 
-	DiopFree(Context);
+	DiopReleaseRequest(Context, Request);
 
-	return TRUE;
+	return Result;
 }
 
 BOOL
 APIENTRY
-DioRegisterPortAddressRange(
+DioQueryEdgeCounters(
 	IN DIOUM_DRIVER_CONTEXT *Context, 
-	IN ULONG AddressRangeCount, 
-	IN DIOUM_PORT_RANGE *AddressRanges)
+	OUT DIOUM_EDGE_COUNTERS *Counters)
+/**
+ *	@brief	Reads all counters of the edge counting engine with one IOCTL.
+ *	
+ *	Mean frequency over a longer window is (difference of RisingEdges) / (difference of SampleTime) 
+ *	between two queries, which is more precise than Frequency.
+ *
+ *	@param	[in] Context				Driver context.
+ *	@param	[out] Counters				Receives the snapshot of the counters.
+ *	@return								Non-zero if successful.
+ *	
+ */
 {
-	ULONG i;
+	DIOUM_REQUEST *Request;
+	ULONG ReturnedLength = 0;
+	BOOL Result;
 
-	if (!DiopValidateContext(Context))
+	if (!DiopValidateContext(Context) || !Counters)
 		return FALSE;
 
-	if (AddressRangeCount > DIO_MAXIMUM_PORT_RANGES)
+	Request = DiopAcquireRequest(Context, sizeof(DIO_PACKET_QUERY_EDGE_COUNTERS));
+	if (!Request)
 		return FALSE;
 
-	EnterCriticalSection(&Context->CriticalSection);
-
-	for (i = 0; i < AddressRangeCount; i++)
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_QUERY_EDGE_COUNTERS, 
+		NULL, 
+		0, 
+		(PVOID)Request->Buffer, 
+		sizeof(DIO_PACKET_QUERY_EDGE_COUNTERS), 
+		&ReturnedLength);
+
+	if (Result && ReturnedLength != sizeof(DIO_PACKET_QUERY_EDGE_COUNTERS))
 	{
-		Context->InputBuffer.Packet.PortIo.AddressRange[i].StartAddress = AddressRanges[i].StartAddress;
-		Context->InputBuffer.Packet.PortIo.AddressRange[i].EndAddress = AddressRanges[i].EndAddress;
+		DFTRACE("Length mismatched, assuming failed\n");
+		Result = FALSE;
 	}
 
-	Context->InputBuffer.Packet.PortIo.RangeCount = AddressRangeCount;
+	if (Result)
+		memcpy(Counters, Request->Buffer, sizeof(*Counters));
 
-	LeaveCriticalSection(&Context->CriticalSection);
+	DiopReleaseRequest(Context, Request);
 
-	return TRUE;
+	return Result;
 }
 
 BOOL
 APIENTRY
-DioReadPortMultiple(
+DioSetFileMode(
 	IN DIOUM_DRIVER_CONTEXT *Context, 
-	IN PUCHAR Buffer, 
-	IN ULONG BufferLength, 
-	OPTIONAL OUT ULONG *ReturnedDataLength)
+	IN ULONG Mode, 
+	IN ULONG Width)
+/**
+ *	@brief	Sets how ReadFile/WriteFile on DioGetFileHandle() map the bytes to the ports.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] Mode					DIOUM_FILE_MODE_XXX.
+ *	@param	[in] Width					Ports in a cycle, 1 ~ DIOUM_FILE_MAXIMUM_WIDTH.
+ *										Ignored unless Mode is DIOUM_FILE_MODE_REPEAT.
+ *	@return								Non-zero if successful.
+ *	
+ */
 {
-	ULONG DataLength;
-	BOOL Result = FALSE;
+	DIO_PACKET_SET_FILE_MODE *Packet;
+	DIOUM_REQUEST *Request;
+	ULONG ReturnedLength = 0;
+	BOOL Result;
 
 	if (!DiopValidateContext(Context))
 		return FALSE;
 
-	EnterCriticalSection(&Context->CriticalSection);
+	Request = DiopAcquireRequest(Context, sizeof(*Packet));
+	if (!Request)
+		return FALSE;
 
-	if (DiopGetDataLength(
-		Context->InputBuffer.Packet.PortIo.RangeCount, 
-		Context->InputBuffer.Packet.PortIo.AddressRange, 
-		&DataLength) && DataLength <= BufferLength)
-	{
-		ULONG HeaderLength = PACKET_PORT_IO_GET_LENGTH(Context->InputBuffer.Packet.PortIo.RangeCount);
-		ULONG ReturnedLength = 0;
+	Packet = (DIO_PACKET_SET_FILE_MODE *)Request->Buffer;
+	Packet->Mode = Mode;
+	Packet->Width = Width;
 
-		Result = DeviceIoControl(
-			Context->Handle, 
-			DIO_IOCTL_READ_PORT, 
-			(PVOID)&Context->InputBuffer, 
-			HeaderLength, 
-			(PVOID)&Context->OutputBuffer, 
-			HeaderLength + DataLength, 
-			&ReturnedLength, 
-			NULL);
-
-		if (Result && GetLastError() == ERROR_SUCCESS)
-		{
-			DFTRACE("IOCTL succeeded with %d bytes returned\n", ReturnedLength);
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_SET_FILE_MODE, 
+		(PVOID)Packet, 
+		sizeof(*Packet), 
+		NULL, 
+		0, 
+		&ReturnedLength);
 
-			if (ReturnedLength == HeaderLength + DataLength)
-			{
-				DiopUnsafeXorCopy(Buffer, Context->OutputBuffer.Bytes + HeaderLength, DataLength, Context->ReadXorMask);
+	DiopReleaseRequest(Context, Request);
 
-				if (ReturnedDataLength)
-					*ReturnedDataLength = DataLength;
-			}
-			else
-			{
-				DFTRACE("Length mismatched, assuming failed\n");
-				Result = FALSE;
-			}
-		}
-	}
+	return Result;
+}
 
-	LeaveCriticalSection(&Context->CriticalSection);
+HANDLE
+APIENTRY
+DioGetFileHandle(
+	IN DIOUM_DRIVER_CONTEXT *Context)
+/**
+ *	@brief	Returns the device handle for ReadFile/WriteFile.
+ *	
+ *	Handle is opened with FILE_FLAG_OVERLAPPED, so every call gives the OVERLAPPED whose
+ *	offset is the port address, and the length is the byte count. Bytes are raw: XOR masks
+ *	are not applied on this path.\n
+ *	Handle belongs to the context. Do not close it.\n
+ *	On Linux, it is the file descriptor of /dev/port (cast to HANDLE) for pread/pwrite, whose
+ *	offset is the port address as well. DioSetFileMode() is not supported there.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@return								Device handle, or NULL if the context is invalid.
+ *	
+ */
+{
+	if (!DiopValidateContext(Context))
+		return NULL;
 
-	return Result;
+	return Context->Handle;
 }
 
 BOOL
 APIENTRY
-DioWritePortMultiple(
+DioStartPortWorker(
 	IN DIOUM_DRIVER_CONTEXT *Context, 
-	IN PUCHAR Buffer, 
-	IN ULONG BufferLength, 
-	OPTIONAL OUT ULONG *TransferredDataLength)
+	IN ULONG Processor, 
+	IN ULONG SpinTime)
+/**
+ *	@brief	Starts the driver thread which runs the port reads and writes of all callers.
+ *	
+ *	While it runs, DioReadPortMultiple(), DioWritePortMultiple() and the range set calls post their
+ *	transfers to the worker and wait, instead of contending for the port lock of the driver.
+ *	Transfers are run in the order of the posts. Pays off with many threads on the same board;
+ *	a single caller is faster without it.\n
+ *	The worker spins on one processor while it polls, so pick the processor with care.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] Processor				Processor of the worker, or DIOUM_WORKER_ANY_PROCESSOR.
+ *	@param	[in] SpinTime				Microseconds to poll after the last request before the worker
+ *										sleeps. Up to DIOUM_WORKER_MAXIMUM_SPIN_TIME.
+ *	@return								Non-zero if successful. Fails if the worker is running.
+ *	
+ */
 {
-	ULONG DataLength;
-	BOOL Result = FALSE;
+	DIO_PACKET_START_WORKER *Packet;
+	DIOUM_REQUEST *Request;
+	ULONG ReturnedLength = 0;
+	BOOL Result;
 
 	if (!DiopValidateContext(Context))
 		return FALSE;
 
-	EnterCriticalSection(&Context->CriticalSection);
+	Request = DiopAcquireRequest(Context, sizeof(*Packet));
+	if (!Request)
+		return FALSE;
 
-	if (DiopGetDataLength(
-		Context->InputBuffer.Packet.PortIo.RangeCount, 
-		Context->InputBuffer.Packet.PortIo.AddressRange, 
-		&DataLength) && DataLength <= BufferLength)
-	{
-		ULONG HeaderLength = PACKET_PORT_IO_GET_LENGTH(Context->InputBuffer.Packet.PortIo.RangeCount);
-		ULONG ReturnedLength = 0;
+	Packet = (DIO_PACKET_START_WORKER *)Request->Buffer;
+	Packet->Processor = Processor;
+	Packet->SpinTime = SpinTime;
 
-		DiopUnsafeXorCopy(Context->InputBuffer.Bytes + HeaderLength, Buffer, DataLength, Context->WriteXorMask);
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_START_WORKER, 
+		(PVOID)Packet, 
+		sizeof(*Packet), 
+		NULL, 
+		0, 
+		&ReturnedLength);
 
-		Result = DeviceIoControl(
-			Context->Handle, 
-			DIO_IOCTL_WRITE_PORT, 
-			(PVOID)&Context->InputBuffer, 
-			HeaderLength + DataLength, 
-			(PVOID)&Context->OutputBuffer, 
-			HeaderLength, 
-			&ReturnedLength, 
-			NULL);
+	DiopReleaseRequest(Context, Request);
 
-		if (Result && GetLastError() == ERROR_SUCCESS)
-		{
-			DFTRACE("IOCTL succeeded with %d bytes returned\n", ReturnedLength);
+	return Result;
+}
 
-			if (ReturnedLength == HeaderLength)
-			{
-				if (TransferredDataLength)
-					*TransferredDataLength = DataLength;
-			}
-			else
-			{
-				DFTRACE("Length mismatched, assuming failed\n");
-				Result = FALSE;
-			}
-		}
+BOOL
+APIENTRY
+DioStopPortWorker(
+	IN DIOUM_DRIVER_CONTEXT *Context)
+/**
+ *	@brief	Stops the port I/O worker. Transfers take the port lock in the caller's thread again.
+ *	
+ *	Closing the driver also stops the worker.
+ *
+ *	@param	[in] Context				Driver context.
+ *	@return								Non-zero if successful, even if the worker was not running.
+ *	
+ */
+{
+	DIOUM_REQUEST *Request;
+	ULONG ReturnedLength = 0;
+	BOOL Result;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	Request = DiopAcquireRequest(Context, 0);
+	if (!Request)
+		return FALSE;
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_STOP_WORKER, 
+		NULL, 
+		0, 
+		NULL, 
+		0, 
+		&ReturnedLength);
+
+	DiopReleaseRequest(Context, Request);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioQueryPortWorker(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OUT DIOUM_WORKER_STATUS *Status)
+/**
+ *	@brief	Reads the statistics of the port I/O worker.
+ *	
+ *	Requests / Batches is the mean count of transfers which share one hold of the port lock.
+ *
+ *	@param	[in] Context				Driver context.
+ *	@param	[out] Status				Receives the statistics.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIOUM_REQUEST *Request;
+	ULONG ReturnedLength = 0;
+	BOOL Result;
+
+	if (!DiopValidateContext(Context) || !Status)
+		return FALSE;
+
+	Request = DiopAcquireRequest(Context, sizeof(DIO_PACKET_QUERY_WORKER));
+	if (!Request)
+		return FALSE;
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_QUERY_WORKER, 
+		NULL, 
+		0, 
+		(PVOID)Request->Buffer, 
+		sizeof(DIO_PACKET_QUERY_WORKER), 
+		&ReturnedLength);
+
+	if (Result && ReturnedLength != sizeof(DIO_PACKET_QUERY_WORKER))
+	{
+		DFTRACE("Length mismatched, assuming failed\n");
+		Result = FALSE;
 	}
 
-	LeaveCriticalSection(&Context->CriticalSection);
+	if (Result)
+		memcpy(Status, Request->Buffer, sizeof(*Status));
+
+	DiopReleaseRequest(Context, Request);
 
 	return Result;
 }
@@ -483,15 +2635,22 @@ DioVfTest(
 {
 	UCHAR Buffer[24] = { 0 };
 	ULONG Dummy;
+	DIOUM_REQUEST *Request;
 
 	if (!DiopValidateContext(Context))
 		return FALSE;
 
+	Request = DiopAcquireRequest(Context, 0);
+	if (!Request)
+		return FALSE;
+
 	if (TestFlag & DIOUM_VF_IO_READ)
-		ReadFile(Context->Handle, Buffer, sizeof(Buffer), &Dummy, NULL);
+		Context->Transport->ReadWrite(Context, Request, 0, Buffer, sizeof(Buffer), FALSE, &Dummy);
 
 	if (TestFlag & DIOUM_VF_IO_WRITE)
-		WriteFile(Context->Handle, Buffer, sizeof(Buffer), &Dummy, NULL);
+		Context->Transport->ReadWrite(Context, Request, 0, Buffer, sizeof(Buffer), TRUE, &Dummy);
+
+	DiopReleaseRequest(Context, Request);
 
 	return TRUE;
 }
@@ -508,6 +2667,8 @@ DioVfIoctlTest(
 	return FALSE;
 #else
 	ULONG i;
+	DIOUM_REQUEST *Request;
+	DIO_PACKET_PORT_IO *PortIo;
 
 	if (!DiopValidateContext(Context))
 		return FALSE;
@@ -515,7 +2676,11 @@ DioVfIoctlTest(
 	if (AddressRangeCountMaximum > AddressRangeCountMaximum)
 		return FALSE;
 
-	EnterCriticalSection(&Context->CriticalSection);
+	Request = DiopAcquireRequest(Context, 8192 + 256 * 4 + 4);
+	if (!Request)
+		return FALSE;
+
+	PortIo = (DIO_PACKET_PORT_IO *)Request->Buffer;
 
 	srand(GetTickCount());
 
@@ -530,51 +2695,37 @@ DioVfIoctlTest(
 		ULONG InputBufferLength;
 		ULONG OutputBufferLength;
 
-		Context->InputBuffer.Packet.PortIo.RangeCount = AddressRangeCount;
+		PortIo->RangeCount = AddressRangeCount;
 
 		for (j = 0; j < 1024; j++)
-			*((UCHAR *)Context->InputBuffer.Packet.PortIo.AddressRange + j) = (UCHAR)rand();
+			*((UCHAR *)PortIo->AddressRange + j) = (UCHAR)rand();
 
 		for (j = 0; j < 16; j++)
 		{
-			Context->InputBuffer.Packet.PortIo.AddressRange[j].StartAddress = 0x7000;
-			Context->InputBuffer.Packet.PortIo.AddressRange[j].EndAddress = 0x7000 + (rand() & 0x3ff);
+			PortIo->AddressRange[j].StartAddress = 0x7000;
+			PortIo->AddressRange[j].EndAddress = 0x7000 + (rand() & 0x3ff);
 		}
 
 		InputBufferLength = rand() % 8192;
 		OutputBufferLength = rand() % 8192;
 		DFTRACE("InputBufferLength %d, OutputBufferLength %d\n", InputBufferLength, OutputBufferLength);
 
-		Result = DeviceIoControl(
-			Context->Handle, 
+		Result = DiopDeviceIoControl(
+			Context, 
+			Request, 
 			DIO_IOCTL_READ_PORT, 
-			(PVOID)&Context->InputBuffer, 
+			(PVOID)Request->Buffer, 
 			InputBufferLength, 
-			(PVOID)&Context->OutputBuffer, 
+			(PVOID)Request->Buffer, 
 			OutputBufferLength, 
-			&ReturnedLength, 
-			NULL);
+			&ReturnedLength);
 
 		DFTRACE("Read: Result %d, ReturnedLength %d, LastError %d\n", 
 			Result, ReturnedLength, GetLastError());
-
-//		Result = DeviceIoControl(
-//			Context->Handle, 
-//			DIO_IOCTL_WRITE_PORT, 
-//			(PVOID)&Context->InputBuffer, 
-//			InputBufferLength, 
-//			(PVOID)&Context->OutputBuffer, 
-//			OutputBufferLength, 
-//			&ReturnedLength, 
-//			NULL);
-//
-//		DTRACE("Write: Result %d, ReturnedLength %d, LastError %d\n", 
-//			Result, ReturnedLength, GetLastError());
 	}
 
-	LeaveCriticalSection(&Context->CriticalSection);
+	DiopReleaseRequest(Context, Request);
 
 	return TRUE;
 #endif
 }
-
@@ -0,0 +1,436 @@
+
+#include <Windows.h>
+#include "../Include/dioctl.h"
+#include "../Include/dioum.h"
+#include "dioum_internal.h"
+
+
+DIOUM_READ_CACHE *
+APIENTRY
+DiopGetReadCache(
+	IN DIOUM_RANGE_SET *RangeSet)
+/**
+ *	@brief	Returns the read cache of range set, allocating it on first use.
+ *	
+ *	@param	[in] RangeSet				Range set.
+ *	@return								Non-NULL if succeeded.
+ *	
+ */
+{
+	DIOUM_READ_CACHE *ReadCache = RangeSet->ReadCache;
+	DIOUM_READ_CACHE *Previous;
+
+	if (ReadCache)
+		return ReadCache;
+
+	// [DIOUM_READ_CACHE] [Data]
+	ReadCache = (DIOUM_READ_CACHE *)DiopAllocate(sizeof(*ReadCache) + RangeSet->DataLength);
+	if (!ReadCache)
+		return NULL;
+
+	InitializeSRWLock(&ReadCache->Lock);
+	ReadCache->Data = (PUCHAR)(ReadCache + 1);
+
+	Previous = (DIOUM_READ_CACHE *)InterlockedCompareExchangePointer(
+		(PVOID volatile *)&RangeSet->ReadCache, ReadCache, NULL);
+
+	if (Previous)
+	{
+		// Other thread allocated it first.
+		DiopFree(ReadCache);
+		return Previous;
+	}
+
+	return ReadCache;
+}
+
+VOID
+APIENTRY
+DiopFreeReadCache(
+	IN DIOUM_RANGE_SET *RangeSet)
+/**
+ *	@brief	Frees the read cache of range set.
+ *	
+ *	@param	[in] RangeSet				Range set.
+ *	@return								None.
+ *	
+ */
+{
+	if (RangeSet->ReadCache)
+		DiopFree(RangeSet->ReadCache);
+
+	RangeSet->ReadCache = NULL;
+}
+
+BOOL
+APIENTRY
+DiopSetReadCacheFreshness(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	IN ULONG Freshness)
+/**
+ *	@brief	Sets the freshness limit of range set. The cached data is invalidated.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] RangeSet				Range set.
+ *	@param	[in] Freshness				Freshness limit in microseconds. Zero disables the cache.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIOUM_READ_CACHE *ReadCache;
+
+	if (!Freshness && !RangeSet->ReadCache)
+		return TRUE;
+
+	ReadCache = DiopGetReadCache(RangeSet);
+	if (!ReadCache)
+		return FALSE;
+
+	AcquireSRWLockExclusive(&ReadCache->Lock);
+
+	ReadCache->Freshness = Freshness;
+	ReadCache->FreshnessTicks = Freshness * Context->PerformanceFrequency.QuadPart / 1000000;
+	ReadCache->Valid = FALSE;
+
+	ReleaseSRWLockExclusive(&ReadCache->Lock);
+
+	return TRUE;
+}
+
+VOID
+APIENTRY
+DiopInvalidateReadCache(
+	IN DIOUM_RANGE_SET *RangeSet)
+{
+	DIOUM_READ_CACHE *ReadCache = RangeSet->ReadCache;
+
+	AcquireSRWLockExclusive(&ReadCache->Lock);
+	ReadCache->Valid = FALSE;
+	ReleaseSRWLockExclusive(&ReadCache->Lock);
+}
+
+BOOLEAN
+APIENTRY
+DiopReadCacheHit(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	IN DIOUM_READ_CACHE *ReadCache, 
+	OUT PUCHAR Buffer)
+/**
+ *	@brief	Copies the cached data if it is fresh. Caller must hold the cache lock.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] RangeSet				Range set.
+ *	@param	[in] ReadCache				Read cache of range set.
+ *	@param	[out] Buffer				Receives the data with the read masks applied.
+ *	@return								TRUE if the cached data is used.
+ *	
+ */
+{
+	LARGE_INTEGER Now;
+
+	if (!ReadCache->Valid || !ReadCache->Freshness)
+		return FALSE;
+
+	QueryPerformanceCounter(&Now);
+
+	if (Now.QuadPart - ReadCache->Timestamp.QuadPart >= ReadCache->FreshnessTicks)
+		return FALSE;
+
+	DiopCopyRangeSetData(Context, RangeSet, Buffer, ReadCache->Data, FALSE);
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DiopRefreshReadCache(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	IN DIOUM_READ_CACHE *ReadCache, 
+	OPTIONAL OUT PUCHAR Buffer)
+/**
+ *	@brief	Reads the ports into the read cache. Caller must hold the cache lock exclusively.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] RangeSet				Range set.
+ *	@param	[in] ReadCache				Read cache of range set.
+ *	@param	[out, opt] Buffer			Receives the data with the read masks applied.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	LARGE_INTEGER Timestamp;
+
+	// Age is counted from before the read, so the data is never older than it appears.
+	QueryPerformanceCounter(&Timestamp);
+
+	ReadCache->Valid = FALSE;
+
+	if (!DiopReadRangeSetUncached(Context, RangeSet, ReadCache->Data, RangeSet->DataLength, NULL))
+		return FALSE;
+
+	// Applying the read masks again restores the port values.
+	DiopCopyRangeSetData(Context, RangeSet, ReadCache->Data, ReadCache->Data, FALSE);
+
+	ReadCache->Timestamp = Timestamp;
+	ReadCache->Valid = TRUE;
+
+	if (Buffer)
+		DiopCopyRangeSetData(Context, RangeSet, Buffer, ReadCache->Data, FALSE);
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DiopReadCachedRangeSet(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *ReturnedDataLength)
+/**
+ *	@brief	Reads the range set through the read cache.
+ *	
+ *	Fresh data is served under the shared lock. On a miss the lock is taken exclusively
+ *	and checked again, so concurrent misses are served by one read.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] RangeSet				Range set which has the read cache.
+ *	@param	[out] Buffer				Receives the data.
+ *	@param	[in] BufferLength			Length of Buffer in bytes.
+ *	@param	[out, opt] ReturnedDataLength	Receives the data length in bytes.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIOUM_READ_CACHE *ReadCache = RangeSet->ReadCache;
+	BOOLEAN Hit;
+	BOOL Result = TRUE;
+
+	if (RangeSet->DataLength > BufferLength)
+		return FALSE;
+
+	AcquireSRWLockShared(&ReadCache->Lock);
+	Hit = DiopReadCacheHit(Context, RangeSet, ReadCache, Buffer);
+	ReleaseSRWLockShared(&ReadCache->Lock);
+
+	if (!Hit)
+	{
+		AcquireSRWLockExclusive(&ReadCache->Lock);
+
+		Hit = DiopReadCacheHit(Context, RangeSet, ReadCache, Buffer);
+		if (!Hit)
+			Result = DiopRefreshReadCache(Context, RangeSet, ReadCache, Buffer);
+
+		ReleaseSRWLockExclusive(&ReadCache->Lock);
+	}
+
+	if (Hit)
+		InterlockedIncrement64(&ReadCache->Hits);
+	else
+		InterlockedIncrement64(&ReadCache->Misses);
+
+	if (Result && ReturnedDataLength)
+		*ReturnedDataLength = RangeSet->DataLength;
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioSetRangeSetFreshness(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OPTIONAL IN DIOUM_RANGE_SET *RangeSet, 
+	IN ULONG Freshness)
+/**
+ *	@brief	Sets the freshness limit of range set.
+ *	
+ *	Reads which are younger than the limit are served from the cache without IOCTL.
+ *	Writes to the same range set invalidate the cache, but writes to other range sets do not.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in, opt] RangeSet			Range set. Registered ranges if NULL, which is kept across registrations.
+ *	@param	[in] Freshness				Freshness limit in microseconds. Zero disables the cache.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	BOOL Result = TRUE;
+	ULONG Epoch = 0;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	if (RangeSet)
+		return DiopSetReadCacheFreshness(Context, RangeSet, Freshness);
+
+	Context->RegisteredFreshness = Freshness;
+
+	RangeSet = DiopReferenceRegisteredRangeSet(Context, &Epoch);
+
+	if (RangeSet)
+		Result = DiopSetReadCacheFreshness(Context, RangeSet, Freshness);
+
+	DiopDereferenceRegisteredRangeSet(Context, Epoch);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioInvalidateRangeSet(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OPTIONAL IN DIOUM_RANGE_SET *RangeSet)
+/**
+ *	@brief	Invalidates the read cache, so the next read goes to the ports.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in, opt] RangeSet			Range set. Registered ranges if NULL.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	BOOLEAN Registered = !RangeSet;
+	ULONG Epoch = 0;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	if (Registered)
+		RangeSet = DiopReferenceRegisteredRangeSet(Context, &Epoch);
+
+	if (RangeSet && RangeSet->ReadCache)
+		DiopInvalidateReadCache(RangeSet);
+
+	if (Registered)
+		DiopDereferenceRegisteredRangeSet(Context, Epoch);
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DioRefreshRangeSet(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OPTIONAL IN DIOUM_RANGE_SET *RangeSet, 
+	OPTIONAL OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *ReturnedDataLength)
+/**
+ *	@brief	Reads the ports regardless of the freshness and updates the read cache.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in, opt] RangeSet			Range set. Registered ranges if NULL.
+ *	@param	[out, opt] Buffer			Receives the data.
+ *	@param	[in] BufferLength			Length of Buffer in bytes.
+ *	@param	[out, opt] ReturnedDataLength	Receives the data length in bytes.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIOUM_READ_CACHE *ReadCache;
+	BOOLEAN Registered = !RangeSet;
+	BOOL Result = FALSE;
+	ULONG Epoch = 0;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	if (Registered)
+		RangeSet = DiopReferenceRegisteredRangeSet(Context, &Epoch);
+
+	do
+	{
+		if (!RangeSet)
+			break;
+
+		if (Buffer && RangeSet->DataLength > BufferLength)
+			break;
+
+		ReadCache = RangeSet->ReadCache;
+
+		if (!ReadCache || !ReadCache->Freshness)
+		{
+			// Nothing to refresh. Reads the ports directly.
+			if (Buffer)
+				Result = DiopReadRangeSetUncached(Context, RangeSet, Buffer, BufferLength, NULL);
+			else
+				Result = TRUE;
+
+			break;
+		}
+
+		AcquireSRWLockExclusive(&ReadCache->Lock);
+		Result = DiopRefreshReadCache(Context, RangeSet, ReadCache, Buffer);
+		ReleaseSRWLockExclusive(&ReadCache->Lock);
+
+	} while (FALSE);
+
+	if (Result && ReturnedDataLength)
+		*ReturnedDataLength = RangeSet->DataLength;
+
+	if (Registered)
+		DiopDereferenceRegisteredRangeSet(Context, Epoch);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioQueryRangeSetStatistics(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OPTIONAL IN DIOUM_RANGE_SET *RangeSet, 
+	OPTIONAL OUT ULONGLONG *Hits, 
+	OPTIONAL OUT ULONGLONG *Misses, 
+	IN BOOL Reset)
+/**
+ *	@brief	Returns the read cache counters of range set.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in, opt] RangeSet			Range set. Registered ranges if NULL.
+ *	@param	[out, opt] Hits				Receives the count of reads which are served from the cache.
+ *	@param	[out, opt] Misses			Receives the count of reads which went to the ports.
+ *	@param	[in] Reset					Resets the counters to zero if TRUE.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIOUM_READ_CACHE *ReadCache;
+	BOOLEAN Registered = !RangeSet;
+	LONGLONG HitCount = 0;
+	LONGLONG MissCount = 0;
+	ULONG Epoch = 0;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	if (Registered)
+		RangeSet = DiopReferenceRegisteredRangeSet(Context, &Epoch);
+
+	ReadCache = RangeSet ? RangeSet->ReadCache : NULL;
+
+	if (ReadCache && Reset)
+	{
+		HitCount = InterlockedExchange64(&ReadCache->Hits, 0);
+		MissCount = InterlockedExchange64(&ReadCache->Misses, 0);
+	}
+	else if (ReadCache)
+	{
+		HitCount = ReadCache->Hits;
+		MissCount = ReadCache->Misses;
+	}
+
+	if (Registered)
+		DiopDereferenceRegisteredRangeSet(Context, Epoch);
+
+	if (Hits)
+		*Hits = (ULONGLONG)HitCount;
+
+	if (Misses)
+		*Misses = (ULONGLONG)MissCount;
+
+	return RangeSet != NULL;
+}
@@ -0,0 +1,708 @@
+
+#include <Windows.h>
+#include "../Include/dioctl.h"
+#include "../Include/dioum.h"
+#include "dioum_internal.h"
+
+// PEXT/PDEP intrinsics are available since Visual Studio 2012.
+#if _MSC_VER >= 1700
+#include <intrin.h>
+#include <immintrin.h>
+#define DIOUM_CHANNEL_MAP_BMI2
+#endif
+
+
+// Byte value to 8 bytes of 0/1 (byte k = bit k).
+#define DIOUM_EXPAND_BIT(_v, _k)	( (ULONGLONG)(((_v) >> (_k)) & 1) << ((_k) * 8) )
+#define DIOUM_EXPAND(_v)			\
+	( DIOUM_EXPAND_BIT(_v, 0) | DIOUM_EXPAND_BIT(_v, 1) | DIOUM_EXPAND_BIT(_v, 2) | DIOUM_EXPAND_BIT(_v, 3) | \
+	  DIOUM_EXPAND_BIT(_v, 4) | DIOUM_EXPAND_BIT(_v, 5) | DIOUM_EXPAND_BIT(_v, 6) | DIOUM_EXPAND_BIT(_v, 7) )
+#define DIOUM_EXPAND4(_v)			DIOUM_EXPAND(_v), DIOUM_EXPAND(_v + 1), DIOUM_EXPAND(_v + 2), DIOUM_EXPAND(_v + 3)
+#define DIOUM_EXPAND16(_v)			DIOUM_EXPAND4(_v), DIOUM_EXPAND4(_v + 4), DIOUM_EXPAND4(_v + 8), DIOUM_EXPAND4(_v + 12)
+#define DIOUM_EXPAND64(_v)			DIOUM_EXPAND16(_v), DIOUM_EXPAND16(_v + 16), DIOUM_EXPAND16(_v + 32), DIOUM_EXPAND16(_v + 48)
+
+static const ULONGLONG DiopExpandTable[256] = {
+	DIOUM_EXPAND64(0), DIOUM_EXPAND64(64), DIOUM_EXPAND64(128), DIOUM_EXPAND64(192)
+};
+
+
+BOOLEAN
+APIENTRY
+DiopIsFastBitExtractSupported(
+	VOID)
+/**
+ *	@brief	Checks whether PEXT/PDEP can be used.
+ *	
+ *	AMD processors before Zen 3 support BMI2 but execute PEXT/PDEP in microcode, 
+ *	which is slower than the table lookup.
+ *	
+ *	@return								TRUE if PEXT/PDEP are fast.
+ *	
+ */
+{
+#ifdef DIOUM_CHANNEL_MAP_BMI2
+	int Registers[4];
+	int Family;
+	BOOLEAN Amd;
+
+	__cpuid(Registers, 0);
+	if (Registers[0] < 7)
+		return FALSE;
+
+	// "AuthenticAMD"
+	Amd = (Registers[1] == 0x68747541 && Registers[3] == 0x69746e65 && Registers[2] == 0x444d4163);
+
+	__cpuidex(Registers, 7, 0);
+	if (!(Registers[1] & (1 << 8)))
+		return FALSE;
+
+	__cpuid(Registers, 1);
+	Family = (Registers[0] >> 8) & 0x0f;
+	if (Family == 0x0f)
+		Family += (Registers[0] >> 20) & 0xff;
+
+	return !Amd || Family >= 0x19;
+#else
+	return FALSE;
+#endif
+}
+
+ULONG
+APIENTRY
+DiopCompileChannelGroup(
+	IN DIOUM_CHANNEL_MAP *Map, 
+	IN ULONG FirstChannel, 
+	IN ULONG ChannelCount, 
+	IN BOOLEAN Pext, 
+	OPTIONAL OUT DIOUM_CHANNEL_OP *Ops)
+/**
+ *	@brief	Builds the extraction steps of the channel group.
+ *	
+ *	PEXT step takes the run of channels which are in ascending bit order within 32-bit window.\n
+ *	Table step takes all channels of the group which are in the same byte.\n
+ *	Both steps are also used to store the channels back with the same mask.
+ *	
+ *	@param	[in] Map					Channel map with ChannelOffsets and ChannelBits.
+ *	@param	[in] FirstChannel			First channel of the group.
+ *	@param	[in] ChannelCount			Count of channels in the group (up to 64).
+ *	@param	[in] Pext					Builds PEXT steps if TRUE, table steps otherwise.
+ *	@param	[out, opt] Ops				Receives the steps. Tables are not filled.
+ *	@return								Count of the steps.
+ *	
+ */
+{
+	ULONG OpCount = 0;
+	ULONG i, j;
+
+	if (Pext)
+	{
+		ULONG WindowStart = 0;
+		ULONG Previous = 0;
+
+		for (i = 0; i < ChannelCount; i++)
+		{
+			ULONG Offset = Map->ChannelOffsets[FirstChannel + i];
+			ULONG Bit = Map->ChannelBits[FirstChannel + i];
+			ULONG Position = (Offset - WindowStart) * 8 + Bit;
+
+			if (i && Offset >= WindowStart && Position < 32 && Position > Previous)
+			{
+				if (Ops)
+					Ops[OpCount - 1].Mask |= 1UL << Position;
+
+				Previous = Position;
+				continue;
+			}
+
+			// Starts a new window, which must be inside the frame.
+			WindowStart = min(Offset, Map->FrameLength - sizeof(ULONG));
+			Previous = (Offset - WindowStart) * 8 + Bit;
+
+			if (Ops)
+			{
+				Ops[OpCount].Offset = WindowStart;
+				Ops[OpCount].Mask = 1UL << Previous;
+				Ops[OpCount].Shift = i;
+				Ops[OpCount].Table = NULL;
+			}
+
+			OpCount++;
+		}
+	}
+	else
+	{
+		for (i = 0; i < ChannelCount; i++)
+		{
+			ULONG Offset = Map->ChannelOffsets[FirstChannel + i];
+
+			for (j = 0; j < i; j++)
+			{
+				if (Map->ChannelOffsets[FirstChannel + j] == Offset)
+					break;
+			}
+
+			if (j < i)
+				continue;
+
+			if (Ops)
+			{
+				Ops[OpCount].Offset = Offset;
+				Ops[OpCount].Mask = 0;
+				Ops[OpCount].Shift = 0;
+
+				// Bit to channel for packing. Last channel wins if a bit is mapped twice.
+				for (j = i; j < ChannelCount; j++)
+				{
+					if (Map->ChannelOffsets[FirstChannel + j] == Offset)
+					{
+						Ops[OpCount].Mask |= 1UL << Map->ChannelBits[FirstChannel + j];
+						Ops[OpCount].Channels[Map->ChannelBits[FirstChannel + j]] = (UCHAR)j;
+					}
+				}
+
+				// Bits are in the channel order, so the byte can be stored with one shift.
+				Ops[OpCount].Linear = TRUE;
+				Ops[OpCount].Shift = (LONG)i - Map->ChannelBits[FirstChannel + i];
+
+				for (j = 0; j < 8; j++)
+				{
+					if ((Ops[OpCount].Mask & (1UL << j)) && (LONG)Ops[OpCount].Channels[j] != (LONG)Ops[OpCount].Shift + (LONG)j)
+						Ops[OpCount].Linear = FALSE;
+				}
+			}
+
+			OpCount++;
+		}
+	}
+
+	return OpCount;
+}
+
+VOID
+APIENTRY
+DiopFillChannelTable(
+	IN DIOUM_CHANNEL_MAP *Map, 
+	IN ULONG FirstChannel, 
+	IN ULONG ChannelCount, 
+	IN OUT DIOUM_CHANNEL_OP *Op)
+/**
+ *	@brief	Fills the lookup table of the byte, which maps the byte value to the channel bits.
+ *	
+ *	@param	[in] Map					Channel map.
+ *	@param	[in] FirstChannel			First channel of the group.
+ *	@param	[in] ChannelCount			Count of channels in the group.
+ *	@param	[in, out] Op				Table step with Offset and Table set.
+ *	@return								None.
+ *	
+ */
+{
+	ULONG Value;
+	ULONG i;
+
+	for (Value = 0; Value < 256; Value++)
+	{
+		ULONGLONG Word = 0;
+
+		for (i = 0; i < ChannelCount; i++)
+		{
+			if (Map->ChannelOffsets[FirstChannel + i] == Op->Offset && 
+				(Value >> Map->ChannelBits[FirstChannel + i]) & 1)
+				Word |= 1ULL << i;
+		}
+
+		Op->Table[Value] = Word;
+	}
+}
+
+FORCEINLINE
+ULONGLONG
+DiopExtractChannelGroup(
+	IN DIOUM_CHANNEL_MAP *Map, 
+	IN DIOUM_CHANNEL_GROUP *Group, 
+	IN PUCHAR Frame)
+/**
+ *	@brief	Returns the channel bits of the group in one frame.
+ */
+{
+	DIOUM_CHANNEL_OP *Op = Map->Ops + Group->FirstOp;
+	DIOUM_CHANNEL_OP *End = Op + Group->OpCount;
+	ULONGLONG Word = 0;
+
+#ifdef DIOUM_CHANNEL_MAP_BMI2
+	if (Group->Pext)
+	{
+		for (; Op < End; Op++)
+			Word |= (ULONGLONG)_pext_u32(*(ULONG UNALIGNED *)(Frame + Op->Offset), Op->Mask) << Op->Shift;
+
+		return Word ^ Group->InvertMask;
+	}
+#endif
+
+	for (; Op < End; Op++)
+		Word |= Op->Table[Frame[Op->Offset]];
+
+	return Word ^ Group->InvertMask;
+}
+
+BOOL
+APIENTRY
+DioCreateChannelMap(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OPTIONAL IN DIOUM_RANGE_SET *RangeSet, 
+	IN ULONG ChannelCount, 
+	IN DIOUM_CHANNEL *Channels, 
+	OUT DIOUM_CHANNEL_MAP **ChannelMap)
+/**
+ *	@brief	Compiles the channel map for the data layout of range set.
+ *	
+ *	Channels are grouped by 64. Each group is extracted with PEXT on the processors which 
+ *	execute it fast, and with a 256-entry table per source byte otherwise.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in, opt] RangeSet			Range set which defines the frame layout. Registered ranges if NULL.
+ *	@param	[in] ChannelCount			Count of channels.
+ *	@param	[in] Channels				Port, bit and polarity of each logical channel.
+ *	@param	[out] ChannelMap			Receives the channel map.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIOUM_CHANNEL_MAP *Map = NULL;
+	BOOLEAN Registered = !RangeSet;
+	BOOLEAN Pext;
+	ULONG GroupCount;
+	ULONG OpCount;
+	ULONG TableCount;
+	ULONG Length;
+	ULONG i, j;
+	BOOL Result = FALSE;
+	ULONG Epoch = 0;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	if (!ChannelCount || ChannelCount > DIOUM_MAXIMUM_CHANNELS || !Channels || !ChannelMap)
+		return FALSE;
+
+	if (Registered)
+		RangeSet = DiopReferenceRegisteredRangeSet(Context, &Epoch);
+
+	do
+	{
+		DIOUM_CHANNEL_MAP Layout;
+		ULONG *Offsets;
+		UCHAR *Bits;
+
+		if (!RangeSet)
+			break;
+
+		// Frame offset of each channel is resolved first, then the steps are counted.
+		Offsets = (ULONG *)DiopAllocate(ChannelCount * (sizeof(ULONG) + sizeof(UCHAR)));
+		if (!Offsets)
+			break;
+
+		Bits = (UCHAR *)(Offsets + ChannelCount);
+
+		for (i = 0; i < ChannelCount; i++)
+		{
+			if (Channels[i].Bit >= 8 || (Channels[i].Flags & ~DIOUM_CHANNEL_VALID_FLAGS))
+				break;
+
+			for (j = 0; j < RangeSet->Header.RangeCount; j++)
+			{
+				DIO_PORT_RANGE *Range = RangeSet->Header.AddressRange + j;
+
+				if (Channels[i].Port >= Range->StartAddress && Channels[i].Port <= Range->EndAddress)
+				{
+					Offsets[i] = RangeSet->Offsets[j] + Channels[i].Port - Range->StartAddress;
+					Bits[i] = Channels[i].Bit;
+					break;
+				}
+			}
+
+			if (j == RangeSet->Header.RangeCount)
+			{
+				DFTRACE("Channel %d (port 0x%04x) is not in the range set\n", i, Channels[i].Port);
+				break;
+			}
+		}
+
+		if (i < ChannelCount)
+		{
+			DiopFree(Offsets);
+			break;
+		}
+
+		ZeroMemory(&Layout, sizeof(Layout));
+		Layout.FrameLength = RangeSet->DataLength;
+		Layout.ChannelOffsets = Offsets;
+		Layout.ChannelBits = Bits;
+
+		Pext = Layout.FrameLength >= sizeof(ULONG) && DiopIsFastBitExtractSupported();
+		GroupCount = (ChannelCount + 63) / 64;
+		OpCount = 0;
+		TableCount = 0;
+
+		for (i = 0; i < GroupCount; i++)
+		{
+			ULONG Count = min(64, ChannelCount - i * 64);
+			ULONG TableOps = DiopCompileChannelGroup(&Layout, i * 64, Count, FALSE, NULL);
+			ULONG PextOps = Pext ? DiopCompileChannelGroup(&Layout, i * 64, Count, TRUE, NULL) : MAXULONG;
+
+			if (PextOps <= TableOps)
+			{
+				OpCount += PextOps;
+			}
+			else
+			{
+				OpCount += TableOps;
+				TableCount += TableOps;
+			}
+		}
+
+		// [DIOUM_CHANNEL_MAP] [Tables] [Groups] [Ops] [ChannelOffsets] [ChannelBits]
+		Length = sizeof(*Map) + TableCount * 256 * sizeof(ULONGLONG) + 
+			GroupCount * sizeof(DIOUM_CHANNEL_GROUP) + OpCount * sizeof(DIOUM_CHANNEL_OP) + 
+			ChannelCount * (sizeof(ULONG) + sizeof(UCHAR));
+
+		Map = (DIOUM_CHANNEL_MAP *)DiopAllocate(Length);
+		if (!Map)
+		{
+			DiopFree(Offsets);
+			break;
+		}
+
+		*Map = Layout;
+		Map->ChannelCount = ChannelCount;
+		Map->GroupCount = GroupCount;
+		Map->Groups = (DIOUM_CHANNEL_GROUP *)((ULONGLONG *)(Map + 1) + TableCount * 256);
+		Map->Ops = (DIOUM_CHANNEL_OP *)(Map->Groups + GroupCount);
+		Map->ChannelOffsets = (ULONG *)(Map->Ops + OpCount);
+		Map->ChannelBits = (UCHAR *)(Map->ChannelOffsets + ChannelCount);
+
+		memcpy(Map->ChannelOffsets, Offsets, ChannelCount * sizeof(ULONG));
+		memcpy(Map->ChannelBits, Bits, ChannelCount * sizeof(UCHAR));
+		DiopFree(Offsets);
+
+		OpCount = 0;
+		TableCount = 0;
+
+		for (i = 0; i < GroupCount; i++)
+		{
+			DIOUM_CHANNEL_GROUP *Group = Map->Groups + i;
+			ULONG Count = min(64, ChannelCount - i * 64);
+			ULONG TableOps = DiopCompileChannelGroup(Map, i * 64, Count, FALSE, NULL);
+			ULONG PextOps = Pext ? DiopCompileChannelGroup(Map, i * 64, Count, TRUE, NULL) : MAXULONG;
+
+			Group->ChannelCount = Count;
+			Group->FirstOp = OpCount;
+			Group->Pext = (PextOps <= TableOps);
+			Group->OpCount = DiopCompileChannelGroup(Map, i * 64, Count, Group->Pext, Map->Ops + OpCount);
+
+			for (j = 0; j < Count; j++)
+			{
+				if (Channels[i * 64 + j].Flags & DIOUM_CHANNEL_INVERTED)
+					Group->InvertMask |= 1ULL << j;
+			}
+
+			if (!Group->Pext)
+			{
+				for (j = 0; j < Group->OpCount; j++)
+				{
+					DIOUM_CHANNEL_OP *Op = Map->Ops + OpCount + j;
+
+					Op->Table = (ULONGLONG *)(Map + 1) + TableCount * 256;
+					DiopFillChannelTable(Map, i * 64, Count, Op);
+					TableCount++;
+				}
+			}
+
+			OpCount += Group->OpCount;
+		}
+
+		*ChannelMap = Map;
+		Result = TRUE;
+
+	} while (FALSE);
+
+	if (Registered)
+		DiopDereferenceRegisteredRangeSet(Context, Epoch);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioDestroyChannelMap(
+	IN DIOUM_CHANNEL_MAP *ChannelMap)
+/**
+ *	@brief	Destroys the channel map.
+ *	
+ *	@param	[in] ChannelMap				Channel map which is created by DioCreateChannelMap().
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	if (!ChannelMap)
+		return FALSE;
+
+	DiopFree(ChannelMap);
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DioExtractChannels(
+	IN DIOUM_CHANNEL_MAP *ChannelMap, 
+	IN PUCHAR Frames, 
+	IN ULONG FrameCount, 
+	IN ULONG FrameStride, 
+	OUT PUCHAR Values)
+/**
+ *	@brief	Extracts the channel values from the frames.
+ *	
+ *	Values are stored frame by frame, one byte (0 or 1) per channel, polarity applied.
+ *	
+ *	@param	[in] ChannelMap				Channel map.
+ *	@param	[in] Frames					Frames in the data layout of the range set.
+ *	@param	[in] FrameCount				Count of frames.
+ *	@param	[in] FrameStride			Distance between frames in bytes. Zero if the frames are packed.
+ *	@param	[out] Values				Receives FrameCount * ChannelCount bytes.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	ULONG ChannelCount;
+	ULONG Frame;
+	ULONG i, j;
+
+	if (!ChannelMap || !Frames || !Values)
+		return FALSE;
+
+	if (!FrameStride)
+		FrameStride = ChannelMap->FrameLength;
+
+	if (FrameStride < ChannelMap->FrameLength)
+		return FALSE;
+
+	ChannelCount = ChannelMap->ChannelCount;
+
+	for (Frame = 0; Frame < FrameCount; Frame++)
+	{
+		for (i = 0; i < ChannelMap->GroupCount; i++)
+		{
+			DIOUM_CHANNEL_GROUP *Group = ChannelMap->Groups + i;
+			ULONGLONG Word = DiopExtractChannelGroup(ChannelMap, Group, Frames);
+			PUCHAR Destination = Values + i * 64;
+
+			for (j = 0; j < Group->ChannelCount; j += 8)
+			{
+				ULONGLONG Bytes = DiopExpandTable[(UCHAR)(Word >> j)];
+
+				if (Group->ChannelCount - j >= 8)
+					*(ULONGLONG UNALIGNED *)(Destination + j) = Bytes;
+				else
+					memcpy(Destination + j, &Bytes, Group->ChannelCount - j);
+			}
+		}
+
+		Frames += FrameStride;
+		Values += ChannelCount;
+	}
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DioExtractBitPlanes(
+	IN DIOUM_CHANNEL_MAP *ChannelMap, 
+	IN PUCHAR Frames, 
+	IN ULONG FrameCount, 
+	IN ULONG FrameStride, 
+	OUT PUCHAR Planes)
+/**
+ *	@brief	Extracts the bit-plane of each channel from the frames.
+ *	
+ *	Plane of channel N starts at Planes + N * DIOUM_BIT_PLANE_LENGTH(FrameCount). 
+ *	Bit (F % 8) of byte (F / 8) is the value of frame F, polarity applied.\n
+ *	Channel bits of 8 frames are transposed at once as 8x8 bit matrices.
+ *	
+ *	@param	[in] ChannelMap				Channel map.
+ *	@param	[in] Frames					Frames in the data layout of the range set.
+ *	@param	[in] FrameCount				Count of frames.
+ *	@param	[in] FrameStride			Distance between frames in bytes. Zero if the frames are packed.
+ *	@param	[out] Planes				Receives ChannelCount * DIOUM_BIT_PLANE_LENGTH(FrameCount) bytes.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	ULONG PlaneLength = DIOUM_BIT_PLANE_LENGTH(FrameCount);
+	ULONGLONG Words[8];
+	ULONG Block;
+	ULONG i, j, k;
+
+	if (!ChannelMap || !Frames || !Planes)
+		return FALSE;
+
+	if (!FrameStride)
+		FrameStride = ChannelMap->FrameLength;
+
+	if (FrameStride < ChannelMap->FrameLength)
+		return FALSE;
+
+	for (Block = 0; Block < PlaneLength; Block++)
+	{
+		ULONG Count = min(8, FrameCount - Block * 8);
+
+		for (i = 0; i < ChannelMap->GroupCount; i++)
+		{
+			DIOUM_CHANNEL_GROUP *Group = ChannelMap->Groups + i;
+			PUCHAR Frame = Frames;
+
+			for (k = 0; k < 8; k++)
+			{
+				Words[k] = k < Count ? DiopExtractChannelGroup(ChannelMap, Group, Frame) : 0;
+				Frame += FrameStride;
+			}
+
+			for (j = 0; j < Group->ChannelCount; j += 8)
+			{
+				ULONGLONG Matrix = 0;
+				ULONGLONG Swap;
+
+				// Row k is the channel byte of frame k.
+				for (k = 0; k < 8; k++)
+					Matrix |= (ULONGLONG)(UCHAR)(Words[k] >> j) << (k * 8);
+
+				// Transpose 8x8 bit matrix, so row k becomes the plane byte of channel j + k.
+				Swap = (Matrix ^ (Matrix >> 7)) & 0x00aa00aa00aa00aaULL;
+				Matrix ^= Swap ^ (Swap << 7);
+				Swap = (Matrix ^ (Matrix >> 14)) & 0x0000cccc0000ccccULL;
+				Matrix ^= Swap ^ (Swap << 14);
+				Swap = (Matrix ^ (Matrix >> 28)) & 0x00000000f0f0f0f0ULL;
+				Matrix ^= Swap ^ (Swap << 28);
+
+				for (k = 0; k < 8 && j + k < Group->ChannelCount; k++)
+					Planes[(i * 64 + j + k) * PlaneLength + Block] = (UCHAR)(Matrix >> (k * 8));
+			}
+		}
+
+		Frames += FrameStride * 8;
+	}
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DioPackChannels(
+	IN DIOUM_CHANNEL_MAP *ChannelMap, 
+	IN PUCHAR Values, 
+	IN ULONG FrameCount, 
+	IN ULONG FrameStride, 
+	IN OUT PUCHAR Frames)
+/**
+ *	@brief	Stores the channel values into the frames. Reverse of DioExtractChannels().
+ *	
+ *	Bits which are not mapped to any channel are left unchanged.
+ *	
+ *	@param	[in] ChannelMap				Channel map.
+ *	@param	[in] Values					FrameCount * ChannelCount bytes. Non-zero means 1.
+ *	@param	[in] FrameCount				Count of frames.
+ *	@param	[in] FrameStride			Distance between frames in bytes. Zero if the frames are packed.
+ *	@param	[in, out] Frames			Frames in the data layout of the range set.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	ULONG ChannelCount;
+	ULONG Frame;
+	ULONG i, j;
+
+	if (!ChannelMap || !Frames || !Values)
+		return FALSE;
+
+	if (!FrameStride)
+		FrameStride = ChannelMap->FrameLength;
+
+	if (FrameStride < ChannelMap->FrameLength)
+		return FALSE;
+
+	ChannelCount = ChannelMap->ChannelCount;
+
+	for (Frame = 0; Frame < FrameCount; Frame++)
+	{
+		for (i = 0; i < ChannelMap->GroupCount; i++)
+		{
+			DIOUM_CHANNEL_GROUP *Group = ChannelMap->Groups + i;
+			PUCHAR Source = Values + i * 64;
+			ULONGLONG Word = 0;
+
+			for (j = 0; j < Group->ChannelCount; j += 8)
+			{
+				ULONGLONG Bytes = 0;
+
+				if (Group->ChannelCount - j >= 8)
+					Bytes = *(ULONGLONG UNALIGNED *)(Source + j);
+				else
+					memcpy(&Bytes, Source + j, Group->ChannelCount - j);
+
+				// Fold each byte to its lowest bit, then gather the lowest bits into one byte.
+				Bytes |= Bytes >> 4;
+				Bytes |= Bytes >> 2;
+				Bytes |= Bytes >> 1;
+				Bytes &= 0x0101010101010101ULL;
+
+				Word |= ((Bytes * 0x0102040810204080ULL) >> 56) << j;
+			}
+
+			Word ^= Group->InvertMask;
+
+#ifdef DIOUM_CHANNEL_MAP_BMI2
+			if (Group->Pext)
+			{
+				DIOUM_CHANNEL_OP *Op = ChannelMap->Ops + Group->FirstOp;
+				DIOUM_CHANNEL_OP *End = Op + Group->OpCount;
+
+				for (; Op < End; Op++)
+				{
+					ULONG UNALIGNED *Window = (ULONG UNALIGNED *)(Frames + Op->Offset);
+
+					*Window = (*Window & ~Op->Mask) | _pdep_u32((ULONG)(Word >> Op->Shift), Op->Mask);
+				}
+
+				continue;
+			}
+#endif
+
+			for (j = 0; j < Group->OpCount; j++)
+			{
+				DIOUM_CHANNEL_OP *Op = ChannelMap->Ops + Group->FirstOp + j;
+				ULONG Value = 0;
+				ULONG Bit;
+
+				if (Op->Linear)
+				{
+					LONG Shift = (LONG)Op->Shift;
+
+					Value = (ULONG)(Shift >= 0 ? Word >> Shift : Word << -Shift);
+				}
+				else
+				{
+					// Unmapped bits point to a valid channel too, and are masked out below.
+					for (Bit = 0; Bit < 8; Bit++)
+						Value |= (ULONG)((Word >> Op->Channels[Bit]) & 1) << Bit;
+				}
+
+				Frames[Op->Offset] = (UCHAR)((Frames[Op->Offset] & ~Op->Mask) | (Value & Op->Mask));
+			}
+		}
+
+		Values += ChannelCount;
+		Frames += FrameStride;
+	}
+
+	return TRUE;
+}
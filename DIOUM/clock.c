@@ -0,0 +1,420 @@
+
+#include <Windows.h>
+#include "../Include/dioctl.h"
+#include "../Include/dioum.h"
+#include "dioum_internal.h"
+
+
+LONGLONG
+APIENTRY
+DiopScaleTicks(
+	IN LONGLONG Ticks, 
+	IN LONGLONG FromFrequency, 
+	IN LONGLONG ToFrequency)
+/**
+ *	@brief	Converts the tick count between the counter frequencies.
+ *	
+ *	@param	[in] Ticks					Tick count in FromFrequency.
+ *	@param	[in] FromFrequency			Frequency of Ticks.
+ *	@param	[in] ToFrequency			Frequency to convert to.
+ *	@return								Tick count in ToFrequency.
+ *	
+ */
+{
+	if (FromFrequency == ToFrequency)
+		return Ticks;
+
+	// Split to avoid the overflow of Ticks * ToFrequency.
+	return (Ticks / FromFrequency) * ToFrequency + 
+		(Ticks % FromFrequency) * ToFrequency / FromFrequency;
+}
+
+BOOL
+APIENTRY
+DiopCalibrateClock(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG SampleCount)
+/**
+ *	@brief	Correlates the kernel clock with the application clock.
+ *	
+ *	Each sample queries the kernel clock between two reads of the application clock.\n
+ *	The sample with the shortest round trip is kept, and the kernel clock is assumed to be
+ *	sampled at the midpoint. Caller must hold ClockLock exclusively.\n
+ *	The correlation is updated only if every sample succeeds, so a failure keeps the previous one.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] SampleCount			Count of samples.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIO_PACKET_QUERY_CLOCK *Packet;
+	DIOUM_REQUEST *Request;
+	LARGE_INTEGER Before, After;
+	LONGLONG BestRoundTrip = MAXLONGLONG;
+	LONGLONG ApplicationClockBase = 0;
+	LONGLONG KernelClockBase = 0;
+	LONGLONG KernelClockFrequency = 0;
+	ULONG ReturnedLength;
+	ULONG i;
+
+	if (!SampleCount)
+		return FALSE;
+
+	Request = DiopAcquireRequest(Context, sizeof(*Packet));
+	if (!Request)
+		return FALSE;
+
+	Packet = (DIO_PACKET_QUERY_CLOCK *)Request->Buffer;
+
+	for (i = 0; i < SampleCount; i++)
+	{
+		QueryPerformanceCounter(&Before);
+
+		if (!DiopDeviceIoControl(
+			Context, 
+			Request, 
+			DIO_IOCTL_QUERY_CLOCK, 
+			NULL, 
+			0, 
+			(PVOID)Packet, 
+			sizeof(*Packet), 
+			&ReturnedLength) || ReturnedLength != sizeof(*Packet) || !Packet->Frequency)
+		{
+			DFTRACE("Failed to query the kernel clock\n");
+			break;
+		}
+
+		QueryPerformanceCounter(&After);
+
+		if (After.QuadPart - Before.QuadPart < BestRoundTrip)
+		{
+			BestRoundTrip = After.QuadPart - Before.QuadPart;
+			ApplicationClockBase = Before.QuadPart + BestRoundTrip / 2;
+			KernelClockBase = Packet->Counter;
+			KernelClockFrequency = Packet->Frequency;
+		}
+	}
+
+	DiopReleaseRequest(Context, Request);
+
+	if (i < SampleCount)
+		return FALSE;
+
+	Context->ApplicationClockBase = ApplicationClockBase;
+	Context->KernelClockBase = KernelClockBase;
+	Context->KernelClockFrequency = KernelClockFrequency;
+	Context->ClockUncertainty = (BestRoundTrip + 1) / 2;
+	Context->ClockCalibrated = TRUE;
+
+	return TRUE;
+}
+
+LONGLONG
+APIENTRY
+DiopConvertKernelTime(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN LONGLONG KernelTime)
+/**
+ *	@brief	Converts the kernel performance counter value to the application clock.
+ *	
+ *	Caller must hold ClockLock.
+ *	
+ *	@param	[in] Context				Driver context which is calibrated.
+ *	@param	[in] KernelTime				Kernel performance counter value.
+ *	@return								Application performance counter value.
+ *	
+ */
+{
+	return Context->ApplicationClockBase + 
+		DiopScaleTicks(KernelTime - Context->KernelClockBase, Context->KernelClockFrequency, Context->PerformanceFrequency.QuadPart);
+}
+
+LONGLONG
+APIENTRY
+DiopConvertApplicationTime(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN LONGLONG ApplicationTime)
+/**
+ *	@brief	Converts the application performance counter value to the kernel clock.
+ *	
+ *	Caller must hold ClockLock.
+ *	
+ *	@param	[in] Context				Driver context which is calibrated.
+ *	@param	[in] ApplicationTime		Application performance counter value.
+ *	@return								Kernel performance counter value.
+ *	
+ */
+{
+	return Context->KernelClockBase + 
+		DiopScaleTicks(ApplicationTime - Context->ApplicationClockBase, Context->PerformanceFrequency.QuadPart, Context->KernelClockFrequency);
+}
+
+BOOL
+APIENTRY
+DiopTimestampedRangeSetIo(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	IN OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *TransferredDataLength, 
+	OUT DIOUM_IO_TIMESTAMP *Timestamp, 
+	IN BOOLEAN Write)
+/**
+ *	@brief	Reads or writes the range set with the timestamp request flag.
+ *	
+ *	Bypasses the read cache and the combining, since the timestamps must belong to this transaction.\n
+ *	The ports are accessed already when the clock is calibrated, so a failed calibration does not fail
+ *	the call. Then the timestamps are left in the kernel clock and Converted is FALSE.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] RangeSet				Range set to read or write.
+ *	@param	[in, out] Buffer			Data buffer.
+ *	@param	[in] BufferLength			Length of Buffer in bytes.
+ *	@param	[out, opt] TransferredDataLength	Receives the data length in bytes.
+ *	@param	[out] Timestamp				Receives the timestamps in the application clock if possible.
+ *	@param	[in] Write					Writes if TRUE, reads otherwise.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	ULONG HeaderLength = RangeSet->HeaderLength;
+	ULONG DataLength = RangeSet->DataLength;
+	ULONG ExpectedLength = (Write ? HeaderLength : HeaderLength + DataLength) + sizeof(DIO_PORT_IO_TIMESTAMP);
+	ULONG ReturnedLength = 0;
+	DIO_PORT_IO_TIMESTAMP KernelTimestamp;
+	DIOUM_REQUEST *Request;
+	BOOL Result = FALSE;
+	BOOL Calibrated;
+
+	if (DataLength > BufferLength)
+		return FALSE;
+
+	Request = DiopAcquireRequest(Context, HeaderLength + DataLength + sizeof(DIO_PORT_IO_TIMESTAMP));
+	if (!Request)
+		return FALSE;
+
+	memcpy(Request->Buffer, &RangeSet->Header, HeaderLength);
+	((DIO_PACKET_PORT_IO *)Request->Buffer)->RangeCount |= DIO_PORT_IO_FLAG_TIMESTAMP;
+
+	if (Write)
+		DiopCopyRangeSetData(Context, RangeSet, Request->Buffer + HeaderLength, Buffer, TRUE);
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		Write ? DIO_IOCTL_WRITE_PORT : DIO_IOCTL_READ_PORT, 
+		(PVOID)Request->Buffer, 
+		Write ? HeaderLength + DataLength : HeaderLength, 
+		(PVOID)Request->Buffer, 
+		ExpectedLength, 
+		&ReturnedLength);
+
+	if (Result && ReturnedLength != ExpectedLength)
+	{
+		DFTRACE("Length mismatched, assuming failed\n");
+		Result = FALSE;
+	}
+
+	if (Result)
+	{
+		// Timestamp is placed right after the returned data.
+		memcpy(&KernelTimestamp, Request->Buffer + ExpectedLength - sizeof(KernelTimestamp), sizeof(KernelTimestamp));
+
+		if (!Write)
+			DiopCopyRangeSetData(Context, RangeSet, Buffer, Request->Buffer + HeaderLength, FALSE);
+
+		if (TransferredDataLength)
+			*TransferredDataLength = DataLength;
+	}
+
+	DiopReleaseRequest(Context, Request);
+
+	if (!Result)
+		return FALSE;
+
+	if (Write && RangeSet->ReadCache)
+		DiopInvalidateReadCache(RangeSet);
+
+	AcquireSRWLockShared(&Context->ClockLock);
+
+	Calibrated = Context->ClockCalibrated && Context->KernelClockFrequency == KernelTimestamp.Frequency;
+
+	if (!Calibrated)
+	{
+		ReleaseSRWLockShared(&Context->ClockLock);
+		AcquireSRWLockExclusive(&Context->ClockLock);
+
+		// Recheck since other thread may have calibrated it.
+		Calibrated = Context->ClockCalibrated && Context->KernelClockFrequency == KernelTimestamp.Frequency;
+		if (!Calibrated)
+			Calibrated = DiopCalibrateClock(Context, DIOUM_CLOCK_DEFAULT_SAMPLES);
+
+		if (Calibrated)
+		{
+			Timestamp->StartTime = DiopConvertKernelTime(Context, KernelTimestamp.StartTime);
+			Timestamp->EndTime = DiopConvertKernelTime(Context, KernelTimestamp.EndTime);
+		}
+
+		ReleaseSRWLockExclusive(&Context->ClockLock);
+	}
+	else
+	{
+		Timestamp->StartTime = DiopConvertKernelTime(Context, KernelTimestamp.StartTime);
+		Timestamp->EndTime = DiopConvertKernelTime(Context, KernelTimestamp.EndTime);
+
+		ReleaseSRWLockShared(&Context->ClockLock);
+	}
+
+	if (!Calibrated)
+	{
+		DFTRACE("Failed to calibrate the clock, returning the kernel clock\n");
+		Timestamp->StartTime = KernelTimestamp.StartTime;
+		Timestamp->EndTime = KernelTimestamp.EndTime;
+	}
+
+	Timestamp->Converted = (BOOLEAN)Calibrated;
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DioCalibrateClock(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG SampleCount, 
+	OPTIONAL OUT LONGLONG *Offset, 
+	OPTIONAL OUT LONGLONG *Uncertainty)
+/**
+ *	@brief	Correlates the kernel clock with the application clock (QueryPerformanceCounter).
+ *	
+ *	Timestamped calls calibrate on first use. Calibrate again to follow the drift.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] SampleCount			Count of samples. Zero selects the default.
+ *	@param	[out, opt] Offset			Receives the application clock minus the kernel clock, in application ticks.
+ *	@param	[out, opt] Uncertainty		Receives the maximum error of the correlation, in application ticks.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	BOOL Result;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	AcquireSRWLockExclusive(&Context->ClockLock);
+
+	Result = DiopCalibrateClock(Context, SampleCount ? SampleCount : DIOUM_CLOCK_DEFAULT_SAMPLES);
+
+	if (Result)
+	{
+		if (Offset)
+			*Offset = DiopConvertKernelTime(Context, 0);
+
+		if (Uncertainty)
+			*Uncertainty = Context->ClockUncertainty;
+	}
+
+	ReleaseSRWLockExclusive(&Context->ClockLock);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioReadRangeSetEx(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OPTIONAL IN DIOUM_RANGE_SET *RangeSet, 
+	OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *ReturnedDataLength, 
+	OPTIONAL OUT DIOUM_IO_TIMESTAMP *Timestamp)
+/**
+ *	@brief	Reads the range set and returns when the ports were accessed.
+ *	
+ *	Same as DioReadRangeSet() if Timestamp is NULL.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in, opt] RangeSet			Range set. Registered ranges if NULL.
+ *	@param	[out] Buffer				Receives the data.
+ *	@param	[in] BufferLength			Length of Buffer in bytes.
+ *	@param	[out, opt] ReturnedDataLength	Receives the data length in bytes.
+ *	@param	[out, opt] Timestamp		Receives the timestamps in the application clock.\n
+ *										See DIOUM_IO_TIMESTAMP if the clock cannot be calibrated.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	BOOLEAN Registered = !RangeSet;
+	BOOL Result = FALSE;
+	ULONG Epoch = 0;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	if (Registered)
+		RangeSet = DiopReferenceRegisteredRangeSet(Context, &Epoch);
+
+	if (RangeSet)
+	{
+		if (Timestamp)
+			Result = DiopTimestampedRangeSetIo(Context, RangeSet, Buffer, BufferLength, ReturnedDataLength, Timestamp, FALSE);
+		else
+			Result = DiopReadRangeSet(Context, RangeSet, Buffer, BufferLength, ReturnedDataLength);
+	}
+
+	if (Registered)
+		DiopDereferenceRegisteredRangeSet(Context, Epoch);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioWriteRangeSetEx(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OPTIONAL IN DIOUM_RANGE_SET *RangeSet, 
+	IN PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *TransferredDataLength, 
+	OPTIONAL OUT DIOUM_IO_TIMESTAMP *Timestamp)
+/**
+ *	@brief	Writes the range set and returns when the ports were accessed.
+ *	
+ *	Same as DioWriteRangeSet() if Timestamp is NULL.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in, opt] RangeSet			Range set. Registered ranges if NULL.
+ *	@param	[in] Buffer					Data to write.
+ *	@param	[in] BufferLength			Length of Buffer in bytes.
+ *	@param	[out, opt] TransferredDataLength	Receives the data length in bytes.
+ *	@param	[out, opt] Timestamp		Receives the timestamps in the application clock.\n
+ *										See DIOUM_IO_TIMESTAMP if the clock cannot be calibrated.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	BOOLEAN Registered = !RangeSet;
+	BOOL Result = FALSE;
+	ULONG Epoch = 0;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	if (Registered)
+		RangeSet = DiopReferenceRegisteredRangeSet(Context, &Epoch);
+
+	if (RangeSet)
+	{
+		if (Timestamp)
+			Result = DiopTimestampedRangeSetIo(Context, RangeSet, Buffer, BufferLength, TransferredDataLength, Timestamp, TRUE);
+		else
+			Result = DiopWriteRangeSet(Context, RangeSet, Buffer, BufferLength, TransferredDataLength);
+	}
+
+	if (Registered)
+		DiopDereferenceRegisteredRangeSet(Context, Epoch);
+
+	return Result;
+}
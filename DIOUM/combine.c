@@ -0,0 +1,365 @@
+
+#include <Windows.h>
+#include "../Include/dioctl.h"
+#include "../Include/dioum.h"
+#include "dioum_internal.h"
+
+
+BOOLEAN
+APIENTRY
+DiopCombineIsOverlapping(
+	IN DIOUM_COMBINE_BATCH *Batch, 
+	IN DIOUM_RANGE_SET *RangeSet)
+/**
+ *	@brief	Checks whether the range set overlaps with the ranges in the batch.
+ *	
+ *	Overlap is always treated as a conflict, since the driver may reject it.
+ *	
+ *	@param	[in] Batch					Batch to check.
+ *	@param	[in] RangeSet				Range set to add.
+ *	@return								TRUE if overlapping.
+ *	
+ */
+{
+	DIOUM_COMBINE_ENTRY *Entry;
+	ULONG i, j;
+
+	for (Entry = Batch->First; Entry; Entry = Entry->Next)
+	{
+		DIO_PORT_RANGE *Ranges = Entry->RangeSet->Header.AddressRange;
+
+		if (!Entry->Unique)
+			continue;
+
+		for (i = 0; i < Entry->RangeSet->Header.RangeCount; i++)
+		{
+			for (j = 0; j < RangeSet->Header.RangeCount; j++)
+			{
+				if (DIO_IS_CONFLICTING_ADDRESSES(
+					Ranges[i].StartAddress, Ranges[i].EndAddress, 
+					RangeSet->Header.AddressRange[j].StartAddress, RangeSet->Header.AddressRange[j].EndAddress))
+					return TRUE;
+			}
+		}
+	}
+
+	return FALSE;
+}
+
+BOOLEAN
+APIENTRY
+DiopCombineJoin(
+	IN DIOUM_COMBINE_BATCH *Batch, 
+	IN DIOUM_COMBINE_ENTRY *Entry)
+/**
+ *	@brief	Adds the entry to the batch.
+ *	
+ *	Reads of the range set which is already in the batch share its data.\n
+ *	Caller must hold CombineLock if the batch is open.
+ *	
+ *	@param	[in] Batch					Batch to join.
+ *	@param	[in] Entry					Entry of the caller.
+ *	@return								FALSE if the entry does not fit in the batch.
+ *	
+ */
+{
+	DIOUM_RANGE_SET *RangeSet = Entry->RangeSet;
+	DIOUM_COMBINE_ENTRY *Other;
+
+	Entry->Unique = TRUE;
+
+	if (!Batch->Write)
+	{
+		for (Other = Batch->First; Other; Other = Other->Next)
+		{
+			if (Other->RangeSet == RangeSet)
+			{
+				Entry->Unique = FALSE;
+				Entry->DataOffset = Other->DataOffset;
+				break;
+			}
+		}
+	}
+
+	if (Entry->Unique)
+	{
+		if (Batch->RangeCount + RangeSet->Header.RangeCount > DIO_MAXIMUM_PORT_RANGES || 
+			Batch->DataLength + RangeSet->DataLength > 0x10000 || 
+			DiopCombineIsOverlapping(Batch, RangeSet))
+			return FALSE;
+
+		Entry->DataOffset = Batch->DataLength;
+		Batch->RangeCount += RangeSet->Header.RangeCount;
+		Batch->DataLength += RangeSet->DataLength;
+	}
+
+	*Batch->Tail = Entry;
+	Batch->Tail = &Entry->Next;
+	Batch->EntryCount++;
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DiopCombineExecute(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_COMBINE_BATCH *Batch)
+/**
+ *	@brief	Sends the closed batch as one IOCTL and fans out the read data.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] Batch					Batch which no longer accepts entries.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	ULONG HeaderLength = PACKET_PORT_IO_GET_LENGTH(Batch->RangeCount);
+	ULONG ExpectedLength = Batch->Write ? HeaderLength : HeaderLength + Batch->DataLength;
+	ULONG ReturnedLength = 0;
+	DIO_PACKET_PORT_IO *Packet;
+	DIOUM_COMBINE_ENTRY *Entry;
+	DIOUM_REQUEST *Request;
+	PUCHAR Data;
+	BOOL Result;
+
+	Request = DiopAcquireRequest(Context, HeaderLength + Batch->DataLength);
+	if (!Request)
+		return FALSE;
+
+	Packet = (DIO_PACKET_PORT_IO *)Request->Buffer;
+	Packet->RangeCount = 0;
+	Data = Request->Buffer + HeaderLength;
+
+	for (Entry = Batch->First; Entry; Entry = Entry->Next)
+	{
+		DIOUM_RANGE_SET *RangeSet = Entry->RangeSet;
+
+		if (!Entry->Unique)
+			continue;
+
+		memcpy(&Packet->AddressRange[Packet->RangeCount], RangeSet->Header.AddressRange, 
+			RangeSet->Header.RangeCount * sizeof(DIO_PORT_RANGE));
+		Packet->RangeCount += RangeSet->Header.RangeCount;
+
+		if (Batch->Write)
+			DiopCopyRangeSetData(Context, RangeSet, Data + Entry->DataOffset, Entry->Buffer, TRUE);
+	}
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		Batch->Write ? DIO_IOCTL_WRITE_PORT : DIO_IOCTL_READ_PORT, 
+		(PVOID)Request->Buffer, 
+		Batch->Write ? HeaderLength + Batch->DataLength : HeaderLength, 
+		(PVOID)Request->Buffer, 
+		ExpectedLength, 
+		&ReturnedLength);
+
+	if (Result && ReturnedLength != ExpectedLength)
+	{
+		DFTRACE("Length mismatched, assuming failed\n");
+		Result = FALSE;
+	}
+
+	if (Result && !Batch->Write)
+	{
+		for (Entry = Batch->First; Entry; Entry = Entry->Next)
+			DiopCopyRangeSetData(Context, Entry->RangeSet, Entry->Buffer, Data + Entry->DataOffset, FALSE);
+	}
+
+	DiopReleaseRequest(Context, Request);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DiopCombineRangeSetIo(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	IN OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *TransferredDataLength, 
+	IN BOOLEAN Write)
+/**
+ *	@brief	Reads or writes the range set through the combining batch.
+ *	
+ *	The first caller becomes the leader. It keeps the batch open for the current window, 
+ *	then sends all entries as one IOCTL while the followers wait for the completion.\n
+ *	The window is doubled (up to the maximum) while other callers are seen, and drops to zero
+ *	as soon as a leader runs alone, so a single caller does not wait.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] RangeSet				Range set to read or write.
+ *	@param	[in, out] Buffer			Data buffer.
+ *	@param	[in] BufferLength			Length of Buffer in bytes.
+ *	@param	[out, opt] TransferredDataLength	Receives the data length in bytes.
+ *	@param	[in] Write					Writes if TRUE, reads otherwise.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIOUM_COMBINE_BATCH **OpenBatch = &Context->OpenBatches[Write ? 1 : 0];
+	DIOUM_COMBINE_ENTRY Entry;
+	DIOUM_COMBINE_BATCH Batch;
+	DIOUM_COMBINE_ENTRY *Current;
+	ULONG Window;
+	BOOL Result;
+
+	if (RangeSet->DataLength > BufferLength)
+		return FALSE;
+
+	ZeroMemory(&Entry, sizeof(Entry));
+	Entry.RangeSet = RangeSet;
+	Entry.Buffer = Buffer;
+
+	AcquireSRWLockExclusive(&Context->CombineLock);
+
+	Context->CombineCallers++;
+
+	if (*OpenBatch)
+	{
+		if (DiopCombineJoin(*OpenBatch, &Entry))
+		{
+			while (!Entry.Done)
+				SleepConditionVariableSRW(&Context->CombineDone, &Context->CombineLock, INFINITE, 0);
+
+			Context->CombineCallers--;
+			ReleaseSRWLockExclusive(&Context->CombineLock);
+
+			if (Entry.Result && TransferredDataLength)
+				*TransferredDataLength = RangeSet->DataLength;
+
+			return Entry.Result;
+		}
+
+		// Does not fit, so the previous batch is closed and a new one is started.
+		InterlockedExchange(&(*OpenBatch)->Full, TRUE);
+		*OpenBatch = NULL;
+	}
+
+	ZeroMemory(&Batch, sizeof(Batch));
+	Batch.Tail = &Batch.First;
+	Batch.Write = Write;
+	DiopCombineJoin(&Batch, &Entry);
+
+	Window = Context->CombineWindow;
+	if (Window)
+		*OpenBatch = &Batch;
+
+	ReleaseSRWLockExclusive(&Context->CombineLock);
+
+	if (Window)
+	{
+		LARGE_INTEGER Now, Deadline;
+
+		QueryPerformanceCounter(&Deadline);
+		Deadline.QuadPart += Window * Context->PerformanceFrequency.QuadPart / 1000000;
+
+		do
+		{
+			SwitchToThread();
+			QueryPerformanceCounter(&Now);
+		} while (Now.QuadPart < Deadline.QuadPart && !InterlockedCompareExchange(&Batch.Full, FALSE, FALSE));
+
+		AcquireSRWLockExclusive(&Context->CombineLock);
+		if (*OpenBatch == &Batch)
+			*OpenBatch = NULL;
+		ReleaseSRWLockExclusive(&Context->CombineLock);
+	}
+
+	Result = DiopCombineExecute(Context, &Batch);
+
+	AcquireSRWLockExclusive(&Context->CombineLock);
+
+	// Followers return as soon as the lock is released, so entries must not be touched after this.
+	for (Current = Batch.First; Current; Current = Current->Next)
+	{
+		Current->Result = Result;
+		Current->Done = TRUE;
+	}
+
+	if (Batch.EntryCount > 1 || Context->CombineCallers > Batch.EntryCount)
+	{
+		Window = Context->CombineWindow ? Context->CombineWindow * 2 : DIOUM_COMBINE_INITIAL_WINDOW;
+		Context->CombineWindow = min(Window, Context->CombineMaximumWindow);
+	}
+	else
+	{
+		Context->CombineWindow = 0;
+	}
+
+	Context->CombineCallers--;
+
+	ReleaseSRWLockExclusive(&Context->CombineLock);
+
+	WakeAllConditionVariable(&Context->CombineDone);
+
+	if (Result && TransferredDataLength)
+		*TransferredDataLength = RangeSet->DataLength;
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioSetCombining(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG MaximumWindow)
+/**
+ *	@brief	Enables or disables the cross-thread request combining.
+ *	
+ *	Reads and writes of range sets which are issued within the window are sent as one IOCTL.
+ *	Reads of the same range set are read once.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] MaximumWindow			Maximum combining window in microseconds. Zero disables.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	AcquireSRWLockExclusive(&Context->CombineLock);
+
+	Context->CombineMaximumWindow = MaximumWindow;
+	Context->CombineWindow = min(Context->CombineWindow, MaximumWindow);
+
+	ReleaseSRWLockExclusive(&Context->CombineLock);
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DioGetCombining(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OPTIONAL OUT ULONG *MaximumWindow, 
+	OPTIONAL OUT ULONG *CurrentWindow)
+/**
+ *	@brief	Returns the combining window.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[out, opt] MaximumWindow	Receives the maximum window in microseconds.
+ *	@param	[out, opt] CurrentWindow	Receives the window which is adapted to the current load.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	AcquireSRWLockShared(&Context->CombineLock);
+
+	if (MaximumWindow)
+		*MaximumWindow = Context->CombineMaximumWindow;
+
+	if (CurrentWindow)
+		*CurrentWindow = Context->CombineWindow;
+
+	ReleaseSRWLockShared(&Context->CombineLock);
+
+	return TRUE;
+}
@@ -0,0 +1,1209 @@
+
+#include <Windows.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include "../Include/dioctl.h"
+#include "../Include/dioum.h"
+#include "dioum_internal.h"
+
+//
+// Linux transport.
+//
+// There is no driver on Linux, so the port IOCTLs are served in the process with the packets of
+// the driver, and DIOUM above the transport does not know the difference. Ports are accessed
+// in one of two ways:
+//
+//  - /dev/port, whose file offset is the port address. Runs of consecutive ports are merged
+//    into one preadv/pwritev, so a request costs a system call per run instead of per range.
+//  - inb/outb in the process, with no system call at all. The thread needs the I/O permission, 
+//    which ioperm() grants for the allowed ranges if the process has CAP_SYS_RAWIO.
+//    Permission is taken per thread on its first access, and /dev/port is used where it fails.
+//
+// Only the ports in DIOUM_PORT_RANGES of the environment may be accessed, e.g. "0x300-0x31f,0x378",
+// and they are reported as the claimed resources of the device. No port is accessible if it is
+// not set. It guards against wrong addresses, like the resources of the driver, but it is not a
+// security boundary, since the process which may open /dev/port may access every port anyway.
+//
+// DIO_CFGB_DISABLE_FAST_IO keeps every access on /dev/port. DIOUM_PORT_DEVICE in the environment
+// names a stand-in for /dev/port, e.g. a regular file of 64K bytes, which gets every access.
+//
+// IOCTLs of the engines of the driver (edge, stream, scheduler, reactor, ring, snapshot, worker)
+// and of the memory resources fail with ERROR_NOT_SUPPORTED.
+//
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <sys/io.h>
+#define DIOUM_PORT_INSTRUCTIONS
+#endif
+
+#define DIOUM_PORT_DEVICE_PATH			"/dev/port"
+#define DIOUM_PORT_DEVICE_VARIABLE		"DIOUM_PORT_DEVICE"
+#define DIOUM_PORT_RANGES_VARIABLE		"DIOUM_PORT_RANGES"
+
+// Vectors of one preadv/pwritev.
+#define DIOUM_PORT_MAXIMUM_VECTORS		64
+
+#define DIOUM_PORT_LIMIT				0x10000
+
+/**
+ *	@brief	Port device of the context.
+ *	
+ *	The run of consecutive ports which is not yet transferred is protected by Lock.
+ */
+typedef struct _DIOUM_PORT_DEVICE {
+	pthread_mutex_t Lock;			// Held across the request, like the port lock of the driver
+	int File;						// /dev/port or the stand-in
+	BOOLEAN StandIn;				// Port instructions are not used
+	BOOLEAN Failed;					// Transfer of the current request failed
+	BOOLEAN RunWrite;
+	DIO_CONFIGURATION_BLOCK Configuration;	// Per process, as there is no driver to share it
+	ULONG RunPort;					// First port of the run
+	ULONG RunLength;				// Total length of Vectors
+	ULONG VectorCount;
+	struct iovec Vectors[DIOUM_PORT_MAXIMUM_VECTORS];
+} DIOUM_PORT_DEVICE;
+
+// Ports of DIOUM_PORT_RANGES. Read once per process, as the threads take the I/O permission for them.
+static DIO_PORT_RANGE DiopAllowedPortRanges[DIO_MAXIMUM_PORT_RANGES];
+static ULONG DiopAllowedPortRangeCount;
+static BOOLEAN DiopAllowedPortRangesValid;
+static pthread_once_t DiopAllowedPortRangesOnce = PTHREAD_ONCE_INIT;
+
+// Allowed ranges are enabled for the port instructions in this thread.
+static __thread BOOLEAN DiopDirectPortsProbed;
+static __thread BOOLEAN DiopDirectPortsEnabled;
+
+
+VOID
+DiopParseAllowedPortRanges(
+	VOID)
+/**
+ *	@brief	Parses DIOUM_PORT_RANGES into the allowed ranges.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Ranges are separated by commas, and each is a port or the first and the last port joined by
+ *	a hyphen, in C notation. Ranges stay empty if the variable is not set.
+ *	
+ */
+{
+	PCSTR Text = getenv(DIOUM_PORT_RANGES_VARIABLE);
+	char *End;
+	unsigned long Start;
+	unsigned long Last;
+
+	if (!Text || !*Text)
+	{
+		DFTRACE("%s is not set, no port is accessible\n", DIOUM_PORT_RANGES_VARIABLE);
+		DiopAllowedPortRangesValid = TRUE;
+		return;
+	}
+
+	for (;;)
+	{
+		Start = strtoul(Text, &End, 0);
+		if (End == Text)
+			break;
+
+		Last = Start;
+
+		if (*End == '-')
+		{
+			Text = End + 1;
+			Last = strtoul(Text, &End, 0);
+			if (End == Text)
+				break;
+		}
+
+		if (Start > Last || Last >= DIOUM_PORT_LIMIT || DiopAllowedPortRangeCount == DIO_MAXIMUM_PORT_RANGES)
+			break;
+
+		DiopAllowedPortRanges[DiopAllowedPortRangeCount].StartAddress = (USHORT)Start;
+		DiopAllowedPortRanges[DiopAllowedPortRangeCount].EndAddress = (USHORT)Last;
+		DiopAllowedPortRangeCount++;
+
+		if (!*End)
+		{
+			DiopAllowedPortRangesValid = TRUE;
+			return;
+		}
+
+		if (*End != ',')
+			break;
+
+		Text = End + 1;
+	}
+
+	DFTRACE("Malformed %s at \"%s\"\n", DIOUM_PORT_RANGES_VARIABLE, Text);
+	DiopAllowedPortRangeCount = 0;
+}
+
+BOOLEAN
+APIENTRY
+DiopIsPortRangeAllowed(
+	IN ULONG StartAddress, 
+	IN ULONG EndAddress)
+/**
+ *	@brief	Tests if the ports are in one of the allowed ranges, as the driver tests its resources.
+ *	
+ *	This function is reserved for internal use. Last error is ERROR_ACCESS_DENIED if not.
+ *	
+ *	@param	[in] StartAddress			First port.
+ *	@param	[in] EndAddress				Last port.
+ *	@return								Non-zero if the ports may be accessed.
+ *	
+ */
+{
+	ULONG i;
+
+	for (i = 0; i < DiopAllowedPortRangeCount; i++)
+	{
+		if (DiopAllowedPortRanges[i].StartAddress <= StartAddress && 
+			EndAddress <= DiopAllowedPortRanges[i].EndAddress)
+			return TRUE;
+	}
+
+	DFTRACE("Inaccessible address range 0x%04x - 0x%04x\n", StartAddress, EndAddress);
+	SetLastError(ERROR_ACCESS_DENIED);
+
+	return FALSE;
+}
+
+BOOLEAN
+APIENTRY
+DiopEnableDirectPorts(
+	VOID)
+/**
+ *	@brief	Takes the I/O permission of this thread for the allowed ranges.
+ *	
+ *	This function is reserved for internal use.\n
+ *	ioperm() is tried once per thread, and the failure is remembered. Other ports stay
+ *	inaccessible to the port instructions.
+ *	
+ *	@return								Non-zero if the allowed ranges may be accessed.
+ *	
+ */
+{
+#ifdef DIOUM_PORT_INSTRUCTIONS
+	ULONG i;
+
+	if (DiopDirectPortsProbed)
+		return DiopDirectPortsEnabled;
+
+	DiopDirectPortsProbed = TRUE;
+	DiopDirectPortsEnabled = TRUE;
+
+	for (i = 0; i < DiopAllowedPortRangeCount; i++)
+	{
+		DIO_PORT_RANGE *Range = DiopAllowedPortRanges + i;
+
+		if (ioperm(Range->StartAddress, Range->EndAddress - Range->StartAddress + 1, 1))
+		{
+			DFTRACE("ioperm of 0x%04x - 0x%04x failed (%d), using %s\n", 
+				Range->StartAddress, Range->EndAddress, errno, DIOUM_PORT_DEVICE_PATH);
+			DiopDirectPortsEnabled = FALSE;
+			break;
+		}
+	}
+
+	return DiopDirectPortsEnabled;
+#else
+	return FALSE;
+#endif
+}
+
+VOID
+APIENTRY
+DiopFlushPortRun(
+	IN DIOUM_PORT_DEVICE *Device)
+/**
+ *	@brief	Transfers the pending run with one preadv/pwritev.
+ *	
+ *	This function is reserved for internal use. Caller holds the lock of the device.
+ *	
+ *	@param	[in] Device					Port device.
+ *	
+ */
+{
+	ssize_t Length;
+
+	if (!Device->VectorCount)
+		return;
+
+	do
+	{
+		if (Device->RunWrite)
+			Length = pwritev(Device->File, Device->Vectors, (int)Device->VectorCount, (off_t)Device->RunPort);
+		else
+			Length = preadv(Device->File, Device->Vectors, (int)Device->VectorCount, (off_t)Device->RunPort);
+	} while (Length < 0 && errno == EINTR);
+
+	// Port device transfers the whole run. Short transfer is the end of a stand-in which is too small.
+	if (Length != (ssize_t)Device->RunLength)
+	{
+		DFTRACE("%s of ports 0x%x - 0x%x failed (%d)\n", Device->RunWrite ? "Write" : "Read", 
+			Device->RunPort, Device->RunPort + Device->RunLength - 1, Length < 0 ? errno : 0);
+		Device->Failed = TRUE;
+	}
+
+	Device->VectorCount = 0;
+	Device->RunLength = 0;
+}
+
+VOID
+APIENTRY
+DiopQueuePortRun(
+	IN DIOUM_PORT_DEVICE *Device, 
+	IN ULONG Port, 
+	IN OUT PUCHAR Buffer, 
+	IN ULONG Length, 
+	IN BOOLEAN Write)
+/**
+ *	@brief	Adds the consecutive ports to the pending run, flushing the run if they do not follow it.
+ *	
+ *	This function is reserved for internal use. Caller holds the lock of the device.
+ *	
+ *	@param	[in] Device					Port device.
+ *	@param	[in] Port					First port.
+ *	@param	[in, out] Buffer			Data of the ports.
+ *	@param	[in] Length					Count of the ports.
+ *	@param	[in] Write					Port input if FALSE, port output otherwise.
+ *	
+ */
+{
+	struct iovec *Last;
+
+	if (Device->VectorCount && 
+		(Device->RunWrite != Write || 
+		Device->RunPort + Device->RunLength != Port || 
+		Device->VectorCount == DIOUM_PORT_MAXIMUM_VECTORS))
+		DiopFlushPortRun(Device);
+
+	if (!Device->VectorCount)
+	{
+		Device->RunPort = Port;
+		Device->RunWrite = Write;
+	}
+
+	Last = Device->VectorCount ? Device->Vectors + Device->VectorCount - 1 : NULL;
+
+	// Data which follows the last vector in the buffer extends it.
+	if (Last && (PUCHAR)Last->iov_base + Last->iov_len == Buffer)
+		Last->iov_len += Length;
+	else
+	{
+		Device->Vectors[Device->VectorCount].iov_base = Buffer;
+		Device->Vectors[Device->VectorCount].iov_len = Length;
+		Device->VectorCount++;
+	}
+
+	Device->RunLength += Length;
+}
+
+VOID
+APIENTRY
+DiopTransferPorts(
+	IN DIOUM_PORT_DEVICE *Device, 
+	IN ULONG Port, 
+	IN OUT PUCHAR Buffer, 
+	IN ULONG Length, 
+	IN BOOLEAN Fifo, 
+	IN BOOLEAN Write)
+/**
+ *	@brief	Transfers the consecutive ports, or one port if Fifo.
+ *	
+ *	This function is reserved for internal use. Caller holds the lock of the device and has
+ *	validated the ports against the allowed ranges.\n
+ *	Port instructions run at once. Otherwise the ports are queued, so caller flushes the run
+ *	before it reads the data or stamps the time.
+ *	
+ *	@param	[in] Device					Port device.
+ *	@param	[in] Port					First port, or the only port if Fifo.
+ *	@param	[in, out] Buffer			Data.
+ *	@param	[in] Length					Length in bytes.
+ *	@param	[in] Fifo					Every byte goes to the same port.
+ *	@param	[in] Write					Port input if FALSE, port output otherwise.
+ *	
+ */
+{
+	ULONG i;
+
+	if (!Length)
+		return;
+
+#ifdef DIOUM_PORT_INSTRUCTIONS
+	if (!Device->StandIn && !(Device->Configuration.ConfigurationBits & DIO_CFGB_DISABLE_FAST_IO) && 
+		DiopEnableDirectPorts())
+	{
+		// Keep the order with the ports which are queued before.
+		DiopFlushPortRun(Device);
+
+		if (Fifo && Write)
+			outsb((USHORT)Port, Buffer, Length);
+		else if (Fifo)
+			insb((USHORT)Port, Buffer, Length);
+		else if (Write)
+		{
+			for (i = 0; i < Length; i++)
+				outb(Buffer[i], (USHORT)(Port + i));
+		}
+		else
+		{
+			for (i = 0; i < Length; i++)
+				Buffer[i] = inb((USHORT)(Port + i));
+		}
+
+		return;
+	}
+#endif
+
+	// Port of the device moves with the offset, so a FIFO is a run per byte.
+	if (Fifo)
+	{
+		for (i = 0; i < Length; i++)
+			DiopQueuePortRun(Device, Port, Buffer + i, 1, Write);
+	}
+	else
+		DiopQueuePortRun(Device, Port, Buffer, Length, Write);
+}
+
+VOID
+APIENTRY
+DiopBeginPortRequest(
+	IN DIOUM_PORT_DEVICE *Device, 
+	OPTIONAL OUT LONGLONG *StartTime)
+/**
+ *	@brief	Takes the lock of the device for a request.
+ *	
+ *	This function is reserved for internal use.
+ *	
+ *	@param	[in] Device					Port device.
+ *	@param	[out, opt] StartTime		Receives the counter before the first port access.
+ *	
+ */
+{
+	LARGE_INTEGER Counter;
+
+	pthread_mutex_lock(&Device->Lock);
+	Device->Failed = FALSE;
+
+	if (StartTime)
+	{
+		QueryPerformanceCounter(&Counter);
+		*StartTime = Counter.QuadPart;
+	}
+}
+
+BOOL
+APIENTRY
+DiopEndPortRequest(
+	IN DIOUM_PORT_DEVICE *Device, 
+	OPTIONAL OUT DIO_PORT_IO_TIMESTAMP *Timestamp)
+/**
+ *	@brief	Flushes the pending run and releases the lock of the device.
+ *	
+ *	This function is reserved for internal use.
+ *	
+ *	@param	[in] Device					Port device.
+ *	@param	[in, out, opt] Timestamp	StartTime is set by DiopBeginPortRequest(). Receives the rest.
+ *	@return								Non-zero if every transfer of the request succeeded.
+ *	
+ */
+{
+	LARGE_INTEGER Counter;
+	LARGE_INTEGER Frequency;
+	BOOL Result;
+
+	DiopFlushPortRun(Device);
+
+	if (Timestamp)
+	{
+		QueryPerformanceCounter(&Counter);
+		QueryPerformanceFrequency(&Frequency);
+		Timestamp->EndTime = Counter.QuadPart;
+		Timestamp->Frequency = Frequency.QuadPart;
+	}
+
+	Result = !Device->Failed;
+
+	pthread_mutex_unlock(&Device->Lock);
+
+	if (!Result)
+		SetLastError(EIO);
+
+	return Result;
+}
+
+BOOLEAN
+APIENTRY
+DiopArePortRangesOverlapping(
+	IN DIO_PORT_RANGE *AddressRanges, 
+	IN ULONG AddressRangeCount)
+/**
+ *	@brief	Same test as the driver, which rejects the overlapping ranges unless
+ *			DIO_CFGB_ALLOW_PORT_RANGE_OVERLAP is set.
+ *	
+ *	This function is reserved for internal use.
+ *	
+ */
+{
+	ULONG i, j;
+
+	for (i = 0; i < AddressRangeCount; i++)
+	{
+		DIO_PORT_RANGE Range1 = AddressRanges[i];
+
+		for (j = i + 1; j < AddressRangeCount; j++)
+		{
+			DIO_PORT_RANGE Range2 = AddressRanges[j];
+
+			if (DIO_IS_CONFLICTING_ADDRESSES(Range1.StartAddress, Range1.EndAddress, 
+				Range2.StartAddress, Range2.EndAddress) || 
+				DIO_IS_CONFLICTING_ADDRESSES(Range2.StartAddress, Range2.EndAddress, 
+				Range1.StartAddress, Range1.EndAddress))
+				return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+BOOL
+APIENTRY
+DiopMeasurePortRanges(
+	IN DIOUM_PORT_DEVICE *Device, 
+	IN DIO_PORT_RANGE *AddressRanges, 
+	IN ULONG AddressRangeCount, 
+	OUT ULONG *DataLength)
+/**
+ *	@brief	Validates the ranges and calculates the data length.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Each range must be in one of the allowed ranges.
+ *	
+ *	@param	[in] Device					Port device.
+ *	@param	[in] AddressRanges			Port ranges.
+ *	@param	[in] AddressRangeCount		Count of AddressRanges.
+ *	@param	[out] DataLength			Receives the data length in bytes.
+ *	@return								Non-zero if the ranges are valid.
+ *	
+ */
+{
+	ULONG Length = 0;
+	ULONG i;
+
+	for (i = 0; i < AddressRangeCount; i++)
+	{
+		if (AddressRanges[i].StartAddress > AddressRanges[i].EndAddress)
+			return FALSE;
+
+		if (!DiopIsPortRangeAllowed(AddressRanges[i].StartAddress, AddressRanges[i].EndAddress))
+			return FALSE;
+
+		Length += AddressRanges[i].EndAddress - AddressRanges[i].StartAddress + 1;
+	}
+
+	if (!(Device->Configuration.ConfigurationBits & DIO_CFGB_ALLOW_PORT_RANGE_OVERLAP) && 
+		DiopArePortRangesOverlapping(AddressRanges, AddressRangeCount))
+	{
+		DFTRACE("Range overlapping detected\n");
+		return FALSE;
+	}
+
+	*DataLength = Length;
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DiopDevicePortIo(
+	IN DIOUM_PORT_DEVICE *Device, 
+	IN BOOLEAN Write, 
+	IN PUCHAR InputBuffer, 
+	IN ULONG InputBufferLength, 
+	OUT PUCHAR OutputBuffer, 
+	IN ULONG OutputBufferLength, 
+	OUT ULONG *ReturnedLength)
+/**
+ *	@brief	Serves DIO_IOCTL_READ_PORT and DIO_IOCTL_WRITE_PORT.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Buffers may be the same, as the system buffer of the driver is.
+ *	DIO_PORT_IO_FLAG_GROUP is not supported, since the interrupts cannot be disabled here.
+ *	
+ */
+{
+	DIO_PORT_RANGE Ranges[DIO_MAXIMUM_PORT_RANGES];
+	DIO_PORT_IO_TIMESTAMP Timestamp;
+	DIO_PACKET_PORT_IO Header;
+	ULONG RangeCount;
+	ULONG HeaderLength;
+	ULONG DataLength = 0;
+	ULONG RequiredLength;
+	PUCHAR Data;
+	ULONG i;
+	BOOL Result;
+
+	if (InputBufferLength < sizeof(Header))
+		return FALSE;
+
+	memcpy(&Header, InputBuffer, sizeof(Header));
+
+	if (Header.RangeCount & ~(DIO_PORT_IO_RANGE_COUNT_MASK | DIO_PORT_IO_VALID_FLAGS))
+		return FALSE;
+
+	if (Header.RangeCount & DIO_PORT_IO_FLAG_GROUP)
+	{
+		SetLastError(ERROR_NOT_SUPPORTED);
+		return FALSE;
+	}
+
+	RangeCount = PACKET_PORT_IO_GET_RANGE_COUNT(&Header);
+	HeaderLength = PACKET_PORT_IO_GET_LENGTH(RangeCount);
+
+	if (RangeCount > DIO_MAXIMUM_PORT_RANGES || InputBufferLength < HeaderLength)
+		return FALSE;
+
+	memcpy(Ranges, InputBuffer + sizeof(Header), RangeCount * sizeof(DIO_PORT_RANGE));
+
+	if (!DiopMeasurePortRanges(Device, Ranges, RangeCount, &DataLength) || DataLength > 0x10000)
+		return FALSE;
+
+	// Same layout as the driver. See DiopValidatePacketBuffer().
+	RequiredLength = HeaderLength + (Write ? 0 : DataLength);
+
+	if (Header.RangeCount & DIO_PORT_IO_FLAG_TIMESTAMP)
+		RequiredLength += sizeof(Timestamp);
+
+	if (OutputBufferLength < RequiredLength || (Write && InputBufferLength < HeaderLength + DataLength))
+		return FALSE;
+
+	memmove(OutputBuffer, InputBuffer, HeaderLength);
+	Data = Write ? InputBuffer + HeaderLength : OutputBuffer + HeaderLength;
+
+	DiopBeginPortRequest(Device, &Timestamp.StartTime);
+
+	for (i = 0; i < RangeCount; i++)
+	{
+		ULONG Length = Ranges[i].EndAddress - Ranges[i].StartAddress + 1;
+
+		DiopTransferPorts(Device, Ranges[i].StartAddress, Data, Length, FALSE, Write);
+		Data += Length;
+	}
+
+	Result = DiopEndPortRequest(Device, &Timestamp);
+	if (!Result)
+		return FALSE;
+
+	*ReturnedLength = HeaderLength + (Write ? 0 : DataLength);
+
+	if (Header.RangeCount & DIO_PORT_IO_FLAG_TIMESTAMP)
+	{
+		memcpy(OutputBuffer + *ReturnedLength, &Timestamp, sizeof(Timestamp));
+		*ReturnedLength += sizeof(Timestamp);
+	}
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DiopDevicePortIoV2(
+	IN DIOUM_PORT_DEVICE *Device, 
+	IN BOOLEAN Write, 
+	IN DIO_PACKET_PORT_IO_V2 *PortIo, 
+	IN ULONG InputBufferLength, 
+	IN OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OUT ULONG *ReturnedLength)
+/**
+ *	@brief	Serves DIO_IOCTL_READ_PORT_V2 and DIO_IOCTL_WRITE_PORT_V2 for the port space.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Elements are transferred as DiopTransferPortDescriptors() of the driver does.
+ *	
+ */
+{
+	DIO_PORT_IO_TIMESTAMP Timestamp;
+	ULONGLONG DataLength = 0;
+	BOOLEAN Timed;
+	ULONG i, j, k;
+
+	if (InputBufferLength < sizeof(*PortIo) || PortIo->Version != DIO_PORT_IO_VERSION2 || 
+		(PortIo->Flags & ~DIO_PORT_IO_V2_VALID_FLAGS))
+		return FALSE;
+
+	if (PortIo->Flags & DIO_PORT_IO_V2_FLAG_MEMORY_SPACE)
+	{
+		SetLastError(ERROR_NOT_SUPPORTED);
+		return FALSE;
+	}
+
+	if (!PortIo->DescriptorCount || PortIo->DescriptorCount > DIO_PORT_IO_V2_MAXIMUM_DESCRIPTORS || 
+		InputBufferLength < PACKET_PORT_IO_V2_GET_LENGTH(PortIo->DescriptorCount))
+		return FALSE;
+
+	for (i = 0; i < PortIo->DescriptorCount; i++)
+	{
+		DIO_PORT_DESCRIPTOR *Descriptor = PortIo->Descriptors + i;
+
+		if (!Descriptor->Count || !Descriptor->Width || !Descriptor->Repeat)
+			return FALSE;
+
+		if ((ULONGLONG)Descriptor->StartAddress +
+			(ULONGLONG)(Descriptor->Count - 1) * Descriptor->Stride + Descriptor->Width - 1 > 0xffff)
+			return FALSE;
+
+		// Whole span of the elements, including the ports which the stride skips.
+		if (!DiopIsPortRangeAllowed(Descriptor->StartAddress, 
+			Descriptor->StartAddress + (Descriptor->Count - 1) * Descriptor->Stride + Descriptor->Width - 1))
+			return FALSE;
+
+		DataLength += (ULONGLONG)Descriptor->Count * Descriptor->Width * Descriptor->Repeat;
+
+		if (DataLength > DIO_PORT_IO_V2_MAXIMUM_DATA_LENGTH)
+			return FALSE;
+	}
+
+	Timed = (BOOLEAN)((PortIo->Flags & DIO_PORT_IO_V2_FLAG_TIMESTAMP) != 0);
+
+	if (BufferLength < DataLength + (Timed ? sizeof(Timestamp) : 0))
+		return FALSE;
+
+	DiopBeginPortRequest(Device, &Timestamp.StartTime);
+
+	for (i = 0; i < PortIo->DescriptorCount; i++)
+	{
+		DIO_PORT_DESCRIPTOR Descriptor = PortIo->Descriptors[i];
+		ULONG ElementsLength = (ULONG)Descriptor.Count * Descriptor.Width;
+
+		for (j = 0; j < Descriptor.Repeat; j++)
+		{
+			if (!Descriptor.Stride && Descriptor.Width == 1)
+				DiopTransferPorts(Device, Descriptor.StartAddress, Buffer, ElementsLength, TRUE, Write);
+			else if (Descriptor.Stride == Descriptor.Width)
+				DiopTransferPorts(Device, Descriptor.StartAddress, Buffer, ElementsLength, FALSE, Write);
+			else
+			{
+				for (k = 0; k < Descriptor.Count; k++)
+				{
+					DiopTransferPorts(Device, Descriptor.StartAddress + k * Descriptor.Stride, 
+						Buffer + k * Descriptor.Width, Descriptor.Width, FALSE, Write);
+				}
+			}
+
+			Buffer += ElementsLength;
+		}
+	}
+
+	if (!DiopEndPortRequest(Device, &Timestamp))
+		return FALSE;
+
+	*ReturnedLength = (ULONG)DataLength;
+
+	if (Timed)
+	{
+		memcpy(Buffer, &Timestamp, sizeof(Timestamp));
+		*ReturnedLength += sizeof(Timestamp);
+	}
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DiopDeviceReadBurst(
+	IN DIOUM_PORT_DEVICE *Device, 
+	IN DIO_PACKET_READ_BURST *ReadBurst, 
+	IN ULONG InputBufferLength, 
+	OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OUT ULONG *ReturnedLength)
+/**
+ *	@brief	Serves DIO_IOCTL_READ_BURST.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Each frame is flushed before its timestamp, so the stamp follows the last port of the frame.
+ *	
+ */
+{
+	ULONGLONG RequiredLength;
+	ULONG FrameLength = 0;
+	ULONG DataLength;
+	BOOLEAN Planar;
+	ULONG Frame;
+	ULONG Offset;
+	ULONG i;
+
+	if (InputBufferLength < sizeof(*ReadBurst) || (ReadBurst->Flags & ~DIO_BURST_VALID_FLAGS) || 
+		!ReadBurst->FrameCount || ReadBurst->FrameCount > DIO_BURST_MAXIMUM_FRAMES)
+		return FALSE;
+
+	if (!ReadBurst->RangeCount || ReadBurst->RangeCount > DIO_MAXIMUM_PORT_RANGES || 
+		InputBufferLength < PACKET_READ_BURST_GET_LENGTH(ReadBurst->RangeCount))
+		return FALSE;
+
+	if (!DiopMeasurePortRanges(Device, ReadBurst->AddressRange, ReadBurst->RangeCount, &FrameLength))
+		return FALSE;
+
+	RequiredLength = (ULONGLONG)FrameLength * ReadBurst->FrameCount;
+	if (RequiredLength > DIO_BURST_MAXIMUM_DATA_LENGTH)
+		return FALSE;
+
+	DataLength = (ULONG)RequiredLength;
+
+	if (ReadBurst->Flags & DIO_BURST_FLAG_TIMESTAMPS)
+		RequiredLength += (ULONGLONG)ReadBurst->FrameCount * sizeof(LONGLONG);
+
+	if (BufferLength < RequiredLength)
+		return FALSE;
+
+	Planar = (BOOLEAN)((ReadBurst->Flags & DIO_BURST_FLAG_PLANAR) != 0);
+
+	DiopBeginPortRequest(Device, NULL);
+
+	for (Frame = 0; Frame < ReadBurst->FrameCount && !Device->Failed; Frame++)
+	{
+		for (i = 0, Offset = 0; i < ReadBurst->RangeCount; i++)
+		{
+			DIO_PORT_RANGE *Range = ReadBurst->AddressRange + i;
+			ULONG Length = Range->EndAddress - Range->StartAddress + 1;
+			PUCHAR Destination = Planar ?
+				Buffer + Offset * ReadBurst->FrameCount + Frame * Length :
+				Buffer + Frame * FrameLength + Offset;
+
+			DiopTransferPorts(Device, Range->StartAddress, Destination, Length, FALSE, FALSE);
+			Offset += Length;
+		}
+
+		if (ReadBurst->Flags & DIO_BURST_FLAG_TIMESTAMPS)
+		{
+			LARGE_INTEGER Now;
+
+			DiopFlushPortRun(Device);
+			QueryPerformanceCounter(&Now);
+			memcpy(Buffer + DataLength + Frame * sizeof(LONGLONG), &Now.QuadPart, sizeof(LONGLONG));
+		}
+	}
+
+	if (!DiopEndPortRequest(Device, NULL))
+		return FALSE;
+
+	*ReturnedLength = (ULONG)RequiredLength;
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DiopDeviceWaitPattern(
+	IN DIOUM_PORT_DEVICE *Device, 
+	IN PUCHAR InputBuffer, 
+	IN ULONG InputBufferLength, 
+	OUT PUCHAR OutputBuffer, 
+	IN ULONG OutputBufferLength, 
+	OUT ULONG *ReturnedLength)
+/**
+ *	@brief	Serves DIO_IOCTL_WAIT_PATTERN like DioWaitPattern() of the driver.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Lock is held for each probe only, and the thread sleeps for the poll interval.
+ *	
+ */
+{
+	DIO_PACKET_WAIT_PATTERN Wait;
+	LARGE_INTEGER StartTime;
+	LARGE_INTEGER CurrentTime;
+	LARGE_INTEGER Frequency;
+	LONGLONG SpinTicks;
+	ULONG SpinTime;
+	ULONG PollInterval;
+	ULONG ReadLength = 0;
+	ULONG Iterations = 0;
+	BOOLEAN Read;
+	BOOLEAN Matched = FALSE;
+	UCHAR Input = 0;
+
+	if (InputBufferLength < sizeof(Wait))
+		return FALSE;
+
+	memcpy(&Wait, InputBuffer, sizeof(Wait));
+
+	Read = (BOOLEAN)((Wait.Flags & DIO_WAIT_PATTERN_FLAG_READ) != 0);
+
+	if (Read && Wait.ReadRange.StartAddress > Wait.ReadRange.EndAddress)
+		return FALSE;
+
+	if (!DiopIsPortRangeAllowed(Wait.Port, Wait.Port) || 
+		(Read && !DiopIsPortRangeAllowed(Wait.ReadRange.StartAddress, Wait.ReadRange.EndAddress)))
+		return FALSE;
+
+	if (OutputBufferLength < PACKET_WAIT_PATTERN_GET_LENGTH(&Wait))
+		return FALSE;
+
+	if (Read)
+		ReadLength = Wait.ReadRange.EndAddress - Wait.ReadRange.StartAddress + 1;
+
+	SpinTime = min(Wait.MaximumSpinTime, DIO_WAIT_PATTERN_MAXIMUM_SPIN_TIME);
+	PollInterval = min(Wait.PollInterval, SpinTime);
+
+	QueryPerformanceFrequency(&Frequency);
+	QueryPerformanceCounter(&StartTime);
+	SpinTicks = (LONGLONG)SpinTime * Frequency.QuadPart / 1000000;
+
+	for (;;)
+	{
+		DiopBeginPortRequest(Device, NULL);
+
+		DiopTransferPorts(Device, Wait.Port, &Input, 1, FALSE, FALSE);
+		DiopFlushPortRun(Device);
+
+		Iterations++;
+		Matched = (BOOLEAN)(!Device->Failed && (Input & Wait.Mask) == (Wait.Value & Wait.Mask));
+
+		// Read in the same hold of the lock, so that nobody touches the ports between the match and the read.
+		if (Matched && Read)
+		{
+			DiopTransferPorts(Device, Wait.ReadRange.StartAddress, 
+				OutputBuffer + sizeof(Wait), ReadLength, FALSE, FALSE);
+		}
+
+		if (!DiopEndPortRequest(Device, NULL))
+			return FALSE;
+
+		QueryPerformanceCounter(&CurrentTime);
+
+		if (Matched || CurrentTime.QuadPart - StartTime.QuadPart >= SpinTicks)
+			break;
+
+		if (PollInterval)
+			usleep(PollInterval);
+		else
+			YieldProcessor();
+	}
+
+	Wait.Matched = Matched;
+	Wait.ObservedValue = Input;
+	Wait.ElapsedTime = (ULONG)((CurrentTime.QuadPart - StartTime.QuadPart) * 1000000 / Frequency.QuadPart);
+	Wait.Iterations = Iterations;
+
+	memcpy(OutputBuffer, &Wait, sizeof(Wait));
+	*ReturnedLength = PACKET_WAIT_PATTERN_GET_LENGTH(&Wait);
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DiopPortDeviceIoControl(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_REQUEST *Request, 
+	IN ULONG IoControlCode, 
+	IN PVOID InputBuffer, 
+	IN ULONG InputBufferLength, 
+	OUT PVOID OutputBuffer, 
+	IN ULONG OutputBufferLength, 
+	OUT ULONG *ReturnedLength)
+/**
+ *	@brief	Serves the IOCTL in the process, with the packets of the driver.
+ *	
+ *	This function is reserved for internal use.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] Request				Request. Not used.
+ *	@param	[in] IoControlCode			IOCTL code.
+ *	@param	[in] InputBuffer			Input buffer.
+ *	@param	[in] InputBufferLength		Input buffer length in bytes.
+ *	@param	[out] OutputBuffer			Output buffer.
+ *	@param	[in] OutputBufferLength		Output buffer length in bytes.
+ *	@param	[out] ReturnedLength		Receives the returned length in bytes.
+ *	@return								Non-zero if successful. Last error is ERROR_NOT_SUPPORTED
+ *										for the IOCTLs which need the driver.
+ *	
+ */
+{
+	DIOUM_PORT_DEVICE *Device = (DIOUM_PORT_DEVICE *)Context->TransportContext;
+	PUCHAR Input = (PUCHAR)InputBuffer;
+	PUCHAR Output = (PUCHAR)OutputBuffer;
+	BOOL Result = FALSE;
+
+	UNREFERENCED_PARAMETER(Request);
+
+	*ReturnedLength = 0;
+	SetLastError(ERROR_INVALID_PARAMETER);
+
+	switch (IoControlCode)
+	{
+	case DIO_IOCTL_READ_CONFIGURATION:
+	case DIO_IOCTL_WRITE_CONFIGURATION:
+		{
+			DIO_PACKET_READ_WRITE_CONFIGURATION Packet;
+			BOOLEAN Write = (BOOLEAN)(IoControlCode == DIO_IOCTL_WRITE_CONFIGURATION);
+
+			if (InputBufferLength < (Write ? sizeof(Packet) : sizeof(Packet.Version)) || 
+				OutputBufferLength < sizeof(Packet))
+				break;
+
+			memcpy(&Packet, Input, Write ? sizeof(Packet) : sizeof(Packet.Version));
+
+			if (Packet.Version != DIO_DRIVER_CONFIGURATION_VERSION1)
+				break;
+
+			pthread_mutex_lock(&Device->Lock);
+
+			if (Write)
+				Device->Configuration = Packet.ConfigurationBlock;
+			else
+				Packet.ConfigurationBlock = Device->Configuration;
+
+			pthread_mutex_unlock(&Device->Lock);
+
+			memcpy(Output, &Packet, sizeof(Packet));
+			*ReturnedLength = sizeof(Packet);
+			Result = TRUE;
+		}
+		break;
+
+	case DIO_IOCTL_READ_PORT:
+	case DIO_IOCTL_WRITE_PORT:
+		Result = DiopDevicePortIo(Device, (BOOLEAN)(IoControlCode == DIO_IOCTL_WRITE_PORT), 
+			Input, InputBufferLength, Output, OutputBufferLength, ReturnedLength);
+		break;
+
+	case DIO_IOCTL_READ_PORT_V2:
+	case DIO_IOCTL_WRITE_PORT_V2:
+		Result = DiopDevicePortIoV2(Device, (BOOLEAN)(IoControlCode == DIO_IOCTL_WRITE_PORT_V2), 
+			(DIO_PACKET_PORT_IO_V2 *)Input, InputBufferLength, Output, OutputBufferLength, ReturnedLength);
+		break;
+
+	case DIO_IOCTL_READ_BURST:
+		Result = DiopDeviceReadBurst(Device, (DIO_PACKET_READ_BURST *)Input, InputBufferLength, 
+			Output, OutputBufferLength, ReturnedLength);
+		break;
+
+	case DIO_IOCTL_QUERY_RESOURCES:
+		// Allowed ranges are the claimed resources. Copied as many as fit, as the driver does.
+		{
+			DIO_PACKET_QUERY_RESOURCES Packet;
+			ULONG CopyCount;
+
+			if (OutputBufferLength < sizeof(Packet))
+				break;
+
+			CopyCount = min(DiopAllowedPortRangeCount, 
+				(OutputBufferLength - sizeof(Packet)) / sizeof(DIO_PORT_RANGE));
+
+			Packet.RangeCount = DiopAllowedPortRangeCount;
+			memcpy(Output, &Packet, sizeof(Packet));
+			memcpy(Output + sizeof(Packet), DiopAllowedPortRanges, CopyCount * sizeof(DIO_PORT_RANGE));
+
+			*ReturnedLength = sizeof(Packet) + CopyCount * sizeof(DIO_PORT_RANGE);
+			Result = TRUE;
+		}
+		break;
+
+	case DIO_IOCTL_QUERY_MEMORY_RESOURCES:
+		// No memory resources.
+		if (OutputBufferLength < sizeof(ULONG))
+			break;
+
+		memset(Output, 0, sizeof(ULONG));
+		*ReturnedLength = sizeof(ULONG);
+		Result = TRUE;
+		break;
+
+	case DIO_IOCTL_WAIT_PATTERN:
+		Result = DiopDeviceWaitPattern(Device, Input, InputBufferLength, 
+			Output, OutputBufferLength, ReturnedLength);
+		break;
+
+	case DIO_IOCTL_QUERY_CLOCK:
+		{
+			DIO_PACKET_QUERY_CLOCK Clock;
+			LARGE_INTEGER Counter;
+			LARGE_INTEGER Frequency;
+
+			if (OutputBufferLength < sizeof(Clock))
+				break;
+
+			QueryPerformanceCounter(&Counter);
+			QueryPerformanceFrequency(&Frequency);
+			Clock.Counter = Counter.QuadPart;
+			Clock.Frequency = Frequency.QuadPart;
+
+			memcpy(Output, &Clock, sizeof(Clock));
+			*ReturnedLength = sizeof(Clock);
+			Result = TRUE;
+		}
+		break;
+
+	default:
+		DFTRACE("IOCTL 0x%x needs the driver\n", IoControlCode);
+		SetLastError(ERROR_NOT_SUPPORTED);
+		break;
+	}
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DiopReadWritePortDevice(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_REQUEST *Request, 
+	IN ULONG Offset, 
+	IN OUT PVOID Buffer, 
+	IN ULONG Length, 
+	IN BOOLEAN Write, 
+	OUT ULONG *TransferredLength)
+/**
+ *	@brief	Reads or writes the consecutive ports from the port address.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Ports must be in one of the allowed ranges.
+ *	
+ */
+{
+	DIOUM_PORT_DEVICE *Device = (DIOUM_PORT_DEVICE *)Context->TransportContext;
+
+	UNREFERENCED_PARAMETER(Request);
+
+	*TransferredLength = 0;
+
+	if ((ULONGLONG)Offset + Length > DIOUM_PORT_LIMIT)
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	if (Length && !DiopIsPortRangeAllowed(Offset, Offset + Length - 1))
+		return FALSE;
+
+	DiopBeginPortRequest(Device, NULL);
+	DiopTransferPorts(Device, Offset, (PUCHAR)Buffer, Length, FALSE, Write);
+
+	if (!DiopEndPortRequest(Device, NULL))
+		return FALSE;
+
+	*TransferredLength = Length;
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DiopOpenPortDevice(
+	IN DIOUM_DRIVER_CONTEXT *Context)
+/**
+ *	@brief	Opens /dev/port, or the stand-in which is named by DIOUM_PORT_DEVICE.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Opening /dev/port needs CAP_SYS_RAWIO, as the port instructions do.
+ *	Fails with ERROR_INVALID_PARAMETER if DIOUM_PORT_RANGES is malformed.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIOUM_PORT_DEVICE *Device;
+	PCSTR Path = getenv(DIOUM_PORT_DEVICE_VARIABLE);
+
+	pthread_once(&DiopAllowedPortRangesOnce, DiopParseAllowedPortRanges);
+
+	if (!DiopAllowedPortRangesValid)
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	Device = (DIOUM_PORT_DEVICE *)DiopAllocate(sizeof(*Device));
+	if (!Device)
+		return FALSE;
+
+	Device->StandIn = (BOOLEAN)(Path && *Path);
+	if (!Device->StandIn)
+		Path = DIOUM_PORT_DEVICE_PATH;
+
+	Device->File = open(Path, O_RDWR | O_CLOEXEC);
+	if (Device->File < 0)
+	{
+		DFTRACE("Failed to open %s (%d)\n", Path, errno);
+		DiopFree(Device);
+		return FALSE;
+	}
+
+	pthread_mutex_init(&Device->Lock, NULL);
+
+	Context->TransportContext = Device;
+	Context->Handle = (HANDLE)(LONG_PTR)Device->File;
+
+	return TRUE;
+}
+
+VOID
+APIENTRY
+DiopClosePortDevice(
+	IN DIOUM_DRIVER_CONTEXT *Context)
+/**
+ *	@brief	Closes the port device. I/O permission of the threads is kept until they exit.
+ *	
+ *	This function is reserved for internal use.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	
+ */
+{
+	DIOUM_PORT_DEVICE *Device = (DIOUM_PORT_DEVICE *)Context->TransportContext;
+
+	if (!Device)
+		return;
+
+	close(Device->File);
+	pthread_mutex_destroy(&Device->Lock);
+	DiopFree(Device);
+
+	Context->TransportContext = NULL;
+	Context->Handle = NULL;
+}
+
+BOOL
+APIENTRY
+DiopInitializePortRequest(
+	IN DIOUM_REQUEST *Request)
+/**
+ *	@brief	Nothing to prepare, as the requests are served synchronously.
+ *	
+ *	This function is reserved for internal use.
+ *	
+ */
+{
+	UNREFERENCED_PARAMETER(Request);
+
+	return TRUE;
+}
+
+VOID
+APIENTRY
+DiopDeletePortRequest(
+	IN DIOUM_REQUEST *Request)
+/**
+ *	@brief	Nothing to release. See DiopInitializePortRequest().
+ *	
+ *	This function is reserved for internal use.
+ *	
+ */
+{
+	UNREFERENCED_PARAMETER(Request);
+}
+
+
+const DIOUM_TRANSPORT DiopTransport = {
+	"devport", 
+	DiopOpenPortDevice, 
+	DiopClosePortDevice, 
+	DiopInitializePortRequest, 
+	DiopDeletePortRequest, 
+	DiopPortDeviceIoControl, 
+	DiopReadWritePortDevice, 
+};
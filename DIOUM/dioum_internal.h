@@ -1,21 +1,588 @@
-
 #pragma once
 
 
 #define	DIOUM_CONTEXT_MAGIC			'WRYY'
 
+// Requests up to this length are served from the pooled request buffer without heap allocation.
+#define DIOUM_INLINE_PACKET_LENGTH	512
+
+#define DIOUM_RANGE_SET_NAME_LENGTH	(DIOUM_RANGE_SET_MAXIMUM_NAME_LENGTH + 1)
+
+// Range set uses per-range XOR masks instead of the context masks.
+#define DIOUM_RANGE_SET_FLAG_OWN_MASKS		0x00000001
+
+/**
+ *	@brief	Port range set.
+ *
+ *	Immutable after creation, so it can be shared by all threads without a lock.\n
+ *	Contains the prebuilt packet header which is copied in front of the data.\n
+ *	Per-range offsets and masks are placed right after the header.
+ */
+typedef struct _DIOUM_RANGE_SET {
+	SLIST_ENTRY RetiredEntry;		// Linked to RetiredRangeSets after replaced, then to ReclaimingRangeSets
+	ULONG IdleReaders;				// Bit i is set once ActiveReaders[i] is seen zero after retired
+	struct _DIOUM_RANGE_SET *Next;	// Linked to RangeSetList if created by DioCreateRangeSet(), or to RetiredSnapshotLayouts
+	CHAR Name[DIOUM_RANGE_SET_NAME_LENGTH];
+	ULONG Flags;					// DIOUM_RANGE_SET_FLAG_XXX
+	ULONG DataLength;				// Total data length of all ranges
+	ULONG HeaderLength;				// PACKET_PORT_IO_GET_LENGTH(RangeCount)
+	ULONG *Offsets;					// Data offset of each range
+	UCHAR *ReadXorMasks;			// Read XOR mask of each range
+	UCHAR *WriteXorMasks;			// Write XOR mask of each range
+	struct _DIOUM_SHADOW * volatile Shadow;	// Output shadow cache, allocated on first use
+	struct _DIOUM_READ_CACHE * volatile ReadCache;	// Read cache, allocated when freshness is set
+	DIO_PACKET_PORT_IO Header;		// Must be the last member
+} DIOUM_RANGE_SET;
+
+// Dirty runs which are this close are merged, since the gap costs less than a range descriptor.
+#define DIOUM_SHADOW_MERGE_GAP		sizeof(DIO_PORT_RANGE)
+
+/**
+ *	@brief	Output shadow cache of range set.
+ *
+ *	Data is in the caller's layout (before XOR masks). Dirty holds one flag per data byte.
+ */
+typedef struct _DIOUM_SHADOW {
+	SRWLOCK Lock;					// Held exclusively across the flush to keep the write order
+	ULONG DirtyCount;				// Count of non-zero flags in Dirty
+	PUCHAR Data;
+	PUCHAR Dirty;
+} DIOUM_SHADOW;
+
+/**
+ *	@brief	Read cache of range set.
+ *
+ *	Data is kept as read from the ports (before XOR masks), so it stays valid if the masks are changed.
+ */
+typedef struct _DIOUM_READ_CACHE {
+	SRWLOCK Lock;					// Held exclusively across the refresh so that concurrent misses read once
+	ULONG Freshness;				// Microseconds. Zero if caching is disabled
+	LONGLONG FreshnessTicks;		// Freshness in performance counter ticks
+	LARGE_INTEGER Timestamp;		// Performance counter before the data was read
+	BOOLEAN Valid;
+	volatile LONGLONG Hits;
+	volatile LONGLONG Misses;
+	PUCHAR Data;
+} DIOUM_READ_CACHE;
+
+// Count of the kernel clock samples when the clock is calibrated on first use.
+#define DIOUM_CLOCK_DEFAULT_SAMPLES		16
+
+#define DIOUM_LOG_MAGIC				'GOLD'
+#define DIOUM_LOG_VERSION			1
+
+// Segment is the unit of the file mapping. Must hold the largest record.
+#define DIOUM_LOG_DEFAULT_SEGMENT_LENGTH	0x00400000
+#define DIOUM_LOG_MINIMUM_SEGMENT_LENGTH	0x00040000
+
+/**
+ *	@brief	Header at the beginning of the log file.
+ */
+typedef struct _DIOUM_LOG_HEADER {
+	ULONG Magic;					// DIOUM_LOG_MAGIC
+	ULONG Version;					// DIOUM_LOG_VERSION
+	ULONG SegmentLength;
+	ULONG Reserved;
+	LONGLONG Frequency;				// Performance counter frequency of the timestamps
+	LONGLONG StartTime;				// Performance counter when the recording started
+} DIOUM_LOG_HEADER;
+
+/**
+ *	@brief	Record of one IOCTL, followed by [Input] [Output].
+ *
+ *	Records do not cross the segment boundary. Zero Length means the rest of the segment is unused.
+ */
+typedef struct _DIOUM_LOG_RECORD {
+	ULONG Length;					// Total length including the header, 8-byte aligned
+	ULONG IoControlCode;
+	ULONG ThreadId;
+	ULONG Result;					// Return value of the IOCTL
+	ULONG InputLength;
+	ULONG OutputLength;				// Returned length
+	LONGLONG StartTime;				// Ticks since the recording started
+	LONGLONG Latency;				// Ticks until the IOCTL is completed
+} DIOUM_LOG_RECORD;
+
+/**
+ *	@brief	Active recording.
+ *
+ *	Only the current segment is mapped. Writers reserve the space with the interlocked operation.
+ */
+typedef struct _DIOUM_LOG {
+	HANDLE File;
+	HANDLE Mapping;
+	PUCHAR View;					// Mapped view of the current segment
+	ULONGLONG SegmentOffset;		// File offset of the current segment
+	ULONG SegmentLength;
+	volatile LONG Used;				// Reserved length in the current segment
+	volatile LONG DroppedRecords;	// Records which are not written due to the failure
+	BOOLEAN Failed;					// Segment cannot be mapped. Later records are dropped
+	LARGE_INTEGER StartTime;
+} DIOUM_LOG;
+
+/**
+ *	@brief	Extraction step of channel group.
+ */
+typedef struct _DIOUM_CHANNEL_OP {
+	ULONG Offset;					// Frame offset of the source byte, or of the 32-bit window for PEXT
+	ULONG Mask;						// Mapped bits of the window, or of the byte
+	ULONG Shift;					// PEXT: index (in the group) of the channel of the lowest bit
+									// Table: channel index minus bit, if Linear
+	ULONGLONG *Table;				// Channel bits for each byte value. NULL for PEXT
+	UCHAR Channels[8];				// Index (in the group) of the channel of each bit. Table step only
+	BOOLEAN Linear;					// Channel index of each mapped bit is Shift + bit. Table step only
+} DIOUM_CHANNEL_OP;
+
+/**
+ *	@brief	Up to 64 consecutive channels which are extracted into one word.
+ */
+typedef struct _DIOUM_CHANNEL_GROUP {
+	ULONG FirstOp;
+	ULONG OpCount;
+	ULONG ChannelCount;
+	BOOLEAN Pext;					// Steps are PEXT windows instead of tables
+	ULONGLONG InvertMask;			// Inverted channels
+} DIOUM_CHANNEL_GROUP;
+
+/**
+ *	@brief	Compiled channel map.
+ *
+ *	Immutable after creation. Does not reference the range set it is compiled for.
+ */
+typedef struct _DIOUM_CHANNEL_MAP {
+	ULONG FrameLength;				// Data length of the range set
+	ULONG ChannelCount;
+	ULONG GroupCount;
+	DIOUM_CHANNEL_GROUP *Groups;
+	DIOUM_CHANNEL_OP *Ops;
+	ULONG *ChannelOffsets;			// Frame offset of each channel
+	UCHAR *ChannelBits;				// Bit of each channel
+} DIOUM_CHANNEL_MAP;
+
+// First window in microseconds when concurrent callers are seen.
+#define DIOUM_COMBINE_INITIAL_WINDOW	8
+
+/**
+ *	@brief	Caller waiting in the combining batch.
+ *
+ *	Lives on the caller's stack until Done is set by the batch leader.
+ */
+typedef struct _DIOUM_COMBINE_ENTRY {
+	struct _DIOUM_COMBINE_ENTRY *Next;
+	DIOUM_RANGE_SET *RangeSet;
+	PUCHAR Buffer;
+	ULONG DataOffset;				// Offset of the range set data in the combined packet
+	BOOLEAN Unique;					// Ranges are in the packet. FALSE if deduplicated
+	BOOLEAN Done;
+	BOOL Result;
+} DIOUM_COMBINE_ENTRY;
+
+/**
+ *	@brief	Batch of reads or writes which are sent as one IOCTL.
+ *
+ *	Lives on the leader's stack. Protected by CombineLock while it is open.
+ */
+typedef struct _DIOUM_COMBINE_BATCH {
+	DIOUM_COMBINE_ENTRY *First;
+	DIOUM_COMBINE_ENTRY **Tail;
+	ULONG EntryCount;
+	ULONG RangeCount;				// Total range count of unique entries
+	ULONG DataLength;				// Total data length of unique entries
+	BOOLEAN Write;
+	volatile LONG Full;				// Set when the batch is replaced, so the leader stops waiting.
+									// Accessed with the interlocked functions, as the leader polls it without the lock
+} DIOUM_COMBINE_BATCH;
+
+/**
+ *	@brief	Per-call request.
+ *
+ *	Requests are kept in the lock-free pool and used by one thread at a time.
+ */
+typedef struct _DIOUM_REQUEST {
+	SLIST_ENTRY PoolEntry;			// Linked to RequestPool while not in use
+	OVERLAPPED Overlapped;			// hEvent is created once and reused
+	PUCHAR Buffer;					// InlineBuffer or heap-allocated buffer
+	ULONG BufferLength;
+	UCHAR InlineBuffer[DIOUM_INLINE_PACKET_LENGTH];
+} DIOUM_REQUEST;
+
+/**
+ *	@brief	Transport which carries the IOCTLs of the context.
+ *
+ *	Windows sends them to the DIOPort device (transport.c). Linux has no driver, so the port IOCTLs
+ *	are served in the process on /dev/port or with the port instructions (devport.c).\n
+ *	Packets are the same on both, so everything above the transport is shared.
+ */
+typedef struct _DIOUM_TRANSPORT {
+	PCSTR Name;
+
+	BOOL (APIENTRY *Open)(
+		IN DIOUM_DRIVER_CONTEXT *Context);
+
+	VOID (APIENTRY *Close)(
+		IN DIOUM_DRIVER_CONTEXT *Context);
+
+	// Called once for each request which is added to the pool, and when it is freed.
+	BOOL (APIENTRY *InitializeRequest)(
+		IN DIOUM_REQUEST *Request);
+
+	VOID (APIENTRY *DeleteRequest)(
+		IN DIOUM_REQUEST *Request);
+
+	BOOL (APIENTRY *IoControl)(
+		IN DIOUM_DRIVER_CONTEXT *Context, 
+		IN DIOUM_REQUEST *Request, 
+		IN ULONG IoControlCode, 
+		IN PVOID InputBuffer, 
+		IN ULONG InputBufferLength, 
+		OUT PVOID OutputBuffer, 
+		IN ULONG OutputBufferLength, 
+		OUT ULONG *ReturnedLength);
+
+	// File offset is the port address, as in the default file mode of the driver.
+	BOOL (APIENTRY *ReadWrite)(
+		IN DIOUM_DRIVER_CONTEXT *Context, 
+		IN DIOUM_REQUEST *Request, 
+		IN ULONG Offset, 
+		IN OUT PVOID Buffer, 
+		IN ULONG Length, 
+		IN BOOLEAN Write, 
+		OUT ULONG *TransferredLength);
+} DIOUM_TRANSPORT;
+
 typedef struct _DIOUM_DRIVER_CONTEXT {
+	SLIST_HEADER RequestPool;		// Free DIOUM_REQUESTs
+	SLIST_HEADER RetiredRangeSets;	// Replaced range sets which may be still in use
 	ULONG Magic;					// DIOUM_CONTEXT_MAGIC
 	UCHAR ReadXorMask;
 	UCHAR WriteXorMask;
 	UCHAR Reserved[2];
-	HANDLE Handle;
-	CRITICAL_SECTION CriticalSection;
-
-	union
-	{
-		DIO_PACKET Packet;
-		UCHAR Bytes[8192 + 256 * 4 + 4];
-	} InputBuffer, OutputBuffer, TempBuffer;
+	const DIOUM_TRANSPORT *Transport;
+	PVOID TransportContext;			// Private state of the transport. NULL on Windows
+	HANDLE Handle;					// Opened with FILE_FLAG_OVERLAPPED so that calls are not serialized.
+									// Descriptor of the port device on Linux
+
+	DIOUM_RANGE_SET * volatile RegisteredRangeSet;
+	volatile LONG ActiveReaders[2];	// Threads which may reference RegisteredRangeSet, by the epoch they entered in
+	volatile LONG ReaderEpoch;		// Index of ActiveReaders which new readers are counted in
+	SRWLOCK ReclaimLock;			// Serializes DiopReclaimRangeSets()
+	PSLIST_ENTRY ReclaimingRangeSets;	// Retired sets which wait for the readers. Protected by ReclaimLock
+
+	SRWLOCK RangeSetLock;			// Protects RangeSetList
+	DIOUM_RANGE_SET *RangeSetList;	// Range sets created by DioCreateRangeSet()
+
+	SRWLOCK CombineLock;			// Protects the combining state below
+	CONDITION_VARIABLE CombineDone;	// Signaled when a batch is completed
+	DIOUM_COMBINE_BATCH *OpenBatches[2];	// Batches accepting reads [0] and writes [1]
+	ULONG CombineMaximumWindow;		// Microseconds. Zero if combining is disabled
+	ULONG CombineWindow;			// Current window which is adapted to the load
+	ULONG CombineCallers;			// Count of callers in the combining path
+	LARGE_INTEGER PerformanceFrequency;
+
+	ULONG RegisteredFreshness;		// Read cache freshness of the registered range set
+
+	SRWLOCK ClockLock;				// Protects the clock correlation below
+	BOOLEAN ClockCalibrated;
+	LONGLONG KernelClockBase;		// Kernel clock at the calibration point
+	LONGLONG ApplicationClockBase;	// Application clock at the calibration point
+	LONGLONG KernelClockFrequency;
+	LONGLONG ClockUncertainty;		// Half of the shortest round trip in application ticks
+
+	SRWLOCK LogLock;				// Held shared while a record is written, exclusively to switch the segment
+	struct _DIOUM_LOG * volatile Log;	// Active recording. NULL if not recording
+
+	SRWLOCK StreamLock;				// Held shared by the stream writers, exclusively to start the stream
+	ULONG StreamFrameLength;		// Zero if the stream is not started
+	PUCHAR StreamWriteMasks;		// Write XOR mask of each frame byte
+
+	SRWLOCK RingLock;				// Held shared by the ring calls, exclusively to create or destroy the ring
+	struct _DIOUM_RING *Ring;		// Submission and completion rings. NULL if not created
+
+	SRWLOCK SnapshotLock;			// Serializes the snapshot start and stop
+	const struct _DIO_SNAPSHOT_PAGE *Snapshot;	// Read-only snapshot page. NULL if not mapped
+	DIOUM_RANGE_SET * volatile SnapshotLayout;	// Private copy of the refreshed range set
+	DIOUM_RANGE_SET *RetiredSnapshotLayouts;	// Layouts of the previous starts, freed on shutdown
+
+	volatile LONG ResourcesQueried;	// Non-zero if Resources is valid
+	ULONG ResourceRangeCount;		// Zero if the driver does not report the resources
+	DIO_PORT_RANGE Resources[DIO_MAXIMUM_PORT_RANGES];
 } DIOUM_DRIVER_CONTEXT;
 
+
+//
+// Internal helper functions (DIOUM.c).
+//
+
+#if defined(_MSC_VER)
+#define DFTRACE(_fmt, ...)			DTRACE(__FUNCTION__ ": " _fmt, __VA_ARGS__)
+#else
+#define DFTRACE(_fmt, ...)			DTRACE("%s: " _fmt, __FUNCTION__, ##__VA_ARGS__)
+#endif
+
+VOID
+CDECL
+DTRACE(
+	IN PSZ Format, 
+	...);
+
+PVOID
+APIENTRY
+DiopAllocate(
+	IN ULONG Size);
+
+VOID
+APIENTRY
+DiopFree(
+	IN PVOID Pointer);
+
+BOOL
+APIENTRY
+DiopValidateContext(
+	IN DIOUM_DRIVER_CONTEXT *Context);
+
+ULONG
+APIENTRY
+DiopUnsafeXorCopy(
+	OUT PUCHAR DestinationBuffer, 
+	IN PUCHAR SourceBuffer, 
+	IN ULONG CopyLength, 
+	IN UCHAR XorMask);
+
+DIOUM_REQUEST *
+APIENTRY
+DiopAcquireRequest(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG BufferLength);
+
+VOID
+APIENTRY
+DiopReleaseRequest(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_REQUEST *Request);
+
+BOOL
+APIENTRY
+DiopIssueIoControl(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_REQUEST *Request, 
+	IN ULONG IoControlCode, 
+	IN PVOID InputBuffer, 
+	IN ULONG InputBufferLength, 
+	OUT PVOID OutputBuffer, 
+	IN ULONG OutputBufferLength, 
+	OUT ULONG *ReturnedLength);
+
+BOOL
+APIENTRY
+DiopDeviceIoControl(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_REQUEST *Request, 
+	IN ULONG IoControlCode, 
+	IN PVOID InputBuffer, 
+	IN ULONG InputBufferLength, 
+	OUT PVOID OutputBuffer, 
+	IN ULONG OutputBufferLength, 
+	OUT ULONG *ReturnedLength);
+
+VOID
+APIENTRY
+DiopCopyRangeSetData(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	OUT PUCHAR DestinationBuffer, 
+	IN PUCHAR SourceBuffer, 
+	IN BOOLEAN Write);
+
+DIOUM_RANGE_SET *
+APIENTRY
+DiopReferenceRegisteredRangeSet(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OUT ULONG *Epoch);
+
+VOID
+APIENTRY
+DiopDereferenceRegisteredRangeSet(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG Epoch);
+
+DIOUM_RANGE_SET *
+APIENTRY
+DiopCreateRangeSet(
+	OPTIONAL IN PCSTR Name, 
+	IN ULONG AddressRangeCount, 
+	IN DIOUM_PORT_RANGE *AddressRanges, 
+	OPTIONAL IN UCHAR *ReadXorMasks, 
+	OPTIONAL IN UCHAR *WriteXorMasks);
+
+VOID
+APIENTRY
+DiopFreeRangeSet(
+	IN DIOUM_RANGE_SET *RangeSet);
+
+BOOL
+APIENTRY
+DiopReadRangeSetUncached(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *ReturnedDataLength);
+
+BOOL
+APIENTRY
+DiopReadRangeSet(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *ReturnedDataLength);
+
+BOOL
+APIENTRY
+DiopWriteRangeSet(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	IN PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *TransferredDataLength);
+
+
+//
+// Transport of the platform (transport.c on Windows, devport.c on Linux).
+//
+
+extern const DIOUM_TRANSPORT DiopTransport;
+
+
+//
+// Output shadow cache (shadow.c).
+//
+
+VOID
+APIENTRY
+DiopFreeShadow(
+	IN DIOUM_RANGE_SET *RangeSet);
+
+
+//
+// Read cache (cache.c).
+//
+
+BOOL
+APIENTRY
+DiopSetReadCacheFreshness(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	IN ULONG Freshness);
+
+VOID
+APIENTRY
+DiopInvalidateReadCache(
+	IN DIOUM_RANGE_SET *RangeSet);
+
+BOOL
+APIENTRY
+DiopReadCachedRangeSet(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *ReturnedDataLength);
+
+VOID
+APIENTRY
+DiopFreeReadCache(
+	IN DIOUM_RANGE_SET *RangeSet);
+
+
+//
+// Clock correlation (clock.c).
+//
+
+LONGLONG
+APIENTRY
+DiopScaleTicks(
+	IN LONGLONG Ticks, 
+	IN LONGLONG FromFrequency, 
+	IN LONGLONG ToFrequency);
+
+BOOL
+APIENTRY
+DiopCalibrateClock(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG SampleCount);
+
+LONGLONG
+APIENTRY
+DiopConvertKernelTime(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN LONGLONG KernelTime);
+
+LONGLONG
+APIENTRY
+DiopConvertApplicationTime(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN LONGLONG ApplicationTime);
+
+
+//
+// Recording (record.c).
+//
+
+BOOL
+APIENTRY
+DiopRecordIoControl(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_REQUEST *Request, 
+	IN ULONG IoControlCode, 
+	IN PVOID InputBuffer, 
+	IN ULONG InputBufferLength, 
+	OUT PVOID OutputBuffer, 
+	IN ULONG OutputBufferLength, 
+	OUT ULONG *ReturnedLength);
+
+ULONG
+APIENTRY
+DiopStopRecording(
+	IN DIOUM_DRIVER_CONTEXT *Context);
+
+
+//
+// Output scheduler (schedule.c).
+//
+
+BOOL
+APIENTRY
+DiopAcquireCalibratedClock(
+	IN DIOUM_DRIVER_CONTEXT *Context);
+
+
+//
+// Snapshot page (snapshot.c).
+//
+
+BOOL
+APIENTRY
+DiopMapSnapshot(
+	IN DIOUM_DRIVER_CONTEXT *Context);
+
+BOOL
+APIENTRY
+DiopReadSnapshotConfiguration(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OUT ULONG *ConfigurationBits);
+
+
+//
+// Request combining (combine.c).
+//
+
+BOOL
+APIENTRY
+DiopCombineRangeSetIo(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	IN OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *TransferredDataLength, 
+	IN BOOLEAN Write);
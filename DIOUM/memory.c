@@ -0,0 +1,373 @@
+#include <Windows.h>
+#include "../Include/dioctl.h"
+#include "../Include/dioum.h"
+#include "dioum_internal.h"
+
+
+C_ASSERT(sizeof(DIOUM_MEMORY_RANGE) == sizeof(DIO_MEMORY_RANGE));
+C_ASSERT(sizeof(DIOUM_MEMORY_DESCRIPTOR) == sizeof(DIO_MEMORY_DESCRIPTOR));
+C_ASSERT(DIOUM_MAXIMUM_MEMORY_RANGES == DIO_MAXIMUM_MEMORY_RANGES);
+C_ASSERT(DIOUM_MEMORY_WINDOW_ALIGNMENT == DIO_MEMORY_WINDOW_ALIGNMENT);
+
+
+BOOL
+APIENTRY
+DiopGetMemoryDescriptorDataLength(
+	IN ULONG DescriptorCount, 
+	IN DIOUM_MEMORY_DESCRIPTOR *Descriptors, 
+	OUT ULONG *DataLength)
+/**
+ *	@brief	Validates the memory descriptors as the driver does, and calculates the data length.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Bounds of the resources are checked by the driver only.
+ *	
+ *	@param	[in] DescriptorCount		Count of Descriptors.
+ *	@param	[in] Descriptors			Memory descriptors.
+ *	@param	[out] DataLength			Receives the data length in bytes.
+ *	@return								Non-zero if the descriptors are valid.
+ *	
+ */
+{
+	ULONGLONG Length = 0;
+	ULONG i;
+
+	if (!DescriptorCount || DescriptorCount > DIOUM_PORT_IO_MAXIMUM_DESCRIPTORS || !Descriptors)
+		return FALSE;
+
+	for (i = 0; i < DescriptorCount; i++)
+	{
+		DIOUM_MEMORY_DESCRIPTOR *Descriptor = Descriptors + i;
+		ULONG Width = Descriptor->Width;
+
+		if (!Descriptor->Count || !Descriptor->Repeat || Descriptor->Resource >= DIOUM_MAXIMUM_MEMORY_RANGES)
+			return FALSE;
+
+		if (!Width || Width > 8 || (Width & (Width - 1)) || 
+			((Descriptor->Offset | Descriptor->Stride) & (Width - 1)))
+			return FALSE;
+
+		Length += (ULONGLONG)Descriptor->Count * Width * Descriptor->Repeat;
+		if (Length > DIOUM_PORT_IO_MAXIMUM_DATA_LENGTH)
+			return FALSE;
+	}
+
+	*DataLength = (ULONG)Length;
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DioQueryMemoryResources(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OUT DIOUM_MEMORY_RANGE *Ranges, 
+	IN ULONG MaximumCount, 
+	OUT ULONG *RangeCount)
+/**
+ *	@brief	Queries the memory resources which are claimed and mapped by the driver.
+ *	
+ *	The index of a range is the Resource of DIOUM_MEMORY_DESCRIPTOR and DioMapMemoryWindow().
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[out] Ranges				Receives the ranges, in the order of the indices.
+ *	@param	[in] MaximumCount			Count of ranges which Ranges can hold.
+ *	@param	[out] RangeCount			Receives the count of the resources, even if it exceeds MaximumCount.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIO_PACKET_QUERY_MEMORY_RESOURCES *Packet;
+	DIOUM_REQUEST *Request;
+	ULONG PacketLength = PACKET_QUERY_MEMORY_RESOURCES_GET_LENGTH(DIO_MAXIMUM_MEMORY_RANGES);
+	ULONG ReturnedLength = 0;
+	ULONG CopyCount;
+	BOOL Result;
+
+	if (!DiopValidateContext(Context) || (MaximumCount && !Ranges) || !RangeCount)
+		return FALSE;
+
+	Request = DiopAcquireRequest(Context, PacketLength);
+	if (!Request)
+		return FALSE;
+
+	Packet = (DIO_PACKET_QUERY_MEMORY_RESOURCES *)Request->Buffer;
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_QUERY_MEMORY_RESOURCES, 
+		NULL, 
+		0, 
+		(PVOID)Packet, 
+		PacketLength, 
+		&ReturnedLength);
+
+	if (Result && 
+		(ReturnedLength < sizeof(*Packet) || 
+		Packet->RangeCount > DIO_MAXIMUM_MEMORY_RANGES || 
+		ReturnedLength != PACKET_QUERY_MEMORY_RESOURCES_GET_LENGTH(Packet->RangeCount)))
+	{
+		DFTRACE("Length mismatched, assuming failed\n");
+		Result = FALSE;
+	}
+
+	if (Result)
+	{
+		CopyCount = min(Packet->RangeCount, MaximumCount);
+		memcpy(Ranges, Packet->AddressRange, CopyCount * sizeof(DIO_MEMORY_RANGE));
+		*RangeCount = Packet->RangeCount;
+	}
+
+	DiopReleaseRequest(Context, Request);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DiopMemoryIo(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG DescriptorCount, 
+	IN DIOUM_MEMORY_DESCRIPTOR *Descriptors, 
+	IN OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *DataLengthTransferred, 
+	IN BOOL Write)
+/**
+ *	@brief	Sends the memory descriptors with the version 2 port I/O packet.
+ *	
+ *	This function is reserved for internal use.\n
+ *	The driver reads the registers straight into Buffer, which it locks.
+ *	
+ */
+{
+	DIO_PACKET_MEMORY_IO_V2 *MemoryIo;
+	DIOUM_REQUEST *Request;
+	ULONG HeaderLength = PACKET_MEMORY_IO_V2_GET_LENGTH(DescriptorCount);
+	ULONG DataLength = 0;
+	ULONG ReturnedLength = 0;
+	PUCHAR Data;
+	BOOL Result;
+
+	if (!DiopValidateContext(Context) || !Buffer)
+		return FALSE;
+
+	if (!DiopGetMemoryDescriptorDataLength(DescriptorCount, Descriptors, &DataLength) || BufferLength < DataLength)
+		return FALSE;
+
+	// Output buffer is locked for write access, so the data to write goes after the descriptors.
+	Request = DiopAcquireRequest(Context, HeaderLength + (Write ? DataLength : 0));
+	if (!Request)
+		return FALSE;
+
+	MemoryIo = (DIO_PACKET_MEMORY_IO_V2 *)Request->Buffer;
+	MemoryIo->Version = DIO_PORT_IO_VERSION2;
+	MemoryIo->Flags = DIO_PORT_IO_V2_FLAG_MEMORY_SPACE;
+	MemoryIo->DescriptorCount = DescriptorCount;
+	memcpy(MemoryIo->Descriptors, Descriptors, DescriptorCount * sizeof(DIO_MEMORY_DESCRIPTOR));
+
+	Data = Write ? Request->Buffer + HeaderLength : Buffer;
+
+	if (Write)
+		memcpy(Data, Buffer, DataLength);
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		Write ? DIO_IOCTL_WRITE_PORT_V2 : DIO_IOCTL_READ_PORT_V2, 
+		(PVOID)MemoryIo, 
+		HeaderLength, 
+		(PVOID)Data, 
+		DataLength, 
+		&ReturnedLength);
+
+	DiopReleaseRequest(Context, Request);
+
+	if (Result && ReturnedLength != DataLength)
+	{
+		DFTRACE("Length mismatched, assuming failed\n");
+		Result = FALSE;
+	}
+
+	if (Result && DataLengthTransferred)
+		*DataLengthTransferred = DataLength;
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioReadMemoryDescriptors(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG DescriptorCount, 
+	IN DIOUM_MEMORY_DESCRIPTOR *Descriptors, 
+	OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *ReturnedDataLength)
+/**
+ *	@brief	Reads the memory-mapped registers which are described by the strided descriptors.
+ *	
+ *	Each element is one register access of its width, so a 32-bit register costs one access
+ *	instead of four port cycles. XOR masks are not applied: registers are not port data lines.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] DescriptorCount		Count of Descriptors, up to DIOUM_PORT_IO_MAXIMUM_DESCRIPTORS.
+ *	@param	[in] Descriptors			Memory descriptors.
+ *	@param	[out] Buffer				Receives the data in the order of Descriptors.
+ *	@param	[in] BufferLength			Length of Buffer in bytes.
+ *	@param	[out, opt] ReturnedDataLength	Receives the data length in bytes.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	return DiopMemoryIo(Context, DescriptorCount, Descriptors, Buffer, BufferLength, ReturnedDataLength, FALSE);
+}
+
+BOOL
+APIENTRY
+DioWriteMemoryDescriptors(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG DescriptorCount, 
+	IN DIOUM_MEMORY_DESCRIPTOR *Descriptors, 
+	IN PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *TransferredDataLength)
+/**
+ *	@brief	Writes the memory-mapped registers which are described by the strided descriptors.
+ *	
+ *	Data is copied once into the request, and nothing is returned but the status.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] DescriptorCount		Count of Descriptors, up to DIOUM_PORT_IO_MAXIMUM_DESCRIPTORS.
+ *	@param	[in] Descriptors			Memory descriptors.
+ *	@param	[in] Buffer					Data to write, in the order of Descriptors.
+ *	@param	[in] BufferLength			Length of Buffer in bytes.
+ *	@param	[out, opt] TransferredDataLength	Receives the data length in bytes.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	return DiopMemoryIo(Context, DescriptorCount, Descriptors, Buffer, BufferLength, TransferredDataLength, TRUE);
+}
+
+BOOL
+APIENTRY
+DioMapMemoryWindow(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG Resource, 
+	IN ULONG Offset, 
+	IN ULONG Length, 
+	OUT PVOID *Address, 
+	OPTIONAL OUT ULONG *MappedLength)
+/**
+ *	@brief	Maps a window of the registers of the memory resource to this process.
+ *	
+ *	Registers in the window are accessed through volatile pointers without any IOCTL, so they
+ *	bypass the port lock and the checks of the driver. The mapping is uncached.\n
+ *	One window per resource. The driver unmaps it when the handle is closed or the device stops.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] Resource				Index of the memory resource. Must be DIOUM_MEMORY_RANGE_FLAG_MAPPABLE.
+ *	@param	[in] Offset					Offset of the window in the resource. Multiple of DIOUM_MEMORY_WINDOW_ALIGNMENT.
+ *	@param	[in] Length					Length of the window. Rounded up to DIOUM_MEMORY_WINDOW_ALIGNMENT.
+ *	@param	[out] Address				Receives the address of the register at Offset.
+ *	@param	[out, opt] MappedLength		Receives the length of the mapping.
+ *	@return								Non-zero if successful. Fails if the resource has a window.
+ *	
+ */
+{
+	DIO_PACKET_MAP_MEMORY *Map;
+	DIO_PACKET_MEMORY_WINDOW Window;
+	DIOUM_REQUEST *Request;
+	ULONG ReturnedLength = 0;
+	BOOL Result;
+
+	if (!DiopValidateContext(Context) || !Address)
+		return FALSE;
+
+	Request = DiopAcquireRequest(Context, sizeof(DIO_PACKET));
+	if (!Request)
+		return FALSE;
+
+	Map = (DIO_PACKET_MAP_MEMORY *)Request->Buffer;
+	Map->Resource = Resource;
+	Map->Offset = Offset;
+	Map->Length = Length;
+	Map->Reserved = 0;
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_MAP_MEMORY, 
+		(PVOID)Map, 
+		sizeof(*Map), 
+		(PVOID)Request->Buffer, 
+		sizeof(Window), 
+		&ReturnedLength);
+
+	if (Result && ReturnedLength != sizeof(Window))
+	{
+		DFTRACE("Length mismatched, assuming failed\n");
+		Result = FALSE;
+	}
+
+	if (Result)
+		memcpy(&Window, Request->Buffer, sizeof(Window));
+
+	DiopReleaseRequest(Context, Request);
+
+	if (!Result)
+		return FALSE;
+
+	*Address = (PVOID)(ULONG_PTR)Window.Address;
+
+	if (MappedLength)
+		*MappedLength = Window.Length;
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DioUnmapMemoryWindow(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG Resource)
+/**
+ *	@brief	Unmaps the window of the memory resource. The address must not be used afterwards.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] Resource				Index of the memory resource.
+ *	@return								Non-zero if successful. Fails if the resource has no window.
+ *	
+ */
+{
+	DIO_PACKET_UNMAP_MEMORY *Unmap;
+	DIOUM_REQUEST *Request;
+	ULONG ReturnedLength = 0;
+	BOOL Result;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	Request = DiopAcquireRequest(Context, sizeof(*Unmap));
+	if (!Request)
+		return FALSE;
+
+	Unmap = (DIO_PACKET_UNMAP_MEMORY *)Request->Buffer;
+	Unmap->Resource = Resource;
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_UNMAP_MEMORY, 
+		(PVOID)Unmap, 
+		sizeof(*Unmap), 
+		NULL, 
+		0, 
+		&ReturnedLength);
+
+	DiopReleaseRequest(Context, Request);
+
+	return Result;
+}
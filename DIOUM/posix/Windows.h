@@ -0,0 +1,435 @@
+#pragma once
+
+//
+// Subset of the Win32 API which DIOUM uses, for the Linux build.
+//
+// The directory is put in front of the include path, so that the sources include <Windows.h>
+// unchanged. Types have the Windows sizes (LLP64), so the packets of dioctl.h keep their layout.
+// The file functions are in win32.c.
+//
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <wchar.h>
+
+#define IN
+#define OUT
+#define OPTIONAL
+#define UNALIGNED
+#define APIENTRY
+#define WINAPI
+#define CDECL
+#define FORCEINLINE					static __inline__ __attribute__((always_inline))
+
+#define VOID						void
+typedef char						CHAR;
+typedef short						SHORT;
+typedef int32_t						LONG;
+typedef int64_t						LONGLONG;
+typedef int64_t						LONG64;
+typedef unsigned char				UCHAR;
+typedef unsigned short				USHORT;
+typedef uint32_t					ULONG;
+typedef uint64_t					ULONGLONG;
+typedef uint64_t					ULONG64;
+typedef uint8_t						BYTE;
+typedef uint16_t					WORD;
+typedef uint32_t					DWORD;
+typedef int							BOOL;
+typedef unsigned char				BOOLEAN;
+typedef wchar_t						WCHAR;
+typedef size_t						SIZE_T;
+typedef intptr_t					LONG_PTR;
+typedef uintptr_t					ULONG_PTR;
+
+typedef void *						PVOID;
+typedef void *						LPVOID;
+typedef void *						HANDLE;
+typedef void *						HMODULE;
+typedef UCHAR *						PUCHAR;
+typedef USHORT *					PUSHORT;
+typedef ULONG *						PULONG;
+typedef CHAR *						PSZ;
+typedef CHAR *						PSTR;
+typedef const CHAR *				PCSTR;
+typedef WCHAR *						PWSTR;
+typedef const WCHAR *				PCWSTR;
+
+typedef union _LARGE_INTEGER {
+	struct {
+		ULONG LowPart;
+		LONG HighPart;
+	};
+	LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+typedef union _ULARGE_INTEGER {
+	struct {
+		ULONG LowPart;
+		ULONG HighPart;
+	};
+	ULONGLONG QuadPart;
+} ULARGE_INTEGER;
+
+#ifndef TRUE
+#define TRUE						1
+#endif
+#ifndef FALSE
+#define FALSE						0
+#endif
+
+#define MAXULONG					0xffffffffUL
+#define MAXLONG						0x7fffffffL
+#define MAXLONGLONG					0x7fffffffffffffffLL
+#define INFINITE					0xffffffffUL
+
+#ifndef min
+#define min(_a, _b)					( ((_a) < (_b)) ? (_a) : (_b) )
+#endif
+#ifndef max
+#define max(_a, _b)					( ((_a) > (_b)) ? (_a) : (_b) )
+#endif
+
+#define C_ASSERT(_e)				_Static_assert(_e, #_e)
+#define ARRAYSIZE(_a)				( sizeof(_a) / sizeof((_a)[0]) )
+#define FIELD_OFFSET(_t, _f)		( (LONG)offsetof(_t, _f) )
+#define CONTAINING_RECORD(_a, _t, _f)	( (_t *)((PUCHAR)(_a) - offsetof(_t, _f)) )
+#define UNREFERENCED_PARAMETER(_p)	( (void)(_p) )
+
+#define ZeroMemory(_d, _l)			memset((_d), 0, (_l))
+#define CopyMemory(_d, _s, _l)		memcpy((_d), (_s), (_l))
+#define _vsnprintf					vsnprintf
+
+
+//
+// Errors. GetLastError() returns errno, so only the codes which DIOUM sets are defined.
+//
+
+#define ERROR_SUCCESS				0
+#define ERROR_NOT_SUPPORTED			EOPNOTSUPP
+#define ERROR_INVALID_PARAMETER		EINVAL
+#define ERROR_ACCESS_DENIED			EACCES
+#define ERROR_IO_PENDING			EINPROGRESS
+#define ERROR_ALREADY_EXISTS		EEXIST
+
+static inline DWORD GetLastError(VOID) { return (DWORD)errno; }
+static inline VOID SetLastError(DWORD Error) { errno = (int)Error; }
+
+
+//
+// Interlocked operations and barriers.
+//
+
+#define InterlockedIncrement(_p)				__atomic_add_fetch((_p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement(_p)				__atomic_sub_fetch((_p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedIncrement64(_p)				__atomic_add_fetch((_p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement64(_p)				__atomic_sub_fetch((_p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedExchangeAdd(_p, _v)			__atomic_fetch_add((_p), (_v), __ATOMIC_SEQ_CST)
+#define InterlockedExchangeAdd64(_p, _v)		__atomic_fetch_add((_p), (_v), __ATOMIC_SEQ_CST)
+#define InterlockedExchange(_p, _v)				__atomic_exchange_n((_p), (_v), __ATOMIC_SEQ_CST)
+#define InterlockedExchange64(_p, _v)			__atomic_exchange_n((_p), (_v), __ATOMIC_SEQ_CST)
+#define InterlockedExchangePointer(_p, _v)		__atomic_exchange_n((_p), (_v), __ATOMIC_SEQ_CST)
+#define InterlockedOr(_p, _v)					__atomic_fetch_or((_p), (_v), __ATOMIC_SEQ_CST)
+#define InterlockedAnd(_p, _v)					__atomic_fetch_and((_p), (_v), __ATOMIC_SEQ_CST)
+
+// Returns the initial value, like the Win32 function.
+#define DIOUM_COMPARE_EXCHANGE(_p, _x, _c)		\
+	({ __typeof__(*(_p) + 0) _Comparand = (_c);	\
+	   __atomic_compare_exchange_n((_p), &_Comparand, (_x), FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);	\
+	   _Comparand; })
+
+#define InterlockedCompareExchange(_p, _x, _c)			DIOUM_COMPARE_EXCHANGE((_p), (_x), (_c))
+#define InterlockedCompareExchange64(_p, _x, _c)		DIOUM_COMPARE_EXCHANGE((_p), (_x), (_c))
+#define InterlockedCompareExchangePointer(_p, _x, _c)	\
+	({ PVOID _Comparand = (PVOID)(_c);		\
+	   __atomic_compare_exchange_n((PVOID volatile *)(_p), &_Comparand, (PVOID)(_x), FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);	\
+	   _Comparand; })
+
+#define MemoryBarrier()				__sync_synchronize()
+#define _ReadBarrier()				__asm__ __volatile__("" ::: "memory")
+#define _WriteBarrier()				__asm__ __volatile__("" ::: "memory")
+#define _ReadWriteBarrier()			__asm__ __volatile__("" ::: "memory")
+
+#if defined(__i386__) || defined(__x86_64__)
+#define YieldProcessor()			__builtin_ia32_pause()
+#else
+#define YieldProcessor()			__asm__ __volatile__("" ::: "memory")
+#endif
+
+
+//
+// Singly linked list. Lock-free on Windows; a mutex is enough for the request pool here.
+//
+
+typedef struct _SLIST_ENTRY {
+	struct _SLIST_ENTRY *Next;
+} SLIST_ENTRY, *PSLIST_ENTRY;
+
+typedef struct _SLIST_HEADER {
+	pthread_mutex_t Lock;
+	PSLIST_ENTRY First;
+} SLIST_HEADER, *PSLIST_HEADER;
+
+static inline VOID InitializeSListHead(PSLIST_HEADER Head)
+{
+	pthread_mutex_init(&Head->Lock, NULL);
+	Head->First = NULL;
+}
+
+static inline PSLIST_ENTRY InterlockedPushEntrySList(PSLIST_HEADER Head, PSLIST_ENTRY Entry)
+{
+	PSLIST_ENTRY First;
+
+	pthread_mutex_lock(&Head->Lock);
+	First = Head->First;
+	Entry->Next = First;
+	Head->First = Entry;
+	pthread_mutex_unlock(&Head->Lock);
+
+	return First;
+}
+
+static inline PSLIST_ENTRY InterlockedPopEntrySList(PSLIST_HEADER Head)
+{
+	PSLIST_ENTRY First;
+
+	pthread_mutex_lock(&Head->Lock);
+	First = Head->First;
+	if (First)
+		Head->First = First->Next;
+	pthread_mutex_unlock(&Head->Lock);
+
+	return First;
+}
+
+static inline PSLIST_ENTRY InterlockedFlushSList(PSLIST_HEADER Head)
+{
+	PSLIST_ENTRY First;
+
+	pthread_mutex_lock(&Head->Lock);
+	First = Head->First;
+	Head->First = NULL;
+	pthread_mutex_unlock(&Head->Lock);
+
+	return First;
+}
+
+
+//
+// Slim reader/writer lock and condition variable.
+//
+// The condition variable counts the wakes, so a wake between the release of the lock and the
+// wait is not lost.
+//
+
+typedef pthread_rwlock_t			SRWLOCK, *PSRWLOCK;
+
+#define SRWLOCK_INIT				PTHREAD_RWLOCK_INITIALIZER
+
+#define InitializeSRWLock(_l)				pthread_rwlock_init((_l), NULL)
+#define AcquireSRWLockExclusive(_l)			pthread_rwlock_wrlock(_l)
+#define AcquireSRWLockShared(_l)			pthread_rwlock_rdlock(_l)
+#define ReleaseSRWLockExclusive(_l)			pthread_rwlock_unlock(_l)
+#define ReleaseSRWLockShared(_l)			pthread_rwlock_unlock(_l)
+#define TryAcquireSRWLockExclusive(_l)		(pthread_rwlock_trywrlock(_l) == 0)
+#define TryAcquireSRWLockShared(_l)			(pthread_rwlock_tryrdlock(_l) == 0)
+
+#define CONDITION_VARIABLE_LOCKMODE_SHARED	0x1
+
+typedef struct _CONDITION_VARIABLE {
+	pthread_mutex_t Lock;
+	pthread_cond_t Condition;
+	ULONG Sequence;
+} CONDITION_VARIABLE, *PCONDITION_VARIABLE;
+
+VOID
+InitializeConditionVariable(
+	OUT PCONDITION_VARIABLE ConditionVariable);
+
+BOOL
+SleepConditionVariableSRW(
+	IN OUT PCONDITION_VARIABLE ConditionVariable, 
+	IN OUT PSRWLOCK Lock, 
+	IN DWORD Milliseconds, 
+	IN ULONG Flags);
+
+VOID
+WakeAllConditionVariable(
+	IN OUT PCONDITION_VARIABLE ConditionVariable);
+
+VOID
+WakeConditionVariable(
+	IN OUT PCONDITION_VARIABLE ConditionVariable);
+
+
+//
+// Time and threads. The performance counter is CLOCK_MONOTONIC in nanoseconds, the clock which
+// the Linux transport stamps the port accesses with.
+//
+
+static inline BOOL QueryPerformanceCounter(LARGE_INTEGER *Counter)
+{
+	struct timespec Now;
+
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+	Counter->QuadPart = (LONGLONG)Now.tv_sec * 1000000000 + Now.tv_nsec;
+
+	return TRUE;
+}
+
+static inline BOOL QueryPerformanceFrequency(LARGE_INTEGER *Frequency)
+{
+	Frequency->QuadPart = 1000000000;
+
+	return TRUE;
+}
+
+static inline DWORD GetTickCount(VOID)
+{
+	struct timespec Now;
+
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+
+	return (DWORD)((ULONGLONG)Now.tv_sec * 1000 + Now.tv_nsec / 1000000);
+}
+
+static inline VOID Sleep(DWORD Milliseconds)
+{
+	struct timespec Duration;
+
+	Duration.tv_sec = Milliseconds / 1000;
+	Duration.tv_nsec = (long)(Milliseconds % 1000) * 1000000;
+
+	while (nanosleep(&Duration, &Duration) && errno == EINTR)
+		;
+}
+
+static inline BOOL SwitchToThread(VOID)
+{
+	return sched_yield() == 0;
+}
+
+DWORD
+GetCurrentThreadId(
+	VOID);
+
+
+//
+// Heap and debug output.
+//
+
+#define HEAP_ZERO_MEMORY			0x00000008
+
+#define GetProcessHeap()			( (HANDLE)1 )
+#define HeapAlloc(_h, _f, _l)		( ((_f) & HEAP_ZERO_MEMORY) ? calloc(1, (_l)) : malloc(_l) )
+#define HeapFree(_h, _f, _p)		( free(_p), (void)0 )
+
+// Written to stderr if DIOUM_TRACE is set in the environment.
+VOID
+OutputDebugStringA(
+	IN PCSTR String);
+
+
+//
+// Files and file mappings (win32.c). File names are converted with the locale of the process.
+//
+
+typedef struct _SECURITY_ATTRIBUTES SECURITY_ATTRIBUTES;
+
+typedef struct _OVERLAPPED {
+	ULONG_PTR Internal;
+	ULONG_PTR InternalHigh;
+	DWORD Offset;
+	DWORD OffsetHigh;
+	HANDLE hEvent;
+} OVERLAPPED;
+
+typedef struct _SYSTEM_INFO {
+	DWORD dwPageSize;
+	DWORD dwAllocationGranularity;
+	DWORD dwNumberOfProcessors;
+} SYSTEM_INFO;
+
+#define INVALID_HANDLE_VALUE		( (HANDLE)(LONG_PTR)-1 )
+
+#define GENERIC_READ				0x80000000UL
+#define GENERIC_WRITE				0x40000000UL
+#define FILE_SHARE_READ				0x00000001
+#define FILE_SHARE_WRITE			0x00000002
+#define CREATE_ALWAYS				2
+#define OPEN_EXISTING				3
+#define FILE_ATTRIBUTE_NORMAL		0x00000080
+#define FILE_BEGIN					0
+
+#define PAGE_READONLY				0x02
+#define PAGE_READWRITE				0x04
+#define FILE_MAP_WRITE				0x0002
+#define FILE_MAP_READ				0x0004
+
+HANDLE
+CreateFileW(
+	IN PCWSTR FileName, 
+	IN DWORD DesiredAccess, 
+	IN DWORD ShareMode, 
+	OPTIONAL IN SECURITY_ATTRIBUTES *SecurityAttributes, 
+	IN DWORD CreationDisposition, 
+	IN DWORD FlagsAndAttributes, 
+	OPTIONAL IN HANDLE TemplateFile);
+
+BOOL
+DeleteFileW(
+	IN PCWSTR FileName);
+
+BOOL
+GetFileSizeEx(
+	IN HANDLE File, 
+	OUT LARGE_INTEGER *FileSize);
+
+BOOL
+SetFilePointerEx(
+	IN HANDLE File, 
+	IN LARGE_INTEGER DistanceToMove, 
+	OPTIONAL OUT LARGE_INTEGER *NewFilePointer, 
+	IN DWORD MoveMethod);
+
+BOOL
+SetEndOfFile(
+	IN HANDLE File);
+
+HANDLE
+CreateFileMappingW(
+	IN HANDLE File, 
+	OPTIONAL IN SECURITY_ATTRIBUTES *SecurityAttributes, 
+	IN DWORD Protect, 
+	IN DWORD MaximumSizeHigh, 
+	IN DWORD MaximumSizeLow, 
+	OPTIONAL IN PCWSTR Name);
+
+LPVOID
+MapViewOfFile(
+	IN HANDLE Mapping, 
+	IN DWORD DesiredAccess, 
+	IN DWORD FileOffsetHigh, 
+	IN DWORD FileOffsetLow, 
+	IN SIZE_T Length);
+
+BOOL
+UnmapViewOfFile(
+	IN LPVOID BaseAddress);
+
+BOOL
+CloseHandle(
+	IN HANDLE Handle);
+
+VOID
+GetSystemInfo(
+	OUT SYSTEM_INFO *SystemInfo);
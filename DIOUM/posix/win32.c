@@ -0,0 +1,463 @@
+
+#include <Windows.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+//
+// File and synchronization functions of the Win32 subset for the Linux build.
+//
+
+#define DIOUM_POSIX_HANDLE_FILE		1
+#define DIOUM_POSIX_HANDLE_MAPPING	2
+
+/**
+ *	@brief	Object behind the file and the file mapping handles.
+ */
+typedef struct _DIOUM_POSIX_HANDLE {
+	ULONG Type;						// DIOUM_POSIX_HANDLE_XXX
+	int File;						// Descriptor. Mapping holds its own duplicate
+	ULONGLONG Length;				// Length of the mapping
+	BOOLEAN Writable;
+} DIOUM_POSIX_HANDLE;
+
+/**
+ *	@brief	Mapped view. munmap() needs the length, which UnmapViewOfFile() does not get.
+ */
+typedef struct _DIOUM_POSIX_VIEW {
+	struct _DIOUM_POSIX_VIEW *Next;
+	PVOID Base;
+	SIZE_T Length;
+} DIOUM_POSIX_VIEW;
+
+static pthread_mutex_t DiopViewLock = PTHREAD_MUTEX_INITIALIZER;
+static DIOUM_POSIX_VIEW *DiopViews;
+
+
+VOID
+InitializeConditionVariable(
+	OUT PCONDITION_VARIABLE ConditionVariable)
+{
+	pthread_mutex_init(&ConditionVariable->Lock, NULL);
+	pthread_cond_init(&ConditionVariable->Condition, NULL);
+	ConditionVariable->Sequence = 0;
+}
+
+BOOL
+SleepConditionVariableSRW(
+	IN OUT PCONDITION_VARIABLE ConditionVariable, 
+	IN OUT PSRWLOCK Lock, 
+	IN DWORD Milliseconds, 
+	IN ULONG Flags)
+/**
+ *	@brief	Releases the lock, waits for a wake and takes the lock again in the same mode.
+ *	
+ *	@return								FALSE if the wait is timed out.
+ *	
+ */
+{
+	struct timespec Deadline;
+	ULONG Sequence;
+	int Error = 0;
+
+	if (Milliseconds != INFINITE)
+	{
+		clock_gettime(CLOCK_REALTIME, &Deadline);
+		Deadline.tv_sec += Milliseconds / 1000;
+		Deadline.tv_nsec += (long)(Milliseconds % 1000) * 1000000;
+
+		if (Deadline.tv_nsec >= 1000000000)
+		{
+			Deadline.tv_sec++;
+			Deadline.tv_nsec -= 1000000000;
+		}
+	}
+
+	// Sequence is taken before the lock is released, so a wake after the release is seen.
+	pthread_mutex_lock(&ConditionVariable->Lock);
+	Sequence = ConditionVariable->Sequence;
+	pthread_rwlock_unlock(Lock);
+
+	while (Sequence == ConditionVariable->Sequence && !Error)
+	{
+		if (Milliseconds == INFINITE)
+			pthread_cond_wait(&ConditionVariable->Condition, &ConditionVariable->Lock);
+		else
+			Error = pthread_cond_timedwait(&ConditionVariable->Condition, &ConditionVariable->Lock, &Deadline);
+	}
+
+	pthread_mutex_unlock(&ConditionVariable->Lock);
+
+	if (Flags & CONDITION_VARIABLE_LOCKMODE_SHARED)
+		pthread_rwlock_rdlock(Lock);
+	else
+		pthread_rwlock_wrlock(Lock);
+
+	if (Error)
+	{
+		errno = Error;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+VOID
+WakeAllConditionVariable(
+	IN OUT PCONDITION_VARIABLE ConditionVariable)
+{
+	pthread_mutex_lock(&ConditionVariable->Lock);
+	ConditionVariable->Sequence++;
+	pthread_cond_broadcast(&ConditionVariable->Condition);
+	pthread_mutex_unlock(&ConditionVariable->Lock);
+}
+
+VOID
+WakeConditionVariable(
+	IN OUT PCONDITION_VARIABLE ConditionVariable)
+{
+	// Waiters recheck their condition, so waking all of them is correct, if not the cheapest.
+	WakeAllConditionVariable(ConditionVariable);
+}
+
+DWORD
+GetCurrentThreadId(
+	VOID)
+{
+	return (DWORD)syscall(SYS_gettid);
+}
+
+VOID
+OutputDebugStringA(
+	IN PCSTR String)
+{
+	static int Enabled = -1;
+
+	if (Enabled < 0)
+		Enabled = getenv("DIOUM_TRACE") != NULL;
+
+	if (Enabled)
+		fputs(String, stderr);
+}
+
+BOOL
+APIENTRY
+DiopConvertFileName(
+	IN PCWSTR FileName, 
+	OUT CHAR *Path)
+/**
+ *	@brief	Converts the wide file name to the multibyte path of PATH_MAX characters.
+ *	
+ */
+{
+	size_t Length = wcstombs(Path, FileName, PATH_MAX);
+
+	if (Length == (size_t)-1 || Length >= PATH_MAX)
+	{
+		errno = ENAMETOOLONG;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+HANDLE
+CreateFileW(
+	IN PCWSTR FileName, 
+	IN DWORD DesiredAccess, 
+	IN DWORD ShareMode, 
+	OPTIONAL IN SECURITY_ATTRIBUTES *SecurityAttributes, 
+	IN DWORD CreationDisposition, 
+	IN DWORD FlagsAndAttributes, 
+	OPTIONAL IN HANDLE TemplateFile)
+/**
+ *	@brief	Opens the file. Only CREATE_ALWAYS and OPEN_EXISTING are supported, and the share mode
+ *			is not enforced.
+ *	
+ */
+{
+	DIOUM_POSIX_HANDLE *Handle;
+	CHAR Path[PATH_MAX];
+	int Flags;
+
+	(void)ShareMode;
+	(void)SecurityAttributes;
+	(void)FlagsAndAttributes;
+	(void)TemplateFile;
+
+	if (!DiopConvertFileName(FileName, Path))
+		return INVALID_HANDLE_VALUE;
+
+	if (CreationDisposition == CREATE_ALWAYS)
+		Flags = O_CREAT | O_TRUNC;
+	else if (CreationDisposition == OPEN_EXISTING)
+		Flags = 0;
+	else
+	{
+		errno = EINVAL;
+		return INVALID_HANDLE_VALUE;
+	}
+
+	Flags |= (DesiredAccess & GENERIC_WRITE) ? O_RDWR : O_RDONLY;
+
+	Handle = (DIOUM_POSIX_HANDLE *)calloc(1, sizeof(*Handle));
+	if (!Handle)
+		return INVALID_HANDLE_VALUE;
+
+	Handle->Type = DIOUM_POSIX_HANDLE_FILE;
+	Handle->Writable = (BOOLEAN)((DesiredAccess & GENERIC_WRITE) != 0);
+	Handle->File = open(Path, Flags | O_CLOEXEC, 0666);
+
+	if (Handle->File < 0)
+	{
+		free(Handle);
+		return INVALID_HANDLE_VALUE;
+	}
+
+	return (HANDLE)Handle;
+}
+
+BOOL
+DeleteFileW(
+	IN PCWSTR FileName)
+{
+	CHAR Path[PATH_MAX];
+
+	if (!DiopConvertFileName(FileName, Path))
+		return FALSE;
+
+	return unlink(Path) == 0;
+}
+
+BOOL
+GetFileSizeEx(
+	IN HANDLE File, 
+	OUT LARGE_INTEGER *FileSize)
+{
+	DIOUM_POSIX_HANDLE *Handle = (DIOUM_POSIX_HANDLE *)File;
+	struct stat Status;
+
+	if (fstat(Handle->File, &Status))
+		return FALSE;
+
+	FileSize->QuadPart = (LONGLONG)Status.st_size;
+
+	return TRUE;
+}
+
+BOOL
+SetFilePointerEx(
+	IN HANDLE File, 
+	IN LARGE_INTEGER DistanceToMove, 
+	OPTIONAL OUT LARGE_INTEGER *NewFilePointer, 
+	IN DWORD MoveMethod)
+{
+	DIOUM_POSIX_HANDLE *Handle = (DIOUM_POSIX_HANDLE *)File;
+	off_t Position;
+
+	if (MoveMethod != FILE_BEGIN)
+	{
+		errno = EINVAL;
+		return FALSE;
+	}
+
+	Position = lseek(Handle->File, (off_t)DistanceToMove.QuadPart, SEEK_SET);
+	if (Position < 0)
+		return FALSE;
+
+	if (NewFilePointer)
+		NewFilePointer->QuadPart = (LONGLONG)Position;
+
+	return TRUE;
+}
+
+BOOL
+SetEndOfFile(
+	IN HANDLE File)
+{
+	DIOUM_POSIX_HANDLE *Handle = (DIOUM_POSIX_HANDLE *)File;
+	off_t Position = lseek(Handle->File, 0, SEEK_CUR);
+
+	if (Position < 0)
+		return FALSE;
+
+	return ftruncate(Handle->File, Position) == 0;
+}
+
+HANDLE
+CreateFileMappingW(
+	IN HANDLE File, 
+	OPTIONAL IN SECURITY_ATTRIBUTES *SecurityAttributes, 
+	IN DWORD Protect, 
+	IN DWORD MaximumSizeHigh, 
+	IN DWORD MaximumSizeLow, 
+	OPTIONAL IN PCWSTR Name)
+/**
+ *	@brief	Creates the mapping of the file, extending the file to the size as Windows does.
+ *	
+ */
+{
+	DIOUM_POSIX_HANDLE *FileHandle = (DIOUM_POSIX_HANDLE *)File;
+	DIOUM_POSIX_HANDLE *Handle;
+	ULONGLONG Length = ((ULONGLONG)MaximumSizeHigh << 32) | MaximumSizeLow;
+	LARGE_INTEGER FileSize;
+
+	(void)SecurityAttributes;
+	(void)Name;
+
+	if (!GetFileSizeEx(File, &FileSize))
+		return NULL;
+
+	if (!Length)
+		Length = (ULONGLONG)FileSize.QuadPart;
+
+	if (!Length)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (Length > (ULONGLONG)FileSize.QuadPart)
+	{
+		if (Protect != PAGE_READWRITE || ftruncate(FileHandle->File, (off_t)Length))
+			return NULL;
+	}
+
+	Handle = (DIOUM_POSIX_HANDLE *)calloc(1, sizeof(*Handle));
+	if (!Handle)
+		return NULL;
+
+	Handle->Type = DIOUM_POSIX_HANDLE_MAPPING;
+	Handle->Length = Length;
+	Handle->Writable = (BOOLEAN)(Protect == PAGE_READWRITE);
+	Handle->File = fcntl(FileHandle->File, F_DUPFD_CLOEXEC, 0);
+
+	if (Handle->File < 0)
+	{
+		free(Handle);
+		return NULL;
+	}
+
+	return (HANDLE)Handle;
+}
+
+LPVOID
+MapViewOfFile(
+	IN HANDLE Mapping, 
+	IN DWORD DesiredAccess, 
+	IN DWORD FileOffsetHigh, 
+	IN DWORD FileOffsetLow, 
+	IN SIZE_T Length)
+{
+	DIOUM_POSIX_HANDLE *Handle = (DIOUM_POSIX_HANDLE *)Mapping;
+	ULONGLONG Offset = ((ULONGLONG)FileOffsetHigh << 32) | FileOffsetLow;
+	DIOUM_POSIX_VIEW *View;
+	int Protection = PROT_READ;
+	PVOID Base;
+
+	if (Offset >= Handle->Length)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (!Length)
+		Length = (SIZE_T)(Handle->Length - Offset);
+
+	if (DesiredAccess & FILE_MAP_WRITE)
+	{
+		if (!Handle->Writable)
+		{
+			errno = EACCES;
+			return NULL;
+		}
+
+		Protection |= PROT_WRITE;
+	}
+
+	View = (DIOUM_POSIX_VIEW *)malloc(sizeof(*View));
+	if (!View)
+		return NULL;
+
+	Base = mmap(NULL, Length, Protection, MAP_SHARED, Handle->File, (off_t)Offset);
+	if (Base == MAP_FAILED)
+	{
+		free(View);
+		return NULL;
+	}
+
+	View->Base = Base;
+	View->Length = Length;
+
+	pthread_mutex_lock(&DiopViewLock);
+	View->Next = DiopViews;
+	DiopViews = View;
+	pthread_mutex_unlock(&DiopViewLock);
+
+	return Base;
+}
+
+BOOL
+UnmapViewOfFile(
+	IN LPVOID BaseAddress)
+{
+	DIOUM_POSIX_VIEW **Link;
+	DIOUM_POSIX_VIEW *View = NULL;
+
+	pthread_mutex_lock(&DiopViewLock);
+
+	for (Link = &DiopViews; *Link; Link = &(*Link)->Next)
+	{
+		if ((*Link)->Base == BaseAddress)
+		{
+			View = *Link;
+			*Link = View->Next;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&DiopViewLock);
+
+	if (!View)
+	{
+		errno = EINVAL;
+		return FALSE;
+	}
+
+	munmap(View->Base, View->Length);
+	free(View);
+
+	return TRUE;
+}
+
+BOOL
+CloseHandle(
+	IN HANDLE Handle)
+{
+	DIOUM_POSIX_HANDLE *Object = (DIOUM_POSIX_HANDLE *)Handle;
+
+	if (!Object || Handle == INVALID_HANDLE_VALUE)
+	{
+		errno = EBADF;
+		return FALSE;
+	}
+
+	close(Object->File);
+	free(Object);
+
+	return TRUE;
+}
+
+VOID
+GetSystemInfo(
+	OUT SYSTEM_INFO *SystemInfo)
+{
+	long PageSize = sysconf(_SC_PAGESIZE);
+	long Processors = sysconf(_SC_NPROCESSORS_ONLN);
+
+	SystemInfo->dwPageSize = (DWORD)PageSize;
+	SystemInfo->dwAllocationGranularity = (DWORD)PageSize;
+	SystemInfo->dwNumberOfProcessors = (DWORD)(Processors > 0 ? Processors : 1);
+}
@@ -0,0 +1,289 @@
+#include <Windows.h>
+#include "../Include/dioctl.h"
+#include "../Include/dioum.h"
+#include "dioum_internal.h"
+
+
+C_ASSERT(sizeof(DIOUM_REACTION_INSTRUCTION) == sizeof(DIO_REACTION_INSTRUCTION));
+C_ASSERT(sizeof(DIOUM_REACTOR_STATUS) == sizeof(DIO_PACKET_QUERY_REACTOR));
+
+
+BOOL
+APIENTRY
+DioLoadReaction(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_REACTION_PROGRAM *Program, 
+	OUT ULONG *Id)
+/**
+ *	@brief	Loads the reaction program to the driver.
+ *	
+ *	The driver runs the program on the reactor ticks, at DISPATCH_LEVEL, and writes the outputs
+ *	which the program stored to the Mask bits of the output ports, within the same tick.\n
+ *	The driver verifies the program on load: every index must be in range, every jump must land
+ *	in the program and the last instruction must be EXIT or JUMP. A program which jumps backward
+ *	must give StepLimit, and the run which exceeds it is aborted without writing the outputs.\n
+ *	Values are in the caller's domain: the read XOR mask is applied to the inputs and the write
+ *	XOR mask to the outputs, as the masks are when the program is loaded.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] Program				Program to load.
+ *	@param	[out] Id					Receives the program id for DioUnloadReaction().
+ *	@return								Non-zero if successful. Fails if the program is invalid or
+ *										DIOUM_REACTION_MAXIMUM_PROGRAMS are loaded.
+ *	
+ */
+{
+	DIO_PACKET_LOAD_REACTION *Packet;
+	DIOUM_REQUEST *Request;
+	ULONG PacketLength;
+	ULONG ReturnedLength = 0;
+	ULONG i;
+	BOOL Result;
+
+	if (!DiopValidateContext(Context) || !Program || !Id)
+		return FALSE;
+
+	if (Program->InputCount > DIOUM_REACTION_MAXIMUM_PORTS || 
+		Program->OutputCount > DIOUM_REACTION_MAXIMUM_PORTS || 
+		!Program->InstructionCount || Program->InstructionCount > DIOUM_REACTION_MAXIMUM_INSTRUCTIONS || 
+		!Program->Instructions)
+		return FALSE;
+
+	PacketLength = PACKET_LOAD_REACTION_GET_LENGTH(Program->InstructionCount);
+
+	Request = DiopAcquireRequest(Context, PacketLength);
+	if (!Request)
+		return FALSE;
+
+	Packet = (DIO_PACKET_LOAD_REACTION *)Request->Buffer;
+
+	ZeroMemory(Packet, sizeof(*Packet));
+	Packet->Trigger = Program->Trigger;
+	Packet->StepLimit = Program->StepLimit;
+	Packet->InputCount = (UCHAR)Program->InputCount;
+	Packet->OutputCount = (UCHAR)Program->OutputCount;
+	Packet->InstructionCount = (USHORT)Program->InstructionCount;
+
+	for (i = 0; i < Program->InputCount; i++)
+	{
+		Packet->Inputs[i].Port = Program->Inputs[i].Port;
+		Packet->Inputs[i].Mask = Program->Inputs[i].Mask;
+		Packet->Inputs[i].XorMask = Context->ReadXorMask;
+	}
+
+	for (i = 0; i < Program->OutputCount; i++)
+	{
+		Packet->Outputs[i].Port = Program->Outputs[i].Port;
+		Packet->Outputs[i].Mask = Program->Outputs[i].Mask;
+		Packet->Outputs[i].XorMask = Context->WriteXorMask;
+	}
+
+	memcpy(Packet->Instructions, Program->Instructions, Program->InstructionCount * sizeof(DIO_REACTION_INSTRUCTION));
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_LOAD_REACTION, 
+		(PVOID)Packet, 
+		PacketLength, 
+		(PVOID)Packet, 
+		sizeof(DIO_PACKET_REACTION_ID), 
+		&ReturnedLength);
+
+	if (Result && ReturnedLength != sizeof(DIO_PACKET_REACTION_ID))
+	{
+		DFTRACE("Length mismatched, assuming failed\n");
+		Result = FALSE;
+	}
+
+	if (Result)
+		*Id = ((DIO_PACKET_REACTION_ID *)Packet)->Id;
+
+	DiopReleaseRequest(Context, Request);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioUnloadReaction(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG Id)
+/**
+ *	@brief	Unloads the reaction program. The program does not run after this returns.
+ *	
+ *	Closing the driver also unloads every program.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] Id						Program id, or DIOUM_REACTION_ALL_PROGRAMS.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIO_PACKET_REACTION_ID *Packet;
+	DIOUM_REQUEST *Request;
+	ULONG ReturnedLength = 0;
+	BOOL Result;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	Request = DiopAcquireRequest(Context, sizeof(*Packet));
+	if (!Request)
+		return FALSE;
+
+	Packet = (DIO_PACKET_REACTION_ID *)Request->Buffer;
+	Packet->Id = Id;
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_UNLOAD_REACTION, 
+		(PVOID)Packet, 
+		sizeof(*Packet), 
+		NULL, 
+		0, 
+		&ReturnedLength);
+
+	DiopReleaseRequest(Context, Request);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioStartReactor(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG TickInterval, 
+	IN ULONG Processor)
+/**
+ *	@brief	Starts the ticks which run the reaction programs in the driver.
+ *	
+ *	Every tick reads the inputs of each program, runs the triggered ones and writes their outputs,
+ *	with the port lock held. So the reaction time is up to one tick interval plus the run time.\n
+ *	The tick thread spins on one processor between the ticks, so pick the processor with care.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] TickInterval			Nanoseconds between the ticks. Must not be zero.
+ *	@param	[in] Processor				Processor to run the ticks, or DIOUM_REACTION_ANY_PROCESSOR.
+ *	@return								Non-zero if successful. Fails if the reactor is already running.
+ *	
+ */
+{
+	DIO_PACKET_START_REACTOR *Packet;
+	DIOUM_REQUEST *Request;
+	ULONG ReturnedLength = 0;
+	BOOL Result;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	Request = DiopAcquireRequest(Context, sizeof(*Packet));
+	if (!Request)
+		return FALSE;
+
+	Packet = (DIO_PACKET_START_REACTOR *)Request->Buffer;
+	Packet->TickInterval = TickInterval;
+	Packet->Processor = Processor;
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_START_REACTOR, 
+		(PVOID)Packet, 
+		sizeof(*Packet), 
+		NULL, 
+		0, 
+		&ReturnedLength);
+
+	DiopReleaseRequest(Context, Request);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioStopReactor(
+	IN DIOUM_DRIVER_CONTEXT *Context)
+/**
+ *	@brief	Stops the ticks of the reactor. Programs remain loaded.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@return								Non-zero if successful, even if the reactor was not running.
+ *	
+ */
+{
+	DIOUM_REQUEST *Request;
+	ULONG ReturnedLength = 0;
+	BOOL Result;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	Request = DiopAcquireRequest(Context, 0);
+	if (!Request)
+		return FALSE;
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_STOP_REACTOR, 
+		NULL, 
+		0, 
+		NULL, 
+		0, 
+		&ReturnedLength);
+
+	DiopReleaseRequest(Context, Request);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioQueryReactor(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OUT DIOUM_REACTOR_STATUS *Status)
+/**
+ *	@brief	Reads the tick counters and the statistics of every program.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[out] Status				Receives the status.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIOUM_REQUEST *Request;
+	ULONG ReturnedLength = 0;
+	BOOL Result;
+
+	if (!DiopValidateContext(Context) || !Status)
+		return FALSE;
+
+	Request = DiopAcquireRequest(Context, sizeof(DIO_PACKET_QUERY_REACTOR));
+	if (!Request)
+		return FALSE;
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_QUERY_REACTOR, 
+		NULL, 
+		0, 
+		(PVOID)Request->Buffer, 
+		sizeof(DIO_PACKET_QUERY_REACTOR), 
+		&ReturnedLength);
+
+	if (Result && ReturnedLength != sizeof(DIO_PACKET_QUERY_REACTOR))
+	{
+		DFTRACE("Length mismatched, assuming failed\n");
+		Result = FALSE;
+	}
+
+	if (Result)
+		memcpy(Status, Request->Buffer, sizeof(*Status));
+
+	DiopReleaseRequest(Context, Request);
+
+	return Result;
+}
@@ -0,0 +1,716 @@
+
+#include <Windows.h>
+#include "../Include/dioctl.h"
+#include "../Include/dioum.h"
+#include "dioum_internal.h"
+
+
+BOOL
+APIENTRY
+DiopMapLogSegment(
+	IN DIOUM_LOG *Log, 
+	IN ULONGLONG SegmentOffset)
+/**
+ *	@brief	Maps the segment of the log file, extending the file.
+ *	
+ *	The previous segment is unmapped. Caller must hold LogLock exclusively.
+ *	
+ *	@param	[in] Log					Log.
+ *	@param	[in] SegmentOffset			File offset of the segment.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	ULARGE_INTEGER MappingLength;
+	ULARGE_INTEGER Offset;
+	HANDLE Mapping;
+	PUCHAR View;
+
+	MappingLength.QuadPart = SegmentOffset + Log->SegmentLength;
+	Offset.QuadPart = SegmentOffset;
+
+	Mapping = CreateFileMappingW(Log->File, NULL, PAGE_READWRITE, 
+		MappingLength.HighPart, MappingLength.LowPart, NULL);
+
+	if (!Mapping)
+	{
+		DFTRACE("CreateFileMapping failed (%d)\n", GetLastError());
+		return FALSE;
+	}
+
+	View = (PUCHAR)MapViewOfFile(Mapping, FILE_MAP_WRITE, Offset.HighPart, Offset.LowPart, Log->SegmentLength);
+
+	if (!View)
+	{
+		DFTRACE("MapViewOfFile failed (%d)\n", GetLastError());
+		CloseHandle(Mapping);
+		return FALSE;
+	}
+
+	if (Log->View)
+	{
+		UnmapViewOfFile(Log->View);
+		CloseHandle(Log->Mapping);
+	}
+
+	Log->Mapping = Mapping;
+	Log->View = View;
+	Log->SegmentOffset = SegmentOffset;
+	Log->Used = 0;
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DiopRecordIoControl(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_REQUEST *Request, 
+	IN ULONG IoControlCode, 
+	IN PVOID InputBuffer, 
+	IN ULONG InputBufferLength, 
+	OUT PVOID OutputBuffer, 
+	IN ULONG OutputBufferLength, 
+	OUT ULONG *ReturnedLength)
+/**
+ *	@brief	Sends the IOCTL and appends it to the log.
+ *	
+ *	Records are appended when the IOCTL is completed, so the order of the records is 
+ *	the completion order. Caller's buffers are copied into the mapped segment directly.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] Request				Request which owns the overlapped structure.
+ *	@param	[in] IoControlCode			IOCTL code.
+ *	@param	[in] InputBuffer			Input buffer.
+ *	@param	[in] InputBufferLength		Input buffer length in bytes.
+ *	@param	[out] OutputBuffer			Output buffer.
+ *	@param	[in] OutputBufferLength		Output buffer length in bytes.
+ *	@param	[out] ReturnedLength		Receives the returned length in bytes.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	UCHAR InlineInput[DIOUM_INLINE_PACKET_LENGTH];
+	PUCHAR Input = (PUCHAR)InputBuffer;
+	LARGE_INTEGER StartTime, EndTime;
+	DIOUM_LOG_RECORD *Record;
+	DIOUM_LOG *Log;
+	ULONGLONG SegmentOffset;
+	ULONG RecordLength;
+	LONG Offset;
+	BOOL Result;
+
+	// Output overwrites the input if the buffer is shared, so the input is saved first.
+	if (InputBuffer == OutputBuffer && InputBufferLength)
+	{
+		Input = InputBufferLength <= sizeof(InlineInput) ? InlineInput : (PUCHAR)DiopAllocate(InputBufferLength);
+
+		if (Input)
+			memcpy(Input, InputBuffer, InputBufferLength);
+	}
+
+	QueryPerformanceCounter(&StartTime);
+
+	Result = DiopIssueIoControl(Context, Request, IoControlCode, 
+		InputBuffer, InputBufferLength, OutputBuffer, OutputBufferLength, ReturnedLength);
+
+	QueryPerformanceCounter(&EndTime);
+
+	RecordLength = (sizeof(*Record) + InputBufferLength + *ReturnedLength + 7) & ~7;
+
+	for (;;)
+	{
+		AcquireSRWLockShared(&Context->LogLock);
+
+		Log = Context->Log;
+
+		if (!Log)
+		{
+			ReleaseSRWLockShared(&Context->LogLock);
+			break;
+		}
+
+		if ((InputBufferLength && !Input) || Log->Failed || RecordLength > Log->SegmentLength)
+		{
+			InterlockedIncrement(&Log->DroppedRecords);
+			ReleaseSRWLockShared(&Context->LogLock);
+			break;
+		}
+
+		do
+		{
+			Offset = Log->Used;
+			if (Offset + RecordLength > Log->SegmentLength)
+				break;
+		} while (InterlockedCompareExchange(&Log->Used, Offset + RecordLength, Offset) != Offset);
+
+		if (Offset + RecordLength <= Log->SegmentLength)
+		{
+			Record = (DIOUM_LOG_RECORD *)(Log->View + Offset);
+			Record->IoControlCode = IoControlCode;
+			Record->ThreadId = GetCurrentThreadId();
+			Record->Result = Result;
+			Record->InputLength = InputBufferLength;
+			Record->OutputLength = *ReturnedLength;
+			Record->StartTime = StartTime.QuadPart - Log->StartTime.QuadPart;
+			Record->Latency = EndTime.QuadPart - StartTime.QuadPart;
+
+			memcpy(Record + 1, Input, InputBufferLength);
+			memcpy((PUCHAR)(Record + 1) + InputBufferLength, OutputBuffer, *ReturnedLength);
+
+			// Length is set last. Reader treats zero as the unused space.
+			Record->Length = RecordLength;
+
+			ReleaseSRWLockShared(&Context->LogLock);
+			break;
+		}
+
+		// Segment is full. Map the next one unless other thread already did it.
+		SegmentOffset = Log->SegmentOffset;
+		ReleaseSRWLockShared(&Context->LogLock);
+
+		AcquireSRWLockExclusive(&Context->LogLock);
+
+		if (Context->Log == Log && Log->SegmentOffset == SegmentOffset && !Log->Failed)
+		{
+			if (!DiopMapLogSegment(Log, SegmentOffset + Log->SegmentLength))
+				Log->Failed = TRUE;
+		}
+
+		ReleaseSRWLockExclusive(&Context->LogLock);
+	}
+
+	if (Input && Input != (PUCHAR)InputBuffer && Input != InlineInput)
+		DiopFree(Input);
+
+	return Result;
+}
+
+ULONG
+APIENTRY
+DiopStopRecording(
+	IN DIOUM_DRIVER_CONTEXT *Context)
+/**
+ *	@brief	Stops the recording and truncates the unused space of the log file.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@return								Count of the dropped records.
+ *	
+ */
+{
+	LARGE_INTEGER FileLength;
+	ULONG DroppedRecords;
+	DIOUM_LOG *Log;
+
+	AcquireSRWLockExclusive(&Context->LogLock);
+	Log = Context->Log;
+	Context->Log = NULL;
+	ReleaseSRWLockExclusive(&Context->LogLock);
+
+	if (!Log)
+		return 0;
+
+	FileLength.QuadPart = Log->SegmentOffset + Log->Used;
+	DroppedRecords = Log->DroppedRecords;
+
+	if (Log->View)
+	{
+		UnmapViewOfFile(Log->View);
+		CloseHandle(Log->Mapping);
+	}
+
+	if (SetFilePointerEx(Log->File, FileLength, NULL, FILE_BEGIN))
+		SetEndOfFile(Log->File);
+
+	CloseHandle(Log->File);
+	DiopFree(Log);
+
+	return DroppedRecords;
+}
+
+BOOL
+APIENTRY
+DioStartRecording(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN PCWSTR FileName, 
+	IN ULONG SegmentLength)
+/**
+ *	@brief	Starts recording every IOCTL of the context to the log file.
+ *	
+ *	Each record holds the IOCTL code, the input, the returned output, the start time and the latency.\n
+ *	The file is written through the mapped segment, so a record costs a reservation and two copies.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] FileName				Log file name. Existing file is overwritten.
+ *	@param	[in] SegmentLength			Length of the mapped segment in bytes. Zero selects the default.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIOUM_LOG_HEADER *Header;
+	SYSTEM_INFO SystemInfo;
+	DIOUM_LOG *Log;
+	ULONG Granularity;
+
+	if (!DiopValidateContext(Context) || !FileName)
+		return FALSE;
+
+	if (!SegmentLength)
+		SegmentLength = DIOUM_LOG_DEFAULT_SEGMENT_LENGTH;
+
+	if (SegmentLength < DIOUM_LOG_MINIMUM_SEGMENT_LENGTH)
+		SegmentLength = DIOUM_LOG_MINIMUM_SEGMENT_LENGTH;
+
+	// Segment offsets must be aligned to the allocation granularity.
+	GetSystemInfo(&SystemInfo);
+	Granularity = SystemInfo.dwAllocationGranularity;
+	SegmentLength = (SegmentLength + Granularity - 1) / Granularity * Granularity;
+
+	Log = (DIOUM_LOG *)DiopAllocate(sizeof(*Log));
+	if (!Log)
+		return FALSE;
+
+	do
+	{
+		Log->SegmentLength = SegmentLength;
+		Log->File = CreateFileW(FileName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, 
+			NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+		if (Log->File == INVALID_HANDLE_VALUE)
+		{
+			DFTRACE("Failed to create the log file (%d)\n", GetLastError());
+			break;
+		}
+
+		if (!DiopMapLogSegment(Log, 0))
+			break;
+
+		QueryPerformanceCounter(&Log->StartTime);
+
+		Header = (DIOUM_LOG_HEADER *)Log->View;
+		Header->Magic = DIOUM_LOG_MAGIC;
+		Header->Version = DIOUM_LOG_VERSION;
+		Header->SegmentLength = SegmentLength;
+		Header->Frequency = Context->PerformanceFrequency.QuadPart;
+		Header->StartTime = Log->StartTime.QuadPart;
+		Log->Used = sizeof(*Header);
+
+		AcquireSRWLockExclusive(&Context->LogLock);
+
+		if (!Context->Log)
+		{
+			Context->Log = Log;
+			Log = NULL;
+		}
+
+		ReleaseSRWLockExclusive(&Context->LogLock);
+
+		if (!Log)
+			return TRUE;
+
+		DFTRACE("Already recording\n");
+
+	} while (FALSE);
+
+	if (Log->View)
+	{
+		UnmapViewOfFile(Log->View);
+		CloseHandle(Log->Mapping);
+	}
+
+	if (Log->File && Log->File != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(Log->File);
+		DeleteFileW(FileName);
+	}
+
+	DiopFree(Log);
+
+	return FALSE;
+}
+
+BOOL
+APIENTRY
+DioStopRecording(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OPTIONAL OUT ULONG *DroppedRecords)
+/**
+ *	@brief	Stops the recording.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[out, opt] DroppedRecords	Receives the count of records which could not be written.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	ULONG Dropped;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	Dropped = DiopStopRecording(Context);
+
+	if (DroppedRecords)
+		*DroppedRecords = Dropped;
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DiopSimulateIoControl(
+	IN PUCHAR Ports, 
+	IN ULONG IoControlCode, 
+	IN PUCHAR Buffer, 
+	IN ULONG InputLength, 
+	IN ULONG OutputLength, 
+	OUT ULONG *ReturnedLength)
+/**
+ *	@brief	Serves the port I/O packet from the simulated port space.
+ *	
+ *	@param	[in] Ports					Simulated port space of 0x10000 bytes.
+ *	@param	[in] IoControlCode			IOCTL code.
+ *	@param	[in, out] Buffer			Packet buffer which is used as the input and output.
+ *	@param	[in] InputLength			Input length in bytes.
+ *	@param	[in] OutputLength			Output length in bytes.
+ *	@param	[out] ReturnedLength		Receives the returned length in bytes.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIO_PACKET_PORT_IO *PortIo = (DIO_PACKET_PORT_IO *)Buffer;
+	ULONG RangeCount;
+	ULONG DataLength = 0;
+	ULONG Length;
+	PUCHAR Data;
+	ULONG i;
+
+	*ReturnedLength = 0;
+
+	if (InputLength < sizeof(*PortIo))
+		return FALSE;
+
+	RangeCount = PACKET_PORT_IO_GET_RANGE_COUNT(PortIo);
+	if (RangeCount > DIO_MAXIMUM_PORT_RANGES || InputLength < PACKET_PORT_IO_GET_LENGTH(RangeCount))
+		return FALSE;
+
+	for (i = 0; i < RangeCount; i++)
+	{
+		if (PortIo->AddressRange[i].StartAddress > PortIo->AddressRange[i].EndAddress)
+			return FALSE;
+
+		DataLength += PortIo->AddressRange[i].EndAddress - PortIo->AddressRange[i].StartAddress + 1;
+	}
+
+	Length = PACKET_PORT_IO_GET_LENGTH(RangeCount);
+	if (IoControlCode == DIO_IOCTL_READ_PORT)
+		Length += DataLength;
+	else if (InputLength < Length + DataLength)
+		return FALSE;
+
+	if (PortIo->RangeCount & DIO_PORT_IO_FLAG_TIMESTAMP)
+		Length += sizeof(DIO_PORT_IO_TIMESTAMP);
+
+	if (PortIo->RangeCount & DIO_PORT_IO_FLAG_GROUP)
+		Length += sizeof(DIO_PORT_IO_SKEW);
+
+	if (OutputLength < Length)
+		return FALSE;
+
+	Data = PACKET_PORT_IO_GET_DATA_ADDRESS(PortIo);
+
+	for (i = 0; i < RangeCount; i++)
+	{
+		ULONG RangeLength = PortIo->AddressRange[i].EndAddress - PortIo->AddressRange[i].StartAddress + 1;
+
+		if (IoControlCode == DIO_IOCTL_READ_PORT)
+			memcpy(Data, Ports + PortIo->AddressRange[i].StartAddress, RangeLength);
+		else
+			memcpy(Ports + PortIo->AddressRange[i].StartAddress, Data, RangeLength);
+
+		Data += RangeLength;
+	}
+
+	// Simulated I/O takes no time.
+	if (PortIo->RangeCount & (DIO_PORT_IO_FLAG_TIMESTAMP | DIO_PORT_IO_FLAG_GROUP))
+	{
+		ULONG TrailerLength = 0;
+
+		if (PortIo->RangeCount & DIO_PORT_IO_FLAG_TIMESTAMP)
+			TrailerLength += sizeof(DIO_PORT_IO_TIMESTAMP);
+
+		if (PortIo->RangeCount & DIO_PORT_IO_FLAG_GROUP)
+			TrailerLength += sizeof(DIO_PORT_IO_SKEW);
+
+		ZeroMemory(Buffer + Length - TrailerLength, TrailerLength);
+	}
+
+	*ReturnedLength = Length;
+
+	return TRUE;
+}
+
+VOID
+APIENTRY
+DiopWaitReplayTime(
+	IN LONGLONG Deadline)
+/**
+ *	@brief	Waits until the performance counter reaches the deadline.
+ *	
+ *	@param	[in] Deadline				Performance counter value.
+ *	@return								None.
+ *	
+ */
+{
+	LARGE_INTEGER Frequency, Now;
+
+	QueryPerformanceFrequency(&Frequency);
+
+	for (;;)
+	{
+		QueryPerformanceCounter(&Now);
+		if (Now.QuadPart >= Deadline)
+			break;
+
+		// Sleep while the deadline is far, then spin for the accuracy.
+		if ((Deadline - Now.QuadPart) * 1000 / Frequency.QuadPart > 2)
+			Sleep(1);
+		else
+			YieldProcessor();
+	}
+}
+
+BOOL
+APIENTRY
+DioReplayLog(
+	OPTIONAL IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN PCWSTR FileName, 
+	IN ULONG Flags, 
+	OPTIONAL OUT DIOUM_REPLAY_STATISTICS *Statistics)
+/**
+ *	@brief	Replays the recorded port I/O and compares the latency with the recording.
+ *	
+ *	Records are replayed one by one in the recorded order. Only the port reads and writes are 
+ *	replayed, and the data is sent as recorded (XOR masks are already applied).\n
+ *	Simulated backend starts with zeroed ports. Recorded read data is stored back to it, 
+ *	so reads mismatch only where the ports changed without a write.
+ *	
+ *	@param	[in, opt] Context			Driver context. Replays against the simulated ports if NULL.
+ *	@param	[in] FileName				Log file name.
+ *	@param	[in] Flags					DIOUM_REPLAY_XXX.
+ *	@param	[out, opt] Statistics		Receives the statistics.
+ *	@return								Non-zero if the whole log is replayed.
+ *	
+ */
+{
+	DIOUM_REPLAY_STATISTICS Stats;
+	DIOUM_LOG_HEADER *Header;
+	DIOUM_REQUEST *Request = NULL;
+	LARGE_INTEGER Frequency, StartTime, Before, After;
+	LARGE_INTEGER FileLength;
+	HANDLE File = INVALID_HANDLE_VALUE;
+	HANDLE Mapping = NULL;
+	PUCHAR View = NULL;
+	PUCHAR Ports = NULL;
+	PUCHAR Buffer = NULL;
+	ULONG BufferLength = 0;
+	ULONGLONG Position;
+	BOOL Result = FALSE;
+
+	if (Context && !DiopValidateContext(Context))
+		return FALSE;
+
+	if (!FileName)
+		return FALSE;
+
+	ZeroMemory(&Stats, sizeof(Stats));
+	QueryPerformanceFrequency(&Frequency);
+
+	do
+	{
+		File = CreateFileW(FileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (File == INVALID_HANDLE_VALUE)
+			break;
+
+		if (!GetFileSizeEx(File, &FileLength) || FileLength.QuadPart < 0 || 
+			(ULONGLONG)FileLength.QuadPart < sizeof(*Header) || 
+			(ULONGLONG)FileLength.QuadPart != (SIZE_T)FileLength.QuadPart)
+			break;
+
+		Mapping = CreateFileMappingW(File, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (!Mapping)
+			break;
+
+		View = (PUCHAR)MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!View)
+			break;
+
+		Header = (DIOUM_LOG_HEADER *)View;
+		if (Header->Magic != DIOUM_LOG_MAGIC || Header->Version != DIOUM_LOG_VERSION || 
+			Header->SegmentLength < DIOUM_LOG_MINIMUM_SEGMENT_LENGTH || !Header->Frequency)
+		{
+			DFTRACE("Invalid log header\n");
+			break;
+		}
+
+		if (Context)
+		{
+			Request = DiopAcquireRequest(Context, 0);
+			if (!Request)
+				break;
+		}
+		else
+		{
+			Ports = (PUCHAR)DiopAllocate(0x10000);
+			if (!Ports)
+				break;
+		}
+
+		QueryPerformanceCounter(&StartTime);
+		Position = sizeof(*Header);
+		Result = TRUE;
+
+		while (Position + sizeof(DIOUM_LOG_RECORD) <= (ULONGLONG)FileLength.QuadPart)
+		{
+			DIOUM_LOG_RECORD *Record = (DIOUM_LOG_RECORD *)(View + Position);
+			PUCHAR RecordedOutput;
+			ULONG PacketLength;
+			ULONG ReturnedLength = 0;
+			BOOL IoResult;
+			LONGLONG RecordedLatency, ReplayedLatency, Difference;
+
+			if (!Record->Length)
+			{
+				// Rest of the segment is unused.
+				Position = (Position / Header->SegmentLength + 1) * Header->SegmentLength;
+				continue;
+			}
+
+			if (Record->Length < sizeof(*Record) || Record->Length > FileLength.QuadPart - Position || 
+				Record->InputLength > Record->Length - sizeof(*Record) || 
+				Record->OutputLength > Record->Length - sizeof(*Record) - Record->InputLength)
+			{
+				DFTRACE("Corrupted record at 0x%llx\n", Position);
+				Result = FALSE;
+				break;
+			}
+
+			Position += Record->Length;
+			Stats.RecordCount++;
+
+			if (Record->IoControlCode != DIO_IOCTL_READ_PORT && Record->IoControlCode != DIO_IOCTL_WRITE_PORT)
+			{
+				Stats.SkippedCount++;
+				continue;
+			}
+
+			PacketLength = max(Record->InputLength, Record->OutputLength);
+
+			if (PacketLength > BufferLength)
+			{
+				if (Buffer)
+					DiopFree(Buffer);
+
+				Buffer = (PUCHAR)DiopAllocate(PacketLength);
+				BufferLength = Buffer ? PacketLength : 0;
+
+				if (!Buffer)
+				{
+					Result = FALSE;
+					break;
+				}
+			}
+
+			memcpy(Buffer, Record + 1, Record->InputLength);
+			RecordedOutput = (PUCHAR)(Record + 1) + Record->InputLength;
+
+			if (Flags & DIOUM_REPLAY_ORIGINAL_TIMING)
+				DiopWaitReplayTime(StartTime.QuadPart + DiopScaleTicks(Record->StartTime, Header->Frequency, Frequency.QuadPart));
+
+			QueryPerformanceCounter(&Before);
+
+			if (Context)
+			{
+				IoResult = DiopIssueIoControl(Context, Request, Record->IoControlCode, 
+					Buffer, Record->InputLength, Buffer, Record->OutputLength, &ReturnedLength);
+			}
+			else
+			{
+				IoResult = DiopSimulateIoControl(Ports, Record->IoControlCode, 
+					Buffer, Record->InputLength, Record->OutputLength, &ReturnedLength);
+			}
+
+			QueryPerformanceCounter(&After);
+
+			Stats.ReplayedCount++;
+
+			if (!IoResult != !Record->Result || ReturnedLength != Record->OutputLength)
+				Stats.FailedCount++;
+
+			if (Record->IoControlCode == DIO_IOCTL_READ_PORT && IoResult && ReturnedLength == Record->OutputLength)
+			{
+				DIO_PACKET_PORT_IO *PortIo = (DIO_PACKET_PORT_IO *)Buffer;
+				ULONG DataOffset = PACKET_PORT_IO_GET_LENGTH(PACKET_PORT_IO_GET_RANGE_COUNT(PortIo));
+				ULONG DataLength = ReturnedLength - DataOffset;
+
+				// Timestamps and skews always differ.
+				if (PortIo->RangeCount & DIO_PORT_IO_FLAG_TIMESTAMP)
+					DataLength -= sizeof(DIO_PORT_IO_TIMESTAMP);
+
+				if (PortIo->RangeCount & DIO_PORT_IO_FLAG_GROUP)
+					DataLength -= sizeof(DIO_PORT_IO_SKEW);
+
+				if (memcmp(Buffer + DataOffset, RecordedOutput + DataOffset, DataLength))
+				{
+					Stats.MismatchCount++;
+
+					if (Ports)
+					{
+						// Follow the recorded inputs.
+						PortIo->RangeCount &= DIO_PORT_IO_RANGE_COUNT_MASK;
+						memcpy(Buffer + DataOffset, RecordedOutput + DataOffset, DataLength);
+						DiopSimulateIoControl(Ports, DIO_IOCTL_WRITE_PORT, 
+							Buffer, DataOffset + DataLength, DataOffset, &ReturnedLength);
+					}
+				}
+			}
+
+			RecordedLatency = DiopScaleTicks(Record->Latency, Header->Frequency, 1000000000);
+			ReplayedLatency = DiopScaleTicks(After.QuadPart - Before.QuadPart, Frequency.QuadPart, 1000000000);
+			Difference = ReplayedLatency - RecordedLatency;
+
+			Stats.RecordedLatency += RecordedLatency;
+			Stats.ReplayedLatency += ReplayedLatency;
+
+			if (Stats.ReplayedCount == 1 || Difference > Stats.MaximumLatencyDifference)
+				Stats.MaximumLatencyDifference = Difference;
+
+			if (Stats.ReplayedCount == 1 || Difference < Stats.MinimumLatencyDifference)
+				Stats.MinimumLatencyDifference = Difference;
+		}
+
+	} while (FALSE);
+
+	if (Buffer)
+		DiopFree(Buffer);
+
+	if (Ports)
+		DiopFree(Ports);
+
+	if (Request)
+		DiopReleaseRequest(Context, Request);
+
+	if (View)
+		UnmapViewOfFile(View);
+
+	if (Mapping)
+		CloseHandle(Mapping);
+
+	if (File != INVALID_HANDLE_VALUE)
+		CloseHandle(File);
+
+	if (Statistics)
+		*Statistics = Stats;
+
+	return Result;
+}
@@ -0,0 +1,339 @@
+#include <Windows.h>
+#include "../Include/dioctl.h"
+#include "../Include/dioring.h"
+#include "../Include/dioum.h"
+#include "dioum_internal.h"
+
+
+C_ASSERT(sizeof(DIOUM_RING_SUBMISSION) == sizeof(DIO_RING_SUBMISSION));
+C_ASSERT(sizeof(DIOUM_RING_COMPLETION) == sizeof(DIO_RING_COMPLETION));
+
+/**
+ *	@brief	Submission and completion rings of the context.
+ */
+typedef struct _DIOUM_RING {
+	SRWLOCK SubmitLock;				// Serializes the producer of the submissions
+	SRWLOCK ReapLock;				// Serializes the consumer of the completions
+	DIO_RING_PRODUCER Producer;
+	BOOLEAN Polled;					// Driver thread polls the submissions
+} DIOUM_RING;
+
+
+BOOL
+APIENTRY
+DiopRingDoorbell(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG IoControlCode)
+/**
+ *	@brief	Sends the ring IOCTL which has no input.
+ *	
+ *	This function is reserved for internal use.
+ *	
+ */
+{
+	DIOUM_REQUEST *Request;
+	ULONG OutputLength = (IoControlCode == DIO_IOCTL_ENTER_RING) ? sizeof(DIO_PACKET_ENTER_RING) : 0;
+	ULONG ReturnedLength = 0;
+	BOOL Result;
+
+	Request = DiopAcquireRequest(Context, OutputLength);
+	if (!Request)
+		return FALSE;
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		IoControlCode, 
+		NULL, 
+		0, 
+		OutputLength ? (PVOID)Request->Buffer : NULL, 
+		OutputLength, 
+		&ReturnedLength);
+
+	if (Result && ReturnedLength != OutputLength)
+	{
+		DFTRACE("Length mismatched, assuming failed\n");
+		Result = FALSE;
+	}
+
+	DiopReleaseRequest(Context, Request);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioCreateRing(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG SubmissionEntries, 
+	IN ULONG Flags, 
+	IN ULONG Processor, 
+	IN ULONG IdleTime)
+/**
+ *	@brief	Creates the submission and completion rings which are shared with the driver.
+ *	
+ *	Port operations which are queued with DioRingSubmit() are run by the driver in order, and
+ *	their results are taken with DioRingReap(). Without DIOUM_RING_FLAG_POLL, DioRingSubmit() runs
+ *	the queued operations with one IOCTL. With it, a driver thread polls the ring, so no IOCTL is
+ *	made while the caller keeps submitting within IdleTime.\n
+ *	The polling thread spins on one processor while it polls, so pick the processor with care.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] SubmissionEntries		Power of two, DIOUM_RING_MINIMUM_ENTRIES ~ DIOUM_RING_MAXIMUM_ENTRIES.
+ *	@param	[in] Flags					Combination of DIOUM_RING_FLAG_XXX.
+ *	@param	[in] Processor				Processor of the polling thread, or DIOUM_RING_ANY_PROCESSOR.
+ *	@param	[in] IdleTime				Microseconds to poll after the last submission before the
+ *										polling thread sleeps. Up to DIOUM_RING_MAXIMUM_IDLE_TIME.
+ *	@return								Non-zero if successful. Fails if the ring already exists.
+ *	
+ */
+{
+	DIO_PACKET_CREATE_RING *Packet;
+	DIO_PACKET_RING_ADDRESS Address;
+	DIOUM_REQUEST *Request;
+	DIOUM_RING *Ring;
+	ULONG ReturnedLength = 0;
+	BOOL Result;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	if (!DioRingIsValidEntries(SubmissionEntries) || (Flags & ~DIOUM_RING_FLAG_POLL))
+		return FALSE;
+
+	Ring = (DIOUM_RING *)DiopAllocate(sizeof(*Ring));
+	if (!Ring)
+		return FALSE;
+
+	InitializeSRWLock(&Ring->SubmitLock);
+	InitializeSRWLock(&Ring->ReapLock);
+	Ring->Polled = (BOOLEAN)((Flags & DIOUM_RING_FLAG_POLL) != 0);
+
+	AcquireSRWLockExclusive(&Context->RingLock);
+
+	do
+	{
+		Result = FALSE;
+
+		if (Context->Ring)
+		{
+			DFTRACE("Ring already exists\n");
+			break;
+		}
+
+		Request = DiopAcquireRequest(Context, sizeof(DIO_PACKET));
+		if (!Request)
+			break;
+
+		Packet = (DIO_PACKET_CREATE_RING *)Request->Buffer;
+		Packet->SubmissionEntries = SubmissionEntries;
+		Packet->Flags = Ring->Polled ? DIO_RING_CREATE_FLAG_POLL : 0;
+		Packet->Processor = Processor;
+		Packet->IdleTime = IdleTime;
+
+		Result = DiopDeviceIoControl(
+			Context, 
+			Request, 
+			DIO_IOCTL_CREATE_RING, 
+			(PVOID)Packet, 
+			sizeof(*Packet), 
+			(PVOID)Request->Buffer, 
+			sizeof(DIO_PACKET_RING_ADDRESS), 
+			&ReturnedLength);
+
+		if (Result && ReturnedLength != sizeof(DIO_PACKET_RING_ADDRESS))
+		{
+			DFTRACE("Length mismatched, assuming failed\n");
+			Result = FALSE;
+		}
+
+		if (Result)
+			memcpy(&Address, Request->Buffer, sizeof(Address));
+
+		DiopReleaseRequest(Context, Request);
+
+		if (!Result)
+			break;
+
+		if (!DioRingProducerInitialize(&Ring->Producer, (PVOID)(ULONG_PTR)Address.Address, Address.Length))
+		{
+			DFTRACE("Invalid ring layout\n");
+			DiopRingDoorbell(Context, DIO_IOCTL_DESTROY_RING);
+			Result = FALSE;
+			break;
+		}
+
+		Context->Ring = Ring;
+	} while (FALSE);
+
+	ReleaseSRWLockExclusive(&Context->RingLock);
+
+	if (!Result)
+		DiopFree(Ring);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioDestroyRing(
+	IN DIOUM_DRIVER_CONTEXT *Context)
+/**
+ *	@brief	Destroys the rings. Pending submissions are dropped.
+ *	
+ *	Closing the driver also destroys the rings.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@return								Non-zero if successful. Fails if no ring exists.
+ *	
+ */
+{
+	DIOUM_RING *Ring;
+	BOOL Result;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	AcquireSRWLockExclusive(&Context->RingLock);
+
+	Ring = Context->Ring;
+	Context->Ring = NULL;
+
+	// Shared memory is unmapped by the driver.
+	Result = Ring && DiopRingDoorbell(Context, DIO_IOCTL_DESTROY_RING);
+
+	ReleaseSRWLockExclusive(&Context->RingLock);
+
+	if (Ring)
+		DiopFree(Ring);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioRingSubmit(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RING_SUBMISSION *Submissions, 
+	IN ULONG SubmissionCount, 
+	OPTIONAL OUT ULONG *SubmittedCount)
+/**
+ *	@brief	Queues the port operations to the ring.
+ *	
+ *	Operations are queued as far as the submission ring has space, and published at once.
+ *	Then the driver is told with the doorbell IOCTL, unless the polling thread is awake.
+ *	Without DIOUM_RING_FLAG_POLL, the operations are run when this returns, as far as the
+ *	completion ring has space. So reap the completions before it fills up.\n
+ *	Data is in the caller's domain: the write XOR mask is applied to WRITE and MODIFY.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] Submissions			Operations to queue.
+ *	@param	[in] SubmissionCount		Count of Submissions.
+ *	@param	[out] SubmittedCount		Receives the count of queued operations. Optional.
+ *	@return								Non-zero if successful, even if the ring is full.
+ *	
+ */
+{
+	DIOUM_RING *Ring;
+	DIO_RING_SUBMISSION Submission;
+	ULONG Count = 0;
+	BOOL NeedsDoorbell = FALSE;
+	BOOL Result = FALSE;
+
+	if (!DiopValidateContext(Context) || (SubmissionCount && !Submissions))
+		return FALSE;
+
+	AcquireSRWLockShared(&Context->RingLock);
+
+	Ring = Context->Ring;
+	if (Ring)
+	{
+		AcquireSRWLockExclusive(&Ring->SubmitLock);
+
+		for (Count = 0; Count < SubmissionCount; Count++)
+		{
+			memcpy(&Submission, &Submissions[Count], sizeof(Submission));
+
+			if (Submission.Operation == DIO_RING_OP_WRITE || Submission.Operation == DIO_RING_OP_MODIFY)
+				Submission.Data ^= Context->WriteXorMask;
+
+			if (!DioRingProducerPrepare(&Ring->Producer, &Submission))
+				break;
+		}
+
+		if (DioRingProducerSubmit(&Ring->Producer))
+			NeedsDoorbell = !Ring->Polled || DioRingProducerNeedsWakeup(&Ring->Producer);
+
+		ReleaseSRWLockExclusive(&Ring->SubmitLock);
+
+		Result = NeedsDoorbell ? DiopRingDoorbell(Context, DIO_IOCTL_ENTER_RING) : TRUE;
+	}
+
+	ReleaseSRWLockShared(&Context->RingLock);
+
+	if (SubmittedCount)
+		*SubmittedCount = Count;
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioRingReap(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OUT DIOUM_RING_COMPLETION *Completions, 
+	IN ULONG MaximumCount, 
+	OUT ULONG *CompletionCount)
+/**
+ *	@brief	Takes the results of the operations, in the order of the submissions.
+ *	
+ *	Does not wait. Data is in the caller's domain: the read XOR mask is applied to READ and MODIFY.\n
+ *	Polling thread sleeps while the completion ring is full, so it is woken up here if the
+ *	submissions are waiting for the space.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[out] Completions			Receives the results.
+ *	@param	[in] MaximumCount			Count of results which Completions can hold.
+ *	@param	[out] CompletionCount		Receives the count of results.
+ *	@return								Non-zero if successful, even if no result is taken.
+ *	
+ */
+{
+	DIOUM_RING *Ring;
+	ULONG Count = 0;
+	BOOL NeedsDoorbell = FALSE;
+	BOOL Result = FALSE;
+	ULONG i;
+
+	if (!DiopValidateContext(Context) || !Completions || !CompletionCount)
+		return FALSE;
+
+	AcquireSRWLockShared(&Context->RingLock);
+
+	Ring = Context->Ring;
+	if (Ring)
+	{
+		AcquireSRWLockExclusive(&Ring->ReapLock);
+		Count = DioRingProducerReap(&Ring->Producer, (DIO_RING_COMPLETION *)Completions, MaximumCount);
+
+		if (Count && Ring->Polled)
+			NeedsDoorbell = DioRingProducerNeedsWakeupAfterReap(&Ring->Producer);
+
+		ReleaseSRWLockExclusive(&Ring->ReapLock);
+
+		Result = NeedsDoorbell ? DiopRingDoorbell(Context, DIO_IOCTL_ENTER_RING) : TRUE;
+	}
+
+	ReleaseSRWLockShared(&Context->RingLock);
+
+	for (i = 0; i < Count; i++)
+	{
+		if (Completions[i].Status == DIOUM_RING_STATUS_SUCCESS && 
+			(Completions[i].Operation == DIOUM_RING_OP_READ || Completions[i].Operation == DIOUM_RING_OP_MODIFY))
+			Completions[i].Data ^= Context->ReadXorMask;
+	}
+
+	*CompletionCount = Count;
+
+	return Result;
+}
@@ -0,0 +1,372 @@
+#include <Windows.h>
+#include "../Include/dioctl.h"
+#include "../Include/dioum.h"
+#include "dioum_internal.h"
+
+
+C_ASSERT(sizeof(DIOUM_SCHEDULE_RECORD) == sizeof(DIO_SCHEDULE_RECORD));
+C_ASSERT(sizeof(DIOUM_SCHEDULER_STATUS) == sizeof(DIO_PACKET_QUERY_SCHEDULER));
+
+
+BOOL
+APIENTRY
+DiopAcquireCalibratedClock(
+	IN DIOUM_DRIVER_CONTEXT *Context)
+/**
+ *	@brief	Acquires ClockLock shared, calibrating the clock first if needed.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@return								Non-zero if ClockLock is held and the clock is calibrated.
+ *	
+ */
+{
+	AcquireSRWLockShared(&Context->ClockLock);
+
+	if (Context->ClockCalibrated)
+		return TRUE;
+
+	ReleaseSRWLockShared(&Context->ClockLock);
+	AcquireSRWLockExclusive(&Context->ClockLock);
+
+	// Recheck since other thread may have calibrated it.
+	if (!Context->ClockCalibrated && !DiopCalibrateClock(Context, DIOUM_CLOCK_DEFAULT_SAMPLES))
+	{
+		ReleaseSRWLockExclusive(&Context->ClockLock);
+		return FALSE;
+	}
+
+	ReleaseSRWLockExclusive(&Context->ClockLock);
+
+	// Calibration is never cleared, so it holds after the lock is taken again.
+	AcquireSRWLockShared(&Context->ClockLock);
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DioStartScheduler(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG Capacity, 
+	IN ULONG Processor)
+/**
+ *	@brief	Starts the output scheduler in the driver.
+ *	
+ *	The scheduler thread sleeps while the next deadline is far, and spins on one processor
+ *	for the last 2 milliseconds, so pick the processor with care.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] Capacity				Maximum count of pending entries (1 ~ DIOUM_SCHEDULE_MAXIMUM_CAPACITY).
+ *	@param	[in] Processor				Processor to run the scheduler, or DIOUM_SCHEDULE_ANY_PROCESSOR.
+ *	@return								Non-zero if successful. Fails if the scheduler is already running.
+ *	
+ */
+{
+	DIO_PACKET_START_SCHEDULER *Packet;
+	DIOUM_REQUEST *Request;
+	ULONG ReturnedLength = 0;
+	BOOL Result;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	if (!Capacity || Capacity > DIOUM_SCHEDULE_MAXIMUM_CAPACITY)
+		return FALSE;
+
+	Request = DiopAcquireRequest(Context, sizeof(*Packet));
+	if (!Request)
+		return FALSE;
+
+	Packet = (DIO_PACKET_START_SCHEDULER *)Request->Buffer;
+	Packet->Capacity = Capacity;
+	Packet->Processor = Processor;
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_START_SCHEDULER, 
+		(PVOID)Packet, 
+		sizeof(*Packet), 
+		NULL, 
+		0, 
+		&ReturnedLength);
+
+	DiopReleaseRequest(Context, Request);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioStopScheduler(
+	IN DIOUM_DRIVER_CONTEXT *Context)
+/**
+ *	@brief	Stops the output scheduler. Pending entries are dropped.
+ *	
+ *	Statistics remain readable until the next start. Closing the driver also stops the scheduler.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@return								Non-zero if successful, even if the scheduler was not running.
+ *	
+ */
+{
+	DIOUM_REQUEST *Request;
+	ULONG ReturnedLength = 0;
+	BOOL Result;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	Request = DiopAcquireRequest(Context, 0);
+	if (!Request)
+		return FALSE;
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_STOP_SCHEDULER, 
+		NULL, 
+		0, 
+		NULL, 
+		0, 
+		&ReturnedLength);
+
+	DiopReleaseRequest(Context, Request);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioScheduleOutput(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG EntryCount, 
+	IN DIOUM_SCHEDULE_ENTRY *Entries, 
+	OPTIONAL OUT ULONG *AcceptedCount)
+/**
+ *	@brief	Queues the port writes which run at the given times.
+ *	
+ *	Times are in the application clock (QueryPerformanceCounter), and are converted with the clock
+ *	correlation, which is calibrated on first use. Data is in the caller's domain: the write XOR
+ *	mask is applied. Entries of the same time run in the order they are given.\n
+ *	Entries are accepted in order until the queue is full. Nothing is queued if any entry is invalid,
+ *	including a time further than DIOUM_SCHEDULE_MAXIMUM_HORIZON seconds from now.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] EntryCount				Count of Entries.
+ *	@param	[in] Entries				Entries to queue.
+ *	@param	[out, opt] AcceptedCount	Receives the count of queued entries.
+ *	@return								Non-zero if all entries are queued.
+ *	
+ */
+{
+	DIO_PACKET_SCHEDULE_OUTPUT *Packet;
+	DIOUM_REQUEST *Request;
+	ULONG PacketLength;
+	ULONG ReturnedLength = 0;
+	ULONG i, j;
+	BOOL Result;
+
+	if (AcceptedCount)
+		*AcceptedCount = 0;
+
+	if (!DiopValidateContext(Context) || (EntryCount && !Entries))
+		return FALSE;
+
+	if (EntryCount > DIOUM_SCHEDULE_MAXIMUM_CAPACITY)
+		return FALSE;
+
+	for (i = 0; i < EntryCount; i++)
+	{
+		if (!Entries[i].Length || Entries[i].Length > DIOUM_SCHEDULE_MAXIMUM_LENGTH || 
+			Entries[i].Operation > DIOUM_SCHEDULE_TOGGLE)
+			return FALSE;
+	}
+
+	PacketLength = sizeof(DIO_PACKET_SCHEDULE_OUTPUT) + EntryCount * sizeof(DIO_SCHEDULE_ENTRY);
+
+	Request = DiopAcquireRequest(Context, PacketLength);
+	if (!Request)
+		return FALSE;
+
+	Packet = (DIO_PACKET_SCHEDULE_OUTPUT *)Request->Buffer;
+	Packet->EntryCount = EntryCount;
+
+	if (!DiopAcquireCalibratedClock(Context))
+	{
+		DiopReleaseRequest(Context, Request);
+		return FALSE;
+	}
+
+	for (i = 0; i < EntryCount; i++)
+	{
+		DIOUM_SCHEDULE_ENTRY *Source = &Entries[i];
+		DIO_SCHEDULE_ENTRY *Entry = &Packet->Entries[i];
+
+		Entry->Time = DiopConvertApplicationTime(Context, Source->Time);
+		Entry->Tag = Source->Tag;
+		Entry->Port = Source->Port;
+		Entry->Length = Source->Length;
+
+		for (j = 0; j < DIO_SCHEDULE_MAXIMUM_LENGTH; j++)
+		{
+			UCHAR Mask = Source->Mask[j];
+			UCHAR Data = Source->Data[j];
+
+			// SET and CLEAR are MODIFY with fixed data. TOGGLE does not depend on the XOR mask.
+			switch (Source->Operation)
+			{
+			case DIOUM_SCHEDULE_WRITE:
+				Entry->Operation = DIO_SCHEDULE_OP_WRITE;
+				Mask = 0xff;
+				break;
+
+			case DIOUM_SCHEDULE_SET:
+				Entry->Operation = DIO_SCHEDULE_OP_MODIFY;
+				Data = 0xff;
+				break;
+
+			case DIOUM_SCHEDULE_CLEAR:
+				Entry->Operation = DIO_SCHEDULE_OP_MODIFY;
+				Data = 0x00;
+				break;
+
+			case DIOUM_SCHEDULE_MODIFY:
+				Entry->Operation = DIO_SCHEDULE_OP_MODIFY;
+				break;
+
+			default:
+				Entry->Operation = DIO_SCHEDULE_OP_TOGGLE;
+				Data = 0x00;
+				break;
+			}
+
+			if (Entry->Operation != DIO_SCHEDULE_OP_TOGGLE)
+				Data = (Data ^ Context->WriteXorMask) & Mask;
+
+			Entry->Data[j] = Data;
+			Entry->Mask[j] = Mask;
+		}
+	}
+
+	ReleaseSRWLockShared(&Context->ClockLock);
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_SCHEDULE_OUTPUT, 
+		(PVOID)Packet, 
+		PacketLength, 
+		(PVOID)Packet, 
+		sizeof(*Packet), 
+		&ReturnedLength);
+
+	if (Result && ReturnedLength != sizeof(*Packet))
+	{
+		DFTRACE("Length mismatched, assuming failed\n");
+		Result = FALSE;
+	}
+
+	if (Result)
+	{
+		if (AcceptedCount)
+			*AcceptedCount = Packet->EntryCount;
+
+		Result = (Packet->EntryCount == EntryCount);
+	}
+
+	DiopReleaseRequest(Context, Request);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioQueryScheduler(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OUT DIOUM_SCHEDULER_STATUS *Status, 
+	OPTIONAL OUT DIOUM_SCHEDULE_RECORD *Records, 
+	IN ULONG MaximumRecordCount)
+/**
+ *	@brief	Reads the scheduler statistics, and the lateness records of the fired entries.
+ *	
+ *	Records are removed from the driver once read. The driver keeps the last
+ *	DIOUM_SCHEDULE_RECORD_COUNT records, and counts the older ones in LostRecords.\n
+ *	Record times are converted to the application clock.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[out] Status				Receives the statistics. RecordCount is the count of Records.
+ *	@param	[out, opt] Records			Receives the records, oldest first.
+ *	@param	[in] MaximumRecordCount		Count of Records. Zero to leave the records in the driver.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIO_PACKET_QUERY_SCHEDULER *Packet;
+	DIOUM_REQUEST *Request;
+	ULONG ReturnedLength = 0;
+	ULONG OutputLength;
+	ULONG i;
+	BOOL Result;
+
+	if (!DiopValidateContext(Context) || !Status)
+		return FALSE;
+
+	if (!Records || MaximumRecordCount > DIOUM_SCHEDULE_RECORD_COUNT)
+		MaximumRecordCount = Records ? DIOUM_SCHEDULE_RECORD_COUNT : 0;
+
+	// Calibrate before the records are removed from the driver, so the conversion cannot fail.
+	if (MaximumRecordCount)
+	{
+		if (!DiopAcquireCalibratedClock(Context))
+			return FALSE;
+
+		ReleaseSRWLockShared(&Context->ClockLock);
+	}
+
+	OutputLength = sizeof(DIO_PACKET_QUERY_SCHEDULER) + MaximumRecordCount * sizeof(DIO_SCHEDULE_RECORD);
+
+	Request = DiopAcquireRequest(Context, OutputLength);
+	if (!Request)
+		return FALSE;
+
+	Packet = (DIO_PACKET_QUERY_SCHEDULER *)Request->Buffer;
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_QUERY_SCHEDULER, 
+		NULL, 
+		0, 
+		(PVOID)Packet, 
+		OutputLength, 
+		&ReturnedLength);
+
+	if (Result && (ReturnedLength < sizeof(*Packet) || Packet->RecordCount > MaximumRecordCount || 
+		ReturnedLength != sizeof(*Packet) + Packet->RecordCount * sizeof(DIO_SCHEDULE_RECORD)))
+	{
+		DFTRACE("Length mismatched, assuming failed\n");
+		Result = FALSE;
+	}
+
+	if (Result)
+	{
+		memcpy(Status, Packet, sizeof(*Status));
+
+		if (Packet->RecordCount)
+		{
+			memcpy(Records, Packet->Records, Packet->RecordCount * sizeof(DIO_SCHEDULE_RECORD));
+
+			AcquireSRWLockShared(&Context->ClockLock);
+
+			for (i = 0; i < Packet->RecordCount; i++)
+				Records[i].Time = DiopConvertKernelTime(Context, Records[i].Time);
+
+			ReleaseSRWLockShared(&Context->ClockLock);
+		}
+	}
+
+	DiopReleaseRequest(Context, Request);
+
+	return Result;
+}
@@ -0,0 +1,463 @@
+
+#include <Windows.h>
+#include "../Include/dioctl.h"
+#include "../Include/dioum.h"
+#include "dioum_internal.h"
+
+
+DIOUM_SHADOW *
+APIENTRY
+DiopGetShadow(
+	IN DIOUM_RANGE_SET *RangeSet)
+/**
+ *	@brief	Returns the shadow cache of range set, allocating it on first use.
+ *	
+ *	Port state is unknown until the first flush, so every byte starts dirty.
+ *	
+ *	@param	[in] RangeSet				Range set.
+ *	@return								Non-NULL if succeeded.
+ *	
+ */
+{
+	DIOUM_SHADOW *Shadow = RangeSet->Shadow;
+	DIOUM_SHADOW *Previous;
+	ULONG DataLength = RangeSet->DataLength;
+
+	if (Shadow)
+		return Shadow;
+
+	// [DIOUM_SHADOW] [Data] [Dirty]
+	Shadow = (DIOUM_SHADOW *)DiopAllocate(sizeof(*Shadow) + DataLength * 2);
+	if (!Shadow)
+		return NULL;
+
+	InitializeSRWLock(&Shadow->Lock);
+	Shadow->Data = (PUCHAR)(Shadow + 1);
+	Shadow->Dirty = Shadow->Data + DataLength;
+	Shadow->DirtyCount = DataLength;
+	memset(Shadow->Dirty, 1, DataLength);
+
+	Previous = (DIOUM_SHADOW *)InterlockedCompareExchangePointer(
+		(PVOID volatile *)&RangeSet->Shadow, Shadow, NULL);
+
+	if (Previous)
+	{
+		// Other thread allocated it first.
+		DiopFree(Shadow);
+		return Previous;
+	}
+
+	return Shadow;
+}
+
+VOID
+APIENTRY
+DiopFreeShadow(
+	IN DIOUM_RANGE_SET *RangeSet)
+/**
+ *	@brief	Frees the shadow cache of range set.
+ *	
+ *	@param	[in] RangeSet				Range set.
+ *	@return								None.
+ *	
+ */
+{
+	if (RangeSet->Shadow)
+		DiopFree(RangeSet->Shadow);
+
+	RangeSet->Shadow = NULL;
+}
+
+VOID
+APIENTRY
+DiopShadowStore(
+	IN DIOUM_SHADOW *Shadow, 
+	IN ULONG Offset, 
+	IN UCHAR Value)
+{
+	if (Shadow->Data[Offset] == Value)
+		return;
+
+	Shadow->Data[Offset] = Value;
+
+	if (!Shadow->Dirty[Offset])
+	{
+		Shadow->Dirty[Offset] = 1;
+		Shadow->DirtyCount++;
+	}
+}
+
+VOID
+APIENTRY
+DiopShadowCopyRun(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	IN ULONG RangeIndex, 
+	OUT PUCHAR DestinationBuffer, 
+	IN PUCHAR SourceBuffer, 
+	IN ULONG Offset, 
+	IN ULONG Length)
+/**
+ *	@brief	Copies the run of shadow data with the write masks applied.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] RangeSet				Range set.
+ *	@param	[in] RangeIndex				Index of the range which contains Offset.
+ *	@param	[out] DestinationBuffer		Destination buffer.
+ *	@param	[in] SourceBuffer			Shadow data.
+ *	@param	[in] Offset					Data offset of the run.
+ *	@param	[in] Length					Length of the run. May span the following ranges.
+ *	@return								None.
+ *	
+ */
+{
+	if (!(RangeSet->Flags & DIOUM_RANGE_SET_FLAG_OWN_MASKS))
+	{
+		DiopUnsafeXorCopy(DestinationBuffer, SourceBuffer + Offset, Length, Context->WriteXorMask);
+		return;
+	}
+
+	while (Length)
+	{
+		ULONG RangeEnd = RangeSet->Offsets[RangeIndex] + 
+			RangeSet->Header.AddressRange[RangeIndex].EndAddress - 
+			RangeSet->Header.AddressRange[RangeIndex].StartAddress + 1;
+		ULONG CopyLength = RangeEnd - Offset;
+
+		if (CopyLength > Length)
+			CopyLength = Length;
+
+		DiopUnsafeXorCopy(DestinationBuffer, SourceBuffer + Offset, CopyLength, 
+			RangeSet->WriteXorMasks[RangeIndex]);
+
+		DestinationBuffer += CopyLength;
+		Offset += CopyLength;
+		Length -= CopyLength;
+		RangeIndex++;
+	}
+}
+
+BOOL
+APIENTRY
+DiopShadowWriteDelta(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	IN DIOUM_SHADOW *Shadow, 
+	OUT ULONG *TransferredDataLength, 
+	OUT BOOLEAN *Fallback)
+/**
+ *	@brief	Writes the dirty runs of shadow cache.
+ *	
+ *	Dirty bytes are coalesced into runs. Runs within DIOUM_SHADOW_MERGE_GAP bytes are merged
+ *	if the ports between them are also in the range set (port-adjacent ranges), then the clean
+ *	bytes in the gap are written again with the cached value.\n
+ *	Caller must hold the shadow lock exclusively.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] RangeSet				Range set.
+ *	@param	[in] Shadow					Shadow cache of range set.
+ *	@param	[out] TransferredDataLength	Receives the data length in bytes.
+ *	@param	[out] Fallback				Set to TRUE if the whole set should be written instead.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIO_PORT_RANGE Runs[DIO_MAXIMUM_PORT_RANGES];
+	ULONG RunOffsets[DIO_MAXIMUM_PORT_RANGES];
+	ULONG RunRangeIndices[DIO_MAXIMUM_PORT_RANGES];
+	ULONG RunSegments[DIO_MAXIMUM_PORT_RANGES];
+	ULONG RunCount = 0;
+	ULONG Remaining = Shadow->DirtyCount;
+	ULONG Segment = 0;
+	ULONG HeaderLength;
+	ULONG DataLength = 0;
+	ULONG ReturnedLength = 0;
+	DIO_PACKET_PORT_IO *Packet;
+	DIOUM_REQUEST *Request;
+	PUCHAR Data;
+	BOOL Result;
+	ULONG i, j;
+
+	*Fallback = FALSE;
+
+	for (i = 0; i < RangeSet->Header.RangeCount && Remaining; i++)
+	{
+		USHORT StartAddress = RangeSet->Header.AddressRange[i].StartAddress;
+		USHORT EndAddress = RangeSet->Header.AddressRange[i].EndAddress;
+		ULONG Offset = RangeSet->Offsets[i];
+
+		// Ports between port-adjacent ranges are all in the set, so runs may be merged across them.
+		if (i > 0 && StartAddress != RangeSet->Header.AddressRange[i - 1].EndAddress + 1)
+			Segment++;
+
+		for (j = 0; j <= (ULONG)(EndAddress - StartAddress) && Remaining; j++)
+		{
+			if (!Shadow->Dirty[Offset + j])
+				continue;
+
+			Remaining--;
+
+			if (RunCount && 
+				RunSegments[RunCount - 1] == Segment && 
+				Offset + j - (RunOffsets[RunCount - 1] + 
+				Runs[RunCount - 1].EndAddress - Runs[RunCount - 1].StartAddress + 1) <= DIOUM_SHADOW_MERGE_GAP)
+			{
+				Runs[RunCount - 1].EndAddress = (USHORT)(StartAddress + j);
+				continue;
+			}
+
+			if (RunCount == ARRAYSIZE(Runs))
+			{
+				*Fallback = TRUE;
+				return FALSE;
+			}
+
+			Runs[RunCount].StartAddress = (USHORT)(StartAddress + j);
+			Runs[RunCount].EndAddress = (USHORT)(StartAddress + j);
+			RunOffsets[RunCount] = Offset + j;
+			RunRangeIndices[RunCount] = i;
+			RunSegments[RunCount] = Segment;
+			RunCount++;
+		}
+	}
+
+	for (i = 0; i < RunCount; i++)
+		DataLength += Runs[i].EndAddress - Runs[i].StartAddress + 1;
+
+	HeaderLength = PACKET_PORT_IO_GET_LENGTH(RunCount);
+
+	// Not worth it if the delta packet is not smaller than the full one.
+	if (HeaderLength + DataLength >= RangeSet->HeaderLength + RangeSet->DataLength)
+	{
+		*Fallback = TRUE;
+		return FALSE;
+	}
+
+	Request = DiopAcquireRequest(Context, HeaderLength + DataLength);
+	if (!Request)
+		return FALSE;
+
+	Packet = (DIO_PACKET_PORT_IO *)Request->Buffer;
+	Packet->RangeCount = RunCount;
+	memcpy(Packet->AddressRange, Runs, RunCount * sizeof(DIO_PORT_RANGE));
+
+	for (i = 0, Data = Request->Buffer + HeaderLength; i < RunCount; i++)
+	{
+		ULONG Length = Runs[i].EndAddress - Runs[i].StartAddress + 1;
+
+		DiopShadowCopyRun(Context, RangeSet, RunRangeIndices[i], Data, Shadow->Data, RunOffsets[i], Length);
+		Data += Length;
+	}
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_WRITE_PORT, 
+		(PVOID)Request->Buffer, 
+		HeaderLength + DataLength, 
+		(PVOID)Request->Buffer, 
+		HeaderLength, 
+		&ReturnedLength);
+
+	if (Result && ReturnedLength != HeaderLength)
+	{
+		DFTRACE("Length mismatched, assuming failed\n");
+		Result = FALSE;
+	}
+
+	DiopReleaseRequest(Context, Request);
+
+	if (Result)
+		*TransferredDataLength = DataLength;
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioShadowWrite(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	IN ULONG Offset, 
+	IN PUCHAR Buffer, 
+	IN ULONG Length)
+/**
+ *	@brief	Updates the shadow cache of range set. Ports are not written until flushed.
+ *	
+ *	Bytes which are changed are marked dirty.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] RangeSet				Range set.
+ *	@param	[in] Offset					Data offset in the range set layout.
+ *	@param	[in] Buffer					Data to store.
+ *	@param	[in] Length					Length of Buffer in bytes.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIOUM_SHADOW *Shadow;
+	ULONG i;
+
+	if (!DiopValidateContext(Context) || !RangeSet)
+		return FALSE;
+
+	if (Offset > RangeSet->DataLength || Length > RangeSet->DataLength - Offset)
+		return FALSE;
+
+	Shadow = DiopGetShadow(RangeSet);
+	if (!Shadow)
+		return FALSE;
+
+	AcquireSRWLockExclusive(&Shadow->Lock);
+
+	for (i = 0; i < Length; i++)
+		DiopShadowStore(Shadow, Offset + i, Buffer[i]);
+
+	ReleaseSRWLockExclusive(&Shadow->Lock);
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DioShadowUpdateBits(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	IN ULONG Offset, 
+	IN UCHAR Mask, 
+	IN UCHAR Value)
+/**
+ *	@brief	Updates the bits of one byte in the shadow cache.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] RangeSet				Range set.
+ *	@param	[in] Offset					Data offset in the range set layout.
+ *	@param	[in] Mask					Bits to update.
+ *	@param	[in] Value					New value of the bits.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIOUM_SHADOW *Shadow;
+
+	if (!DiopValidateContext(Context) || !RangeSet)
+		return FALSE;
+
+	if (Offset >= RangeSet->DataLength)
+		return FALSE;
+
+	Shadow = DiopGetShadow(RangeSet);
+	if (!Shadow)
+		return FALSE;
+
+	AcquireSRWLockExclusive(&Shadow->Lock);
+	DiopShadowStore(Shadow, Offset, (UCHAR)((Shadow->Data[Offset] & ~Mask) | (Value & Mask)));
+	ReleaseSRWLockExclusive(&Shadow->Lock);
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DioShadowRead(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	IN ULONG Offset, 
+	OUT PUCHAR Buffer, 
+	IN ULONG Length)
+/**
+ *	@brief	Reads the shadow cache of range set. Ports are not read.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] RangeSet				Range set.
+ *	@param	[in] Offset					Data offset in the range set layout.
+ *	@param	[out] Buffer				Receives the cached data.
+ *	@param	[in] Length					Length of Buffer in bytes.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIOUM_SHADOW *Shadow;
+
+	if (!DiopValidateContext(Context) || !RangeSet)
+		return FALSE;
+
+	if (Offset > RangeSet->DataLength || Length > RangeSet->DataLength - Offset)
+		return FALSE;
+
+	Shadow = DiopGetShadow(RangeSet);
+	if (!Shadow)
+		return FALSE;
+
+	AcquireSRWLockShared(&Shadow->Lock);
+	memcpy(Buffer, Shadow->Data + Offset, Length);
+	ReleaseSRWLockShared(&Shadow->Lock);
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DioFlushRangeSet(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	IN ULONG Flags, 
+	OPTIONAL OUT ULONG *TransferredDataLength)
+/**
+ *	@brief	Writes the shadow cache of range set to the ports.
+ *	
+ *	Only the dirty runs are written unless DIOUM_FLUSH_ALL is given. The whole set is
+ *	written if the delta packet would not be smaller, or if the cache is clean and
+ *	DIOUM_FLUSH_SKIP_IF_CLEAN is not given.\n
+ *	Dirty flags are kept if the write fails, so the next flush retries them.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] RangeSet				Range set.
+ *	@param	[in] Flags					DIOUM_FLUSH_XXX.
+ *	@param	[out, opt] TransferredDataLength	Receives the data length in bytes. Zero if skipped.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIOUM_SHADOW *Shadow;
+	ULONG Transferred = 0;
+	BOOLEAN Fallback = TRUE;
+	BOOL Result = TRUE;
+
+	if (!DiopValidateContext(Context) || !RangeSet)
+		return FALSE;
+
+	Shadow = DiopGetShadow(RangeSet);
+	if (!Shadow)
+		return FALSE;
+
+	AcquireSRWLockExclusive(&Shadow->Lock);
+
+	do
+	{
+		if (!Shadow->DirtyCount && (Flags & DIOUM_FLUSH_SKIP_IF_CLEAN))
+			break;
+
+		if (Shadow->DirtyCount && !(Flags & DIOUM_FLUSH_ALL))
+		{
+			Result = DiopShadowWriteDelta(Context, RangeSet, Shadow, &Transferred, &Fallback);
+			if (!Fallback)
+				break;
+		}
+
+		Result = DiopWriteRangeSet(Context, RangeSet, Shadow->Data, RangeSet->DataLength, &Transferred);
+	} while (FALSE);
+
+	if (Result && Shadow->DirtyCount)
+	{
+		memset(Shadow->Dirty, 0, RangeSet->DataLength);
+		Shadow->DirtyCount = 0;
+	}
+
+	ReleaseSRWLockExclusive(&Shadow->Lock);
+
+	if (Result && TransferredDataLength)
+		*TransferredDataLength = Transferred;
+
+	return Result;
+}
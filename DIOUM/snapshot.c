@@ -0,0 +1,349 @@
+#include <Windows.h>
+#include "../Include/dioctl.h"
+#include "../Include/diosnap.h"
+#include "../Include/dioum.h"
+#include "dioum_internal.h"
+
+
+C_ASSERT(sizeof(DIO_SNAPSHOT_PAGE) == DIO_SNAPSHOT_PAGE_LENGTH);
+
+// Readers spin this many times on a page which is being updated before yielding the processor.
+#define DIOUM_SNAPSHOT_SPIN_COUNT			64
+
+
+BOOL
+APIENTRY
+DiopMapSnapshot(
+	IN DIOUM_DRIVER_CONTEXT *Context)
+/**
+ *	@brief	Maps the snapshot page of the driver. Called once on initialization.
+ *	
+ *	This function is reserved for internal use.\n
+ *	The page is unmapped by the driver when the handle is closed.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIO_PACKET_SNAPSHOT_ADDRESS Address;
+	DIOUM_REQUEST *Request;
+	ULONG ReturnedLength = 0;
+	BOOL Result;
+
+	Request = DiopAcquireRequest(Context, sizeof(Address));
+	if (!Request)
+		return FALSE;
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_MAP_SNAPSHOT, 
+		NULL, 
+		0, 
+		(PVOID)Request->Buffer, 
+		sizeof(Address), 
+		&ReturnedLength);
+
+	if (Result && ReturnedLength != sizeof(Address))
+	{
+		DFTRACE("Length mismatched, assuming failed\n");
+		Result = FALSE;
+	}
+
+	if (Result)
+		memcpy(&Address, Request->Buffer, sizeof(Address));
+
+	DiopReleaseRequest(Context, Request);
+
+	if (!Result)
+		return FALSE;
+
+	if (Address.Length < sizeof(DIO_SNAPSHOT_PAGE))
+	{
+		DFTRACE("Invalid page length %d\n", Address.Length);
+		return FALSE;
+	}
+
+	Context->Snapshot = (const DIO_SNAPSHOT_PAGE *)(ULONG_PTR)Address.Address;
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DiopReadSnapshotConfiguration(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OUT ULONG *ConfigurationBits)
+/**
+ *	@brief	Reads the driver configuration from the snapshot page.
+ *	
+ *	This function is reserved for internal use.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[out] ConfigurationBits		Receives the DIO_CFGB_XXX bits.
+ *	@return								Non-zero if successful. Fails if the page is not mapped.
+ *	
+ */
+{
+	const DIO_SNAPSHOT_PAGE *Page = Context->Snapshot;
+	ULONG Sequence;
+	ULONG Bits;
+	ULONG Retries = 0;
+
+	if (!Page)
+		return FALSE;
+
+	for (;;)
+	{
+		Sequence = DioSnapshotReadBegin(Page);
+		Bits = Page->ConfigurationBits;
+
+		if (!DioSnapshotReadRetry(Page, Sequence))
+			break;
+
+		if (++Retries % DIOUM_SNAPSHOT_SPIN_COUNT)
+			YieldProcessor();
+		else
+			SwitchToThread();
+	}
+
+	*ConfigurationBits = Bits;
+
+	return TRUE;
+}
+
+BOOL
+APIENTRY
+DioStartSnapshot(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OPTIONAL IN DIOUM_RANGE_SET *RangeSet, 
+	IN ULONG RefreshInterval, 
+	IN ULONG Processor)
+/**
+ *	@brief	Starts refreshing the range set into the snapshot page of the driver.
+ *	
+ *	The driver reads the ranges every RefreshInterval and publishes them in the page which is
+ *	mapped read-only to this process, so DioReadSnapshot() takes the latest values without an
+ *	IOCTL, from any number of threads.\n
+ *	The refresh thread spins on one processor between the refreshes, so pick the processor with care.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in, opt] RangeSet			Range set to refresh. Registered range set if NULL.
+ *										Up to DIOUM_SNAPSHOT_MAXIMUM_RANGES ranges.
+ *	@param	[in] RefreshInterval		Nanoseconds between the refreshes. Raised to
+ *										DIOUM_SNAPSHOT_MINIMUM_REFRESH_INTERVAL if shorter.
+ *	@param	[in] Processor				Processor of the refresh thread, or DIOUM_SNAPSHOT_ANY_PROCESSOR.
+ *	@return								Non-zero if successful. Fails if the refreshes are running.
+ *	
+ */
+{
+	DIO_PACKET_START_SNAPSHOT *Packet;
+	DIOUM_RANGE_SET *Source;
+	DIOUM_RANGE_SET *Layout = NULL;
+	DIOUM_REQUEST *Request;
+	ULONG PacketLength;
+	ULONG ReturnedLength = 0;
+	BOOL Result = FALSE;
+	ULONG Epoch = 0;
+
+	if (!DiopValidateContext(Context) || !Context->Snapshot)
+		return FALSE;
+
+	Source = RangeSet ? RangeSet : DiopReferenceRegisteredRangeSet(Context, &Epoch);
+
+	// Readers use the layout without a lock, so keep a private copy which the caller cannot free.
+	if (Source && Source->Header.RangeCount && Source->Header.RangeCount <= DIO_SNAPSHOT_MAXIMUM_RANGES)
+	{
+		BOOL OwnMasks = (BOOL)(Source->Flags & DIOUM_RANGE_SET_FLAG_OWN_MASKS);
+
+		Layout = DiopCreateRangeSet(NULL, Source->Header.RangeCount, 
+			(DIOUM_PORT_RANGE *)Source->Header.AddressRange, 
+			OwnMasks ? Source->ReadXorMasks : NULL, 
+			OwnMasks ? Source->WriteXorMasks : NULL);
+	}
+
+	if (!RangeSet)
+		DiopDereferenceRegisteredRangeSet(Context, Epoch);
+
+	if (!Layout)
+		return FALSE;
+
+	// Calibrate now, so that the first read does not pay for it.
+	if (DiopAcquireCalibratedClock(Context))
+		ReleaseSRWLockShared(&Context->ClockLock);
+
+	PacketLength = PACKET_START_SNAPSHOT_GET_LENGTH(Layout->Header.RangeCount);
+
+	AcquireSRWLockExclusive(&Context->SnapshotLock);
+
+	do
+	{
+		Request = DiopAcquireRequest(Context, PacketLength);
+		if (!Request)
+			break;
+
+		Packet = (DIO_PACKET_START_SNAPSHOT *)Request->Buffer;
+		Packet->RefreshInterval = RefreshInterval;
+		Packet->Processor = Processor;
+		Packet->RangeCount = Layout->Header.RangeCount;
+		memcpy(Packet->AddressRange, Layout->Header.AddressRange, Layout->Header.RangeCount * sizeof(DIO_PORT_RANGE));
+
+		Result = DiopDeviceIoControl(
+			Context, 
+			Request, 
+			DIO_IOCTL_START_SNAPSHOT, 
+			(PVOID)Packet, 
+			PacketLength, 
+			NULL, 
+			0, 
+			&ReturnedLength);
+
+		DiopReleaseRequest(Context, Request);
+
+		if (!Result)
+			break;
+
+		// Readers may still use the previous layout. Starts are rare, so it is kept until shutdown.
+		if (Context->SnapshotLayout)
+		{
+			Context->SnapshotLayout->Next = Context->RetiredSnapshotLayouts;
+			Context->RetiredSnapshotLayouts = Context->SnapshotLayout;
+		}
+
+		Context->SnapshotLayout = Layout;
+		Layout = NULL;
+	} while (FALSE);
+
+	ReleaseSRWLockExclusive(&Context->SnapshotLock);
+
+	if (Layout)
+		DiopFreeRangeSet(Layout);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioStopSnapshot(
+	IN DIOUM_DRIVER_CONTEXT *Context)
+/**
+ *	@brief	Stops the refreshes. DioReadSnapshot() keeps returning the last refresh.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@return								Non-zero if successful, even if the refreshes were not running.
+ *	
+ */
+{
+	DIOUM_REQUEST *Request;
+	ULONG ReturnedLength = 0;
+	BOOL Result;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	Request = DiopAcquireRequest(Context, 0);
+	if (!Request)
+		return FALSE;
+
+	AcquireSRWLockExclusive(&Context->SnapshotLock);
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_STOP_SNAPSHOT, 
+		NULL, 
+		0, 
+		NULL, 
+		0, 
+		&ReturnedLength);
+
+	ReleaseSRWLockExclusive(&Context->SnapshotLock);
+
+	DiopReleaseRequest(Context, Request);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioReadSnapshot(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT DIOUM_SNAPSHOT_INFO *Info)
+/**
+ *	@brief	Takes the latest values of the range set from the snapshot page.
+ *	
+ *	No IOCTL is made and no lock is taken: the data is copied between two reads of the sequence
+ *	counter of the page, and copied again if the driver has updated the page meanwhile.\n
+ *	Data is in the layout of the range set given to DioStartSnapshot(), with the read XOR masks applied.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[out] Buffer				Receives the data.
+ *	@param	[in] BufferLength			Length of Buffer. Must hold the data of the range set.
+ *	@param	[out, opt] Info				Receives the sample time and the counters.
+ *	@return								Non-zero if successful. Fails if no refresh has completed
+ *										since the start.
+ *	
+ */
+{
+	const DIO_SNAPSHOT_PAGE *Page;
+	DIOUM_RANGE_SET *Layout;
+	LONGLONG Timestamp = 0;
+	ULONGLONG SampleCount = 0;
+	ULONG Running = 0;
+	ULONG DataLength;
+	ULONG Sequence;
+	ULONG Retries = 0;
+
+	if (!DiopValidateContext(Context) || !Buffer)
+		return FALSE;
+
+	Page = Context->Snapshot;
+	Layout = Context->SnapshotLayout;
+
+	if (!Page || !Layout || BufferLength < Layout->DataLength)
+		return FALSE;
+
+	for (;;)
+	{
+		Sequence = DioSnapshotReadBegin(Page);
+
+		DataLength = Page->DataLength;
+		SampleCount = Page->SampleCount;
+		Timestamp = Page->Timestamp;
+		Running = Page->Running;
+		memcpy(Buffer, (const void *)Page->Data, Layout->DataLength);
+
+		if (!DioSnapshotReadRetry(Page, Sequence))
+			break;
+
+		if (++Retries % DIOUM_SNAPSHOT_SPIN_COUNT)
+			YieldProcessor();
+		else
+			SwitchToThread();
+	}
+
+	// Layout of the page differs while a new start is not yet published to the context.
+	if (DataLength != Layout->DataLength || !SampleCount)
+		return FALSE;
+
+	DiopCopyRangeSetData(Context, Layout, Buffer, Buffer, FALSE);
+
+	if (Info)
+	{
+		Info->Timestamp = Timestamp;
+		Info->SampleCount = SampleCount;
+		Info->Running = Running;
+		Info->Retries = Retries;
+
+		if (DiopAcquireCalibratedClock(Context))
+		{
+			Info->Timestamp = DiopConvertKernelTime(Context, Timestamp);
+			ReleaseSRWLockShared(&Context->ClockLock);
+		}
+	}
+
+	return TRUE;
+}
@@ -0,0 +1,336 @@
+#include <Windows.h>
+#include "../Include/dioctl.h"
+#include "../Include/dioum.h"
+#include "dioum_internal.h"
+
+
+C_ASSERT(sizeof(DIOUM_STREAM_STATUS) == sizeof(DIO_PACKET_QUERY_STREAM));
+
+
+BOOL
+APIENTRY
+DioStartStream(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OPTIONAL IN DIOUM_RANGE_SET *RangeSet, 
+	IN ULONG TickInterval, 
+	IN ULONG Processor, 
+	IN ULONG FrameCapacity, 
+	IN ULONG Flags)
+/**
+ *	@brief	Starts the output stream in the driver.
+ *	
+ *	The driver writes one frame to the ranges of the range set every TickInterval. A frame has
+ *	the layout of the range set data. Frames are queued by DioWriteStream().\n
+ *	The tick thread spins on one processor between the ticks, so pick the processor with care.\n
+ *	Write XOR masks are taken when the stream starts, and applied to every frame.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in, opt] RangeSet			Range set to write. Registered ranges if NULL.
+ *	@param	[in] TickInterval			Nanoseconds between the frames.
+ *	@param	[in] Processor				Processor to run the ticks, or DIOUM_STREAM_ANY_PROCESSOR.
+ *	@param	[in] FrameCapacity			Count of frames the driver buffers.
+ *	@param	[in] Flags					Combination of DIOUM_STREAM_XXX.
+ *	@return								Non-zero if successful. Fails if the stream is already running.
+ *	
+ */
+{
+	DIO_PACKET_START_STREAM *Packet;
+	DIOUM_REQUEST *Request = NULL;
+	BOOLEAN Registered = !RangeSet;
+	PUCHAR WriteMasks = NULL;
+	ULONG ReturnedLength = 0;
+	ULONG PacketLength;
+	ULONG RangeCount;
+	BOOL Result = FALSE;
+	ULONG Epoch = 0;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	if (Flags & ~DIOUM_STREAM_VALID_FLAGS)
+		return FALSE;
+
+	if (Registered)
+		RangeSet = DiopReferenceRegisteredRangeSet(Context, &Epoch);
+
+	do
+	{
+		if (!RangeSet)
+			break;
+
+		RangeCount = RangeSet->Header.RangeCount;
+
+		if (!RangeCount || RangeCount > DIOUM_STREAM_MAXIMUM_RANGES || 
+			RangeSet->DataLength > DIOUM_STREAM_MAXIMUM_FRAME_LENGTH)
+		{
+			DFTRACE("Range set cannot be streamed (%d ranges, %d bytes)\n", RangeCount, RangeSet->DataLength);
+			break;
+		}
+
+		// Mask of each frame byte is the masked copy of zeros.
+		WriteMasks = (PUCHAR)DiopAllocate(RangeSet->DataLength);
+		if (!WriteMasks)
+			break;
+
+		ZeroMemory(WriteMasks, RangeSet->DataLength);
+		DiopCopyRangeSetData(Context, RangeSet, WriteMasks, WriteMasks, TRUE);
+
+		PacketLength = PACKET_START_STREAM_GET_LENGTH(RangeCount);
+
+		Request = DiopAcquireRequest(Context, PacketLength);
+		if (!Request)
+			break;
+
+		Packet = (DIO_PACKET_START_STREAM *)Request->Buffer;
+		Packet->TickInterval = TickInterval;
+		Packet->Processor = Processor;
+		Packet->Flags = (Flags & DIOUM_STREAM_LOOP) ? DIO_STREAM_FLAG_LOOP : 0;
+		Packet->FrameCapacity = FrameCapacity;
+		Packet->RangeCount = RangeCount;
+		memcpy(Packet->AddressRange, RangeSet->Header.AddressRange, RangeCount * sizeof(DIO_PORT_RANGE));
+
+		AcquireSRWLockExclusive(&Context->StreamLock);
+
+		Result = DiopDeviceIoControl(
+			Context, 
+			Request, 
+			DIO_IOCTL_START_STREAM, 
+			(PVOID)Packet, 
+			PacketLength, 
+			NULL, 
+			0, 
+			&ReturnedLength);
+
+		if (Result)
+		{
+			// Masks of the previous stream are replaced.
+			PUCHAR PreviousMasks = Context->StreamWriteMasks;
+
+			Context->StreamWriteMasks = WriteMasks;
+			Context->StreamFrameLength = RangeSet->DataLength;
+			WriteMasks = PreviousMasks;
+		}
+
+		ReleaseSRWLockExclusive(&Context->StreamLock);
+	} while (FALSE);
+
+	if (Request)
+		DiopReleaseRequest(Context, Request);
+
+	if (WriteMasks)
+		DiopFree(WriteMasks);
+
+	if (Registered)
+		DiopDereferenceRegisteredRangeSet(Context, Epoch);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioWriteStream(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN PUCHAR Frames, 
+	IN ULONG FrameCount, 
+	IN ULONG Timeout, 
+	OPTIONAL OUT ULONG *WrittenFrames)
+/**
+ *	@brief	Queues the frames to the output stream.
+ *	
+ *	Waits for the free space until all frames are queued or Timeout expires.\n
+ *	With DIOUM_STREAM_LOOP, the frames become one segment which repeats until the next segment
+ *	is queued, and the next segment starts at the end of the repetition. So writing the next
+ *	segment while the current one plays switches the pattern without a gap (double buffering).
+ *	Segment is queued as a whole, so it must fit in the buffer with the current segment.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] Frames					Frames in the layout of the range set data, back to back.
+ *	@param	[in] FrameCount				Count of frames.
+ *	@param	[in] Timeout				Milliseconds to wait for the free space. Can be INFINITE.
+ *	@param	[out, opt] WrittenFrames	Receives the count of queued frames.
+ *	@return								Non-zero if all frames are queued.
+ *	
+ */
+{
+	DIO_PACKET_WRITE_STREAM *Packet;
+	DIO_PACKET_QUERY_STREAM Status;
+	DIOUM_REQUEST *Request = NULL;
+	ULONG ReturnedLength = 0;
+	ULONG FrameLength;
+	ULONG Written = 0;
+	ULONG StartTime = GetTickCount();
+	ULONG i;
+	BOOL Result = FALSE;
+
+	if (WrittenFrames)
+		*WrittenFrames = 0;
+
+	if (!DiopValidateContext(Context) || (FrameCount && !Frames))
+		return FALSE;
+
+	AcquireSRWLockShared(&Context->StreamLock);
+
+	do
+	{
+		FrameLength = Context->StreamFrameLength;
+
+		if (!FrameLength)
+		{
+			DFTRACE("Stream is not started\n");
+			break;
+		}
+
+		if (FrameCount > (MAXULONG - sizeof(DIO_PACKET_WRITE_STREAM)) / FrameLength)
+			break;
+
+		Request = DiopAcquireRequest(Context, sizeof(DIO_PACKET_WRITE_STREAM) + FrameCount * FrameLength);
+		if (!Request)
+			break;
+
+		Packet = (DIO_PACKET_WRITE_STREAM *)Request->Buffer;
+
+		for (i = 0; i < FrameCount * FrameLength; i++)
+			Packet->Frames[i] = Frames[i] ^ Context->StreamWriteMasks[i % FrameLength];
+
+		for (;;)
+		{
+			ULONG Remaining = FrameCount - Written;
+
+			// Frames which are accepted are dropped from the front of the packet.
+			Packet = (DIO_PACKET_WRITE_STREAM *)(Request->Buffer + Written * FrameLength);
+			Packet->FrameCount = Remaining;
+
+			Result = DiopDeviceIoControl(
+				Context, 
+				Request, 
+				DIO_IOCTL_WRITE_STREAM, 
+				(PVOID)Packet, 
+				sizeof(*Packet) + Remaining * FrameLength, 
+				&Status, 
+				sizeof(Status), 
+				&ReturnedLength);
+
+			if (Result && ReturnedLength != sizeof(Status))
+			{
+				DFTRACE("Length mismatched, assuming failed\n");
+				Result = FALSE;
+			}
+
+			if (!Result)
+				break;
+
+			Written += Status.AcceptedFrames;
+
+			if (Written == FrameCount)
+				break;
+
+			if (Timeout != INFINITE && GetTickCount() - StartTime >= Timeout)
+			{
+				Result = FALSE;
+				break;
+			}
+
+			// Roughly the time to play the frames which did not fit.
+			Sleep(1);
+		}
+	} while (FALSE);
+
+	ReleaseSRWLockShared(&Context->StreamLock);
+
+	if (Request)
+		DiopReleaseRequest(Context, Request);
+
+	if (WrittenFrames)
+		*WrittenFrames = Written;
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioStopStream(
+	IN DIOUM_DRIVER_CONTEXT *Context)
+/**
+ *	@brief	Stops the output stream. Frames which are not played yet are dropped.
+ *	
+ *	Status remains readable until the next start. Closing the driver also stops the stream.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@return								Non-zero if successful, even if the stream was not running.
+ *	
+ */
+{
+	DIOUM_REQUEST *Request;
+	ULONG ReturnedLength = 0;
+	BOOL Result;
+
+	if (!DiopValidateContext(Context))
+		return FALSE;
+
+	Request = DiopAcquireRequest(Context, 0);
+	if (!Request)
+		return FALSE;
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_STOP_STREAM, 
+		NULL, 
+		0, 
+		NULL, 
+		0, 
+		&ReturnedLength);
+
+	DiopReleaseRequest(Context, Request);
+
+	return Result;
+}
+
+BOOL
+APIENTRY
+DioQueryStream(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OUT DIOUM_STREAM_STATUS *Status)
+/**
+ *	@brief	Reads the buffer level and the timing statistics of the output stream.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[out] Status				Receives the status.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	DIOUM_REQUEST *Request;
+	ULONG ReturnedLength = 0;
+	BOOL Result;
+
+	if (!DiopValidateContext(Context) || !Status)
+		return FALSE;
+
+	Request = DiopAcquireRequest(Context, sizeof(DIO_PACKET_QUERY_STREAM));
+	if (!Request)
+		return FALSE;
+
+	Result = DiopDeviceIoControl(
+		Context, 
+		Request, 
+		DIO_IOCTL_QUERY_STREAM, 
+		NULL, 
+		0, 
+		(PVOID)Request->Buffer, 
+		sizeof(DIO_PACKET_QUERY_STREAM), 
+		&ReturnedLength);
+
+	if (Result && ReturnedLength != sizeof(DIO_PACKET_QUERY_STREAM))
+	{
+		DFTRACE("Length mismatched, assuming failed\n");
+		Result = FALSE;
+	}
+
+	if (Result)
+		memcpy(Status, Request->Buffer, sizeof(*Status));
+
+	DiopReleaseRequest(Context, Request);
+
+	return Result;
+}
@@ -0,0 +1,473 @@
+
+#include <Windows.h>
+#include <fcntl.h>
+#include "../../Include/dioum.h"
+
+//
+// Tests of the Linux transport (devport.c) through the API of DIOUM.
+//
+// DIOUM_PORT_DEVICE names a temporary file of 64K bytes, which stands in for /dev/port, so every
+// port access is a read or write of the file at the port address. The expected data is taken from
+// the file directly. XOR masks are not zero, so a mask which is missed or applied twice fails.
+//
+// DIOUM_PORT_RANGES allows the ports which the tests use, and is read once per process.
+//
+
+#define TEST_PORT_SPACE			0x10000
+#define TEST_READ_XOR_MASK		0x5a
+#define TEST_WRITE_XOR_MASK		0xa5
+#define TEST_PORT_RANGES		"0x80-0x8f,0xf8-0x107,0x300-0xa03,0x1000,0xfff0-0xffff"
+
+#define CHECK(_e)				\
+	do { if (!(_e)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #_e); Failures++; } } while (0)
+
+static ULONG Failures;
+static ULONGLONG RandomState = 0x2545f4914f6cdd1dULL;
+static int File;
+
+
+static
+ULONG
+Random(
+	VOID)
+{
+	// xorshift64*, so the runs are reproducible.
+	RandomState ^= RandomState >> 12;
+	RandomState ^= RandomState << 25;
+	RandomState ^= RandomState >> 27;
+
+	return (ULONG)((RandomState * 0x2545f4914f6cdd1dULL) >> 32);
+}
+
+static
+UCHAR
+PeekPort(
+	IN ULONG Port)
+/**
+ *	@brief	Returns the raw value of the port in the stand-in file.
+ */
+{
+	UCHAR Value = 0;
+
+	CHECK(pread(File, &Value, 1, Port) == 1);
+
+	return Value;
+}
+
+static
+VOID
+PokePort(
+	IN ULONG Port, 
+	IN UCHAR Value)
+{
+	CHECK(pwrite(File, &Value, 1, Port) == 1);
+}
+
+static
+int
+CreateStandIn(
+	OUT char *Path, 
+	IN ULONG Length)
+/**
+ *	@brief	Creates the stand-in file of Length bytes with random contents and returns its descriptor.
+ */
+{
+	UCHAR Data[4096];
+	ULONG Offset;
+	ULONG i;
+	int Descriptor;
+
+	strcpy(Path, "/tmp/devport_test.XXXXXX");
+
+	Descriptor = mkstemp(Path);
+	if (Descriptor < 0)
+		return -1;
+
+	for (Offset = 0; Offset < Length; Offset += sizeof(Data))
+	{
+		for (i = 0; i < sizeof(Data); i++)
+			Data[i] = (UCHAR)Random();
+
+		if (pwrite(Descriptor, Data, min(sizeof(Data), Length - Offset), Offset) < 0)
+			break;
+	}
+
+	return Descriptor;
+}
+
+static
+VOID
+TestRoundTrip(
+	IN DIOUM_DRIVER_CONTEXT *Context)
+/**
+ *	@brief	Registered ranges are written and read back with the XOR masks of the context.
+ */
+{
+	DIOUM_PORT_RANGE Ranges[] = { { 0x300, 0x307 }, { 0x310, 0x313 }, { 0x308, 0x308 } };
+	UCHAR Data[13];
+	UCHAR Buffer[13];
+	ULONG Length = 0;
+	ULONG Offset;
+	ULONG i;
+	ULONG j;
+
+	for (i = 0; i < sizeof(Data); i++)
+		Data[i] = (UCHAR)Random();
+
+	CHECK(DioRegisterPortAddressRange(Context, ARRAYSIZE(Ranges), Ranges));
+	CHECK(DioWritePortMultiple(Context, Data, sizeof(Data), &Length) && Length == sizeof(Data));
+
+	for (i = 0, Offset = 0; i < ARRAYSIZE(Ranges); i++)
+	{
+		for (j = Ranges[i].StartAddress; j <= Ranges[i].EndAddress; j++, Offset++)
+			CHECK(PeekPort(j) == (Data[Offset] ^ TEST_WRITE_XOR_MASK));
+	}
+
+	Length = 0;
+	CHECK(DioReadPortMultiple(Context, Buffer, sizeof(Buffer), &Length) && Length == sizeof(Buffer));
+
+	for (i = 0; i < sizeof(Data); i++)
+		CHECK(Buffer[i] == (Data[i] ^ TEST_WRITE_XOR_MASK ^ TEST_READ_XOR_MASK));
+
+	// Too small a buffer is rejected.
+	CHECK(!DioReadPortMultiple(Context, Buffer, sizeof(Buffer) - 1, NULL));
+}
+
+static
+VOID
+TestScatter(
+	IN DIOUM_DRIVER_CONTEXT *Context)
+/**
+ *	@brief	Scattered ranges, adjacent ones merged into one run, land in their own buffers.
+ */
+{
+	UCHAR Buffers[4][16];
+	DIOUM_SCATTER_ENTRY Entries[] = {
+		{ { 0x420, 0x423 }, Buffers[0] }, 
+		{ { 0x424, 0x42f }, Buffers[1] }, 
+		{ { 0x1000, 0x1000 }, Buffers[2] }, 
+		{ { 0xfff0, 0xffff }, Buffers[3] }, 
+	};
+	ULONG Length = 0;
+	ULONG i;
+	ULONG j;
+
+	memset(Buffers, 0, sizeof(Buffers));
+
+	CHECK(DioReadPortScatter(Context, ARRAYSIZE(Entries), Entries, &Length) && Length == 4 + 12 + 1 + 16);
+
+	for (i = 0; i < ARRAYSIZE(Entries); i++)
+	{
+		for (j = Entries[i].Range.StartAddress; j <= Entries[i].Range.EndAddress; j++)
+			CHECK(Entries[i].Buffer[j - Entries[i].Range.StartAddress] == (PeekPort(j) ^ TEST_READ_XOR_MASK));
+	}
+}
+
+static
+VOID
+TestDescriptors(
+	IN DIOUM_DRIVER_CONTEXT *Context)
+/**
+ *	@brief	Strided, repeated and same-port descriptors of the v2 port I/O.
+ */
+{
+	DIOUM_PORT_DESCRIPTOR ReadDescriptors[] = {
+		{ 0x500, 4, 3, 2, 2 },		// 4 elements of 2 ports, 3 apart, twice
+		{ 0x600, 5, 0, 1, 1 },		// Same port 5 times
+		{ 0x700, 1, 0, 8, 1 },		// One run
+	};
+	DIOUM_PORT_DESCRIPTOR WriteDescriptors[] = {
+		{ 0x800, 3, 4, 2, 1 }, 
+		{ 0x810, 3, 0, 1, 1 },		// Last write of the same port wins
+	};
+	UCHAR Buffer[64];
+	UCHAR Data[9];
+	ULONG Length = 0;
+	ULONG Offset = 0;
+	ULONG i;
+	ULONG j;
+	ULONG k;
+
+	CHECK(DioReadPortDescriptors(Context, ARRAYSIZE(ReadDescriptors), ReadDescriptors, Buffer, sizeof(Buffer), &Length));
+	CHECK(Length == 16 + 5 + 8);
+
+	for (i = 0; i < ARRAYSIZE(ReadDescriptors); i++)
+	{
+		DIOUM_PORT_DESCRIPTOR *Descriptor = &ReadDescriptors[i];
+
+		for (j = 0; j < (ULONG)Descriptor->Count * Descriptor->Repeat; j++)
+		{
+			for (k = 0; k < Descriptor->Width; k++, Offset++)
+			{
+				ULONG Port = Descriptor->StartAddress + (j % Descriptor->Count) * Descriptor->Stride + k;
+
+				CHECK(Buffer[Offset] == (PeekPort(Port) ^ TEST_READ_XOR_MASK));
+			}
+		}
+	}
+
+	for (i = 0; i < sizeof(Data); i++)
+		Data[i] = (UCHAR)Random();
+
+	CHECK(DioWritePortDescriptors(Context, ARRAYSIZE(WriteDescriptors), WriteDescriptors, Data, sizeof(Data), &Length));
+	CHECK(Length == sizeof(Data));
+
+	for (i = 0; i < 3; i++)
+	{
+		CHECK(PeekPort(0x800 + i * 4) == (Data[i * 2] ^ TEST_WRITE_XOR_MASK));
+		CHECK(PeekPort(0x801 + i * 4) == (Data[i * 2 + 1] ^ TEST_WRITE_XOR_MASK));
+	}
+
+	CHECK(PeekPort(0x810) == (Data[8] ^ TEST_WRITE_XOR_MASK));
+
+	// Descriptor beyond the port space, and one without elements.
+	ReadDescriptors[0].StartAddress = 0xfffe;
+	CHECK(!DioReadPortDescriptors(Context, 1, ReadDescriptors, Buffer, sizeof(Buffer), NULL));
+
+	ReadDescriptors[0].StartAddress = 0x500;
+	ReadDescriptors[0].Count = 0;
+	CHECK(!DioReadPortDescriptors(Context, 1, ReadDescriptors, Buffer, sizeof(Buffer), NULL));
+}
+
+static
+VOID
+TestBurst(
+	IN DIOUM_DRIVER_CONTEXT *Context)
+/**
+ *	@brief	Planar and interleaved bursts with the timestamps in the application clock.
+ */
+{
+	DIOUM_PORT_RANGE Ranges[] = { { 0x900, 0x903 }, { 0x910, 0x911 } };
+	DIOUM_RANGE_SET *RangeSet = NULL;
+	LONGLONG Timestamps[8];
+	LARGE_INTEGER Before;
+	LARGE_INTEGER After;
+	LARGE_INTEGER Frequency;
+	UCHAR Planar[6 * 8];
+	UCHAR Interleaved[6 * 8];
+	UCHAR Expected[6];
+	ULONG Frame;
+	ULONG i;
+
+	for (i = 0; i < 4; i++)
+		Expected[i] = PeekPort(0x900 + i) ^ TEST_READ_XOR_MASK;
+
+	for (i = 0; i < 2; i++)
+		Expected[4 + i] = PeekPort(0x910 + i) ^ TEST_READ_XOR_MASK;
+
+	CHECK(DioCreateRangeSet(Context, NULL, ARRAYSIZE(Ranges), Ranges, NULL, NULL, &RangeSet));
+	if (!RangeSet)
+		return;
+
+	QueryPerformanceFrequency(&Frequency);
+	QueryPerformanceCounter(&Before);
+	CHECK(DioReadRangeSetBurst(Context, RangeSet, 8, DIOUM_BURST_FLAG_PLANAR, Planar, sizeof(Planar), Timestamps));
+	QueryPerformanceCounter(&After);
+
+	// Plane of each range holds its data of all frames, in the order of the ranges.
+	for (Frame = 0; Frame < 8; Frame++)
+	{
+		CHECK(!memcmp(Planar + Frame * 4, Expected, 4));
+		CHECK(!memcmp(Planar + 4 * 8 + Frame * 2, Expected + 4, 2));
+	}
+
+	// Conversion of the kernel clock may be off by a little, so allow 10 ms.
+	for (i = 0; i < 8; i++)
+	{
+		CHECK(Timestamps[i] >= Before.QuadPart - Frequency.QuadPart / 100);
+		CHECK(Timestamps[i] <= After.QuadPart + Frequency.QuadPart / 100);
+		CHECK(!i || Timestamps[i] >= Timestamps[i - 1]);
+	}
+
+	CHECK(DioReadRangeSetBurst(Context, RangeSet, 8, 0, Interleaved, sizeof(Interleaved), NULL));
+
+	for (Frame = 0; Frame < 8; Frame++)
+		CHECK(!memcmp(Interleaved + Frame * 6, Expected, 6));
+
+	CHECK(!DioReadRangeSetBurst(Context, RangeSet, 8, 0, Interleaved, sizeof(Interleaved) - 1, NULL));
+
+	DioDestroyRangeSet(Context, RangeSet);
+}
+
+static
+VOID
+TestWaitPattern(
+	IN DIOUM_DRIVER_CONTEXT *Context)
+/**
+ *	@brief	Pattern which is there matches at once and reads the range. Other one times out.
+ */
+{
+	DIOUM_PORT_RANGE ReadRange = { 0xa01, 0xa03 };
+	DIOUM_WAIT_PATTERN_RESULT Result;
+	UCHAR Buffer[3];
+	ULONG i;
+
+	PokePort(0xa00, 0x3c);
+
+	memset(&Result, 0, sizeof(Result));
+	CHECK(DioWaitPortPattern(Context, 0xa00, 0xf0, (0x3c ^ TEST_READ_XOR_MASK) & 0xf0, 100000, 0, 
+		&ReadRange, Buffer, sizeof(Buffer), &Result));
+	CHECK(Result.ObservedValue == (0x3c ^ TEST_READ_XOR_MASK));
+	CHECK(Result.Iterations == 1);
+
+	for (i = 0; i < sizeof(Buffer); i++)
+		CHECK(Buffer[i] == (PeekPort(0xa01 + i) ^ TEST_READ_XOR_MASK));
+
+	memset(&Result, 0, sizeof(Result));
+	CHECK(!DioWaitPortPattern(Context, 0xa00, 0xff, 0x3c, 5000, 500, NULL, NULL, 0, &Result));
+	CHECK(Result.ObservedValue == (0x3c ^ TEST_READ_XOR_MASK));
+	CHECK(Result.ElapsedTime >= 5000);
+	CHECK(Result.Iterations > 1);
+}
+
+static
+VOID
+TestOverlap(
+	IN DIOUM_DRIVER_CONTEXT *Context)
+/**
+ *	@brief	Overlapping ranges are rejected by the transport, as the driver does.
+ */
+{
+	DIOUM_PORT_RANGE Ranges[] = { { 0x300, 0x30f }, { 0x30f, 0x310 } };
+	DIOUM_SCATTER_ENTRY Entries[2];
+	UCHAR Buffer[32];
+
+	CHECK(DioRegisterPortAddressRange(Context, ARRAYSIZE(Ranges), Ranges));
+	CHECK(!DioReadPortMultiple(Context, Buffer, sizeof(Buffer), NULL));
+	CHECK(!DioWritePortMultiple(Context, Buffer, 18, NULL));
+
+	Entries[0].Range = Ranges[0];
+	Entries[0].Buffer = Buffer;
+	Entries[1].Range = Ranges[1];
+	Entries[1].Buffer = Buffer + 16;
+	CHECK(!DioReadPortScatter(Context, ARRAYSIZE(Entries), Entries, NULL));
+
+	// Adjacent ranges are fine.
+	Ranges[1].StartAddress = 0x310;
+	CHECK(DioRegisterPortAddressRange(Context, ARRAYSIZE(Ranges), Ranges));
+	CHECK(DioReadPortMultiple(Context, Buffer, 17, NULL));
+}
+
+static
+VOID
+TestAllowedRanges(
+	IN DIOUM_DRIVER_CONTEXT *Context)
+/**
+ *	@brief	Ports out of DIOUM_PORT_RANGES are rejected on every path of the transport.
+ */
+{
+	DIOUM_PORT_RANGE Outside = { 0x200, 0x20f };
+	DIOUM_PORT_RANGE Straddling = { 0x8f, 0x90 };
+	DIOUM_PORT_DESCRIPTOR Descriptor = { 0x200, 1, 0, 4, 1 };
+	DIOUM_RANGE_SET *RangeSet = NULL;
+	DIOUM_WAIT_PATTERN_RESULT Result;
+	UCHAR Buffer[16];
+
+	// Allowed ranges are reported as the resources, so DIOUM rejects the range set by itself.
+	CHECK(!DioCreateRangeSet(Context, NULL, 1, &Outside, NULL, NULL, &RangeSet));
+	CHECK(!DioCreateRangeSet(Context, NULL, 1, &Straddling, NULL, NULL, &RangeSet));
+
+	CHECK(DioRegisterPortAddressRange(Context, 1, &Outside));
+	SetLastError(0);
+	CHECK(!DioReadPortMultiple(Context, Buffer, sizeof(Buffer), NULL));
+	CHECK(GetLastError() == ERROR_ACCESS_DENIED);
+
+	SetLastError(0);
+	CHECK(!DioReadPortDescriptors(Context, 1, &Descriptor, Buffer, sizeof(Buffer), NULL));
+	CHECK(GetLastError() == ERROR_ACCESS_DENIED);
+
+	SetLastError(0);
+	CHECK(!DioWaitPortPattern(Context, 0x200, 0, 0, 1000, 0, NULL, NULL, 0, &Result));
+	CHECK(GetLastError() == ERROR_ACCESS_DENIED);
+
+	// Polled port is allowed, but the range to read is not.
+	SetLastError(0);
+	CHECK(!DioWaitPortPattern(Context, 0xa00, 0, 0, 1000, 0, &Outside, Buffer, sizeof(Buffer), &Result));
+	CHECK(GetLastError() == ERROR_ACCESS_DENIED);
+}
+
+static
+VOID
+TestShortStandIn(
+	VOID)
+/**
+ *	@brief	Ports beyond the end of a short stand-in fail with EIO, and those before it work.
+ */
+{
+	DIOUM_DRIVER_CONTEXT *Context;
+	DIOUM_PORT_RANGE Inside = { 0x80, 0x8f };
+	DIOUM_PORT_RANGE Outside = { 0xf8, 0x107 };
+	char Path[32];
+	UCHAR Buffer[16];
+	int Descriptor = CreateStandIn(Path, 0x100);
+
+	CHECK(Descriptor >= 0);
+	if (Descriptor < 0)
+		return;
+
+	setenv("DIOUM_PORT_DEVICE", Path, 1);
+
+	Context = DioInitialize();
+	CHECK(Context != NULL);
+
+	if (Context)
+	{
+		CHECK(DioRegisterPortAddressRange(Context, 1, &Inside));
+		CHECK(DioReadPortMultiple(Context, Buffer, sizeof(Buffer), NULL));
+
+		CHECK(DioRegisterPortAddressRange(Context, 1, &Outside));
+		SetLastError(0);
+		CHECK(!DioReadPortMultiple(Context, Buffer, sizeof(Buffer), NULL));
+		CHECK(GetLastError() == EIO);
+
+		DioShutdown(Context);
+	}
+
+	close(Descriptor);
+	unlink(Path);
+}
+
+int
+main(
+	VOID)
+{
+	DIOUM_DRIVER_CONTEXT *Context;
+	char Path[32];
+
+	File = CreateStandIn(Path, TEST_PORT_SPACE);
+	if (File < 0)
+	{
+		printf("devport_test: cannot create the stand-in\n");
+		return 1;
+	}
+
+	setenv("DIOUM_PORT_DEVICE", Path, 1);
+	setenv("DIOUM_PORT_RANGES", TEST_PORT_RANGES, 1);
+
+	Context = DioInitialize();
+	CHECK(Context != NULL);
+
+	if (Context)
+	{
+		CHECK(DioSetXorMask(Context, TEST_READ_XOR_MASK, TEST_WRITE_XOR_MASK, TRUE, TRUE));
+
+		TestRoundTrip(Context);
+		TestScatter(Context);
+		TestDescriptors(Context);
+		TestBurst(Context);
+		TestWaitPattern(Context);
+		TestOverlap(Context);
+		TestAllowedRanges(Context);
+
+		DioShutdown(Context);
+	}
+
+	close(File);
+	unlink(Path);
+
+	TestShortStandIn();
+
+	printf("devport_test: %s\n", Failures ? "FAILED" : "passed");
+
+	return Failures ? 1 : 0;
+}
@@ -0,0 +1,213 @@
+
+#include <Windows.h>
+#include "../Include/dioctl.h"
+#include "../Include/dioum.h"
+#include "dioum_internal.h"
+
+
+BOOL
+APIENTRY
+DiopOpenDevice(
+	IN DIOUM_DRIVER_CONTEXT *Context)
+/**
+ *	@brief	Opens the DIOPort device.
+ *	
+ *	This function is reserved for internal use.\n
+ *	Device is opened for overlapped I/O so the I/O manager does not serialize the concurrent calls.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	Context->Handle = CreateFileW(L"\\\\.\\dioport", GENERIC_READ | GENERIC_WRITE, 
+		0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+
+	if (Context->Handle == INVALID_HANDLE_VALUE)
+	{
+		DFTRACE("Failed to open the device (%d)\n", GetLastError());
+		Context->Handle = NULL;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+VOID
+APIENTRY
+DiopCloseDevice(
+	IN DIOUM_DRIVER_CONTEXT *Context)
+/**
+ *	@brief	Closes the device. Mappings of the driver into this process are released by the driver.
+ *	
+ *	This function is reserved for internal use.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	
+ */
+{
+	if (Context->Handle)
+		CloseHandle(Context->Handle);
+
+	Context->Handle = NULL;
+}
+
+BOOL
+APIENTRY
+DiopInitializeDeviceRequest(
+	IN DIOUM_REQUEST *Request)
+/**
+ *	@brief	Creates the event of the request, which is reused for every call.
+ *	
+ *	This function is reserved for internal use.
+ *	
+ *	@param	[in] Request				Request to add to the pool.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	Request->Overlapped.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+
+	return Request->Overlapped.hEvent != NULL;
+}
+
+VOID
+APIENTRY
+DiopDeleteDeviceRequest(
+	IN DIOUM_REQUEST *Request)
+/**
+ *	@brief	Closes the event of the request.
+ *	
+ *	This function is reserved for internal use.
+ *	
+ *	@param	[in] Request				Request to free.
+ *	
+ */
+{
+	CloseHandle(Request->Overlapped.hEvent);
+}
+
+VOID
+APIENTRY
+DiopResetOverlapped(
+	IN DIOUM_REQUEST *Request, 
+	IN ULONG Offset)
+/**
+ *	@brief	Prepares the overlapped structure of the request for the next call.
+ *	
+ *	This function is reserved for internal use.
+ *	
+ *	@param	[in] Request				Request which owns the overlapped structure.
+ *	@param	[in] Offset					File offset.
+ *	
+ */
+{
+	HANDLE Event = Request->Overlapped.hEvent;
+
+	ZeroMemory(&Request->Overlapped, sizeof(Request->Overlapped));
+	Request->Overlapped.hEvent = Event;
+	Request->Overlapped.Offset = Offset;
+}
+
+BOOL
+APIENTRY
+DiopDeviceIoControlOverlapped(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_REQUEST *Request, 
+	IN ULONG IoControlCode, 
+	IN PVOID InputBuffer, 
+	IN ULONG InputBufferLength, 
+	OUT PVOID OutputBuffer, 
+	IN ULONG OutputBufferLength, 
+	OUT ULONG *ReturnedLength)
+/**
+ *	@brief	Sends the IOCTL to the device and waits for the completion.
+ *	
+ *	This function is reserved for internal use.\n
+ *	The request supplies the event to wait on.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] Request				Request which owns the overlapped structure.
+ *	@param	[in] IoControlCode			IOCTL code.
+ *	@param	[in] InputBuffer			Input buffer.
+ *	@param	[in] InputBufferLength		Input buffer length in bytes.
+ *	@param	[out] OutputBuffer			Output buffer.
+ *	@param	[in] OutputBufferLength		Output buffer length in bytes.
+ *	@param	[out] ReturnedLength		Receives the returned length in bytes.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	BOOL Result;
+
+	DiopResetOverlapped(Request, 0);
+
+	Result = DeviceIoControl(
+		Context->Handle, 
+		IoControlCode, 
+		InputBuffer, 
+		InputBufferLength, 
+		OutputBuffer, 
+		OutputBufferLength, 
+		NULL, 
+		&Request->Overlapped);
+
+	if (!Result && GetLastError() != ERROR_IO_PENDING)
+		return FALSE;
+
+	return GetOverlappedResult(Context->Handle, &Request->Overlapped, ReturnedLength, TRUE);
+}
+
+BOOL
+APIENTRY
+DiopReadWriteDevice(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_REQUEST *Request, 
+	IN ULONG Offset, 
+	IN OUT PVOID Buffer, 
+	IN ULONG Length, 
+	IN BOOLEAN Write, 
+	OUT ULONG *TransferredLength)
+/**
+ *	@brief	Reads or writes the device at the port address, and waits for the completion.
+ *	
+ *	This function is reserved for internal use.
+ *	
+ *	@param	[in] Context				Driver context.
+ *	@param	[in] Request				Request which owns the overlapped structure.
+ *	@param	[in] Offset					Port address.
+ *	@param	[in, out] Buffer			Data.
+ *	@param	[in] Length					Length of Buffer in bytes.
+ *	@param	[in] Write					ReadFile if FALSE, WriteFile otherwise.
+ *	@param	[out] TransferredLength		Receives the transferred length in bytes.
+ *	@return								Non-zero if successful.
+ *	
+ */
+{
+	BOOL Result;
+
+	*TransferredLength = 0;
+
+	DiopResetOverlapped(Request, Offset);
+
+	if (Write)
+		Result = WriteFile(Context->Handle, Buffer, Length, NULL, &Request->Overlapped);
+	else
+		Result = ReadFile(Context->Handle, Buffer, Length, NULL, &Request->Overlapped);
+
+	if (!Result && GetLastError() != ERROR_IO_PENDING)
+		return FALSE;
+
+	return GetOverlappedResult(Context->Handle, &Request->Overlapped, TransferredLength, TRUE);
+}
+
+
+const DIOUM_TRANSPORT DiopTransport = {
+	"dioport", 
+	DiopOpenDevice, 
+	DiopCloseDevice, 
+	DiopInitializeDeviceRequest, 
+	DiopDeleteDeviceRequest, 
+	DiopDeviceIoControlOverlapped, 
+	DiopReadWriteDevice, 
+};
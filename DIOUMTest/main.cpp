@@ -20,11 +20,112 @@ void PrintBuffer(const char *Message, unsigned char *Buffer, int Length)
 	printf("\n");
 }
 
+// Average nanoseconds of one read of the registered range, with the given driver configuration.
+double MeasureReadLatency(DIOUM_DRIVER_CONTEXT *Context, ULONG ConfigurationBits, ULONG Count)
+{
+	UCHAR Buffer[0x100];
+	ULONG ReturnedLength;
+	LARGE_INTEGER Frequency;
+	LARGE_INTEGER Start;
+	LARGE_INTEGER End;
+
+	if (!DioSetDriverConfiguration(Context, ConfigurationBits))
+		return -1.0;
+
+	QueryPerformanceFrequency(&Frequency);
+	QueryPerformanceCounter(&Start);
+
+	for (ULONG i = 0; i < Count; i++)
+	{
+		if (!DioReadPortMultiple(Context, Buffer, ARRAYSIZE(Buffer), &ReturnedLength))
+			return -1.0;
+	}
+
+	QueryPerformanceCounter(&End);
+
+	return (double)(End.QuadPart - Start.QuadPart) * 1e9 / Frequency.QuadPart / Count;
+}
+
+typedef struct _READ_LOOP_PARAMETER {
+	DIOUM_DRIVER_CONTEXT *Context;
+	HANDLE StartEvent;
+	ULONG Count;
+} READ_LOOP_PARAMETER;
+
+DWORD WINAPI ReadLoopThread(LPVOID Parameter)
+{
+	READ_LOOP_PARAMETER *ReadLoop = (READ_LOOP_PARAMETER *)Parameter;
+	UCHAR Buffer[0x100];
+	ULONG ReturnedLength;
+
+	WaitForSingleObject(ReadLoop->StartEvent, INFINITE);
+
+	for (ULONG i = 0; i < ReadLoop->Count; i++)
+	{
+		if (!DioReadPortMultiple(ReadLoop->Context, Buffer, ARRAYSIZE(Buffer), &ReturnedLength))
+			return 1;
+	}
+
+	return 0;
+}
+
+// Reads per second of the registered range, with Producers threads reading Count times each at once.
+double MeasureReadThroughput(DIOUM_DRIVER_CONTEXT *Context, ULONG Producers, ULONG Count)
+{
+	HANDLE Threads[32];
+	READ_LOOP_PARAMETER ReadLoop;
+	LARGE_INTEGER Frequency;
+	LARGE_INTEGER Start;
+	LARGE_INTEGER End;
+	ULONG Created = 0;
+
+	if (Producers > ARRAYSIZE(Threads))
+		return -1.0;
+
+	ReadLoop.Context = Context;
+	ReadLoop.StartEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	ReadLoop.Count = Count;
+
+	if (!ReadLoop.StartEvent)
+		return -1.0;
+
+	for (Created = 0; Created < Producers; Created++)
+	{
+		Threads[Created] = CreateThread(NULL, 0, ReadLoopThread, &ReadLoop, 0, NULL);
+		if (!Threads[Created])
+			break;
+	}
+
+	QueryPerformanceFrequency(&Frequency);
+	QueryPerformanceCounter(&Start);
+
+	SetEvent(ReadLoop.StartEvent);
+	WaitForMultipleObjects(Created, Threads, TRUE, INFINITE);
+
+	QueryPerformanceCounter(&End);
+
+	for (ULONG i = 0; i < Created; i++)
+		CloseHandle(Threads[i]);
+
+	CloseHandle(ReadLoop.StartEvent);
+
+	if (Created < Producers)
+		return -1.0;
+
+	return (double)Producers * Count * Frequency.QuadPart / (End.QuadPart - Start.QuadPart);
+}
+
 int wmain(int argc, wchar_t **wargv, wchar_t **wenvp)
 {
 	UCHAR Buffer[0x100];
 	ULONG ReturnedLength;
 	BOOL WaitCtrlC = FALSE;
+	wchar_t *RecordFileName = NULL;
+	wchar_t *ReplayFileName = NULL;
+	BOOL ReplaySimulated = FALSE;
+	ULONG ReplayFlags = 0;
+	ULONG BenchmarkCount = 0;
+	ULONG WorkerBenchmarkCount = 0;
 
 	DIOUM_DRIVER_CONTEXT *Context = DioInitialize();
 	DIOUM_PORT_RANGE PortRange[] = {
@@ -47,9 +148,49 @@ int wmain(int argc, wchar_t **wargv, wchar_t **wenvp)
 				ConfigurationBit |= DIOUM_CFGB_SHOW_DEBUG_OUTPUT;
 			else if (!_wcsicmp(L"-cc", wargv[i]))
 				WaitCtrlC = TRUE;
+			else if (!_wcsicmp(L"-record", wargv[i]) && i + 1 < argc)
+				RecordFileName = wargv[++i];
+			else if (!_wcsicmp(L"-replay", wargv[i]) && i + 1 < argc)
+				ReplayFileName = wargv[++i];
+			else if (!_wcsicmp(L"-sim", wargv[i]))
+				ReplaySimulated = TRUE;
+			else if (!_wcsicmp(L"-timed", wargv[i]))
+				ReplayFlags |= DIOUM_REPLAY_ORIGINAL_TIMING;
+			else if (!_wcsicmp(L"-bench", wargv[i]) && i + 1 < argc)
+				BenchmarkCount = wcstoul(wargv[++i], NULL, 0);
+			else if (!_wcsicmp(L"-mpsc", wargv[i]) && i + 1 < argc)
+				WorkerBenchmarkCount = wcstoul(wargv[++i], NULL, 0);
 		}
 	}
 
+	if (ReplayFileName)
+	{
+		DIOUM_REPLAY_STATISTICS Statistics;
+
+		if (!DioReplayLog(ReplaySimulated ? NULL : Context, ReplayFileName, ReplayFlags, &Statistics))
+			printf("WARNING: Replay stopped before the end of the log\n");
+
+		printf("Records %u, replayed %u, skipped %u, failed %u, mismatched reads %u\n", 
+			Statistics.RecordCount, Statistics.ReplayedCount, Statistics.SkippedCount, 
+			Statistics.FailedCount, Statistics.MismatchCount);
+
+		if (Statistics.ReplayedCount)
+		{
+			printf("Average latency: recorded %llu ns, replayed %llu ns (difference %lld ~ %lld ns)\n", 
+				Statistics.RecordedLatency / Statistics.ReplayedCount, 
+				Statistics.ReplayedLatency / Statistics.ReplayedCount, 
+				Statistics.MinimumLatencyDifference, Statistics.MaximumLatencyDifference);
+		}
+
+		DioShutdown(Context);
+		return 0;
+	}
+
+	if (RecordFileName && !DioStartRecording(Context, RecordFileName, 0))
+	{
+		printf("WARNING: Failed to start recording\n");
+	}
+
 	if (!DioSetDriverConfiguration(Context, ConfigurationBit))
 	{
 		printf("WARNING: Failed to set driver configuration\n");
@@ -71,6 +212,44 @@ int wmain(int argc, wchar_t **wargv, wchar_t **wenvp)
 
 		PrintBuffer("Read", Buffer, ReturnedLength);
 
+		if (BenchmarkCount)
+		{
+			// Small reads take the fast I/O path unless it is disabled.
+			double FastIo = MeasureReadLatency(Context, ConfigurationBit, BenchmarkCount);
+			double Irp = MeasureReadLatency(Context, ConfigurationBit | DIOUM_CFGB_DISABLE_FAST_IO, BenchmarkCount);
+
+			DioSetDriverConfiguration(Context, ConfigurationBit);
+
+			printf("Read latency (%u bytes, %u ops): fast I/O %.0f ns, IRP %.0f ns\n", 
+				ReturnedLength, BenchmarkCount, FastIo, Irp);
+		}
+
+		if (WorkerBenchmarkCount)
+		{
+			SYSTEM_INFO SystemInfo;
+
+			GetSystemInfo(&SystemInfo);
+
+			// Worker takes the last processor, so it does not compete with the producers there.
+			for (ULONG Producers = 1; Producers <= 32; Producers *= 2)
+			{
+				DIOUM_WORKER_STATUS Status = { 0 };
+				double Spinlock = MeasureReadThroughput(Context, Producers, WorkerBenchmarkCount);
+				double Worker = -1.0;
+
+				if (DioStartPortWorker(Context, SystemInfo.dwNumberOfProcessors - 1, 100))
+				{
+					Worker = MeasureReadThroughput(Context, Producers, WorkerBenchmarkCount);
+					DioQueryPortWorker(Context, &Status);
+					DioStopPortWorker(Context);
+				}
+
+				printf("%2u producers: port lock %.0f reads/s, worker %.0f reads/s (%.1f reads per lock hold)\n", 
+					Producers, Spinlock, Worker, 
+					Status.Batches ? (double)Status.Requests / Status.Batches : 0.0);
+			}
+		}
+
 //		for (int i = 0; i < ARRAYSIZE(Buffer); i++)
 //			Buffer[i] = (UCHAR)i;
 //
@@ -84,6 +263,9 @@ int wmain(int argc, wchar_t **wargv, wchar_t **wenvp)
 
 	} while(FALSE);
 
+	if (RecordFileName)
+		DioStopRecording(Context, NULL);
+
 	if (Context)
 		DioShutdown(Context);
 
@@ -9,6 +9,41 @@
 #define DIO_IOFN_WRITE_CONFIGURATION	0x802
 #define	DIO_IOFN_READ_PORT				0x803
 #define DIO_IOFN_WRITE_PORT				0x804
+#define DIO_IOFN_QUERY_RESOURCES		0x805
+#define DIO_IOFN_WAIT_PATTERN			0x806
+#define DIO_IOFN_QUERY_CLOCK			0x807
+#define DIO_IOFN_START_EDGE_ENGINE		0x808
+#define DIO_IOFN_STOP_EDGE_ENGINE		0x809
+#define DIO_IOFN_QUERY_EDGE_COUNTERS	0x80a
+#define DIO_IOFN_START_STREAM			0x80b
+#define DIO_IOFN_WRITE_STREAM			0x80c
+#define DIO_IOFN_STOP_STREAM			0x80d
+#define DIO_IOFN_QUERY_STREAM			0x80e
+#define DIO_IOFN_START_SCHEDULER		0x80f
+#define DIO_IOFN_STOP_SCHEDULER			0x810
+#define DIO_IOFN_SCHEDULE_OUTPUT		0x811
+#define DIO_IOFN_QUERY_SCHEDULER		0x812
+#define DIO_IOFN_LOAD_REACTION			0x813
+#define DIO_IOFN_UNLOAD_REACTION		0x814
+#define DIO_IOFN_START_REACTOR			0x815
+#define DIO_IOFN_STOP_REACTOR			0x816
+#define DIO_IOFN_QUERY_REACTOR			0x817
+#define DIO_IOFN_CREATE_RING			0x818
+#define DIO_IOFN_ENTER_RING				0x819
+#define DIO_IOFN_DESTROY_RING			0x81a
+#define DIO_IOFN_SET_FILE_MODE			0x81b
+#define DIO_IOFN_MAP_SNAPSHOT			0x81c
+#define DIO_IOFN_START_SNAPSHOT			0x81d
+#define DIO_IOFN_STOP_SNAPSHOT			0x81e
+#define DIO_IOFN_START_WORKER			0x81f
+#define DIO_IOFN_STOP_WORKER			0x820
+#define DIO_IOFN_QUERY_WORKER			0x821
+#define DIO_IOFN_READ_PORT_V2			0x822
+#define DIO_IOFN_WRITE_PORT_V2			0x823
+#define DIO_IOFN_READ_BURST				0x824
+#define DIO_IOFN_QUERY_MEMORY_RESOURCES	0x825
+#define DIO_IOFN_MAP_MEMORY				0x826
+#define DIO_IOFN_UNMAP_MEMORY			0x827
 
 #ifndef _NTDDK_
 
@@ -18,6 +53,7 @@
 
 #define FILE_DEVICE_UNKNOWN             0x00000022
 #define METHOD_BUFFERED                 0
+#define METHOD_OUT_DIRECT               2
 #define FILE_ANY_ACCESS                 0
 
 #define CTL_CODE( DeviceType, Function, Method, Access ) (                 \
@@ -28,10 +64,48 @@
 
 #define	DIO_CREATE_IOCTL(_fn)					CTL_CODE(FILE_DEVICE_UNKNOWN, (_fn), METHOD_BUFFERED, FILE_ANY_ACCESS)
 
+// Output buffer is locked and mapped by the driver, so the data is not copied by the I/O manager.
+#define DIO_CREATE_IOCTL_DIRECT(_fn)			CTL_CODE(FILE_DEVICE_UNKNOWN, (_fn), METHOD_OUT_DIRECT, FILE_ANY_ACCESS)
+
 #define DIO_IOCTL_READ_CONFIGURATION			DIO_CREATE_IOCTL(DIO_IOFN_READ_CONFIGURATION)
 #define DIO_IOCTL_WRITE_CONFIGURATION			DIO_CREATE_IOCTL(DIO_IOFN_WRITE_CONFIGURATION)
 #define	DIO_IOCTL_READ_PORT						DIO_CREATE_IOCTL(DIO_IOFN_READ_PORT)
 #define DIO_IOCTL_WRITE_PORT					DIO_CREATE_IOCTL(DIO_IOFN_WRITE_PORT)
+#define DIO_IOCTL_QUERY_RESOURCES				DIO_CREATE_IOCTL(DIO_IOFN_QUERY_RESOURCES)
+#define DIO_IOCTL_WAIT_PATTERN					DIO_CREATE_IOCTL(DIO_IOFN_WAIT_PATTERN)
+#define DIO_IOCTL_QUERY_CLOCK					DIO_CREATE_IOCTL(DIO_IOFN_QUERY_CLOCK)
+#define DIO_IOCTL_START_EDGE_ENGINE				DIO_CREATE_IOCTL(DIO_IOFN_START_EDGE_ENGINE)
+#define DIO_IOCTL_STOP_EDGE_ENGINE				DIO_CREATE_IOCTL(DIO_IOFN_STOP_EDGE_ENGINE)
+#define DIO_IOCTL_QUERY_EDGE_COUNTERS			DIO_CREATE_IOCTL(DIO_IOFN_QUERY_EDGE_COUNTERS)
+#define DIO_IOCTL_START_STREAM					DIO_CREATE_IOCTL(DIO_IOFN_START_STREAM)
+#define DIO_IOCTL_WRITE_STREAM					DIO_CREATE_IOCTL(DIO_IOFN_WRITE_STREAM)
+#define DIO_IOCTL_STOP_STREAM					DIO_CREATE_IOCTL(DIO_IOFN_STOP_STREAM)
+#define DIO_IOCTL_QUERY_STREAM					DIO_CREATE_IOCTL(DIO_IOFN_QUERY_STREAM)
+#define DIO_IOCTL_START_SCHEDULER				DIO_CREATE_IOCTL(DIO_IOFN_START_SCHEDULER)
+#define DIO_IOCTL_STOP_SCHEDULER				DIO_CREATE_IOCTL(DIO_IOFN_STOP_SCHEDULER)
+#define DIO_IOCTL_SCHEDULE_OUTPUT				DIO_CREATE_IOCTL(DIO_IOFN_SCHEDULE_OUTPUT)
+#define DIO_IOCTL_QUERY_SCHEDULER				DIO_CREATE_IOCTL(DIO_IOFN_QUERY_SCHEDULER)
+#define DIO_IOCTL_LOAD_REACTION					DIO_CREATE_IOCTL(DIO_IOFN_LOAD_REACTION)
+#define DIO_IOCTL_UNLOAD_REACTION				DIO_CREATE_IOCTL(DIO_IOFN_UNLOAD_REACTION)
+#define DIO_IOCTL_START_REACTOR					DIO_CREATE_IOCTL(DIO_IOFN_START_REACTOR)
+#define DIO_IOCTL_STOP_REACTOR					DIO_CREATE_IOCTL(DIO_IOFN_STOP_REACTOR)
+#define DIO_IOCTL_QUERY_REACTOR					DIO_CREATE_IOCTL(DIO_IOFN_QUERY_REACTOR)
+#define DIO_IOCTL_CREATE_RING					DIO_CREATE_IOCTL(DIO_IOFN_CREATE_RING)
+#define DIO_IOCTL_ENTER_RING					DIO_CREATE_IOCTL(DIO_IOFN_ENTER_RING)
+#define DIO_IOCTL_DESTROY_RING					DIO_CREATE_IOCTL(DIO_IOFN_DESTROY_RING)
+#define DIO_IOCTL_SET_FILE_MODE					DIO_CREATE_IOCTL(DIO_IOFN_SET_FILE_MODE)
+#define DIO_IOCTL_MAP_SNAPSHOT					DIO_CREATE_IOCTL(DIO_IOFN_MAP_SNAPSHOT)
+#define DIO_IOCTL_START_SNAPSHOT				DIO_CREATE_IOCTL(DIO_IOFN_START_SNAPSHOT)
+#define DIO_IOCTL_STOP_SNAPSHOT					DIO_CREATE_IOCTL(DIO_IOFN_STOP_SNAPSHOT)
+#define DIO_IOCTL_START_WORKER					DIO_CREATE_IOCTL(DIO_IOFN_START_WORKER)
+#define DIO_IOCTL_STOP_WORKER					DIO_CREATE_IOCTL(DIO_IOFN_STOP_WORKER)
+#define DIO_IOCTL_QUERY_WORKER					DIO_CREATE_IOCTL(DIO_IOFN_QUERY_WORKER)
+#define DIO_IOCTL_READ_PORT_V2					DIO_CREATE_IOCTL_DIRECT(DIO_IOFN_READ_PORT_V2)
+#define DIO_IOCTL_WRITE_PORT_V2					DIO_CREATE_IOCTL_DIRECT(DIO_IOFN_WRITE_PORT_V2)
+#define DIO_IOCTL_READ_BURST					DIO_CREATE_IOCTL_DIRECT(DIO_IOFN_READ_BURST)
+#define DIO_IOCTL_QUERY_MEMORY_RESOURCES		DIO_CREATE_IOCTL(DIO_IOFN_QUERY_MEMORY_RESOURCES)
+#define DIO_IOCTL_MAP_MEMORY					DIO_CREATE_IOCTL(DIO_IOFN_MAP_MEMORY)
+#define DIO_IOCTL_UNMAP_MEMORY					DIO_CREATE_IOCTL(DIO_IOFN_UNMAP_MEMORY)
 
 
 
@@ -60,6 +134,15 @@ typedef struct _DIO_PORT_RANGE {
 )
 
 
+// Flags in the upper bits of DIO_PACKET_PORT_IO.RangeCount. Lower bits hold the count.
+#define DIO_PORT_IO_RANGE_COUNT_MASK		0x0000ffff
+#define DIO_PORT_IO_FLAG_TIMESTAMP			0x80000000	//!< Appends DIO_PORT_IO_TIMESTAMP to the output.
+#define DIO_PORT_IO_FLAG_GROUP				0x40000000	//!< Runs the ports as one group. Appends DIO_PORT_IO_SKEW to the output.
+#define DIO_PORT_IO_VALID_FLAGS				(DIO_PORT_IO_FLAG_TIMESTAMP | DIO_PORT_IO_FLAG_GROUP)
+
+// Data length of a group, which is transferred with the interrupts disabled.
+#define DIO_PORT_IO_GROUP_MAXIMUM_LENGTH	16
+
 #pragma warning(push)
 #pragma warning(disable: 4200)
 
@@ -67,7 +150,10 @@ typedef struct _DIO_PORT_RANGE {
  *	@brief	Port access packet structure.
  *
  *	Contains one or multiple port address ranges.\n
- *	[RangeCount] [AddressRange1, AddressRange2, ... AddressRangeN] [Data]
+ *	[RangeCount] [AddressRange1, AddressRange2, ... AddressRangeN] [Data]\n
+ *	If DIO_PORT_IO_FLAG_TIMESTAMP is set, DIO_PORT_IO_TIMESTAMP follows the output
+ *	(after the data for read, after the ranges for write).
+ *	If DIO_PORT_IO_FLAG_GROUP is set, DIO_PORT_IO_SKEW follows it.
  */
 typedef struct _DIO_PACKET_PORT_IO {
 	ULONG RangeCount;				//!< Count of DIO_PORT_RANGE.
@@ -79,10 +165,840 @@ typedef struct _DIO_PACKET_PORT_IO {
 #define	PACKET_PORT_IO_GET_LENGTH(_range_cnt)	\
 	( sizeof(DIO_PACKET_PORT_IO) + (_range_cnt) * sizeof(DIO_PORT_RANGE) )
 
+#define PACKET_PORT_IO_GET_RANGE_COUNT(_port_io)	\
+	( (_port_io)->RangeCount & DIO_PORT_IO_RANGE_COUNT_MASK )
+
 #define	PACKET_PORT_IO_GET_DATA_ADDRESS(_port_io)	\
-	( (PUCHAR)((_port_io)->AddressRange + (_port_io)->RangeCount) )
+	( (PUCHAR)((_port_io)->AddressRange + PACKET_PORT_IO_GET_RANGE_COUNT(_port_io)) )
+
+/**
+ *	@brief	Timestamps of port I/O.
+ *
+ *	Kernel performance counter values taken under the port lock.
+ */
+typedef struct _DIO_PORT_IO_TIMESTAMP {
+	LONGLONG StartTime;				//!< Counter right before the first port access.
+	LONGLONG EndTime;				//!< Counter right after the last port access.
+	LONGLONG Frequency;				//!< Counter frequency.
+} DIO_PORT_IO_TIMESTAMP;
+
+/**
+ *	@brief	Skew of the group port I/O.
+ *
+ *	Measured with the processor time stamp counter, from the end of the first port access to
+ *	the end of the last one.
+ */
+typedef struct _DIO_PORT_IO_SKEW {
+	ULONGLONG Cycles;				//!< Time stamp counter ticks.
+	ULONG Nanoseconds;				//!< Cycles in nanoseconds. Zero if the counter is not calibrated.
+	ULONG PortCount;				//!< Count of port accesses in the group.
+} DIO_PORT_IO_SKEW;
+
+
+//
+// Structures for Port I/O version 2.
+// Ports are described by the strided descriptors, and the output buffer carries the data only.
+//
+
+#define DIO_PORT_IO_VERSION2					2
+
+#define DIO_PORT_IO_V2_MAXIMUM_DESCRIPTORS		4096
+#define DIO_PORT_IO_V2_MAXIMUM_DATA_LENGTH		0x100000
+
+#define DIO_PORT_IO_V2_FLAG_TIMESTAMP			0x0001	//!< Appends DIO_PORT_IO_TIMESTAMP to the data.
+#define DIO_PORT_IO_V2_FLAG_MEMORY_SPACE		0x0002	//!< Descriptors are DIO_MEMORY_DESCRIPTOR (DIO_PACKET_MEMORY_IO_V2).
+#define DIO_PORT_IO_V2_VALID_FLAGS				(DIO_PORT_IO_V2_FLAG_TIMESTAMP | DIO_PORT_IO_V2_FLAG_MEMORY_SPACE)
+
+/**
+ *	@brief	Strided port descriptor.
+ *
+ *	Element i is the Width consecutive ports from StartAddress + i * Stride, and the Count
+ *	elements are transferred Repeat times, so the data length is Count * Width * Repeat.
+
+ *	Stride 0 transfers the same ports Count times (FIFO if Width is 1).
+ */
+typedef struct _DIO_PORT_DESCRIPTOR {
+	USHORT StartAddress;			//!< First port of the first element.
+	USHORT Count;					//!< Count of elements. Non-zero.
+	USHORT Stride;					//!< Port distance between the elements.
+	USHORT Width;					//!< Consecutive ports of an element. Non-zero.
+	USHORT Repeat;					//!< Times the elements are transferred. Non-zero.
+} DIO_PORT_DESCRIPTOR;
+
+#pragma warning(push)
+#pragma warning(disable: 4200)
+
+/**
+ *	@brief	Port access packet structure, version 2.
+ *
+ *	Input buffer : [Header] [Descriptor1, Descriptor2, ... DescriptorN]\n
+ *	Output buffer: [Data] [DIO_PORT_IO_TIMESTAMP if DIO_PORT_IO_V2_FLAG_TIMESTAMP]\n
+ *	Data is in the order of the descriptors. Driver reads the data from the output buffer for write.
+ */
+typedef struct _DIO_PACKET_PORT_IO_V2 {
+	USHORT Version;					//!< DIO_PORT_IO_VERSION2.
+	USHORT Flags;					//!< Combination of DIO_PORT_IO_V2_FLAG_XXX.
+	ULONG DescriptorCount;			//!< Count of DIO_PORT_DESCRIPTOR.
+	DIO_PORT_DESCRIPTOR Descriptors[];
+} DIO_PACKET_PORT_IO_V2;
+#pragma warning(pop)
+
+#define PACKET_PORT_IO_V2_GET_LENGTH(_desc_cnt)	\
+	( sizeof(DIO_PACKET_PORT_IO_V2) + (_desc_cnt) * sizeof(DIO_PORT_DESCRIPTOR) )
+
+
+//
+// Structures for memory-mapped I/O.
+// Memory resources of the device are mapped by the driver and addressed by their index and a
+// byte offset. The version 2 packet carries the memory space with DIO_PORT_IO_V2_FLAG_MEMORY_SPACE.
+//
+
+#define DIO_MAXIMUM_MEMORY_RANGES				8
+
+// Windows mapped to the caller start and end at this alignment.
+#define DIO_MEMORY_WINDOW_ALIGNMENT				0x1000
+
+#define DIO_MEMORY_RANGE_FLAG_MAPPABLE			0x00000001	//!< Resource is page aligned, so windows can be mapped.
+
+/**
+ *	@brief	Memory range structure.
+ *
+ *	Describes a memory resource which is claimed by the device.
+ */
+typedef struct _DIO_MEMORY_RANGE {
+	ULONGLONG PhysicalAddress;		//!< Translated physical address of the resource.
+	ULONG Length;					//!< Length in bytes. Registers are at offsets 0 ~ Length - 1.
+	ULONG Flags;					//!< Combination of DIO_MEMORY_RANGE_FLAG_XXX.
+} DIO_MEMORY_RANGE;
+
+/**
+ *	@brief	Strided memory descriptor.
+ *
+ *	Element i is one access of Width bytes at Offset + i * Stride of the memory resource, and the
+ *	Count elements are transferred Repeat times, so the data length is Count * Width * Repeat.\n
+ *	Offset and Stride are multiples of Width. Stride 0 accesses the same register Count times.
+ */
+typedef struct _DIO_MEMORY_DESCRIPTOR {
+	ULONG Offset;					//!< Byte offset of the first element in the resource.
+	ULONG Stride;					//!< Byte distance between the elements.
+	USHORT Count;					//!< Count of elements. Non-zero.
+	USHORT Width;					//!< Access width in bytes: 1, 2, 4 or 8 (8 on 64-bit drivers only).
+	USHORT Repeat;					//!< Times the elements are transferred. Non-zero.
+	USHORT Resource;				//!< Index of the memory resource, below DIO_MAXIMUM_MEMORY_RANGES.
+} DIO_MEMORY_DESCRIPTOR;
+
+#pragma warning(push)
+#pragma warning(disable: 4200)
+
+/**
+ *	@brief	Memory access packet structure.
+ *
+ *	Same header and buffers as DIO_PACKET_PORT_IO_V2, with DIO_PORT_IO_V2_FLAG_MEMORY_SPACE set.
+ *	Sent with DIO_IOCTL_READ_PORT_V2 and DIO_IOCTL_WRITE_PORT_V2.
+ */
+typedef struct _DIO_PACKET_MEMORY_IO_V2 {
+	USHORT Version;					//!< DIO_PORT_IO_VERSION2.
+	USHORT Flags;					//!< DIO_PORT_IO_V2_FLAG_MEMORY_SPACE, and the other DIO_PORT_IO_V2_FLAG_XXX.
+	ULONG DescriptorCount;			//!< Count of DIO_MEMORY_DESCRIPTOR.
+	DIO_MEMORY_DESCRIPTOR Descriptors[];
+} DIO_PACKET_MEMORY_IO_V2;
+
+/**
+ *	@brief	Memory resource query packet structure.
+ *
+ *	RangeCount is the total count even if the output buffer is too small to hold all ranges.
+ */
+typedef struct _DIO_PACKET_QUERY_MEMORY_RESOURCES {
+	ULONG RangeCount;				//!< Count of claimed DIO_MEMORY_RANGE.
+	DIO_MEMORY_RANGE AddressRange[];	//!< Claimed memory ranges, in the order of the indices.
+} DIO_PACKET_QUERY_MEMORY_RESOURCES;
+#pragma warning(pop)
+
+#define PACKET_MEMORY_IO_V2_GET_LENGTH(_desc_cnt)	\
+	( sizeof(DIO_PACKET_MEMORY_IO_V2) + (_desc_cnt) * sizeof(DIO_MEMORY_DESCRIPTOR) )
+
+#define PACKET_QUERY_MEMORY_RESOURCES_GET_LENGTH(_range_cnt)	\
+	( sizeof(DIO_PACKET_QUERY_MEMORY_RESOURCES) + (_range_cnt) * sizeof(DIO_MEMORY_RANGE) )
+
+/**
+ *	@brief	Memory window map packet structure.
+ *
+ *	Window is mapped uncached to the caller, one window per resource, and unmapped when the
+ *	handle is closed.
+ */
+typedef struct _DIO_PACKET_MAP_MEMORY {
+	ULONG Resource;					//!< Index of the memory resource. Must be DIO_MEMORY_RANGE_FLAG_MAPPABLE.
+	ULONG Offset;					//!< Multiple of DIO_MEMORY_WINDOW_ALIGNMENT.
+	ULONG Length;					//!< Non-zero. Rounded up to DIO_MEMORY_WINDOW_ALIGNMENT.
+	ULONG Reserved;
+} DIO_PACKET_MAP_MEMORY;
+
+/**
+ *	@brief	Memory window mapped to the caller.
+ */
+typedef struct _DIO_PACKET_MEMORY_WINDOW {
+	ULONGLONG Address;				//!< Address of the register at Offset in the caller's address space.
+	ULONG Length;					//!< Length of the mapping.
+	ULONG Reserved;
+} DIO_PACKET_MEMORY_WINDOW;
+
+/**
+ *	@brief	Memory window unmap packet structure.
+ */
+typedef struct _DIO_PACKET_UNMAP_MEMORY {
+	ULONG Resource;					//!< Index of the memory resource.
+} DIO_PACKET_UNMAP_MEMORY;
+
+
+//
+// Structures for the burst read.
+// Ranges are read FrameCount times back to back, and each frame is read with one hold of the lock.
+//
+
+#define DIO_BURST_MAXIMUM_FRAMES				0x10000
+#define DIO_BURST_MAXIMUM_DATA_LENGTH			0x100000
+
+#define DIO_BURST_FLAG_PLANAR					0x00000001	//!< Data of each range is contiguous over the frames.
+#define DIO_BURST_FLAG_TIMESTAMPS				0x00000002	//!< Appends the counter value of each frame to the data.
+#define DIO_BURST_VALID_FLAGS					(DIO_BURST_FLAG_PLANAR | DIO_BURST_FLAG_TIMESTAMPS)
+
+#pragma warning(push)
+#pragma warning(disable: 4200)
+
+/**
+ *	@brief	Burst read packet structure.
+ *
+ *	Input buffer : [Header] [AddressRange1, AddressRange2, ... AddressRangeN]\n
+ *	Output buffer: [Data] [LONGLONG Timestamps[FrameCount] if DIO_BURST_FLAG_TIMESTAMPS]\n
+ *	Frame f of range r is at f * FrameLength + Offset(r), or at Offset(r) * FrameCount + f * Length(r)
+ *	if DIO_BURST_FLAG_PLANAR. Timestamps are the kernel performance counter after each frame.
+ */
+typedef struct _DIO_PACKET_READ_BURST {
+	ULONG FrameCount;				//!< Times the ranges are read, 1 ~ DIO_BURST_MAXIMUM_FRAMES.
+	ULONG Flags;					//!< Combination of DIO_BURST_FLAG_XXX.
+	ULONG RangeCount;				//!< Count of DIO_PORT_RANGE, 1 ~ DIO_MAXIMUM_PORT_RANGES.
+	DIO_PORT_RANGE AddressRange[];
+} DIO_PACKET_READ_BURST;
+#pragma warning(pop)
+
+#define PACKET_READ_BURST_GET_LENGTH(_range_cnt)	\
+	( sizeof(DIO_PACKET_READ_BURST) + (_range_cnt) * sizeof(DIO_PORT_RANGE) )
+
+
+#pragma warning(push)
+#pragma warning(disable: 4200)
+
+/**
+ *	@brief	Resource query packet structure.
+ *
+ *	Receives the port address ranges claimed by the device.\n
+ *	RangeCount is the total count even if the output buffer is too small to hold all ranges.
+ */
+typedef struct _DIO_PACKET_QUERY_RESOURCES {
+	ULONG RangeCount;				//!< Count of claimed DIO_PORT_RANGE.
+	DIO_PORT_RANGE AddressRange[];	//!< Claimed address ranges.
+} DIO_PACKET_QUERY_RESOURCES;
+#pragma warning(pop)
+
+
+
+//
+// Structure for pattern wait.
+//
+
+// Upper bound of MaximumSpinTime in microseconds.
+#define DIO_WAIT_PATTERN_MAXIMUM_SPIN_TIME		10000
+
+// Reads ReadRange right after the pattern is observed, without releasing the port lock.
+#define DIO_WAIT_PATTERN_FLAG_READ				0x00000001
+
+#pragma warning(push)
+#pragma warning(disable: 4200)
+
+/**
+ *	@brief	Pattern wait packet structure.
+ *
+ *	Polls the port until (Input & Mask) == Value or the spin time is elapsed.
+
+ *	[Parameters] [Results] [Data of ReadRange if DIO_WAIT_PATTERN_FLAG_READ]
+ */
+typedef struct _DIO_PACKET_WAIT_PATTERN {
+	USHORT Port;					//!< Port address to poll.
+	UCHAR Mask;						//!< Bits to compare.
+	UCHAR Value;					//!< Expected value of the masked bits.
+	ULONG MaximumSpinTime;			//!< Microseconds. Capped at DIO_WAIT_PATTERN_MAXIMUM_SPIN_TIME.
+	ULONG PollInterval;				//!< Microseconds between the probes. Zero for back-to-back probes.
+	ULONG Flags;					//!< Combination of DIO_WAIT_PATTERN_FLAG_XXX.
+	DIO_PORT_RANGE ReadRange;		//!< Range to read after the match.
+	ULONG Matched;					//!< [out] Non-zero if the pattern is observed.
+	ULONG ObservedValue;			//!< [out] Last value read from the port.
+	ULONG ElapsedTime;				//!< [out] Elapsed time in microseconds.
+	ULONG Iterations;				//!< [out] Count of the probes.
+	UCHAR Data[];					//!< [out] Data of ReadRange.
+} DIO_PACKET_WAIT_PATTERN;
+#pragma warning(pop)
+
+#define PACKET_WAIT_PATTERN_GET_LENGTH(_wait)							\
+	( sizeof(DIO_PACKET_WAIT_PATTERN) + (((_wait)->Flags & DIO_WAIT_PATTERN_FLAG_READ) ?	\
+		(ULONG)((_wait)->ReadRange.EndAddress - (_wait)->ReadRange.StartAddress + 1) : 0) )
+
+
+
+
+/**
+ *	@brief	Clock query packet structure.
+ *
+ *	Used to correlate the kernel performance counter with the application clock.
+ */
+typedef struct _DIO_PACKET_QUERY_CLOCK {
+	LONGLONG Counter;				//!< Kernel performance counter.
+	LONGLONG Frequency;				//!< Counter frequency.
+} DIO_PACKET_QUERY_CLOCK;
+
+
+//
+// Structure for edge counting engine.
+//
+
+#define DIO_EDGE_MAXIMUM_CHANNELS				32
+#define DIO_EDGE_MAXIMUM_DECODERS				8
+
+// Sampler thread may run on any processor.
+#define DIO_EDGE_ANY_PROCESSOR					0xffffffff
+
+// Channel level is inverted before the edge detection (active low).
+#define DIO_EDGE_CHANNEL_INVERTED				0x01
+#define DIO_EDGE_CHANNEL_VALID_FLAGS			(DIO_EDGE_CHANNEL_INVERTED)
+
+// Decoder has no index channel.
+#define DIO_QUADRATURE_NO_INDEX					0xff
+
+// Position is cleared on the rising edge of the index.
+#define DIO_QUADRATURE_FLAG_RESET_ON_INDEX		0x01
+// Counts down when A leads B.
+#define DIO_QUADRATURE_FLAG_REVERSE				0x02
+#define DIO_QUADRATURE_VALID_FLAGS				(DIO_QUADRATURE_FLAG_RESET_ON_INDEX | DIO_QUADRATURE_FLAG_REVERSE)
+
+// Age of the channel which has not seen a rising edge.
+#define DIO_EDGE_NO_EDGE						((ULONGLONG)-1)
+
+/**
+ *	@brief	Input channel of the edge counting engine.
+ */
+typedef struct _DIO_EDGE_CHANNEL {
+	USHORT Port;					//!< Port address to sample.
+	UCHAR Bit;						//!< Bit in the port (0 ~ 7).
+	UCHAR Flags;					//!< Combination of DIO_EDGE_CHANNEL_XXX.
+} DIO_EDGE_CHANNEL;
+
+/**
+ *	@brief	Quadrature decoder of the edge counting engine.
+ *
+ *	Refers to the channels by index. Every transition of A and B is counted (4x decoding).
+ */
+typedef struct _DIO_QUADRATURE_DECODER {
+	UCHAR ChannelA;					//!< Index of the A phase channel.
+	UCHAR ChannelB;					//!< Index of the B phase channel.
+	UCHAR ChannelIndex;				//!< Index of the index channel, or DIO_QUADRATURE_NO_INDEX.
+	UCHAR Flags;					//!< Combination of DIO_QUADRATURE_FLAG_XXX.
+} DIO_QUADRATURE_DECODER;
+
+/**
+ *	@brief	Edge counting engine start packet structure.
+ *
+ *	Starts the sampler which reads the ports of the channels at a fixed rate.
+ */
+typedef struct _DIO_PACKET_START_EDGE_ENGINE {
+	ULONG SampleInterval;			//!< Nanoseconds between the samples. Must not be zero.
+	ULONG Processor;				//!< Processor to run the sampler, or DIO_EDGE_ANY_PROCESSOR.
+	ULONG ChannelCount;				//!< Count of Channels (1 ~ DIO_EDGE_MAXIMUM_CHANNELS).
+	ULONG DecoderCount;				//!< Count of Decoders.
+	DIO_EDGE_CHANNEL Channels[DIO_EDGE_MAXIMUM_CHANNELS];
+	DIO_QUADRATURE_DECODER Decoders[DIO_EDGE_MAXIMUM_DECODERS];
+} DIO_PACKET_START_EDGE_ENGINE;
+
+/**
+ *	@brief	Counters of the edge counting channel.
+ */
+typedef struct _DIO_EDGE_COUNTER {
+	ULONG RisingEdges;				//!< Count of rising edges.
+	ULONG FallingEdges;				//!< Count of falling edges.
+	ULONG Level;					//!< Level of the last sample.
+	ULONG Frequency;				//!< Estimated frequency in millihertz. Decays once the edges stop.
+	ULONGLONG Period;				//!< Nanoseconds between the last two rising edges. Zero if unknown.
+	ULONGLONG Age;					//!< Nanoseconds since the last rising edge, or DIO_EDGE_NO_EDGE.
+} DIO_EDGE_COUNTER;
+
+/**
+ *	@brief	Counters of the quadrature decoder.
+ */
+typedef struct _DIO_QUADRATURE_COUNTER {
+	LONG Position;					//!< Position in counts.
+	LONG IndexPosition;				//!< Position latched on the last index, before the reset.
+	ULONG IndexCount;				//!< Count of index pulses.
+	ULONG ErrorCount;				//!< Count of samples where A and B changed together.
+} DIO_QUADRATURE_COUNTER;
+
+/**
+ *	@brief	Edge counter query packet structure.
+ *
+ *	Snapshot of all counters. Counters of the stopped engine remain readable until the next start.
+ */
+typedef struct _DIO_PACKET_QUERY_EDGE_COUNTERS {
+	ULONG Running;					//!< Non-zero if the sampler is running.
+	ULONG ChannelCount;				//!< Count of valid Channels.
+	ULONG DecoderCount;				//!< Count of valid Decoders.
+	ULONG MissedSamples;			//!< Sample ticks which the sampler could not keep up with.
+	ULONGLONG SampleCount;			//!< Count of samples.
+	ULONGLONG SampleTime;			//!< Nanoseconds from the first to the last sample.
+	DIO_EDGE_COUNTER Channels[DIO_EDGE_MAXIMUM_CHANNELS];
+	DIO_QUADRATURE_COUNTER Decoders[DIO_EDGE_MAXIMUM_DECODERS];
+} DIO_PACKET_QUERY_EDGE_COUNTERS;
+
+
+//
+// Structure for output streaming.
+//
+
+#define DIO_STREAM_MAXIMUM_RANGES				16
+#define DIO_STREAM_MAXIMUM_FRAME_LENGTH			256
+#define DIO_STREAM_MAXIMUM_BUFFER_LENGTH		0x100000	// FrameCapacity * frame length
+#define DIO_STREAM_MAXIMUM_SEGMENTS				64
+
+// Ticks may run on any processor.
+#define DIO_STREAM_ANY_PROCESSOR				DIO_EDGE_ANY_PROCESSOR
+
+// Repeats the current segment until the next segment is written, instead of running out.
+#define DIO_STREAM_FLAG_LOOP					0x00000001
+#define DIO_STREAM_VALID_FLAGS					(DIO_STREAM_FLAG_LOOP)
+
+#pragma warning(push)
+#pragma warning(disable: 4200)
+
+/**
+ *	@brief	Stream start packet structure.
+ *
+ *	Allocates the frame buffer and starts the ticks. A frame holds the data of all ranges,
+ *	in the same layout as DIO_PACKET_PORT_IO, and one frame is written per tick.\n
+ *	[Parameters] [AddressRange1, AddressRange2, ... AddressRangeN]
+ */
+typedef struct _DIO_PACKET_START_STREAM {
+	ULONG TickInterval;				//!< Nanoseconds between the frames.
+	ULONG Processor;				//!< Processor to run the ticks, or DIO_STREAM_ANY_PROCESSOR.
+	ULONG Flags;					//!< Combination of DIO_STREAM_FLAG_XXX.
+	ULONG FrameCapacity;			//!< Count of frames in the buffer.
+	ULONG RangeCount;				//!< Count of DIO_PORT_RANGE (1 ~ DIO_STREAM_MAXIMUM_RANGES).
+	DIO_PORT_RANGE AddressRange[];	//!< Address ranges to write.
+} DIO_PACKET_START_STREAM;
+
+/**
+ *	@brief	Stream write packet structure.
+ *
+ *	Appends frames as one segment. Without DIO_STREAM_FLAG_LOOP, the frames which fit are accepted.
+ *	With it, the segment is accepted as a whole or not at all.\n
+ *	Input: [FrameCount] [Frames]\n
+ *	Output: DIO_PACKET_QUERY_STREAM
+ */
+typedef struct _DIO_PACKET_WRITE_STREAM {
+	ULONG FrameCount;				//!< Count of frames.
+	UCHAR Frames[];					//!< Frames to append.
+} DIO_PACKET_WRITE_STREAM;
+#pragma warning(pop)
+
+#define PACKET_START_STREAM_GET_LENGTH(_range_cnt)	\
+	( sizeof(DIO_PACKET_START_STREAM) + (_range_cnt) * sizeof(DIO_PORT_RANGE) )
+
+/**
+ *	@brief	Stream status packet structure.
+ */
+typedef struct _DIO_PACKET_QUERY_STREAM {
+	ULONG Running;					//!< Non-zero if the ticks are running.
+	ULONG Flags;					//!< Combination of DIO_STREAM_FLAG_XXX.
+	ULONG FrameLength;				//!< Length of one frame in bytes.
+	ULONG FrameCapacity;			//!< Count of frames in the buffer.
+	ULONG QueuedFrames;				//!< Frames which are written but not played yet.
+	ULONG FreeFrames;				//!< Frames which can be written now.
+	ULONG AcceptedFrames;			//!< Frames accepted by DIO_IOCTL_WRITE_STREAM. Zero for the query.
+	ULONG Underruns;				//!< Ticks which had no frame to play, after the first frame.
+	ULONG Loops;					//!< Times the segment is repeated.
+	ULONG LateTicks;				//!< Ticks played later than one tick interval.
+	ULONGLONG PlayedFrames;			//!< Count of frames written to the ports.
+	ULONGLONG MaximumLateness;		//!< Largest delay of a tick in nanoseconds.
+} DIO_PACKET_QUERY_STREAM;
+
+
+//
+// Structure for time-tagged output scheduling.
+//
+
+#define DIO_SCHEDULE_MAXIMUM_CAPACITY			0x20000
+#define DIO_SCHEDULE_MAXIMUM_LENGTH				4
+#define DIO_SCHEDULE_RECORD_COUNT				1024	// Records of the fired entries kept for the query
+#define DIO_SCHEDULE_MAXIMUM_HORIZON			86400	// Seconds which Time may be away from the current time
+
+// Scheduler may run on any processor.
+#define DIO_SCHEDULE_ANY_PROCESSOR				DIO_EDGE_ANY_PROCESSOR
+
+// Operations of the scheduled entry.
+#define DIO_SCHEDULE_OP_WRITE					0x00	// Port = Data
+#define DIO_SCHEDULE_OP_MODIFY					0x01	// Port = (Port & ~Mask) | (Data & Mask)
+#define DIO_SCHEDULE_OP_TOGGLE					0x02	// Port = Port ^ Mask
+#define DIO_SCHEDULE_OP_MAXIMUM					DIO_SCHEDULE_OP_TOGGLE
+
+// Lateness histogram buckets: < 1us, < 10us, < 100us, < 1ms and the rest.
+#define DIO_SCHEDULE_HISTOGRAM_BUCKETS			5
+
+/**
+ *	@brief	Scheduled output entry.
+ *
+ *	Entries of the same Time run in the order they are scheduled. MODIFY and TOGGLE read the port
+ *	back before the write, so they need the hardware which reads back the output latch.
+ */
+typedef struct _DIO_SCHEDULE_ENTRY {
+	LONGLONG Time;					//!< Deadline in the kernel performance counter. Past deadline runs at once.
+									//!< Within DIO_SCHEDULE_MAXIMUM_HORIZON of the current time.
+	ULONG Tag;						//!< Caller-defined value which is reported in the record.
+	USHORT Port;					//!< First port address.
+	UCHAR Length;					//!< Count of ports (1 ~ DIO_SCHEDULE_MAXIMUM_LENGTH).
+	UCHAR Operation;				//!< DIO_SCHEDULE_OP_XXX.
+	UCHAR Data[DIO_SCHEDULE_MAXIMUM_LENGTH];	//!< Value of each port.
+	UCHAR Mask[DIO_SCHEDULE_MAXIMUM_LENGTH];	//!< Bits of each port to change (MODIFY and TOGGLE).
+} DIO_SCHEDULE_ENTRY;
+
+/**
+ *	@brief	Record of the fired entry.
+ */
+typedef struct _DIO_SCHEDULE_RECORD {
+	ULONG Tag;						//!< Tag of the entry.
+	ULONG Reserved;
+	LONGLONG Time;					//!< Deadline of the entry.
+	ULONGLONG Lateness;				//!< Nanoseconds from the deadline to the port access.
+} DIO_SCHEDULE_RECORD;
+
+/**
+ *	@brief	Scheduler start packet structure.
+ */
+typedef struct _DIO_PACKET_START_SCHEDULER {
+	ULONG Capacity;					//!< Maximum count of pending entries (1 ~ DIO_SCHEDULE_MAXIMUM_CAPACITY).
+	ULONG Processor;				//!< Processor to run the scheduler, or DIO_SCHEDULE_ANY_PROCESSOR.
+} DIO_PACKET_START_SCHEDULER;
+
+#pragma warning(push)
+#pragma warning(disable: 4200)
+
+/**
+ *	@brief	Scheduled output packet structure.
+ *
+ *	Entries are accepted in order until the queue is full.\n
+ *	Input: [EntryCount] [Entries]\n
+ *	Output: [EntryCount] which receives the count of accepted entries.
+ */
+typedef struct _DIO_PACKET_SCHEDULE_OUTPUT {
+	ULONG EntryCount;				//!< Count of entries.
+	DIO_SCHEDULE_ENTRY Entries[];	//!< Entries to schedule.
+} DIO_PACKET_SCHEDULE_OUTPUT;
+
+/**
+ *	@brief	Scheduler status packet structure.
+ *
+ *	Records of the fired entries fill the rest of the output buffer, oldest first, and are
+ *	removed from the driver.\n
+ *	Output: [Status] [Records]
+ */
+typedef struct _DIO_PACKET_QUERY_SCHEDULER {
+	ULONG Running;					//!< Non-zero if the scheduler is running.
+	ULONG Capacity;					//!< Maximum count of pending entries.
+	ULONG PendingEntries;			//!< Entries waiting for the deadline.
+	ULONG RejectedEntries;			//!< Entries which are not accepted since the queue was full.
+	ULONG LostRecords;				//!< Records which are overwritten before the query.
+	ULONG RecordCount;				//!< Count of Records.
+	ULONGLONG FiredEntries;			//!< Count of entries which are run.
+	ULONGLONG TotalLateness;		//!< Sum of the lateness in nanoseconds.
+	ULONGLONG MaximumLateness;		//!< Largest lateness in nanoseconds.
+	ULONG LatenessHistogram[DIO_SCHEDULE_HISTOGRAM_BUCKETS];	//!< Fired entries by lateness.
+	ULONG Reserved;
+	DIO_SCHEDULE_RECORD Records[];	//!< Records of the fired entries.
+} DIO_PACKET_QUERY_SCHEDULER;
+#pragma warning(pop)
+
+
+//
+// Structure for reaction programs.
+//
+
+#define DIO_REACTION_MAXIMUM_PROGRAMS			8
+#define DIO_REACTION_MAXIMUM_INSTRUCTIONS		256
+#define DIO_REACTION_MAXIMUM_STEPS				1024	// Instructions which one run may execute
+#define DIO_REACTION_MAXIMUM_PORTS				8		// Inputs, and outputs, of one program
+#define DIO_REACTION_REGISTERS					8		// Cleared on every run
+#define DIO_REACTION_STATES						8		// Kept between the runs, cleared on load
+
+// Reactor may run on any processor.
+#define DIO_REACTION_ANY_PROCESSOR				DIO_EDGE_ANY_PROCESSOR
+
+// Unloads every program.
+#define DIO_REACTION_ALL_PROGRAMS				0xffffffff
+
+// Program runs on every tick.
+#define DIO_REACTION_TRIGGER_TICK				0x00
+// Program runs on the tick which sees a change in the Mask bits of its inputs, and on the first tick.
+#define DIO_REACTION_TRIGGER_CHANGE				0x01
+#define DIO_REACTION_TRIGGER_MAXIMUM			DIO_REACTION_TRIGGER_CHANGE
+
+//
+// Instructions. R is a register, and the operand is R[Source], or Immediate with 
+// DIO_REACTION_OP_IMMEDIATE. Jump targets are relative to the next instruction.
+//
+
+#define DIO_REACTION_OP_EXIT					0x00	// Ends the run. Stored outputs are written.
+#define DIO_REACTION_OP_LOAD_INPUT				0x01	// R[Destination] = Inputs[Source]
+#define DIO_REACTION_OP_LOAD_STATE				0x02	// R[Destination] = States[Source]
+#define DIO_REACTION_OP_STORE_STATE				0x03	// States[Destination] = R[Source]
+#define DIO_REACTION_OP_STORE_OUTPUT			0x04	// Outputs[Destination] = R[Source]
+#define DIO_REACTION_OP_MOVE					0x05	// R[Destination] = operand
+#define DIO_REACTION_OP_AND						0x06	// R[Destination] &= operand
+#define DIO_REACTION_OP_OR						0x07	// R[Destination] |= operand
+#define DIO_REACTION_OP_XOR						0x08	// R[Destination] ^= operand
+#define DIO_REACTION_OP_ADD						0x09	// R[Destination] += operand
+#define DIO_REACTION_OP_SUB						0x0a	// R[Destination] -= operand
+#define DIO_REACTION_OP_SHL						0x0b	// R[Destination] <<= operand & 31
+#define DIO_REACTION_OP_SHR						0x0c	// R[Destination] >>= operand & 31
+#define DIO_REACTION_OP_LESS					0x0d	// R[Destination] = R[Destination] < operand (unsigned)
+#define DIO_REACTION_OP_JUMP					0x0e	// Jumps by Immediate
+#define DIO_REACTION_OP_JUMP_ZERO				0x0f	// Jumps by Immediate if R[Destination] == 0
+#define DIO_REACTION_OP_JUMP_NOT_ZERO			0x10	// Jumps by Immediate if R[Destination] != 0
+#define DIO_REACTION_OP_MAXIMUM					DIO_REACTION_OP_JUMP_NOT_ZERO
+#define DIO_REACTION_OP_IMMEDIATE				0x80	// Operand is Immediate (MOVE ~ LESS only).
+
+// Verifier did not fail on a particular instruction.
+#define DIO_REACTION_NO_INSTRUCTION				0xffffffff
+
+/**
+ *	@brief	Port of the reaction program.
+ */
+typedef struct _DIO_REACTION_PORT {
+	USHORT Port;					//!< Port address.
+	UCHAR Mask;						//!< Input: bits which trigger DIO_REACTION_TRIGGER_CHANGE. Output: bits to write.
+	UCHAR XorMask;					//!< Input: applied after the read. Output: applied before the write.
+} DIO_REACTION_PORT;
+
+/**
+ *	@brief	Instruction of the reaction program.
+ */
+typedef struct _DIO_REACTION_INSTRUCTION {
+	UCHAR Opcode;					//!< DIO_REACTION_OP_XXX, with DIO_REACTION_OP_IMMEDIATE.
+	UCHAR Destination;				//!< Register, state or output index.
+	UCHAR Source;					//!< Register, state or input index.
+	UCHAR Reserved;					//!< Must be zero.
+	LONG Immediate;					//!< Operand, or jump distance.
+} DIO_REACTION_INSTRUCTION;
+
+#pragma warning(push)
+#pragma warning(disable: 4200)
+
+/**
+ *	@brief	Reaction program load packet structure.
+ *
+ *	Program is verified before it is loaded: every index must be in range, every jump must land
+ *	in the program, and the last instruction must be EXIT or JUMP. A program with a backward jump
+ *	must give StepLimit, and the run which exceeds it is aborted without writing the outputs.\n
+ *	Input: [Parameters] [Instructions]\n
+ *	Output: DIO_PACKET_REACTION_ID
+ */
+typedef struct _DIO_PACKET_LOAD_REACTION {
+	ULONG Trigger;					//!< DIO_REACTION_TRIGGER_XXX.
+	ULONG StepLimit;				//!< Maximum steps of a run (1 ~ DIO_REACTION_MAXIMUM_STEPS). Zero if no loop.
+	UCHAR InputCount;				//!< Count of Inputs (0 ~ DIO_REACTION_MAXIMUM_PORTS).
+	UCHAR OutputCount;				//!< Count of Outputs (0 ~ DIO_REACTION_MAXIMUM_PORTS).
+	USHORT InstructionCount;		//!< Count of Instructions (1 ~ DIO_REACTION_MAXIMUM_INSTRUCTIONS).
+	DIO_REACTION_PORT Inputs[DIO_REACTION_MAXIMUM_PORTS];
+	DIO_REACTION_PORT Outputs[DIO_REACTION_MAXIMUM_PORTS];
+	DIO_REACTION_INSTRUCTION Instructions[];
+} DIO_PACKET_LOAD_REACTION;
+#pragma warning(pop)
+
+#define PACKET_LOAD_REACTION_GET_LENGTH(_instruction_cnt)	\
+	( sizeof(DIO_PACKET_LOAD_REACTION) + (_instruction_cnt) * sizeof(DIO_REACTION_INSTRUCTION) )
+
+/**
+ *	@brief	Reaction program identifier packet structure.
+ */
+typedef struct _DIO_PACKET_REACTION_ID {
+	ULONG Id;						//!< Slot of the program, or DIO_REACTION_ALL_PROGRAMS to unload.
+} DIO_PACKET_REACTION_ID;
+
+/**
+ *	@brief	Reactor start packet structure.
+ */
+typedef struct _DIO_PACKET_START_REACTOR {
+	ULONG TickInterval;				//!< Nanoseconds between the ticks. Must not be zero.
+	ULONG Processor;				//!< Processor to run the ticks, or DIO_REACTION_ANY_PROCESSOR.
+} DIO_PACKET_START_REACTOR;
+
+/**
+ *	@brief	Statistics of the reaction program.
+ *
+ *	Time of a run covers the input reads, the execution and the output writes.
+ */
+typedef struct _DIO_REACTION_STATISTICS {
+	ULONG Loaded;					//!< Non-zero if the slot has a program.
+	ULONG InstructionCount;			//!< Count of instructions.
+	ULONG StepLimit;				//!< Maximum steps of a run which the verifier allowed.
+	ULONG MaximumSteps;				//!< Largest steps of a run.
+	ULONG Faults;					//!< Runs aborted by the step limit.
+	ULONG Reserved;
+	ULONGLONG Runs;					//!< Count of runs.
+	ULONGLONG TotalTime;			//!< Sum of the run time in nanoseconds.
+	ULONGLONG MaximumTime;			//!< Largest run time in nanoseconds.
+} DIO_REACTION_STATISTICS;
+
+/**
+ *	@brief	Reactor status packet structure.
+ *
+ *	Statistics of a program remain readable until it is unloaded.
+ */
+typedef struct _DIO_PACKET_QUERY_REACTOR {
+	ULONG Running;					//!< Non-zero if the ticks are running.
+	ULONG MissedTicks;				//!< Ticks which the reactor could not keep up with.
+	ULONGLONG Ticks;				//!< Count of ticks.
+	DIO_REACTION_STATISTICS Programs[DIO_REACTION_MAXIMUM_PROGRAMS];
+} DIO_PACKET_QUERY_REACTOR;
+
+
+//
+// Structures for submission and completion rings. Layout of the rings is in dioring.h.
+//
+
+#define DIO_RING_ANY_PROCESSOR					0xffffffff
+
+// Flags of DIO_PACKET_CREATE_RING.
+#define DIO_RING_CREATE_FLAG_POLL				0x00000001	// Polling thread runs the submissions. Otherwise the doorbell does.
+#define DIO_RING_CREATE_VALID_FLAGS				(DIO_RING_CREATE_FLAG_POLL)
+
+// Polling thread polls at most this long, in microseconds, before it sleeps.
+#define DIO_RING_MAXIMUM_IDLE_TIME				1000000
+
+/**
+ *	@brief	Ring creation packet structure.
+ *
+ *	Input: DIO_PACKET_CREATE_RING\n
+ *	Output: DIO_PACKET_RING_ADDRESS
+ */
+typedef struct _DIO_PACKET_CREATE_RING {
+	ULONG SubmissionEntries;		//!< Power of two, DIO_RING_MINIMUM_ENTRIES ~ DIO_RING_MAXIMUM_ENTRIES.
+	ULONG Flags;					//!< Combination of DIO_RING_CREATE_FLAG_XXX.
+	ULONG Processor;				//!< Processor of the polling thread, or DIO_RING_ANY_PROCESSOR.
+	ULONG IdleTime;					//!< Microseconds to poll after the last submission before the polling thread sleeps.
+} DIO_PACKET_CREATE_RING;
+
+/**
+ *	@brief	Shared memory of the rings, mapped to the caller.
+ */
+typedef struct _DIO_PACKET_RING_ADDRESS {
+	ULONGLONG Address;				//!< Address of DIO_RING_SHARED in the caller's address space.
+	ULONG Length;					//!< Length of the shared memory.
+	ULONG Reserved;
+} DIO_PACKET_RING_ADDRESS;
+
+/**
+ *	@brief	Doorbell packet structure.
+ */
+typedef struct _DIO_PACKET_ENTER_RING {
+	ULONG Completed;				//!< Submissions which are run by this doorbell. Zero if polled.
+} DIO_PACKET_ENTER_RING;
+
+
+//
+// Structures for ReadFile/WriteFile on the device.
+// File offset is the port address and the length is the byte count.
+//
+
+// Address modes of DIO_PACKET_SET_FILE_MODE.
+#define DIO_FILE_MODE_LINEAR					0	// Byte i goes to port (offset + i). Default of the handle.
+#define DIO_FILE_MODE_FIFO						1	// Every byte goes to the port at the offset.
+#define DIO_FILE_MODE_REPEAT					2	// Byte i goes to port (offset + i % Width).
+#define DIO_FILE_MODE_MAXIMUM					DIO_FILE_MODE_REPEAT
+
+// Largest width of DIO_FILE_MODE_REPEAT.
+#define DIO_FILE_MAXIMUM_WIDTH					0x10000
+
+/**
+ *	@brief	File mode packet structure.
+ *
+ *	Applies to the reads and writes on the handle which sent it.
+ */
+typedef struct _DIO_PACKET_SET_FILE_MODE {
+	ULONG Mode;						//!< DIO_FILE_MODE_XXX.
+	ULONG Width;					//!< Ports in a cycle, 1 ~ DIO_FILE_MAXIMUM_WIDTH. DIO_FILE_MODE_REPEAT only.
+} DIO_PACKET_SET_FILE_MODE;
+
+
+//
+// Structures for the live snapshot page. Layout of the page is in diosnap.h.
+//
+
+#define DIO_SNAPSHOT_MAXIMUM_RANGES				16
+#define DIO_SNAPSHOT_MINIMUM_REFRESH_INTERVAL	10000	// Nanoseconds. Shorter intervals are raised to this.
 
+// Refreshes may run on any processor.
+#define DIO_SNAPSHOT_ANY_PROCESSOR				DIO_EDGE_ANY_PROCESSOR
 
+/**
+ *	@brief	Snapshot page mapped to the caller.
+ */
+typedef struct _DIO_PACKET_SNAPSHOT_ADDRESS {
+	ULONGLONG Address;				//!< Address of DIO_SNAPSHOT_PAGE in the caller's address space.
+	ULONG Length;					//!< Length of the mapping.
+	ULONG Reserved;
+} DIO_PACKET_SNAPSHOT_ADDRESS;
+
+/**
+ *	@brief	Snapshot start packet structure.
+ *	
+ *	Input: [DIO_PACKET_START_SNAPSHOT] [DIO_PORT_RANGE] * RangeCount\n
+ *	Output: None
+ */
+typedef struct _DIO_PACKET_START_SNAPSHOT {
+	ULONG RefreshInterval;			//!< Nanoseconds between the refreshes. At least DIO_SNAPSHOT_MINIMUM_REFRESH_INTERVAL.
+	ULONG Processor;				//!< Processor to run the refreshes, or DIO_SNAPSHOT_ANY_PROCESSOR.
+	ULONG RangeCount;				//!< Count of DIO_PORT_RANGE (1 ~ DIO_SNAPSHOT_MAXIMUM_RANGES).
+	DIO_PORT_RANGE AddressRange[];	//!< Address ranges to read.
+} DIO_PACKET_START_SNAPSHOT;
+
+#define PACKET_START_SNAPSHOT_GET_LENGTH(_range_cnt)	\
+	( sizeof(DIO_PACKET_START_SNAPSHOT) + (_range_cnt) * sizeof(DIO_PORT_RANGE) )
+
+
+//
+// Structures for the port I/O worker.
+// While the worker runs, port reads and writes are queued to it instead of taking the port lock
+// in the caller's thread.
+//
+
+// Worker may run on any processor.
+#define DIO_WORKER_ANY_PROCESSOR				DIO_EDGE_ANY_PROCESSOR
+
+// Worker polls the queue at most this long, in microseconds, before it sleeps.
+#define DIO_WORKER_MAXIMUM_SPIN_TIME			1000000
+
+/**
+ *	@brief	Worker start packet structure.
+ */
+typedef struct _DIO_PACKET_START_WORKER {
+	ULONG Processor;				//!< Processor of the worker, or DIO_WORKER_ANY_PROCESSOR.
+	ULONG SpinTime;					//!< Microseconds to poll after the last request before the worker sleeps.
+} DIO_PACKET_START_WORKER;
+
+/**
+ *	@brief	Worker query packet structure.
+ */
+typedef struct _DIO_PACKET_QUERY_WORKER {
+	ULONG Running;					//!< Non-zero if the worker runs.
+	ULONG MaximumBatch;				//!< Most requests which are run with one hold of the port lock.
+	ULONGLONG Requests;				//!< Requests which are run by the worker since the start.
+	ULONGLONG Batches;				//!< Holds of the port lock since the start.
+	ULONGLONG Wakeups;				//!< Times the worker is woken from the sleep.
+} DIO_PACKET_QUERY_WORKER;
 
 
 //
@@ -91,6 +1007,7 @@ typedef struct _DIO_PACKET_PORT_IO {
 
 #define DIO_CFGB_SHOW_DEBUG_OUTPUT				0x00000001
 #define DIO_CFGB_ALLOW_PORT_RANGE_OVERLAP		0x00000002
+#define DIO_CFGB_DISABLE_FAST_IO				0x00000004	// Port reads/writes always take the IRP path.
 
 /**
  *	@brief	Configuration structure.
@@ -123,7 +1040,37 @@ typedef struct _DIO_PACKET_READ_WRITE_CONFIGURATION {
  */
 typedef union _DIO_PACKET {
 	DIO_PACKET_PORT_IO PortIo;
+	DIO_PACKET_PORT_IO_V2 PortIoV2;
+	DIO_PACKET_READ_BURST ReadBurst;
+	DIO_PACKET_MEMORY_IO_V2 MemoryIoV2;
+	DIO_PACKET_QUERY_MEMORY_RESOURCES QueryMemoryResources;
+	DIO_PACKET_MAP_MEMORY MapMemory;
+	DIO_PACKET_MEMORY_WINDOW MemoryWindow;
+	DIO_PACKET_UNMAP_MEMORY UnmapMemory;
 	DIO_PACKET_READ_WRITE_CONFIGURATION ReadWriteConfiguration;
+	DIO_PACKET_QUERY_RESOURCES QueryResources;
+	DIO_PACKET_WAIT_PATTERN WaitPattern;
+	DIO_PACKET_QUERY_CLOCK QueryClock;
+	DIO_PACKET_START_EDGE_ENGINE StartEdgeEngine;
+	DIO_PACKET_QUERY_EDGE_COUNTERS QueryEdgeCounters;
+	DIO_PACKET_START_STREAM StartStream;
+	DIO_PACKET_WRITE_STREAM WriteStream;
+	DIO_PACKET_QUERY_STREAM QueryStream;
+	DIO_PACKET_START_SCHEDULER StartScheduler;
+	DIO_PACKET_SCHEDULE_OUTPUT ScheduleOutput;
+	DIO_PACKET_QUERY_SCHEDULER QueryScheduler;
+	DIO_PACKET_LOAD_REACTION LoadReaction;
+	DIO_PACKET_REACTION_ID ReactionId;
+	DIO_PACKET_START_REACTOR StartReactor;
+	DIO_PACKET_QUERY_REACTOR QueryReactor;
+	DIO_PACKET_CREATE_RING CreateRing;
+	DIO_PACKET_RING_ADDRESS RingAddress;
+	DIO_PACKET_ENTER_RING EnterRing;
+	DIO_PACKET_SET_FILE_MODE SetFileMode;
+	DIO_PACKET_SNAPSHOT_ADDRESS SnapshotAddress;
+	DIO_PACKET_START_SNAPSHOT StartSnapshot;
+	DIO_PACKET_START_WORKER StartWorker;
+	DIO_PACKET_QUERY_WORKER QueryWorker;
 } DIO_PACKET;
 
 #pragma pack(pop)
@@ -0,0 +1,272 @@
+#pragma once
+
+//
+// Compile-time register map for DIOUM (C++17, header only).
+//
+// Board ports and bit fields are declared once. Coalesced port ranges, buffer offsets
+// and masks are computed at compile time, so field accessors are fixed-offset loads.
+//
+//	// IOConfig = 7000-705f (DIOPort.inf, [DIOPort.LogConfig0])
+//	using Board = dio::regmap::io_config<0x7000, 0x705f>;
+//
+//	// or the IOConfig line can be pasted as is
+//	struct Board { static constexpr auto range = dio::regmap::parse_io_config("7000-705f"); };
+//
+//	using LimitSwitch  = dio::regmap::field<0x7000, 3, 1, bool>;
+//	using BoardId      = dio::regmap::field<0x7010, 0, 16>;
+//	using MotorEnable  = dio::regmap::field<0x7040, 0, 4>;
+//
+//	using Inputs = dio::regmap::register_map<Board, LimitSwitch, BoardId>;
+//
+//	Inputs::frame Frame;
+//	DIOUM_RANGE_SET *RangeSet = Inputs::create_range_set(Context, "inputs");
+//	if (RangeSet && Inputs::read(Context, RangeSet, Frame) && Frame.get<LimitSwitch>()) { ... }
+//
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <Windows.h>
+#include "dioctl.h"
+#include "dioum.h"
+
+namespace dio {
+namespace regmap {
+
+	struct port_range {
+		unsigned short start;
+		unsigned short end;
+	};
+
+	/**
+	 *	@brief	Port range claimed by the board.
+	 *
+	 *	Mirrors the IOConfig range of DIOPort.inf. All fields must be inside this range.
+	 */
+	template <unsigned short Start, unsigned short End>
+	struct io_config {
+		static_assert(Start <= End, "io_config: start address must not exceed end address");
+		static constexpr port_range range = { Start, End };
+	};
+
+	namespace detail {
+
+		constexpr unsigned hex_digit(char c) {
+			return (c >= '0' && c <= '9') ? unsigned(c - '0') :
+				(c >= 'a' && c <= 'f') ? unsigned(c - 'a' + 10) :
+				(c >= 'A' && c <= 'F') ? unsigned(c - 'A' + 10) : 16u;
+		}
+
+	} // namespace detail
+
+	/**
+	 *	@brief	Parses the fixed IOConfig range of INF file ("start-end" in hex).
+	 *
+	 *	Relocatable form ("size@min-max%align") has no fixed address, so it is rejected at compile time.
+	 */
+	constexpr port_range parse_io_config(const char *IoConfig) {
+		unsigned long value[2] = { 0, 0 };
+		unsigned index = 0;
+		unsigned digits = 0;
+
+		for (const char *p = IoConfig; *p; p++) {
+			if (*p == '-' && index == 0 && digits) {
+				index = 1;
+				digits = 0;
+			}
+			else if (detail::hex_digit(*p) < 16 && digits < 4) {
+				value[index] = value[index] * 16 + detail::hex_digit(*p);
+				digits++;
+			}
+			else if (*p != ' ' && *p != '\t') {
+				throw "parse_io_config: only \"start-end\" form is supported";
+			}
+		}
+
+		if (index != 1 || !digits || value[0] > value[1])
+			throw "parse_io_config: invalid range";
+
+		return port_range { static_cast<unsigned short>(value[0]), static_cast<unsigned short>(value[1]) };
+	}
+
+	/**
+	 *	@brief	Bit field starting at given port.
+	 *
+	 *	Fields wider than the remaining bits of the port continue to the next ports (little endian).
+	 */
+	template <unsigned short Port, unsigned Bit = 0, unsigned Width = 8, typename T = unsigned long>
+	struct field {
+		static_assert(Bit < 8, "field: bit offset must be less than 8");
+		static_assert(Width >= 1 && Width <= 32, "field: width must be 1 to 32 bits");
+		static_assert(std::is_integral<T>::value || std::is_enum<T>::value, "field: value type must be integral or enum");
+		static_assert(static_cast<unsigned long>(Port) + (Bit + Width - 1) / 8 <= 0xffff, "field: port address overflow");
+
+		using value_type = T;
+		static constexpr unsigned short port = Port;
+		static constexpr unsigned bit = Bit;
+		static constexpr unsigned width = Width;
+		static constexpr unsigned port_count = (Bit + Width + 7) / 8;
+		static constexpr unsigned long long mask = ((1ull << Width) - 1) << Bit;
+	};
+
+	namespace detail {
+
+		template <std::size_t N>
+		struct port_list {
+			std::array<unsigned short, N> ports {};
+			std::size_t count = 0;
+		};
+
+		// Sorted unique ports touched by the fields.
+		template <typename... Fields>
+		constexpr auto collect_ports() {
+			constexpr std::size_t total = (std::size_t(0) + ... + Fields::port_count);
+			port_list<total> list {};
+			const unsigned short starts[] = { Fields::port..., 0 };
+			const unsigned counts[] = { Fields::port_count..., 0 };
+
+			for (std::size_t f = 0; f < sizeof...(Fields); f++) {
+				for (unsigned k = 0; k < counts[f]; k++) {
+					unsigned short port = static_cast<unsigned short>(starts[f] + k);
+					std::size_t i = 0;
+
+					while (i < list.count && list.ports[i] < port)
+						i++;
+
+					if (i < list.count && list.ports[i] == port)
+						continue;
+
+					for (std::size_t j = list.count; j > i; j--)
+						list.ports[j] = list.ports[j - 1];
+
+					list.ports[i] = port;
+					list.count++;
+				}
+			}
+
+			return list;
+		}
+
+		template <typename List>
+		constexpr std::size_t count_ranges(const List &list) {
+			std::size_t count = 0;
+
+			for (std::size_t i = 0; i < list.count; i++) {
+				if (i == 0 || list.ports[i] != list.ports[i - 1] + 1)
+					count++;
+			}
+
+			return count;
+		}
+
+		template <std::size_t N, typename List>
+		constexpr std::array<port_range, N> coalesce(const List &list) {
+			std::array<port_range, N> ranges {};
+			std::size_t count = 0;
+
+			for (std::size_t i = 0; i < list.count; i++) {
+				if (i == 0 || list.ports[i] != list.ports[i - 1] + 1)
+					ranges[count++] = { list.ports[i], list.ports[i] };
+				else
+					ranges[count - 1].end = list.ports[i];
+			}
+
+			return ranges;
+		}
+
+		// Ports are unique and sorted, so the buffer offset of a port is its index.
+		template <typename List>
+		constexpr std::size_t offset_of(const List &list, unsigned short port) {
+			for (std::size_t i = 0; i < list.count; i++) {
+				if (list.ports[i] == port)
+					return i;
+			}
+
+			return static_cast<std::size_t>(-1);
+		}
+
+		template <typename F, typename... Fields>
+		constexpr bool contains() {
+			return (false || ... || std::is_same<F, Fields>::value);
+		}
+
+	} // namespace detail
+
+	/**
+	 *	@brief	Register map of the board.
+	 *
+	 *	Data buffer layout is the same as DioReadRangeSet()/DioWriteRangeSet() with the coalesced ranges.
+	 */
+	template <typename Config, typename... Fields>
+	class register_map {
+		static_assert(sizeof...(Fields) > 0, "register_map: at least one field is required");
+
+		static constexpr auto port_list_ = detail::collect_ports<Fields...>();
+
+	public:
+		static constexpr std::size_t range_count = detail::count_ranges(port_list_);
+		static constexpr std::size_t data_length = port_list_.count;
+		static constexpr std::array<port_range, range_count> ranges = detail::coalesce<range_count>(port_list_);
+
+		static_assert(range_count <= DIO_MAXIMUM_PORT_RANGES, "register_map: too many port ranges");
+		static_assert(Config::range.start <= port_list_.ports[0] && port_list_.ports[data_length - 1] <= Config::range.end,
+			"register_map: field is outside of the board I/O range");
+
+		template <typename F>
+		static constexpr std::size_t offset = detail::offset_of(port_list_, F::port);
+
+		class frame {
+		public:
+			std::array<unsigned char, data_length> bytes {};
+
+			template <typename F>
+			typename F::value_type get() const {
+				static_assert(detail::contains<F, Fields...>(), "frame::get: field is not in this register map");
+				constexpr std::size_t off = offset<F>;
+				unsigned long long raw = 0;
+
+				if constexpr (F::port_count == 1)
+					raw = bytes[off];
+				else
+					std::memcpy(&raw, bytes.data() + off, F::port_count);
+
+				return static_cast<typename F::value_type>((raw & F::mask) >> F::bit);
+			}
+
+			template <typename F>
+			void set(typename F::value_type value) {
+				static_assert(detail::contains<F, Fields...>(), "frame::set: field is not in this register map");
+				constexpr std::size_t off = offset<F>;
+				unsigned long long raw = 0;
+
+				std::memcpy(&raw, bytes.data() + off, F::port_count);
+				raw = (raw & ~F::mask) | ((static_cast<unsigned long long>(value) << F::bit) & F::mask);
+				std::memcpy(bytes.data() + off, &raw, F::port_count);
+			}
+		};
+
+		static DIOUM_RANGE_SET *create_range_set(DIOUM_DRIVER_CONTEXT *Context, PCSTR Name = nullptr) {
+			DIOUM_PORT_RANGE PortRanges[range_count];
+			DIOUM_RANGE_SET *RangeSet = nullptr;
+
+			for (std::size_t i = 0; i < range_count; i++)
+				PortRanges[i] = { ranges[i].start, ranges[i].end };
+
+			if (!DioCreateRangeSet(Context, Name, static_cast<ULONG>(range_count), PortRanges, nullptr, nullptr, &RangeSet))
+				return nullptr;
+
+			return RangeSet;
+		}
+
+		static bool read(DIOUM_DRIVER_CONTEXT *Context, DIOUM_RANGE_SET *RangeSet, frame &Frame) {
+			return !!DioReadRangeSet(Context, RangeSet, Frame.bytes.data(), static_cast<ULONG>(data_length), nullptr);
+		}
+
+		static bool write(DIOUM_DRIVER_CONTEXT *Context, DIOUM_RANGE_SET *RangeSet, frame &Frame) {
+			return !!DioWriteRangeSet(Context, RangeSet, Frame.bytes.data(), static_cast<ULONG>(data_length), nullptr);
+		}
+	};
+
+} // namespace regmap
+} // namespace dio
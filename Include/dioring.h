@@ -0,0 +1,509 @@
+
+#pragma once
+
+//
+// Submission and completion rings shared by DIOUM and the driver.
+//
+// The caller writes port operations to the submission ring (SQ) and the driver posts one completion
+// per operation to the completion ring (CQ), in the order of the submissions. Each ring has a single
+// producer and a single consumer, which own Tail and Head respectively, so no lock is shared between
+// them. Indices run free and wrap around, and entry counts are powers of two.
+//
+// This header only uses the base types (ULONG, UCHAR, ...), so the same protocol code is built into
+// the driver, DIOUM and the user-mode test (test/ring_test.c). Include ntddk.h, Windows.h or a header
+// which provides the base types first.
+//
+// Driver treats everything in the shared memory as untrusted. Geometry is kept in DIO_RING_CONSUMER, 
+// and each submission is copied once before it is used.
+//
+
+#define DIO_RING_MINIMUM_ENTRIES				16
+#define DIO_RING_MAXIMUM_ENTRIES				4096	// Submission entries. Completion ring is twice as large.
+
+// Flags of DIO_RING_SHARED, which are written by the driver.
+#define DIO_RING_FLAG_NEED_WAKEUP				0x00000001	// Polling thread sleeps. Ring the doorbell after submit.
+#define DIO_RING_FLAG_CORRUPTED					0x00000002	// Submission tail was invalid. Ring is stopped.
+
+// Operations of the submission.
+#define DIO_RING_OP_NOP							0x00
+#define DIO_RING_OP_READ						0x01	// Data of the completion = Port
+#define DIO_RING_OP_WRITE						0x02	// Port = Data
+#define DIO_RING_OP_MODIFY						0x03	// Port = (Port & ~Mask) | (Data & Mask). Data of the completion = old Port
+#define DIO_RING_OP_MAXIMUM						DIO_RING_OP_MODIFY
+
+// Status of the completion.
+#define DIO_RING_STATUS_SUCCESS					0x00
+#define DIO_RING_STATUS_INVALID_OPERATION		0x01
+#define DIO_RING_STATUS_ACCESS_DENIED			0x02	// Port is not claimed by the driver.
+
+#if defined(_MSC_VER)
+#define DIO_RING_INLINE							static __inline
+#else
+#define DIO_RING_INLINE							static inline
+#endif
+
+// Full barrier. Publishing an index and checking DIO_RING_FLAG_NEED_WAKEUP need the store-load order.
+#ifndef DIO_RING_BARRIER
+#if defined(_MSC_VER)
+#define DIO_RING_BARRIER()						MemoryBarrier()
+#else
+#define DIO_RING_BARRIER()						__sync_synchronize()
+#endif
+#endif
+
+#pragma pack(push, 8)
+
+/**
+ *	@brief	Indices of one ring. Head and Tail are in separate cache lines.
+ */
+typedef struct _DIO_RING_INDICES {
+	volatile ULONG Head;			//!< Next entry to consume. Written by the consumer only.
+	ULONG Reserved1[15];
+	volatile ULONG Tail;			//!< Next entry to produce. Written by the producer only.
+	ULONG Reserved2[15];
+} DIO_RING_INDICES;
+
+/**
+ *	@brief	Head of the shared memory. The entries of the rings follow it.
+ */
+typedef struct _DIO_RING_SHARED {
+	DIO_RING_INDICES Submission;
+	DIO_RING_INDICES Completion;
+	volatile ULONG Flags;			//!< Combination of DIO_RING_FLAG_XXX.
+	ULONG SubmissionEntries;		//!< Count of submission entries.
+	ULONG CompletionEntries;		//!< Count of completion entries.
+	ULONG SubmissionOffset;			//!< Offset of the submission entries from the shared memory.
+	ULONG CompletionOffset;			//!< Offset of the completion entries from the shared memory.
+	ULONG Reserved[11];
+} DIO_RING_SHARED;
+
+/**
+ *	@brief	Port operation in the submission ring.
+ */
+typedef struct _DIO_RING_SUBMISSION {
+	ULONGLONG UserData;				//!< Caller-defined value which is copied to the completion.
+	USHORT Port;					//!< Port address.
+	UCHAR Operation;				//!< DIO_RING_OP_XXX.
+	UCHAR Data;						//!< Value to write (WRITE and MODIFY).
+	UCHAR Mask;						//!< Bits to change (MODIFY).
+	UCHAR Reserved[3];
+} DIO_RING_SUBMISSION;
+
+/**
+ *	@brief	Result of the operation in the completion ring.
+ */
+typedef struct _DIO_RING_COMPLETION {
+	ULONGLONG UserData;				//!< UserData of the submission.
+	UCHAR Status;					//!< DIO_RING_STATUS_XXX.
+	UCHAR Operation;				//!< Operation of the submission.
+	UCHAR Data;						//!< Value read (READ and MODIFY).
+	UCHAR Reserved[5];
+} DIO_RING_COMPLETION;
+
+/**
+ *	@brief	Private state of the consumer of the submissions (driver).
+ */
+typedef struct _DIO_RING_CONSUMER {
+	DIO_RING_SHARED *Shared;
+	volatile DIO_RING_SUBMISSION *Submissions;
+	DIO_RING_COMPLETION *Completions;
+	ULONG SubmissionEntries;
+	ULONG CompletionEntries;
+	ULONG SubmissionHead;
+	ULONG CompletionTail;
+	BOOLEAN Corrupted;
+} DIO_RING_CONSUMER;
+
+/**
+ *	@brief	Private state of the producer of the submissions (caller).
+ */
+typedef struct _DIO_RING_PRODUCER {
+	DIO_RING_SHARED *Shared;
+	DIO_RING_SUBMISSION *Submissions;
+	volatile DIO_RING_COMPLETION *Completions;
+	ULONG SubmissionEntries;
+	ULONG CompletionEntries;
+	ULONG SubmissionTail;			// Includes the prepared submissions which are not published.
+	ULONG CompletionHead;
+} DIO_RING_PRODUCER;
+
+#pragma pack(pop)
+
+// Runs one submission. Returns DIO_RING_STATUS_XXX, and the value read in *Data.
+typedef UCHAR (*DIO_RING_EXECUTE)(PVOID Context, DIO_RING_SUBMISSION *Submission, UCHAR *Data);
+
+
+DIO_RING_INLINE
+ULONG
+DioRingGetLength(
+	IN ULONG SubmissionEntries)
+/**
+ *	@brief	Returns the length of the shared memory of the rings.
+ */
+{
+	return sizeof(DIO_RING_SHARED) + SubmissionEntries * sizeof(DIO_RING_SUBMISSION) +
+		SubmissionEntries * 2 * sizeof(DIO_RING_COMPLETION);
+}
+
+DIO_RING_INLINE
+BOOLEAN
+DioRingIsValidEntries(
+	IN ULONG SubmissionEntries)
+/**
+ *	@brief	Checks the count of submission entries.
+ */
+{
+	return (BOOLEAN)(SubmissionEntries >= DIO_RING_MINIMUM_ENTRIES && 
+		SubmissionEntries <= DIO_RING_MAXIMUM_ENTRIES && 
+		!(SubmissionEntries & (SubmissionEntries - 1)));
+}
+
+DIO_RING_INLINE
+ULONG
+DioRingSpace(
+	IN DIO_RING_INDICES *Indices, 
+	IN ULONG Tail, 
+	IN ULONG Entries)
+/**
+ *	@brief	Producer side. Returns the count of free entries, or zero if the consumer's Head is invalid.
+ */
+{
+	ULONG Used = Tail - Indices->Head;
+
+	// Entries which the consumer released are not overwritten before Head is read.
+	DIO_RING_BARRIER();
+
+	return (Used > Entries) ? 0 : Entries - Used;
+}
+
+DIO_RING_INLINE
+VOID
+DioRingPublish(
+	IN DIO_RING_INDICES *Indices, 
+	IN ULONG Tail)
+/**
+ *	@brief	Producer side. Makes the entries before Tail visible to the consumer.
+ */
+{
+	DIO_RING_BARRIER();
+	Indices->Tail = Tail;
+}
+
+DIO_RING_INLINE
+ULONG
+DioRingPending(
+	IN DIO_RING_INDICES *Indices, 
+	IN ULONG Head)
+/**
+ *	@brief	Consumer side. Returns the count of entries to consume. Caller must check it against
+ *	the entry count, since the producer may be broken.
+ */
+{
+	ULONG Pending = Indices->Tail - Head;
+
+	// Entries are not read before Tail.
+	DIO_RING_BARRIER();
+
+	return Pending;
+}
+
+DIO_RING_INLINE
+VOID
+DioRingRelease(
+	IN DIO_RING_INDICES *Indices, 
+	IN ULONG Head)
+/**
+ *	@brief	Consumer side. Gives the entries before Head back to the producer.
+ */
+{
+	DIO_RING_BARRIER();
+	Indices->Head = Head;
+}
+
+DIO_RING_INLINE
+VOID
+DioRingConsumerInitialize(
+	OUT DIO_RING_CONSUMER *Consumer, 
+	IN PVOID Memory, 
+	IN ULONG SubmissionEntries)
+/**
+ *	@brief	Lays out the shared memory and initializes the consumer.
+ *	
+ *	@param	[out] Consumer				Consumer to initialize.
+ *	@param	[in] Memory					Zeroed memory of DioRingGetLength() bytes, 8-byte aligned.
+ *	@param	[in] SubmissionEntries		Count of submission entries. Must pass DioRingIsValidEntries().
+ *	@return								None.
+ *	
+ */
+{
+	DIO_RING_SHARED *Shared = (DIO_RING_SHARED *)Memory;
+
+	Shared->SubmissionEntries = SubmissionEntries;
+	Shared->CompletionEntries = SubmissionEntries * 2;
+	Shared->SubmissionOffset = sizeof(DIO_RING_SHARED);
+	Shared->CompletionOffset = sizeof(DIO_RING_SHARED) + SubmissionEntries * sizeof(DIO_RING_SUBMISSION);
+
+	Consumer->Shared = Shared;
+	Consumer->Submissions = (DIO_RING_SUBMISSION *)((PUCHAR)Memory + Shared->SubmissionOffset);
+	Consumer->Completions = (DIO_RING_COMPLETION *)((PUCHAR)Memory + Shared->CompletionOffset);
+	Consumer->SubmissionEntries = Shared->SubmissionEntries;
+	Consumer->CompletionEntries = Shared->CompletionEntries;
+	Consumer->SubmissionHead = 0;
+	Consumer->CompletionTail = 0;
+	Consumer->Corrupted = FALSE;
+}
+
+DIO_RING_INLINE
+BOOLEAN
+DioRingConsumerHasWork(
+	IN DIO_RING_CONSUMER *Consumer)
+/**
+ *	@brief	Consumer side. Returns TRUE if a submission is pending and the completion ring has space
+ *	for it, or the ring is broken.
+ *	
+ *	Submissions wait while the completion ring is full, so the polling thread sleeps then until
+ *	the producer reaps.
+ */
+{
+	ULONG Pending = DioRingPending(&Consumer->Shared->Submission, Consumer->SubmissionHead);
+
+	if (!Pending)
+		return FALSE;
+
+	return (BOOLEAN)(Pending > Consumer->SubmissionEntries || 
+		DioRingSpace(&Consumer->Shared->Completion, Consumer->CompletionTail, Consumer->CompletionEntries) != 0);
+}
+
+DIO_RING_INLINE
+ULONG
+DioRingConsume(
+	IN OUT DIO_RING_CONSUMER *Consumer, 
+	IN ULONG Maximum, 
+	IN DIO_RING_EXECUTE Execute, 
+	IN PVOID Context)
+/**
+ *	@brief	Consumer side. Runs the pending submissions and posts their completions.
+ *	
+ *	Submissions are taken only as far as the completion ring has space, so no completion is lost.
+ *	If the producer published an invalid Tail, Corrupted is set and nothing is run.
+ *	
+ *	@param	[in, out] Consumer			Consumer.
+ *	@param	[in] Maximum				Maximum count of submissions to run.
+ *	@param	[in] Execute				Runs one submission.
+ *	@param	[in] Context				Context of Execute.
+ *	@return								Count of submissions which are run.
+ *	
+ */
+{
+	DIO_RING_SHARED *Shared = Consumer->Shared;
+	ULONG SubmissionMask = Consumer->SubmissionEntries - 1;
+	ULONG CompletionMask = Consumer->CompletionEntries - 1;
+	ULONG Pending;
+	ULONG Space;
+	ULONG Count;
+	ULONG i;
+
+	if (Consumer->Corrupted)
+		return 0;
+
+	Pending = DioRingPending(&Shared->Submission, Consumer->SubmissionHead);
+	if (Pending > Consumer->SubmissionEntries)
+	{
+		Consumer->Corrupted = TRUE;
+		return 0;
+	}
+
+	Space = DioRingSpace(&Shared->Completion, Consumer->CompletionTail, Consumer->CompletionEntries);
+
+	Count = Pending;
+	if (Count > Space)
+		Count = Space;
+	if (Count > Maximum)
+		Count = Maximum;
+
+	for (i = 0; i < Count; i++)
+	{
+		// Copied once, so the producer cannot change it between the check and the use.
+		DIO_RING_SUBMISSION Submission = Consumer->Submissions[(Consumer->SubmissionHead + i) & SubmissionMask];
+		DIO_RING_COMPLETION *Completion = &Consumer->Completions[(Consumer->CompletionTail + i) & CompletionMask];
+		UCHAR Data = 0;
+		UCHAR Status;
+
+		if (Submission.Operation > DIO_RING_OP_MAXIMUM)
+			Status = DIO_RING_STATUS_INVALID_OPERATION;
+		else if (Submission.Operation == DIO_RING_OP_NOP)
+			Status = DIO_RING_STATUS_SUCCESS;
+		else
+			Status = Execute(Context, &Submission, &Data);
+
+		Completion->UserData = Submission.UserData;
+		Completion->Status = Status;
+		Completion->Operation = Submission.Operation;
+		Completion->Data = Data;
+	}
+
+	if (Count)
+	{
+		Consumer->SubmissionHead += Count;
+		Consumer->CompletionTail += Count;
+
+		DioRingPublish(&Shared->Completion, Consumer->CompletionTail);
+		DioRingRelease(&Shared->Submission, Consumer->SubmissionHead);
+	}
+
+	return Count;
+}
+
+DIO_RING_INLINE
+BOOLEAN
+DioRingProducerInitialize(
+	OUT DIO_RING_PRODUCER *Producer, 
+	IN PVOID Memory, 
+	IN ULONG Length)
+/**
+ *	@brief	Initializes the producer from the shared memory which the consumer laid out.
+ *	
+ *	@param	[out] Producer				Producer to initialize.
+ *	@param	[in] Memory					Shared memory.
+ *	@param	[in] Length					Length of the shared memory.
+ *	@return								Non-zero if the layout is valid.
+ *	
+ */
+{
+	DIO_RING_SHARED *Shared = (DIO_RING_SHARED *)Memory;
+
+	if (Length < sizeof(DIO_RING_SHARED) || 
+		!DioRingIsValidEntries(Shared->SubmissionEntries) || 
+		Shared->CompletionEntries != Shared->SubmissionEntries * 2 || 
+		Length < DioRingGetLength(Shared->SubmissionEntries) || 
+		Shared->SubmissionOffset < sizeof(DIO_RING_SHARED) || 
+		Shared->SubmissionOffset + Shared->SubmissionEntries * sizeof(DIO_RING_SUBMISSION) > Length || 
+		Shared->CompletionOffset < sizeof(DIO_RING_SHARED) || 
+		Shared->CompletionOffset + Shared->CompletionEntries * sizeof(DIO_RING_COMPLETION) > Length)
+		return FALSE;
+
+	Producer->Shared = Shared;
+	Producer->Submissions = (DIO_RING_SUBMISSION *)((PUCHAR)Memory + Shared->SubmissionOffset);
+	Producer->Completions = (DIO_RING_COMPLETION *)((PUCHAR)Memory + Shared->CompletionOffset);
+	Producer->SubmissionEntries = Shared->SubmissionEntries;
+	Producer->CompletionEntries = Shared->CompletionEntries;
+	Producer->SubmissionTail = Shared->Submission.Tail;
+	Producer->CompletionHead = Shared->Completion.Head;
+
+	return TRUE;
+}
+
+DIO_RING_INLINE
+BOOLEAN
+DioRingProducerPrepare(
+	IN OUT DIO_RING_PRODUCER *Producer, 
+	IN DIO_RING_SUBMISSION *Submission)
+/**
+ *	@brief	Producer side. Writes the submission to the ring without publishing it.
+ *	
+ *	@return								Non-zero if written. Fails if the ring is full.
+ *	
+ */
+{
+	if (!DioRingSpace(&Producer->Shared->Submission, Producer->SubmissionTail, Producer->SubmissionEntries))
+		return FALSE;
+
+	Producer->Submissions[Producer->SubmissionTail & (Producer->SubmissionEntries - 1)] = *Submission;
+	Producer->SubmissionTail++;
+
+	return TRUE;
+}
+
+DIO_RING_INLINE
+ULONG
+DioRingProducerSubmit(
+	IN OUT DIO_RING_PRODUCER *Producer)
+/**
+ *	@brief	Producer side. Publishes the prepared submissions.
+ *	
+ *	@return								Count of submissions which are published now.
+ *	
+ */
+{
+	ULONG Count = Producer->SubmissionTail - Producer->Shared->Submission.Tail;
+
+	if (Count)
+		DioRingPublish(&Producer->Shared->Submission, Producer->SubmissionTail);
+
+	return Count;
+}
+
+DIO_RING_INLINE
+BOOLEAN
+DioRingProducerNeedsWakeup(
+	IN DIO_RING_PRODUCER *Producer)
+/**
+ *	@brief	Producer side. Checks whether the polling consumer sleeps, after the submit.
+ *	
+ *	Consumer sets the flag and checks the ring again before it sleeps, and the producer publishes
+ *	and checks the flag, so one of them always sees the other.
+ */
+{
+	DIO_RING_BARRIER();
+
+	return (BOOLEAN)((Producer->Shared->Flags & DIO_RING_FLAG_NEED_WAKEUP) != 0);
+}
+
+DIO_RING_INLINE
+ULONG
+DioRingProducerReap(
+	IN OUT DIO_RING_PRODUCER *Producer, 
+	OUT DIO_RING_COMPLETION *Completions, 
+	IN ULONG Maximum)
+/**
+ *	@brief	Producer side. Takes the posted completions, oldest first.
+ *	
+ *	Polling consumer sleeps while the completion ring is full, so check
+ *	DioRingProducerNeedsWakeupAfterReap() and ring the doorbell after completions are taken.
+ *	
+ *	@param	[in, out] Producer			Producer.
+ *	@param	[out] Completions			Receives the completions.
+ *	@param	[in] Maximum				Count of completions which Completions can hold.
+ *	@return								Count of completions which are taken.
+ *	
+ */
+{
+	ULONG Mask = Producer->CompletionEntries - 1;
+	ULONG Pending = DioRingPending(&Producer->Shared->Completion, Producer->CompletionHead);
+	ULONG i;
+
+	if (Pending > Producer->CompletionEntries)
+		return 0;
+
+	if (Pending > Maximum)
+		Pending = Maximum;
+
+	for (i = 0; i < Pending; i++)
+		Completions[i] = Producer->Completions[(Producer->CompletionHead + i) & Mask];
+
+	if (Pending)
+	{
+		Producer->CompletionHead += Pending;
+		DioRingRelease(&Producer->Shared->Completion, Producer->CompletionHead);
+	}
+
+	return Pending;
+}
+
+DIO_RING_INLINE
+BOOLEAN
+DioRingProducerNeedsWakeupAfterReap(
+	IN DIO_RING_PRODUCER *Producer)
+/**
+ *	@brief	Producer side. Checks whether the polling consumer sleeps on the full completion ring,
+ *	after the reap.
+ *	
+ *	Consumer sets the flag and checks the completion space again before it sleeps, and the
+ *	producer releases the completions and checks the flag, so one of them always sees the other.
+ */
+{
+	DIO_RING_BARRIER();
+
+	return (BOOLEAN)((Producer->Shared->Flags & DIO_RING_FLAG_NEED_WAKEUP) && 
+		Producer->Shared->Submission.Head != Producer->Shared->Submission.Tail);
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+//
+// Live snapshot page shared by DIOUM and the driver.
+//
+// The driver refreshes the input ports into one page which is mapped read-only to the caller, and
+// publishes the driver configuration in the same page. The page is guarded by a sequence counter
+// (seqlock): the driver makes Sequence odd, updates the page and makes it even again. Readers copy
+// what they need between two reads of Sequence and retry if it was odd or has changed, so any
+// number of threads read without a lock and without an IOCTL.
+//
+// The driver keeps its own copy of Sequence and never reads the page back, so the page carries no
+// state which the driver trusts.
+//
+// Include dioctl.h first (DIO_PORT_RANGE and DIO_SNAPSHOT_MAXIMUM_RANGES).
+//
+
+#define DIO_SNAPSHOT_PAGE_LENGTH				4096
+#define DIO_SNAPSHOT_MAXIMUM_DATA_LENGTH		(DIO_SNAPSHOT_PAGE_LENGTH - 128)
+
+#if defined(_MSC_VER)
+#define DIO_SNAPSHOT_INLINE						static __inline
+#else
+#define DIO_SNAPSHOT_INLINE						static inline
+#endif
+
+// Writer needs the full barrier. Reader only keeps its loads in order, which x86 and x64 do by
+// themselves, so the compiler barrier is enough there.
+#ifndef DIO_SNAPSHOT_BARRIER
+#if defined(_MSC_VER)
+#define DIO_SNAPSHOT_BARRIER()					MemoryBarrier()
+#define DIO_SNAPSHOT_READ_BARRIER()				_ReadBarrier()
+#else
+#define DIO_SNAPSHOT_BARRIER()					__sync_synchronize()
+#define DIO_SNAPSHOT_READ_BARRIER()				__atomic_thread_fence(__ATOMIC_ACQUIRE)
+#endif
+#endif
+
+#pragma pack(push, 8)
+
+/**
+ *	@brief	Snapshot page. Data follows the 128-byte header.
+ */
+typedef struct _DIO_SNAPSHOT_PAGE {
+	volatile ULONG Sequence;		//!< Odd while the driver updates the page.
+	ULONG ConfigurationBits;		//!< DIO_CFGB_XXX of the driver.
+	ULONG Running;					//!< Non-zero while the ports are refreshed.
+	ULONG Interval;					//!< Nanoseconds between the refreshes.
+	ULONG RangeCount;				//!< Count of Ranges.
+	ULONG DataLength;				//!< Total length of Ranges. Data is in the order of Ranges.
+	LONGLONG Timestamp;				//!< Kernel performance counter after the ports are read.
+	LONGLONG Frequency;				//!< Kernel performance counter frequency.
+	ULONGLONG SampleCount;			//!< Count of refreshes since the start. Zero if Data is not valid.
+	ULONG Reserved[4];
+	DIO_PORT_RANGE Ranges[DIO_SNAPSHOT_MAXIMUM_RANGES];
+	UCHAR Data[DIO_SNAPSHOT_MAXIMUM_DATA_LENGTH];
+} DIO_SNAPSHOT_PAGE;
+
+#pragma pack(pop)
+
+
+DIO_SNAPSHOT_INLINE
+VOID
+DioSnapshotBeginUpdate(
+	IN OUT DIO_SNAPSHOT_PAGE *Page, 
+	IN OUT ULONG *Sequence)
+/**
+ *	@brief	Makes the page inconsistent for the readers. Writer only.
+ *	
+ *	@param	[in, out] Page				Snapshot page.
+ *	@param	[in, out] Sequence			Private sequence of the writer.
+ *	
+ */
+{
+	*Sequence += 1;
+	Page->Sequence = *Sequence;
+	DIO_SNAPSHOT_BARRIER();
+}
+
+DIO_SNAPSHOT_INLINE
+VOID
+DioSnapshotEndUpdate(
+	IN OUT DIO_SNAPSHOT_PAGE *Page, 
+	IN OUT ULONG *Sequence)
+/**
+ *	@brief	Publishes the update of the page. Writer only.
+ *	
+ *	@param	[in, out] Page				Snapshot page.
+ *	@param	[in, out] Sequence			Private sequence of the writer.
+ *	
+ */
+{
+	DIO_SNAPSHOT_BARRIER();
+	*Sequence += 1;
+	Page->Sequence = *Sequence;
+}
+
+DIO_SNAPSHOT_INLINE
+ULONG
+DioSnapshotReadBegin(
+	IN const DIO_SNAPSHOT_PAGE *Page)
+/**
+ *	@brief	Starts the read of the page.
+ *	
+ *	@param	[in] Page					Snapshot page.
+ *	@return								Sequence to give to DioSnapshotReadRetry(). Odd if the
+ *										driver is updating the page.
+ *	
+ */
+{
+	ULONG Sequence = Page->Sequence;
+
+	DIO_SNAPSHOT_READ_BARRIER();
+
+	return Sequence;
+}
+
+DIO_SNAPSHOT_INLINE
+BOOLEAN
+DioSnapshotReadRetry(
+	IN const DIO_SNAPSHOT_PAGE *Page, 
+	IN ULONG Sequence)
+/**
+ *	@brief	Ends the read of the page.
+ *	
+ *	@param	[in] Page					Snapshot page.
+ *	@param	[in] Sequence				Return value of DioSnapshotReadBegin().
+ *	@return								Non-zero if what was read may be torn, so read again.
+ *	
+ */
+{
+	DIO_SNAPSHOT_READ_BARRIER();
+
+	return (BOOLEAN)((Sequence & 1) || Page->Sequence != Sequence);
+}
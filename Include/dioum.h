@@ -2,12 +2,397 @@
 #pragma once
 
 typedef struct _DIOUM_DRIVER_CONTEXT		DIOUM_DRIVER_CONTEXT;
+typedef struct _DIOUM_RANGE_SET				DIOUM_RANGE_SET;
+typedef struct _DIOUM_CHANNEL_MAP			DIOUM_CHANNEL_MAP;
 
 typedef struct _DIOUM_PORT_RANGE {
 	USHORT StartAddress;
 	USHORT EndAddress;
 } DIOUM_PORT_RANGE;
 
+// Element i is Width consecutive ports from StartAddress + i * Stride. Elements are transferred Repeat times.
+typedef struct _DIOUM_PORT_DESCRIPTOR {
+	USHORT StartAddress;			// First port of the first element.
+	USHORT Count;					// Count of elements. Non-zero.
+	USHORT Stride;					// Port distance between the elements. Zero repeats the same ports.
+	USHORT Width;					// Consecutive ports of an element. Non-zero.
+	USHORT Repeat;					// Times the elements are transferred. Non-zero.
+} DIOUM_PORT_DESCRIPTOR;
+
+typedef struct _DIOUM_SCATTER_ENTRY {
+	DIOUM_PORT_RANGE Range;			// Port address range to read.
+	PUCHAR Buffer;					// Receives (EndAddress - StartAddress + 1) bytes.
+} DIOUM_SCATTER_ENTRY;
+
+typedef struct _DIOUM_WAIT_PATTERN_RESULT {
+	UCHAR ObservedValue;			// Last value read from the port (read XOR mask applied).
+	ULONG ElapsedTime;				// Elapsed time in microseconds.
+	ULONG Iterations;				// Count of the probes.
+} DIOUM_WAIT_PATTERN_RESULT;
+
+typedef struct _DIOUM_IO_TIMESTAMP {
+	LONGLONG StartTime;				// Before the first port access, in QueryPerformanceCounter() ticks.
+	LONGLONG EndTime;				// After the last port access, in QueryPerformanceCounter() ticks.
+	BOOLEAN Converted;				// FALSE if the clock could not be calibrated after the access.
+									// Then the times are in the kernel performance counter ticks.
+} DIOUM_IO_TIMESTAMP;
+
+typedef struct _DIOUM_PORT_SKEW {
+	ULONGLONG Cycles;				// Time stamp counter ticks from the first to the last port access.
+	ULONG Nanoseconds;				// Cycles in nanoseconds. Zero if the driver could not calibrate the counter.
+	ULONG PortCount;				// Count of port accesses in the group.
+} DIOUM_PORT_SKEW;
+
+typedef struct _DIOUM_REPLAY_STATISTICS {
+	ULONG RecordCount;				// Records in the log.
+	ULONG ReplayedCount;			// Port reads and writes which are replayed.
+	ULONG SkippedCount;				// Other IOCTLs which are not replayed.
+	ULONG FailedCount;				// Replayed records whose result or length differs from the recording.
+	ULONG MismatchCount;			// Replayed reads which returned different data.
+	ULONGLONG RecordedLatency;		// Sum of the recorded latency in nanoseconds.
+	ULONGLONG ReplayedLatency;		// Sum of the replayed latency in nanoseconds.
+	LONGLONG MinimumLatencyDifference;	// Smallest (replayed - recorded) latency in nanoseconds.
+	LONGLONG MaximumLatencyDifference;	// Largest (replayed - recorded) latency in nanoseconds.
+} DIOUM_REPLAY_STATISTICS;
+
+// Channel value is inverted (active low).
+#define DIOUM_CHANNEL_INVERTED				0x01
+#define DIOUM_CHANNEL_VALID_FLAGS			(DIOUM_CHANNEL_INVERTED)
+
+#define DIOUM_MAXIMUM_CHANNELS				4096
+
+typedef struct _DIOUM_CHANNEL {
+	USHORT Port;					// Port address. Must be in the range set of the channel map.
+	UCHAR Bit;						// Bit in the port (0 ~ 7).
+	UCHAR Flags;					// DIOUM_CHANNEL_XXX.
+} DIOUM_CHANNEL;
+
+// Limits of the edge counting engine.
+#define DIOUM_EDGE_MAXIMUM_CHANNELS			32
+#define DIOUM_EDGE_MAXIMUM_DECODERS			8
+
+// Sampler of the edge counting engine may run on any processor.
+#define DIOUM_EDGE_ANY_PROCESSOR			0xffffffff
+
+// Age of the channel which has not seen a rising edge.
+#define DIOUM_EDGE_NO_EDGE					((ULONGLONG)-1)
+
+// Decoder has no index channel.
+#define DIOUM_QUADRATURE_NO_INDEX			0xff
+
+// Position is cleared on the rising edge of the index.
+#define DIOUM_QUADRATURE_RESET_ON_INDEX		0x01
+// Counts down when A leads B.
+#define DIOUM_QUADRATURE_REVERSE			0x02
+
+typedef struct _DIOUM_QUADRATURE_DECODER {
+	UCHAR ChannelA;					// Index of the A phase channel.
+	UCHAR ChannelB;					// Index of the B phase channel.
+	UCHAR ChannelIndex;				// Index of the index channel, or DIOUM_QUADRATURE_NO_INDEX.
+	UCHAR Flags;					// DIOUM_QUADRATURE_XXX.
+} DIOUM_QUADRATURE_DECODER;
+
+typedef struct _DIOUM_EDGE_COUNTER {
+	ULONG RisingEdges;				// Count of rising edges.
+	ULONG FallingEdges;				// Count of falling edges.
+	ULONG Level;					// Level of the last sample.
+	ULONG Frequency;				// Estimated frequency in millihertz. Decays once the edges stop.
+	ULONGLONG Period;				// Nanoseconds between the last two rising edges. Zero if unknown.
+	ULONGLONG Age;					// Nanoseconds since the last rising edge, or DIOUM_EDGE_NO_EDGE.
+} DIOUM_EDGE_COUNTER;
+
+typedef struct _DIOUM_QUADRATURE_COUNTER {
+	LONG Position;					// Position in counts (4 per cycle).
+	LONG IndexPosition;				// Position latched on the last index, before the reset.
+	ULONG IndexCount;				// Count of index pulses.
+	ULONG ErrorCount;				// Count of samples where A and B changed together (sampling too slow).
+} DIOUM_QUADRATURE_COUNTER;
+
+typedef struct _DIOUM_EDGE_COUNTERS {
+	ULONG Running;					// Non-zero if the sampler is running.
+	ULONG ChannelCount;				// Count of valid Channels.
+	ULONG DecoderCount;				// Count of valid Decoders.
+	ULONG MissedSamples;			// Sample ticks which the sampler could not keep up with.
+	ULONGLONG SampleCount;			// Count of samples.
+	ULONGLONG SampleTime;			// Nanoseconds from the first to the last sample.
+	DIOUM_EDGE_COUNTER Channels[DIOUM_EDGE_MAXIMUM_CHANNELS];
+	DIOUM_QUADRATURE_COUNTER Decoders[DIOUM_EDGE_MAXIMUM_DECODERS];
+} DIOUM_EDGE_COUNTERS;
+
+// Limits of the output stream.
+#define DIOUM_STREAM_MAXIMUM_RANGES			16
+#define DIOUM_STREAM_MAXIMUM_FRAME_LENGTH	256
+
+// Ticks of the output stream may run on any processor.
+#define DIOUM_STREAM_ANY_PROCESSOR			0xffffffff
+
+// Repeats the last written segment until the next one is written, instead of running out.
+#define DIOUM_STREAM_LOOP					0x00000001
+#define DIOUM_STREAM_VALID_FLAGS			(DIOUM_STREAM_LOOP)
+
+typedef struct _DIOUM_STREAM_STATUS {
+	ULONG Running;					// Non-zero if the ticks are running.
+	ULONG Flags;					// DIOUM_STREAM_XXX.
+	ULONG FrameLength;				// Length of one frame in bytes.
+	ULONG FrameCapacity;			// Count of frames in the driver buffer.
+	ULONG QueuedFrames;				// Frames which are queued but not played yet.
+	ULONG FreeFrames;				// Frames which can be queued now.
+	ULONG Reserved;
+	ULONG Underruns;				// Ticks which had no frame to play, after the first frame.
+	ULONG Loops;					// Times the segment is repeated.
+	ULONG LateTicks;				// Ticks played later than one tick interval.
+	ULONGLONG PlayedFrames;			// Count of frames written to the ports.
+	ULONGLONG MaximumLateness;		// Largest delay of a tick in nanoseconds.
+} DIOUM_STREAM_STATUS;
+
+// Limits of the output scheduler.
+#define DIOUM_SCHEDULE_MAXIMUM_CAPACITY		0x20000
+#define DIOUM_SCHEDULE_MAXIMUM_LENGTH		4
+#define DIOUM_SCHEDULE_RECORD_COUNT			1024
+#define DIOUM_SCHEDULE_MAXIMUM_HORIZON		86400	// Seconds which Time may be away from now.
+
+// Output scheduler may run on any processor.
+#define DIOUM_SCHEDULE_ANY_PROCESSOR		0xffffffff
+
+// Operations of the scheduled entry. Bits are in the caller's domain (write XOR mask applied).
+#define DIOUM_SCHEDULE_WRITE				0x00	// Port = Data
+#define DIOUM_SCHEDULE_MODIFY				0x01	// Port = (Port & ~Mask) | (Data & Mask)
+#define DIOUM_SCHEDULE_SET					0x02	// Sets the bits of Mask
+#define DIOUM_SCHEDULE_CLEAR				0x03	// Clears the bits of Mask
+#define DIOUM_SCHEDULE_TOGGLE				0x04	// Inverts the bits of Mask
+
+// Lateness histogram buckets: < 1us, < 10us, < 100us, < 1ms and the rest.
+#define DIOUM_SCHEDULE_HISTOGRAM_BUCKETS	5
+
+typedef struct _DIOUM_SCHEDULE_ENTRY {
+	LONGLONG Time;					// Deadline in QueryPerformanceCounter() ticks. Past deadline runs at once.
+	ULONG Tag;						// Caller-defined value which is reported in the record.
+	USHORT Port;					// First port address.
+	UCHAR Length;					// Count of ports (1 ~ DIOUM_SCHEDULE_MAXIMUM_LENGTH).
+	UCHAR Operation;				// DIOUM_SCHEDULE_XXX. Except WRITE, the ports are read back.
+	UCHAR Data[DIOUM_SCHEDULE_MAXIMUM_LENGTH];	// Value of each port (WRITE and MODIFY).
+	UCHAR Mask[DIOUM_SCHEDULE_MAXIMUM_LENGTH];	// Bits of each port to change (except WRITE).
+} DIOUM_SCHEDULE_ENTRY;
+
+typedef struct _DIOUM_SCHEDULE_RECORD {
+	ULONG Tag;						// Tag of the entry.
+	ULONG Reserved;
+	LONGLONG Time;					// Deadline of the entry in QueryPerformanceCounter() ticks.
+	ULONGLONG Lateness;				// Nanoseconds from the deadline to the port access.
+} DIOUM_SCHEDULE_RECORD;
+
+typedef struct _DIOUM_SCHEDULER_STATUS {
+	ULONG Running;					// Non-zero if the scheduler is running.
+	ULONG Capacity;					// Maximum count of pending entries.
+	ULONG PendingEntries;			// Entries waiting for the deadline.
+	ULONG RejectedEntries;			// Entries which are not accepted since the queue was full.
+	ULONG LostRecords;				// Records which are dropped before they are read.
+	ULONG RecordCount;				// Count of records which are returned.
+	ULONGLONG FiredEntries;			// Count of entries which are run.
+	ULONGLONG TotalLateness;		// Sum of the lateness in nanoseconds.
+	ULONGLONG MaximumLateness;		// Largest lateness in nanoseconds.
+	ULONG LatenessHistogram[DIOUM_SCHEDULE_HISTOGRAM_BUCKETS];	// Fired entries by lateness.
+	ULONG Reserved;
+} DIOUM_SCHEDULER_STATUS;
+
+// Limits of the reaction programs.
+#define DIOUM_REACTION_MAXIMUM_PROGRAMS		8
+#define DIOUM_REACTION_MAXIMUM_INSTRUCTIONS	256
+#define DIOUM_REACTION_MAXIMUM_STEPS		1024
+#define DIOUM_REACTION_MAXIMUM_PORTS		8
+#define DIOUM_REACTION_REGISTERS			8
+#define DIOUM_REACTION_STATES				8
+
+// Reactor may run on any processor.
+#define DIOUM_REACTION_ANY_PROCESSOR		0xffffffff
+
+// Unloads every program.
+#define DIOUM_REACTION_ALL_PROGRAMS			0xffffffff
+
+// Program runs on every tick, or on the tick which sees a change in the Mask bits of its inputs.
+#define DIOUM_REACTION_TRIGGER_TICK			0x00
+#define DIOUM_REACTION_TRIGGER_CHANGE		0x01
+
+// Instructions. The operand is R[Source], or Immediate with DIOUM_REACTION_OP_IMMEDIATE.
+#define DIOUM_REACTION_OP_EXIT				0x00	// Ends the run. Stored outputs are written.
+#define DIOUM_REACTION_OP_LOAD_INPUT		0x01	// R[Destination] = Inputs[Source]
+#define DIOUM_REACTION_OP_LOAD_STATE		0x02	// R[Destination] = States[Source]
+#define DIOUM_REACTION_OP_STORE_STATE		0x03	// States[Destination] = R[Source]
+#define DIOUM_REACTION_OP_STORE_OUTPUT		0x04	// Outputs[Destination] = R[Source]
+#define DIOUM_REACTION_OP_MOVE				0x05	// R[Destination] = operand
+#define DIOUM_REACTION_OP_AND				0x06	// R[Destination] &= operand
+#define DIOUM_REACTION_OP_OR				0x07	// R[Destination] |= operand
+#define DIOUM_REACTION_OP_XOR				0x08	// R[Destination] ^= operand
+#define DIOUM_REACTION_OP_ADD				0x09	// R[Destination] += operand
+#define DIOUM_REACTION_OP_SUB				0x0a	// R[Destination] -= operand
+#define DIOUM_REACTION_OP_SHL				0x0b	// R[Destination] <<= operand & 31
+#define DIOUM_REACTION_OP_SHR				0x0c	// R[Destination] >>= operand & 31
+#define DIOUM_REACTION_OP_LESS				0x0d	// R[Destination] = R[Destination] < operand (unsigned)
+#define DIOUM_REACTION_OP_JUMP				0x0e	// Jumps by Immediate, from the next instruction
+#define DIOUM_REACTION_OP_JUMP_ZERO			0x0f	// Jumps by Immediate if R[Destination] == 0
+#define DIOUM_REACTION_OP_JUMP_NOT_ZERO		0x10	// Jumps by Immediate if R[Destination] != 0
+#define DIOUM_REACTION_OP_IMMEDIATE			0x80	// Operand is Immediate (MOVE ~ LESS only).
+
+typedef struct _DIOUM_REACTION_INSTRUCTION {
+	UCHAR Opcode;					// DIOUM_REACTION_OP_XXX, with DIOUM_REACTION_OP_IMMEDIATE.
+	UCHAR Destination;				// Register, state or output index.
+	UCHAR Source;					// Register, state or input index.
+	UCHAR Reserved;					// Must be zero.
+	LONG Immediate;					// Operand, or jump distance.
+} DIOUM_REACTION_INSTRUCTION;
+
+typedef struct _DIOUM_REACTION_PORT {
+	USHORT Port;					// Port address.
+	UCHAR Mask;						// Input: bits which trigger DIOUM_REACTION_TRIGGER_CHANGE. Output: bits to write.
+	UCHAR Reserved;
+} DIOUM_REACTION_PORT;
+
+typedef struct _DIOUM_REACTION_PROGRAM {
+	ULONG Trigger;					// DIOUM_REACTION_TRIGGER_XXX.
+	ULONG StepLimit;				// Maximum steps of a run. Required if the program jumps backward.
+	ULONG InputCount;				// Count of Inputs (0 ~ DIOUM_REACTION_MAXIMUM_PORTS).
+	ULONG OutputCount;				// Count of Outputs (0 ~ DIOUM_REACTION_MAXIMUM_PORTS).
+	ULONG InstructionCount;			// Count of Instructions (1 ~ DIOUM_REACTION_MAXIMUM_INSTRUCTIONS).
+	DIOUM_REACTION_PORT Inputs[DIOUM_REACTION_MAXIMUM_PORTS];
+	DIOUM_REACTION_PORT Outputs[DIOUM_REACTION_MAXIMUM_PORTS];
+	DIOUM_REACTION_INSTRUCTION *Instructions;
+} DIOUM_REACTION_PROGRAM;
+
+typedef struct _DIOUM_REACTION_STATISTICS {
+	ULONG Loaded;					// Non-zero if the slot has a program.
+	ULONG InstructionCount;			// Count of instructions.
+	ULONG StepLimit;				// Maximum steps of a run which the verifier allowed.
+	ULONG MaximumSteps;				// Largest steps of a run.
+	ULONG Faults;					// Runs aborted by the step limit.
+	ULONG Reserved;
+	ULONGLONG Runs;					// Count of runs.
+	ULONGLONG TotalTime;			// Sum of the run time in nanoseconds, including the port accesses.
+	ULONGLONG MaximumTime;			// Largest run time in nanoseconds.
+} DIOUM_REACTION_STATISTICS;
+
+typedef struct _DIOUM_REACTOR_STATUS {
+	ULONG Running;					// Non-zero if the ticks are running.
+	ULONG MissedTicks;				// Ticks which the reactor could not keep up with.
+	ULONGLONG Ticks;				// Count of ticks.
+	DIOUM_REACTION_STATISTICS Programs[DIOUM_REACTION_MAXIMUM_PROGRAMS];	// Indexed by the program id.
+} DIOUM_REACTOR_STATUS;
+
+// Limits of the submission ring. Count of entries is a power of two. Completion ring has twice as many.
+#define DIOUM_RING_MINIMUM_ENTRIES			16
+#define DIOUM_RING_MAXIMUM_ENTRIES			4096
+#define DIOUM_RING_MAXIMUM_IDLE_TIME		1000000
+
+// Polling thread of the ring may run on any processor.
+#define DIOUM_RING_ANY_PROCESSOR			0xffffffff
+
+// Driver thread polls the submissions, instead of DioRingSubmit() running them.
+#define DIOUM_RING_FLAG_POLL				0x00000001
+
+// Operations of the submission. Bits are in the caller's domain (XOR masks applied).
+#define DIOUM_RING_OP_NOP					0x00
+#define DIOUM_RING_OP_READ					0x01	// Data of the completion = Port
+#define DIOUM_RING_OP_WRITE					0x02	// Port = Data
+#define DIOUM_RING_OP_MODIFY				0x03	// Port = (Port & ~Mask) | (Data & Mask). Data of the completion = old Port
+
+// Status of the completion.
+#define DIOUM_RING_STATUS_SUCCESS			0x00
+#define DIOUM_RING_STATUS_INVALID_OPERATION	0x01
+#define DIOUM_RING_STATUS_ACCESS_DENIED		0x02	// Port is not claimed by the driver.
+
+typedef struct _DIOUM_RING_SUBMISSION {
+	ULONGLONG UserData;				// Copied to the completion.
+	USHORT Port;
+	UCHAR Operation;				// DIOUM_RING_OP_XXX.
+	UCHAR Data;
+	UCHAR Mask;						// Bits to change (MODIFY).
+	UCHAR Reserved[3];
+} DIOUM_RING_SUBMISSION;
+
+typedef struct _DIOUM_RING_COMPLETION {
+	ULONGLONG UserData;				// UserData of the submission.
+	UCHAR Status;					// DIOUM_RING_STATUS_XXX.
+	UCHAR Operation;				// Operation of the submission.
+	UCHAR Data;						// Value read (READ and MODIFY).
+	UCHAR Reserved[5];
+} DIOUM_RING_COMPLETION;
+
+// Address modes of DioSetFileMode(). Offset of ReadFile/WriteFile is the port address.
+#define DIOUM_FILE_MODE_LINEAR				0	// Byte i goes to port (offset + i). Default.
+#define DIOUM_FILE_MODE_FIFO				1	// Every byte goes to the port at the offset.
+#define DIOUM_FILE_MODE_REPEAT				2	// Byte i goes to port (offset + i % Width).
+#define DIOUM_FILE_MAXIMUM_WIDTH			0x10000
+
+// Limit of the range set of DioStartSnapshot().
+#define DIOUM_SNAPSHOT_MAXIMUM_RANGES		16
+#define DIOUM_SNAPSHOT_MINIMUM_REFRESH_INTERVAL	10000	// Nanoseconds. Shorter intervals are raised to this.
+
+// Refresh thread of the snapshot may run on any processor.
+#define DIOUM_SNAPSHOT_ANY_PROCESSOR		0xffffffff
+
+typedef struct _DIOUM_SNAPSHOT_INFO {
+	LONGLONG Timestamp;				// Application clock (QueryPerformanceCounter) when the ports were read.
+	ULONGLONG SampleCount;			// Count of refreshes since the start.
+	ULONG Running;					// Non-zero while the ports are refreshed.
+	ULONG Retries;					// Times the read was repeated because the driver updated the page.
+} DIOUM_SNAPSHOT_INFO;
+
+// Port I/O worker may run on any processor.
+#define DIOUM_WORKER_ANY_PROCESSOR			0xffffffff
+#define DIOUM_WORKER_MAXIMUM_SPIN_TIME		1000000
+
+typedef struct _DIOUM_WORKER_STATUS {
+	ULONG Running;					// Non-zero if the worker runs.
+	ULONG MaximumBatch;				// Most requests which are run with one hold of the port lock.
+	ULONGLONG Requests;				// Requests which are run by the worker since the start.
+	ULONGLONG Batches;				// Holds of the port lock since the start.
+	ULONGLONG Wakeups;				// Times the worker is woken from the sleep.
+} DIOUM_WORKER_STATUS;
+
+// Longest name of DioCreateRangeSet(), without the terminating null.
+#define DIOUM_RANGE_SET_MAXIMUM_NAME_LENGTH	31
+
+// Data length of DioReadPortGroup() and DioWritePortGroup().
+#define DIOUM_GROUP_MAXIMUM_LENGTH			16
+
+// Burst of DioReadRangeSetBurst().
+#define DIOUM_BURST_FLAG_PLANAR				0x00000001	// Data of each range is contiguous over the frames.
+#define DIOUM_BURST_MAXIMUM_FRAMES			0x10000
+#define DIOUM_BURST_MAXIMUM_DATA_LENGTH		0x100000
+
+// Limits of DioReadPortDescriptors() and DioWritePortDescriptors().
+#define DIOUM_PORT_IO_MAXIMUM_DESCRIPTORS	4096
+#define DIOUM_PORT_IO_MAXIMUM_DATA_LENGTH	0x100000
+
+// Memory resources of DioQueryMemoryResources(), addressed by their index.
+#define DIOUM_MAXIMUM_MEMORY_RANGES			8
+#define DIOUM_MEMORY_RANGE_FLAG_MAPPABLE	0x00000001	// DioMapMemoryWindow() can map the resource.
+#define DIOUM_MEMORY_WINDOW_ALIGNMENT		0x1000
+
+typedef struct _DIOUM_MEMORY_RANGE {
+	ULONGLONG PhysicalAddress;		// Translated physical address of the resource.
+	ULONG Length;					// Length in bytes. Registers are at offsets 0 ~ Length - 1.
+	ULONG Flags;					// Combination of DIOUM_MEMORY_RANGE_FLAG_XXX.
+} DIOUM_MEMORY_RANGE;
+
+// Element i is one register access of Width bytes at Offset + i * Stride of the memory resource.
+// Elements are transferred Repeat times. Limits are those of DioReadPortDescriptors().
+typedef struct _DIOUM_MEMORY_DESCRIPTOR {
+	ULONG Offset;					// Byte offset of the first element. Multiple of Width.
+	ULONG Stride;					// Byte distance between the elements. Multiple of Width.
+	USHORT Count;					// Count of elements. Non-zero.
+	USHORT Width;					// 1, 2, 4 or 8. 8 needs the 64-bit driver.
+	USHORT Repeat;					// Times the elements are transferred. Non-zero.
+	USHORT Resource;				// Index of the memory resource.
+} DIOUM_MEMORY_DESCRIPTOR;
+
+// Length of the bit-plane of one channel for DioExtractBitPlanes().
+#define DIOUM_BIT_PLANE_LENGTH(_frame_cnt)			\
+	( ((_frame_cnt) + 7) / 8 )
+
+// Length of the packet header which must be reserved in front of the data for DioReadPortDirect().
+#define DIOUM_DIRECT_HEADER_LENGTH(_range_cnt)		\
+	( sizeof(ULONG) + (_range_cnt) * sizeof(DIOUM_PORT_RANGE) )
+
 
 #ifdef __cplusplus
 extern "C" {
@@ -46,6 +431,554 @@ DioWritePortMultiple(
 	IN ULONG BufferLength, 
 	OPTIONAL OUT ULONG *TransferredDataLength);
 
+BOOL
+APIENTRY
+DioReadPortScatter(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG EntryCount, 
+	IN DIOUM_SCATTER_ENTRY *Entries, 
+	OPTIONAL OUT ULONG *ReturnedDataLength);
+
+BOOL
+APIENTRY
+DioReadPortDirect(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG AddressRangeCount, 
+	IN DIOUM_PORT_RANGE *AddressRanges, 
+	IN OUT PUCHAR PacketBuffer, 
+	IN ULONG PacketBufferLength, 
+	OPTIONAL OUT PUCHAR *Data, 
+	OPTIONAL OUT ULONG *ReturnedDataLength);
+
+BOOL
+APIENTRY
+DioReadPortGroup(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG AddressRangeCount, 
+	IN DIOUM_PORT_RANGE *AddressRanges, 
+	OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT DIOUM_PORT_SKEW *Skew);
+
+BOOL
+APIENTRY
+DioWritePortGroup(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG AddressRangeCount, 
+	IN DIOUM_PORT_RANGE *AddressRanges, 
+	IN PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT DIOUM_PORT_SKEW *Skew);
+
+BOOL
+APIENTRY
+DioReadPortDescriptors(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG DescriptorCount, 
+	IN DIOUM_PORT_DESCRIPTOR *Descriptors, 
+	OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *ReturnedDataLength);
+
+BOOL
+APIENTRY
+DioWritePortDescriptors(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG DescriptorCount, 
+	IN DIOUM_PORT_DESCRIPTOR *Descriptors, 
+	IN PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *TransferredDataLength);
+
+BOOL
+APIENTRY
+DioWaitPortPattern(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN USHORT Port, 
+	IN UCHAR Mask, 
+	IN UCHAR Value, 
+	IN ULONG MaximumSpinTime, 
+	IN ULONG PollInterval, 
+	OPTIONAL IN DIOUM_PORT_RANGE *ReadRange, 
+	OPTIONAL OUT PUCHAR ReadBuffer, 
+	IN ULONG ReadBufferLength, 
+	OPTIONAL OUT DIOUM_WAIT_PATTERN_RESULT *WaitResult);
+
+BOOL
+APIENTRY
+DioStartEdgeEngine(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG SampleInterval, 
+	IN ULONG Processor, 
+	IN ULONG ChannelCount, 
+	IN DIOUM_CHANNEL *Channels, 
+	IN ULONG DecoderCount, 
+	OPTIONAL IN DIOUM_QUADRATURE_DECODER *Decoders);
+
+BOOL
+APIENTRY
+DioStopEdgeEngine(
+	IN DIOUM_DRIVER_CONTEXT *Context);
+
+BOOL
+APIENTRY
+DioQueryEdgeCounters(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OUT DIOUM_EDGE_COUNTERS *Counters);
+
+BOOL
+APIENTRY
+DioCreateRangeSet(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OPTIONAL IN PCSTR Name, 
+	IN ULONG AddressRangeCount, 
+	IN DIOUM_PORT_RANGE *AddressRanges, 
+	OPTIONAL IN UCHAR *ReadXorMasks, 
+	OPTIONAL IN UCHAR *WriteXorMasks, 
+	OUT DIOUM_RANGE_SET **RangeSet);
+
+BOOL
+APIENTRY
+DioDestroyRangeSet(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet);
+
+DIOUM_RANGE_SET *
+APIENTRY
+DioLookupRangeSet(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN PCSTR Name);
+
+BOOL
+APIENTRY
+DioGetRangeSetLayout(
+	IN DIOUM_RANGE_SET *RangeSet, 
+	IN ULONG RangeIndex, 
+	OPTIONAL OUT ULONG *Offset, 
+	OPTIONAL OUT ULONG *Length, 
+	OPTIONAL OUT ULONG *DataLength);
+
+BOOL
+APIENTRY
+DioReadRangeSet(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *ReturnedDataLength);
+
+BOOL
+APIENTRY
+DioWriteRangeSet(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	IN PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *TransferredDataLength);
+
+BOOL
+APIENTRY
+DioReadRangeSetBurst(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OPTIONAL IN DIOUM_RANGE_SET *RangeSet, 
+	IN ULONG FrameCount, 
+	IN ULONG Flags, 
+	OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT LONGLONG *Timestamps);
+
+
+// Skips the flush if no byte is changed since the last flush.
+#define DIOUM_FLUSH_SKIP_IF_CLEAN					0x000000001
+// Writes the whole range set instead of the dirty runs.
+#define DIOUM_FLUSH_ALL								0x000000002
+
+BOOL
+APIENTRY
+DioShadowWrite(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	IN ULONG Offset, 
+	IN PUCHAR Buffer, 
+	IN ULONG Length);
+
+BOOL
+APIENTRY
+DioShadowUpdateBits(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	IN ULONG Offset, 
+	IN UCHAR Mask, 
+	IN UCHAR Value);
+
+BOOL
+APIENTRY
+DioShadowRead(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	IN ULONG Offset, 
+	OUT PUCHAR Buffer, 
+	IN ULONG Length);
+
+BOOL
+APIENTRY
+DioFlushRangeSet(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RANGE_SET *RangeSet, 
+	IN ULONG Flags, 
+	OPTIONAL OUT ULONG *TransferredDataLength);
+
+BOOL
+APIENTRY
+DioSetRangeSetFreshness(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OPTIONAL IN DIOUM_RANGE_SET *RangeSet, 
+	IN ULONG Freshness);
+
+BOOL
+APIENTRY
+DioInvalidateRangeSet(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OPTIONAL IN DIOUM_RANGE_SET *RangeSet);
+
+BOOL
+APIENTRY
+DioRefreshRangeSet(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OPTIONAL IN DIOUM_RANGE_SET *RangeSet, 
+	OPTIONAL OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *ReturnedDataLength);
+
+BOOL
+APIENTRY
+DioQueryRangeSetStatistics(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OPTIONAL IN DIOUM_RANGE_SET *RangeSet, 
+	OPTIONAL OUT ULONGLONG *Hits, 
+	OPTIONAL OUT ULONGLONG *Misses, 
+	IN BOOL Reset);
+
+BOOL
+APIENTRY
+DioSetCombining(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG MaximumWindow);
+
+BOOL
+APIENTRY
+DioGetCombining(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OPTIONAL OUT ULONG *MaximumWindow, 
+	OPTIONAL OUT ULONG *CurrentWindow);
+
+BOOL
+APIENTRY
+DioCalibrateClock(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG SampleCount, 
+	OPTIONAL OUT LONGLONG *Offset, 
+	OPTIONAL OUT LONGLONG *Uncertainty);
+
+BOOL
+APIENTRY
+DioReadRangeSetEx(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OPTIONAL IN DIOUM_RANGE_SET *RangeSet, 
+	OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *ReturnedDataLength, 
+	OPTIONAL OUT DIOUM_IO_TIMESTAMP *Timestamp);
+
+BOOL
+APIENTRY
+DioWriteRangeSetEx(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OPTIONAL IN DIOUM_RANGE_SET *RangeSet, 
+	IN PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *TransferredDataLength, 
+	OPTIONAL OUT DIOUM_IO_TIMESTAMP *Timestamp);
+
+BOOL
+APIENTRY
+DioStartRecording(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN PCWSTR FileName, 
+	IN ULONG SegmentLength);
+
+BOOL
+APIENTRY
+DioStopRecording(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OPTIONAL OUT ULONG *DroppedRecords);
+
+// Waits until the recorded start time of each record. Replays as fast as possible otherwise.
+#define DIOUM_REPLAY_ORIGINAL_TIMING				0x000000001
+
+BOOL
+APIENTRY
+DioReplayLog(
+	OPTIONAL IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN PCWSTR FileName, 
+	IN ULONG Flags, 
+	OPTIONAL OUT DIOUM_REPLAY_STATISTICS *Statistics);
+
+BOOL
+APIENTRY
+DioCreateChannelMap(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OPTIONAL IN DIOUM_RANGE_SET *RangeSet, 
+	IN ULONG ChannelCount, 
+	IN DIOUM_CHANNEL *Channels, 
+	OUT DIOUM_CHANNEL_MAP **ChannelMap);
+
+BOOL
+APIENTRY
+DioDestroyChannelMap(
+	IN DIOUM_CHANNEL_MAP *ChannelMap);
+
+BOOL
+APIENTRY
+DioExtractChannels(
+	IN DIOUM_CHANNEL_MAP *ChannelMap, 
+	IN PUCHAR Frames, 
+	IN ULONG FrameCount, 
+	IN ULONG FrameStride, 
+	OUT PUCHAR Values);
+
+BOOL
+APIENTRY
+DioExtractBitPlanes(
+	IN DIOUM_CHANNEL_MAP *ChannelMap, 
+	IN PUCHAR Frames, 
+	IN ULONG FrameCount, 
+	IN ULONG FrameStride, 
+	OUT PUCHAR Planes);
+
+BOOL
+APIENTRY
+DioPackChannels(
+	IN DIOUM_CHANNEL_MAP *ChannelMap, 
+	IN PUCHAR Values, 
+	IN ULONG FrameCount, 
+	IN ULONG FrameStride, 
+	IN OUT PUCHAR Frames);
+
+BOOL
+APIENTRY
+DioStartStream(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OPTIONAL IN DIOUM_RANGE_SET *RangeSet, 
+	IN ULONG TickInterval, 
+	IN ULONG Processor, 
+	IN ULONG FrameCapacity, 
+	IN ULONG Flags);
+
+BOOL
+APIENTRY
+DioWriteStream(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN PUCHAR Frames, 
+	IN ULONG FrameCount, 
+	IN ULONG Timeout, 
+	OPTIONAL OUT ULONG *WrittenFrames);
+
+BOOL
+APIENTRY
+DioStopStream(
+	IN DIOUM_DRIVER_CONTEXT *Context);
+
+BOOL
+APIENTRY
+DioQueryStream(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OUT DIOUM_STREAM_STATUS *Status);
+
+BOOL
+APIENTRY
+DioStartScheduler(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG Capacity, 
+	IN ULONG Processor);
+
+BOOL
+APIENTRY
+DioStopScheduler(
+	IN DIOUM_DRIVER_CONTEXT *Context);
+
+BOOL
+APIENTRY
+DioScheduleOutput(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG EntryCount, 
+	IN DIOUM_SCHEDULE_ENTRY *Entries, 
+	OPTIONAL OUT ULONG *AcceptedCount);
+
+BOOL
+APIENTRY
+DioQueryScheduler(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OUT DIOUM_SCHEDULER_STATUS *Status, 
+	OPTIONAL OUT DIOUM_SCHEDULE_RECORD *Records, 
+	IN ULONG MaximumRecordCount);
+
+BOOL
+APIENTRY
+DioLoadReaction(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_REACTION_PROGRAM *Program, 
+	OUT ULONG *Id);
+
+BOOL
+APIENTRY
+DioUnloadReaction(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG Id);
+
+BOOL
+APIENTRY
+DioStartReactor(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG TickInterval, 
+	IN ULONG Processor);
+
+BOOL
+APIENTRY
+DioStopReactor(
+	IN DIOUM_DRIVER_CONTEXT *Context);
+
+BOOL
+APIENTRY
+DioQueryReactor(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OUT DIOUM_REACTOR_STATUS *Status);
+
+BOOL
+APIENTRY
+DioCreateRing(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG SubmissionEntries, 
+	IN ULONG Flags, 
+	IN ULONG Processor, 
+	IN ULONG IdleTime);
+
+BOOL
+APIENTRY
+DioDestroyRing(
+	IN DIOUM_DRIVER_CONTEXT *Context);
+
+BOOL
+APIENTRY
+DioRingSubmit(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN DIOUM_RING_SUBMISSION *Submissions, 
+	IN ULONG SubmissionCount, 
+	OPTIONAL OUT ULONG *SubmittedCount);
+
+BOOL
+APIENTRY
+DioRingReap(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OUT DIOUM_RING_COMPLETION *Completions, 
+	IN ULONG MaximumCount, 
+	OUT ULONG *CompletionCount);
+
+BOOL
+APIENTRY
+DioStartSnapshot(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OPTIONAL IN DIOUM_RANGE_SET *RangeSet, 
+	IN ULONG RefreshInterval, 
+	IN ULONG Processor);
+
+BOOL
+APIENTRY
+DioStopSnapshot(
+	IN DIOUM_DRIVER_CONTEXT *Context);
+
+BOOL
+APIENTRY
+DioReadSnapshot(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT DIOUM_SNAPSHOT_INFO *Info);
+
+BOOL
+APIENTRY
+DioQueryMemoryResources(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OUT DIOUM_MEMORY_RANGE *Ranges, 
+	IN ULONG MaximumCount, 
+	OUT ULONG *RangeCount);
+
+BOOL
+APIENTRY
+DioReadMemoryDescriptors(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG DescriptorCount, 
+	IN DIOUM_MEMORY_DESCRIPTOR *Descriptors, 
+	OUT PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *ReturnedDataLength);
+
+BOOL
+APIENTRY
+DioWriteMemoryDescriptors(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG DescriptorCount, 
+	IN DIOUM_MEMORY_DESCRIPTOR *Descriptors, 
+	IN PUCHAR Buffer, 
+	IN ULONG BufferLength, 
+	OPTIONAL OUT ULONG *TransferredDataLength);
+
+BOOL
+APIENTRY
+DioMapMemoryWindow(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG Resource, 
+	IN ULONG Offset, 
+	IN ULONG Length, 
+	OUT PVOID *Address, 
+	OPTIONAL OUT ULONG *MappedLength);
+
+BOOL
+APIENTRY
+DioUnmapMemoryWindow(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG Resource);
+
+BOOL
+APIENTRY
+DioStartPortWorker(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG Processor, 
+	IN ULONG SpinTime);
+
+BOOL
+APIENTRY
+DioStopPortWorker(
+	IN DIOUM_DRIVER_CONTEXT *Context);
+
+BOOL
+APIENTRY
+DioQueryPortWorker(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	OUT DIOUM_WORKER_STATUS *Status);
+
+BOOL
+APIENTRY
+DioSetFileMode(
+	IN DIOUM_DRIVER_CONTEXT *Context, 
+	IN ULONG Mode, 
+	IN ULONG Width);
+
+HANDLE
+APIENTRY
+DioGetFileHandle(
+	IN DIOUM_DRIVER_CONTEXT *Context);
+
 BOOL
 APIENTRY
 DioGetXorMask(
@@ -65,6 +998,7 @@ DioSetXorMask(
 
 // Same as DIO_CFGB_XXX.
 #define DIOUM_CFGB_SHOW_DEBUG_OUTPUT				0x000000001
+#define DIOUM_CFGB_DISABLE_FAST_IO					0x000000004
 
 BOOL
 APIENTRY
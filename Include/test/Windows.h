@@ -0,0 +1,40 @@
+#pragma once
+
+//
+// Base types of Windows.h for the user-mode test of the ring protocol.
+//
+// ring_test.c includes <Windows.h>, and this file is found first through the include path of the
+// test Makefile. Only the types and the routines which dioring.h and the test use are provided.
+//
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define IN
+#define OUT
+#define OPTIONAL
+
+#define VOID						void
+typedef char						CHAR;
+typedef int32_t						LONG;
+typedef int64_t						LONGLONG;
+typedef unsigned char				UCHAR;
+typedef unsigned short				USHORT;
+typedef uint32_t					ULONG;
+typedef uint64_t					ULONGLONG;
+typedef void						*PVOID;
+typedef UCHAR						BOOLEAN;
+typedef UCHAR						*PUCHAR;
+
+#define TRUE						1
+#define FALSE						0
+
+#define ARRAYSIZE(_a)				( sizeof(_a) / sizeof((_a)[0]) )
+
+#define InterlockedOr(_p, _v)		__atomic_fetch_or((_p), (_v), __ATOMIC_SEQ_CST)
+#define InterlockedAnd(_p, _v)		__atomic_fetch_and((_p), (_v), __ATOMIC_SEQ_CST)
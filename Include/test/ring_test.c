@@ -0,0 +1,633 @@
+
+#include <Windows.h>
+#include "../dioring.h"
+
+//
+// Stress test of the ring protocol of dioring.h.
+//
+// A pthread consumer plays the polling thread of the driver (DiopRingThread) against 256 emulated
+// ports, and the main thread is the producer of DIOUM (DioRingSubmit, DioRingReap). UserData is the
+// sequence number of the submission, so the producer checks the order and the data of every
+// completion against its own model of the ports.
+//
+
+#define TEST_PORT_BASE			0x300
+#define TEST_PORT_COUNT			256
+#define TEST_WAIT_TIMEOUT		1			// Seconds which a sleeping consumer waits for the doorbell.
+#define TEST_STALL_TIMEOUT		10			// Seconds without progress which fail the stress test.
+
+#define CHECK(_e)				\
+	do { if (!(_e)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #_e); Failures++; } } while (0)
+
+/**
+ *	@brief	Consumer thread and the emulated ports.
+ */
+typedef struct _TEST_RING {
+	DIO_RING_CONSUMER Consumer;
+	DIO_RING_PRODUCER Producer;
+	PVOID Memory;
+	pthread_t Thread;
+	pthread_mutex_t Lock;
+	pthread_cond_t Condition;
+	BOOLEAN Signaled;				// Doorbell, an auto-reset event like the one of the driver.
+	volatile BOOLEAN StopRequested;
+	ULONG IdleSpins;				// Empty polls before the consumer sleeps.
+	UCHAR Ports[TEST_PORT_COUNT];	// Written by the consumer only.
+	volatile ULONG Sleeps;
+	volatile ULONG EmptyPolls;		// Polls which ran no submission.
+	volatile ULONG LostWakeups;		// Sleeps which timed out with a submission pending.
+} TEST_RING;
+
+static ULONG Failures;
+static ULONGLONG RandomState = 0x2545f4914f6cdd1dULL;
+
+
+static
+ULONG
+Random(
+	VOID)
+{
+	// xorshift64*, so the runs are reproducible.
+	RandomState ^= RandomState >> 12;
+	RandomState ^= RandomState << 25;
+	RandomState ^= RandomState >> 27;
+
+	return (ULONG)((RandomState * 0x2545f4914f6cdd1dULL) >> 32);
+}
+
+static
+UCHAR
+Execute(
+	IN PVOID Context, 
+	IN DIO_RING_SUBMISSION *Submission, 
+	OUT UCHAR *Data)
+/**
+ *	@brief	Runs one submission against the emulated ports, as DiopRunRingSubmission does.
+ */
+{
+	TEST_RING *Ring = (TEST_RING *)Context;
+	UCHAR *Port;
+
+	if (Submission->Port < TEST_PORT_BASE || Submission->Port >= TEST_PORT_BASE + TEST_PORT_COUNT)
+		return DIO_RING_STATUS_ACCESS_DENIED;
+
+	Port = &Ring->Ports[Submission->Port - TEST_PORT_BASE];
+
+	switch (Submission->Operation)
+	{
+	case DIO_RING_OP_READ:
+		*Data = *Port;
+		break;
+
+	case DIO_RING_OP_WRITE:
+		*Port = Submission->Data;
+		break;
+
+	case DIO_RING_OP_MODIFY:
+		*Data = *Port;
+		*Port = (UCHAR)((*Port & ~Submission->Mask) | (Submission->Data & Submission->Mask));
+		break;
+	}
+
+	return DIO_RING_STATUS_SUCCESS;
+}
+
+static
+VOID
+RingDoorbell(
+	IN TEST_RING *Ring)
+{
+	pthread_mutex_lock(&Ring->Lock);
+	Ring->Signaled = TRUE;
+	pthread_cond_signal(&Ring->Condition);
+	pthread_mutex_unlock(&Ring->Lock);
+}
+
+static
+BOOLEAN
+WaitDoorbell(
+	IN TEST_RING *Ring)
+/**
+ *	@brief	Waits for the doorbell and resets it. Returns FALSE on the timeout.
+ */
+{
+	struct timespec Deadline;
+	int Error = 0;
+
+	clock_gettime(CLOCK_REALTIME, &Deadline);
+	Deadline.tv_sec += TEST_WAIT_TIMEOUT;
+
+	pthread_mutex_lock(&Ring->Lock);
+
+	while (!Ring->Signaled && !Error)
+		Error = pthread_cond_timedwait(&Ring->Condition, &Ring->Lock, &Deadline);
+
+	Ring->Signaled = FALSE;
+	pthread_mutex_unlock(&Ring->Lock);
+
+	return (BOOLEAN)!Error;
+}
+
+static
+PVOID
+ConsumerThread(
+	IN PVOID Context)
+/**
+ *	@brief	Polls the submission ring and sleeps after IdleSpins empty polls, as DiopRingThread does.
+ */
+{
+	TEST_RING *Ring = (TEST_RING *)Context;
+	DIO_RING_CONSUMER *Consumer = &Ring->Consumer;
+	volatile ULONG *Flags = &Consumer->Shared->Flags;
+	ULONG Idle = 0;
+
+	while (!Ring->StopRequested)
+	{
+		if (DioRingConsume(Consumer, Consumer->SubmissionEntries, Execute, Ring))
+		{
+			Idle = 0;
+			continue;
+		}
+
+		Ring->EmptyPolls++;
+
+		// Yields instead of YieldProcessor(), so the producer runs on a single processor as well.
+		if (!Consumer->Corrupted && Idle++ < Ring->IdleSpins)
+		{
+			sched_yield();
+			continue;
+		}
+
+		InterlockedOr(Flags, DIO_RING_FLAG_NEED_WAKEUP);
+
+		if (Consumer->Corrupted || !DioRingConsumerHasWork(Consumer))
+		{
+			Ring->Sleeps++;
+
+			// Producer checks the flag after it publishes, so a timeout with work pending is a lost wakeup.
+			if (!WaitDoorbell(Ring) && !Ring->StopRequested && DioRingConsumerHasWork(Consumer))
+				Ring->LostWakeups++;
+		}
+
+		InterlockedAnd(Flags, ~DIO_RING_FLAG_NEED_WAKEUP);
+		Idle = 0;
+	}
+
+	return NULL;
+}
+
+static
+BOOLEAN
+CreateRing(
+	OUT TEST_RING *Ring, 
+	IN ULONG SubmissionEntries, 
+	IN ULONG IdleSpins)
+{
+	ULONG Length = DioRingGetLength(SubmissionEntries);
+
+	memset(Ring, 0, sizeof(*Ring));
+
+	Ring->Memory = aligned_alloc(64, (Length + 63) & ~63);
+	if (!Ring->Memory)
+		return FALSE;
+
+	memset(Ring->Memory, 0, Length);
+	DioRingConsumerInitialize(&Ring->Consumer, Ring->Memory, SubmissionEntries);
+
+	if (!DioRingProducerInitialize(&Ring->Producer, Ring->Memory, Length))
+	{
+		free(Ring->Memory);
+		return FALSE;
+	}
+
+	Ring->IdleSpins = IdleSpins;
+	pthread_mutex_init(&Ring->Lock, NULL);
+	pthread_cond_init(&Ring->Condition, NULL);
+
+	return TRUE;
+}
+
+static
+VOID
+StartConsumer(
+	IN OUT TEST_RING *Ring)
+{
+	pthread_create(&Ring->Thread, NULL, ConsumerThread, Ring);
+}
+
+static
+VOID
+DestroyRing(
+	IN OUT TEST_RING *Ring)
+{
+	if (Ring->Thread)
+	{
+		Ring->StopRequested = TRUE;
+		RingDoorbell(Ring);
+		pthread_join(Ring->Thread, NULL);
+	}
+
+	pthread_cond_destroy(&Ring->Condition);
+	pthread_mutex_destroy(&Ring->Lock);
+	free(Ring->Memory);
+}
+
+static
+VOID
+RandomSubmission(
+	OUT DIO_RING_SUBMISSION *Submission, 
+	IN ULONGLONG Sequence)
+/**
+ *	@brief	Makes a random operation. A few of them are invalid or on a port which is not claimed.
+ */
+{
+	ULONG Value = Random();
+
+	memset(Submission, 0, sizeof(*Submission));
+	Submission->UserData = Sequence;
+	Submission->Port = (USHORT)(TEST_PORT_BASE + (Value & 0xff));
+	Submission->Operation = (UCHAR)(DIO_RING_OP_READ + (Value >> 8) % 3);
+	Submission->Data = (UCHAR)(Value >> 16);
+	Submission->Mask = (UCHAR)(Value >> 24);
+
+	if (Value % 97 == 0)
+		Submission->Operation = (UCHAR)(DIO_RING_OP_MAXIMUM + 1 + Value % 200);
+	else if (Value % 89 == 0)
+		Submission->Port = (USHORT)(TEST_PORT_BASE - 1 - Value % 0x100);
+	else if (Value % 83 == 0)
+		Submission->Operation = DIO_RING_OP_NOP;
+}
+
+static
+BOOLEAN
+CheckCompletion(
+	IN OUT UCHAR *Ports, 
+	IN DIO_RING_SUBMISSION *Submission, 
+	IN DIO_RING_COMPLETION *Completion)
+/**
+ *	@brief	Checks the completion against the model of the ports, and applies the submission to it.
+ */
+{
+	UCHAR *Port;
+	UCHAR Status = DIO_RING_STATUS_SUCCESS;
+	UCHAR Data = 0;
+
+	if (Submission->Operation > DIO_RING_OP_MAXIMUM)
+		Status = DIO_RING_STATUS_INVALID_OPERATION;
+	else if (Submission->Operation != DIO_RING_OP_NOP)
+	{
+		if (Submission->Port < TEST_PORT_BASE || Submission->Port >= TEST_PORT_BASE + TEST_PORT_COUNT)
+			Status = DIO_RING_STATUS_ACCESS_DENIED;
+		else
+		{
+			Port = &Ports[Submission->Port - TEST_PORT_BASE];
+
+			if (Submission->Operation != DIO_RING_OP_WRITE)
+				Data = *Port;
+
+			if (Submission->Operation == DIO_RING_OP_WRITE)
+				*Port = Submission->Data;
+			else if (Submission->Operation == DIO_RING_OP_MODIFY)
+				*Port = (UCHAR)((*Port & ~Submission->Mask) | (Submission->Data & Submission->Mask));
+		}
+	}
+
+	return (BOOLEAN)(Completion->UserData == Submission->UserData && 
+		Completion->Status == Status && 
+		Completion->Operation == Submission->Operation && 
+		Completion->Data == Data);
+}
+
+static
+VOID
+TestStress(
+	IN ULONG SubmissionEntries, 
+	IN ULONG OperationCount)
+/**
+ *	@brief	Producer and consumer threads run OperationCount random operations through the ring.
+ *	
+ *	Submissions are kept by their sequence number until the completion is checked, so a
+ *	completion which is lost, duplicated, reordered or torn fails the test.
+ */
+{
+	TEST_RING Ring;
+	DIO_RING_SUBMISSION *Submitted;
+	DIO_RING_SUBMISSION Submission;
+	DIO_RING_COMPLETION Completions[64];
+	UCHAR Ports[TEST_PORT_COUNT];
+	ULONGLONG Produced = 0;
+	ULONGLONG Reaped = 0;
+	ULONGLONG Progress;
+	time_t LastProgress = time(NULL);
+	ULONG Mask = SubmissionEntries * 4 - 1;
+	ULONG Count;
+	ULONG Batch;
+	ULONG Errors = 0;
+	ULONG i;
+
+	// Submissions in flight are bounded by both rings, three times the submission entries.
+	Submitted = (DIO_RING_SUBMISSION *)malloc((Mask + 1) * sizeof(*Submitted));
+	CHECK(Submitted && CreateRing(&Ring, SubmissionEntries, 1000));
+	memset(Ports, 0, sizeof(Ports));
+
+	StartConsumer(&Ring);
+
+	while (Reaped < OperationCount)
+	{
+		Batch = 1 + Random() % SubmissionEntries;
+		Progress = Produced + Reaped;
+
+		for (i = 0; i < Batch && Produced < OperationCount && Produced - Reaped <= Mask; i++)
+		{
+			RandomSubmission(&Submission, Produced);
+
+			if (!DioRingProducerPrepare(&Ring.Producer, &Submission))
+				break;
+
+			Submitted[Produced++ & Mask] = Submission;
+		}
+
+		if (DioRingProducerSubmit(&Ring.Producer) && DioRingProducerNeedsWakeup(&Ring.Producer))
+			RingDoorbell(&Ring);
+
+		// Completions are left behind now and then, so the consumer fills the completion ring.
+		do
+		{
+			if (Random() % 4 == 0)
+				break;
+
+			Count = DioRingProducerReap(&Ring.Producer, Completions, 1 + Random() % ARRAYSIZE(Completions));
+
+			for (i = 0; i < Count; i++, Reaped++)
+			{
+				if (!CheckCompletion(Ports, &Submitted[Reaped & Mask], &Completions[i]))
+					Errors++;
+			}
+
+			// Consumer sleeps on the full completion ring until it is told about the space.
+			if (Count && DioRingProducerNeedsWakeupAfterReap(&Ring.Producer))
+				RingDoorbell(&Ring);
+		} while (Count);
+
+		// Ring is full and nothing is done yet. Consumer may need this processor.
+		if (Produced + Reaped != Progress)
+			LastProgress = time(NULL);
+		else if (time(NULL) - LastProgress < TEST_STALL_TIMEOUT)
+			sched_yield();
+		else
+		{
+			CHECK(!"stalled");
+			break;
+		}
+	}
+
+	DestroyRing(&Ring);
+
+	CHECK(Errors == 0);
+	CHECK(Ring.LostWakeups == 0);
+	CHECK(!Ring.Consumer.Corrupted);
+	CHECK(!memcmp(Ports, Ring.Ports, sizeof(Ports)));
+
+	free(Submitted);
+}
+
+static
+VOID
+TestForgedTail(
+	VOID)
+/**
+ *	@brief	Invalid Tail and Head which a broken peer publishes are detected on both sides.
+ */
+{
+	TEST_RING Ring;
+	DIO_RING_SUBMISSION Submission;
+	DIO_RING_COMPLETION Completions[16];
+	ULONG i;
+
+	CHECK(CreateRing(&Ring, 16, 0));
+
+	// Full ring is valid.
+	for (i = 0; i < 16; i++)
+	{
+		RandomSubmission(&Submission, i);
+		CHECK(DioRingProducerPrepare(&Ring.Producer, &Submission));
+	}
+
+	CHECK(!DioRingProducerPrepare(&Ring.Producer, &Submission));
+	CHECK(DioRingProducerSubmit(&Ring.Producer) == 16);
+	CHECK(DioRingConsume(&Ring.Consumer, 100, Execute, &Ring) == 16);
+	CHECK(DioRingProducerReap(&Ring.Producer, Completions, 16) == 16);
+
+	// Tail beyond the entries, and behind Head.
+	Ring.Consumer.Shared->Submission.Tail = Ring.Consumer.SubmissionHead + 17;
+	CHECK(DioRingConsume(&Ring.Consumer, 100, Execute, &Ring) == 0);
+	CHECK(Ring.Consumer.Corrupted);
+	CHECK(DioRingConsumerHasWork(&Ring.Consumer));
+
+	// Stopped ring stays stopped after the Tail is valid again.
+	Ring.Consumer.Shared->Submission.Tail = Ring.Consumer.SubmissionHead + 1;
+	CHECK(DioRingConsume(&Ring.Consumer, 100, Execute, &Ring) == 0);
+	CHECK(Ring.Consumer.Shared->Submission.Head == 16);
+
+	Ring.Consumer.Corrupted = FALSE;
+	Ring.Consumer.Shared->Submission.Tail = Ring.Consumer.SubmissionHead - 1;
+	CHECK(DioRingConsume(&Ring.Consumer, 100, Execute, &Ring) == 0);
+	CHECK(Ring.Consumer.Corrupted);
+
+	// Forged Head of the consumer and Tail of the completions on the producer side.
+	Ring.Consumer.Shared->Submission.Head = Ring.Producer.SubmissionTail + 1;
+	CHECK(!DioRingProducerPrepare(&Ring.Producer, &Submission));
+
+	Ring.Consumer.Shared->Completion.Tail = Ring.Producer.CompletionHead + 33;
+	CHECK(DioRingProducerReap(&Ring.Producer, Completions, 16) == 0);
+	CHECK(Ring.Producer.CompletionHead == 16);
+
+	// Geometry which the producer does not accept.
+	Ring.Consumer.Shared->SubmissionEntries = 24;
+	CHECK(!DioRingProducerInitialize(&Ring.Producer, Ring.Memory, DioRingGetLength(16)));
+
+	Ring.Consumer.Shared->SubmissionEntries = 16;
+	Ring.Consumer.Shared->CompletionOffset = DioRingGetLength(16) - 8;
+	CHECK(!DioRingProducerInitialize(&Ring.Producer, Ring.Memory, DioRingGetLength(16)));
+
+	Ring.Consumer.Shared->CompletionOffset = sizeof(DIO_RING_SHARED) + 16 * sizeof(DIO_RING_SUBMISSION);
+	CHECK(!DioRingProducerInitialize(&Ring.Producer, Ring.Memory, DioRingGetLength(16) - 1));
+	CHECK(DioRingProducerInitialize(&Ring.Producer, Ring.Memory, DioRingGetLength(16)));
+
+	DestroyRing(&Ring);
+}
+
+static
+VOID
+TestFullCompletion(
+	VOID)
+/**
+ *	@brief	Consumer sleeps while the completion ring is full, and the reap which makes space wakes it.
+ *	
+ *	Completion ring holds two rings of submissions, so the third ring waits for the space.
+ */
+{
+	TEST_RING Ring;
+	DIO_RING_SUBMISSION Submitted[48];
+	DIO_RING_COMPLETION Completions[48];
+	UCHAR Ports[TEST_PORT_COUNT];
+	struct timespec Delay = { 0, 100000000 };
+	time_t Start;
+	ULONG EmptyPolls;
+	ULONG Reaped = 0;
+	ULONG Errors = 0;
+	ULONG i;
+
+	CHECK(CreateRing(&Ring, 16, 0));
+	memset(Ports, 0, sizeof(Ports));
+
+	StartConsumer(&Ring);
+
+	for (i = 0; i < 48; i++)
+	{
+		RandomSubmission(&Submitted[i], i);
+		CHECK(DioRingProducerPrepare(&Ring.Producer, &Submitted[i]));
+
+		if (i % 16 != 15)
+			continue;
+
+		CHECK(DioRingProducerSubmit(&Ring.Producer) == 16);
+
+		if (DioRingProducerNeedsWakeup(&Ring.Producer))
+			RingDoorbell(&Ring);
+
+		// First two rings are run, and the submission ring is free again.
+		for (Start = time(NULL); i < 32 && Ring.Producer.Shared->Submission.Head != Ring.Producer.SubmissionTail; )
+		{
+			if (time(NULL) - Start >= TEST_STALL_TIMEOUT)
+			{
+				CHECK(!"stalled");
+				break;
+			}
+
+			sched_yield();
+		}
+	}
+
+	// Consumer goes to sleep instead of polling the full completion ring.
+	for (Start = time(NULL); !(Ring.Producer.Shared->Flags & DIO_RING_FLAG_NEED_WAKEUP); )
+	{
+		if (time(NULL) - Start >= TEST_STALL_TIMEOUT)
+			break;
+
+		sched_yield();
+	}
+
+	EmptyPolls = Ring.EmptyPolls;
+	nanosleep(&Delay, NULL);
+
+	CHECK(Ring.Producer.Shared->Flags & DIO_RING_FLAG_NEED_WAKEUP);
+	CHECK(Ring.EmptyPolls == EmptyPolls);
+	CHECK(Ring.Producer.Shared->Submission.Head == 32);
+
+	for (Start = time(NULL); Reaped < 48; )
+	{
+		i = DioRingProducerReap(&Ring.Producer, &Completions[Reaped], 48 - Reaped);
+		Reaped += i;
+
+		if (i && DioRingProducerNeedsWakeupAfterReap(&Ring.Producer))
+			RingDoorbell(&Ring);
+
+		if (time(NULL) - Start >= TEST_STALL_TIMEOUT)
+		{
+			CHECK(!"stalled");
+			break;
+		}
+
+		sched_yield();
+	}
+
+	DestroyRing(&Ring);
+
+	for (i = 0; i < Reaped; i++)
+	{
+		if (!CheckCompletion(Ports, &Submitted[i], &Completions[i]))
+			Errors++;
+	}
+
+	CHECK(Errors == 0);
+	CHECK(Ring.LostWakeups == 0);
+	CHECK(!memcmp(Ports, Ring.Ports, sizeof(Ports)));
+}
+
+static
+VOID
+TestWakeup(
+	IN ULONG OperationCount)
+/**
+ *	@brief	Consumer sleeps as soon as the ring is empty, and every submission wakes it up.
+ *	
+ *	Each operation is submitted alone and waited for, so the producer publishes while the consumer
+ *	is on its way to sleep as often as possible.
+ */
+{
+	TEST_RING Ring;
+	DIO_RING_SUBMISSION Submission;
+	DIO_RING_COMPLETION Completion;
+	UCHAR Ports[TEST_PORT_COUNT];
+	ULONG Doorbells = 0;
+	ULONG Errors = 0;
+	ULONG i;
+
+	CHECK(CreateRing(&Ring, 16, 0));
+	memset(Ports, 0, sizeof(Ports));
+
+	StartConsumer(&Ring);
+
+	// Each lost wakeup costs TEST_WAIT_TIMEOUT, so the first one ends the test.
+	for (i = 0; i < OperationCount && !Ring.LostWakeups; i++)
+	{
+		RandomSubmission(&Submission, i);
+
+		if (i % 7 == 3)
+			Submission.Operation = (UCHAR)(0x80 + i % 0x80);
+		else if (i % 5 == 1)
+			Submission.Port = (USHORT)(i % TEST_PORT_BASE);
+
+		CHECK(DioRingProducerPrepare(&Ring.Producer, &Submission));
+		CHECK(DioRingProducerSubmit(&Ring.Producer) == 1);
+
+		if (DioRingProducerNeedsWakeup(&Ring.Producer))
+		{
+			RingDoorbell(&Ring);
+			Doorbells++;
+		}
+
+		while (!DioRingProducerReap(&Ring.Producer, &Completion, 1))
+			sched_yield();
+
+		if (!CheckCompletion(Ports, &Submission, &Completion))
+			Errors++;
+	}
+
+	DestroyRing(&Ring);
+
+	CHECK(Errors == 0);
+	CHECK(Ring.LostWakeups == 0);
+	CHECK(Ring.Sleeps > 0 && Doorbells > 0);
+	CHECK(!memcmp(Ports, Ring.Ports, sizeof(Ports)));
+}
+
+int
+main(
+	VOID)
+{
+	static const ULONG Entries[] = { 16, 256, 4096 };
+	ULONG i;
+
+	for (i = 0; i < ARRAYSIZE(Entries); i++)
+		TestStress(Entries[i], 4000000);
+
+	TestForgedTail();
+	TestFullCompletion();
+	TestWakeup(300000);
+
+	printf("ring_test: %s\n", Failures ? "FAILED" : "passed");
+
+	return Failures ? 1 : 0;
+}